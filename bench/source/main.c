@@ -0,0 +1,245 @@
+/**
+ * main.c - Runs the libntfs benchmark suite on the first NTFS partition of a USB or SD device.
+ *
+ * The partition is modified; use one set aside for benchmarking.
+ *
+ * This program/include file is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program/include file is distributed in the hope that it will be
+ * useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <gctypes.h>
+#include <gccore.h>
+#include <wiiuse/wpad.h>
+#include <sdcard/wiisd_io.h>
+#include <ogc/usbstorage.h>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <ntfs.h>
+
+#include "workloads.h"
+
+/**
+ * bench_disc - A disc interface counting the commands sent on to a real one
+ */
+typedef struct _bench_disc {
+    DISC_INTERFACE iface;
+    DISC_INTERFACE *real;
+    bench_device_stats stats;
+    sec_t next;
+} bench_disc;
+
+static void *xfb = NULL;
+static GXRModeObj *rmode = NULL;
+
+static void bench_count (bench_disc *bd, sec_t sector, sec_t numSectors, const void *buffer, u64 start)
+{
+    // Count what the device was asked to do, as the file backed disc does on the host
+    if (sector != bd->next)
+        bd->stats.seeks++;
+    if ((uintptr_t)buffer & 31)
+        bd->stats.unaligned++;
+    bd->next = sector + numSectors;
+    bd->stats.deviceTime += ticks_to_nanosecs(diff_ticks(start, gettime()));
+}
+
+static bool bench_startup (DISC_INTERFACE *disc)
+{
+    bench_disc *bd = (bench_disc *) disc;
+
+    return bd->real->startup(bd->real);
+}
+
+static bool bench_is_inserted (DISC_INTERFACE *disc)
+{
+    bench_disc *bd = (bench_disc *) disc;
+
+    return bd->real->isInserted(bd->real);
+}
+
+static bool bench_read (DISC_INTERFACE *disc, sec_t sector, sec_t numSectors, void *buffer)
+{
+    bench_disc *bd = (bench_disc *) disc;
+    u64 start = gettime();
+    bool ret = bd->real->readSectors(bd->real, sector, numSectors, buffer);
+
+    bd->stats.reads++;
+    bd->stats.sectorsRead += numSectors;
+    bench_count(bd, sector, numSectors, buffer, start);
+    return ret;
+}
+
+static bool bench_write (DISC_INTERFACE *disc, sec_t sector, sec_t numSectors, const void *buffer)
+{
+    bench_disc *bd = (bench_disc *) disc;
+    u64 start = gettime();
+    bool ret = bd->real->writeSectors(bd->real, sector, numSectors, buffer);
+
+    bd->stats.writes++;
+    bd->stats.sectorsWritten += numSectors;
+    bench_count(bd, sector, numSectors, buffer, start);
+    return ret;
+}
+
+static bool bench_clear_status (DISC_INTERFACE *disc)
+{
+    bench_disc *bd = (bench_disc *) disc;
+
+    return bd->real->clearStatus(bd->real);
+}
+
+static bool bench_shutdown (DISC_INTERFACE *disc)
+{
+    bench_disc *bd = (bench_disc *) disc;
+
+    return bd->real->shutdown(bd->real);
+}
+
+static bool bench_flush (DISC_INTERFACE *disc)
+{
+    bench_disc *bd = (bench_disc *) disc;
+    u64 start = gettime();
+    bool ret = bd->real->flush ? bd->real->flush(bd->real) : true;
+
+    bd->stats.flushes++;
+    bd->stats.deviceTime += ticks_to_nanosecs(diff_ticks(start, gettime()));
+    return ret;
+}
+
+static void bench_reset_stats (DISC_INTERFACE *disc)
+{
+    bench_disc *bd = (bench_disc *) disc;
+
+    memset(&bd->stats, 0, sizeof(bd->stats));
+}
+
+static void bench_get_stats (DISC_INTERFACE *disc, bench_device_stats *stats)
+{
+    bench_disc *bd = (bench_disc *) disc;
+
+    *stats = bd->stats;
+}
+
+static void bench_wrap (bench_disc *bd, DISC_INTERFACE *real)
+{
+    memset(bd, 0, sizeof(bench_disc));
+    bd->iface = *real;
+    bd->iface.startup = bench_startup;
+    bd->iface.isInserted = bench_is_inserted;
+    bd->iface.readSectors = bench_read;
+    bd->iface.writeSectors = bench_write;
+    bd->iface.clearStatus = bench_clear_status;
+    bd->iface.shutdown = bench_shutdown;
+    bd->iface.flush = bench_flush;
+    bd->real = real;
+}
+
+static bool bench_save (DISC_INTERFACE *disc, const char *results, size_t size)
+{
+    ntfs_mount_opts opts;
+    sec_t *partitions = NULL;
+    FILE *file;
+    bool ret = false;
+
+    // Keep the results on the partition benchmarked, where they can be picked up from another machine
+    ntfsInitMountOptions(&opts);
+    if (ntfsFindPartitions(disc, &partitions) <= 0 || !ntfsMountEx("bench", disc, partitions[0], &opts)) {
+        free(partitions);
+        return false;
+    }
+    free(partitions);
+
+    file = fopen("bench:/bench/results.csv", "w");
+    if (file) {
+        ret = fwrite(results, 1, size, file) == size;
+        ret = (fclose(file) == 0) && ret;
+    }
+
+    ntfsUnmount("bench", true);
+    return ret;
+}
+
+//---------------------------------------------------------------------------------
+int main(int argc, char **argv) {
+//---------------------------------------------------------------------------------
+
+    DISC_INTERFACE *discs[] = { &__io_usbstorage, &__io_wiisd };
+    bench_config config;
+    bench_device device;
+    bench_disc bd;
+    char *results = NULL;
+    size_t size = 0;
+    FILE *out;
+    bool ok = false;
+    int i;
+
+    // Initialise the video system and the console, as the example does
+    VIDEO_Init();
+    WPAD_Init();
+    rmode = VIDEO_GetPreferredMode(NULL);
+    xfb = SYS_AllocateFramebuffer(rmode);
+    CON_Init(xfb, 0, 0, rmode->fbWidth, rmode->xfbHeight, rmode->fbWidth * VI_DISPLAY_PIX_SZ);
+    VIDEO_Configure(rmode);
+    VIDEO_SetNextFramebuffer(xfb);
+    VIDEO_SetBlack(false);
+    VIDEO_Flush();
+    VIDEO_WaitForFlush();
+
+    printf("\x1b[2;0H");
+    printf("\n");
+    printf(" NTFS Benchmark\n");
+    printf("\n");
+
+    // The standard suite, or the tests named by the loader (e.g. wiiload bench.dol seqread,cmpread)
+    benchInitConfig(&config);
+    config.format = BENCH_FORMAT_CSV;
+    config.opts.flags = NTFS_DEFAULT | NTFS_RECOVER;
+    if (argc > 1)
+        config.tests = argv[1];
+
+    // Run on the first device that is there, USB before SD
+    for (i = 0; i < sizeof(discs) / sizeof(discs[0]); i++) {
+        if (!discs[i]->startup(discs[i]) || !discs[i]->isInserted(discs[i]))
+            continue;
+
+        bench_wrap(&bd, discs[i]);
+        device.disc = &bd.iface;
+        device.resetStats = bench_reset_stats;
+        device.getStats = bench_get_stats;
+
+        out = open_memstream(&results, &size);
+        if (!out)
+            break;
+        ok = benchRun(&config, &device, out);
+        fclose(out);
+
+        printf("%s\n", results);
+        if (!bench_save(discs[i], results, size))
+            printf("Could not save the results to bench:/bench/results.csv\n");
+        free(results);
+        break;
+    }
+
+    if (i == sizeof(discs) / sizeof(discs[0]))
+        printf("No USB or SD device was found.\n");
+    printf(ok ? "Done, press HOME to quit.\n" : "Failed, press HOME to quit.\n");
+
+    while (1) {
+        WPAD_ScanPads();
+        if (WPAD_ButtonsDown(0) & WPAD_BUTTON_HOME)
+            break;
+        VIDEO_WaitVSync();
+    }
+
+    return ok ? 0 : 1;
+}
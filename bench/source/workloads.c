@@ -0,0 +1,707 @@
+/*
+ * workloads.c - The libntfs benchmark suite, shared by the console and host drivers.
+ *
+ * Every run works from a fixed random seed on a freshly mounted volume so that
+ * successive builds can be compared by the commands they send to the device as
+ * well as by the time they take.
+ *
+ * This program/include file is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program/include file is distributed in the hope that it will be
+ * useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/iosupport.h>
+
+#include "workloads.h"
+#include "ntfsinternal.h"
+#include "security.h"
+#include "mst.h"
+
+#define BENCH_MOUNT         "bench"
+#define BENCH_ROOT          BENCH_MOUNT ":/bench"
+#define BENCH_BIGFILE       BENCH_ROOT "/stream.bin"
+#define BENCH_SMALLDIR      BENCH_ROOT "/small"
+#define BENCH_BIGDIR        BENCH_ROOT "/large"
+#define BENCH_CMPDIR        BENCH_ROOT "/compressed"
+#define BENCH_CMPFILE       BENCH_CMPDIR "/text.bin"
+
+/* Phrases repeated by the data written to the compressed file, so that it compresses about as well as text */
+#define BENCH_PHRASES       32
+#define BENCH_PHRASE_SIZE   64
+
+/**
+ * bench_state - A mounted volume and what the benchmark has done to it so far
+ */
+typedef struct _bench_state {
+    const bench_config *config;
+    const bench_device *device;
+    const devoptab_t *dev;
+    struct _reent r;
+    u8 *buffer;
+    size_t chunkSize;
+    u64 rng;
+    u8 phrases[BENCH_PHRASES][BENCH_PHRASE_SIZE];
+} bench_state;
+
+typedef bool (*bench_fn) (bench_state *state, u64 *ops, u64 *bytes);
+
+static bool bench_mount (bench_state *state);
+
+static u64 bench_rand (bench_state *state)
+{
+    // xorshift64*, so that the same seed gives the same run everywhere
+    state->rng ^= state->rng >> 12;
+    state->rng ^= state->rng << 25;
+    state->rng ^= state->rng >> 27;
+    return state->rng * 0x2545F4914F6CDD1DULL;
+}
+
+static void bench_fill (bench_state *state, u8 *buffer, size_t size)
+{
+    size_t i;
+    u64 v;
+
+    for (i = 0; i + 8 <= size; i += 8) {
+        v = bench_rand(state);
+        memcpy(buffer + i, &v, 8);
+    }
+    for (; i < size; i++)
+        buffer[i] = (u8)bench_rand(state);
+}
+
+static void bench_fill_text (bench_state *state, u8 *buffer, size_t size)
+{
+    size_t i, len;
+
+    for (i = 0; i < size; i += len) {
+        len = size - i < BENCH_PHRASE_SIZE ? size - i : BENCH_PHRASE_SIZE;
+        memcpy(buffer + i, state->phrases[bench_rand(state) % BENCH_PHRASES], len);
+    }
+}
+
+static void *bench_open (bench_state *state, const char *path, int flags)
+{
+    void *file = calloc(1, state->dev->structSize);
+
+    if (file && state->dev->open_r(&state->r, file, path, flags, 0666) == -1) {
+        fprintf(stderr, "open %s: %s\n", path, strerror(state->r._errno));
+        free(file);
+        return NULL;
+    }
+
+    return file;
+}
+
+static bool bench_close (bench_state *state, void *file)
+{
+    bool ret = state->dev->close_r(&state->r, file) == 0;
+
+    free(file);
+    return ret;
+}
+
+static bool bench_mkdir (bench_state *state, const char *path)
+{
+    if (state->dev->mkdir_r(&state->r, path, 0777) == -1 && state->r._errno != EEXIST) {
+        fprintf(stderr, "mkdir %s: %s\n", path, strerror(state->r._errno));
+        return false;
+    }
+
+    return true;
+}
+
+static bool bench_rw (bench_state *state, void *file, u8 *buffer, size_t size, bool write)
+{
+    ssize_t ret;
+    size_t done = 0;
+
+    while (done < size) {
+        if (write)
+            ret = state->dev->write_r(&state->r, file, (const char *)buffer + done, size - done);
+        else
+            ret = state->dev->read_r(&state->r, file, (char *)buffer + done, size - done);
+        if (ret <= 0) {
+            fprintf(stderr, "%s: %s\n", write ? "write" : "read", ret < 0 ? strerror(state->r._errno) : "short transfer");
+            return false;
+        }
+        done += ret;
+    }
+
+    return true;
+}
+
+static bool bench_stream (bench_state *state, u64 *ops, u64 *bytes, const char *path, size_t size, bool write, bool text)
+{
+    size_t done, len;
+    void *file;
+
+    file = bench_open(state, path, write ? (O_RDWR | O_CREAT | O_TRUNC) : O_RDONLY);
+    if (!file)
+        return false;
+
+    for (done = 0; done < size; done += len) {
+        len = size - done < state->chunkSize ? size - done : state->chunkSize;
+        if (write && text)
+            bench_fill_text(state, state->buffer, len);
+        else if (write)
+            bench_fill(state, state->buffer, len);
+        if (!bench_rw(state, file, state->buffer, len, write)) {
+            bench_close(state, file);
+            return false;
+        }
+        (*ops)++;
+        *bytes += len;
+    }
+
+    return bench_close(state, file);
+}
+
+static bool bench_seqwrite (bench_state *state, u64 *ops, u64 *bytes)
+{
+    return bench_stream(state, ops, bytes, BENCH_BIGFILE, state->config->fileSize, true, false);
+}
+
+static bool bench_seqread (bench_state *state, u64 *ops, u64 *bytes)
+{
+    return bench_stream(state, ops, bytes, BENCH_BIGFILE, state->config->fileSize, false, false);
+}
+
+static bool bench_random (bench_state *state, u64 *ops, u64 *bytes, bool write)
+{
+    const bench_config *config = state->config;
+    u64 slots = config->fileSize / config->ioSize;
+    void *file;
+    off_t pos;
+    u32 i;
+
+    file = bench_open(state, BENCH_BIGFILE, O_RDWR);
+    if (!file)
+        return false;
+
+    for (i = 0; i < config->randomOps; i++) {
+        pos = (off_t)(bench_rand(state) % slots) * config->ioSize;
+        if (state->dev->seek_r(&state->r, file, pos, SEEK_SET) != pos) {
+            fprintf(stderr, "seek: %s\n", strerror(state->r._errno));
+            bench_close(state, file);
+            return false;
+        }
+        if (write)
+            bench_fill(state, state->buffer, config->ioSize);
+        if (!bench_rw(state, file, state->buffer, config->ioSize, write)) {
+            bench_close(state, file);
+            return false;
+        }
+        (*ops)++;
+        *bytes += config->ioSize;
+    }
+
+    return bench_close(state, file);
+}
+
+static bool bench_randread (bench_state *state, u64 *ops, u64 *bytes)
+{
+    return bench_random(state, ops, bytes, false);
+}
+
+static bool bench_randwrite (bench_state *state, u64 *ops, u64 *bytes)
+{
+    return bench_random(state, ops, bytes, true);
+}
+
+static bool bench_cmpwrite (bench_state *state, u64 *ops, u64 *bytes)
+{
+    ntfs_inode *ni;
+    ntfs_vd *vd;
+    le32 attributes = FILE_ATTR_COMPRESSED | FILE_ATTR_DIRECTORY;
+    int ret;
+
+    if (!bench_mkdir(state, BENCH_CMPDIR))
+        return false;
+
+    // Mark the directory compressed, so that what is made in it is compressed as it is written
+    vd = ntfsGetVolume(BENCH_MOUNT ":/", false);
+    if (!vd)
+        return false;
+    ntfsLock(vd);
+    NVolSetCompression(vd->vol);
+    ni = ntfs_pathname_to_inode(vd->vol, NULL, "/bench/compressed");
+    ret = ni ? ntfs_set_ntfs_attrib(ni, (const char *)&attributes, sizeof(attributes), 0) : -1;
+    if (ni)
+        ntfs_inode_close(ni);
+    ntfsUnlock(vd);
+    if (ret) {
+        fprintf(stderr, "compress %s: %s\n", BENCH_CMPDIR, strerror(errno));
+        return false;
+    }
+
+    return bench_stream(state, ops, bytes, BENCH_CMPFILE, state->config->compressedSize, true, true);
+}
+
+static bool bench_cmpread (bench_state *state, u64 *ops, u64 *bytes)
+{
+    return bench_stream(state, ops, bytes, BENCH_CMPFILE, state->config->compressedSize, false, true);
+}
+
+static bool bench_create (bench_state *state, u64 *ops, u64 *bytes)
+{
+    const bench_config *config = state->config;
+    char path[256];
+    void *file;
+    u32 i;
+
+    if (!bench_mkdir(state, BENCH_SMALLDIR))
+        return false;
+
+    for (i = 0; i < config->smallFiles; i++) {
+        snprintf(path, sizeof(path), BENCH_SMALLDIR "/file%05u.dat", (unsigned)i);
+        file = bench_open(state, path, O_RDWR | O_CREAT | O_TRUNC);
+        if (!file)
+            return false;
+        bench_fill(state, state->buffer, config->smallSize);
+        if (!bench_rw(state, file, state->buffer, config->smallSize, true)) {
+            bench_close(state, file);
+            return false;
+        }
+        if (!bench_close(state, file))
+            return false;
+        (*ops)++;
+        *bytes += config->smallSize;
+    }
+
+    return true;
+}
+
+static bool bench_unlink (bench_state *state, u64 *ops, u64 *bytes)
+{
+    const bench_config *config = state->config;
+    char path[256];
+    u32 i;
+
+    for (i = 0; i < config->smallFiles; i++) {
+        snprintf(path, sizeof(path), BENCH_SMALLDIR "/file%05u.dat", (unsigned)i);
+        if (state->dev->unlink_r(&state->r, path) == -1) {
+            fprintf(stderr, "unlink %s: %s\n", path, strerror(state->r._errno));
+            return false;
+        }
+        (*ops)++;
+    }
+
+    return true;
+}
+
+static bool bench_dirfill (bench_state *state, u64 *ops, u64 *bytes)
+{
+    char path[256];
+    void *file;
+    u32 i;
+
+    if (!bench_mkdir(state, BENCH_BIGDIR))
+        return false;
+
+    // Empty files, so that this is all index and MFT record updates
+    for (i = 0; i < state->config->dirEntries; i++) {
+        snprintf(path, sizeof(path), BENCH_BIGDIR "/entry%05u", (unsigned)i);
+        file = bench_open(state, path, O_WRONLY | O_CREAT);
+        if (!file || !bench_close(state, file))
+            return false;
+        (*ops)++;
+    }
+
+    return true;
+}
+
+static bool bench_readdir (bench_state *state, u64 *ops, u64 *bytes)
+{
+    DIR_ITER *dir;
+    char name[768];
+    struct stat st;
+    u32 count = 0;
+
+    dir = calloc(1, sizeof(DIR_ITER));
+    if (!dir)
+        return false;
+    dir->dirStruct = calloc(1, state->dev->dirStateSize);
+    if (!dir->dirStruct || !state->dev->diropen_r(&state->r, dir, BENCH_BIGDIR)) {
+        fprintf(stderr, "diropen %s: %s\n", BENCH_BIGDIR, strerror(state->r._errno));
+        free(dir->dirStruct);
+        free(dir);
+        return false;
+    }
+
+    // Each entry comes back with its stat, as readdir and stat would give a program
+    while (state->dev->dirnext_r(&state->r, dir, name, &st) == 0) {
+        count++;
+        (*ops)++;
+    }
+    state->dev->dirclose_r(&state->r, dir);
+    free(dir->dirStruct);
+    free(dir);
+
+    // Every entry made by dirfill must be there
+    if (count < state->config->dirEntries) {
+        fprintf(stderr, "readdir: %u entries, expected at least %u\n", (unsigned)count, (unsigned)state->config->dirEntries);
+        return false;
+    }
+
+    return true;
+}
+
+static bool bench_stat (bench_state *state, u64 *ops, u64 *bytes)
+{
+    const bench_config *config = state->config;
+    char path[256];
+    struct stat st;
+    u32 i;
+
+    for (i = 0; i < config->dirEntries; i++) {
+        snprintf(path, sizeof(path), BENCH_BIGDIR "/entry%05u", (unsigned)(bench_rand(state) % config->dirEntries));
+        if (state->dev->stat_r(&state->r, path, &st) == -1) {
+            fprintf(stderr, "stat %s: %s\n", path, strerror(state->r._errno));
+            return false;
+        }
+        (*ops)++;
+    }
+
+    return true;
+}
+
+static bool bench_remount (bench_state *state, u64 *ops, u64 *bytes)
+{
+    (*ops)++;
+    return bench_mount(state);
+}
+
+static bool bench_mst (bench_state *state, u64 *ops, u64 *bytes)
+{
+    static const u32 sizes[] = { 1024, 4096 };
+    NTFS_RECORD *record;
+    u32 i, j, k;
+
+    // Protect and deprotect records of the usual sizes, as every MFT record and index block written and read back is
+    record = (NTFS_RECORD *) state->buffer;
+    for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        if (state->chunkSize < sizes[i])
+            continue;
+        bench_fill(state, state->buffer, sizes[i]);
+        record->magic = magic_FILE;
+        record->usa_ofs = cpu_to_le16(sizeof(NTFS_RECORD));
+        record->usa_count = cpu_to_le16(1 + sizes[i] / NTFS_BLOCK_SIZE);
+        for (j = 0; j < state->config->randomOps; j++) {
+            for (k = 0; k < 64; k++) {
+                if (ntfs_mst_pre_write_fixup(record, sizes[i]) || ntfs_mst_post_read_fixup(record, sizes[i])) {
+                    fprintf(stderr, "mst: fixup of a %u byte record failed\n", (unsigned)sizes[i]);
+                    return false;
+                }
+            }
+            (*ops) += 64;
+            *bytes += 64 * sizes[i];
+        }
+    }
+
+    return true;
+}
+
+/* How a test is run */
+#define BENCH_SIZED         0x1 /* Once for each transfer size */
+#define BENCH_UNMOUNTED     0x2 /* With the partition unmounted beforehand, outside of the time taken */
+#define BENCH_RANDOM_SIZE   0x4 /* In transfers of the random transfer size */
+#define BENCH_SMALL_SIZE    0x8 /* On files of the small file size */
+
+static const struct {
+    const char *name;
+    bench_fn fn;
+    u32 flags;
+} bench_tests[] = {
+    { "mount", bench_remount, BENCH_UNMOUNTED },
+    { "seqwrite", bench_seqwrite, BENCH_SIZED },
+    { "seqread", bench_seqread, BENCH_SIZED },
+    { "randread", bench_randread, BENCH_RANDOM_SIZE },
+    { "randwrite", bench_randwrite, BENCH_RANDOM_SIZE },
+    { "cmpwrite", bench_cmpwrite, BENCH_SIZED },
+    { "cmpread", bench_cmpread, BENCH_SIZED },
+    { "create", bench_create, BENCH_SMALL_SIZE },
+    { "unlink", bench_unlink, BENCH_SMALL_SIZE },
+    { "dirfill", bench_dirfill, 0 },
+    { "readdir", bench_readdir, 0 },
+    { "stat", bench_stat, 0 },
+    { "mst", bench_mst, 0 },
+    { NULL, NULL, 0 }
+};
+
+static bool bench_mount (bench_state *state)
+{
+    sec_t *partitions = NULL;
+    sec_t start = 0;
+    int count;
+
+    count = ntfsFindPartitions(state->device->disc, &partitions);
+    if (count > 0)
+        start = partitions[0];
+    free(partitions);
+
+    if (!ntfsMountEx(BENCH_MOUNT, state->device->disc, start, &state->config->opts)) {
+        fprintf(stderr, "mount: %s\n", strerror(errno));
+        return false;
+    }
+
+    state->dev = GetDeviceOpTab(BENCH_MOUNT ":/");
+    if (!state->dev) {
+        ntfsUnmount(BENCH_MOUNT, true);
+        return false;
+    }
+
+    return true;
+}
+
+static void bench_header (bench_state *state, FILE *out)
+{
+    if (state->config->format == BENCH_FORMAT_CSV) {
+        fprintf(out, "version,test,size,pass,seconds,ops,bytes,ops_per_sec,mib_per_sec,device_seconds,"
+                     "reads,writes,flushes,seeks,unaligned,sectors_read,sectors_written,cache_hits,cache_misses\n");
+        return;
+    }
+
+    fprintf(out, "%-10s %7s %9s %10s %9s %9s %8s %8s %8s %6s %9s %9s %8s %8s\n",
+            "test", "size", "time", "ops/s", "MiB/s", "devtime", "reads", "writes", "seeks", "unal", "rd MiB", "wr MiB", "hits", "misses");
+}
+
+static void bench_report (bench_state *state, FILE *out, const char *name, size_t size, u32 pass, u64 ticks, u64 ops, u64 bytes,
+                          const bench_device_stats *disc, const ntfs_cache_stats *cache)
+{
+    double secs = ticks_to_nanosecs(ticks) / 1e9;
+    double mib = state->device->disc->bytesPerSector / 1048576.0;
+    char sizeName[16];
+
+    if (state->config->format == BENCH_FORMAT_CSV) {
+        fprintf(out, "%s,%s,%llu,%u,%.6f,%llu,%llu,%.1f,%.3f,%.6f,%llu,%llu,%llu,%llu,%llu,%llu,%llu,%llu,%llu\n",
+                PACKAGE_VERSION, name, (unsigned long long)size, (unsigned)pass, secs,
+                (unsigned long long)ops, (unsigned long long)bytes,
+                secs > 0 ? ops / secs : 0.0, secs > 0 ? bytes / secs / 1048576.0 : 0.0, disc->deviceTime / 1e9,
+                (unsigned long long)disc->reads, (unsigned long long)disc->writes, (unsigned long long)disc->flushes,
+                (unsigned long long)disc->seeks, (unsigned long long)disc->unaligned,
+                (unsigned long long)disc->sectorsRead, (unsigned long long)disc->sectorsWritten,
+                (unsigned long long)cache->hits, (unsigned long long)cache->misses);
+        return;
+    }
+
+    if (!size)
+        strcpy(sizeName, "-");
+    else if (size % (1 << 20) == 0)
+        snprintf(sizeName, sizeof(sizeName), "%uM", (unsigned)(size >> 20));
+    else if (size % (1 << 10) == 0)
+        snprintf(sizeName, sizeof(sizeName), "%uK", (unsigned)(size >> 10));
+    else
+        snprintf(sizeName, sizeof(sizeName), "%u", (unsigned)size);
+
+    fprintf(out, "%-10s %7s %9.3f %10.0f %9.2f %9.3f %8llu %8llu %8llu %6llu %9.2f %9.2f %8llu %8llu\n",
+            name, sizeName, secs, secs > 0 ? ops / secs : 0.0, secs > 0 ? bytes / secs / 1048576.0 : 0.0,
+            disc->deviceTime / 1e9, (unsigned long long)disc->reads, (unsigned long long)disc->writes,
+            (unsigned long long)disc->seeks, (unsigned long long)disc->unaligned,
+            disc->sectorsRead * mib, disc->sectorsWritten * mib,
+            (unsigned long long)cache->hits, (unsigned long long)cache->misses);
+}
+
+static void bench_trace (bench_state *state, FILE *out)
+{
+    static const char *classes[] = { "data", "metadata", "uncached", "async" };
+    u32 count[4] = { 0 }, hits[4] = { 0 }, jumps[4] = { 0 };
+    u64 sectors[4] = { 0 }, micros[4] = { 0 };
+    sec_t next[4] = { 0 };
+    ntfs_io_trace_entry *entries;
+    int i, n;
+
+    entries = malloc(state->config->opts.ioTraceSize * sizeof(ntfs_io_trace_entry));
+    if (!entries)
+        return;
+
+    // Summarise the accesses of each class, counting those that do not follow on from the last one
+    n = ntfsGetIOTrace(BENCH_MOUNT, entries, state->config->opts.ioTraceSize);
+    for (i = 0; i < n; i++) {
+        u8 c = entries[i].caller & 3;
+        if (count[c] && entries[i].sector != next[c])
+            jumps[c]++;
+        next[c] = entries[i].sector + entries[i].numSectors;
+        count[c]++;
+        hits[c] += entries[i].hit;
+        sectors[c] += entries[i].numSectors;
+        micros[c] += entries[i].duration;
+    }
+
+    for (i = 0; i < 4; i++) {
+        if (!count[i])
+            continue;
+        fprintf(out, "  %-8s %8u accesses %5.1f%% hits %8u jumps %8.1f sectors each %8.1f us each\n",
+                classes[i], count[i], 100.0 * hits[i] / count[i], jumps[i],
+                (double) sectors[i] / count[i], (double) micros[i] / count[i]);
+    }
+
+    free(entries);
+}
+
+static bool bench_selected (const char *tests, const char *name)
+{
+    size_t len = strlen(name);
+    const char *p = tests;
+
+    if (!tests)
+        return true;
+
+    while ((p = strstr(p, name)) != NULL) {
+        if ((p == tests || p[-1] == ',') && (p[len] == ',' || p[len] == '\0'))
+            return true;
+        p += len;
+    }
+
+    return false;
+}
+
+static bool bench_run_test (bench_state *state, FILE *out, int test, size_t size)
+{
+    const bench_config *config = state->config;
+    bench_device_stats disc;
+    ntfs_cache_stats cache;
+    u64 start, ops, bytes;
+    u32 pass;
+    bool ok = true;
+
+    for (pass = 0; ok && pass < config->repeat; pass++) {
+        if (bench_tests[test].flags & BENCH_UNMOUNTED) {
+            ntfsUnmount(BENCH_MOUNT, true);
+            state->dev = NULL;
+        }
+
+        state->device->resetStats(state->device->disc);
+        ntfsResetCacheStats(BENCH_MOUNT);
+        ntfsResetIOTrace(BENCH_MOUNT);
+        ops = bytes = 0;
+
+        start = gettime();
+        ok = bench_tests[test].fn(state, &ops, &bytes);
+
+        state->device->getStats(state->device->disc, &disc);
+        if (!ntfsGetCacheStats(BENCH_MOUNT, &cache))
+            memset(&cache, 0, sizeof(cache));
+        bench_report(state, out, bench_tests[test].name, size, pass, diff_ticks(start, gettime()), ops, bytes, &disc, &cache);
+        if (config->opts.ioTraceSize)
+            bench_trace(state, config->format == BENCH_FORMAT_CSV ? stderr : out);
+    }
+
+    return ok;
+}
+
+void benchInitConfig (bench_config *config)
+{
+    memset(config, 0, sizeof(bench_config));
+    ntfsInitMountOptions(&config->opts);
+    config->fileSize = 64 << 20;
+    config->chunkSizes[0] = 4 << 10;
+    config->chunkSizes[1] = 64 << 10;
+    config->chunkSizes[2] = 1 << 20;
+    config->chunkCount = 3;
+    config->ioSize = 4 << 10;
+    config->randomOps = 4096;
+    config->smallFiles = 10000;
+    config->smallSize = 2 << 10;
+    config->dirEntries = 50000;
+    config->compressedSize = 16 << 20;
+    config->repeat = 1;
+    config->seed = 1;
+    config->format = BENCH_FORMAT_TABLE;
+}
+
+bool benchIsTest (const char *name)
+{
+    int i;
+
+    for (i = 0; bench_tests[i].name; i++)
+        if (!strcmp(bench_tests[i].name, name))
+            return true;
+
+    return false;
+}
+
+bool benchRun (const bench_config *config, const bench_device *device, FILE *out)
+{
+    bench_state state;
+    bench_device_stats disc;
+    ntfs_cache_stats cache;
+    size_t bufferSize;
+    u64 start;
+    u32 j;
+    int i;
+    bool ok = true;
+
+    memset(&state, 0, sizeof(state));
+    state.config = config;
+    state.device = device;
+    state.rng = config->seed ? config->seed : 1;
+    bench_fill(&state, &state.phrases[0][0], sizeof(state.phrases));
+
+    // One buffer big enough for the largest transfer of any test
+    bufferSize = config->ioSize > config->smallSize ? config->ioSize : config->smallSize;
+    for (j = 0; j < config->chunkCount; j++)
+        if (config->chunkSizes[j] > bufferSize)
+            bufferSize = config->chunkSizes[j];
+    state.chunkSize = bufferSize;
+    state.buffer = malloc(bufferSize);
+    if (!state.buffer)
+        return false;
+
+    if (!bench_mount(&state)) {
+        free(state.buffer);
+        return false;
+    }
+    ok = bench_mkdir(&state, BENCH_ROOT);
+
+    bench_header(&state, out);
+    for (i = 0; ok && bench_tests[i].name; i++) {
+        if (!bench_selected(config->tests, bench_tests[i].name))
+            continue;
+
+        if (!(bench_tests[i].flags & BENCH_SIZED)) {
+            state.chunkSize = bufferSize;
+            if (bench_tests[i].flags & BENCH_RANDOM_SIZE)
+                ok = bench_run_test(&state, out, i, config->ioSize);
+            else if (bench_tests[i].flags & BENCH_SMALL_SIZE)
+                ok = bench_run_test(&state, out, i, config->smallSize);
+            else
+                ok = bench_run_test(&state, out, i, 0);
+            continue;
+        }
+
+        for (j = 0; ok && j < config->chunkCount; j++) {
+            state.chunkSize = config->chunkSizes[j];
+            ok = bench_run_test(&state, out, i, state.chunkSize);
+        }
+    }
+
+    // Time the unmount too, as that is where a write-back cache pays for what it deferred
+    if (state.dev) {
+        device->resetStats(device->disc);
+        start = gettime();
+        ntfsUnmount(BENCH_MOUNT, false);
+        device->getStats(device->disc, &disc);
+        memset(&cache, 0, sizeof(cache));
+        bench_report(&state, out, "unmount", 0, 0, diff_ticks(start, gettime()), 1, 0, &disc, &cache);
+    }
+
+    free(state.buffer);
+
+    return ok;
+}
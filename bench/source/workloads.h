@@ -0,0 +1,95 @@
+/*
+ * workloads.h - The libntfs benchmark suite, shared by the console and host drivers.
+ *
+ * This program/include file is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program/include file is distributed in the hope that it will be
+ * useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef _WORKLOADS_H
+#define _WORKLOADS_H
+
+#include <stdio.h>
+#include <gccore.h>
+#include <ogc/disc_io.h>
+
+#include <ntfs.h>
+
+/* Most transfer sizes the sequential and compressed tests can be run at in one go */
+#define BENCH_MAX_SIZES     8
+
+/* Output formats */
+#define BENCH_FORMAT_TABLE  0 /* Aligned columns, for reading */
+#define BENCH_FORMAT_CSV    1 /* One header line then one line per run, for comparing releases */
+
+/**
+ * bench_config - What to run and how
+ */
+typedef struct _bench_config {
+    const char *tests;              /* Tests to run, comma separated, NULL for the whole suite */
+    ntfs_mount_opts opts;           /* Options to mount the partition with */
+    size_t fileSize;                /* Size of the file written and read sequentially, and at random */
+    size_t chunkSizes[BENCH_MAX_SIZES]; /* Transfer sizes to run the sequential and compressed tests at */
+    u32 chunkCount;                 /* Number of transfer sizes in chunkSizes */
+    size_t ioSize;                  /* Size of each random transfer */
+    u32 randomOps;                  /* Number of random transfers, and of batches of 64 records fixed up by mst */
+    u32 smallFiles;                 /* Number of small files made and removed by create and unlink */
+    size_t smallSize;               /* Size of each small file */
+    u32 dirEntries;                 /* Number of entries in the directory listed by readdir and stat */
+    size_t compressedSize;          /* Size of the compressed file */
+    u32 repeat;                     /* Times to run each test */
+    u32 seed;                       /* Random seed */
+    int format;                     /* Output format (BENCH_FORMAT_*) */
+} bench_config;
+
+/**
+ * bench_device_stats - Commands seen by the disc under test
+ */
+typedef struct _bench_device_stats {
+    u64 reads;                      /* Read commands */
+    u64 writes;                     /* Write commands */
+    u64 flushes;                    /* Flush commands */
+    u64 sectorsRead;                /* Sectors moved by read commands */
+    u64 sectorsWritten;             /* Sectors moved by write commands */
+    u64 seeks;                      /* Commands that did not follow on from the last one */
+    u64 unaligned;                  /* Transfers whose buffer could not have been used for DMA */
+    u64 deviceTime;                 /* Time spent in the device, in nanoseconds */
+} bench_device_stats;
+
+/**
+ * bench_device - The disc under test and how to count what is sent to it
+ */
+typedef struct _bench_device {
+    DISC_INTERFACE *disc;
+    void (*resetStats) (DISC_INTERFACE *disc);
+    void (*getStats) (DISC_INTERFACE *disc, bench_device_stats *stats);
+} bench_device;
+
+/**
+ * Fill in the parameters of the standard suite
+ */
+void benchInitConfig (bench_config *config);
+
+/**
+ * Check that a test name is part of the suite
+ */
+bool benchIsTest (const char *name);
+
+/**
+ * Mount the first NTFS partition of a device, run the selected tests on it and unmount it
+ *
+ * @param CONFIG What to run
+ * @param DEVICE The device to run it on
+ * @param OUT Where to write the results, in the format of the configuration
+ *
+ * @return True if every test ran to completion
+ */
+bool benchRun (const bench_config *config, const bench_device *device, FILE *out);
+
+#endif /* _WORKLOADS_H */
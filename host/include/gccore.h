@@ -0,0 +1,17 @@
+/*
+ * gccore.h - Host stand-in for the parts of libogc used by libntfs.
+ */
+
+#ifndef __GCCORE_H__
+#define __GCCORE_H__
+
+#include <gctypes.h>
+#include <ogc/disc_io.h>
+#include <ogc/lwp.h>
+#include <ogc/mutex.h>
+#include <ogc/cond.h>
+#include <ogc/system.h>
+#include <ogc/cache.h>
+#include <ogc/lwp_watchdog.h>
+
+#endif /* __GCCORE_H__ */
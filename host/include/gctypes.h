@@ -0,0 +1,42 @@
+/*
+ * gctypes.h - Host stand-in for the libogc integer types.
+ */
+
+#ifndef __GCTYPES_H__
+#define __GCTYPES_H__
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* 64-bit types are long long as on the PowerPC, so that format strings agree */
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef unsigned long long u64;
+
+typedef int8_t s8;
+typedef int16_t s16;
+typedef int32_t s32;
+typedef signed long long s64;
+
+typedef volatile u8 vu8;
+typedef volatile u16 vu16;
+typedef volatile u32 vu32;
+typedef volatile u64 vu64;
+
+typedef float f32;
+typedef double f64;
+
+typedef unsigned int BOOL;
+
+#ifndef TRUE
+#define TRUE	1
+#endif
+#ifndef FALSE
+#define FALSE	0
+#endif
+
+#define ATTRIBUTE_ALIGN(v)	__attribute__((aligned(v)))
+#define ATTRIBUTE_PACKED	__attribute__((packed))
+
+#endif /* __GCTYPES_H__ */
@@ -0,0 +1,10 @@
+/*
+ * endian.h - Host stand-in for the newlib machine byte order header.
+ */
+
+#ifndef __MACHINE_ENDIAN_H__
+#define __MACHINE_ENDIAN_H__
+
+#include <endian.h>
+
+#endif /* __MACHINE_ENDIAN_H__ */
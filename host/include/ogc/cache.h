@@ -0,0 +1,13 @@
+/*
+ * cache.h - Host stand-in for the libogc data cache calls, which do nothing here.
+ */
+
+#ifndef __CACHE_H__
+#define __CACHE_H__
+
+#include <gctypes.h>
+
+static inline void DCFlushRange(void *startaddress, u32 len) { (void)startaddress; (void)len; }
+static inline void DCInvalidateRange(void *startaddress, u32 len) { (void)startaddress; (void)len; }
+
+#endif /* __CACHE_H__ */
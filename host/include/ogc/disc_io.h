@@ -0,0 +1,39 @@
+/*
+ * disc_io.h - Host stand-in for the libogc disc interface.
+ */
+
+#ifndef __DISC_IO_H__
+#define __DISC_IO_H__
+
+#include <gctypes.h>
+
+#define FEATURE_MEDIUM_CANREAD		0x00000001
+#define FEATURE_MEDIUM_CANWRITE		0x00000002
+
+typedef u64 sec_t;
+
+typedef struct DISC_INTERFACE_STRUCT DISC_INTERFACE;
+
+typedef bool (*FN_MEDIUM_STARTUP)(DISC_INTERFACE *disc);
+typedef bool (*FN_MEDIUM_ISINSERTED)(DISC_INTERFACE *disc);
+typedef bool (*FN_MEDIUM_READSECTORS)(DISC_INTERFACE *disc, sec_t sector, sec_t numSectors, void *buffer);
+typedef bool (*FN_MEDIUM_WRITESECTORS)(DISC_INTERFACE *disc, sec_t sector, sec_t numSectors, const void *buffer);
+typedef bool (*FN_MEDIUM_CLEARSTATUS)(DISC_INTERFACE *disc);
+typedef bool (*FN_MEDIUM_SHUTDOWN)(DISC_INTERFACE *disc);
+typedef bool (*FN_MEDIUM_FLUSH)(DISC_INTERFACE *disc);
+
+struct DISC_INTERFACE_STRUCT {
+	unsigned long ioType;
+	unsigned long features;
+	FN_MEDIUM_STARTUP startup;
+	FN_MEDIUM_ISINSERTED isInserted;
+	FN_MEDIUM_READSECTORS readSectors;
+	FN_MEDIUM_WRITESECTORS writeSectors;
+	FN_MEDIUM_CLEARSTATUS clearStatus;
+	FN_MEDIUM_SHUTDOWN shutdown;
+	sec_t numberOfSectors;
+	u32 bytesPerSector;
+	FN_MEDIUM_FLUSH flush;
+};
+
+#endif /* __DISC_IO_H__ */
@@ -0,0 +1,12 @@
+/*
+ * dvd.h - Host stand-in for the libogc DVD interfaces.
+ */
+
+#ifndef __DVD_H__
+#define __DVD_H__
+
+#include <ogc/disc_io.h>
+
+extern DISC_INTERFACE __io_gcode;
+
+#endif /* __DVD_H__ */
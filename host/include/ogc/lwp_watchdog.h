@@ -0,0 +1,26 @@
+/*
+ * lwp_watchdog.h - Host stand-in for the libogc time base, counted in nanoseconds.
+ */
+
+#ifndef __LWP_WATCHDOG_H__
+#define __LWP_WATCHDOG_H__
+
+#include <gctypes.h>
+
+#define TB_TIMER_CLOCK				1000000
+
+#define ticks_to_secs(ticks)		((u64)(ticks) / ((u64)TB_TIMER_CLOCK * 1000))
+#define ticks_to_millisecs(ticks)	((u64)(ticks) / (u64)TB_TIMER_CLOCK)
+#define ticks_to_microsecs(ticks)	((u64)(ticks) / 1000)
+#define ticks_to_nanosecs(ticks)	((u64)(ticks))
+
+#define secs_to_ticks(sec)			((u64)(sec) * ((u64)TB_TIMER_CLOCK * 1000))
+#define millisecs_to_ticks(msec)	((u64)(msec) * (u64)TB_TIMER_CLOCK)
+#define microsecs_to_ticks(usec)	((u64)(usec) * 1000)
+#define nanosecs_to_ticks(nsec)		((u64)(nsec))
+
+#define diff_ticks(tick0,tick1)		(((u64)(tick1) < (u64)(tick0)) ? ((u64)-1 - (u64)(tick0) + (u64)(tick1)) : ((u64)(tick1) - (u64)(tick0)))
+
+u64 gettime(void);
+
+#endif /* __LWP_WATCHDOG_H__ */
@@ -0,0 +1,12 @@
+/*
+ * system.h - Host stand-in for the libogc system calls used by libntfs.
+ */
+
+#ifndef __SYSTEM_H__
+#define __SYSTEM_H__
+
+#include <gctypes.h>
+
+bool SYS_IsDMAAddress(const void *addr, u32 align);
+
+#endif /* __SYSTEM_H__ */
@@ -0,0 +1,12 @@
+/*
+ * usbstorage.h - Host stand-in for the libogc USB mass storage interface.
+ */
+
+#ifndef __USBSTORAGE_H__
+#define __USBSTORAGE_H__
+
+#include <ogc/disc_io.h>
+
+extern DISC_INTERFACE __io_usbstorage;
+
+#endif /* __USBSTORAGE_H__ */
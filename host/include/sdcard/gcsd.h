@@ -0,0 +1,14 @@
+/*
+ * gcsd.h - Host stand-in for the libogc memory card slot SD interfaces.
+ */
+
+#ifndef __GCSD_H__
+#define __GCSD_H__
+
+#include <ogc/disc_io.h>
+
+extern DISC_INTERFACE __io_gcsda;
+extern DISC_INTERFACE __io_gcsdb;
+extern DISC_INTERFACE __io_gcsd2;
+
+#endif /* __GCSD_H__ */
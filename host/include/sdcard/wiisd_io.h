@@ -0,0 +1,12 @@
+/*
+ * wiisd_io.h - Host stand-in for the libogc front SD interface.
+ */
+
+#ifndef __WIISD_IO_H__
+#define __WIISD_IO_H__
+
+#include <ogc/disc_io.h>
+
+extern DISC_INTERFACE __io_wiisd;
+
+#endif /* __WIISD_IO_H__ */
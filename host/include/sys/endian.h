@@ -0,0 +1,10 @@
+/*
+ * endian.h - Host stand-in for the newlib byte order header.
+ */
+
+#ifndef __SYS_ENDIAN_H__
+#define __SYS_ENDIAN_H__
+
+#include <endian.h>
+
+#endif /* __SYS_ENDIAN_H__ */
@@ -0,0 +1,10 @@
+/*
+ * mkdev.h - Host stand-in for the newlib device number macros.
+ */
+
+#ifndef __SYS_MKDEV_H__
+#define __SYS_MKDEV_H__
+
+#include <sys/sysmacros.h>
+
+#endif /* __SYS_MKDEV_H__ */
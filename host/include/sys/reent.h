@@ -0,0 +1,12 @@
+/*
+ * reent.h - Host stand-in for the newlib reentrancy structure, of which only errno is used.
+ */
+
+#ifndef __SYS_REENT_H__
+#define __SYS_REENT_H__
+
+struct _reent {
+	int _errno;
+};
+
+#endif /* __SYS_REENT_H__ */
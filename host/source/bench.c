@@ -0,0 +1,196 @@
+/*
+ * bench.c - Benchmark driver for libntfs running on a file backed disc.
+ *
+ * Runs the suite in bench/source/workloads.c against a disk image, with the
+ * device characteristics to model given on the command line.
+ *
+ * This program/include file is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program/include file is distributed in the hope that it will be
+ * useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <errno.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <ntfs.h>
+#include "filedisc.h"
+#include "workloads.h"
+
+static void bench_host_reset (DISC_INTERFACE *disc)
+{
+    fileDiscResetStats(disc);
+}
+
+static void bench_host_stats (DISC_INTERFACE *disc, bench_device_stats *stats)
+{
+    filedisc_stats fds;
+
+    fileDiscGetStats(disc, &fds);
+    stats->reads = fds.reads;
+    stats->writes = fds.writes;
+    stats->flushes = fds.flushes;
+    stats->sectorsRead = fds.sectorsRead;
+    stats->sectorsWritten = fds.sectorsWritten;
+    stats->seeks = fds.seeks;
+    stats->unaligned = fds.unaligned;
+    stats->deviceTime = fds.deviceTime;
+}
+
+static size_t bench_size (const char *arg, char **end)
+{
+    size_t size = strtoull(arg, end, 0);
+
+    switch (**end) {
+        case 'k': case 'K': size <<= 10; (*end)++; break;
+        case 'm': case 'M': size <<= 20; (*end)++; break;
+        case 'g': case 'G': size <<= 30; (*end)++; break;
+    }
+
+    return size;
+}
+
+static bool bench_sizes (bench_config *config, const char *arg)
+{
+    char *end;
+
+    // A comma separated list, each transfer size is a run of its own
+    for (config->chunkCount = 0; *arg && config->chunkCount < BENCH_MAX_SIZES; arg = end + (*end == ',')) {
+        config->chunkSizes[config->chunkCount] = bench_size(arg, &end);
+        if (!config->chunkSizes[config->chunkCount] || (*end && *end != ','))
+            return false;
+        config->chunkCount++;
+    }
+
+    return config->chunkCount && !*arg;
+}
+
+static bool bench_tests_valid (const char *tests)
+{
+    char name[32];
+    size_t len;
+
+    while (*tests) {
+        len = strcspn(tests, ",");
+        if (len >= sizeof(name))
+            return false;
+        memcpy(name, tests, len);
+        name[len] = '\0';
+        if (!benchIsTest(name))
+            return false;
+        tests += len + (tests[len] == ',');
+    }
+
+    return true;
+}
+
+static void bench_usage (const char *prog)
+{
+    fprintf(stderr,
+        "usage: %s [options] IMAGE\n"
+        "\n"
+        "Runs libntfs against IMAGE, an NTFS volume or a disk holding one (e.g. made with mkntfs -F).\n"
+        "The image is modified; keep a pristine copy and work on a duplicate for comparable runs.\n"
+        "With no options this is the standard suite, which wants an image of 256M or more.\n"
+        "\n"
+        "  -t LIST      tests to run, comma separated (mount,seqwrite,seqread,randread,randwrite,cmpwrite,cmpread,\n"
+        "               create,unlink,dirfill,readdir,stat,mst)\n"
+        "  -s SIZE      size of the sequential file (default 64M)\n"
+        "  -c LIST      sizes of the sequential and compressed transfers, comma separated (default 4K,64K,1M)\n"
+        "  -o SIZE      size of each random transfer (default 4K)\n"
+        "  -n COUNT     number of random transfers, and of batches of 64 records fixed up by mst (default 4096)\n"
+        "  -f COUNT     number of small files (default 10000)\n"
+        "  -z SIZE      size of each small file (default 2K)\n"
+        "  -d COUNT     number of entries in the directory listed (default 50000)\n"
+        "  -e SIZE      size of the compressed file (default 16M)\n"
+        "  -x COUNT     times to run each test (default 1)\n"
+        "  -R SEED      random seed (default 1)\n"
+        "  -C           write the results as comma separated values, one line per run\n"
+        "  -B BYTES     sector size of the disc (default 512)\n"
+        "  -l USEC      modelled latency of each command\n"
+        "  -S USEC      modelled latency of each seek\n"
+        "  -b BYTES     modelled bandwidth per second\n"
+        "  -w           wait out the modelled time instead of only counting it\n"
+        "  -p COUNT     cache pages\n"
+        "  -P SECTORS   sectors per cache page\n"
+        "  -m COUNT     metadata cache pages\n"
+        "  -a PAGES     read-ahead pages\n"
+        "  -F FLAGS     mount flags (see ntfs.h)\n"
+        "  -T COUNT     trace the last COUNT device accesses of each test and summarise them\n",
+        prog);
+}
+
+int main (int argc, char **argv)
+{
+    bench_config config;
+    bench_device device;
+    filedisc_limits limits;
+    u32 bytesPerSector = 0;
+    const char *image;
+    char *end;
+    int opt;
+    bool ok;
+
+    benchInitConfig(&config);
+    memset(&limits, 0, sizeof(limits));
+
+    while ((opt = getopt(argc, argv, "t:s:c:o:n:f:z:d:e:x:R:CB:l:S:b:wp:P:m:a:F:T:h")) != -1) {
+        switch (opt) {
+            case 't': config.tests = optarg; break;
+            case 's': config.fileSize = bench_size(optarg, &end); break;
+            case 'c': if (!bench_sizes(&config, optarg)) config.chunkCount = 0; break;
+            case 'o': config.ioSize = bench_size(optarg, &end); break;
+            case 'n': config.randomOps = strtoul(optarg, NULL, 0); break;
+            case 'f': config.smallFiles = strtoul(optarg, NULL, 0); break;
+            case 'z': config.smallSize = bench_size(optarg, &end); break;
+            case 'd': config.dirEntries = strtoul(optarg, NULL, 0); break;
+            case 'e': config.compressedSize = bench_size(optarg, &end); break;
+            case 'x': config.repeat = strtoul(optarg, NULL, 0); break;
+            case 'R': config.seed = strtoul(optarg, NULL, 0); break;
+            case 'C': config.format = BENCH_FORMAT_CSV; break;
+            case 'B': bytesPerSector = strtoul(optarg, NULL, 0); break;
+            case 'l': limits.latency = strtoul(optarg, NULL, 0); break;
+            case 'S': limits.seekLatency = strtoul(optarg, NULL, 0); break;
+            case 'b': limits.bandwidth = bench_size(optarg, &end); break;
+            case 'w': limits.sleep = true; break;
+            case 'p': config.opts.cachePageCount = strtoul(optarg, NULL, 0); break;
+            case 'P': config.opts.cachePageSize = strtoul(optarg, NULL, 0); break;
+            case 'm': config.opts.cacheMetaPageCount = strtoul(optarg, NULL, 0); break;
+            case 'a': config.opts.cacheReadAhead = strtoul(optarg, NULL, 0); break;
+            case 'F': config.opts.flags = strtoul(optarg, NULL, 0); break;
+            case 'T': config.opts.ioTraceSize = strtoul(optarg, NULL, 0); break;
+            default: bench_usage(argv[0]); return (opt == 'h') ? 0 : 2;
+        }
+    }
+
+    if (optind != argc - 1 || !config.chunkCount || !config.ioSize || config.ioSize > config.fileSize ||
+        (config.tests && !bench_tests_valid(config.tests))) {
+        bench_usage(argv[0]);
+        return 2;
+    }
+    image = argv[optind];
+
+    device.disc = fileDiscOpen(image, bytesPerSector, (config.opts.flags & NTFS_READ_ONLY) != 0);
+    if (!device.disc) {
+        fprintf(stderr, "%s: %s\n", image, strerror(errno));
+        return 1;
+    }
+    device.resetStats = bench_host_reset;
+    device.getStats = bench_host_stats;
+    fileDiscSetLimits(device.disc, &limits);
+
+    ok = benchRun(&config, &device, stdout);
+
+    fileDiscClose(device.disc);
+
+    return ok ? 0 : 1;
+}
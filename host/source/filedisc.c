@@ -0,0 +1,256 @@
+/*
+ * filedisc.c - A disc interface backed by an image file, for running libntfs on the host.
+ *
+ * This program/include file is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program/include file is distributed in the hope that it will be
+ * useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "filedisc.h"
+
+#define FILEDISC_IO_TYPE    0x46494c45 /* 'FILE' */
+
+/**
+ * filedisc - The interface handed to libntfs followed by the state behind it
+ */
+typedef struct _filedisc {
+    DISC_INTERFACE interface;
+    int fd;
+    pthread_mutex_t lock;
+    filedisc_limits limits;
+    filedisc_stats stats;
+    sec_t nextSector;
+} filedisc;
+
+static bool filedisc_startup (DISC_INTERFACE *disc)
+{
+    return ((filedisc *)disc)->fd >= 0;
+}
+
+static bool filedisc_isInserted (DISC_INTERFACE *disc)
+{
+    return ((filedisc *)disc)->fd >= 0;
+}
+
+static bool filedisc_clearStatus (DISC_INTERFACE *disc)
+{
+    return true;
+}
+
+static bool filedisc_shutdown (DISC_INTERFACE *disc)
+{
+    return true;
+}
+
+/**
+ * Count a command against the disc and, if asked to, take as long over it as the modelled device would
+ */
+static void filedisc_account (filedisc *fd, sec_t sector, sec_t numSectors, const void *buffer)
+{
+    u64 time;
+    struct timespec wait;
+
+    pthread_mutex_lock(&fd->lock);
+
+    if (buffer && !SYS_IsDMAAddress(buffer, 32))
+        fd->stats.unaligned++;
+
+    // Work out how long the device would take over this command
+    time = (u64)fd->limits.latency * 1000;
+    if (sector != fd->nextSector) {
+        time += (u64)fd->limits.seekLatency * 1000;
+        fd->stats.seeks++;
+    }
+    if (fd->limits.bandwidth)
+        time += (numSectors * fd->interface.bytesPerSector * 1000000000ULL) / fd->limits.bandwidth;
+
+    fd->stats.deviceTime += time;
+    fd->nextSector = sector + numSectors;
+
+    pthread_mutex_unlock(&fd->lock);
+
+    if (fd->limits.sleep && time) {
+        wait.tv_sec = time / 1000000000ULL;
+        wait.tv_nsec = time % 1000000000ULL;
+        while (nanosleep(&wait, &wait) == -1 && errno == EINTR);
+    }
+}
+
+static bool filedisc_readSectors (DISC_INTERFACE *disc, sec_t sector, sec_t numSectors, void *buffer)
+{
+    filedisc *fd = (filedisc *)disc;
+    size_t size = numSectors * disc->bytesPerSector;
+    off_t pos = (off_t)sector * disc->bytesPerSector;
+    ssize_t ret;
+    size_t done = 0;
+
+    if (sector + numSectors > disc->numberOfSectors) {
+        errno = EIO;
+        return false;
+    }
+
+    filedisc_account(fd, sector, numSectors, buffer);
+
+    while (done < size) {
+        ret = pread(fd->fd, (u8 *)buffer + done, size - done, pos + done);
+        if (ret <= 0) {
+            if (ret < 0 && errno == EINTR)
+                continue;
+            return false;
+        }
+        done += ret;
+    }
+
+    pthread_mutex_lock(&fd->lock);
+    fd->stats.reads++;
+    fd->stats.sectorsRead += numSectors;
+    pthread_mutex_unlock(&fd->lock);
+
+    return true;
+}
+
+static bool filedisc_writeSectors (DISC_INTERFACE *disc, sec_t sector, sec_t numSectors, const void *buffer)
+{
+    filedisc *fd = (filedisc *)disc;
+    size_t size = numSectors * disc->bytesPerSector;
+    off_t pos = (off_t)sector * disc->bytesPerSector;
+    ssize_t ret;
+    size_t done = 0;
+
+    if (!(disc->features & FEATURE_MEDIUM_CANWRITE) || sector + numSectors > disc->numberOfSectors) {
+        errno = (disc->features & FEATURE_MEDIUM_CANWRITE) ? EIO : EROFS;
+        return false;
+    }
+
+    filedisc_account(fd, sector, numSectors, buffer);
+
+    while (done < size) {
+        ret = pwrite(fd->fd, (const u8 *)buffer + done, size - done, pos + done);
+        if (ret <= 0) {
+            if (ret < 0 && errno == EINTR)
+                continue;
+            return false;
+        }
+        done += ret;
+    }
+
+    pthread_mutex_lock(&fd->lock);
+    fd->stats.writes++;
+    fd->stats.sectorsWritten += numSectors;
+    pthread_mutex_unlock(&fd->lock);
+
+    return true;
+}
+
+static bool filedisc_flush (DISC_INTERFACE *disc)
+{
+    filedisc *fd = (filedisc *)disc;
+
+    pthread_mutex_lock(&fd->lock);
+    fd->stats.flushes++;
+    pthread_mutex_unlock(&fd->lock);
+
+    // The image is written straight through, so there is nothing held back to flush
+    return true;
+}
+
+DISC_INTERFACE *fileDiscOpen (const char *path, u32 bytesPerSector, bool readOnly)
+{
+    filedisc *fd;
+    struct stat st;
+
+    // Sanity check
+    if (!path || (bytesPerSector & (bytesPerSector - 1))) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    fd = calloc(1, sizeof(filedisc));
+    if (!fd) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    fd->fd = open(path, readOnly ? O_RDONLY : O_RDWR);
+    if (fd->fd < 0 || fstat(fd->fd, &st) < 0) {
+        int err = errno;
+        if (fd->fd >= 0)
+            close(fd->fd);
+        free(fd);
+        errno = err;
+        return NULL;
+    }
+
+    pthread_mutex_init(&fd->lock, NULL);
+
+    fd->interface.ioType = FILEDISC_IO_TYPE;
+    fd->interface.features = FEATURE_MEDIUM_CANREAD | (readOnly ? 0 : FEATURE_MEDIUM_CANWRITE);
+    fd->interface.startup = filedisc_startup;
+    fd->interface.isInserted = filedisc_isInserted;
+    fd->interface.readSectors = filedisc_readSectors;
+    fd->interface.writeSectors = filedisc_writeSectors;
+    fd->interface.clearStatus = filedisc_clearStatus;
+    fd->interface.shutdown = filedisc_shutdown;
+    fd->interface.bytesPerSector = bytesPerSector ? bytesPerSector : 512;
+    fd->interface.numberOfSectors = st.st_size / fd->interface.bytesPerSector;
+    fd->interface.flush = filedisc_flush;
+
+    return &fd->interface;
+}
+
+void fileDiscClose (DISC_INTERFACE *disc)
+{
+    filedisc *fd = (filedisc *)disc;
+
+    if (!fd)
+        return;
+
+    close(fd->fd);
+    pthread_mutex_destroy(&fd->lock);
+    free(fd);
+}
+
+void fileDiscSetLimits (DISC_INTERFACE *disc, const filedisc_limits *limits)
+{
+    filedisc *fd = (filedisc *)disc;
+
+    pthread_mutex_lock(&fd->lock);
+    if (limits)
+        fd->limits = *limits;
+    else
+        memset(&fd->limits, 0, sizeof(filedisc_limits));
+    pthread_mutex_unlock(&fd->lock);
+}
+
+void fileDiscGetStats (DISC_INTERFACE *disc, filedisc_stats *stats)
+{
+    filedisc *fd = (filedisc *)disc;
+
+    pthread_mutex_lock(&fd->lock);
+    *stats = fd->stats;
+    pthread_mutex_unlock(&fd->lock);
+}
+
+void fileDiscResetStats (DISC_INTERFACE *disc)
+{
+    filedisc *fd = (filedisc *)disc;
+
+    pthread_mutex_lock(&fd->lock);
+    memset(&fd->stats, 0, sizeof(filedisc_stats));
+    pthread_mutex_unlock(&fd->lock);
+}
@@ -0,0 +1,76 @@
+/*
+ * filedisc.h - A disc interface backed by an image file, for running libntfs on the host.
+ *
+ * This program/include file is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program/include file is distributed in the hope that it will be
+ * useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#ifndef _FILEDISC_H
+#define _FILEDISC_H
+
+#include <gccore.h>
+#include <ogc/disc_io.h>
+
+/**
+ * filedisc_limits - Device characteristics to model on top of the image file
+ */
+typedef struct _filedisc_limits {
+    u32 latency;                    /* Microseconds taken by every command */
+    u32 seekLatency;                /* Further microseconds taken by a command that does not follow on from the last one */
+    u32 bandwidth;                  /* Bytes per second moved once a command is under way, 0 for no limit */
+    bool sleep;                     /* Wait out the modelled time as well as counting it */
+} filedisc_limits;
+
+/**
+ * filedisc_stats - Commands seen by a file backed disc
+ */
+typedef struct _filedisc_stats {
+    u64 reads;                      /* Read commands */
+    u64 writes;                     /* Write commands */
+    u64 flushes;                    /* Flush commands */
+    u64 sectorsRead;                /* Sectors moved by read commands */
+    u64 sectorsWritten;             /* Sectors moved by write commands */
+    u64 seeks;                      /* Commands that did not follow on from the last one */
+    u64 unaligned;                  /* Transfers whose buffer could not have been used for DMA */
+    u64 deviceTime;                 /* Modelled time spent in the device, in nanoseconds */
+} filedisc_stats;
+
+/**
+ * Open an image file as a disc
+ *
+ * @param PATH Image file to use
+ * @param BYTESPERSECTOR Sector size to present, 0 for 512 bytes
+ * @param READONLY True if the disc must not be written to
+ *
+ * @return The disc interface, which is started and ready for ntfsMount, or NULL on error (errno is set)
+ */
+DISC_INTERFACE *fileDiscOpen (const char *path, u32 bytesPerSector, bool readOnly);
+
+/**
+ * Close a disc opened by fileDiscOpen
+ */
+void fileDiscClose (DISC_INTERFACE *disc);
+
+/**
+ * Set the device characteristics to model, NULL for none
+ */
+void fileDiscSetLimits (DISC_INTERFACE *disc, const filedisc_limits *limits);
+
+/**
+ * Get the commands seen so far
+ */
+void fileDiscGetStats (DISC_INTERFACE *disc, filedisc_stats *stats);
+
+/**
+ * Reset the commands seen so far
+ */
+void fileDiscResetStats (DISC_INTERFACE *disc);
+
+#endif /* _FILEDISC_H */
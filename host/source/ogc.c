@@ -0,0 +1,372 @@
+/*
+ * ogc.c - Host implementations of the libogc and newlib services used by libntfs.
+ *
+ * Threads, mutexes and condition variables map onto pthreads through small
+ * handle tables, the time base counts nanoseconds and the devoptab table is
+ * a plain array searched by name. The console's own disc interfaces are
+ * present but never report a medium, like empty slots.
+ *
+ * This program/include file is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program/include file is distributed in the hope that it will be
+ * useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <gccore.h>
+#include <sys/iosupport.h>
+#include <sdcard/wiisd_io.h>
+#include <sdcard/gcsd.h>
+#include <ogc/usbstorage.h>
+#include <ogc/dvd.h>
+
+#define MAX_HANDLES		256
+
+static pthread_mutex_t table_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static pthread_mutex_t mutexes[MAX_HANDLES];
+static bool mutex_used[MAX_HANDLES];
+
+static pthread_cond_t conds[MAX_HANDLES];
+static bool cond_used[MAX_HANDLES];
+
+static pthread_t threads[MAX_HANDLES];
+static bool thread_used[MAX_HANDLES];
+
+static int handle_alloc (bool *used)
+{
+    int i;
+
+    pthread_mutex_lock(&table_lock);
+    for (i = 0; i < MAX_HANDLES; i++) {
+        if (!used[i]) {
+            used[i] = true;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&table_lock);
+
+    return (i < MAX_HANDLES) ? i : -1;
+}
+
+static void handle_free (bool *used, u32 handle)
+{
+    pthread_mutex_lock(&table_lock);
+    used[handle] = false;
+    pthread_mutex_unlock(&table_lock);
+}
+
+s32 LWP_MutexInit (mutex_t *mutex, bool use_recursive)
+{
+    pthread_mutexattr_t attr;
+    int i = handle_alloc(mutex_used);
+
+    if (i < 0)
+        return -1;
+
+    // A libogc mutex that is not recursive fails a second lock by its holder rather than blocking
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, use_recursive ? PTHREAD_MUTEX_RECURSIVE : PTHREAD_MUTEX_ERRORCHECK);
+    pthread_mutex_init(&mutexes[i], &attr);
+    pthread_mutexattr_destroy(&attr);
+
+    *mutex = i;
+    return 0;
+}
+
+s32 LWP_MutexDestroy (mutex_t mutex)
+{
+    if (mutex >= MAX_HANDLES)
+        return -1;
+
+    pthread_mutex_destroy(&mutexes[mutex]);
+    handle_free(mutex_used, mutex);
+    return 0;
+}
+
+s32 LWP_MutexLock (mutex_t mutex)
+{
+    return (mutex < MAX_HANDLES) ? pthread_mutex_lock(&mutexes[mutex]) : -1;
+}
+
+s32 LWP_MutexTryLock (mutex_t mutex)
+{
+    return (mutex < MAX_HANDLES) ? pthread_mutex_trylock(&mutexes[mutex]) : -1;
+}
+
+s32 LWP_MutexUnlock (mutex_t mutex)
+{
+    return (mutex < MAX_HANDLES) ? pthread_mutex_unlock(&mutexes[mutex]) : -1;
+}
+
+s32 LWP_CondInit (cond_t *cond)
+{
+    int i = handle_alloc(cond_used);
+
+    if (i < 0)
+        return -1;
+
+    pthread_cond_init(&conds[i], NULL);
+
+    *cond = i;
+    return 0;
+}
+
+s32 LWP_CondDestroy (cond_t cond)
+{
+    if (cond >= MAX_HANDLES)
+        return -1;
+
+    pthread_cond_destroy(&conds[cond]);
+    handle_free(cond_used, cond);
+    return 0;
+}
+
+s32 LWP_CondWait (cond_t cond, mutex_t mutex)
+{
+    return pthread_cond_wait(&conds[cond], &mutexes[mutex]);
+}
+
+s32 LWP_CondTimedWait (cond_t cond, mutex_t mutex, const struct timespec *reltime)
+{
+    struct timespec abstime;
+
+    // libogc takes the timeout as an interval, pthreads wants the time it runs out
+    clock_gettime(CLOCK_REALTIME, &abstime);
+    abstime.tv_sec += reltime->tv_sec;
+    abstime.tv_nsec += reltime->tv_nsec;
+    if (abstime.tv_nsec >= 1000000000L) {
+        abstime.tv_sec++;
+        abstime.tv_nsec -= 1000000000L;
+    }
+
+    return pthread_cond_timedwait(&conds[cond], &mutexes[mutex], &abstime);
+}
+
+s32 LWP_CondSignal (cond_t cond)
+{
+    return pthread_cond_signal(&conds[cond]);
+}
+
+s32 LWP_CondBroadcast (cond_t cond)
+{
+    return pthread_cond_broadcast(&conds[cond]);
+}
+
+s32 LWP_CreateThread (lwp_t *thethread, void *(*entry)(void *), void *arg, void *stackbase, u32 stack_size, u8 prio)
+{
+    int i = handle_alloc(thread_used);
+
+    if (i < 0)
+        return -1;
+
+    // Stacks and priorities are left to the host scheduler
+    if (pthread_create(&threads[i], NULL, entry, arg) != 0) {
+        handle_free(thread_used, i);
+        return -1;
+    }
+
+    *thethread = i;
+    return 0;
+}
+
+s32 LWP_JoinThread (lwp_t thethread, void **value_ptr)
+{
+    if (thethread >= MAX_HANDLES)
+        return -1;
+
+    pthread_join(threads[thethread], value_ptr);
+    handle_free(thread_used, thethread);
+    return 0;
+}
+
+/* Identifiers handed to threads as they first ask for one, clear of the handle table */
+static u32 next_self = MAX_HANDLES;
+static __thread lwp_t self = LWP_THREAD_NULL;
+
+lwp_t LWP_GetSelf (void)
+{
+    if (self == LWP_THREAD_NULL)
+        self = __atomic_fetch_add(&next_self, 1, __ATOMIC_RELAXED);
+
+    return self;
+}
+
+void LWP_YieldThread (void)
+{
+    sched_yield();
+}
+
+u64 gettime (void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (u64)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+bool SYS_IsDMAAddress (const void *addr, u32 align)
+{
+    return addr && ((uintptr_t)addr & (align - 1)) == 0;
+}
+
+const devoptab_t *devoptab_list[STD_MAX];
+
+static int defaultDevice = -1;
+
+int FindDevice (const char *name)
+{
+    size_t namelen;
+    int i;
+
+    if (!name)
+        return -1;
+
+    for (i = 0; i < STD_MAX; i++) {
+        if (!devoptab_list[i])
+            continue;
+
+        namelen = strlen(devoptab_list[i]->name);
+        if (strncmp(devoptab_list[i]->name, name, namelen) == 0 && (name[namelen] == ':' || name[namelen] == '\0'))
+            return i;
+    }
+
+    return -1;
+}
+
+int AddDevice (const devoptab_t *device)
+{
+    int i = FindDevice(device->name);
+
+    // A device of the same name is replaced, as newlib does
+    if (i < 0) {
+        for (i = 0; i < STD_MAX; i++) {
+            if (!devoptab_list[i])
+                break;
+        }
+        if (i == STD_MAX)
+            return -1;
+    }
+
+    devoptab_list[i] = device;
+    return i;
+}
+
+int RemoveDevice (const char *name)
+{
+    int i = FindDevice(name);
+
+    if (i < 0)
+        return -1;
+
+    devoptab_list[i] = NULL;
+    if (defaultDevice == i)
+        defaultDevice = -1;
+
+    return 0;
+}
+
+const devoptab_t *GetDeviceOpTab (const char *name)
+{
+    int i;
+
+    if (!name)
+        return NULL;
+
+    // Paths without a device name refer to the default device
+    if (!strchr(name, ':'))
+        return (defaultDevice >= 0) ? devoptab_list[defaultDevice] : NULL;
+
+    i = FindDevice(name);
+    return (i >= 0) ? devoptab_list[i] : NULL;
+}
+
+int setDefaultDevice (int device)
+{
+    if (device < 0 || device >= STD_MAX || !devoptab_list[device])
+        return -1;
+
+    defaultDevice = device;
+    return 0;
+}
+
+/* File descriptors below this are left for the standard streams */
+#define FIRST_HANDLE	3
+
+static __handle *handles[MAX_HANDLES];
+
+int __alloc_handle (int device)
+{
+    __handle *handle;
+    int fd;
+
+    if (device < 0 || device >= STD_MAX || !devoptab_list[device])
+        return -1;
+
+    handle = calloc(1, sizeof(__handle) + devoptab_list[device]->structSize);
+    if (!handle)
+        return -1;
+
+    pthread_mutex_lock(&table_lock);
+    for (fd = FIRST_HANDLE; fd < MAX_HANDLES; fd++) {
+        if (!handles[fd]) {
+            handles[fd] = handle;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&table_lock);
+
+    if (fd == MAX_HANDLES) {
+        free(handle);
+        return -1;
+    }
+
+    // The file state of the device lives just after the handle, as it does in newlib
+    handle->device = device;
+    handle->refcount = 1;
+    handle->fileStruct = handle + 1;
+    return fd;
+}
+
+__handle *__get_handle (int fd)
+{
+    return (fd >= FIRST_HANDLE && fd < MAX_HANDLES) ? handles[fd] : NULL;
+}
+
+void __release_handle (int fd)
+{
+    __handle *handle = __get_handle(fd);
+
+    if (!handle)
+        return;
+
+    pthread_mutex_lock(&table_lock);
+    handles[fd] = NULL;
+    pthread_mutex_unlock(&table_lock);
+    free(handle);
+}
+
+static bool slot_empty (DISC_INTERFACE *disc)
+{
+    return false;
+}
+
+#define EMPTY_SLOT(type) { type, FEATURE_MEDIUM_CANREAD | FEATURE_MEDIUM_CANWRITE, slot_empty, slot_empty, NULL, NULL, slot_empty, slot_empty, 0, 512, NULL }
+
+DISC_INTERFACE __io_wiisd = EMPTY_SLOT(0x57494953);
+DISC_INTERFACE __io_usbstorage = EMPTY_SLOT(0x55534232);
+DISC_INTERFACE __io_gcsda = EMPTY_SLOT(0x47435344);
+DISC_INTERFACE __io_gcsdb = EMPTY_SLOT(0x47435344);
+DISC_INTERFACE __io_gcsd2 = EMPTY_SLOT(0x47435344);
+DISC_INTERFACE __io_gcode = EMPTY_SLOT(0x47434f44);
@@ -28,6 +28,8 @@
 extern "C" {
 #endif
 
+#include <fcntl.h>
+#include <sys/stat.h>
 #include <gctypes.h>
 #include <gccore.h>
 #include <ogc/disc_io.h>
@@ -41,6 +43,13 @@ extern "C" {
 /* NTFS cache options */
 #define CACHE_DEFAULT_PAGE_COUNT        8  /* The default number of pages in the cache */
 #define CACHE_DEFAULT_PAGE_SIZE         64 /* The default number of sectors per cache page */
+#define CACHE_DEFAULT_META_PAGE_COUNT   0  /* The default number of pages reserved for metadata (0 shares the data pages) */
+#define CACHE_DEFAULT_META_PAGE_SIZE    8  /* The default number of sectors per metadata cache page */
+#define CACHE_DEFAULT_READ_AHEAD        4  /* The default maximum number of pages read at once by a sequential stream */
+#define CACHE_DEFAULT_FLUSH_AGE         0  /* The default age in milliseconds after which dirty pages are written back (0 disables the flusher) */
+#define CACHE_DEFAULT_FLUSH_THRESHOLD   50 /* The default percentage of dirty pages that starts a writeback regardless of age */
+#define LAZY_SYNC_DEFAULT_AGE           5000 /* The default age in milliseconds after which entries left dirty by NTFS_LAZY_SYNC are written back */
+#define GROUP_COMMIT_DEFAULT_WINDOW     2000 /* The default microseconds a device flush waits for other fsyncs already under way to share it */
 
 /* NTFS mount flags */
 #define NTFS_DEFAULT                    0x00000000 /* Standard mount, expects a clean, non-hibernated volume */
@@ -51,9 +60,53 @@ extern "C" {
 #define NTFS_IGNORE_HIBERFILE           0x00000010 /* Mount even if volume is hibernated */
 #define NTFS_READ_ONLY                  0x00000020 /* Mount in read only mode */
 #define NTFS_IGNORE_CASE                0x00000040 /* Ignore case sensitivity. Everything must be and  will be provided in lowercase. */
+#define NTFS_CACHE_LRU                  0x00000080 /* Replace cache pages least-recently-used first instead of using the scan resistant 2Q policy */
+#define NTFS_SHARE_CACHE                0x00000100 /* Share one device cache between all partitions mounted with this flag from the same block device */
+#define NTFS_ASYNC_IO                   0x00000200 /* Read large buffered transfers on a worker thread, overlapping the disc with copying the data out, and the next block of compressed files with decompressing */
+#define NTFS_DISCARD                    0x00000400 /* Tell the device about freed clusters using the discard handler in the mount options */
+#define NTFS_LAZY_SYNC                  0x00000800 /* Keep the entries of closed files dirty in memory and write them back together later (see ntfsSyncVolume) */
+#define NTFS_FAST_MOUNT                 0x00001000 /* Skip the checks reading does not need, leaving the $MFTMirr, $LogFile and hibernation checks for the first write */
+#define NTFS_BEST_FIT                   0x00002000 /* Place allocations of 1 MiB or more in the smallest free extent that holds them whole */
+#define NTFS_NO_PERMISSIONS             0x00004000 /* Single user, give all new entries one security id granting everybody full access instead of a security descriptor of their own */
+#define NTFS_OP_STATS                   0x00008000 /* Time each call made through the devoptab and each wait for the volume lock (see ntfsGetOpStats) */
 #define NTFS_SU                         NTFS_SHOW_HIDDEN_FILES | NTFS_SHOW_SYSTEM_FILES
 #define NTFS_FORCE                      NTFS_RECOVER | NTFS_IGNORE_HIBERFILE
 
+/* Open flag for files whose data should bypass the device cache (e.g. streaming large media files) */
+#if defined(O_DIRECT)
+#define NTFS_O_DIRECT                   O_DIRECT
+#else
+#define NTFS_O_DIRECT                   0x00080000
+#endif
+
+/* Seek directions finding the next data or hole of a sparse file (see lseek) */
+#if defined(SEEK_DATA)
+#define NTFS_SEEK_DATA                  SEEK_DATA
+#else
+#define NTFS_SEEK_DATA                  3
+#endif
+#if defined(SEEK_HOLE)
+#define NTFS_SEEK_HOLE                  SEEK_HOLE
+#else
+#define NTFS_SEEK_HOLE                  4
+#endif
+
+/* Preallocation flags */
+#define NTFS_PREALLOC_KEEP_SIZE         0x00000001 /* Allocate the space without changing the file size */
+#define NTFS_PREALLOC_BEST_FIT          0x00000002 /* Place the space as NTFS_BEST_FIT does, even if the partition was mounted without it */
+
+/* Defragmentation flags */
+#define NTFS_DEFRAG_PARTIAL             0x00000001 /* Settle for fewer extents when no free extent can hold the whole file */
+
+/* Copy flags */
+#define NTFS_COPY_OVERWRITE             0x00000001 /* Replace the destination if it already exists */
+#define NTFS_COPY_UNCACHED              0x00000002 /* Keep the data copied out of the device cache on both ends, as NTFS_O_DIRECT does */
+
+/* Compression levels for data written to compressed files */
+#define NTFS_COMPRESS_BEST              0 /* Search hard for matches, for the smallest files (default) */
+#define NTFS_COMPRESS_FAST              1 /* Take the first match found, several times faster for slightly bigger files */
+#define NTFS_COMPRESS_STORE             2 /* As fast, and write blocks saving less than an eighth uncompressed without finishing them */
+
 /**
  * ntfs_md - NTFS mount descriptor
  */
@@ -63,6 +116,291 @@ typedef struct _ntfs_md {
     sec_t startSector;                  /* Local block address to first sector of partition */
 } ntfs_md;
 
+/**
+ * ntfs_discard_fn - Tell a block device that a run of sectors no longer holds any data (e.g. SD erase or ATA TRIM)
+ */
+typedef bool (*ntfs_discard_fn) (DISC_INTERFACE *interface, sec_t sector, sec_t numSectors);
+
+/**
+ * ntfs_mount_opts - NTFS mount options
+ */
+typedef struct _ntfs_mount_opts {
+    u32 cachePageCount;                 /* The total number of pages in the device cache */
+    u32 cachePageSize;                  /* The number of sectors per cache page (32 to 1024) */
+    u32 cacheMetaPageCount;             /* The number of additional cache pages reserved for metadata (0 to disable) */
+    u32 cacheMetaPageSize;              /* The number of sectors per metadata cache page (at most cachePageSize) */
+    u32 cacheReadAhead;                 /* The maximum number of pages read at once by a sequential stream (0 or 1 to disable) */
+    u32 cacheFlushAge;                  /* Milliseconds a page may stay dirty before a background thread writes it back (0 to disable) */
+    u32 cacheFlushThreshold;            /* Percentage of dirty pages at which the background thread writes them all back */
+    u32 flags;                          /* Additional mounting flags (see above) */
+    ntfs_discard_fn discard;            /* Called with the sectors of freed clusters when NTFS_DISCARD is set (NULL to disable) */
+    u32 ioTraceSize;                    /* The number of device accesses kept in the i/o trace (0 to disable) */
+    u32 lazySyncAge;                    /* Milliseconds an entry may stay dirty under NTFS_LAZY_SYNC before it is written back (0 to wait for a sync) */
+    u32 inodeCacheSize;                 /* The number of full paths kept with the entry they lead to (0 to disable) */
+    u32 nidataCacheSize;                /* The number of closed entries kept in memory for reopening and NTFS_LAZY_SYNC (0 to disable) */
+    u32 lookupCacheSize;                /* The number of names kept with the entry they refer to in their directory (0 to disable) */
+    u32 securidCacheSize;               /* The number of security descriptors kept with their security id (0 to disable) */
+    u32 legacyCacheSize;                /* The number of permission sets kept for volumes without security ids (0 to disable) */
+    u32 mftRecordCacheSize;             /* The number of MFT records kept as read, along with the others of their cluster (0 to disable) */
+    u32 caseIndexSize;                  /* Bytes of upcased names kept for directories searched often under NTFS_IGNORE_CASE (0 to disable) */
+    u32 sdhCacheSize;                   /* The number of security descriptors kept with the id found or allocated for them in $Secure (0 to disable) */
+    u32 reparseCacheSize;               /* The number of symbolic link and junction targets kept for following them again (0 to disable) */
+    u32 compressedBlockCacheSize;       /* The number of decompressed blocks of compressed files kept for reads within them (0 to disable) */
+    u32 compressionLevel;               /* How hard data written to compressed files is compressed (NTFS_COMPRESS_*) */
+    u32 groupCommitWindow;              /* Microseconds a device flush waits for other fsyncs already under way to share it (0 to disable waiting) */
+    u32 memoryBudget;                   /* Bytes the device cache and all other caches of the partition may hold between them (0 for no limit) */
+    u32 mftPreextend;                   /* MFT records to make room for when mounting writable, so that creating them does not fragment $MFT (0 to disable) */
+} ntfs_mount_opts;
+
+/* Classes of caller recorded in the i/o trace */
+#define NTFS_IO_DATA                    0 /* File data read or written through the device cache */
+#define NTFS_IO_METADATA                1 /* Volume metadata (MFT records, indexes, bitmaps, etc.) */
+#define NTFS_IO_UNCACHED                2 /* File data of a file opened with NTFS_O_DIRECT */
+#define NTFS_IO_ASYNC                   3 /* Reads issued by the asynchronous worker (see NTFS_ASYNC_IO) */
+
+/**
+ * ntfs_io_trace_entry - A single device access recorded in the i/o trace
+ */
+typedef struct _ntfs_io_trace_entry {
+    u32 sequence;                       /* Number of accesses recorded before this one */
+    u32 numSectors;                     /* Number of sectors accessed */
+    sec_t sector;                       /* LBA of the first sector accessed */
+    u64 time;                           /* Time the access started (in microseconds since the partition was mounted) */
+    u32 duration;                       /* Time the access took (in microseconds) */
+    u8 caller;                          /* Class of caller (NTFS_IO_*) */
+    bool write;                         /* True for writes, false for reads */
+    bool hit;                           /* True if served by the device cache without touching the block device */
+} ntfs_io_trace_entry;
+
+/* Phases of mounting a partition, in the order they run (see ntfsGetMountStats) */
+#define NTFS_MOUNT_PHASE_OPEN           0  /* Starting the device, reading its boot sector and setting up the device cache */
+#define NTFS_MOUNT_PHASE_BOOT           1  /* Checking the boot sector and setting up the cluster allocator */
+#define NTFS_MOUNT_PHASE_MFT            2  /* Loading $MFT and its bitmap */
+#define NTFS_MOUNT_PHASE_MFTMIRR        3  /* Loading $MFTMirr and comparing it to $MFT */
+#define NTFS_MOUNT_PHASE_BITMAP         4  /* Opening $Bitmap */
+#define NTFS_MOUNT_PHASE_UPCASE         5  /* Loading $UpCase */
+#define NTFS_MOUNT_PHASE_VOLUME         6  /* Reading the version, flags and name from $Volume */
+#define NTFS_MOUNT_PHASE_ATTRDEF        7  /* Loading $AttrDef */
+#define NTFS_MOUNT_PHASE_SECURE         8  /* Opening $Secure */
+#define NTFS_MOUNT_PHASE_LOGFILE        9  /* Checking $LogFile and for hibernation */
+#define NTFS_MOUNT_PHASE_SETUP          10 /* Setting up the lookup caches and the partition */
+#define NTFS_MOUNT_PHASES               11
+
+/**
+ * ntfs_mount_phase_stats - Time and device i/o taken by one phase of mounting a partition
+ */
+typedef struct _ntfs_mount_phase_stats {
+    u32 time;                           /* Time taken (in microseconds) */
+    u32 reads;                          /* Read commands issued to the block device */
+    u32 writes;                         /* Write commands issued to the block device */
+    u64 bytesRead;                      /* Bytes read from the block device */
+    u64 bytesWritten;                   /* Bytes written to the block device */
+} ntfs_mount_phase_stats;
+
+/**
+ * ntfs_mount_stats - Where the time went while mounting a partition
+ */
+typedef struct _ntfs_mount_stats {
+    u32 time;                           /* Total time taken to mount (in microseconds) */
+    ntfs_mount_phase_stats phase[NTFS_MOUNT_PHASES]; /* Each phase, indexed by NTFS_MOUNT_PHASE_* */
+} ntfs_mount_stats;
+
+/**
+ * ntfs_lru_stats - Statistics of one of the ntfs-3g lookup caches
+ */
+typedef struct _ntfs_lru_stats {
+    u32 reads;                          /* Number of lookups */
+    u32 writes;                         /* Number of entries added */
+    u32 hits;                           /* Number of lookups that found an entry */
+} ntfs_lru_stats;
+
+/**
+ * ntfs_cache_stats - NTFS cache statistics
+ */
+typedef struct _ntfs_cache_stats {
+    u64 hits;                           /* Device cache accesses served from a resident page */
+    u64 misses;                         /* Device cache accesses that had to load a page */
+    u64 readAheadPages;                 /* Pages loaded ahead of a sequential stream or prefetched */
+    u64 bypassReads;                    /* Reads passed straight to the block device */
+    u64 bypassWrites;                   /* Writes passed straight to the block device */
+    u64 evictions;                      /* Resident pages replaced to make room */
+    u64 writebacks;                     /* Write commands issued for dirty pages */
+    u64 bytesRead;                      /* Bytes read from the block device */
+    u64 bytesWritten;                   /* Bytes written to the block device */
+    u64 reads;                          /* Read commands issued to the block device */
+    u64 writes;                         /* Write commands issued to the block device */
+    ntfs_lru_stats inodeCache;          /* Extended inode cache */
+    ntfs_lru_stats nidataCache;         /* Inode number cache */
+    ntfs_lru_stats lookupCache;         /* Path lookup cache */
+    ntfs_lru_stats securidCache;        /* Security id cache */
+    ntfs_lru_stats legacyCache;         /* Legacy permission cache */
+    ntfs_lru_stats mftRecordCache;      /* MFT record cache */
+    ntfs_lru_stats sdhCache;            /* Security descriptor cache */
+    ntfs_lru_stats reparseCache;        /* Reparse point target cache */
+    ntfs_lru_stats compressedBlockCache; /* Decompressed compression block cache */
+} ntfs_cache_stats;
+
+/* Devoptab entry points timed under NTFS_OP_STATS (see ntfs_volume_op_stats) */
+#define NTFS_OP_OPEN                    0
+#define NTFS_OP_CLOSE                   1
+#define NTFS_OP_WRITE                   2
+#define NTFS_OP_READ                    3
+#define NTFS_OP_SEEK                    4
+#define NTFS_OP_FSTAT                   5
+#define NTFS_OP_STAT                    6
+#define NTFS_OP_UNLINK                  7
+#define NTFS_OP_CHDIR                   8
+#define NTFS_OP_RENAME                  9
+#define NTFS_OP_MKDIR                   10
+#define NTFS_OP_DIROPEN                 11
+#define NTFS_OP_DIRRESET                12
+#define NTFS_OP_DIRNEXT                 13
+#define NTFS_OP_DIRCLOSE                14
+#define NTFS_OP_STATVFS                 15
+#define NTFS_OP_FTRUNCATE               16
+#define NTFS_OP_FSYNC                   17
+#define NTFS_OP_RMDIR                   18
+#define NTFS_OP_LSTAT                   19
+#define NTFS_OP_SYMLINK                 20
+#define NTFS_OPS                        21
+
+/* Buckets of an operation latency histogram, bucket n counting times from 2^n up to 2^(n+1) microseconds */
+#define NTFS_OP_HISTOGRAM_BUCKETS       24 /* The first also counts times under a microsecond, the last anything of 2^23 microseconds or more */
+
+/**
+ * ntfs_op_stats - Calls made to one devoptab entry point, or waits for the volume lock
+ */
+typedef struct _ntfs_op_stats {
+    u64 calls;                          /* Number of calls (for the volume lock, number of times it was not free) */
+    u64 errors;                         /* Number of calls that failed */
+    u64 time;                           /* Total time taken (in microseconds) */
+    u32 maxTime;                        /* Longest time taken (in microseconds) */
+    u32 histogram[NTFS_OP_HISTOGRAM_BUCKETS]; /* Number of calls by time taken, in log2 buckets */
+} ntfs_op_stats;
+
+/**
+ * ntfs_volume_op_stats - Where the time of the calls made to a mounted partition went
+ */
+typedef struct _ntfs_volume_op_stats {
+    ntfs_op_stats op[NTFS_OPS];         /* Each entry point, indexed by NTFS_OP_* */
+    ntfs_op_stats lockWait;             /* Waits for another thread to let go of the volume lock, exclusive or shared */
+} ntfs_volume_op_stats;
+
+/* Memory held by a mounted partition, by component (see ntfs_memory_usage) */
+#define NTFS_MEMORY_DEVICE_CACHE        0 /* Pages of the device cache, cut down to half the budget (but no fewer than 4 data pages) */
+#define NTFS_MEMORY_CASE_TABLES         1 /* $UpCase and the lowercase table built from it */
+#define NTFS_MEMORY_LOOKUP_CACHES       2 /* The ntfs-3g lookup caches and what their entries keep */
+#define NTFS_MEMORY_CLOSED_ENTRIES      3 /* Closed entries kept in memory for reopening and NTFS_LAZY_SYNC */
+#define NTFS_MEMORY_CASE_INDEX          4 /* Upcased names of directories searched often under NTFS_IGNORE_CASE */
+#define NTFS_MEMORY_RUNLISTS            5 /* Runlists of the system files and of open files (not drawn from the budget) */
+#define NTFS_MEMORY_DIR_ENTRIES         6 /* Entries read ahead for open directories (not drawn from the budget) */
+#define NTFS_MEMORY_COMPONENTS          7
+
+/**
+ * ntfs_memory_usage - Memory held by a mounted partition, as given by ntfsGetMemoryUsage
+ */
+typedef struct _ntfs_memory_usage {
+    u64 budget;                         /* The memory budget the partition was mounted with (0 for none) */
+    u64 total;                          /* Bytes held by all components */
+    u64 used[NTFS_MEMORY_COMPONENTS];   /* Bytes held by each component, indexed by NTFS_MEMORY_* */
+    u64 reclaimed[NTFS_MEMORY_COMPONENTS]; /* Bytes each component gave back to make room for others */
+    u32 denied;                         /* Entries left uncached because the budget was spent */
+} ntfs_memory_usage;
+
+/* File extent flags */
+#define NTFS_EXTENT_HOLE                0x00000001 /* Unallocated range of a sparse file, reads as zeroes */
+#define NTFS_EXTENT_UNWRITTEN           0x00000002 /* Allocated past the initialized size, reads as zeroes whatever the sectors hold */
+#define NTFS_EXTENT_COMPRESSED          0x00000004 /* The sectors hold compressed data */
+#define NTFS_EXTENT_ENCRYPTED           0x00000008 /* The sectors hold encrypted data */
+#define NTFS_EXTENT_RESIDENT            0x00000010 /* Data stored within the file's MFT record, not in sectors of its own */
+#define NTFS_EXTENT_UNMAPPABLE          (NTFS_EXTENT_HOLE | NTFS_EXTENT_UNWRITTEN | NTFS_EXTENT_COMPRESSED | NTFS_EXTENT_ENCRYPTED | NTFS_EXTENT_RESIDENT)
+
+/**
+ * ntfs_file_extent - A range of a file and where it lies on the disc
+ */
+typedef struct _ntfs_file_extent {
+    u64 offset;                         /* Position of the range within the file (in bytes) */
+    u64 length;                         /* Length of the range (in bytes) */
+    sec_t sector;                       /* LBA of the first sector of the range on the block device, or 0 if it has none */
+    u32 flags;                          /* Extent flags (NTFS_EXTENT_*) */
+} ntfs_file_extent;
+
+/* Entry attributes (see ntfs_create_entry) */
+#define NTFS_ENTRY_READONLY             0x00000001 /* The entry is read-only */
+#define NTFS_ENTRY_HIDDEN               0x00000002 /* The entry is hidden */
+#define NTFS_ENTRY_SYSTEM               0x00000004 /* The entry is a system file */
+
+/**
+ * ntfs_create_entry - An entry to create with ntfsCreateEntries
+ */
+typedef struct _ntfs_create_entry {
+    const char *name;                   /* The name of the entry within its directory */
+    mode_t type;                        /* The type of entry (S_IFREG or S_IFDIR) */
+    u32 attributes;                     /* Entry attributes (NTFS_ENTRY_*) */
+    int error;                          /* (out) 0 if the entry was created, otherwise the reason it was not (see errno) */
+} ntfs_create_entry;
+
+/**
+ * ntfs_list_callback - Called by ntfsListDir for each entry listed
+ *
+ * @return Zero to go on listing, or non-zero to stop
+ */
+typedef int (*ntfs_list_callback) (const char *name, const struct stat *st, void *arg);
+
+/* Stream types (see ntfs_stream_entry) */
+#define NTFS_STREAM_DATA                0x00000001 /* A named data stream, opened as "file:name" by Windows */
+#define NTFS_STREAM_EA                  0x00000002 /* An extended attribute */
+
+/**
+ * ntfs_stream_entry - A named data stream or extended attribute listed by ntfsListStreams
+ */
+typedef struct _ntfs_stream_entry {
+    const char *name;                   /* The name of the stream (points into the names buffer given to ntfsListStreams) */
+    u64 size;                           /* The size of its data or value (in bytes) */
+    u32 type;                           /* Stream type (NTFS_STREAM_*) */
+} ntfs_stream_entry;
+
+/**
+ * ntfs_scan_entry - A name handed out by ntfsScanNext
+ */
+typedef struct _ntfs_scan_entry {
+    u64 mref;                           /* The MFT reference of the entry */
+    u64 parent;                         /* The MFT reference of the directory the name is in */
+    const char *name;                   /* The name of the entry within that directory (valid until the next call) */
+    u32 attributes;                     /* Entry attributes (NTFS_ENTRY_* among the other Windows file attributes) */
+    struct stat st;                     /* The status of the entry */
+} ntfs_scan_entry;
+
+/**
+ * ntfs_scan - A whole volume scan started by ntfsScanOpen
+ */
+typedef struct _ntfs_scan ntfs_scan;
+
+/* Path tree flags */
+#define NTFS_PATH_TREE_DIRS_ONLY        0x00000001 /* Only keep directories, leaving files to be named from the path of their parent */
+
+/**
+ * ntfs_path_tree - Directory tree of a volume built by ntfsScanNext, for turning MFT references into paths
+ */
+typedef struct _ntfs_path_tree ntfs_path_tree;
+
+/**
+ * ntfs_frag_stats - Layout of data streams on the disc, as given by ntfsGetFileFragStats and ntfsGetVolumeFragStats
+ */
+typedef struct _ntfs_frag_stats {
+    u64 streams;                        /* Number of non-resident data streams counted */
+    u64 fragmentedStreams;              /* Number of them lying in more than one extent */
+    u64 extents;                        /* Number of extents, runs which follow each other on the disc counting as one */
+    u64 clusters;                       /* Number of clusters allocated to the streams */
+    u64 largestExtent;                  /* Length of the largest extent (in clusters) */
+    u64 averageExtent;                  /* Average length of an extent (in clusters) */
+    u64 sparseClusters;                 /* Number of clusters of the streams left unallocated as holes */
+    u64 compressedClusters;             /* Number of clusters allocated to compressed streams */
+    u64 mftExtents;                     /* Number of extents of the MFT itself */
+    u64 mftClusters;                    /* Number of clusters allocated to the MFT */
+    u32 clusterSize;                    /* Bytes per cluster */
+} ntfs_frag_stats;
+
 /**
  * Find all NTFS partitions on a block device.
  *
@@ -86,6 +424,40 @@ extern int ntfsFindPartitions (DISC_INTERFACE *interface, sec_t **partitions);
  */
 extern int ntfsMountAll (ntfs_md **mounts, u32 flags);
 
+/**
+ * ntfs_mount_callback - Called by ntfsMountAllParallel once every device has been probed and mounted
+ *
+ * @param MOUNTS The array of every mount descriptor made (NULL if COUNT is 0); the callback is responsible for freeing it
+ * @param COUNT The number of entries in MOUNTS
+ * @param DATA The user data given to ntfsMountAllParallel
+ */
+typedef void (*ntfs_mount_callback) (ntfs_md *mounts, int count, void *data);
+
+/**
+ * Mount all NTFS partitions on all inserted block devices, probing and mounting each device on its own thread.
+ *
+ * @param MOUNTS (out) A pointer to receive the array of mount descriptors made before returning
+ * @param FLAGS Additional mounting flags. (see above)
+ * @param PRIMARY The name of the device to wait for (e.g. "sd"), or NULL to wait for all devices
+ * @param CALLBACK Called from the thread of the last device to finish, with all mounts made (may be NULL)
+ * @param DATA User data passed to CALLBACK
+ *
+ * @return The number of entries in MOUNTS or -1 if an error occurred (see errno)
+ * @note The caller is responsible for freeing MOUNTS when finished with it
+ * @note Each device's startup and partition probing overlaps with the others'; a slow device only delays its own mounts
+ * @note Mount names are handed out in the order the mounts complete, so use the interface of each descriptor to tell them apart
+ * @note When PRIMARY is given, the other devices are left to finish in the background; see @ntfsMountAllWait
+ */
+extern int ntfsMountAllParallel (ntfs_md **mounts, u32 flags, const char *primary, ntfs_mount_callback callback, void *data);
+
+/**
+ * Wait for the devices ntfsMountAllParallel left to finish in the background, and release their threads.
+ *
+ * @note Must not be called from the callback given to ntfsMountAllParallel
+ * @note Called by ntfsMountAllParallel itself before it starts another batch
+ */
+extern void ntfsMountAllWait (void);
+
 /**
  * Mount all NTFS partitions on a block devices.
  *
@@ -114,6 +486,29 @@ extern int ntfsMountDevice (DISC_INTERFACE* interface, ntfs_md **mounts, u32 fla
  */
 extern bool ntfsMount (const char *name, DISC_INTERFACE *interface, sec_t startSector, u32 cachePageCount, u32 cachePageSize, u32 flags);
 
+/**
+ * Fill a set of mount options with default values.
+ *
+ * @param OPTS The mount options to initialise
+ */
+extern void ntfsInitMountOptions (ntfs_mount_opts *opts);
+
+/**
+ * Mount a NTFS partition from a specific sector on a block device, using a set of mount options.
+ *
+ * @param NAME The name to mount the device under (can then be accessed as "NAME:/")
+ * @param INTERFACE The block device to mount
+ * @param STARTSECTOR The sector the partition begins at (see @ntfsFindPartitions)
+ * @param OPTS The mount options (see @ntfsInitMountOptions), or NULL to use default values
+ *
+ * @return True if mount was successful, false if no partition was found or an error occurred (see errno)
+ * @note Cache page sizes are rounded down to a power of two
+ * @note Under NTFS_FAST_MOUNT a dirty or hibernated volume still mounts; the first call that writes to it then fails with EROFS
+ *       and the partition stays read-only (unless NTFS_RECOVER or NTFS_IGNORE_HIBERFILE allow it), access times are not
+ *       updated until then
+ */
+extern bool ntfsMountEx (const char *name, DISC_INTERFACE *interface, sec_t startSector, const ntfs_mount_opts *opts);
+
 /**
  * Unmount a NTFS partition.
  *
@@ -142,6 +537,472 @@ extern const char *ntfsGetVolumeName (const char *name);
  */
 extern bool ntfsSetVolumeName (const char *name, const char *volumeName);
 
+/**
+ * Change the device cache geometry of a mounted NTFS partition.
+ *
+ * @param NAME The name of mount (see @ntfsMountAll, @ntfsMountDevice, and @ntfsMount)
+ * @param CACHEPAGECOUNT The total number of pages in the device cache
+ * @param CACHEPAGESIZE The number of sectors per cache page
+ *
+ * @return True if successful, false if an error occurred (see errno)
+ * @note All dirty pages are written back and the cache is emptied, the old cache is kept if this fails
+ * @note Partitions sharing a device cache (see NTFS_SHARE_CACHE) are all affected
+ */
+extern bool ntfsSetCacheParams (const char *name, u32 cachePageCount, u32 cachePageSize);
+
+/**
+ * Get the cache statistics of a mounted NTFS partition.
+ *
+ * @param NAME The name of mount (see @ntfsMountAll, @ntfsMountDevice, and @ntfsMount)
+ * @param STATS (out) A pointer to receive the statistics
+ *
+ * @return True if successful, false if an error occurred (see errno)
+ * @note Caches that are disabled report zero for all of their statistics
+ * @note Partitions sharing a device cache (see NTFS_SHARE_CACHE) report the same device cache statistics
+ */
+extern bool ntfsGetCacheStats (const char *name, ntfs_cache_stats *stats);
+
+/**
+ * Get the memory held by a mounted NTFS partition, by component.
+ *
+ * @param NAME The name of mount (see @ntfsMountAll, @ntfsMountDevice, and @ntfsMount)
+ * @param USAGE (out) A pointer to receive the memory usage
+ *
+ * @return True if successful, false if an error occurred (see errno)
+ * @note Under a budget (see memoryBudget), caches give entries back to each other, those cheapest to rebuild first
+ * @note The device cache and case tables are counted whether or not they fit, as the partition cannot do without them
+ */
+extern bool ntfsGetMemoryUsage (const char *name, ntfs_memory_usage *usage);
+
+/**
+ * Reset the cache statistics of a mounted NTFS partition to zero.
+ *
+ * @param NAME The name of mount (see @ntfsMountAll, @ntfsMountDevice, and @ntfsMount)
+ *
+ * @return True if successful, false if an error occurred (see errno)
+ */
+extern bool ntfsResetCacheStats (const char *name);
+
+/**
+ * Get the operation statistics of a mounted NTFS partition.
+ *
+ * @param NAME The name of mount (see @ntfsMountAll, @ntfsMountDevice, and @ntfsMount)
+ * @param STATS (out) A pointer to receive the statistics
+ *
+ * @return True if successful, false if an error occurred (see errno)
+ * @note Only partitions mounted with NTFS_OP_STATS keep them (EOPNOTSUPP otherwise)
+ * @note Calls are timed as a whole, including any wait for the volume lock, which is also counted on its own
+ */
+extern bool ntfsGetOpStats (const char *name, ntfs_volume_op_stats *stats);
+
+/**
+ * Reset the operation statistics of a mounted NTFS partition to zero.
+ *
+ * @param NAME The name of mount (see @ntfsMountAll, @ntfsMountDevice, and @ntfsMount)
+ *
+ * @return True if successful, false if an error occurred (see errno)
+ * @note Only partitions mounted with NTFS_OP_STATS keep them (EOPNOTSUPP otherwise)
+ */
+extern bool ntfsResetOpStats (const char *name);
+
+/**
+ * Read the i/o trace of a mounted NTFS partition.
+ *
+ * @param NAME The name of mount (see @ntfsMountAll, @ntfsMountDevice, and @ntfsMount)
+ * @param ENTRIES (out) The array to receive the most recent device accesses, oldest first
+ * @param COUNT The number of entries in ENTRIES
+ *
+ * @return The number of entries stored in ENTRIES or -1 if an error occurred (see errno)
+ * @note The trace is only recorded when the partition is mounted with a non-zero ioTraceSize (see @ntfsMountEx)
+ * @note Only the most recent ioTraceSize accesses are kept, gaps in the sequence numbers show where older ones were lost
+ */
+extern int ntfsGetIOTrace (const char *name, ntfs_io_trace_entry *entries, int count);
+
+/**
+ * Count the free clusters and mft records of a mounted NTFS partition again.
+ *
+ * @param NAME The name of mount (see @ntfsMountAll, @ntfsMountDevice, and @ntfsMount)
+ *
+ * @return True if successful, false if an error occurred (see errno)
+ * @note statvfs counts the free space once and keeps it up to date, this reads the bitmaps again in case the counts drifted
+ */
+extern bool ntfsRecountFreeSpace (const char *name);
+
+/**
+ * Make room in $MFT for many new entries at once.
+ *
+ * @param NAME The name of mount (see @ntfsMountAll, @ntfsMountDevice, and @ntfsMount)
+ * @param RECORDS The number of MFT records to make room for
+ *
+ * @return True if successful, false if an error occurred (see errno)
+ * @note $MFT is extended in a single allocation from the MFT zone, so that at least RECORDS records follow the last
+ *       one ever used, records already there count towards RECORDS
+ * @note Otherwise $MFT is extended as entries are created, in steps that double from 16 records up to 1024
+ * @note The space stays with $MFT, which never shrinks
+ */
+extern bool ntfsExtendMft (const char *name, u32 records);
+
+/**
+ * Get the time and device i/o each phase of mounting a NTFS partition took.
+ *
+ * @param NAME The name of mount (see @ntfsMountAll, @ntfsMountDevice, and @ntfsMount)
+ * @param STATS (out) A pointer to receive the timings
+ *
+ * @return True if successful, false if an error occurred (see errno)
+ * @note Phases skipped by the mount (see NTFS_FAST_MOUNT) report zero, device i/o is only counted with a device cache
+ * @note Finding the partition (see @ntfsFindPartitions) comes before the mount and is not included
+ */
+extern bool ntfsGetMountStats (const char *name, ntfs_mount_stats *stats);
+
+/**
+ * Discard the i/o trace of a mounted NTFS partition.
+ *
+ * @param NAME The name of mount (see @ntfsMountAll, @ntfsMountDevice, and @ntfsMount)
+ *
+ * @return True if successful, false if an error occurred (see errno)
+ */
+extern bool ntfsResetIOTrace (const char *name);
+
+/**
+ * Write everything held back in memory for a mounted NTFS partition out to its device.
+ *
+ * @param NAME The name of mount (see @ntfsMountAll, @ntfsMountDevice, and @ntfsMount)
+ *
+ * @return True if successful, false if an error occurred (see errno)
+ * @note Under NTFS_LAZY_SYNC the entries of closed files are otherwise only written back once the oldest is lazySyncAge old
+ *       (checked as entries are closed), when a file is synced or when the partition is unmounted
+ */
+extern bool ntfsSyncVolume (const char *name);
+
+/**
+ * Allocate disc space for a range of an open file, so that later writes to it stream into as few extents as possible.
+ *
+ * @param FD The file descriptor of a file opened for writing on a NTFS partition
+ * @param OFFSET The start of the range (in bytes)
+ * @param LEN The length of the range (in bytes)
+ * @param FLAGS Preallocation flags (see above)
+ *
+ * @return True if successful, false if an error occurred (see errno)
+ * @note Unless NTFS_PREALLOC_KEEP_SIZE is set, a file shorter than OFFSET + LEN is extended and the new space reads as zeroes
+ * @note Clusters are allocated from the end of the file's current allocation onwards; holes earlier in the file are left alone
+ * @note With best fit the range is kept in one extent when any free extent is large enough, else it is allocated first fit
+ * @note Compressed and encrypted files are not supported (EOPNOTSUPP)
+ */
+extern bool ntfsPreallocate (int fd, off_t offset, off_t len, int flags);
+
+/**
+ * Set how hard the data written to an open file is compressed, if the file is compressed.
+ *
+ * @param FD The file descriptor of a file opened on a NTFS partition
+ * @param LEVEL The compression level (NTFS_COMPRESS_*)
+ *
+ * @return True if successful, false if an error occurred (see errno)
+ * @note Files start with the level the partition was mounted with, the level only lasts until the file is closed
+ * @note Data already written keeps the compression it was written with
+ */
+extern bool ntfsSetCompressionLevel (int fd, int level);
+
+/**
+ * Read from an open file at a given position, without moving the file position.
+ *
+ * @param FD The file descriptor of a file opened for reading on a NTFS partition
+ * @param BUF (out) The buffer to receive the data
+ * @param LEN The number of bytes to read
+ * @param OFFSET The position within the file to read from (in bytes)
+ *
+ * @return The number of bytes read, which is short only at the end of the file, or -1 if an error occurred (see errno)
+ * @note Threads may read the same descriptor at once, reads of cached files then overlap where the volume allows it
+ */
+extern ssize_t ntfsPread (int fd, void *buf, size_t len, off_t offset);
+
+/**
+ * Write to an open file at a given position, without moving the file position.
+ *
+ * @param FD The file descriptor of a file opened for writing on a NTFS partition
+ * @param BUF The data to write
+ * @param LEN The number of bytes to write
+ * @param OFFSET The position within the file to write to (in bytes)
+ *
+ * @return The number of bytes written or -1 if an error occurred (see errno)
+ * @note The data is written at OFFSET even if the file was opened in append mode
+ */
+extern ssize_t ntfsPwrite (int fd, const void *buf, size_t len, off_t offset);
+
+/**
+ * Read a whole file in one call, without opening it.
+ *
+ * @param PATH The path of the file to read
+ * @param BUF (out) The buffer to receive the data
+ * @param MAXLEN The size of BUF (in bytes)
+ *
+ * @return The size of the file, of which at most MAXLEN bytes were read, or -1 if an error occurred (see errno)
+ * @note Data small enough to be resident is copied straight from the files record, nothing is written back unless
+ *       access times are kept
+ * @note Encrypted files can not be read (EACCES), nor files too large for their size to be returned (EFBIG)
+ */
+extern ssize_t ntfsReadFile (const char *path, void *buf, size_t maxlen);
+
+/**
+ * Replace the contents of a file in one call, without opening it.
+ *
+ * @param PATH The path of the file to write, which is created if it does not exist
+ * @param BUF The data to write
+ * @param LEN The number of bytes to write
+ *
+ * @return The number of bytes written or -1 if an error occurred (see errno)
+ * @note The file is left untouched, times included, if it already holds exactly the data given
+ * @note Fails with EBUSY while the file is open, and with EACCES for encrypted files
+ */
+extern ssize_t ntfsWriteFile (const char *path, const void *buf, size_t len);
+
+/**
+ * Copy a file, with its named data streams, within a partition or from one partition to another.
+ *
+ * @param SRC The path of the file to copy
+ * @param DST The path of the copy, which must not exist unless NTFS_COPY_OVERWRITE is given
+ * @param FLAGS Copy flags (see above)
+ *
+ * @return True if successful, false if an error occurred (see errno)
+ * @note Both partitions are locked for the whole copy, which is made in large aligned transfers
+ * @note The space of each stream is allocated in one go (in the best fitting free extent) before its data is
+ *       copied, holes of sparse files are kept as holes
+ * @note An existing destination is deleted before the copy is made, and a copy that could not be finished is deleted
+ * @note Fails with EEXIST if the destination exists, EBUSY while it is open and EACCES for encrypted files
+ */
+extern bool ntfsCopyFile (const char *src, const char *dst, int flags);
+
+/**
+ * Map a range of an open file for reading it in place.
+ *
+ * @param FD The file descriptor of a file opened for reading on a NTFS partition
+ * @param OFFSET The start of the range (in bytes)
+ * @param LEN The length of the range (in bytes), which must lie within the file
+ * @param PTR (out) Receives the address of the mapped range
+ *
+ * @return True if successful, false if an error occurred (see errno)
+ * @note A range lying within a single extent and device cache page is pinned there and not copied, other ranges are read into a buffer of their own
+ * @note The mapping is read-only, writes made to the range while it is mapped may or may not show through it
+ * @note The device cache can not be resized while any range is mapped in place (EBUSY)
+ */
+extern bool ntfsMapRange (int fd, off_t offset, size_t len, const void **ptr);
+
+/**
+ * Release a range mapped by ntfsMapRange.
+ *
+ * @param FD The file descriptor the range was mapped from
+ * @param PTR The address the range was mapped at
+ *
+ * @return True if successful, false if PTR is not a range mapped from FD (EINVAL) or another error occurred (see errno)
+ * @note Ranges still mapped when the file is closed are released with it
+ */
+extern bool ntfsUnmapRange (int fd, const void *ptr);
+
+/**
+ * Get the extents of an open file, as ranges of sectors on its block device.
+ *
+ * @param FD The file descriptor of a file opened on a NTFS partition
+ * @param EXTENTS (out) The array to receive the extents, in file order
+ * @param MAX The number of entries in EXTENTS (0 to only count the extents)
+ *
+ * @return The number of extents the file has, which may be more than MAX, or -1 if an error occurred (see errno)
+ * @note Only extents without any of the NTFS_EXTENT_UNMAPPABLE flags can be read straight from the block device
+ * @note Pending writes are flushed to the block device first, the extents stay valid until the file is written to or truncated
+ */
+extern int ntfsGetFileExtents (int fd, ntfs_file_extent *extents, int max);
+
+/**
+ * Move the data of a file into a single extent, or fewer extents than it has.
+ *
+ * @param PATH The path of the file to defragment
+ * @param FLAGS Defragmentation flags (see above)
+ *
+ * @return True if successful, false if an error occurred (see errno)
+ * @note The data is copied to newly allocated clusters before the file is switched over to them, so an interrupted
+ *       or failed call leaves the file as it was and can simply be made again
+ * @note Fails with ENOSPC when the free space does not allow fewer extents, and with EBUSY while the file is open
+ * @note Holes are kept, compressed and encrypted files are not supported (EOPNOTSUPP)
+ */
+extern bool ntfsDefragFile (const char *path, int flags);
+
+/**
+ * Create many entries in one directory at once.
+ *
+ * @param PATH The path of the directory to create the entries in
+ * @param ENTRIES The entries to create, each receiving the result of its creation
+ * @param COUNT The number of entries in ENTRIES
+ *
+ * @return The number of entries created or -1 if the directory could not be used (see errno)
+ * @note Entries are added to the directory index in its own order rather than the order of ENTRIES
+ * @note Entries that fail (e.g. EEXIST) do not stop the others from being created
+ * @note The device is synced once for the whole batch, rather than once per entry as when creating files one by one
+ */
+extern int ntfsCreateEntries (const char *path, ntfs_create_entry *entries, int count);
+
+/**
+ * List the entries of a directory in the order of its index, starting part way through it.
+ *
+ * @param PATH The path of the directory to list
+ * @param AFTER The name the listing starts after, or NULL to start at the beginning
+ * @param PATTERN Only list the names matching this pattern of '*' and '?' wildcards, or NULL to list every name
+ * @param CALLBACK The function given the name and status of each entry listed
+ * @param ARG Passed on to CALLBACK
+ *
+ * @return The number of entries given to CALLBACK or -1 if an error occurred (see errno)
+ * @note The index is ordered by upcased names, so the last name of one page is the AFTER of the next; "." and ".." are not listed
+ * @note Only the part of the index from AFTER, or from the literal start of PATTERN, up to the last entry listed is read
+ * @note Names are matched exactly, or ignoring case on partitions mounted with NTFS_IGNORE_CASE
+ * @note CALLBACK runs with the partition locked and must not change the directory being listed
+ */
+extern int ntfsListDir (const char *path, const char *after, const char *pattern, ntfs_list_callback callback, void *arg);
+
+/**
+ * List the named data streams and extended attributes of an entry.
+ *
+ * @param PATH The path of the file or directory
+ * @param STREAMS (out) The array to receive the streams, in the order they are stored
+ * @param MAX The number of entries in STREAMS (0 to only count the streams)
+ * @param NAMES (out) The buffer to receive the names of the streams
+ * @param SIZE The size of NAMES in bytes
+ *
+ * @return The number of streams the entry has, which may be more than MAX, or -1 if an error occurred (see errno)
+ * @note The attributes of the entry are walked once, so listing costs one read of its MFT record(s) and no stream is opened
+ * @note ERANGE means NAMES is too small for the names of the streams that fit in STREAMS
+ */
+extern int ntfsListStreams (const char *path, ntfs_stream_entry *streams, int max, char *names, size_t size);
+
+/**
+ * Start a scan of every name on a volume, in the order of the Master File Table.
+ *
+ * @param NAME The name of the device to scan
+ *
+ * @return The scan or NULL if an error occurred (see errno)
+ * @note The MFT is read front to back in large chunks, so a whole volume is indexed in one pass without walking its directories
+ */
+extern ntfs_scan *ntfsScanOpen (const char *name);
+
+/**
+ * Get the next name of a volume scan.
+ *
+ * @param SCAN The scan to continue
+ * @param ENTRY (out) The entry the name belongs to
+ *
+ * @return 1 if a name was found, 0 once the whole volume has been scanned or -1 if an error occurred (see errno)
+ * @note Each hard link is a name of its own; short DOS names, the root directory and hidden or system entries
+ *       the mount does not show are left out, and entries which change during the scan may be missed
+ */
+extern int ntfsScanNext (ntfs_scan *scan, ntfs_scan_entry *entry);
+
+/**
+ * Add every name a volume scan hands out from now on to a path tree.
+ *
+ * @param SCAN The scan to take names from
+ * @param TREE The tree to add them to, or NULL to stop adding names
+ *
+ * @return True if successful
+ * @note Names are added as ntfsScanNext hands them out; the tree must outlive the scan, or be detached first
+ */
+extern bool ntfsScanTrackPaths (ntfs_scan *scan, ntfs_path_tree *tree);
+
+/**
+ * End a volume scan.
+ *
+ * @param SCAN The scan to end
+ */
+extern void ntfsScanClose (ntfs_scan *scan);
+
+/**
+ * Open a file from its MFT reference, without looking up its path.
+ *
+ * @param NAME The name of the device the file is on
+ * @param MREF The MFT reference of the file (such as handed out by ntfsScanNext)
+ * @param FLAGS The open() flags to open the file with (O_CREAT is not allowed)
+ *
+ * @return A file descriptor to use and close() as any other, or -1 if an error occurred (see errno)
+ * @note ENOENT means the record is not in use or, when MREF has a sequence number, that it has since been reused;
+ *       directories give EISDIR and system files EINVAL
+ */
+extern int ntfsOpenByRef (const char *name, u64 mref, int flags);
+
+/**
+ * Create an empty path tree.
+ *
+ * @param FLAGS Tree flags (NTFS_PATH_TREE_*)
+ *
+ * @return The tree or NULL if an error occurred (see errno)
+ * @note A tree belongs to no volume and does no device I/O, so callers share it between threads under their own lock
+ */
+extern ntfs_path_tree *ntfsPathTreeCreate (u32 flags);
+
+/**
+ * Add an entry to a path tree, or move or rename an entry it already holds.
+ *
+ * @param TREE The tree to change
+ * @param MREF The MFT reference of the entry
+ * @param PARENT The MFT reference of the directory the entry is now in
+ * @param NAME The name of the entry within that directory
+ * @param DIRECTORY True if the entry is a directory
+ *
+ * @return True if successful
+ * @note An entry has one path in the tree, so a hard link added later replaces the name held. The entries of a
+ *       directory that is moved or renamed follow it without being changed themselves
+ */
+extern bool ntfsPathTreeSet (ntfs_path_tree *tree, u64 mref, u64 parent, const char *name, bool directory);
+
+/**
+ * Remove an entry from a path tree.
+ *
+ * @param TREE The tree to change
+ * @param MREF The MFT reference of the entry
+ *
+ * @return True if successful
+ */
+extern bool ntfsPathTreeRemove (ntfs_path_tree *tree, u64 mref);
+
+/**
+ * Get the full path of an entry held by a path tree, from the root directory of its volume down.
+ *
+ * @param TREE The tree to look in
+ * @param MREF The MFT reference of the entry
+ * @param PATH (out) The buffer to receive the path (such as "/dir/file"), without the name of the device
+ * @param SIZE The size of PATH in bytes
+ *
+ * @return The length of the path or -1 if an error occurred (see errno)
+ * @note ENOENT means the entry or one of its ancestors is not in the tree, or MREF refers to a record that has since
+ *       been reused; ERANGE means PATH is too small for it
+ */
+extern int ntfsPathTreeGetPath (ntfs_path_tree *tree, u64 mref, char *path, size_t size);
+
+/**
+ * Destroy a path tree.
+ *
+ * @param TREE The tree to destroy
+ */
+extern void ntfsPathTreeDestroy (ntfs_path_tree *tree);
+
+/**
+ * Get the layout of the unnamed data stream of a file.
+ *
+ * @param PATH The path of the file
+ * @param STATS (out) The layout of the stream, along with that of the MFT
+ *
+ * @return True if successful, false if an error occurred (see errno)
+ * @note Only the runlist of the stream is decoded, no file data is read; a resident stream counts for nothing
+ */
+extern bool ntfsGetFileFragStats (const char *path, ntfs_frag_stats *stats);
+
+/**
+ * Get the layout of every data stream on a volume.
+ *
+ * @param NAME The name of the device
+ * @param STATS (out) The layout of the streams, along with that of the MFT
+ *
+ * @return True if successful, false if an error occurred (see errno)
+ * @note The MFT is read front to back as by ntfsScanOpen and the runlists are decoded from the records read, no file
+ *       data is read. The system files are left out, apart from the figures of the MFT itself
+ * @note A stream whose runlist is spread over several records counts as fragmented, and its parts as separate extents
+ */
+extern bool ntfsGetVolumeFragStats (const char *name, ntfs_frag_stats *stats);
+
 #ifdef __cplusplus
 }
 #endif
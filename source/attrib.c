@@ -334,6 +334,9 @@ static void __ntfs_attr_init(ntfs_attr *na, ntfs_inode *ni,
 		const ATTR_TYPES type, ntfschar *name, const u32 name_len)
 {
 	na->rl = NULL;
+	na->rl_cursor = NULL;
+	na->rl_count = 0;
+	na->compression_level = ni->vol->compression_level;
 	na->ni = ni;
 	na->type = type;
 	na->name = name;
@@ -423,9 +426,10 @@ ntfs_attr *ntfs_attr_open(ntfs_inode *ni, const ATTR_TYPES type,
 		errno = EINVAL;
 		goto out;
 	}
-	na = ntfs_calloc(sizeof(ntfs_attr));
+	na = ntfs_pool_zget(&ni->vol->attr_pool);
 	if (!na)
 		goto out;
+	na->pool = &ni->vol->attr_pool;
 	if (!name_len)
 		name = (ntfschar*)NULL;
 	if (name && name != AT_UNNAMED && name != NTFS_INDEX_I30) {
@@ -576,7 +580,7 @@ put_err_out:
 	ntfs_attr_put_search_ctx(ctx);
 err_out:
 	free(newname);
-	free(na);
+	ntfs_pool_put(&ni->vol->attr_pool, na);
 	na = NULL;
 	goto out;
 }
@@ -592,13 +596,14 @@ void ntfs_attr_close(ntfs_attr *na)
 {
 	if (!na)
 		return;
+	ntfs_cluster_unreserve(na);
 	if (NAttrNonResident(na) && na->rl)
 		free(na->rl);
 	/* Don't release if using an internal constant. */
 	if (na->name != AT_UNNAMED && na->name != NTFS_INDEX_I30
 				&& na->name != STREAM_SDS)
 		free(na->name);
-	free(na);
+	ntfs_pool_put(na->pool, na);
 }
 
 /**
@@ -632,6 +637,7 @@ int ntfs_attr_map_runlist(ntfs_attr *na, VCN vcn)
 		runlist_element *rl;
 
 		/* Decode the runlist. */
+		na->rl_cursor = NULL;
 		rl = ntfs_mapping_pairs_decompress(na->ni->vol, ctx->attr,
 				na->rl);
 		if (rl) {
@@ -691,6 +697,7 @@ static int ntfs_attr_map_partial_runlist(ntfs_attr *na, VCN vcn)
 				/* Decode and merge the runlist. */
 			if (ntfs_rl_vcn_to_lcn(na->rl, needed)
 						== LCN_RL_NOT_MAPPED) {
+				na->rl_cursor = NULL;
 				rl = ntfs_mapping_pairs_decompress(na->ni->vol,
 					a, na->rl);
 				newrunlist = TRUE;
@@ -788,6 +795,7 @@ int ntfs_attr_map_whole_runlist(ntfs_attr *na)
 
 		if (not_mapped) {
 			/* Decode the runlist. */
+			na->rl_cursor = NULL;
 			rl = ntfs_mapping_pairs_decompress(na->ni->vol,
 								a, na->rl);
 			if (!rl)
@@ -856,6 +864,111 @@ out:
 	return ret;
 }
 
+/**
+ * ntfs_attr_release_runlist - free the decoded runlist of an ntfs attribute
+ * @na:		ntfs attribute whose runlist to release
+ *
+ * Free the runlist of the non-resident ntfs attribute @na, if it is the same
+ * as the mapping pairs in the attribute extents, so that it only takes memory
+ * again once it is needed and decoded anew. Reservations are not affected.
+ *
+ * Return 0 on success and -1 on error with errno set to the error code:
+ *	EBUSY		The runlist has changes not yet written to the mapping
+ *			pairs, or is for compressed data.
+ */
+int ntfs_attr_release_runlist(ntfs_attr *na)
+{
+	if (!na->rl)
+		return 0;
+	if (NAttrRunlistDirty(na) || NAttrDataAppending(na)
+	    || NAttrBeingNonResident(na) || NAttrComprClosing(na)
+	    || (na->data_flags & ATTR_COMPRESSION_MASK)) {
+		errno = EBUSY;
+		return -1;
+	}
+	free(na->rl);
+	na->rl = NULL;
+	na->rl_cursor = NULL;
+	NAttrClearFullyMapped(na);
+	return 0;
+}
+
+/*
+ *		Locate the element of a mapped runlist which contains a vcn
+ *
+ *	Returns the terminator if the vcn is beyond the runlist, the vcn
+ *	must not be below the first element.
+ *
+ *	Lookups at or next to the element found last time are resolved
+ *	directly, others binary search the runlist, whose length is only
+ *	recounted when the runlist has been changed.
+ */
+
+static runlist_element *ntfs_attr_rl_seek(ntfs_attr *na, const VCN vcn)
+{
+	runlist_element *rl;
+	runlist_element *cursor;
+	int count;
+
+	rl = na->rl;
+		/*
+		 * Compressed runlists are rearranged in place when
+		 * writing, so their position is not worth remembering.
+		 */
+	if (na->data_flags & ATTR_COMPRESSION_MASK) {
+		while (rl->length && (vcn >= rl[1].vcn))
+			rl++;
+		return (rl);
+	}
+	cursor = na->rl_cursor;
+	if (cursor) {
+		if ((vcn >= cursor->vcn) && (vcn < cursor[1].vcn))
+			return (cursor);
+		if ((vcn >= cursor[1].vcn) && cursor[1].length
+		    && (vcn < cursor[2].vcn)) {
+			na->rl_cursor = ++cursor;
+			return (cursor);
+		}
+		count = na->rl_count;
+	} else
+		count = 0;
+		/* the runlist may have been extended in place */
+	while (rl[count].length)
+		count++;
+	na->rl_count = count;
+	if (vcn >= rl[count].vcn)
+		return (&rl[count]);
+	rl = ntfs_rl_find_vcn(rl, count, vcn);
+	na->rl_cursor = rl;
+	return (rl);
+}
+
+/*
+ *		Convert a vcn into a lcn through the mapped runlist of an attribute
+ *
+ *	Same as ntfs_rl_vcn_to_lcn(), with the lookup done by
+ *	ntfs_attr_rl_seek()
+ */
+
+static LCN ntfs_attr_rl_vcn_to_lcn(ntfs_attr *na, const VCN vcn)
+{
+	runlist_element *rl;
+
+	if (!na->rl)
+		return ((LCN)LCN_RL_NOT_MAPPED);
+	if (vcn < na->rl[0].vcn)
+		return ((LCN)LCN_ENOENT);
+	rl = ntfs_attr_rl_seek(na, vcn);
+	if (rl->length) {
+		if (rl->lcn >= (LCN)0)
+			return (rl->lcn + (vcn - rl->vcn));
+		return (rl->lcn);
+	}
+	if (rl->lcn < (LCN)0)
+		return (rl->lcn);
+	return ((LCN)LCN_ENOENT);
+}
+
 /**
  * ntfs_attr_vcn_to_lcn - convert a vcn into a lcn given an ntfs attribute
  * @na:		ntfs attribute whose runlist to use for conversion
@@ -889,7 +1002,7 @@ LCN ntfs_attr_vcn_to_lcn(ntfs_attr *na, const VCN vcn)
 			long)na->ni->mft_no, le32_to_cpu(na->type));
 retry:
 	/* Convert vcn to lcn. If that fails map the runlist and retry once. */
-	lcn = ntfs_rl_vcn_to_lcn(na->rl, vcn);
+	lcn = ntfs_attr_rl_vcn_to_lcn(na, vcn);
 	if (lcn >= 0)
 		return lcn;
 	if (!is_retry && !ntfs_attr_map_runlist(na, vcn)) {
@@ -946,14 +1059,9 @@ retry:
 		goto map_rl;
 	if (vcn < rl[0].vcn)
 		goto map_rl;
-	while (rl->length) {
-		if (vcn < rl[1].vcn) {
-			if (rl->lcn >= (LCN)LCN_HOLE)
-				return rl;
-			break;
-		}
-		rl++;
-	}
+	rl = ntfs_attr_rl_seek(na, vcn);
+	if (rl->length && rl->lcn >= (LCN)LCN_HOLE)
+		return rl;
 	switch (rl->lcn) {
 	case (LCN)LCN_RL_NOT_MAPPED:
 		goto map_rl;
@@ -985,6 +1093,34 @@ map_rl:
 	return NULL;
 }
 
+/*
+ *		Keep the decoded runlist of a file within bounds while reading
+ *	or overwriting it
+ *
+ *	Before the extent containing a vcn is mapped, the extents mapped
+ *	so far are forgotten if they already hold too many runs, so that
+ *	going through a badly fragmented file does not end with all of
+ *	its runlist in memory. They are decoded again from the mapping
+ *	pairs if needed, so nothing is done while the runlist has pending
+ *	changes. Only user data is concerned, the callers walking the
+ *	runlists of metadata are not prepared for them to shrink.
+ */
+
+static void ntfs_attr_window_runlist(ntfs_attr *na, const VCN vcn)
+{
+	int count;
+
+	if (!na->rl || (na->type != AT_DATA)
+	    || (na->ni->mft_no < FILE_first_user)
+	    || (ntfs_attr_rl_vcn_to_lcn(na, vcn) != LCN_RL_NOT_MAPPED))
+		return;
+	count = 0;
+	while (na->rl[count].length)
+		count++;
+	if (count > NTFS_RL_WINDOW_RUNS)
+		ntfs_attr_release_runlist(na);
+}
+
 /**
  * ntfs_attr_pread_i - see description at ntfs_attr_pread()
  */ 
@@ -993,6 +1129,7 @@ static s64 ntfs_attr_pread_i(ntfs_attr *na, const s64 pos, s64 count, void *b)
 	s64 br, to_read, ofs, total, total2, max_read, max_init;
 	ntfs_volume *vol;
 	runlist_element *rl;
+	LCN lcn;
 	u16 efs_padding_length;
 
 	/* Sanity checking arguments is done in ntfs_attr_pread(). */
@@ -1107,6 +1244,7 @@ res_err_out:
 	}
 	
 	/* Find the runlist element containing the vcn. */
+	ntfs_attr_window_runlist(na, pos >> vol->cluster_size_bits);
 	rl = ntfs_attr_find_vcn(na, pos >> vol->cluster_size_bits);
 	if (!rl) {
 		/*
@@ -1128,7 +1266,10 @@ res_err_out:
 	ofs = pos - (rl->vcn << vol->cluster_size_bits);
 	for (; count; rl++, ofs = 0) {
 		if (rl->lcn == LCN_RL_NOT_MAPPED) {
-			rl = ntfs_attr_find_vcn(na, rl->vcn);
+			VCN vcn = rl->vcn;
+
+			ntfs_attr_window_runlist(na, vcn);
+			rl = ntfs_attr_find_vcn(na, vcn);
 			if (!rl) {
 				if (errno == ENOENT) {
 					errno = EIO;
@@ -1165,11 +1306,19 @@ res_err_out:
 		/* It is a real lcn, read it into @dst. */
 		to_read = min(count, (rl->length << vol->cluster_size_bits) -
 				ofs);
+		lcn = rl->lcn;
+		/* Runs following on disk are read along in the same request. */
+		while ((to_read < count) && rl[1].length
+		    && (rl[1].lcn == rl->lcn + rl->length)) {
+			rl++;
+			to_read = min(count, to_read
+					+ (rl->length << vol->cluster_size_bits));
+		}
 retry:
 		ntfs_log_trace("Reading %lld bytes from vcn %lld, lcn %lld, ofs"
 				" %lld.\n", (long long)to_read, (long long)rl->vcn,
-			       (long long )rl->lcn, (long long)ofs);
-		br = ntfs_pread(vol->dev, (rl->lcn << vol->cluster_size_bits) +
+			       (long long )lcn, (long long)ofs);
+		br = ntfs_pread(vol->dev, (lcn << vol->cluster_size_bits) +
 				ofs, to_read, b);
 		/* If everything ok, update progress counters and continue. */
 		if (br > 0) {
@@ -1217,8 +1366,22 @@ rl_err_out:
  * to the return code of ntfs_pread(), or to EINVAL in case of invalid
  * arguments.
  */
+/*
+ *		Check whether an attribute holds file system metadata,
+ *	which the device caches apart from file data.
+ *
+ *	The journal is written in bulk and is left out.
+ */
+static BOOL ntfs_attr_is_metadata(const ntfs_attr *na)
+{
+	return (na->ni->mft_no < FILE_first_user)
+		&& (na->ni->mft_no != FILE_LogFile);
+}
+
 s64 ntfs_attr_pread(ntfs_attr *na, const s64 pos, s64 count, void *b)
 {
+	struct ntfs_device *dev;
+	BOOL was_meta;
 	s64 ret;
 	
 	if (!na || !na->ni || !na->ni->vol || !b || pos < 0 || count < 0) {
@@ -1233,7 +1396,14 @@ s64 ntfs_attr_pread(ntfs_attr *na, const s64 pos, s64 count, void *b)
 		       "%lld\n", (unsigned long long)na->ni->mft_no,
 		       le32_to_cpu(na->type), (long long)pos, (long long)count);
 
+	dev = na->ni->vol->dev;
+	/* User data is read by threads sharing the volume, leave the flags alone */
+	was_meta = !ntfs_attr_is_metadata(na) || NDevMetadata(dev);
+	if (!was_meta)
+		NDevSetMetadata(dev);
 	ret = ntfs_attr_pread_i(na, pos, count, b);
+	if (!was_meta)
+		NDevClearMetadata(dev);
 	
 	ntfs_log_leave("\n");
 	return ret;
@@ -1260,9 +1430,19 @@ static int ntfs_attr_fill_zero(ntfs_attr *na, s64 pos, s64 count)
 	if (!buf)
 		goto err_out;
 	
-	rli = na->rl;
-	ofsi = 0;
 	vol = na->ni->vol;
+		/*
+		 * Start from the run containing @pos rather than from the
+		 * beginning of the runlist, a long sparse file may have
+		 * many runs ahead of the gap.
+		 */
+	rli = ntfs_attr_find_vcn(na, pos >> vol->cluster_size_bits);
+	if (rli)
+		ofsi = rli->vcn << vol->cluster_size_bits;
+	else {
+		rli = na->rl;
+		ofsi = 0;
+	}
 	while (pos < end) {
 		while (rli->length && (ofsi + (rli->length <<
 	                        vol->cluster_size_bits) <= pos)) {
@@ -1301,7 +1481,8 @@ err_out:
 }
 
 static int ntfs_attr_fill_hole(ntfs_attr *na, s64 count, s64 *ofs, 
-			       runlist_element **rl, VCN *update_from)
+			       runlist_element **rl, VCN *update_from,
+			       s64 *zero_head)
 {
 	s64 to_write;
 	s64 need;
@@ -1424,9 +1605,12 @@ static int ntfs_attr_fill_hole(ntfs_attr *na, s64 count, s64 *ofs,
 				 lcn_seek_from, DATA_ZONE);
 	if (!rlc)
 		goto err_out;
+	if (na->type == AT_DATA)
+		ntfs_cluster_reserve(na, rlc);
 	if (na->data_flags & (ATTR_COMPRESSION_MASK | ATTR_IS_SPARSE))
 		na->compressed_size += need << vol->cluster_size_bits;
 	
+	na->rl_cursor = NULL;
 	*rl = ntfs_runlists_merge(na->rl, rlc);
 	NAttrSetRunlistDirty(na);
 		/*
@@ -1474,7 +1658,14 @@ static int ntfs_attr_fill_hole(ntfs_attr *na, s64 count, s64 *ofs,
 		errno = EIO;
 		goto err_out;
 	}
-	if (*ofs) {
+	if (zero_head && !(na->data_flags & ATTR_COMPRESSION_MASK)) {
+		/*
+		 * Only the first allocated cluster has to be cleared ahead
+		 * of @*ofs, the rest of the hole is left sparse. Let the
+		 * caller write these zeroes along with its data.
+		 */
+		*zero_head = *ofs & (vol->cluster_size - 1);
+	} else if (*ofs) {
 		/* Clear non-sparse region from @cur_vcn to @*ofs. */
 		if (ntfs_attr_fill_zero(na, cur_vcn << vol->cluster_size_bits,
 					*ofs))
@@ -1805,7 +1996,7 @@ static int borrow_from_hole(ntfs_attr *na, runlist_element **prl,
 			xofs = 0;
 			if (ntfs_attr_fill_hole(na,
 				    zrl->length << cluster_size_bits,
-				    &xofs, &zrl, update_from))
+				    &xofs, &zrl, update_from, NULL))
 					compressed_part = -1;
 			else {
 			/* go back to initial cluster, now reallocated */
@@ -1857,6 +2048,7 @@ static s64 ntfs_attr_pwrite_i(ntfs_attr *na, const s64 pos, s64 count,
 	ntfs_attr_search_ctx *ctx = NULL;
 	runlist_element *rl;
 	s64 hole_end;
+	s64 zero_head = 0;
 	int eo;
 	int compressed_part;
 	struct {
@@ -2055,11 +2247,26 @@ static s64 ntfs_attr_pwrite_i(ntfs_attr *na, const s64 pos, s64 count,
 				0, NULL, 0, ctx))
 			goto err_out;
 		
-		/* If write starts beyond initialized_size, zero the gap. */
-		if (pos > na->initialized_size)
-			if (ntfs_attr_fill_zero(na, na->initialized_size, 
+		/*
+		 * If write starts beyond initialized_size, zero the gap.
+		 * A short gap in the same run as @pos is written along
+		 * with the data instead.
+		 */
+		if (pos > na->initialized_size) {
+			const runlist_element *grl;
+
+			grl = (compressed
+				|| (pos - na->initialized_size > NTFS_BUF_SIZE)
+				? NULL : ntfs_attr_find_vcn(na,
+				    na->initialized_size >> vol->cluster_size_bits));
+			if (grl && (grl->lcn >= 0)
+			    && ((pos >> vol->cluster_size_bits)
+					< grl->vcn + grl->length))
+				zero_head = pos - na->initialized_size;
+			else if (ntfs_attr_fill_zero(na, na->initialized_size, 
 						pos - na->initialized_size))
 				goto err_out;
+		}
 			
 		ctx->attr->initialized_size = cpu_to_sle64(pos + count);
 		/* fix data_size for compressed files */
@@ -2104,6 +2311,7 @@ static s64 ntfs_attr_pwrite_i(ntfs_attr *na, const s64 pos, s64 count,
 		need_to.undo_initialized_size = 1;
 	}
 	/* Find the runlist element containing the vcn. */
+	ntfs_attr_window_runlist(na, pos >> vol->cluster_size_bits);
 	rl = ntfs_attr_find_vcn(na, pos >> vol->cluster_size_bits);
 	if (!rl) {
 		/*
@@ -2183,7 +2391,10 @@ static s64 ntfs_attr_pwrite_i(ntfs_attr *na, const s64 pos, s64 count,
 	 */
 	for (hole_end = 0; count; rl++, ofs = 0) {
 		if (rl->lcn == LCN_RL_NOT_MAPPED) {
-			rl = ntfs_attr_find_vcn(na, rl->vcn);
+			VCN vcn = rl->vcn;
+
+			ntfs_attr_window_runlist(na, vcn);
+			rl = ntfs_attr_find_vcn(na, vcn);
 			if (!rl) {
 				if (errno == ENOENT) {
 					errno = EIO;
@@ -2211,7 +2422,7 @@ static s64 ntfs_attr_pwrite_i(ntfs_attr *na, const s64 pos, s64 count,
 				goto rl_err_out;
 			}
 			if (ntfs_attr_fill_hole(na, fullcount, &ofs, &rl,
-					 &update_from))
+					 &update_from, &zero_head))
 				goto err_out;
 		}
 		if (compressed) {
@@ -2245,19 +2456,28 @@ retry:
 			 * This is done even for compressed files, because
 			 * data is generally first written uncompressed.
 			 */
-			if (rounding && ((wend == na->initialized_size) ||
-				(wend < (hole_end << vol->cluster_size_bits)))){
+			if (!((wend == na->initialized_size) ||
+				(wend < (hole_end << vol->cluster_size_bits))))
+				rounding = 0;
+			/*
+			 * Zeroes needed ahead of the data (a fresh cluster
+			 * out of a hole, or a short gap beyond the former
+			 * initialized size) go out in the same write.
+			 */
+			if (rounding || zero_head) {
 				
 				char *cb;
 				
 				rounding += to_write;
 				
-				cb = ntfs_malloc(rounding);
+				cb = ntfs_malloc(zero_head + rounding);
 				if (!cb)
 					goto err_out;
 				
-				memcpy(cb, b, to_write);
-				memset(cb + to_write, 0, rounding - to_write);
+				memset(cb, 0, zero_head);
+				memcpy(cb + zero_head, b, to_write);
+				memset(cb + zero_head + to_write, 0,
+						rounding - to_write);
 				
 				if (compressed) {
 					written = ntfs_compressed_pwrite(na,
@@ -2265,13 +2485,17 @@ retry:
 						rounding, cb, compressed_part,
 						&update_from);
 				} else {
-					written = ntfs_pwrite(vol->dev, wpos,
-						rounding, cb); 
-					if (written == rounding)
+					written = ntfs_pwrite(vol->dev,
+						wpos - zero_head,
+						zero_head + rounding, cb); 
+					if (written == zero_head + rounding)
 						written = to_write;
+					else if (zero_head && (written > 0))
+						written = 0;
 				}
 				
 				free(cb);
+				zero_head = 0;
 			} else {
 				if (compressed) {
 					written = ntfs_compressed_pwrite(na,
@@ -2394,6 +2618,8 @@ errno_set:
 
 s64 ntfs_attr_pwrite(ntfs_attr *na, const s64 pos, s64 count, const void *b)
 {
+	struct ntfs_device *dev;
+	BOOL was_meta;
 	s64 total;
 	s64 written;
 
@@ -2409,6 +2635,10 @@ s64 ntfs_attr_pwrite(ntfs_attr *na, const s64 pos, s64 count, const void *b)
 		goto out;
 	}
 
+	dev = na->ni->vol->dev;
+	was_meta = NDevMetadata(dev);
+	if (ntfs_attr_is_metadata(na))
+		NDevSetMetadata(dev);
 		/*
 		 * Compressed attributes may be written partially, so
 		 * we may have to iterate.
@@ -2419,6 +2649,9 @@ s64 ntfs_attr_pwrite(ntfs_attr *na, const s64 pos, s64 count, const void *b)
 		if (written > 0)
 			total += written;
 	} while ((written > 0) && (total < count));
+	ntfs_compressed_invalidate(na);
+	if (!was_meta)
+		NDevClearMetadata(dev);
 out :
 	ntfs_log_leave("\n");
 	return (total > 0 ? total : written);
@@ -2555,7 +2788,8 @@ int ntfs_attr_pclose(ntfs_attr *na)
 			goto rl_err_out;
 		}
 			
-		if (ntfs_attr_fill_hole(na, (s64)0, &ofs, &rl, &update_from))
+		if (ntfs_attr_fill_hole(na, (s64)0, &ofs, &rl, &update_from,
+				NULL))
 			goto err_out;
 	}
 	while (rl->length
@@ -2654,6 +2888,8 @@ errno_set:
 s64 ntfs_attr_mst_pread(ntfs_attr *na, const s64 pos, const s64 bk_cnt,
 		const u32 bk_size, void *dst)
 {
+	struct ntfs_device *dev;
+	BOOL was_meta;
 	s64 br;
 	u8 *end;
 	BOOL warn;
@@ -2666,7 +2902,13 @@ s64 ntfs_attr_mst_pread(ntfs_attr *na, const s64 pos, const s64 bk_cnt,
 		ntfs_log_perror("%s", __FUNCTION__);
 		return -1;
 	}
+		/* mst protected blocks are always metadata */
+	dev = na->ni->vol->dev;
+	was_meta = NDevMetadata(dev);
+	NDevSetMetadata(dev);
 	br = ntfs_attr_pread(na, pos, bk_cnt * bk_size, dst);
+	if (!was_meta)
+		NDevClearMetadata(dev);
 	if (br <= 0)
 		return br;
 	br /= bk_size;
@@ -2679,6 +2921,65 @@ s64 ntfs_attr_mst_pread(ntfs_attr *na, const s64 pos, const s64 bk_cnt,
 	return br;
 }
 
+/**
+ * ntfs_attr_prefetch - read part of a non-resident attribute into the cache
+ * @na:		ntfs attribute to prefetch
+ * @pos:	byte position in the attribute to begin prefetching from
+ * @count:	number of bytes to prefetch
+ *
+ * Ask the device to load the clusters holding @count bytes of @na from @pos
+ * into its cache, one request per run, so that the reads which follow are
+ * served from memory whatever order they come in. Holes have nothing to load
+ * and are passed over, as are resident, compressed and encrypted attributes
+ * as a whole.
+ *
+ * Return the number of bytes from @pos on that were dealt with, which is less
+ * than @count when the cache could not take any more, or -1 with errno set if
+ * nothing was, in particular to EOPNOTSUPP when the device has no cache.
+ */
+s64 ntfs_attr_prefetch(ntfs_attr *na, const s64 pos, s64 count)
+{
+	ntfs_volume *vol;
+	runlist_element *rl;
+	u64 range[2];
+	s64 done, ofs, len;
+
+	if (!na || !na->ni || !na->ni->vol || pos < 0 || count < 0) {
+		errno = EINVAL;
+		return -1;
+	}
+	if (!NAttrNonResident(na)
+	    || (na->data_flags & (ATTR_COMPRESSION_MASK | ATTR_IS_ENCRYPTED))
+	    || pos >= na->initialized_size)
+		return 0;
+	if (count > na->initialized_size - pos)
+		count = na->initialized_size - pos;
+
+	vol = na->ni->vol;
+	if (!vol->dev->d_ops->ioctl) {
+		errno = EOPNOTSUPP;
+		return -1;
+	}
+	for (done = 0; done < count; done += len) {
+		rl = ntfs_attr_find_vcn(na, (pos + done) >> vol->cluster_size_bits);
+		if (!rl)
+			break;
+		ofs = pos + done - (rl->vcn << vol->cluster_size_bits);
+		len = (rl->length << vol->cluster_size_bits) - ofs;
+		if (len > count - done)
+			len = count - done;
+		if (rl->lcn < 0)
+			continue;
+		range[0] = (rl->lcn << vol->cluster_size_bits) + ofs;
+		range[1] = len;
+		if (vol->dev->d_ops->ioctl(vol->dev, NTFS_IOC_PREFETCH, range))
+			break;
+		if ((s64)range[1] < len)
+			return (done + range[1]);
+	}
+	return (done || !count ? done : -1);
+}
+
 /**
  * ntfs_attr_mst_pwrite - multi sector transfer protected ntfs attribute write
  * @na:		multi sector transfer protected ntfs attribute to write to
@@ -2712,6 +3013,8 @@ s64 ntfs_attr_mst_pread(ntfs_attr *na, const s64 pos, const s64 bk_cnt,
 s64 ntfs_attr_mst_pwrite(ntfs_attr *na, const s64 pos, s64 bk_cnt,
 		const u32 bk_size, void *src)
 {
+	struct ntfs_device *dev;
+	BOOL was_meta;
 	s64 written, i;
 
 	ntfs_log_trace("Entering for inode 0x%llx, attr type 0x%x, pos 0x%llx.\n",
@@ -2738,8 +3041,13 @@ s64 ntfs_attr_mst_pwrite(ntfs_attr *na, const s64 pos, s64 bk_cnt,
 			break;
 		}
 	}
-	/* Write the prepared data. */
+	/* Write the prepared data, mst protected blocks are always metadata. */
+	dev = na->ni->vol->dev;
+	was_meta = NDevMetadata(dev);
+	NDevSetMetadata(dev);
 	written = ntfs_attr_pwrite(na, pos, bk_cnt * bk_size, src);
+	if (!was_meta)
+		NDevClearMetadata(dev);
 	if (written <= 0) {
 		ntfs_log_perror("%s: written=%lld", __FUNCTION__,
 				(long long)written);
@@ -2992,6 +3300,146 @@ char *ntfs_attr_name_get(const ntfschar *uname, const int uname_len)
 	return NULL;
 }
 
+#if ATTR_INDEX_SIZE
+
+/*
+ *		Hash an attribute name for the attribute index
+ */
+
+static u16 ntfs_attr_index_hash(const ntfschar *name, u32 name_len)
+{
+	u32 h;
+	u32 i;
+
+	h = 0;
+	for (i=0; i<name_len; i++)
+		h = h*31 + le16_to_cpu(name[i]);
+	return (h ^ (h >> 16));
+}
+
+/*
+ *		Find an attribute through the attribute index of an inode
+ *
+ *	On success, @ctx is left as ntfs_external_attr_find() would have
+ *	left it for a first search of the same attribute.  When looking
+ *	for a higher vcn, only @ctx->al_entry is moved forward to the first
+ *	entry of the attribute, for the scan to start from there.  A
+ *	remembered entry which no longer matches is dropped.
+ *
+ *	Returns 0 if found, -1 if the attribute list has to be scanned
+ */
+
+static int ntfs_attr_index_find(ntfs_inode *base_ni, ATTR_TYPES type,
+		const ntfschar *name, u32 name_len, u16 hash,
+		const VCN lowest_vcn, ntfs_attr_search_ctx *ctx)
+{
+	struct ATTR_INDEX_ENTRY *entry;
+	ATTR_LIST_ENTRY *al_entry;
+	ATTR_RECORD *a;
+	MFT_RECORD *mrec;
+	ntfs_inode *ni;
+	u32 offs;
+	int i;
+
+	for (i=0; (i<base_ni->attr_index_count)
+			&& ((base_ni->attr_index[i].type != type)
+			    || (base_ni->attr_index[i].name_len != name_len)
+			    || (base_ni->attr_index[i].name_hash != hash)); i++)
+		;
+	if (i >= base_ni->attr_index_count)
+		return (-1);
+	entry = &base_ni->attr_index[i];
+		/* check the attribute list entry is still the first one */
+	offs = entry->al_offset;
+	al_entry = (ATTR_LIST_ENTRY*)(base_ni->attr_list + offs);
+	if ((offs + offsetof(ATTR_LIST_ENTRY, name) > base_ni->attr_list_size)
+	    || (offs + le16_to_cpu(al_entry->length)
+			> base_ni->attr_list_size)
+	    || (al_entry->type != type)
+	    || (al_entry->name_length != name_len)
+	    || (al_entry->name_offset + name_len*sizeof(ntfschar)
+			> le16_to_cpu(al_entry->length))
+	    || al_entry->lowest_vcn
+	    || (name_len && memcmp((u8*)al_entry + al_entry->name_offset,
+			name, name_len*sizeof(ntfschar))))
+		goto stale;
+	if (lowest_vcn) {
+		ctx->al_entry = al_entry;
+		return (-1);
+	}
+		/* get the record, as the full search would */
+	if (MREF_LE(al_entry->mft_reference) == base_ni->mft_no) {
+		if (MSEQNO_LE(al_entry->mft_reference)
+		    != le16_to_cpu(base_ni->mrec->sequence_number))
+			goto stale;
+		ni = base_ni;
+		mrec = ctx->base_mrec;
+	} else {
+		if (!base_ni->vol->mft_na)
+			goto stale;
+		ni = ntfs_extent_inode_open(base_ni, al_entry->mft_reference);
+		if (!ni)
+			goto stale;
+		mrec = ni->mrec;
+	}
+		/* check the attribute record has not moved */
+	offs = entry->attr_offset;
+	a = (ATTR_RECORD*)((u8*)mrec + offs);
+	if ((offs < le16_to_cpu(mrec->attrs_offset))
+	    || (offs + offsetof(ATTR_RECORD, resident_end)
+			> le32_to_cpu(mrec->bytes_in_use))
+	    || (offs + le32_to_cpu(a->length)
+			> le32_to_cpu(mrec->bytes_in_use))
+	    || (a->type != type)
+	    || (a->instance != al_entry->instance)
+	    || (a->name_length != name_len)
+	    || (le16_to_cpu(a->name_offset) + name_len*sizeof(ntfschar)
+			> le32_to_cpu(a->length))
+	    || (name_len && memcmp((u8*)a + le16_to_cpu(a->name_offset),
+			name, name_len*sizeof(ntfschar))))
+		goto stale;
+	ctx->is_first = FALSE;
+	ctx->al_entry = al_entry;
+	ctx->ntfs_ino = ni;
+	ctx->mrec = mrec;
+	ctx->attr = a;
+	return (0);
+stale :
+	*entry = base_ni->attr_index[--base_ni->attr_index_count];
+	return (-1);
+}
+
+/*
+ *		Remember where a first search through the attribute list
+ *	ended, replacing the oldest entry when the index is full
+ */
+
+static void ntfs_attr_index_enter(ntfs_inode *base_ni, ATTR_TYPES type,
+		u32 name_len, u16 hash, const ntfs_attr_search_ctx *ctx)
+{
+	struct ATTR_INDEX_ENTRY *entry;
+	ptrdiff_t attr_offset;
+	int i;
+
+	attr_offset = (u8*)ctx->attr - (u8*)ctx->mrec;
+	if ((attr_offset > 0xffff) || ctx->al_entry->lowest_vcn)
+		return;
+	if (base_ni->attr_index_count < ATTR_INDEX_SIZE)
+		i = base_ni->attr_index_count++;
+	else {
+		i = base_ni->attr_index_next;
+		base_ni->attr_index_next = (i + 1) % ATTR_INDEX_SIZE;
+	}
+	entry = &base_ni->attr_index[i];
+	entry->type = type;
+	entry->name_hash = hash;
+	entry->name_len = name_len;
+	entry->attr_offset = attr_offset;
+	entry->al_offset = (u8*)ctx->al_entry - base_ni->attr_list;
+}
+
+#endif /* ATTR_INDEX_SIZE */
+
 /**
  * ntfs_external_attr_find - find an attribute in the attribute list of an inode
  * @type:	attribute type to find
@@ -3077,6 +3525,11 @@ static int ntfs_external_attr_find(ATTR_TYPES type, const ntfschar *name,
 	ptrdiff_t space;
 	u32 al_name_len;
 	BOOL is_first_search = FALSE;
+#if ATTR_INDEX_SIZE
+	BOOL indexed = FALSE;
+	u32 index_name_len = 0;
+	u16 hash = 0;
+#endif
 
 	ni = ctx->ntfs_ino;
 	base_ni = ctx->base_ntfs_ino;
@@ -3098,6 +3551,26 @@ static int ntfs_external_attr_find(ATTR_TYPES type, const ntfschar *name,
 		ctx->al_entry = (ATTR_LIST_ENTRY*)al_start;
 		is_first_search = TRUE;
 	}
+#if ATTR_INDEX_SIZE
+	/*
+	 * A first search for a named or unnamed attribute can go straight
+	 * to where the same search ended last time, or to the first entry
+	 * of the attribute when looking for a higher vcn.  File names are
+	 * left out, an inode may have several of them.
+	 */
+	if (is_first_search && ctx->is_first && (ni == base_ni)
+	    && (type != AT_UNUSED) && (type != AT_FILE_NAME) && !val
+	    && ((name == AT_UNNAMED) || (name && (ic == CASE_SENSITIVE)))) {
+		indexed = !lowest_vcn;
+		if (name != AT_UNNAMED) {
+			index_name_len = name_len;
+			hash = ntfs_attr_index_hash(name, name_len);
+		}
+		if (!ntfs_attr_index_find(base_ni, type, name,
+				index_name_len, hash, lowest_vcn, ctx))
+			return 0;
+	}
+#endif
 	/*
 	 * Iterate over entries in attribute list starting at @ctx->al_entry,
 	 * or the entry following that, if @ctx->is_first is TRUE.
@@ -3356,6 +3829,11 @@ do_next_attr_loop:
 				le32_to_cpu(a->value_length) == val_len &&
 				!memcmp((char*)a + le16_to_cpu(a->value_offset),
 				val, val_len))) {
+#if ATTR_INDEX_SIZE
+			if (indexed)
+				ntfs_attr_index_enter(base_ni, type,
+					index_name_len, hash, ctx);
+#endif
 			return 0;
 		}
 do_next_attr:
@@ -3812,9 +4290,14 @@ ntfs_attr_search_ctx *ntfs_attr_get_search_ctx(ntfs_inode *ni, MFT_RECORD *mrec)
 		ntfs_log_perror("NULL arguments");
 		return NULL;
 	}
-	ctx = ntfs_malloc(sizeof(ntfs_attr_search_ctx));
-	if (ctx)
+	if (ni)
+		ctx = ntfs_pool_get(&ni->vol->ctx_pool);
+	else
+		ctx = ntfs_malloc(sizeof(ntfs_attr_search_ctx));
+	if (ctx) {
 		ntfs_attr_init_search_ctx(ctx, ni, mrec);
+		ctx->pool = (ni ? &ni->vol->ctx_pool : NULL);
+	}
 	return ctx;
 }
 
@@ -3827,7 +4310,10 @@ ntfs_attr_search_ctx *ntfs_attr_get_search_ctx(ntfs_inode *ni, MFT_RECORD *mrec)
 void ntfs_attr_put_search_ctx(ntfs_attr_search_ctx *ctx)
 {
 	// NOTE: save errno if it could change and function stays void!
-	free(ctx);
+	if (ctx && ctx->pool)
+		ntfs_pool_put(ctx->pool, ctx);
+	else
+		free(ctx);
 }
 
 /**
@@ -3849,10 +4335,16 @@ ATTR_DEF *ntfs_attr_find_in_attrdef(const ntfs_volume *vol,
 {
 	ATTR_DEF *ad;
 
-	if (!vol || !vol->attrdef || !type) {
+	if (!vol || !type) {
 		errno = EINVAL;
 		ntfs_log_perror("%s: type=%d", __FUNCTION__, le32_to_cpu(type));
 		return NULL;
+	}
+		/* not loaded yet after a fast mount */
+	if (!vol->attrdef
+	    && ntfs_volume_load_attrdef((ntfs_volume*)vol)) {
+		ntfs_log_perror("%s: type=%d", __FUNCTION__, le32_to_cpu(type));
+		return NULL;
 	}
 	for (ad = vol->attrdef; ((ptrdiff_t)((u8*)ad - (u8*)vol->attrdef
 				+ sizeof(ATTR_DEF)) <= vol->attrdef_len)
@@ -4013,7 +4505,7 @@ static int ntfs_attr_can_be_non_resident(const ntfs_volume *vol, const ATTR_TYPE
  */
 int ntfs_attr_can_be_resident(const ntfs_volume *vol, const ATTR_TYPES type)
 {
-	if (!vol || !vol->attrdef || !type) {
+	if (!vol || !type) {
 		errno = EINVAL;
 		return -1;
 	}
@@ -4754,6 +5246,7 @@ int ntfs_attr_rm(ntfs_attr *na)
 	ntfs_log_trace("Entering for inode 0x%llx, attr 0x%x.\n",
 		(long long) na->ni->mft_no, le32_to_cpu(na->type));
 
+	ntfs_compressed_invalidate(na);
 	/* Free cluster allocation. */
 	if (NAttrNonResident(na)) {
 		if (ntfs_attr_map_whole_runlist(na))
@@ -5144,6 +5637,8 @@ int ntfs_attr_make_non_resident(ntfs_attr *na,
 				vol->cluster_size_bits, -1, DATA_ZONE);
 		if (!rl)
 			return -1;
+		if (na->type == AT_DATA)
+			ntfs_cluster_reserve(na, rl);
 	} else
 		rl = NULL;
 	/*
@@ -5153,6 +5648,7 @@ int ntfs_attr_make_non_resident(ntfs_attr *na,
 	NAttrSetNonResident(na);
 	NAttrSetBeingNonResident(na);
 	na->rl = rl;
+	na->rl_cursor = NULL;
 	na->allocated_size = new_allocated_size;
 	na->data_size = na->initialized_size = le32_to_cpu(a->value_length);
 	/*
@@ -5273,6 +5769,7 @@ cluster_free_err_out:
 	NAttrClearFullyMapped(na);
 	na->allocated_size = na->data_size;
 	na->rl = NULL;
+	na->rl_cursor = NULL;
 	free(rl);
 	errno = err;
 	return -1;
@@ -5754,6 +6251,7 @@ static int ntfs_attr_make_resident(ntfs_attr *na, ntfs_attr_search_ctx *ctx)
 	/* Throw away the now unused runlist. */
 	free(na->rl);
 	na->rl = NULL;
+	na->rl_cursor = NULL;
 
 	/* Update in-memory struct ntfs_attr. */
 	NAttrClearNonResident(na);
@@ -6394,8 +6892,8 @@ static int ntfs_non_resident_attr_shrink(ntfs_attr *na, const s64 newsize)
 			return -1;
 		}
 		/* Deallocate all clusters starting with the first free one. */
-		nr_freed_clusters = ntfs_cluster_free(vol, na, first_free_vcn,
-				-1);
+		nr_freed_clusters = ntfs_cluster_queue_free(vol, na,
+				first_free_vcn, -1);
 		if (nr_freed_clusters < 0) {
 			ntfs_log_trace("Eeek! Freeing of clusters failed. "
 					"Aborting...\n");
@@ -6403,6 +6901,7 @@ static int ntfs_non_resident_attr_shrink(ntfs_attr *na, const s64 newsize)
 		}
 
 		/* Truncate the runlist itself. */
+		na->rl_cursor = NULL;
 		if (ntfs_rl_truncate(&na->rl, first_free_vcn)) {
 			/*
 			 * Failed to truncate the runlist, so just throw it
@@ -6616,6 +7115,8 @@ static int ntfs_non_resident_attr_expand_i(ntfs_attr *na, const s64 newsize,
 						 vol->cluster_size_bits));
 				return -1;
 			}
+			if (na->type == AT_DATA)
+				ntfs_cluster_reserve(na, rl);
 		}
 
 		/* Append new clusters to attribute runlist. */
@@ -6630,6 +7131,7 @@ static int ntfs_non_resident_attr_expand_i(ntfs_attr *na, const s64 newsize,
 			return -1;
 		}
 		na->rl = rln;
+		na->rl_cursor = NULL;
 		NAttrSetRunlistDirty(na);
 
 		/* Prepare to mapping pairs update. */
@@ -6706,6 +7208,7 @@ rollback:
 		ntfs_log_perror("Leaking clusters");
 	}
 	/* Now, truncate the runlist itself. */
+	na->rl_cursor = NULL;
 	if (ntfs_rl_truncate(&na->rl, org_alloc_size >>
 			vol->cluster_size_bits)) {
 		/*
@@ -6838,6 +7341,7 @@ static int ntfs_attr_truncate_i(ntfs_attr *na, const s64 newsize,
 			ret = ntfs_non_resident_attr_shrink(na, fullsize);
 	} else
 		ret = ntfs_resident_attr_resize_i(na, newsize, holes);
+	ntfs_compressed_invalidate(na);
 out:	
 	ntfs_log_leave("Return status %d\n", ret);
 	return ret;
@@ -6866,6 +7370,314 @@ int ntfs_attr_truncate_solid(ntfs_attr *na, const s64 newsize)
 	return (ntfs_attr_truncate_i(na, newsize, HOLES_NO));
 }
 
+/*
+ *		Allocate the clusters of an attribute up to a given size
+ *
+ *	The missing clusters are allocated in one go and without holes, so
+ *	that data later written sequentially lands in as few runs as the
+ *	free space allows. Unless @keep_size is set, the data size is raised
+ *	to @newsize. The initialized size is left alone either way, so the
+ *	new space reads back as zeroes without having to be written.
+ *
+ *	returns 0 if successful,
+ *		-1 if failed, with errno telling why
+ */
+
+int ntfs_attr_preallocate(ntfs_attr *na, const s64 newsize, BOOL keep_size)
+{
+	ntfs_attr_search_ctx *ctx;
+	s64 data_size;
+	int ret;
+
+	if (!na || newsize < 0) {
+		errno = EINVAL;
+		return -1;
+	}
+	if (na->data_flags & (ATTR_COMPRESSION_MASK | ATTR_IS_ENCRYPTED)) {
+		errno = EOPNOTSUPP;
+		return -1;
+	}
+	if (!keep_size) {
+		if (newsize <= na->data_size)
+			return 0;
+		ret = ntfs_attr_truncate_solid(na, newsize);
+		goto out;
+	}
+	if (NAttrNonResident(na) && (newsize <= na->allocated_size))
+		return 0;
+	/* A resident attribute has no clusters to extend */
+	if (!NAttrNonResident(na) && ntfs_attr_force_non_resident(na)) {
+		ret = -1;
+		goto out;
+	}
+	data_size = na->data_size;
+	ret = ntfs_attr_truncate_solid(na, newsize);
+	if (ret || (na->data_size == data_size))
+		goto out;
+	/* Put back the data size, keeping the clusters just allocated */
+	ctx = ntfs_attr_get_search_ctx(na->ni, NULL);
+	if (!ctx) {
+		ret = -1;
+		goto out;
+	}
+	if (ntfs_attr_lookup(na->type, na->name, na->name_len, CASE_SENSITIVE,
+			0, NULL, 0, ctx)) {
+		if (errno == ENOENT)
+			errno = EIO;
+		ntfs_log_perror("Lookup of first attribute extent failed");
+		ntfs_attr_put_search_ctx(ctx);
+		ret = -1;
+		goto out;
+	}
+	na->data_size = data_size;
+	ctx->attr->data_size = cpu_to_sle64(data_size);
+	if (na->type == AT_DATA && na->name == AT_UNNAMED) {
+		na->ni->data_size = data_size;
+		NInoFileNameSetDirty(na->ni);
+	}
+	ntfs_inode_mark_dirty(ctx->ntfs_ino);
+	ntfs_attr_put_search_ctx(ctx);
+out:
+	NAttrClearDataAppending(na);
+	NAttrClearBeingNonResident(na);
+	return (ret);
+}
+
+/*
+ *		Free the clusters of an attribute allocated beyond its data
+ *
+ *	This gives back what ntfs_attr_preallocate() allocated with
+ *	@keep_size set and was not written to since. The data size is
+ *	left alone.
+ *
+ *	returns 0 if successful,
+ *		-1 if failed, with errno telling why
+ */
+
+int ntfs_attr_trim_allocation(ntfs_attr *na)
+{
+	s64 cluster_mask;
+
+	if (!na) {
+		errno = EINVAL;
+		return -1;
+	}
+	/* Compressed attributes keep whole compression blocks anyway */
+	if (!NAttrNonResident(na) || (na->data_flags & ATTR_COMPRESSION_MASK))
+		return 0;
+	cluster_mask = na->ni->vol->cluster_size - 1;
+	if (na->allocated_size <= ((na->data_size + cluster_mask) & ~cluster_mask))
+		return 0;
+	return (ntfs_non_resident_attr_shrink(na, na->data_size));
+}
+
+/*
+ *		Count the extents of a runlist
+ *
+ *	Adjacent runs which are contiguous on the device count as one.
+ */
+
+static s64 count_extents(const runlist_element *rl, s64 *clusters)
+{
+	s64 extents;
+	LCN next;
+
+	extents = 0;
+	next = LCN_HOLE;
+	if (clusters)
+		*clusters = 0;
+	for (; rl->length; rl++) {
+		if (rl->lcn < 0)
+			continue;
+		if (rl->lcn != next)
+			extents++;
+		next = rl->lcn + rl->length;
+		if (clusters)
+			*clusters += rl->length;
+	}
+	return (extents);
+}
+
+/*
+ *		Append a run to a runlist being built, merging it if contiguous
+ */
+
+static void append_run(runlist_element *rl, int *pos, VCN vcn, LCN lcn,
+			s64 length)
+{
+	runlist_element *prev;
+
+	if (*pos) {
+		prev = &rl[*pos - 1];
+		if ((lcn >= 0) && (prev->lcn >= 0)
+		    && (prev->lcn + prev->length == lcn)) {
+			prev->length += length;
+			return;
+		}
+	}
+	rl[*pos].vcn = vcn;
+	rl[*pos].lcn = lcn;
+	rl[*pos].length = length;
+	(*pos)++;
+}
+
+#define NTFS_DEFRAG_BUFSIZE (256 << 10) /* bytes copied at a time */
+
+/*
+ *		Move the clusters of an attribute into fewer extents
+ *
+ *	The clusters in use are copied into a newly allocated area, and
+ *	the attribute is switched to it once the copy is on the device,
+ *	so that an interruption at any point leaves the attribute as it
+ *	was : the old clusters are only freed after the new mapping pairs
+ *	have been written. Holes are kept as they are.
+ *
+ *	Unless @partial is set, the new area must be a single extent.
+ *	An attribute already in one extent is left alone.
+ *
+ *	returns 0 if successful,
+ *		-1 if failed, with errno telling why (ENOSPC when the free
+ *		space does not allow fewer extents)
+ */
+
+int ntfs_attr_defragment(ntfs_attr *na, BOOL partial)
+{
+	ntfs_volume *vol;
+	runlist_element *oldrl;
+	runlist_element *newrl;
+	runlist_element *allocrl;
+	runlist_element *rl;
+	runlist_element *arl;
+	s64 clusters, extents, length, n, copy_end, done;
+	VCN vcn;
+	LCN alcn;
+	BOOL best_fit;
+	char *buf;
+	int pos, nr, err, old_count;
+
+	if (!na) {
+		errno = EINVAL;
+		return -1;
+	}
+	if (na->data_flags & (ATTR_COMPRESSION_MASK | ATTR_IS_ENCRYPTED)) {
+		errno = EOPNOTSUPP;
+		return -1;
+	}
+	if (!NAttrNonResident(na))
+		return 0;
+	if (ntfs_attr_map_whole_runlist(na))
+		return -1;
+	vol = na->ni->vol;
+	extents = count_extents(na->rl, &clusters);
+	if (extents <= 1)
+		return 0;
+		/* the reservation ahead of the file would only be in the way */
+	ntfs_cluster_unreserve(na);
+	best_fit = NVolBestFit(vol);
+	NVolSetBestFit(vol);
+	allocrl = ntfs_cluster_alloc(vol, 0, clusters, -1, DATA_ZONE);
+	if (!best_fit)
+		NVolClearBestFit(vol);
+	if (!allocrl)
+		return -1;
+	newrl = (runlist_element*)NULL;
+	buf = (char*)NULL;
+	n = count_extents(allocrl, (s64*)NULL);
+	if ((n >= extents) || ((n > 1) && !partial)) {
+		errno = ENOSPC;
+		goto err_free;
+	}
+	for (nr = 0; na->rl[nr].length; nr++) ;
+	for (pos = 0; allocrl[pos].length; pos++) ;
+	newrl = (runlist_element*)ntfs_malloc((nr + pos + 1)
+			* sizeof(runlist_element));
+	buf = (char*)ntfs_malloc(NTFS_DEFRAG_BUFSIZE);
+	if (!newrl || !buf)
+		goto err_free;
+		/* copy the data, building the new runlist on the way */
+	copy_end = (na->initialized_size + vol->cluster_size - 1)
+			>> vol->cluster_size_bits;
+	arl = allocrl;
+	alcn = arl->lcn;
+	pos = 0;
+	for (rl = na->rl; rl->length; rl++) {
+		if (rl->lcn < 0) {
+			append_run(newrl, &pos, rl->vcn, rl->lcn, rl->length);
+			continue;
+		}
+		for (vcn = rl->vcn; vcn < rl->vcn + rl->length; vcn += length) {
+			if (alcn >= arl->lcn + arl->length) {
+				arl++;
+				alcn = arl->lcn;
+			}
+			length = rl->vcn + rl->length - vcn;
+			if (length > arl->lcn + arl->length - alcn)
+				length = arl->lcn + arl->length - alcn;
+			append_run(newrl, &pos, vcn, alcn, length);
+			for (done = 0; (done < length)
+					&& (vcn + done < copy_end); done += n) {
+				n = (NTFS_DEFRAG_BUFSIZE >> vol->cluster_size_bits);
+				if (n > length - done)
+					n = length - done;
+				if (n > copy_end - vcn - done)
+					n = copy_end - vcn - done;
+				if (ntfs_pread(vol->dev, (rl->lcn + vcn - rl->vcn
+					+ done) << vol->cluster_size_bits,
+					n << vol->cluster_size_bits, buf)
+				    != (n << vol->cluster_size_bits)
+				    || ntfs_pwrite(vol->dev, (alcn + done)
+					<< vol->cluster_size_bits,
+					n << vol->cluster_size_bits, buf)
+				    != (n << vol->cluster_size_bits)) {
+					if (!errno)
+						errno = EIO;
+					goto err_free;
+				}
+			}
+			alcn += length;
+		}
+	}
+	newrl[pos] = *rl;
+		/* the new clusters must be on the device before being used */
+	if (ntfs_cluster_bitmap_sync(vol) || ntfs_device_sync(vol->dev))
+		goto err_free;
+	oldrl = na->rl;
+	old_count = na->rl_count;
+	na->rl = newrl;
+	na->rl_cursor = NULL;
+	na->rl_count = pos;
+	if (ntfs_attr_update_mapping_pairs(na, 0)
+	    || ntfs_inode_sync(na->ni)
+	    || ntfs_device_sync(vol->dev)) {
+		err = errno;
+		na->rl = oldrl;
+		na->rl_cursor = NULL;
+		na->rl_count = old_count;
+		if (ntfs_attr_update_mapping_pairs(na, 0))
+			ntfs_log_perror("Could not restore the runlist of "
+				"inode %lld", (long long)na->ni->mft_no);
+		errno = err;
+		goto err_free;
+	}
+	if (ntfs_cluster_free_from_rl(vol, oldrl))
+		ntfs_log_perror("Leaking clusters of inode %lld",
+				(long long)na->ni->mft_no);
+	free(oldrl);
+	free(allocrl);
+	free(buf);
+	return 0;
+err_free:
+	err = errno;
+	if (ntfs_cluster_free_from_rl(vol, allocrl))
+		ntfs_log_perror("Leaking clusters allocated for inode %lld",
+				(long long)na->ni->mft_no);
+	free(allocrl);
+	free(newrl);
+	free(buf);
+	errno = err;
+	return -1;
+}
+
 /*
  *		Stuff a hole in a compressed file
  *
@@ -7194,63 +8006,25 @@ int ntfs_attr_remove(ntfs_inode *ni, const ATTR_TYPES type, ntfschar *name,
 	return ret;
 }
 
-/* Below macros are 32-bit ready. */
-#define BCX(x) ((x) - (((x) >> 1) & 0x77777777) - \
-		      (((x) >> 2) & 0x33333333) - \
-		      (((x) >> 3) & 0x11111111))
-#define BITCOUNT(x) (((BCX(x) + (BCX(x) >> 4)) & 0x0F0F0F0F) % 255)
-
-static u8 *ntfs_init_lut256(void)
-{
-	int i;
-	u8 *lut;
-	
-	lut = ntfs_malloc(256);
-	if (lut)
-		for(i = 0; i < 256; i++)
-			*(lut + i) = 8 - BITCOUNT(i);
-	return lut;
-}
-
 s64 ntfs_attr_get_free_bits(ntfs_attr *na)
 {
-	u8 *buf, *lut;
+	u8 *buf;
 	s64 br      = 0;
 	s64 total   = 0;
 	s64 nr_free = 0;
 
-	lut = ntfs_init_lut256();
-	if (!lut)
-		return -1;
-	
 	buf = ntfs_malloc(65536);
 	if (!buf)
-		goto out;
+		return -1;
 
 	while (1) {
-		u32 *p;
 		br = ntfs_attr_pread(na, total, 65536, buf);
 		if (br <= 0)
 			break;
 		total += br;
-		p = (u32 *)buf + br / 4 - 1;
-		for (; (u8 *)p >= buf; p--) {
-			nr_free += lut[ *p        & 255] + 
-			           lut[(*p >>  8) & 255] + 
-			           lut[(*p >> 16) & 255] + 
-			           lut[(*p >> 24)      ];
-		}
-		switch (br % 4) {
-			case 3:  nr_free += lut[*(buf + br - 3)];
-			/* FALLTHRU */
-			case 2:  nr_free += lut[*(buf + br - 2)];
-			/* FALLTHRU */
-			case 1:  nr_free += lut[*(buf + br - 1)];
-		}
+		nr_free += ntfs_bitmap_count_clear(buf, br);
 	}
 	free(buf);
-out:
-	free(lut);
 	if (!total || br < 0)
 		return -1;
 	return nr_free;
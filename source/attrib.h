@@ -92,6 +92,7 @@ struct _ntfs_attr_search_ctx {
 	ntfs_inode *base_ntfs_ino;
 	MFT_RECORD *base_mrec;
 	ATTR_RECORD *base_attr;
+	struct NTFS_POOL *pool; /* where to release, NULL if allocated */
 };
 
 extern void ntfs_attr_reinit_search_ctx(ntfs_attr_search_ctx *ctx);
@@ -155,6 +156,7 @@ static __inline__ int ntfs_attrs_walk(ntfs_attr_search_ctx *ctx)
  * @compression_block_size:		size of a compression block (cb)
  * @compression_block_size_bits:	log2 of the size of a cb
  * @compression_block_clusters:		number of clusters per cb
+ * @compression_level:	how hard to compress the data written, from the volume
  *
  * This structure exists purely to provide a mechanism of caching the runlist
  * of an attribute. If you want to operate on a particular attribute extent,
@@ -173,6 +175,13 @@ static __inline__ int ntfs_attrs_walk(ntfs_attr_search_ctx *ctx)
  * i.e. NAttrNonResident() is true. If the runlist hasn't been decompressed yet
  * @rl is NULL, so be prepared to cope with @rl == NULL.
  *
+ * @rl_cursor is the element of @rl last returned by ntfs_attr_find_vcn(), so
+ * that sequential and nearby lookups start from there instead of from the
+ * beginning of the runlist. It is NULL if unknown, and must be reset whenever
+ * @rl is reallocated or its elements are rearranged. While it is set,
+ * @rl_count is the number of elements of @rl before its terminator, as last
+ * seen, so that lookups further away can binary search the runlist.
+ *
  * @ni is the base ntfs inode of the attribute described by this structure.
  *
  * @type is the attribute type (see layout.h for the definition of ATTR_TYPES),
@@ -184,6 +193,8 @@ static __inline__ int ntfs_attrs_walk(ntfs_attr_search_ctx *ctx)
  */
 struct _ntfs_attr {
 	runlist_element *rl;
+	runlist_element *rl_cursor;
+	int rl_count;
 	ntfs_inode *ni;
 	ATTR_TYPES type;
 	ATTR_FLAGS data_flags;
@@ -197,7 +208,12 @@ struct _ntfs_attr {
 	u32 compression_block_size;
 	u8 compression_block_size_bits;
 	u8 compression_block_clusters;
+	u8 compression_level;
 	s8 unused_runs; /* pre-reserved entries available */
+	struct NTFS_POOL *pool; /* where to release the structure */
+	LCN resv_lcn;		/* clusters after the last allocated ones, */
+	s64 resv_count;		/* kept for this attribute to grow into */
+	ntfs_attr *resv_next;	/* next attribute with a reservation */
 };
 
 /**
@@ -309,9 +325,11 @@ extern s64 ntfs_attr_mst_pread(ntfs_attr *na, const s64 pos,
 		const s64 bk_cnt, const u32 bk_size, void *dst);
 extern s64 ntfs_attr_mst_pwrite(ntfs_attr *na, const s64 pos,
 		s64 bk_cnt, const u32 bk_size, void *src);
+extern s64 ntfs_attr_prefetch(ntfs_attr *na, const s64 pos, s64 count);
 
 extern int ntfs_attr_map_runlist(ntfs_attr *na, VCN vcn);
 extern int ntfs_attr_map_whole_runlist(ntfs_attr *na);
+extern int ntfs_attr_release_runlist(ntfs_attr *na);
 
 extern LCN ntfs_attr_vcn_to_lcn(ntfs_attr *na, const VCN vcn);
 extern runlist_element *ntfs_attr_find_vcn(ntfs_attr *na, const VCN vcn);
@@ -352,6 +370,10 @@ extern int ntfs_attr_update_mapping_pairs(ntfs_attr *na, VCN from_vcn);
 
 extern int ntfs_attr_truncate(ntfs_attr *na, const s64 newsize);
 extern int ntfs_attr_truncate_solid(ntfs_attr *na, const s64 newsize);
+extern int ntfs_attr_preallocate(ntfs_attr *na, const s64 newsize,
+		BOOL keep_size);
+extern int ntfs_attr_trim_allocation(ntfs_attr *na);
+extern int ntfs_attr_defragment(ntfs_attr *na, BOOL partial);
 
 /**
  * get_attribute_value_length - return the length of the value of an attribute
@@ -222,6 +222,7 @@ int ntfs_attrlist_entry_add(ntfs_inode *ni, ATTR_RECORD *attr)
 	ni->attr_list = new_al;
 	ni->attr_list_size = ni->attr_list_size + entry_len;
 	NInoAttrListSetDirty(ni);
+	ntfs_inode_forget_attrs(ni);
 	/* Done! */
 	ntfs_attr_close(na);
 	return 0;
@@ -302,6 +303,7 @@ int ntfs_attrlist_entry_rm(ntfs_attr_search_ctx *ctx)
 	base_ni->attr_list = new_al;
 	base_ni->attr_list_size = new_al_len;
 	NInoAttrListSetDirty(base_ni);
+	ntfs_inode_forget_attrs(base_ni);
 	/* Done! */
 	ntfs_attr_close(na);
 	return 0;
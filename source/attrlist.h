@@ -36,16 +36,16 @@ extern int ntfs_attrlist_entry_rm(ntfs_attr_search_ctx *ctx);
  * @ni:		ntfs inode which base inode contain dirty attribute list
  *
  * Set the attribute list dirty so it is written out later (at the latest at
- * ntfs_inode_close() time).
+ * ntfs_inode_close() time), and forget the lookups remembered through it.
  *
  * This function cannot fail.
  */
 static __inline__ void ntfs_attrlist_mark_dirty(ntfs_inode *ni)
 {
 	if (ni->nr_extents == -1)
-		NInoAttrListSetDirty(ni->base_ni);
-	else
-		NInoAttrListSetDirty(ni);
+		ni = ni->base_ni;
+	NInoAttrListSetDirty(ni);
+	ntfs_inode_forget_attrs(ni);
 }
 
 #endif /* defined _NTFS_ATTRLIST_H */
@@ -41,6 +41,8 @@
 #include "types.h"
 #include "attrib.h"
 #include "bitmap.h"
+#include "volume.h"
+#include "lcnalloc.h"
 #include "debug.h"
 #include "logging.h"
 #include "misc.h"
@@ -100,6 +102,102 @@ char ntfs_bit_get_and_set(u8 *bitmap, const u64 bit, const u8 new_value)
 	return old_bit;
 }
 
+/*
+ *		Count the bits set in a 32-bit word
+ */
+
+static __inline__ int ntfs_popcount32(u32 x)
+{
+#if defined(__GNUC__) && defined(__POPCNT__)
+	return (__builtin_popcount(x));
+#else
+	x = x - ((x >> 1) & 0x55555555);
+	x = (x & 0x33333333) + ((x >> 2) & 0x33333333);
+	x = (x + (x >> 4)) & 0x0f0f0f0f;
+	return ((x * 0x01010101) >> 24);
+#endif
+}
+
+/**
+ * ntfs_bitmap_count_clear - count the clear bits in a buffer
+ * @buf:	bitmap data
+ * @size:	number of bytes in @buf
+ *
+ * The buffer is taken a 32-bit word at a time once aligned, all-clear and
+ * all-set words, the common case in volume bitmaps, costing one compare.
+ *
+ * Return the number of clear bits.
+ */
+s64 ntfs_bitmap_count_clear(const u8 *buf, s64 size)
+{
+	const u32 *p;
+	s64 nr_clear = 0;
+	s64 i = 0;
+	u32 w;
+
+	for (; (i < size) && ((uintptr_t)(buf + i) & 3); i++)
+		nr_clear += 8 - ntfs_popcount32(buf[i]);
+	p = (const u32*)(buf + i);
+	for (; i + 4 <= size; i += 4) {
+		w = *p++;
+		if (!w)
+			nr_clear += 32;
+		else if (~w)
+			nr_clear += 32 - ntfs_popcount32(w);
+	}
+	for (; i < size; i++)
+		nr_clear += 8 - ntfs_popcount32(buf[i]);
+	return (nr_clear);
+}
+
+/**
+ * ntfs_bitmap_skip - skip the bytes of a given value in a buffer
+ * @buf:	bitmap data
+ * @pos:	first byte to examine
+ * @size:	number of bytes in @buf
+ * @value:	value of the bytes to skip, usually 0 or 0xff
+ *
+ * Return the position of the first byte at or after @pos which differs
+ * from @value, or @size if there is none.
+ */
+s64 ntfs_bitmap_skip(const u8 *buf, s64 pos, s64 size, u8 value)
+{
+	const u32 *p;
+	u32 w;
+
+	for (; (pos < size) && ((uintptr_t)(buf + pos) & 3); pos++)
+		if (buf[pos] != value)
+			return (pos);
+	w = value * 0x01010101U;
+	p = (const u32*)(buf + pos);
+	while ((pos + 4 <= size) && (*p == w)) {
+		p++;
+		pos += 4;
+	}
+	while ((pos < size) && (buf[pos] == value))
+		pos++;
+	return (pos);
+}
+
+/*
+ *		Read or write a bitmap, going through the allocator cache
+ *	for the cluster bitmap
+ */
+
+static s64 bitmap_pread(ntfs_attr *na, s64 pos, s64 count, void *b)
+{
+	if (na == na->ni->vol->lcnbmp_na)
+		return (ntfs_cluster_bitmap_pread(na->ni->vol, pos, count, b));
+	return (ntfs_attr_pread(na, pos, count, b));
+}
+
+static s64 bitmap_pwrite(ntfs_attr *na, s64 pos, s64 count, const void *b)
+{
+	if (na == na->ni->vol->lcnbmp_na)
+		return (ntfs_cluster_bitmap_pwrite(na->ni->vol, pos, count, b));
+	return (ntfs_attr_pwrite(na, pos, count, b));
+}
+
 /**
  * ntfs_bitmap_set_bits_in_run - set a run of bits in a bitmap to a value
  * @na:		attribute containing the bitmap
@@ -147,7 +245,7 @@ static int ntfs_bitmap_set_bits_in_run(ntfs_attr *na, s64 start_bit,
 	/* If there is a first partial byte... */
 	if (bit) {
 		/* read it in... */
-		br = ntfs_attr_pread(na, start_bit >> 3, 1, buf);
+		br = bitmap_pread(na, start_bit >> 3, 1, buf);
 		if (br != 1) {
 			if (br >= 0)
 				errno = EIO;
@@ -184,7 +282,7 @@ static int ntfs_bitmap_set_bits_in_run(ntfs_attr *na, s64 start_bit,
 				lastbyte_buf = buf + lastbyte_pos - 1;
 
 				/* read the byte in... */
-				br = ntfs_attr_pread(na, (start_bit + count) >>
+				br = bitmap_pread(na, (start_bit + count) >>
 						3, 1, lastbyte_buf);
 				if (br != 1) {
 					// FIXME: Eeek! We need rollback! (AIA)
@@ -211,7 +309,7 @@ static int ntfs_bitmap_set_bits_in_run(ntfs_attr *na, s64 start_bit,
 
 		/* Write the prepared buffer to disk. */
 		tmp = (start_bit >> 3) - firstbyte;
-		br = ntfs_attr_pwrite(na, tmp, bufsize, buf);
+		br = bitmap_pwrite(na, tmp, bufsize, buf);
 		if (br != bufsize) {
 			// FIXME: Eeek! We need rollback! (AIA)
 			if (br >= 0)
@@ -30,7 +30,9 @@
  * NOTES:
  *
  * - Operations are 8-bit only to ensure the functions work both on little
- *   and big endian machines! So don't make them 32-bit ops!
+ *   and big endian machines! So don't make them 32-bit ops! The exceptions
+ *   are counting bits and skipping over bytes of the same value, which do
+ *   not depend on the order of the bytes in a word.
  * - bitmap starts at bit = 0 and ends at bit = bitmap size - 1.
  * - _Caller_ has to make sure that the bit to operate on is less than the
  *   size of the bitmap.
@@ -39,6 +41,8 @@
 extern void ntfs_bit_set(u8 *bitmap, const u64 bit, const u8 new_value);
 extern char ntfs_bit_get(const u8 *bitmap, const u64 bit);
 extern char ntfs_bit_get_and_set(u8 *bitmap, const u64 bit, const u8 new_value);
+extern s64  ntfs_bitmap_count_clear(const u8 *buf, s64 size);
+extern s64  ntfs_bitmap_skip(const u8 *buf, s64 pos, s64 size, u8 value);
 extern int  ntfs_bitmap_set_run(ntfs_attr *na, s64 start_bit, s64 count);
 extern int  ntfs_bitmap_clear_run(ntfs_attr *na, s64 start_bit, s64 count);
 
@@ -0,0 +1,164 @@
+/**
+ * budget.c : share out a bound on the memory held by a volume
+ *
+ * This program/include file is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program/include file is distributed in the hope that it will be
+ * useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program (in the main directory of the NTFS-3G
+ * distribution in the file COPYING); if not, write to the Free Software
+ * Foundation,Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+
+#include "types.h"
+#include "budget.h"
+#include "logging.h"
+
+/*
+ *	Memory which can be rebuilt is charged to the budget as it is
+ *	kept, and denied when the budget is full and nothing else can
+ *	be given back, in which case it is simply not kept. Memory the
+ *	volume cannot do without (the device cache once sized, the case
+ *	tables) is added unconditionally, so that it is accounted for.
+ */
+
+/*
+ *		Set up a budget
+ */
+
+void ntfs_budget_init(struct NTFS_BUDGET *budget, size_t limit)
+{
+	memset(budget, 0, sizeof(struct NTFS_BUDGET));
+	budget->limit = limit;
+}
+
+/*
+ *		Add a reclaimer, keeping the list in priority order
+ */
+
+void ntfs_budget_register(struct NTFS_BUDGET *budget,
+			struct NTFS_RECLAIMER *reclaimer)
+{
+	struct NTFS_RECLAIMER **pprev;
+
+	pprev = &budget->reclaimers;
+	while (*pprev && ((*pprev)->priority <= reclaimer->priority))
+		pprev = &(*pprev)->next;
+	reclaimer->next = *pprev;
+	*pprev = reclaimer;
+}
+
+/*
+ *		Remove a reclaimer, before what it reclaims from is freed
+ */
+
+void ntfs_budget_unregister(struct NTFS_BUDGET *budget,
+			struct NTFS_RECLAIMER *reclaimer)
+{
+	struct NTFS_RECLAIMER **pprev;
+
+	for (pprev=&budget->reclaimers; *pprev; pprev=&(*pprev)->next) {
+		if (*pprev == reclaimer) {
+			*pprev = reclaimer->next;
+			break;
+		}
+	}
+}
+
+/*
+ *		Get the number of bytes which may still be charged without
+ *	reclaiming anything
+ */
+
+size_t ntfs_budget_available(const struct NTFS_BUDGET *budget)
+{
+	if (!budget->limit)
+		return ((size_t)-1);
+	return (budget->total < budget->limit
+			? budget->limit - budget->total : 0);
+}
+
+/*
+ *		Account for memory which is kept whatever the budget
+ */
+
+void ntfs_budget_add(struct NTFS_BUDGET *budget, int component,
+			size_t size)
+{
+	budget->used[component] += size;
+	budget->total += size;
+}
+
+/*
+ *		Charge memory to a component
+ *
+ *	When the budget is full, the reclaimers are asked in turn to
+ *	give back what is missing, the least valuable memory first.
+ *
+ *	Returns TRUE if the memory may be kept
+ *		FALSE if it should not (not an error, nothing is logged)
+ */
+
+BOOL ntfs_budget_charge(struct NTFS_BUDGET *budget, int component,
+			size_t size)
+{
+	struct NTFS_RECLAIMER *reclaimer;
+	size_t before;
+	size_t wanted;
+
+	if (budget->limit && (size > ntfs_budget_available(budget))) {
+		if ((size > budget->limit) || budget->reclaiming) {
+			budget->denied++;
+			return (FALSE);
+		}
+		budget->reclaiming = TRUE;
+		for (reclaimer=budget->reclaimers; reclaimer
+		    && (size > ntfs_budget_available(budget));
+		    reclaimer=reclaimer->next) {
+			before = budget->total;
+			wanted = size - ntfs_budget_available(budget);
+			reclaimer->reclaim(reclaimer->data, wanted);
+			if (budget->total < before)
+				budget->reclaimed[reclaimer->component]
+					+= before - budget->total;
+		}
+		budget->reclaiming = FALSE;
+		if (size > ntfs_budget_available(budget)) {
+			budget->denied++;
+			return (FALSE);
+		}
+	}
+	ntfs_budget_add(budget, component, size);
+	return (TRUE);
+}
+
+/*
+ *		Give memory back to the budget
+ */
+
+void ntfs_budget_release(struct NTFS_BUDGET *budget, int component,
+			size_t size)
+{
+	if (size > budget->used[component]) {
+		ntfs_log_error("Budget of component %d overdrawn\n",
+				component);
+		size = budget->used[component];
+	}
+	budget->used[component] -= size;
+	budget->total -= size;
+}
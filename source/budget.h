@@ -0,0 +1,107 @@
+/*
+ * budget.h : share out a bound on the memory held by a volume
+ *
+ * This program/include file is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program/include file is distributed in the hope that it will be
+ * useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program (in the main directory of the NTFS-3G
+ * distribution in the file COPYING); if not, write to the Free Software
+ * Foundation,Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef _NTFS_BUDGET_H_
+#define _NTFS_BUDGET_H_
+
+#include <stddef.h>
+
+#include "types.h"
+
+/*
+ *	The components memory is charged to, in the order of the
+ *	NTFS_MEMORY_* identifiers of ntfs.h
+ */
+
+enum {
+	NTFS_BUDGET_DEVICE_CACHE,	/* pages of the device cache */
+	NTFS_BUDGET_CASE_TABLES,	/* $UpCase and the lowercase table */
+	NTFS_BUDGET_LRU_CACHES,		/* the lookup caches of cache.c */
+	NTFS_BUDGET_CLOSED_INODES,	/* inodes kept open by the nidata cache */
+	NTFS_BUDGET_CASE_INDEX,		/* upcased directory names */
+	NTFS_BUDGET_COMPONENTS
+} ;
+
+/*
+ *	The order memory is reclaimed in, cheapest to rebuild first :
+ *	a copy of an mft record is read again from the device cache,
+ *	while a closed inode may have to be written back
+ */
+
+enum {
+	NTFS_RECLAIM_MFTREC,
+	NTFS_RECLAIM_CBLOCK,
+	NTFS_RECLAIM_SDH,
+	NTFS_RECLAIM_REPARSE,
+	NTFS_RECLAIM_LOOKUP,
+	NTFS_RECLAIM_INODE,
+	NTFS_RECLAIM_LEGACY,
+	NTFS_RECLAIM_SECURID,
+	NTFS_RECLAIM_CASE_INDEX,
+	NTFS_RECLAIM_NIDATA
+} ;
+
+/*
+ *	A reclaimer gives memory back when the budget runs out. It
+ *	frees up to "wanted" bytes, releasing them from the budget as
+ *	it goes. Whatever is charged meanwhile is denied, so it may be
+ *	called whenever a charge is made, and what it reclaims from
+ *	must then be in a consistent state.
+ */
+
+typedef void (*budget_reclaim)(void *data, size_t wanted);
+
+struct NTFS_RECLAIMER {
+	struct NTFS_RECLAIMER *next;
+	budget_reclaim reclaim;
+	void *data;
+	int component;
+	int priority;		/* lowest is reclaimed first */
+} ;
+
+/*
+ *	A zero limit leaves the memory unbounded, though it is still
+ *	accounted for. The budget is only used by threads holding the
+ *	volume lock.
+ */
+
+struct NTFS_BUDGET {
+	size_t limit;
+	size_t total;
+	size_t used[NTFS_BUDGET_COMPONENTS];
+	u64 reclaimed[NTFS_BUDGET_COMPONENTS];
+	unsigned long denied;
+	struct NTFS_RECLAIMER *reclaimers;
+	BOOL reclaiming;
+} ;
+
+void ntfs_budget_init(struct NTFS_BUDGET *budget, size_t limit);
+void ntfs_budget_register(struct NTFS_BUDGET *budget,
+			struct NTFS_RECLAIMER *reclaimer);
+void ntfs_budget_unregister(struct NTFS_BUDGET *budget,
+			struct NTFS_RECLAIMER *reclaimer);
+size_t ntfs_budget_available(const struct NTFS_BUDGET *budget);
+void ntfs_budget_add(struct NTFS_BUDGET *budget, int component,
+			size_t size);
+BOOL ntfs_budget_charge(struct NTFS_BUDGET *budget, int component,
+			size_t size);
+void ntfs_budget_release(struct NTFS_BUDGET *budget, int component,
+			size_t size);
+
+#endif /* _NTFS_BUDGET_H_ */
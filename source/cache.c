@@ -33,6 +33,9 @@
 #include "types.h"
 #include "security.h"
 #include "cache.h"
+#include "mft.h"
+#include "compress.h"
+#include "reparse.h"
 #include "misc.h"
 #include "logging.h"
 
@@ -49,11 +52,28 @@
  *	an entry to facilitate multiple invalidation.
  *
  *	These functions never return error codes. When there is a
- *	shortage of memory, data is simply not cached.
+ *	shortage of memory, or the budget of the volume is spent, data
+ *	is simply not cached.
  *	When there is a hashing bug, hashing is dropped, and sequential
  *	searches are used.
  */
 
+/*
+ *		Get the hash index of a record
+ *
+ *	The hash functions return any non-negative value, which is
+ *	reduced to the size of the hash table the cache was created with
+ */
+
+static int hashindex(struct CACHE_HEADER *cache,
+			const struct CACHED_GENERIC *item)
+{
+	int h;
+
+	h = cache->dohash(item);
+	return (h >= 0 ? h % cache->max_hash : h);
+}
+
 /*
  *		Enter a new hash index, after a new record has been inserted
  *
@@ -68,7 +88,7 @@ static void inserthashindex(struct CACHE_HEADER *cache,
 	struct HASH_ENTRY *first;
 
 	if (cache->dohash) {
-		h = cache->dohash(current);
+		h = hashindex(cache, current);
 		if ((h >= 0) && (h < cache->max_hash)) {
 			/* get a free link and insert at top of hash list */
 			link = cache->free_hash;
@@ -137,6 +157,59 @@ static void drophashindex(struct CACHE_HEADER *cache,
 	}
 }
 
+static void do_invalidate(struct CACHE_HEADER *cache,
+		struct CACHED_GENERIC *current, int flags);
+
+/*
+ *		Drop the least recently used entry
+ */
+
+static void drop_oldest(struct CACHE_HEADER *cache)
+{
+	struct CACHED_GENERIC *current;
+
+	current = cache->oldest_entry;
+	if (cache->dohash)
+		drophashindex(cache,current,hashindex(cache, current));
+	do_invalidate(cache,current,CACHE_FREE);
+}
+
+/*
+ *		Give entries back to the budget, the oldest first
+ */
+
+static void reclaim_cache(void *data, size_t wanted)
+{
+	struct CACHE_HEADER *cache;
+	size_t freed;
+
+	cache = (struct CACHE_HEADER*)data;
+	freed = 0;
+	while (cache->oldest_entry && (freed < wanted)) {
+		freed += cache->oldest_entry->varsize + cache->entry_cost;
+		drop_oldest(cache);
+	}
+}
+
+/*
+ *		Charge a new entry to the budget of the cache
+ *
+ *	The oldest entry, which would be reused, is dropped first so
+ *	that only the difference is drawn from the other caches.
+ */
+
+static BOOL charge_entry(struct CACHE_HEADER *cache,
+			const struct CACHED_GENERIC *item)
+{
+	if (!cache->budget)
+		return (TRUE);
+	if (!cache->free_entry && cache->oldest_entry
+	    && cache->budget->limit)
+		drop_oldest(cache);
+	return (ntfs_budget_charge(cache->budget, cache->reclaimer.component,
+				item->varsize + cache->entry_cost));
+}
+
 /*
  *		Fetch an entry from cache
  *
@@ -159,7 +232,7 @@ struct CACHED_GENERIC *ntfs_fetch_cache(struct CACHE_HEADER *cache,
 			 * When possible, use the hash table to
 			 * locate the entry if present
 			 */
-			h = cache->dohash(wanted);
+			h = hashindex(cache, wanted);
 		        link = cache->first_hash[h];
 			while (link && compare(link->entry, wanted))
 				link = link->next;
@@ -225,7 +298,7 @@ struct CACHED_GENERIC *ntfs_enter_cache(struct CACHE_HEADER *cache,
 			 * When possible, use the hash table to
 			 * find out whether the entry if present
 			 */
-			h = cache->dohash(item);
+			h = hashindex(cache, item);
 		        link = cache->first_hash[h];
 			while (link && compare(link->entry, item))
 				link = link->next;
@@ -247,7 +320,7 @@ struct CACHED_GENERIC *ntfs_enter_cache(struct CACHE_HEADER *cache,
 				}
 		}
 
-		if (!current) {
+		if (!current && charge_entry(cache, item)) {
 			/*
 			 * Not in list, get a free entry or reuse the
 			 * last entry, and relink as head of list
@@ -274,10 +347,15 @@ struct CACHED_GENERIC *ntfs_enter_cache(struct CACHE_HEADER *cache,
 				before->next = (struct CACHED_GENERIC*)NULL;
 				if (cache->dohash)
 					drophashindex(cache,current,
-						cache->dohash(current));
+						hashindex(cache, current));
 				if (cache->dofree)
 					cache->dofree(current);
 				cache->oldest_entry = current->previous;
+				if (cache->budget)
+					ntfs_budget_release(cache->budget,
+						cache->reclaimer.component,
+						current->varsize
+							+ cache->entry_cost);
 				if (item->varsize) {
 					if (current->varsize)
 						current->variable = realloc(
@@ -310,9 +388,21 @@ struct CACHED_GENERIC *ntfs_enter_cache(struct CACHE_HEADER *cache,
 					 * not an error, just uncacheable
 					 */
 					cache->most_recent_entry = current->next;
+					if (cache->most_recent_entry)
+						cache->most_recent_entry->previous
+							= (struct CACHED_GENERIC*)NULL;
+					else
+						cache->oldest_entry
+							= (struct CACHED_GENERIC*)NULL;
 					current->next = cache->free_entry;
 					cache->free_entry = current;
+					current->varsize = 0;
 					current = (struct CACHED_GENERIC*)NULL;
+					if (cache->budget)
+						ntfs_budget_release(cache->budget,
+							cache->reclaimer.component,
+							item->varsize
+							    + cache->entry_cost);
 				}
 			} else {
 				current->variable = (void*)NULL;
@@ -353,6 +443,9 @@ static void do_invalidate(struct CACHE_HEADER *cache,
 		cache->most_recent_entry = current->next;
 	current->next = cache->free_entry;
 	cache->free_entry = current;
+	if (cache->budget)
+		ntfs_budget_release(cache->budget, cache->reclaimer.component,
+				current->varsize + cache->entry_cost);
 	if (current->variable)
 		free(current->variable);
 	current->varsize = 0;
@@ -389,7 +482,7 @@ int ntfs_invalidate_cache(struct CACHE_HEADER *cache,
 			 * When possible, use the hash table to
 			 * find out whether the entry if present
 			 */
-			h = cache->dohash(item);
+			h = hashindex(cache, item);
 		        link = cache->first_hash[h];
 			while (link) {
 				if (compare(link->entry, item))
@@ -416,7 +509,7 @@ int ntfs_invalidate_cache(struct CACHE_HEADER *cache,
 					next = current->next;
 					if (cache->dohash)
 						drophashindex(cache,current,
-						    cache->dohash(current));
+						    hashindex(cache, current));
 					do_invalidate(cache,current,flags);
 					current = next;
 					count++;
@@ -437,7 +530,7 @@ int ntfs_remove_cache(struct CACHE_HEADER *cache,
 	count = 0;
 	if (cache) {
 		if (cache->dohash)
-			drophashindex(cache,item,cache->dohash(item));
+			drophashindex(cache,item,hashindex(cache, item));
 		do_invalidate(cache,item,flags);
 		count++;
 	}
@@ -453,26 +546,59 @@ static void ntfs_free_cache(struct CACHE_HEADER *cache)
 	struct CACHED_GENERIC *entry;
 
 	if (cache) {
+		if (cache->budget)
+			ntfs_budget_unregister(cache->budget,
+					&cache->reclaimer);
 		for (entry=cache->most_recent_entry; entry; entry=entry->next) {
 			if (cache->dofree)
 				cache->dofree(entry);
 			if (entry->variable)
 				free(entry->variable);
+			if (cache->budget)
+				ntfs_budget_release(cache->budget,
+					cache->reclaimer.component,
+					entry->varsize + cache->entry_cost);
 		}
+		if (cache->budget)
+			ntfs_budget_release(cache->budget,
+					NTFS_BUDGET_LRU_CACHES,
+					cache->table_size);
 		free(cache);
 	}
 }
 
+/*
+ *		Get the size of the block holding a cache
+ */
+
+static size_t cache_table_size(int full_item_size, int item_count,
+			int max_hash)
+{
+	size_t size;
+
+	size = sizeof(struct CACHE_HEADER) + item_count*full_item_size;
+	if (max_hash)
+		size += item_count*sizeof(struct HASH_ENTRY)
+			 + max_hash*sizeof(struct HASH_ENTRY*);
+	return (size);
+}
+
 /*
  *		Create a cache
  *
+ *	With a budget, the entries (and hash table) are cut down to
+ *	what is left of it, and the cache gives entries back when
+ *	memory is wanted elsewhere, those of the lowest priority first.
+ *
  *	Returns the cache header, or NULL if the cache could not be created
  */
 
 static struct CACHE_HEADER *ntfs_create_cache(const char *name,
 			cache_free dofree, cache_hash dohash,
 			int full_item_size,
-			int item_count, int max_hash)
+			int item_count, int max_hash,
+			struct NTFS_BUDGET *budget, int component,
+			int priority)
 {
 	struct CACHE_HEADER *cache;
 	struct CACHED_GENERIC *pc;
@@ -483,11 +609,22 @@ static struct CACHE_HEADER *ntfs_create_cache(const char *name,
 	size_t size;
 	int i;
 
-	size = sizeof(struct CACHE_HEADER) + item_count*full_item_size;
-	if (max_hash)
-		size += item_count*sizeof(struct HASH_ENTRY)
-			 + max_hash*sizeof(struct HASH_ENTRY*);
+	size = cache_table_size(full_item_size, item_count, max_hash);
+	if (budget) {
+		while ((size > ntfs_budget_available(budget))
+		    && (item_count > 3)) {
+			item_count = (item_count > 6 ? item_count/2 : 3);
+			if (max_hash)
+				max_hash = 2*item_count;
+			size = cache_table_size(full_item_size, item_count,
+						max_hash);
+		}
+		if (!ntfs_budget_charge(budget, NTFS_BUDGET_LRU_CACHES, size))
+			return ((struct CACHE_HEADER*)NULL);
+	}
 	cache = (struct CACHE_HEADER*)ntfs_malloc(size);
+	if (!cache && budget)
+		ntfs_budget_release(budget, NTFS_BUDGET_LRU_CACHES, size);
 	if (cache) {
 				/* header */
 		cache->name = name;
@@ -503,6 +640,15 @@ static struct CACHE_HEADER *ntfs_create_cache(const char *name,
 		cache->reads = 0;
 		cache->writes = 0;
 		cache->hits = 0;
+		cache->budget = budget;
+		cache->table_size = size;
+		cache->entry_cost = 0;
+		cache->reclaimer.reclaim = reclaim_cache;
+		cache->reclaimer.data = cache;
+		cache->reclaimer.component = component;
+		cache->reclaimer.priority = priority;
+		if (budget)
+			ntfs_budget_register(budget, &cache->reclaimer);
 		/* chain the data entries, and mark an invalid entry */
 		cache->most_recent_entry = (struct CACHED_GENERIC*)NULL;
 		cache->oldest_entry = (struct CACHED_GENERIC*)NULL;
@@ -548,7 +694,18 @@ static struct CACHE_HEADER *ntfs_create_cache(const char *name,
 }
 
 /*
- *		Create all LRU caches
+ *		Get the number of entries of a cache from the size asked for
+ */
+
+static int lru_cache_size(unsigned int wanted)
+{
+	if (!wanted)
+		return (0);
+	return (wanted < 3 ? 3 : (wanted > 0x10000000 ? 0x10000000 : (int)wanted));
+}
+
+/*
+ *		Create all LRU caches with the default sizes
  *
  *	No error return, if creation is not possible, cacheing will
  *	just be not available
@@ -556,31 +713,112 @@ static struct CACHE_HEADER *ntfs_create_cache(const char *name,
 
 void ntfs_create_lru_caches(ntfs_volume *vol)
 {
+	struct LRU_CACHE_SIZES sizes;
+
+	sizes.inode = CACHE_INODE_SIZE;
+	sizes.nidata = CACHE_NIDATA_SIZE;
+	sizes.lookup = CACHE_LOOKUP_SIZE;
+	sizes.securid = CACHE_SECURID_SIZE;
+	sizes.legacy = CACHE_LEGACY_SIZE;
+	sizes.mftrec = CACHE_MFTREC_SIZE;
+	sizes.sdh = CACHE_SDH_SIZE;
+	sizes.reparse = CACHE_REPARSE_SIZE;
+	sizes.cblock = CACHE_CBLOCK_SIZE;
+	ntfs_create_sized_lru_caches(vol, &sizes);
+}
+
+/*
+ *		Create all LRU caches with the number of entries given
+ *
+ *	A cache given no entries is not created. Those compiled out
+ *	(with a zero default size) are never created.
+ */
+
+void ntfs_create_sized_lru_caches(ntfs_volume *vol,
+			const struct LRU_CACHE_SIZES *sizes)
+{
+	int count;
+
 #if CACHE_INODE_SIZE
 		 /* inode cache */
-	vol->xinode_cache = ntfs_create_cache("inode",(cache_free)NULL,
-		ntfs_dir_inode_hash, sizeof(struct CACHED_INODE),
-		CACHE_INODE_SIZE, 2*CACHE_INODE_SIZE);
+	count = lru_cache_size(sizes->inode);
+	vol->xinode_cache = (count ? ntfs_create_cache("inode",
+		(cache_free)NULL, ntfs_dir_inode_hash,
+		sizeof(struct CACHED_INODE), count, 2*count,
+		vol->budget, NTFS_BUDGET_LRU_CACHES, NTFS_RECLAIM_INODE)
+		: (struct CACHE_HEADER*)NULL);
 #endif
 #if CACHE_NIDATA_SIZE
 		 /* idata cache */
-	vol->nidata_cache = ntfs_create_cache("nidata",
+	count = lru_cache_size(sizes->nidata);
+	vol->nidata_cache = (count ? ntfs_create_cache("nidata",
 		ntfs_inode_nidata_free, ntfs_inode_nidata_hash,
-		sizeof(struct CACHED_NIDATA),
-		CACHE_NIDATA_SIZE, 2*CACHE_NIDATA_SIZE);
+		sizeof(struct CACHED_NIDATA), count, 2*count,
+		vol->budget, NTFS_BUDGET_CLOSED_INODES, NTFS_RECLAIM_NIDATA)
+		: (struct CACHE_HEADER*)NULL);
+		/* each entry keeps an inode and its mft record */
+	if (vol->nidata_cache)
+		vol->nidata_cache->entry_cost = sizeof(ntfs_inode)
+					+ vol->mft_record_size;
 #endif
 #if CACHE_LOOKUP_SIZE
 		 /* lookup cache */
-	vol->lookup_cache = ntfs_create_cache("lookup",
+	count = lru_cache_size(sizes->lookup);
+	vol->lookup_cache = (count ? ntfs_create_cache("lookup",
 		(cache_free)NULL, ntfs_dir_lookup_hash,
-		sizeof(struct CACHED_LOOKUP),
-		CACHE_LOOKUP_SIZE, 2*CACHE_LOOKUP_SIZE);
+		sizeof(struct CACHED_LOOKUP), count, 2*count,
+		vol->budget, NTFS_BUDGET_LRU_CACHES, NTFS_RECLAIM_LOOKUP)
+		: (struct CACHE_HEADER*)NULL);
 #endif
-	vol->securid_cache = ntfs_create_cache("securid",(cache_free)NULL,
-		(cache_hash)NULL,sizeof(struct CACHED_SECURID), CACHE_SECURID_SIZE, 0);
+	count = lru_cache_size(sizes->securid);
+	vol->securid_cache = (count ? ntfs_create_cache("securid",
+		(cache_free)NULL, (cache_hash)NULL,
+		sizeof(struct CACHED_SECURID), count, 0,
+		vol->budget, NTFS_BUDGET_LRU_CACHES, NTFS_RECLAIM_SECURID)
+		: (struct CACHE_HEADER*)NULL);
 #if CACHE_LEGACY_SIZE
-	vol->legacy_cache = ntfs_create_cache("legacy",(cache_free)NULL,
-		(cache_hash)NULL, sizeof(struct CACHED_PERMISSIONS_LEGACY), CACHE_LEGACY_SIZE, 0);
+	count = lru_cache_size(sizes->legacy);
+	vol->legacy_cache = (count ? ntfs_create_cache("legacy",
+		(cache_free)NULL, (cache_hash)NULL,
+		sizeof(struct CACHED_PERMISSIONS_LEGACY), count, 0,
+		vol->budget, NTFS_BUDGET_LRU_CACHES, NTFS_RECLAIM_LEGACY)
+		: (struct CACHE_HEADER*)NULL);
+#endif
+#if CACHE_MFTREC_SIZE
+		 /* mft record cache */
+	count = lru_cache_size(sizes->mftrec);
+	vol->mftrec_cache = (count ? ntfs_create_cache("mftrec",
+		(cache_free)NULL, ntfs_mft_record_hash,
+		sizeof(struct CACHED_MFTREC), count, 2*count,
+		vol->budget, NTFS_BUDGET_LRU_CACHES, NTFS_RECLAIM_MFTREC)
+		: (struct CACHE_HEADER*)NULL);
+#endif
+#if CACHE_SDH_SIZE
+		 /* security id cache, by descriptor */
+	count = lru_cache_size(sizes->sdh);
+	vol->sdh_cache = (count ? ntfs_create_cache("sdh",
+		(cache_free)NULL, ntfs_security_sdh_hash,
+		sizeof(struct CACHED_SDH), count, 2*count,
+		vol->budget, NTFS_BUDGET_LRU_CACHES, NTFS_RECLAIM_SDH)
+		: (struct CACHE_HEADER*)NULL);
+#endif
+#if CACHE_REPARSE_SIZE
+		 /* reparse point target cache */
+	count = lru_cache_size(sizes->reparse);
+	vol->reparse_cache = (count ? ntfs_create_cache("reparse",
+		(cache_free)NULL, ntfs_reparse_target_hash,
+		sizeof(struct CACHED_REPARSE), count, 2*count,
+		vol->budget, NTFS_BUDGET_LRU_CACHES, NTFS_RECLAIM_REPARSE)
+		: (struct CACHE_HEADER*)NULL);
+#endif
+#if CACHE_CBLOCK_SIZE
+		 /* decompressed compression block cache */
+	count = lru_cache_size(sizes->cblock);
+	vol->cblock_cache = (count ? ntfs_create_cache("cblock",
+		(cache_free)NULL, ntfs_compressed_block_hash,
+		sizeof(struct CACHED_CBLOCK), count, 2*count,
+		vol->budget, NTFS_BUDGET_LRU_CACHES, NTFS_RECLAIM_CBLOCK)
+		: (struct CACHE_HEADER*)NULL);
 #endif
 }
 
@@ -603,4 +841,16 @@ void ntfs_free_lru_caches(ntfs_volume *vol)
 #if CACHE_LEGACY_SIZE
 	ntfs_free_cache(vol->legacy_cache);
 #endif
+#if CACHE_MFTREC_SIZE
+	ntfs_free_cache(vol->mftrec_cache);
+#endif
+#if CACHE_SDH_SIZE
+	ntfs_free_cache(vol->sdh_cache);
+#endif
+#if CACHE_REPARSE_SIZE
+	ntfs_free_cache(vol->reparse_cache);
+#endif
+#if CACHE_CBLOCK_SIZE
+	ntfs_free_cache(vol->cblock_cache);
+#endif
 }
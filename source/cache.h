@@ -23,6 +23,7 @@
 #define _NTFS_CACHE_H_
 
 #include "volume.h"
+#include "budget.h"
 
 struct CACHED_GENERIC {
 	struct CACHED_GENERIC *next;
@@ -64,6 +65,48 @@ struct CACHED_LOOKUP {
 	u64 inum;
 } ;
 
+struct CACHED_MFTREC {
+	struct CACHED_MFTREC *next;
+	struct CACHED_MFTREC *previous;
+	MFT_RECORD *mrec;	/* mst deprotected copy of the record */
+	size_t varsize;		/* the mft record size */
+	union ALIGNMENT payload[0];
+		/* above fields must match "struct CACHED_GENERIC" */
+	u64 inum;
+} ;
+
+struct CACHED_SDH {
+	struct CACHED_SDH *next;
+	struct CACHED_SDH *previous;
+	char *descr;		/* copy of the self-relative descriptor */
+	size_t varsize;		/* the descriptor size */
+	union ALIGNMENT payload[0];
+		/* above fields must match "struct CACHED_GENERIC" */
+	le32 hash;
+	le32 securid;
+} ;
+
+struct CACHED_REPARSE {
+	struct CACHED_REPARSE *next;
+	struct CACHED_REPARSE *previous;
+	char *link;		/* mount point, then target, null terminated */
+	size_t varsize;		/* the size of both strings */
+	union ALIGNMENT payload[0];
+		/* above fields must match "struct CACHED_GENERIC" */
+	u64 mref;		/* mft reference of the reparse point */
+} ;
+
+struct CACHED_CBLOCK {
+	struct CACHED_CBLOCK *next;
+	struct CACHED_CBLOCK *previous;
+	u8 *data;		/* decompressed contents of the block */
+	size_t varsize;		/* the compression block size */
+	union ALIGNMENT payload[0];
+		/* above fields must match "struct CACHED_GENERIC" */
+	u64 inum;
+	VCN vcn;
+} ;
+
 enum {
 	CACHE_FREE = 1,
 	CACHE_NOHASH = 2
@@ -93,6 +136,10 @@ struct CACHE_HEADER {
 	unsigned long hits;
 	int fixed_size;
 	int max_hash;
+	struct NTFS_BUDGET *budget;	/* NULL if not accounted for */
+	struct NTFS_RECLAIMER reclaimer;
+	size_t table_size;	/* charged when created */
+	size_t entry_cost;	/* charged per entry besides the variable part */
 	struct CACHED_GENERIC entry[0];
 } ;
 
@@ -111,7 +158,21 @@ int ntfs_invalidate_cache(struct CACHE_HEADER *cache,
 int ntfs_remove_cache(struct CACHE_HEADER *cache,
 			struct CACHED_GENERIC *item, int flags);
 
+struct LRU_CACHE_SIZES {
+	unsigned int inode;
+	unsigned int nidata;
+	unsigned int lookup;
+	unsigned int securid;
+	unsigned int legacy;
+	unsigned int mftrec;
+	unsigned int sdh;
+	unsigned int reparse;
+	unsigned int cblock;
+} ;
+
 void ntfs_create_lru_caches(ntfs_volume *vol);
+void ntfs_create_sized_lru_caches(ntfs_volume *vol,
+			const struct LRU_CACHE_SIZES *sizes);
 void ntfs_free_lru_caches(ntfs_volume *vol);
 
 #endif /* _NTFS_CACHE_H_ */
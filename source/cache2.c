@@ -3,11 +3,15 @@
  The cache is not visible to the user. It should be flushed
  when any file is closed or changes are made to the filesystem.
 
- This cache implements a least-used-page replacement policy. This will
- distribute sectors evenly over the pages, so if less than the maximum
- pages are used at once, they should all eventually remain in the cache.
- This also has the benefit of throwing out old sectors, so as not to keep
- too many stale pages around.
+ This cache implements a 2Q page replacement policy by default. Pages
+ read in once are kept in a short FIFO queue and only move to the main
+ LRU queue when they are referenced again soon after being replaced, so
+ a long sequential stream cannot flush out frequently used metadata.
+ A plain least-recently-used policy can be selected instead.
+
+ Pages of up to 1024 sectors are supported. Accesses the caller tags as
+ metadata can be given their own pool of smaller pages, which bulk data
+ transfers can never replace.
 
  Copyright (c) 2006 Michael "Chishm" Chisholm
  Copyright (c) 2009 shareese, rodries
@@ -37,6 +41,8 @@
 */
 
 #include <string.h>
+#include <stdlib.h>
+#include <errno.h>
 #include <limits.h>
 
 #include "cache2.h"
@@ -46,114 +52,772 @@
 
 #define CACHE_FREE ((sec_t)-1)
 
-NTFS_CACHE* _NTFS_cache_constructor (unsigned int numberOfPages, unsigned int sectorsPerPage, DISC_INTERFACE* discInterface, sec_t endOfPartition, unsigned int bytesPerSector) {
-	NTFS_CACHE* cache;
+#define CACHE_MIN_PAGE_SIZE 32
+#define CACHE_MAX_PAGE_SIZE 1024
+
+// Clean sectors between dirty ones are written over rather than split into another command,
+// up to this many
+#define CACHE_WRITEBACK_MAX_HOLE 16
+
+// Dirty pages are coalesced into writes of at least this many sectors, through a staging buffer
+// allocated the first time it is needed
+#define CACHE_WRITEBACK_MIN_STAGING 256
+
+// The background flusher writes back at most this many pages before letting other threads in
+#define CACHE_FLUSHER_BATCH 16
+#define CACHE_FLUSHER_STACK_SIZE (16*1024)
+#define CACHE_FLUSHER_PRIORITY 48
+
+static void _NTFS_cache_queueRemove(NTFS_CACHE_POOL *pool,NTFS_CACHE_ENTRY *entry);
+static void _NTFS_cache_queueInsert(NTFS_CACHE_POOL *pool,unsigned int queue,NTFS_CACHE_ENTRY *entry);
+static bool _NTFS_cache_doFlush(NTFS_CACHE *cache);
+
+static void _NTFS_cache_poolDestructor (NTFS_CACHE_POOL* pool) {
+	unsigned int i;
+
+	// Free memory in reverse allocation order
+	if (pool->cacheEntries) {
+		for (i = 0; i < pool->numberOfPages; i++) {
+			ntfs_free (pool->cacheEntries[i].cache);
+		}
+	}
+	ntfs_free (pool->cacheEntries);
+	ntfs_free (pool->dirtyBitmaps);
+	ntfs_free (pool->ghosts);
+	memset(pool, 0, sizeof(NTFS_CACHE_POOL));
+}
+
+static bool _NTFS_cache_poolConstructor (NTFS_CACHE_POOL* pool, unsigned int numberOfPages, unsigned int sectorsPerPage, unsigned int bytesPerSector) {
 	unsigned int i;
 	NTFS_CACHE_ENTRY* cacheEntries;
 
-	if(numberOfPages==0 || sectorsPerPage==0) return NULL;
+	memset(pool, 0, sizeof(NTFS_CACHE_POOL));
+
+	if (numberOfPages == 0) {
+		return true;
+	}
+
+	// Round the page size down to a power of two so pages can be located with shifts
+	while ((2U << pool->pageShift) <= sectorsPerPage) {
+		pool->pageShift++;
+	}
+
+	pool->numberOfPages = numberOfPages;
+	pool->sectorsPerPage = 1U << pool->pageShift;
+	pool->dirtyWords = (pool->sectorsPerPage + 31) / 32;
+
+	// A1in holds a quarter of the pages, and twice as many replaced pages as fit in the
+	// cache are remembered so that a stream cannot push hot pages out of the history
+	pool->maxA1in = numberOfPages / 4;
+	pool->ghostSize = numberOfPages * 2;
+
+	pool->ghosts = (sec_t*) ntfs_alloc ( sizeof(sec_t) * pool->ghostSize);
+	pool->dirtyBitmaps = (uint32_t*) ntfs_alloc ( sizeof(uint32_t) * pool->dirtyWords * numberOfPages);
+	cacheEntries = (NTFS_CACHE_ENTRY*) ntfs_alloc ( sizeof(NTFS_CACHE_ENTRY) * numberOfPages);
+	pool->cacheEntries = cacheEntries;
+	if (pool->ghosts == NULL || pool->dirtyBitmaps == NULL || cacheEntries == NULL) {
+		_NTFS_cache_poolDestructor (pool);
+		return false;
+	}
+
+	memset(pool->dirtyBitmaps, 0, sizeof(uint32_t) * pool->dirtyWords * numberOfPages);
+	memset(cacheEntries, 0, sizeof(NTFS_CACHE_ENTRY) * numberOfPages);
+
+	for (i = 0; i < numberOfPages; i++) {
+		cacheEntries[i].sector = CACHE_FREE;
+		cacheEntries[i].count = 0;
+		cacheEntries[i].last_access = 0;
+		cacheEntries[i].dirty = &pool->dirtyBitmaps[i * pool->dirtyWords];
+		cacheEntries[i].dirtyFirst = 0;
+		cacheEntries[i].dirtyEnd = 0;
+		cacheEntries[i].cache = (uint8_t*) ntfs_align ( pool->sectorsPerPage * bytesPerSector );
+		cacheEntries[i].pool = pool;
+		cacheEntries[i].next = NULL;
+		if (cacheEntries[i].cache == NULL) {
+			_NTFS_cache_poolDestructor (pool);
+			return false;
+		}
+		_NTFS_cache_queueInsert(pool,CACHE_QUEUE_FREE,&cacheEntries[i]);
+	}
+
+	return true;
+}
+
+/*
+Free the pools and buffers of a cache, whose size depends on its geometry
+*/
+static void _NTFS_cache_freeLayout (NTFS_CACHE* layout) {
+	_NTFS_cache_poolDestructor(&layout->pools[CACHE_POOL_META]);
+	_NTFS_cache_poolDestructor(&layout->pools[CACHE_POOL_DATA]);
+	ntfs_free (layout->writeList);
+	ntfs_free (layout->stagingBuffer);
+	ntfs_free (layout->hashTable);
+}
+
+/*
+Allocate the pools and buffers for a cache geometry into layout
+*/
+static bool _NTFS_cache_buildLayout (NTFS_CACHE* layout, unsigned int numberOfPages, unsigned int sectorsPerPage, unsigned int numberOfMetaPages, unsigned int sectorsPerMetaPage, unsigned int bytesPerSector, unsigned int readAheadPages) {
+	unsigned int totalPages;
+
+	if(numberOfPages==0 || sectorsPerPage==0) return false;
 
 	if (numberOfPages < 4) {
 		numberOfPages = 4;
 	}
 
-	if (sectorsPerPage < 32) {
-		sectorsPerPage = 32;
-	} else if (sectorsPerPage > 64) {
-		sectorsPerPage = 64;
+	if (sectorsPerPage < CACHE_MIN_PAGE_SIZE) {
+		sectorsPerPage = CACHE_MIN_PAGE_SIZE;
+	} else if (sectorsPerPage > CACHE_MAX_PAGE_SIZE) {
+		sectorsPerPage = CACHE_MAX_PAGE_SIZE;
+	}
+
+	// Metadata pages may not be larger than data pages
+	if (sectorsPerMetaPage == 0) {
+		numberOfMetaPages = 0;
+	} else if (sectorsPerMetaPage > sectorsPerPage) {
+		sectorsPerMetaPage = sectorsPerPage;
+	}
+
+	if (numberOfMetaPages > 0 && numberOfMetaPages < 4) {
+		numberOfMetaPages = 4;
+	}
+
+	memset(layout, 0, sizeof(NTFS_CACHE));
+
+	// Size the hash table to at least twice the number of pages, keeping the chains short
+	totalPages = numberOfPages + numberOfMetaPages;
+	layout->hashBits = 4;
+	while ((1U << layout->hashBits) < totalPages * 2 && layout->hashBits < 24) {
+		layout->hashBits++;
+	}
+
+	layout->hashTable = (NTFS_CACHE_ENTRY**) ntfs_alloc ( sizeof(NTFS_CACHE_ENTRY*) << layout->hashBits);
+	layout->writeList = (NTFS_CACHE_ENTRY**) ntfs_alloc ( sizeof(NTFS_CACHE_ENTRY*) * totalPages);
+	if (layout->hashTable == NULL || layout->writeList == NULL ||
+		!_NTFS_cache_poolConstructor(&layout->pools[CACHE_POOL_DATA], numberOfPages, sectorsPerPage, bytesPerSector) ||
+		!_NTFS_cache_poolConstructor(&layout->pools[CACHE_POOL_META], numberOfMetaPages, sectorsPerMetaPage, bytesPerSector)) {
+		_NTFS_cache_freeLayout(layout);
+		return false;
+	}
+
+	memset(layout->hashTable, 0, sizeof(NTFS_CACHE_ENTRY*) << layout->hashBits);
+
+	// Read-ahead may not take up more than half of the data pages
+	if (readAheadPages > numberOfPages / 2) {
+		readAheadPages = numberOfPages / 2;
+	}
+
+	layout->stagingSize = readAheadPages * layout->pools[CACHE_POOL_DATA].sectorsPerPage;
+	if (layout->stagingSize < CACHE_WRITEBACK_MIN_STAGING) {
+		layout->stagingSize = CACHE_WRITEBACK_MIN_STAGING;
+	}
+
+	// The staging buffer itself is only allocated once something needs it
+	layout->stagingBuffer = NULL;
+	if (readAheadPages > 1) {
+		layout->readAheadMax = readAheadPages;
+	}
+
+	return true;
+}
+
+/*
+Move a freshly built layout into a cache, whose own layout must already be freed
+*/
+static void _NTFS_cache_installLayout (NTFS_CACHE* cache, NTFS_CACHE* layout) {
+	unsigned int i, j;
+
+	memcpy(cache->pools, layout->pools, sizeof(cache->pools));
+	cache->hashTable = layout->hashTable;
+	cache->hashBits = layout->hashBits;
+	cache->writeList = layout->writeList;
+	cache->stagingBuffer = layout->stagingBuffer;
+	cache->stagingSize = layout->stagingSize;
+	cache->stagingCount = 0;
+	cache->stagingSource = NULL;
+	cache->readAheadMax = layout->readAheadMax;
+	cache->readAheadWindow = 0;
+	cache->readAheadNext = CACHE_FREE;
+	cache->dirtyPages = 0;
+	cache->pinnedPages = 0;
+
+	// The pages moved along with their pools
+	for (j = 0; j < CACHE_POOL_COUNT; j++) {
+		for (i = 0; i < cache->pools[j].numberOfPages; i++) {
+			cache->pools[j].cacheEntries[i].pool = &cache->pools[j];
+		}
+	}
+}
+
+NTFS_CACHE* _NTFS_cache_constructor (unsigned int numberOfPages, unsigned int sectorsPerPage, unsigned int numberOfMetaPages, unsigned int sectorsPerMetaPage, DISC_INTERFACE* discInterface, sec_t endOfPartition, unsigned int bytesPerSector, NTFS_CACHE_POLICY policy, unsigned int readAheadPages) {
+	NTFS_CACHE* cache;
+	NTFS_CACHE layout;
+
+	if (!_NTFS_cache_buildLayout(&layout, numberOfPages, sectorsPerPage, numberOfMetaPages, sectorsPerMetaPage, bytesPerSector, readAheadPages)) {
+		return NULL;
 	}
 
 	cache = (NTFS_CACHE*) ntfs_alloc (sizeof(NTFS_CACHE));
 	if (cache == NULL) {
+		_NTFS_cache_freeLayout(&layout);
 		return NULL;
 	}
 
 	cache->disc = discInterface;
 	cache->endOfPartition = endOfPartition;
-	cache->numberOfPages = numberOfPages;
-	cache->sectorsPerPage = sectorsPerPage;
 	cache->bytesPerSector = bytesPerSector;
+	cache->policy = policy;
+	cache->accessCounter = 0;
+	_NTFS_cache_installLayout(cache, &layout);
 
+	memset(&cache->stats, 0, sizeof(NTFS_CACHE_STATS));
+	cache->flusher = LWP_THREAD_NULL;
+	LWP_MutexInit(&cache->lock, false);
 
-	cacheEntries = (NTFS_CACHE_ENTRY*) ntfs_alloc ( sizeof(NTFS_CACHE_ENTRY) * numberOfPages);
-	if (cacheEntries == NULL) {
-		ntfs_free (cache);
-		return NULL;
+	return cache;
+}
+
+bool _NTFS_cache_reconfigure (NTFS_CACHE* cache, unsigned int numberOfPages, unsigned int sectorsPerPage, unsigned int numberOfMetaPages, unsigned int sectorsPerMetaPage, unsigned int readAheadPages) {
+	NTFS_CACHE layout;
+
+	LWP_MutexLock(cache->lock);
+
+	// Pinned pages are in use outside the cache and must stay where they are
+	if (cache->pinnedPages) {
+		LWP_MutexUnlock(cache->lock);
+		errno = EBUSY;
+		return false;
 	}
 
-	for (i = 0; i < numberOfPages; i++) {
-		cacheEntries[i].sector = CACHE_FREE;
-		cacheEntries[i].count = 0;
-		cacheEntries[i].last_access = 0;
-		cacheEntries[i].dirty = 0;
-		cacheEntries[i].cache = (uint8_t*) ntfs_align ( sectorsPerPage * bytesPerSector );
+	// Build the new layout first, so that the cache stays usable if there is not enough memory
+	if (!_NTFS_cache_buildLayout(&layout, numberOfPages, sectorsPerPage, numberOfMetaPages, sectorsPerMetaPage, cache->bytesPerSector, readAheadPages)) {
+		LWP_MutexUnlock(cache->lock);
+		errno = ENOMEM;
+		return false;
 	}
 
-	cache->cacheEntries = cacheEntries;
+	if (!_NTFS_cache_doFlush(cache)) {
+		_NTFS_cache_freeLayout(&layout);
+		LWP_MutexUnlock(cache->lock);
+		errno = EIO;
+		return false;
+	}
 
-	return cache;
+	_NTFS_cache_freeLayout(cache);
+	_NTFS_cache_installLayout(cache, &layout);
+
+	LWP_MutexUnlock(cache->lock);
+	return true;
 }
 
 void _NTFS_cache_destructor (NTFS_CACHE* cache) {
-	unsigned int i;
+	// Stop the background flusher
+	if (cache->flusher != LWP_THREAD_NULL) {
+		LWP_MutexLock(cache->lock);
+		cache->flusherQuit = true;
+		LWP_CondSignal(cache->flusherCond);
+		LWP_MutexUnlock(cache->lock);
+		LWP_JoinThread(cache->flusher, NULL);
+		LWP_CondDestroy(cache->flusherCond);
+	}
+
 	// Clear out cache before destroying it
-	_NTFS_cache_flush(cache);
+	_NTFS_cache_doFlush(cache);
+	LWP_MutexDestroy(cache->lock);
 
 	// Free memory in reverse allocation order
-	for (i = 0; i < cache->numberOfPages; i++) {
-		ntfs_free (cache->cacheEntries[i].cache);
-	}
-	ntfs_free (cache->cacheEntries);
+	_NTFS_cache_freeLayout(cache);
 	ntfs_free (cache);
 }
 
+static inline uint64_t accessTime(NTFS_CACHE *cache){
+	return ++cache->accessCounter;
+}
+
+static void _NTFS_cache_queueRemove(NTFS_CACHE_POOL *pool,NTFS_CACHE_ENTRY *entry)
+{
+	NTFS_CACHE_QUEUE *queue = &pool->queues[entry->queue];
 
-static u32 accessCounter = 0;
+	if(entry->newer) entry->newer->older = entry->older;
+	else queue->head = entry->older;
+	if(entry->older) entry->older->newer = entry->newer;
+	else queue->tail = entry->newer;
+
+	entry->newer = entry->older = NULL;
+	queue->count--;
+}
 
-static u32 accessTime(){
-	accessCounter++;
-	return accessCounter;
+static void _NTFS_cache_queueInsert(NTFS_CACHE_POOL *pool,unsigned int queue,NTFS_CACHE_ENTRY *entry)
+{
+	NTFS_CACHE_QUEUE *q = &pool->queues[queue];
+
+	entry->queue = queue;
+	entry->newer = NULL;
+	entry->older = q->head;
+	if(q->head) q->head->newer = entry;
+	else q->tail = entry;
+	q->head = entry;
+	q->count++;
 }
 
+/*
+Remember the base sector of a page replaced from A1in, dropping the oldest one
+*/
+static void _NTFS_cache_addGhost(NTFS_CACHE_POOL *pool,sec_t sector)
+{
+	if(pool->ghostSize==0) return;
+
+	pool->ghosts[pool->ghostHead] = sector;
+	pool->ghostHead = (pool->ghostHead + 1) % pool->ghostSize;
+	if(pool->ghostCount < pool->ghostSize) pool->ghostCount++;
+}
 
-static NTFS_CACHE_ENTRY* _NTFS_cache_getPage(NTFS_CACHE *cache,sec_t sector,sec_t numSectors,bool write)
+/*
+Check whether a page was replaced from A1in recently, forgetting it if so
+*/
+static bool _NTFS_cache_takeGhost(NTFS_CACHE_POOL *pool,sec_t sector)
 {
 	unsigned int i;
-	NTFS_CACHE_ENTRY* cacheEntries = cache->cacheEntries;
-	unsigned int numberOfPages = cache->numberOfPages;
-	unsigned int sectorsPerPage = cache->sectorsPerPage;
 
-	bool foundFree = false;
-	unsigned int oldUsed = 0;
-	unsigned int oldAccess = UINT_MAX;
+	for(i=0;i<pool->ghostCount;i++) {
+		if(pool->ghosts[i]==sector) {
+			pool->ghosts[i] = CACHE_FREE;
+			return true;
+		}
+	}
 
-	for(i=0;i<numberOfPages;i++) {
-		if(sector>=cacheEntries[i].sector && sector<(cacheEntries[i].sector + cacheEntries[i].count)) {
-			cacheEntries[i].last_access = accessTime();
-			return &(cacheEntries[i]);
+	return false;
+}
+
+/*
+Mark a page as referenced by the current access
+*/
+static inline void _NTFS_cache_touch(NTFS_CACHE *cache,NTFS_CACHE_ENTRY *entry)
+{
+	NTFS_CACHE_POOL *pool = entry->pool;
+
+	// Re-references within A1in are correlated and do not promote the page
+	if(entry->queue==CACHE_QUEUE_AM && pool->queues[CACHE_QUEUE_AM].head!=entry) {
+		_NTFS_cache_queueRemove(pool,entry);
+		_NTFS_cache_queueInsert(pool,CACHE_QUEUE_AM,entry);
+	}
+
+	entry->last_access = accessTime(cache);
+}
+
+/*
+Find the oldest page of a queue that may be reused
+*/
+static inline NTFS_CACHE_ENTRY* _NTFS_cache_queueVictim(NTFS_CACHE_QUEUE *queue)
+{
+	NTFS_CACHE_ENTRY *entry = queue->tail;
+
+	// Pinned pages are passed over until they are unpinned
+	while(entry!=NULL && entry->pinned) entry = entry->newer;
+
+	return entry;
+}
+
+/*
+Pick the page to load the next sectors into, without yet removing it from its queue
+Returns NULL if every page of the pool is pinned
+*/
+static NTFS_CACHE_ENTRY* _NTFS_cache_getVictim(NTFS_CACHE_POOL *pool)
+{
+	NTFS_CACHE_QUEUE *queues = pool->queues;
+	NTFS_CACHE_ENTRY *entry, *a1in, *am;
+
+	entry = _NTFS_cache_queueVictim(&queues[CACHE_QUEUE_FREE]);
+	if(entry) return entry;
+
+	a1in = _NTFS_cache_queueVictim(&queues[CACHE_QUEUE_A1IN]);
+	am = _NTFS_cache_queueVictim(&queues[CACHE_QUEUE_AM]);
+	if(a1in && (queues[CACHE_QUEUE_A1IN].count > pool->maxA1in || !am))
+		return a1in;
+
+	return am;
+}
+
+/*
+Hash a page aligned base sector into a bucket of the page index
+*/
+static inline unsigned int _NTFS_cache_hash(NTFS_CACHE *cache,NTFS_CACHE_POOL *pool,sec_t sector)
+{
+	uint64_t page = sector >> pool->pageShift;
+	return (((uint32_t)page ^ (uint32_t)(page >> 32)) * 0x9E3779B1U) >> (32 - cache->hashBits);
+}
+
+static NTFS_CACHE_ENTRY* _NTFS_cache_lookup(NTFS_CACHE *cache,NTFS_CACHE_POOL *pool,sec_t sector)
+{
+	NTFS_CACHE_ENTRY *entry = cache->hashTable[_NTFS_cache_hash(cache,pool,sector)];
+
+	while(entry!=NULL && (entry->sector!=sector || entry->pool!=pool)) entry = entry->next;
+
+	return entry;
+}
+
+static void _NTFS_cache_hashInsert(NTFS_CACHE *cache,NTFS_CACHE_ENTRY *entry)
+{
+	NTFS_CACHE_ENTRY **bucket = &cache->hashTable[_NTFS_cache_hash(cache,entry->pool,entry->sector)];
+
+	entry->next = *bucket;
+	*bucket = entry;
+}
+
+static void _NTFS_cache_hashRemove(NTFS_CACHE *cache,NTFS_CACHE_ENTRY *entry)
+{
+	NTFS_CACHE_ENTRY **link = &cache->hashTable[_NTFS_cache_hash(cache,entry->pool,entry->sector)];
+
+	while(*link!=NULL) {
+		if(*link==entry) {
+			*link = entry->next;
+			break;
 		}
+		link = &(*link)->next;
+	}
+
+	entry->next = NULL;
+}
+
+/*
+Check whether enough pages are dirty for the background flusher to write them all back
+*/
+static inline bool _NTFS_cache_overThreshold(NTFS_CACHE *cache)
+{
+	unsigned int totalPages = cache->pools[CACHE_POOL_DATA].numberOfPages + cache->pools[CACHE_POOL_META].numberOfPages;
+
+	return cache->dirtyPages * 100 >= totalPages * cache->flushThreshold;
+}
+
+/*
+Mark a run of sectors within a page as dirty
+*/
+static void _NTFS_cache_markDirty(NTFS_CACHE *cache,NTFS_CACHE_ENTRY *entry,unsigned int sec,unsigned int count)
+{
+	unsigned int end = sec + count;
+	unsigned int i;
+
+	if(count==0) return;
+
+	for(i=sec;i<end && (i&31);i++) entry->dirty[i>>5] |= 1U << (i&31);
+	for(;i+32<=end;i+=32) entry->dirty[i>>5] = 0xFFFFFFFF;
+	for(;i<end;i++) entry->dirty[i>>5] |= 1U << (i&31);
+
+	if(entry->dirtyEnd==0) {
+		entry->dirtyFirst = sec;
+		entry->dirtyEnd = end;
+		entry->dirtied = gettime();
+		cache->dirtyPages++;
+		if(cache->flusher!=LWP_THREAD_NULL && _NTFS_cache_overThreshold(cache)) LWP_CondSignal(cache->flusherCond);
+	} else {
+		if(sec < entry->dirtyFirst) entry->dirtyFirst = sec;
+		if(end > entry->dirtyEnd) entry->dirtyEnd = end;
+	}
+}
+
+static inline bool _NTFS_cache_isDirtySector(NTFS_CACHE_ENTRY *entry,unsigned int sec)
+{
+	return (entry->dirty[sec>>5] >> (sec&31)) & 1;
+}
 
-		if(foundFree==false && (cacheEntries[i].sector==CACHE_FREE || cacheEntries[i].last_access<oldAccess)) {
-			if(cacheEntries[i].sector==CACHE_FREE) foundFree = true;
-			oldUsed = i;
-			oldAccess = cacheEntries[i].last_access;
+static void _NTFS_cache_clearDirty(NTFS_CACHE *cache,NTFS_CACHE_ENTRY *entry)
+{
+	unsigned int first = entry->dirtyFirst >> 5;
+	unsigned int last = (entry->dirtyEnd + 31) >> 5;
+
+	if(entry->dirtyEnd==0) return;
+
+	memset(&entry->dirty[first],0,(last-first)*sizeof(uint32_t));
+	entry->dirtyFirst = 0;
+	entry->dirtyEnd = 0;
+	cache->dirtyPages--;
+}
+
+/*
+Transfer sectors between the disc and the cache, keeping count of the bytes moved
+*/
+static inline bool _NTFS_cache_discRead(NTFS_CACHE *cache,sec_t sector,sec_t numSectors,void *buffer)
+{
+	cache->stats.bytesRead += numSectors*cache->bytesPerSector;
+	cache->stats.reads++;
+	return cache->disc->readSectors(cache->disc,sector,numSectors,buffer);
+}
+
+static inline bool _NTFS_cache_discWrite(NTFS_CACHE *cache,sec_t sector,sec_t numSectors,const void *buffer)
+{
+	cache->stats.bytesWritten += numSectors*cache->bytesPerSector;
+	cache->stats.writes++;
+	return cache->disc->writeSectors(cache->disc,sector,numSectors,buffer);
+}
+
+/*
+Find the next run of dirty sectors in a page at or after *pos, taking in clean
+holes of up to CACHE_WRITEBACK_MAX_HOLE sectors
+*/
+static bool _NTFS_cache_nextDirtyRun(NTFS_CACHE_ENTRY *entry,unsigned int *pos,unsigned int *start,unsigned int *end)
+{
+	unsigned int i = *pos;
+	unsigned int hole;
+
+	while(i<entry->dirtyEnd && !_NTFS_cache_isDirtySector(entry,i)) {
+		if(!(i&31) && entry->dirty[i>>5]==0) i += 32;
+		else i++;
+	}
+	if(i>=entry->dirtyEnd) return false;
+
+	*start = i;
+	for(;;) {
+		while(i<entry->dirtyEnd && _NTFS_cache_isDirtySector(entry,i)) {
+			if(!(i&31) && entry->dirty[i>>5]==0xFFFFFFFF) i += 32;
+			else i++;
 		}
+		*end = i;
+
+		for(hole=i;hole<entry->dirtyEnd && !_NTFS_cache_isDirtySector(entry,hole);hole++) {
+			if(hole-i >= CACHE_WRITEBACK_MAX_HOLE) break;
+		}
+		if(hole>=entry->dirtyEnd || hole-i >= CACHE_WRITEBACK_MAX_HOLE) break;
+		i = hole;
 	}
 
-	if(foundFree==false && cacheEntries[oldUsed].dirty!=0) {
-		sec_t sec = ffsll(cacheEntries[oldUsed].dirty)-1;
-		sec_t secs_to_write = flsll(cacheEntries[oldUsed].dirty)-sec;
+	*pos = *end;
+	return true;
+}
 
-		if(!cache->disc->writeSectors(cache->disc,cacheEntries[oldUsed].sector+sec,secs_to_write,cacheEntries[oldUsed].cache+(sec*cache->bytesPerSector))) return NULL;
+/*
+Get the staging buffer, allocating it the first time. Without one, transfers fall back to
+single pages rather than failing
+*/
+static uint8_t* _NTFS_cache_staging(NTFS_CACHE *cache)
+{
+	if(cache->stagingBuffer==NULL && cache->stagingSize>0) {
+		cache->stagingBuffer = (uint8_t*) ntfs_align(cache->stagingSize*cache->bytesPerSector);
+		if(cache->stagingBuffer==NULL) {
+			cache->stagingSize = 0;
+			cache->readAheadMax = 0;
+		}
+	}
 
-		cacheEntries[oldUsed].dirty = 0;
+	return cache->stagingBuffer;
+}
+
+/*
+Write out the sectors gathered in the staging buffer
+*/
+static bool _NTFS_cache_flushStaging(NTFS_CACHE *cache)
+{
+	const void *src = cache->stagingSource ? cache->stagingSource : cache->stagingBuffer;
+	bool ret = true;
+
+	if(cache->stagingCount==0) return true;
+
+	ret = _NTFS_cache_discWrite(cache,cache->stagingSector,cache->stagingCount,src);
+	cache->stats.writebacks++;
+
+	cache->stagingCount = 0;
+	cache->stagingSource = NULL;
+	return ret;
+}
+
+/*
+Queue a run of page data for writing, merging it with the previous run when they are
+contiguous on disc
+*/
+static bool _NTFS_cache_stageWrite(NTFS_CACHE *cache,sec_t sector,unsigned int count,const uint8_t *src)
+{
+	if(cache->stagingCount>0 && (sector!=cache->stagingSector+cache->stagingCount || cache->stagingCount+count>cache->stagingSize)) {
+		if(!_NTFS_cache_flushStaging(cache)) return false;
 	}
 
-	cacheEntries[oldUsed].sector = (sector/sectorsPerPage)*sectorsPerPage; // align base sector to page size
-	sector -= cacheEntries[oldUsed].sector;
-	cacheEntries[oldUsed].count = cache->endOfPartition - cacheEntries[oldUsed].sector;
-	if(cacheEntries[oldUsed].count > sectorsPerPage) cacheEntries[oldUsed].count = sectorsPerPage;
-	else sectorsPerPage = cacheEntries[oldUsed].count;
+	// A run is only copied once another one is merged with it
+	if(cache->stagingCount==0 || !_NTFS_cache_staging(cache)) {
+		if(!_NTFS_cache_flushStaging(cache)) return false;
+
+		cache->stagingSector = sector;
+		cache->stagingCount = count;
+		cache->stagingSource = src;
+		return true;
+	}
+
+	if(cache->stagingSource) {
+		memcpy(cache->stagingBuffer,cache->stagingSource,cache->stagingCount*cache->bytesPerSector);
+		cache->stagingSource = NULL;
+	}
+
+	memcpy(cache->stagingBuffer+(cache->stagingCount*cache->bytesPerSector),src,count*cache->bytesPerSector);
+	cache->stagingCount += count;
+	return true;
+}
+
+/*
+Write back a list of dirty pages sorted by sector, in as few commands as possible
+*/
+static bool _NTFS_cache_writePages(NTFS_CACHE *cache,NTFS_CACHE_ENTRY **pages,unsigned int count)
+{
+	unsigned int i, pos, start, end;
+	NTFS_CACHE_ENTRY *entry;
+
+	for(i=0;i<count;i++) {
+		entry = pages[i];
+		pos = entry->dirtyFirst;
+		while(_NTFS_cache_nextDirtyRun(entry,&pos,&start,&end)) {
+			if(!_NTFS_cache_stageWrite(cache,entry->sector+start,end-start,entry->cache+(start*cache->bytesPerSector))) return false;
+		}
+	}
+
+	if(!_NTFS_cache_flushStaging(cache)) return false;
+
+	for(i=0;i<count;i++) _NTFS_cache_clearDirty(cache,pages[i]);
+	return true;
+}
+
+/*
+Find the page of either pool holding a sector
+*/
+static NTFS_CACHE_ENTRY* _NTFS_cache_pageAt(NTFS_CACHE *cache,sec_t sector)
+{
+	NTFS_CACHE_ENTRY* entry;
+	NTFS_CACHE_POOL* pool;
+	unsigned int i;
+
+	for(i=0;i<CACHE_POOL_COUNT;i++) {
+		pool = &cache->pools[i];
+		if(pool->numberOfPages==0) continue;
+
+		entry = _NTFS_cache_lookup(cache,pool,(sector>>pool->pageShift)<<pool->pageShift);
+		if(entry!=NULL && sector<(entry->sector + entry->count)) return entry;
+	}
+
+	return NULL;
+}
+
+/*
+Write the dirty sectors of a page back to disc, together with those of the dirty pages
+directly around it while they fit in the staging buffer
+*/
+static bool _NTFS_cache_writeBack(NTFS_CACHE *cache,NTFS_CACHE_ENTRY *entry)
+{
+	NTFS_CACHE_ENTRY *page;
+	unsigned int count = 1;
+	unsigned int size = entry->count;
+
+	if(entry->dirtyEnd==0) return true;
+
+	cache->writeList[0] = entry;
+
+	while(entry->sector>0 && (page = _NTFS_cache_pageAt(cache,entry->sector-1))!=NULL && page->dirtyEnd!=0 && size+page->count<=cache->stagingSize) {
+		memmove(&cache->writeList[1],&cache->writeList[0],count*sizeof(NTFS_CACHE_ENTRY*));
+		cache->writeList[0] = entry = page;
+		size += page->count;
+		count++;
+	}
+
+	entry = cache->writeList[count-1];
+	while((page = _NTFS_cache_pageAt(cache,entry->sector+entry->count))!=NULL && page->dirtyEnd!=0 && size+page->count<=cache->stagingSize) {
+		cache->writeList[count++] = entry = page;
+		size += page->count;
+	}
+
+	return _NTFS_cache_writePages(cache,cache->writeList,count);
+}
+
+/*
+Return a page to the free queue, discarding its contents
+A pinned page keeps its data until it is unpinned, it is only no longer found by lookups
+*/
+static void _NTFS_cache_release(NTFS_CACHE *cache,NTFS_CACHE_ENTRY *entry)
+{
+	if(entry->queue!=CACHE_QUEUE_FREE) _NTFS_cache_hashRemove(cache,entry);
+	_NTFS_cache_queueRemove(entry->pool,entry);
+	_NTFS_cache_queueInsert(entry->pool,CACHE_QUEUE_FREE,entry);
+	_NTFS_cache_clearDirty(cache,entry);
+	entry->sector = CACHE_FREE;
+	entry->count = 0;
+	entry->last_access = 0;
+}
+
+/*
+Move the contents of any metadata pages overlapping a freshly loaded data page into it,
+so that no sector is ever cached twice
+*/
+static void _NTFS_cache_absorbMetaPages(NTFS_CACHE *cache,NTFS_CACHE_ENTRY *entry)
+{
+	NTFS_CACHE_POOL *meta = &cache->pools[CACHE_POOL_META];
+	NTFS_CACHE_ENTRY *page;
+	sec_t sector;
+	unsigned int sec;
+
+	if(meta->numberOfPages - meta->queues[CACHE_QUEUE_FREE].count == 0) return;
+
+	for(sector=entry->sector;sector<entry->sector+entry->count;sector+=meta->sectorsPerPage) {
+		page = _NTFS_cache_lookup(cache,meta,sector);
+		if(page==NULL) continue;
+
+		memcpy(entry->cache + ((sector-entry->sector)*cache->bytesPerSector),page->cache,page->count*cache->bytesPerSector);
+
+		for(sec=page->dirtyFirst;sec<page->dirtyEnd;sec++) {
+			if(_NTFS_cache_isDirtySector(page,sec)) _NTFS_cache_markDirty(cache,entry,(sector-entry->sector)+sec,1);
+		}
+
+		_NTFS_cache_release(cache,page);
+	}
+}
+
+/*
+Take a page from a pool for the page aligned base sector, writing back its old contents first
+*/
+static NTFS_CACHE_ENTRY* _NTFS_cache_claimPage(NTFS_CACHE *cache,NTFS_CACHE_POOL *pool,sec_t base)
+{
+	NTFS_CACHE_ENTRY* entry = _NTFS_cache_getVictim(pool);
+
+	if(entry==NULL || !_NTFS_cache_writeBack(cache,entry)) return NULL;
+
+	if(entry->queue!=CACHE_QUEUE_FREE) {
+		_NTFS_cache_hashRemove(cache,entry);
+		cache->stats.evictions++;
+	}
+	if(entry->queue==CACHE_QUEUE_A1IN) _NTFS_cache_addGhost(pool,entry->sector);
+	_NTFS_cache_queueRemove(pool,entry);
+
+	// Pages seen again shortly after leaving A1in go straight to the main queue
+	if(cache->policy==NTFS_CACHE_POLICY_LRU || _NTFS_cache_takeGhost(pool,base))
+		_NTFS_cache_queueInsert(pool,CACHE_QUEUE_AM,entry);
+	else
+		_NTFS_cache_queueInsert(pool,CACHE_QUEUE_A1IN,entry);
+
+	entry->sector = base;
+	_NTFS_cache_hashInsert(cache,entry);
+	entry->count = cache->endOfPartition - entry->sector;
+	if(entry->count > pool->sectorsPerPage) entry->count = pool->sectorsPerPage;
+	entry->last_access = accessTime(cache);
+
+	return entry;
+}
+
+static NTFS_CACHE_ENTRY* _NTFS_cache_getPage(NTFS_CACHE *cache,sec_t sector,sec_t numSectors,bool write,unsigned int poolIndex)
+{
+	NTFS_CACHE_ENTRY* entry;
+	NTFS_CACHE_POOL* pool;
+
+	// The sector may already be cached by either pool, but never by both
+	entry = _NTFS_cache_pageAt(cache,sector);
+	if(entry!=NULL) {
+		_NTFS_cache_touch(cache,entry);
+		cache->stats.hits++;
+		return entry;
+	}
+
+	cache->stats.misses++;
+
+	pool = &cache->pools[poolIndex];
+	if(pool->numberOfPages==0) pool = &cache->pools[CACHE_POOL_DATA];
+
+	entry = _NTFS_cache_claimPage(cache,pool,(sector>>pool->pageShift)<<pool->pageShift); // align base sector to page size
+	if(entry==NULL) return NULL;
+
+	unsigned int sectorsPerPage = entry->count;
+	sector -= entry->sector;
 	if(numSectors > sectorsPerPage - sector) numSectors = sectorsPerPage - sector;
 
 	sec_t sec = 0;
@@ -161,8 +825,7 @@ static NTFS_CACHE_ENTRY* _NTFS_cache_getPage(NTFS_CACHE *cache,sec_t sector,sec_
 
 	if(write) {
 		if (sector == sec && numSectors == secs_to_read) {
-			cacheEntries[oldUsed].last_access = accessTime();
-			return &(cacheEntries[oldUsed]);
+			secs_to_read = 0;
 		} else if (sector == sec) {
 			sec += numSectors;
 			secs_to_read -= numSectors;
@@ -171,25 +834,171 @@ static NTFS_CACHE_ENTRY* _NTFS_cache_getPage(NTFS_CACHE *cache,sec_t sector,sec_
 		}
 	}
 
-	if(!cache->disc->readSectors(cache->disc,cacheEntries[oldUsed].sector+sec,secs_to_read,cacheEntries[oldUsed].cache+(sec*cache->bytesPerSector))) {
-		cacheEntries[oldUsed].sector = CACHE_FREE;
-		cacheEntries[oldUsed].count = 0;
-		cacheEntries[oldUsed].last_access = 0;
-		cacheEntries[oldUsed].dirty = 0;
+	if(secs_to_read>0 && !_NTFS_cache_discRead(cache,entry->sector+sec,secs_to_read,entry->cache+(sec*cache->bytesPerSector))) {
+		_NTFS_cache_release(cache,entry);
 		return NULL;
 	}
 
-	cacheEntries[oldUsed].last_access = accessTime();
-	return &(cacheEntries[oldUsed]);
+	if(pool==&cache->pools[CACHE_POOL_DATA]) _NTFS_cache_absorbMetaPages(cache,entry);
+
+	return entry;
 }
 
-static NTFS_CACHE_ENTRY* _NTFS_cache_findPage(NTFS_CACHE *cache,sec_t sector,sec_t count)
+/*
+Claim count consecutive data pages starting at base and fill them with a single disc command
+through the staging buffer. pages receives the pages, except that an entry is left NULL where a
+later claim took over the page again, which then holds the later sectors.
+*/
+static bool _NTFS_cache_loadPages(NTFS_CACHE *cache,sec_t base,unsigned int count,NTFS_CACHE_ENTRY **pages)
+{
+	NTFS_CACHE_POOL *pool = &cache->pools[CACHE_POOL_DATA];
+	sec_t end = base+((sec_t)count<<pool->pageShift);
+	unsigned int i;
+
+	if(end > cache->endOfPartition) end = cache->endOfPartition;
+
+	// Claim all pages before reading, as writing back their old contents uses the staging buffer
+	for(i=0;i<count;i++) {
+		pages[i] = _NTFS_cache_claimPage(cache,pool,base+((sec_t)i<<pool->pageShift));
+		if(pages[i]==NULL) break;
+	}
+
+	if(i<count || !_NTFS_cache_discRead(cache,base,end-base,cache->stagingBuffer)) {
+		while(i-->0) {
+			if(pages[i]->sector==base+((sec_t)i<<pool->pageShift)) _NTFS_cache_release(cache,pages[i]);
+		}
+		return false;
+	}
+
+	for(i=0;i<count;i++) {
+		if(pages[i]->sector!=base+((sec_t)i<<pool->pageShift)) {
+			pages[i] = NULL;
+			continue;
+		}
+
+		memcpy(pages[i]->cache,cache->stagingBuffer+(((sec_t)i<<pool->pageShift)*cache->bytesPerSector),pages[i]->count*cache->bytesPerSector);
+		_NTFS_cache_absorbMetaPages(cache,pages[i]);
+	}
+
+	return true;
+}
+
+/*
+Load the data page holding a sector of a sequential stream together with the pages that
+follow it, as far as the read-ahead window reaches, using a single disc command.
+*page receives the page holding the sector, or NULL if it was not loaded this way.
+*/
+static bool _NTFS_cache_readAhead(NTFS_CACHE *cache,sec_t sector,NTFS_CACHE_ENTRY **page)
+{
+	NTFS_CACHE_POOL *pool = &cache->pools[CACHE_POOL_DATA];
+	NTFS_CACHE_ENTRY *pages[cache->readAheadWindow];
+	sec_t base = (sector>>pool->pageShift)<<pool->pageShift;
+	sec_t end = base;
+	unsigned int count, i;
+
+	*page = NULL;
+
+	// Stop at the first page that is already resident
+	for(count=0;count<cache->readAheadWindow && end<cache->endOfPartition;count++) {
+		if(_NTFS_cache_lookup(cache,pool,end)!=NULL) break;
+		end += pool->sectorsPerPage;
+	}
+
+	if(count<2 || !_NTFS_cache_staging(cache)) return true;
+
+	if(!_NTFS_cache_loadPages(cache,base,count,pages)) return false;
+
+	for(i=0;i<count;i++) {
+		if(pages[i]==NULL) continue;
+
+		if(i==0) {
+			cache->stats.misses++;
+			*page = pages[i];
+		} else {
+			cache->stats.readAheadPages++;
+		}
+	}
+
+	return true;
+}
+
+/*
+Load the data pages covering a run of sectors that are not resident yet, each stretch of missing
+pages with as few disc commands as the staging buffer allows. A call covers no more than half of
+the data pages, resident ones included, so that the pages loaded stay resident while they are
+being read. A run shorter than two pages is left to be read when it is used, as loading the pages
+around it would read more than saving the seeks is worth.
+*/
+static bool _NTFS_cache_doPrefetch(NTFS_CACHE *cache,sec_t sector,sec_t *numSectors)
+{
+	NTFS_CACHE_POOL *pool = &cache->pools[CACHE_POOL_DATA];
+	unsigned int batch = cache->stagingSize>>pool->pageShift;
+	unsigned int budget = pool->numberOfPages/2;
+	NTFS_CACHE_ENTRY *pages[batch > 0 ? batch : 1];
+	sec_t base = (sector>>pool->pageShift)<<pool->pageShift;
+	sec_t end = sector+*numSectors;
+	sec_t next;
+	unsigned int count, i;
+
+	if(end > cache->endOfPartition) end = cache->endOfPartition;
+
+	if(end <= sector || end-sector < 2*pool->sectorsPerPage) return true;
+
+	*numSectors = 0;
+	if(batch==0 || budget==0 || !_NTFS_cache_staging(cache)) return true;
+
+	while(base<end && budget>0) {
+		if(_NTFS_cache_lookup(cache,pool,base)!=NULL) {
+			base += pool->sectorsPerPage;
+			budget--;
+			continue;
+		}
+
+		// Gather the pages missing from here on
+		next = base;
+		for(count=0;count<batch && count<budget && next<end;count++) {
+			if(_NTFS_cache_lookup(cache,pool,next)!=NULL) break;
+			next += pool->sectorsPerPage;
+		}
+
+		if(!_NTFS_cache_loadPages(cache,base,count,pages)) return false;
+		for(i=0;i<count;i++) {
+			if(pages[i]!=NULL) cache->stats.readAheadPages++;
+		}
+
+		budget -= count;
+		base = next;
+	}
+
+	if(base > end) base = end;
+	if(base > sector) *numSectors = base-sector;
+
+	return true;
+}
+
+/*
+Find the lowest page of a pool intersecting a sector range
+*/
+static NTFS_CACHE_ENTRY* _NTFS_cache_findPoolPage(NTFS_CACHE *cache,NTFS_CACHE_POOL *pool,sec_t sector,sec_t count)
 {
 	unsigned int i;
-	NTFS_CACHE_ENTRY* cacheEntries = cache->cacheEntries;
-	unsigned int numberOfPages = cache->numberOfPages;
+	NTFS_CACHE_ENTRY* cacheEntries = pool->cacheEntries;
+	unsigned int numberOfPages = pool->numberOfPages;
 	NTFS_CACHE_ENTRY* entry = NULL;
 	sec_t lowest = CACHE_FREE;
+	sec_t first = sector>>pool->pageShift;
+	sec_t last = (sector+count-1)>>pool->pageShift;
+
+	if(numberOfPages==0 || pool->queues[CACHE_QUEUE_FREE].count==numberOfPages) return NULL;
+
+	// Probe the page index in ascending order while that is cheaper than a full scan
+	if(last-first < numberOfPages) {
+		for(;first<=last;first++) {
+			entry = _NTFS_cache_lookup(cache,pool,first<<pool->pageShift);
+			if(entry!=NULL && (entry->sector >= sector || sector - entry->sector < entry->count)) return entry;
+		}
+		return NULL;
+	}
 
 	for(i=0;i<numberOfPages;i++) {
 		if (cacheEntries[i].sector != CACHE_FREE) {
@@ -210,18 +1019,96 @@ static NTFS_CACHE_ENTRY* _NTFS_cache_findPage(NTFS_CACHE *cache,sec_t sector,sec
 	return entry;
 }
 
-bool _NTFS_cache_readSectors(NTFS_CACHE *cache,sec_t sector,sec_t numSectors,void *buffer)
+static NTFS_CACHE_ENTRY* _NTFS_cache_findPage(NTFS_CACHE *cache,sec_t sector,sec_t count)
+{
+	NTFS_CACHE_ENTRY* entry = _NTFS_cache_findPoolPage(cache,&cache->pools[CACHE_POOL_DATA],sector,count);
+	NTFS_CACHE_ENTRY* meta = _NTFS_cache_findPoolPage(cache,&cache->pools[CACHE_POOL_META],sector,count);
+
+	if(entry==NULL || (meta!=NULL && meta->sector < entry->sector)) return meta;
+
+	return entry;
+}
+
+/*
+Read sectors straight from disc. A destination that can not be used for DMA has all but its
+last sector read to the first aligned address inside it and moved down into place, so that the
+bulk of it is still one command; what is left comes through the staging buffer
+*/
+static bool _NTFS_cache_discReadAny(NTFS_CACHE *cache,sec_t sector,sec_t numSectors,uint8_t *dest)
+{
+	sec_t secs;
+	uint8_t *aligned;
+
+	if(SYS_IsDMAAddress(dest,32)) return _NTFS_cache_discRead(cache,sector,numSectors,dest);
+
+	aligned = (uint8_t *)(((uintptr_t)dest + 31) & ~(uintptr_t)31);
+	if(numSectors>1 && SYS_IsDMAAddress(aligned,32)) {
+		secs = numSectors - 1;
+		if(!_NTFS_cache_discRead(cache,sector,secs,aligned)) return false;
+		memmove(dest,aligned,secs*cache->bytesPerSector);
+
+		dest += (secs*cache->bytesPerSector);
+		sector += secs;
+		numSectors -= secs;
+	}
+
+	while(numSectors>0) {
+		secs = numSectors < cache->stagingSize ? numSectors : cache->stagingSize;
+		if(!_NTFS_cache_discRead(cache,sector,secs,cache->stagingBuffer)) return false;
+		memcpy(dest,cache->stagingBuffer,secs*cache->bytesPerSector);
+
+		dest += (secs*cache->bytesPerSector);
+		sector += secs;
+		numSectors -= secs;
+	}
+
+	return true;
+}
+
+/*
+Write sectors straight to disc, through the staging buffer if the source can not be used for DMA
+*/
+static bool _NTFS_cache_discWriteAny(NTFS_CACHE *cache,sec_t sector,sec_t numSectors,const uint8_t *src)
+{
+	sec_t secs;
+
+	if(SYS_IsDMAAddress(src,32)) return _NTFS_cache_discWrite(cache,sector,numSectors,src);
+
+	while(numSectors>0) {
+		secs = numSectors < cache->stagingSize ? numSectors : cache->stagingSize;
+		memcpy(cache->stagingBuffer,src,secs*cache->bytesPerSector);
+		if(!_NTFS_cache_discWrite(cache,sector,secs,cache->stagingBuffer)) return false;
+
+		src += (secs*cache->bytesPerSector);
+		sector += secs;
+		numSectors -= secs;
+	}
+
+	return true;
+}
+
+static bool _NTFS_cache_doReadSectors(NTFS_CACHE *cache,sec_t sector,sec_t numSectors,void *buffer,bool metadata)
 {
 	sec_t sec;
 	sec_t secs_to_read;
 	NTFS_CACHE_ENTRY *entry;
 	uint8_t *dest = (uint8_t *)buffer;
+	unsigned int pageShift = cache->pools[CACHE_POOL_DATA].pageShift;
+	unsigned int poolIndex = metadata ? CACHE_POOL_META : CACHE_POOL_DATA;
+	bool bypass = !metadata || cache->pools[CACHE_POOL_META].numberOfPages==0;
+	bool sequential = (sector == cache->readAheadNext);
+
+	// Reads continuing where the last one ended grow the read-ahead window, anything else resets it
+	if(cache->readAheadMax > 1 && !metadata) {
+		if(!sequential) cache->readAheadWindow = 0;
+		cache->readAheadNext = sector + numSectors;
+	}
 
 	while(numSectors>0) {
-		if(SYS_IsDMAAddress(dest,32) && (sector%cache->sectorsPerPage)==0) {
+		if(bypass && (SYS_IsDMAAddress(dest,32) || _NTFS_cache_staging(cache)) && (sector&((1U<<pageShift)-1))==0) {
 			entry = _NTFS_cache_findPage(cache,sector,numSectors);
 			if(entry==NULL) {
-				secs_to_read = (numSectors/cache->sectorsPerPage)*cache->sectorsPerPage;
+				secs_to_read = (numSectors>>pageShift)<<pageShift;
 			} else if (entry->sector > sector) {
 				secs_to_read = entry->sector - sector;
 			} else {
@@ -229,7 +1116,8 @@ bool _NTFS_cache_readSectors(NTFS_CACHE *cache,sec_t sector,sec_t numSectors,voi
 			}
 
 			if(secs_to_read>0) {
-				if(!cache->disc->readSectors(cache->disc,sector,secs_to_read,dest)) return false;
+				if(!_NTFS_cache_discReadAny(cache,sector,secs_to_read,dest)) return false;
+				cache->stats.bypassReads++;
 
 				dest += (secs_to_read*cache->bytesPerSector);
 				sector += secs_to_read;
@@ -238,7 +1126,16 @@ bool _NTFS_cache_readSectors(NTFS_CACHE *cache,sec_t sector,sec_t numSectors,voi
 			}
 		}
 
-		entry = _NTFS_cache_getPage(cache,sector,numSectors,false);
+		entry = NULL;
+		if(sequential && !metadata && _NTFS_cache_findPage(cache,sector,1)==NULL) {
+			if(cache->readAheadWindow < cache->readAheadMax) {
+				cache->readAheadWindow = cache->readAheadWindow ? cache->readAheadWindow * 2 : 2;
+				if(cache->readAheadWindow > cache->readAheadMax) cache->readAheadWindow = cache->readAheadMax;
+			}
+			if(!_NTFS_cache_readAhead(cache,sector,&entry)) return false;
+		}
+
+		if(entry==NULL) entry = _NTFS_cache_getPage(cache,sector,numSectors,false,poolIndex);
 		if(entry==NULL) return false;
 
 		sec = sector - entry->sector;
@@ -255,17 +1152,61 @@ bool _NTFS_cache_readSectors(NTFS_CACHE *cache,sec_t sector,sec_t numSectors,voi
 	return true;
 }
 
+/*
+Read sectors without bringing any of them into the cache, taking those that are
+already cached from their pages as they may be dirty
+*/
+static bool _NTFS_cache_doReadSectorsUncached(NTFS_CACHE *cache,sec_t sector,sec_t numSectors,void *buffer)
+{
+	sec_t sec;
+	sec_t secs_to_read;
+	NTFS_CACHE_ENTRY *entry;
+	uint8_t *dest = (uint8_t *)buffer;
+
+	// Without a staging buffer, misaligned transfers have to go through the pages
+	if(!SYS_IsDMAAddress(buffer,32) && !_NTFS_cache_staging(cache)) return _NTFS_cache_doReadSectors(cache,sector,numSectors,buffer,false);
+
+	while(numSectors>0) {
+		entry = _NTFS_cache_findPage(cache,sector,numSectors);
+		if(entry==NULL) {
+			secs_to_read = numSectors;
+		} else if (entry->sector > sector) {
+			secs_to_read = entry->sector - sector;
+		} else {
+			secs_to_read = 0;
+		}
+
+		if(secs_to_read>0) {
+			if(!_NTFS_cache_discReadAny(cache,sector,secs_to_read,dest)) return false;
+			cache->stats.bypassReads++;
+		} else {
+			sec = sector - entry->sector;
+			secs_to_read = entry->count - sec;
+			if(secs_to_read>numSectors) secs_to_read = numSectors;
+
+			memcpy(dest,entry->cache + (sec*cache->bytesPerSector),(secs_to_read*cache->bytesPerSector));
+			cache->stats.hits++;
+		}
+
+		dest += (secs_to_read*cache->bytesPerSector);
+		sector += secs_to_read;
+		numSectors -= secs_to_read;
+	}
+
+	return true;
+}
+
 /*
 Reads some data from a cache page, determined by the sector number
 */
-bool _NTFS_cache_readPartialSector (NTFS_CACHE* cache, void* buffer, sec_t sector, unsigned int offset, size_t size)
+static bool _NTFS_cache_doReadPartialSector (NTFS_CACHE* cache, void* buffer, sec_t sector, unsigned int offset, size_t size, bool metadata)
 {
 	sec_t sec;
 	NTFS_CACHE_ENTRY *entry;
 
 	if (offset + size > cache->bytesPerSector) return false;
 
-	entry = _NTFS_cache_getPage(cache,sector,1,false);
+	entry = _NTFS_cache_getPage(cache,sector,1,false,metadata ? CACHE_POOL_META : CACHE_POOL_DATA);
 	if(entry==NULL) return false;
 
 	sec = sector - entry->sector;
@@ -274,9 +1215,42 @@ bool _NTFS_cache_readPartialSector (NTFS_CACHE* cache, void* buffer, sec_t secto
 	return true;
 }
 
+/*
+Reads a range of bytes from the cache pages, which may start and end part way through a sector
+*/
+static bool _NTFS_cache_doReadBytes (NTFS_CACHE* cache, sec_t sector, unsigned int offset, size_t size, void* buffer, bool metadata)
+{
+	sec_t sec;
+	size_t len;
+	NTFS_CACHE_ENTRY *entry;
+	uint8_t *dest = (uint8_t *)buffer;
+	unsigned int poolIndex = metadata ? CACHE_POOL_META : CACHE_POOL_DATA;
+
+	sector += offset / cache->bytesPerSector;
+	offset %= cache->bytesPerSector;
+
+	while(size>0) {
+		entry = _NTFS_cache_getPage(cache,sector,(offset+size+cache->bytesPerSector-1)/cache->bytesPerSector,false,poolIndex);
+		if(entry==NULL) return false;
+
+		sec = sector - entry->sector;
+		len = ((entry->count - sec)*cache->bytesPerSector) - offset;
+		if(len>size) len = size;
+
+		memcpy(dest,entry->cache + ((sec*cache->bytesPerSector) + offset),len);
+
+		dest += len;
+		size -= len;
+		sector = entry->sector + entry->count;
+		offset = 0;
+	}
+
+	return true;
+}
+
 bool _NTFS_cache_readLittleEndianValue (NTFS_CACHE* cache, uint32_t *value, sec_t sector, unsigned int offset, int num_bytes) {
   uint8_t buf[4];
-  if (!_NTFS_cache_readPartialSector(cache, buf, sector, offset, num_bytes)) return false;
+  if (!_NTFS_cache_readPartialSector(cache, buf, sector, offset, num_bytes, true)) return false;
 
   switch(num_bytes) {
   case 1: *value = buf[0]; break;
@@ -290,20 +1264,20 @@ bool _NTFS_cache_readLittleEndianValue (NTFS_CACHE* cache, uint32_t *value, sec_
 /*
 Writes some data to a cache page, making sure it is loaded into memory first.
 */
-bool _NTFS_cache_writePartialSector (NTFS_CACHE* cache, const void* buffer, sec_t sector, unsigned int offset, size_t size)
+static bool _NTFS_cache_doWritePartialSector (NTFS_CACHE* cache, const void* buffer, sec_t sector, unsigned int offset, size_t size, bool metadata)
 {
 	sec_t sec;
 	NTFS_CACHE_ENTRY *entry;
 
 	if (offset + size > cache->bytesPerSector) return false;
 
-	entry = _NTFS_cache_getPage(cache,sector,1,false);
+	entry = _NTFS_cache_getPage(cache,sector,1,false,metadata ? CACHE_POOL_META : CACHE_POOL_DATA);
 	if(entry==NULL) return false;
 
 	sec = sector - entry->sector;
 	memcpy(entry->cache + ((sec*cache->bytesPerSector) + offset),buffer,size);
 
-	entry->dirty |= 1ULL << sec;
+	_NTFS_cache_markDirty(cache,entry,sec,1);
 	return true;
 }
 
@@ -317,43 +1291,46 @@ bool _NTFS_cache_writeLittleEndianValue (NTFS_CACHE* cache, const uint32_t value
   default: return false;
   }
 
-  return _NTFS_cache_writePartialSector(cache, buf, sector, offset, size);
+  return _NTFS_cache_writePartialSector(cache, buf, sector, offset, size, true);
 }
 
 /*
 Writes some data to a cache page, zeroing out the page first
 */
-bool _NTFS_cache_eraseWritePartialSector (NTFS_CACHE* cache, const void* buffer, sec_t sector, unsigned int offset, size_t size)
+static bool _NTFS_cache_doEraseWritePartialSector (NTFS_CACHE* cache, const void* buffer, sec_t sector, unsigned int offset, size_t size)
 {
 	sec_t sec;
 	NTFS_CACHE_ENTRY *entry;
 
 	if (offset + size > cache->bytesPerSector) return false;
 
-	entry = _NTFS_cache_getPage(cache,sector,1,true);
+	entry = _NTFS_cache_getPage(cache,sector,1,true,CACHE_POOL_META);
 	if(entry==NULL) return false;
 
 	sec = sector - entry->sector;
 	memset(entry->cache + (sec*cache->bytesPerSector),0,cache->bytesPerSector);
 	memcpy(entry->cache + ((sec*cache->bytesPerSector) + offset),buffer,size);
 
-	entry->dirty |= 1ULL << sec;
+	_NTFS_cache_markDirty(cache,entry,sec,1);
 	return true;
 }
 
 
-bool _NTFS_cache_writeSectors (NTFS_CACHE* cache, sec_t sector, sec_t numSectors, const void* buffer)
+static bool _NTFS_cache_doWriteSectors (NTFS_CACHE* cache, sec_t sector, sec_t numSectors, const void* buffer, bool metadata)
 {
 	sec_t sec;
 	sec_t secs_to_write;
 	NTFS_CACHE_ENTRY *entry;
 	const uint8_t *src = (const uint8_t *)buffer;
+	unsigned int pageShift = cache->pools[CACHE_POOL_DATA].pageShift;
+	unsigned int poolIndex = metadata ? CACHE_POOL_META : CACHE_POOL_DATA;
+	bool bypass = !metadata || cache->pools[CACHE_POOL_META].numberOfPages==0;
 
 	while(numSectors>0) {
-		if(SYS_IsDMAAddress(src,32) && (sector%cache->sectorsPerPage)==0) {
+		if(bypass && (SYS_IsDMAAddress(src,32) || _NTFS_cache_staging(cache)) && (sector&((1U<<pageShift)-1))==0) {
 			entry = _NTFS_cache_findPage(cache,sector,numSectors);
 			if(entry==NULL) {
-				secs_to_write = (numSectors/cache->sectorsPerPage)*cache->sectorsPerPage;
+				secs_to_write = (numSectors>>pageShift)<<pageShift;
 			} else if (entry->sector > sector) {
 				secs_to_write = entry->sector - sector;
 			} else {
@@ -361,7 +1338,8 @@ bool _NTFS_cache_writeSectors (NTFS_CACHE* cache, sec_t sector, sec_t numSectors
 			}
 
 			if(secs_to_write>0) {
-				if(!cache->disc->writeSectors(cache->disc,sector,secs_to_write,src)) return false;
+				if(!_NTFS_cache_discWriteAny(cache,sector,secs_to_write,src)) return false;
+				cache->stats.bypassWrites++;
 
 				src += (secs_to_write*cache->bytesPerSector);
 				sector += secs_to_write;
@@ -370,7 +1348,7 @@ bool _NTFS_cache_writeSectors (NTFS_CACHE* cache, sec_t sector, sec_t numSectors
 			}
 		}
 
-		entry = _NTFS_cache_getPage(cache,sector,numSectors,true);
+		entry = _NTFS_cache_getPage(cache,sector,numSectors,true,poolIndex);
 		if(entry==NULL) return false;
 
 		sec = sector - entry->sector;
@@ -383,44 +1361,457 @@ bool _NTFS_cache_writeSectors (NTFS_CACHE* cache, sec_t sector, sec_t numSectors
 		sector += secs_to_write;
 		numSectors -= secs_to_write;
 
-		entry->dirty |= ((1ULL << secs_to_write)-1) << sec;
+		_NTFS_cache_markDirty(cache,entry,sec,secs_to_write);
 	}
 
 	return true;
 }
 
 /*
-Flushes all dirty pages to disc, clearing the dirty flag.
+Write sectors without bringing any of them into the cache, updating those that are
+already cached in their pages so that the cache never holds stale data
 */
-bool _NTFS_cache_flush (NTFS_CACHE* cache) {
+static bool _NTFS_cache_doWriteSectorsUncached (NTFS_CACHE* cache, sec_t sector, sec_t numSectors, const void* buffer)
+{
 	sec_t sec;
 	sec_t secs_to_write;
 	NTFS_CACHE_ENTRY *entry;
-	unsigned int i;
+	const uint8_t *src = (const uint8_t *)buffer;
+
+	// Without a staging buffer, misaligned transfers have to go through the pages
+	if(!SYS_IsDMAAddress(buffer,32) && !_NTFS_cache_staging(cache)) return _NTFS_cache_doWriteSectors(cache,sector,numSectors,buffer,false);
+
+	while(numSectors>0) {
+		entry = _NTFS_cache_findPage(cache,sector,numSectors);
+		if(entry==NULL) {
+			secs_to_write = numSectors;
+		} else if (entry->sector > sector) {
+			secs_to_write = entry->sector - sector;
+		} else {
+			secs_to_write = 0;
+		}
+
+		if(secs_to_write>0) {
+			if(!_NTFS_cache_discWriteAny(cache,sector,secs_to_write,src)) return false;
+			cache->stats.bypassWrites++;
+		} else {
+			sec = sector - entry->sector;
+			secs_to_write = entry->count - sec;
+			if(secs_to_write>numSectors) secs_to_write = numSectors;
+
+			memcpy(entry->cache + (sec*cache->bytesPerSector),src,(secs_to_write*cache->bytesPerSector));
+			_NTFS_cache_markDirty(cache,entry,sec,secs_to_write);
+		}
+
+		src += (secs_to_write*cache->bytesPerSector);
+		sector += secs_to_write;
+		numSectors -= secs_to_write;
+	}
+
+	return true;
+}
+
+/*
+Flushes all dirty pages to disc, clearing the dirty flag.
+*/
+static int _NTFS_cache_compareSector(const void *a, const void *b) {
+	const NTFS_CACHE_ENTRY *x = *(NTFS_CACHE_ENTRY* const*)a;
+	const NTFS_CACHE_ENTRY *y = *(NTFS_CACHE_ENTRY* const*)b;
 
-	for (i = 0; i < cache->numberOfPages; i++) {
-		entry = &cache->cacheEntries[i];
+	return (x->sector > y->sector) - (x->sector < y->sector);
+}
 
-		if (entry->dirty) {
-			sec = ffsll(entry->dirty) - 1;
-			secs_to_write = flsll(entry->dirty) - sec;
+static bool _NTFS_cache_doFlush (NTFS_CACHE* cache) {
+	NTFS_CACHE_POOL *pool;
+	unsigned int i, j, count = 0;
 
-			if (!cache->disc->writeSectors(cache->disc, entry->sector + sec, secs_to_write, entry->cache + (sec * cache->bytesPerSector))) return false;
+	for (j = 0; j < CACHE_POOL_COUNT; j++) {
+		pool = &cache->pools[j];
 
-			entry->dirty = 0;
+		for (i = 0; i < pool->numberOfPages; i++) {
+			if (pool->cacheEntries[i].dirtyEnd != 0) cache->writeList[count++] = &pool->cacheEntries[i];
 		}
 	}
 
+	// Write the pages in disc order so that neighbouring pages go out as one command
+	qsort(cache->writeList, count, sizeof(NTFS_CACHE_ENTRY*), _NTFS_cache_compareSector);
+
+	if (!_NTFS_cache_writePages(cache, cache->writeList, count)) return false;
+
 	return cache->disc->flush(cache->disc);
 }
 
+bool _NTFS_cache_readSectors (NTFS_CACHE* cache, sec_t sector, sec_t numSectors, void* buffer, bool metadata) {
+	bool ret;
+
+	LWP_MutexLock(cache->lock);
+	ret = _NTFS_cache_doReadSectors(cache, sector, numSectors, buffer, metadata);
+	LWP_MutexUnlock(cache->lock);
+
+	return ret;
+}
+
+bool _NTFS_cache_readSectorsUncached (NTFS_CACHE* cache, sec_t sector, sec_t numSectors, void* buffer) {
+	bool ret;
+
+	LWP_MutexLock(cache->lock);
+	ret = _NTFS_cache_doReadSectorsUncached(cache, sector, numSectors, buffer);
+	LWP_MutexUnlock(cache->lock);
+
+	return ret;
+}
+
+bool _NTFS_cache_readPartialSector (NTFS_CACHE* cache, void* buffer, sec_t sector, unsigned int offset, size_t size, bool metadata) {
+	bool ret;
+
+	LWP_MutexLock(cache->lock);
+	ret = _NTFS_cache_doReadPartialSector(cache, buffer, sector, offset, size, metadata);
+	LWP_MutexUnlock(cache->lock);
+
+	return ret;
+}
+
+bool _NTFS_cache_readBytes (NTFS_CACHE* cache, sec_t sector, unsigned int offset, size_t size, void* buffer, bool metadata) {
+	bool ret;
+
+	LWP_MutexLock(cache->lock);
+	ret = _NTFS_cache_doReadBytes(cache, sector, offset, size, buffer, metadata);
+	LWP_MutexUnlock(cache->lock);
+
+	return ret;
+}
+
+const void* _NTFS_cache_pin (NTFS_CACHE* cache, sec_t sector, unsigned int offset, size_t size, NTFS_CACHE_ENTRY** page) {
+	NTFS_CACHE_ENTRY *entry;
+	sec_t numSectors;
+
+	sector += offset / cache->bytesPerSector;
+	offset %= cache->bytesPerSector;
+	numSectors = (offset + size + cache->bytesPerSector - 1) / cache->bytesPerSector;
+
+	if (size == 0 || cache->pools[CACHE_POOL_DATA].numberOfPages == 0 || !_NTFS_cache_inPage(cache, sector, numSectors)) {
+		return NULL;
+	}
+
+	LWP_MutexLock(cache->lock);
+
+	// A sector already held by a metadata page stays there, and those pages are too small to hand out
+	entry = _NTFS_cache_getPage(cache, sector, numSectors, false, CACHE_POOL_DATA);
+	if (entry == NULL || entry->pool != &cache->pools[CACHE_POOL_DATA] || sector + numSectors > entry->sector + entry->count) {
+		LWP_MutexUnlock(cache->lock);
+		return NULL;
+	}
+
+	// Leave enough pages unpinned for the cache to keep working
+	if (entry->pinned == 0) {
+		if (cache->pinnedPages >= cache->pools[CACHE_POOL_DATA].numberOfPages / 2) {
+			LWP_MutexUnlock(cache->lock);
+			return NULL;
+		}
+		cache->pinnedPages++;
+	}
+	entry->pinned++;
+
+	LWP_MutexUnlock(cache->lock);
+
+	*page = entry;
+	return entry->cache + ((sector - entry->sector) * cache->bytesPerSector) + offset;
+}
+
+void _NTFS_cache_unpin (NTFS_CACHE* cache, NTFS_CACHE_ENTRY* page) {
+	LWP_MutexLock(cache->lock);
+
+	if (page->pinned && --page->pinned == 0) {
+		cache->pinnedPages--;
+	}
+
+	LWP_MutexUnlock(cache->lock);
+}
+
+bool _NTFS_cache_writePartialSector (NTFS_CACHE* cache, const void* buffer, sec_t sector, unsigned int offset, size_t size, bool metadata) {
+	bool ret;
+
+	LWP_MutexLock(cache->lock);
+	ret = _NTFS_cache_doWritePartialSector(cache, buffer, sector, offset, size, metadata);
+	LWP_MutexUnlock(cache->lock);
+
+	return ret;
+}
+
+bool _NTFS_cache_eraseWritePartialSector (NTFS_CACHE* cache, const void* buffer, sec_t sector, unsigned int offset, size_t size) {
+	bool ret;
+
+	LWP_MutexLock(cache->lock);
+	ret = _NTFS_cache_doEraseWritePartialSector(cache, buffer, sector, offset, size);
+	LWP_MutexUnlock(cache->lock);
+
+	return ret;
+}
+
+bool _NTFS_cache_writeSectors (NTFS_CACHE* cache, sec_t sector, sec_t numSectors, const void* buffer, bool metadata) {
+	bool ret;
+
+	LWP_MutexLock(cache->lock);
+	ret = _NTFS_cache_doWriteSectors(cache, sector, numSectors, buffer, metadata);
+	LWP_MutexUnlock(cache->lock);
+
+	return ret;
+}
+
+bool _NTFS_cache_writeSectorsUncached (NTFS_CACHE* cache, sec_t sector, sec_t numSectors, const void* buffer) {
+	bool ret;
+
+	LWP_MutexLock(cache->lock);
+	ret = _NTFS_cache_doWriteSectorsUncached(cache, sector, numSectors, buffer);
+	LWP_MutexUnlock(cache->lock);
+
+	return ret;
+}
+
+bool _NTFS_cache_flush (NTFS_CACHE* cache) {
+	bool ret;
+
+	LWP_MutexLock(cache->lock);
+	ret = _NTFS_cache_doFlush(cache);
+	LWP_MutexUnlock(cache->lock);
+
+	return ret;
+}
+
 void _NTFS_cache_invalidate (NTFS_CACHE* cache) {
+	NTFS_CACHE_POOL *pool;
+	unsigned int i, j;
+
+	LWP_MutexLock(cache->lock);
+
+	_NTFS_cache_doFlush(cache);
+	memset(cache->hashTable, 0, sizeof(NTFS_CACHE_ENTRY*) << cache->hashBits);
+
+	for (j = 0; j < CACHE_POOL_COUNT; j++) {
+		pool = &cache->pools[j];
+		memset(pool->queues, 0, sizeof(pool->queues));
+		pool->ghostCount = 0;
+		pool->ghostHead = 0;
+
+		for (i = 0; i < pool->numberOfPages; i++) {
+			_NTFS_cache_clearDirty(cache,&pool->cacheEntries[i]);
+			pool->cacheEntries[i].sector = CACHE_FREE;
+			pool->cacheEntries[i].count = 0;
+			pool->cacheEntries[i].last_access = 0;
+			pool->cacheEntries[i].next = NULL;
+			_NTFS_cache_queueInsert(pool,CACHE_QUEUE_FREE,&pool->cacheEntries[i]);
+		}
+	}
+
+	LWP_MutexUnlock(cache->lock);
+}
+
+void _NTFS_cache_discard (NTFS_CACHE* cache, sec_t sector, sec_t numSectors) {
+	NTFS_CACHE_POOL *pool;
+	NTFS_CACHE_ENTRY *entry;
+	unsigned int i, j;
+
+	LWP_MutexLock(cache->lock);
+
+	for (j = 0; j < CACHE_POOL_COUNT; j++) {
+		pool = &cache->pools[j];
+
+		for (i = 0; i < pool->numberOfPages; i++) {
+			entry = &pool->cacheEntries[i];
+			if (entry->sector != CACHE_FREE && entry->sector >= sector && entry->sector + entry->count <= sector + numSectors) {
+				_NTFS_cache_release(cache, entry);
+			}
+		}
+	}
+
+	LWP_MutexUnlock(cache->lock);
+}
+
+bool _NTFS_cache_prefetch (NTFS_CACHE* cache, sec_t sector, sec_t* numSectors) {
+	bool ret;
+
+	LWP_MutexLock(cache->lock);
+	ret = _NTFS_cache_doPrefetch(cache, sector, numSectors);
+	LWP_MutexUnlock(cache->lock);
+
+	return ret;
+}
+
+void _NTFS_cache_extend (NTFS_CACHE* cache, sec_t endOfPartition) {
+	LWP_MutexLock(cache->lock);
+
+	if (endOfPartition > cache->endOfPartition) {
+		cache->endOfPartition = endOfPartition;
+	}
+
+	LWP_MutexUnlock(cache->lock);
+}
+
+void _NTFS_cache_getStats (NTFS_CACHE* cache, NTFS_CACHE_STATS* stats, bool reset) {
+	LWP_MutexLock(cache->lock);
+
+	*stats = cache->stats;
+	if (reset) {
+		memset(&cache->stats, 0, sizeof(NTFS_CACHE_STATS));
+	}
+
+	LWP_MutexUnlock(cache->lock);
+}
+
+/*
+Bytes one pool of a cache geometry holds, pages rounded as the pool constructor rounds them
+*/
+static size_t _NTFS_cache_poolSize (unsigned int numberOfPages, unsigned int sectorsPerPage, unsigned int bytesPerSector) {
+	unsigned int pageShift = 0;
+
+	while ((2U << pageShift) <= sectorsPerPage) {
+		pageShift++;
+	}
+
+	return numberOfPages * (sizeof(NTFS_CACHE_ENTRY*) + sizeof(NTFS_CACHE_ENTRY) + ((1U << pageShift) + 31) / 32 * sizeof(uint32_t) + (1U << pageShift) * bytesPerSector + 2 * sizeof(sec_t));
+}
+
+size_t _NTFS_cache_layoutSize (unsigned int numberOfPages, unsigned int sectorsPerPage, unsigned int numberOfMetaPages, unsigned int sectorsPerMetaPage, unsigned int bytesPerSector, unsigned int readAheadPages) {
+	unsigned int totalPages, hashBits, stagingSize, pageShift = 0;
+
+	// Apply the limits _NTFS_cache_buildLayout applies
+	if (numberOfPages < 4) {
+		numberOfPages = 4;
+	}
+	if (sectorsPerPage < CACHE_MIN_PAGE_SIZE) {
+		sectorsPerPage = CACHE_MIN_PAGE_SIZE;
+	} else if (sectorsPerPage > CACHE_MAX_PAGE_SIZE) {
+		sectorsPerPage = CACHE_MAX_PAGE_SIZE;
+	}
+	if (sectorsPerMetaPage == 0) {
+		numberOfMetaPages = 0;
+	} else if (sectorsPerMetaPage > sectorsPerPage) {
+		sectorsPerMetaPage = sectorsPerPage;
+	}
+	if (numberOfMetaPages > 0 && numberOfMetaPages < 4) {
+		numberOfMetaPages = 4;
+	}
+
+	totalPages = numberOfPages + numberOfMetaPages;
+	hashBits = 4;
+	while ((1U << hashBits) < totalPages * 2 && hashBits < 24) {
+		hashBits++;
+	}
+
+	if (readAheadPages > numberOfPages / 2) {
+		readAheadPages = numberOfPages / 2;
+	}
+	while ((2U << pageShift) <= sectorsPerPage) {
+		pageShift++;
+	}
+	stagingSize = readAheadPages << pageShift;
+	if (stagingSize < CACHE_WRITEBACK_MIN_STAGING) {
+		stagingSize = CACHE_WRITEBACK_MIN_STAGING;
+	}
+
+	return sizeof(NTFS_CACHE) + (sizeof(NTFS_CACHE_ENTRY*) << hashBits) + stagingSize * bytesPerSector +
+		_NTFS_cache_poolSize(numberOfPages, sectorsPerPage, bytesPerSector) +
+		(numberOfMetaPages ? _NTFS_cache_poolSize(numberOfMetaPages, sectorsPerMetaPage, bytesPerSector) : 0);
+}
+
+size_t _NTFS_cache_memoryUsage (NTFS_CACHE* cache) {
+	const NTFS_CACHE_POOL *pool;
+	size_t size;
 	unsigned int i;
-	_NTFS_cache_flush(cache);
-	for (i = 0; i < cache->numberOfPages; i++) {
-		cache->cacheEntries[i].sector = CACHE_FREE;
-		cache->cacheEntries[i].count = 0;
-		cache->cacheEntries[i].last_access = 0;
-		cache->cacheEntries[i].dirty = 0;
+
+	LWP_MutexLock(cache->lock);
+
+	// The staging buffer counts before it is allocated, as that may happen at any time
+	size = sizeof(NTFS_CACHE) + (sizeof(NTFS_CACHE_ENTRY*) << cache->hashBits) + cache->stagingSize * cache->bytesPerSector;
+	for (i = 0; i < CACHE_POOL_COUNT; i++) {
+		pool = &cache->pools[i];
+		size += pool->numberOfPages * (sizeof(NTFS_CACHE_ENTRY*) + sizeof(NTFS_CACHE_ENTRY) + pool->dirtyWords * sizeof(uint32_t) + pool->sectorsPerPage * cache->bytesPerSector);
+		size += pool->ghostSize * sizeof(sec_t);
 	}
+
+	LWP_MutexUnlock(cache->lock);
+
+	return size;
+}
+
+/*
+Write back pages that have been dirty for too long, or all of them if too many are dirty.
+Pages go out in batches so that other threads get the cache between them.
+*/
+static void* _NTFS_cache_flusherThread (void* arg) {
+	NTFS_CACHE* cache = (NTFS_CACHE*)arg;
+	NTFS_CACHE_POOL *pool;
+	NTFS_CACHE_ENTRY *entry;
+	struct timespec interval;
+	uint64_t now;
+	unsigned int i, j, count;
+	bool all;
+
+	// libogc takes the timeout relative to now
+	interval.tv_sec = ticks_to_secs(cache->flushAge / 2);
+	interval.tv_nsec = ticks_to_nanosecs(cache->flushAge / 2) % 1000000000;
+	if (interval.tv_sec == 0 && interval.tv_nsec < 10000000) {
+		interval.tv_nsec = 10000000;
+	}
+
+	LWP_MutexLock(cache->lock);
+
+	while (!cache->flusherQuit) {
+		LWP_CondTimedWait(cache->flusherCond, cache->lock, &interval);
+
+		do {
+			now = gettime();
+			all = _NTFS_cache_overThreshold(cache);
+			count = 0;
+
+			for (j = 0; j < CACHE_POOL_COUNT && count < CACHE_FLUSHER_BATCH; j++) {
+				pool = &cache->pools[j];
+
+				for (i = 0; i < pool->numberOfPages && count < CACHE_FLUSHER_BATCH; i++) {
+					entry = &pool->cacheEntries[i];
+					if (entry->dirtyEnd != 0 && (all || diff_ticks(entry->dirtied, now) >= cache->flushAge)) {
+						cache->writeList[count++] = entry;
+					}
+				}
+			}
+
+			qsort(cache->writeList, count, sizeof(NTFS_CACHE_ENTRY*), _NTFS_cache_compareSector);
+
+			if (count == 0 || !_NTFS_cache_writePages(cache, cache->writeList, count)) break;
+
+			LWP_MutexUnlock(cache->lock);
+			LWP_YieldThread();
+			LWP_MutexLock(cache->lock);
+		} while (!cache->flusherQuit);
+	}
+
+	LWP_MutexUnlock(cache->lock);
+
+	return NULL;
+}
+
+bool _NTFS_cache_startFlusher (NTFS_CACHE* cache, unsigned int flushAge, unsigned int flushThreshold) {
+	if (cache->flusher != LWP_THREAD_NULL) {
+		return false;
+	}
+
+	if (flushThreshold == 0 || flushThreshold > 100) {
+		flushThreshold = 100;
+	}
+
+	cache->flushAge = millisecs_to_ticks(flushAge);
+	cache->flushThreshold = flushThreshold;
+	cache->flusherQuit = false;
+
+	if (LWP_CondInit(&cache->flusherCond) < 0) {
+		return false;
+	}
+
+	if (LWP_CreateThread(&cache->flusher, _NTFS_cache_flusherThread, cache, NULL, CACHE_FLUSHER_STACK_SIZE, CACHE_FLUSHER_PRIORITY) < 0) {
+		cache->flusher = LWP_THREAD_NULL;
+		LWP_CondDestroy(cache->flusherCond);
+		return false;
+	}
+
+	return true;
 }
@@ -3,11 +3,15 @@
  The cache is not visible to the user. It should be flushed
  when any file is closed or changes are made to the filesystem.
 
- This cache implements a least-used-page replacement policy. This will
- distribute sectors evenly over the pages, so if less than the maximum
- pages are used at once, they should all eventually remain in the cache.
- This also has the benefit of throwing out old sectors, so as not to keep
- too many stale pages around.
+ This cache implements a 2Q page replacement policy by default. Pages
+ read in once are kept in a short FIFO queue and only move to the main
+ LRU queue when they are referenced again soon after being replaced, so
+ a long sequential stream cannot flush out frequently used metadata.
+ A plain least-recently-used policy can be selected instead.
+
+ Pages of up to 1024 sectors are supported. Accesses the caller tags as
+ metadata can be given their own pool of smaller pages, which bulk data
+ transfers can never replace.
 
  Copyright (c) 2006 Michael "Chishm" Chisholm
  Copyright (c) 2009 shareese, rodries
@@ -44,21 +48,105 @@
 #include <ogc/disc_io.h>
 #include <gccore.h>
 
-typedef struct {
+typedef enum {
+	NTFS_CACHE_POLICY_2Q,             // Scan resistant two queue replacement
+	NTFS_CACHE_POLICY_LRU             // Plain least recently used replacement
+} NTFS_CACHE_POLICY;
+
+enum {
+	CACHE_QUEUE_FREE,                 // Pages holding no sectors
+	CACHE_QUEUE_A1IN,                 // Pages referenced once, replaced in FIFO order
+	CACHE_QUEUE_AM,                   // Pages referenced again, replaced in LRU order
+	CACHE_QUEUE_COUNT
+};
+
+enum {
+	CACHE_POOL_DATA,                  // Pages for bulk transfers
+	CACHE_POOL_META,                  // Pages for small metadata accesses
+	CACHE_POOL_COUNT
+};
+
+struct _NTFS_CACHE_POOL;
+
+typedef struct _NTFS_CACHE_ENTRY {
 	sec_t        sector;
 	unsigned int count;
-	unsigned int last_access;
-	uint64_t     dirty;
+	uint64_t     last_access;
+	uint64_t     dirtied;             // Time the page went from clean to dirty
+	uint32_t*    dirty;               // One bit per sector in the page
+	unsigned int dirtyFirst;          // First dirty sector in the page
+	unsigned int dirtyEnd;            // One past the last dirty sector, or zero if clean
 	uint8_t*     cache;
+	struct _NTFS_CACHE_POOL*  pool;   // Pool this page belongs to
+	struct _NTFS_CACHE_ENTRY* next;   // Next page in the same hash bucket
+	struct _NTFS_CACHE_ENTRY* older;  // Next page towards the tail of its queue
+	struct _NTFS_CACHE_ENTRY* newer;  // Next page towards the head of its queue
+	unsigned int queue;
+	unsigned int pinned;              // Outstanding pins keeping the page from being reused
 } NTFS_CACHE_ENTRY;
 
 typedef struct {
-	DISC_INTERFACE*   disc;
-	sec_t             endOfPartition;
-	unsigned int      numberOfPages;
-	unsigned int      sectorsPerPage;
-	unsigned int      bytesPerSector;
-	NTFS_CACHE_ENTRY* cacheEntries;
+	NTFS_CACHE_ENTRY* head;           // Most recently inserted or used page
+	NTFS_CACHE_ENTRY* tail;           // Next page up for replacement
+	unsigned int      count;
+} NTFS_CACHE_QUEUE;
+
+typedef struct _NTFS_CACHE_POOL {
+	unsigned int       numberOfPages;
+	unsigned int       sectorsPerPage;
+	unsigned int       pageShift;     // log2 of sectorsPerPage
+	NTFS_CACHE_ENTRY*  cacheEntries;
+	uint32_t*          dirtyBitmaps;
+	unsigned int       dirtyWords;    // Bitmap words per page
+	NTFS_CACHE_QUEUE   queues[CACHE_QUEUE_COUNT];
+	unsigned int       maxA1in;       // Size limit of the A1in queue
+	sec_t*             ghosts;        // Base sectors recently replaced from A1in
+	unsigned int       ghostSize;
+	unsigned int       ghostCount;
+	unsigned int       ghostHead;
+} NTFS_CACHE_POOL;
+
+typedef struct {
+	uint64_t hits;                    // Accesses served from a resident page
+	uint64_t misses;                  // Accesses that had to load a page
+	uint64_t readAheadPages;          // Pages loaded ahead of a sequential stream or prefetched
+	uint64_t bypassReads;             // Reads passed straight to the disc
+	uint64_t bypassWrites;            // Writes passed straight to the disc
+	uint64_t evictions;               // Resident pages replaced to make room
+	uint64_t writebacks;              // Write commands issued for dirty pages
+	uint64_t bytesRead;               // Bytes read from the disc
+	uint64_t bytesWritten;            // Bytes written to the disc
+	uint64_t reads;                   // Read commands issued to the disc
+	uint64_t writes;                  // Write commands issued to the disc
+} NTFS_CACHE_STATS;
+
+typedef struct {
+	DISC_INTERFACE*    disc;
+	sec_t              endOfPartition;
+	unsigned int       bytesPerSector;
+	NTFS_CACHE_POOL    pools[CACHE_POOL_COUNT];
+	NTFS_CACHE_ENTRY** hashTable;     // Pages indexed by base sector
+	unsigned int       hashBits;      // log2 of the number of hash buckets
+	NTFS_CACHE_POLICY  policy;
+	uint64_t           accessCounter; // Access clock, private to this cache
+	unsigned int       readAheadMax;  // Most data pages fetched by one read, or zero if read-ahead is disabled
+	unsigned int       readAheadWindow; // Data pages currently fetched per miss of a sequential stream
+	sec_t              readAheadNext; // Sector a sequential stream will read next
+	uint8_t*           stagingBuffer; // Gathers read-ahead pages and coalesced writes into single commands, NULL until first needed
+	unsigned int       stagingSize;   // Capacity of the staging buffer in sectors
+	sec_t              stagingSector; // First sector of the write being gathered
+	unsigned int       stagingCount;  // Sectors gathered so far, or zero if none
+	const uint8_t*     stagingSource; // Page data of a lone gathered run not yet copied to the buffer
+	NTFS_CACHE_ENTRY** writeList;     // Dirty pages sorted by sector while being written back
+	unsigned int       dirtyPages;    // Number of pages holding dirty sectors
+	unsigned int       pinnedPages;   // Number of data pages pinned
+	mutex_t            lock;          // Serialises the background flusher against all other access
+	lwp_t              flusher;       // Background flusher thread, or LWP_THREAD_NULL if not running
+	cond_t             flusherCond;   // Wakes the flusher early, or tells it to quit
+	bool               flusherQuit;
+	uint64_t           flushAge;      // Dirty pages older than this many ticks are written back
+	unsigned int       flushThreshold; // Percentage of dirty pages that triggers a writeback regardless of age
+	NTFS_CACHE_STATS   stats;
 } NTFS_CACHE;
 
 /*
@@ -66,9 +154,10 @@ Read data from a sector in the cache
 If the sector is not in the cache, it will be swapped in
 offset is the position to start reading from
 size is the amount of data to read
+metadata selects the pool the sector is swapped into
 Precondition: offset + size <= BYTES_PER_READ
 */
-bool _NTFS_cache_readPartialSector (NTFS_CACHE* cache, void* buffer, sec_t sector, unsigned int offset, size_t size);
+bool _NTFS_cache_readPartialSector (NTFS_CACHE* cache, void* buffer, sec_t sector, unsigned int offset, size_t size, bool metadata);
 
 bool _NTFS_cache_readLittleEndianValue (NTFS_CACHE* cache, uint32_t *value, sec_t sector, unsigned int offset, int num_bytes);
 
@@ -78,9 +167,10 @@ If the sector is not in the cache, it will be swapped in.
 When the sector is swapped out, the data will be written to the disc
 offset is the position to start writing to
 size is the amount of data to write
+metadata selects the pool the sector is swapped into
 Precondition: offset + size <= BYTES_PER_READ
 */
-bool _NTFS_cache_writePartialSector (NTFS_CACHE* cache, const void* buffer, sec_t sector, unsigned int offset, size_t size);
+bool _NTFS_cache_writePartialSector (NTFS_CACHE* cache, const void* buffer, sec_t sector, unsigned int offset, size_t size, bool metadata);
 
 bool _NTFS_cache_writeLittleEndianValue (NTFS_CACHE* cache, const uint32_t value, sec_t sector, unsigned int offset, int num_bytes);
 
@@ -96,38 +186,123 @@ bool _NTFS_cache_eraseWritePartialSector (NTFS_CACHE* cache, const void* buffer,
 
 /*
 Read several sectors from the cache
+Metadata is kept in the metadata pool, where reads and writes of file data can not replace it
+*/
+bool _NTFS_cache_readSectors (NTFS_CACHE* cache, sec_t sector, sec_t numSectors, void* buffer, bool metadata);
+
+/*
+Read a range of bytes starting offset bytes into a sector, copying straight out of the cache pages
+The range may start and end part way through a sector, and may span several pages
 */
-bool _NTFS_cache_readSectors (NTFS_CACHE* cache, sec_t sector, sec_t numSectors, void* buffer);
+bool _NTFS_cache_readBytes (NTFS_CACHE* cache, sec_t sector, unsigned int offset, size_t size, void* buffer, bool metadata);
+
+/*
+Check whether a run of sectors lies within a single data page
+*/
+static inline bool _NTFS_cache_inPage (NTFS_CACHE* cache, sec_t sector, sec_t numSectors) {
+	unsigned int pageShift = cache->pools[CACHE_POOL_DATA].pageShift;
+	return (sector >> pageShift) == ((sector + numSectors - 1) >> pageShift);
+}
+
+/*
+Pin the data page holding a range of bytes starting offset bytes into a sector, swapping it in if needed
+The page is not reused until it is unpinned, and *page receives the handle to unpin it with
+Returns a pointer to the bytes within the page, or NULL if they do not lie within a single data page
+or half of the data pages are pinned already
+*/
+const void* _NTFS_cache_pin (NTFS_CACHE* cache, sec_t sector, unsigned int offset, size_t size, NTFS_CACHE_ENTRY** page);
+
+void _NTFS_cache_unpin (NTFS_CACHE* cache, NTFS_CACHE_ENTRY* page);
 
 /*
 Read a full sector from the cache
 */
 static inline bool _NTFS_cache_readSector (NTFS_CACHE* cache, void* buffer, sec_t sector) {
-	return _NTFS_cache_readPartialSector (cache, buffer, sector, 0, cache->bytesPerSector);
+	return _NTFS_cache_readPartialSector (cache, buffer, sector, 0, cache->bytesPerSector, true);
 }
 
 /*
 Write a full sector to the cache
 */
 static inline bool _NTFS_cache_writeSector (NTFS_CACHE* cache, const void* buffer, sec_t sector) {
-	return _NTFS_cache_writePartialSector (cache, buffer, sector, 0, cache->bytesPerSector);
+	return _NTFS_cache_writePartialSector (cache, buffer, sector, 0, cache->bytesPerSector, true);
 }
 
-bool _NTFS_cache_writeSectors (NTFS_CACHE* cache, sec_t sector, sec_t numSectors, const void* buffer);
+/*
+Write several sectors to the cache
+*/
+bool _NTFS_cache_writeSectors (NTFS_CACHE* cache, sec_t sector, sec_t numSectors, const void* buffer, bool metadata);
+
+/*
+Read or write several sectors without loading any of them into the cache
+Sectors that are already cached are still read from and written to their pages
+*/
+bool _NTFS_cache_readSectorsUncached (NTFS_CACHE* cache, sec_t sector, sec_t numSectors, void* buffer);
+bool _NTFS_cache_writeSectorsUncached (NTFS_CACHE* cache, sec_t sector, sec_t numSectors, const void* buffer);
 
 /*
 Write any dirty sectors back to disc and clear out the contents of the cache
 */
 bool _NTFS_cache_flush (NTFS_CACHE* cache);
 
+/*
+Drop the pages lying wholly within a run of sectors, without writing them back
+*/
+void _NTFS_cache_discard (NTFS_CACHE* cache, sec_t sector, sec_t numSectors);
+
+/*
+Load a run of sectors into data pages ahead of their use, in large disc commands
+*numSectors is reduced to the sectors from sector on that have been dealt with, which falls
+short when the run would take more than half of the data pages. Runs shorter than two pages are not loaded.
+*/
+bool _NTFS_cache_prefetch (NTFS_CACHE* cache, sec_t sector, sec_t* numSectors);
+
 /*
 Clear out the contents of the cache without writing any dirty sectors first
 */
 void _NTFS_cache_invalidate (NTFS_CACHE* cache);
 
-NTFS_CACHE* _NTFS_cache_constructor (unsigned int numberOfPages, unsigned int sectorsPerPage, DISC_INTERFACE* discInterface, sec_t endOfPartition, unsigned int bytesPerSector);
+/*
+Create a cache of numberOfPages pages of sectorsPerPage sectors for bulk transfers, and
+optionally a separate pool of numberOfMetaPages smaller pages that metadata accesses
+are cached in instead. Page sizes are rounded down to a power of two.
+Sequential reads fetch up to readAheadPages data pages per disc command, 0 or 1 disables this.
+*/
+NTFS_CACHE* _NTFS_cache_constructor (unsigned int numberOfPages, unsigned int sectorsPerPage, unsigned int numberOfMetaPages, unsigned int sectorsPerMetaPage, DISC_INTERFACE* discInterface, sec_t endOfPartition, unsigned int bytesPerSector, NTFS_CACHE_POLICY policy, unsigned int readAheadPages);
 
 void _NTFS_cache_destructor (NTFS_CACHE* cache);
 
+/*
+Write back all dirty sectors and rebuild the cache with a new geometry, keeping its statistics.
+The cache is left unchanged if this fails, with errno set, as it is while any page is pinned (EBUSY).
+*/
+bool _NTFS_cache_reconfigure (NTFS_CACHE* cache, unsigned int numberOfPages, unsigned int sectorsPerPage, unsigned int numberOfMetaPages, unsigned int sectorsPerMetaPage, unsigned int readAheadPages);
+
+/*
+Let the cache hold sectors up to endOfPartition, so that it can be shared with a further partition
+*/
+void _NTFS_cache_extend (NTFS_CACHE* cache, sec_t endOfPartition);
+
+/*
+Copy the statistics of the cache, optionally resetting them afterwards
+*/
+void _NTFS_cache_getStats (NTFS_CACHE* cache, NTFS_CACHE_STATS* stats, bool reset);
+
+/*
+Bytes of memory held by the cache: its pages, their bookkeeping and the staging buffer
+*/
+size_t _NTFS_cache_memoryUsage (NTFS_CACHE* cache);
+
+/*
+Bytes of memory a cache of the given geometry would hold
+*/
+size_t _NTFS_cache_layoutSize (unsigned int numberOfPages, unsigned int sectorsPerPage, unsigned int numberOfMetaPages, unsigned int sectorsPerMetaPage, unsigned int bytesPerSector, unsigned int readAheadPages);
+
+/*
+Start a thread writing back pages that have been dirty for longer than flushAge milliseconds,
+or all dirty pages once more than flushThreshold percent of the pages are dirty
+*/
+bool _NTFS_cache_startFlusher (NTFS_CACHE* cache, unsigned int flushAge, unsigned int flushThreshold);
+
 #endif // _CACHE_H
 
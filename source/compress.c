@@ -49,6 +49,7 @@
 #include "runlist.h"
 #include "compress.h"
 #include "lcnalloc.h"
+#include "cache.h"
 #include "logging.h"
 #include "misc.h"
 
@@ -82,6 +83,10 @@ typedef enum {
 /* log base 2 of the number of entries in the hash table for match-finding.  */
 #define HASH_SHIFT 14
 
+/* log base 2 of the number of entries of the hash table used by the fast
+ * compression level, small enough to be cleared cheaply for each block.  */
+#define FAST_HASH_SHIFT 12
+
 /* Constant for the multiplicative hash function.  */
 #define HASH_MULTIPLIER 0x1E35A7BD
 
@@ -117,6 +122,17 @@ static inline unsigned int ntfs_hash(const u8 *p)
 	return hash >> (32 - HASH_SHIFT);
 }
 
+/*
+ *		Hash the next 3-byte sequence for the fast compression level
+ */
+static inline unsigned int ntfs_fast_hash(const u8 *p)
+{
+	u32 str;
+
+	str = ((u32)p[0] << 0) | ((u32)p[1] << 8) | ((u32)p[2] << 16);
+	return (str * HASH_MULTIPLIER) >> (32 - FAST_HASH_SHIFT);
+}
+
 /*
  *		Search for the longest sequence matching current position
  *
@@ -258,6 +274,34 @@ static void ntfs_skip_position(struct COMPRESS_CONTEXT *pctx, const int i)
 	pctx->head[hash] = i;
 }
 
+/*
+ *		Complete the header of a compressed block
+ *
+ *	When the whole input was not compressed into less than its size,
+ *	it is stored uncompressed instead.
+ *
+ *	Returns the size of the block, including the header
+ */
+
+static unsigned int ntfs_compress_end(const char *inbuf, const int bufsize,
+				char *outbuf, int i, unsigned int xout)
+{
+	if ((i >= bufsize) && (xout < (NTFS_SB_SIZE + 2))) {
+		/* Compressed.  */
+		outbuf[0] = (xout - 3) & 255;
+		outbuf[1] = 0xb0 + (((xout - 3) >> 8) & 15);
+	} else {
+		/* Uncompressed.  */
+		memcpy(&outbuf[2], inbuf, bufsize);
+		if (bufsize < NTFS_SB_SIZE)
+			memset(&outbuf[bufsize + 2], 0, NTFS_SB_SIZE - bufsize);
+		outbuf[0] = 0xff;
+		outbuf[1] = 0x3f;
+		xout = NTFS_SB_SIZE + 2;
+	}
+	return (xout);
+}
+
 /*
  *		Compress a 4096-byte block
  *
@@ -270,13 +314,12 @@ static void ntfs_skip_position(struct COMPRESS_CONTEXT *pctx, const int i)
  *
  *	Returns the size of the compressed block, including the
  *			header (minimal size is 2, maximum size is 4098)
- *		0 if an error has been met. 
  */
 
-static unsigned int ntfs_compress_block(const char *inbuf, const int bufsize,
+static unsigned int ntfs_compress_block(struct COMPRESS_CONTEXT *pctx,
+				const char *inbuf, const int bufsize,
 				char *outbuf)
 {
-	struct COMPRESS_CONTEXT *pctx;
 	int i; /* current position */
 	int j; /* end of best match from current position */
 	int k; /* end of best match from next position */
@@ -291,12 +334,6 @@ static unsigned int ntfs_compress_block(const char *inbuf, const int bufsize,
 	int tag;    /* current value of tag */
 	int ntag;   /* count of bits still undefined in tag */
 
-	pctx = ntfs_malloc(sizeof(struct COMPRESS_CONTEXT));
-	if (!pctx) {
-		errno = ENOMEM;
-		return 0;
-	}
-
 	/* All hash chains start as empty.  The special value '-1' indicates the
 	 * end of each hash chain.  */
 	memset(pctx->head, 0xFF, sizeof(pctx->head));
@@ -424,26 +461,105 @@ static unsigned int ntfs_compress_block(const char *inbuf, const int bufsize,
 	else
 		*ptag = tag;
 
-	/* Determine whether to store the data compressed or uncompressed.  */
+	/* Return the total number of bytes written to 'outbuf'.  */
+	return (ntfs_compress_end(inbuf, bufsize, outbuf, i, xout));
+}
 
-	if ((i >= bufsize) && (xout < (NTFS_SB_SIZE + 2))) {
-		/* Compressed.  */
-		outbuf[0] = (xout - 3) & 255;
-		outbuf[1] = 0xb0 + (((xout - 3) >> 8) & 15);
-	} else {
-		/* Uncompressed.  */
-		memcpy(&outbuf[2], inbuf, bufsize);
-		if (bufsize < NTFS_SB_SIZE)
-			memset(&outbuf[bufsize + 2], 0, NTFS_SB_SIZE - bufsize);
-		outbuf[0] = 0xff;
-		outbuf[1] = 0x3f;
-		xout = NTFS_SB_SIZE + 2;
+/*
+ *		Compress a 4096-byte block quickly
+ *
+ *	This is a greedy parser probing a single earlier position per
+ *	byte : the match found at the current position is always taken,
+ *	and it is only looked for at the last position with the same
+ *	hash. On text the output is about half as big again as with
+ *	ntfs_compress_block(), in less than a third of the time.
+ *
+ *	Same output and returned size as ntfs_compress_block().
+ */
+
+static unsigned int ntfs_compress_block_fast(struct COMPRESS_CONTEXT *pctx,
+				const char *inbuf, const int bufsize,
+				char *outbuf)
+{
+	const u8 *in = (const u8*)inbuf;
+	s16 *head = pctx->head;
+	int i; /* current position */
+	int j; /* end of match from current position */
+	int len; /* length of match */
+	int max_len; /* longest match allowed at current position */
+	int bp; /* bits to store offset */
+	int mxoff; /* max match offset : 1 << bp */
+	int mxsz; /* max match size with bp bits of offset */
+	s16 cur_match;
+	unsigned int xout;
+	unsigned int q; /* aggregated offset and size */
+	char *ptag; /* location reserved for a tag */
+	int tag;    /* current value of tag */
+	int ntag;   /* count of bits still undefined in tag */
+
+	memset(head, 0xFF, sizeof(s16) << FAST_HASH_SHIFT);
+
+	xout = 2;
+	i = 0;
+	bp = 4;
+	mxoff = 1 << bp;
+	mxsz = (1 << (16 - bp)) + 2;
+	tag = 0;
+	ntag = 8;
+	ptag = &outbuf[xout++];
+
+	while ((i < bufsize) && (xout < (NTFS_SB_SIZE + 2))) {
+		while (mxoff < i) {
+			bp++;
+			mxoff <<= 1;
+			mxsz = (mxsz + 2) >> 1;
+		}
+		len = 0;
+		cur_match = -1;
+		if ((bufsize - i) >= 3) {
+			q = ntfs_fast_hash(&in[i]);
+			cur_match = head[q];
+			head[q] = i;
+			if ((cur_match >= 0)
+			    && (in[cur_match] == in[i])
+			    && (in[cur_match + 1] == in[i + 1])
+			    && (in[cur_match + 2] == in[i + 2])) {
+				max_len = min(bufsize - i, mxsz);
+				len = 3;
+				while ((len < max_len)
+				    && (in[cur_match + len] == in[i + len]))
+					len++;
+			}
+		}
+		if (len >= 3) {
+			/* Take the match, hashing the positions it covers */
+			q = ((i - cur_match - 1) << (16 - bp)) + (len - 3);
+			outbuf[xout++] = q & 255;
+			outbuf[xout++] = (q >> 8) & 255;
+			tag |= (1 << (8 - ntag));
+			j = i + len;
+			while ((++i < j) && ((bufsize - i) >= 3))
+				head[ntfs_fast_hash(&in[i])] = i;
+			i = j;
+		} else
+			outbuf[xout++] = inbuf[i++];
+
+		/* Store the tag if fully used.  */
+		if (!--ntag) {
+			*ptag = tag;
+			ntag = 8;
+			ptag = &outbuf[xout++];
+			tag = 0;
+		}
 	}
 
-	/* Free the compression context and return the total number of bytes
-	 * written to 'outbuf'.  */
-	free(pctx);
-	return (xout);
+	/* Store the last tag if partially used.  */
+	if (ntag == 8)
+		xout--;
+	else
+		*ptag = tag;
+
+	return (ntfs_compress_end(inbuf, bufsize, outbuf, i, xout));
 }
 
 /**
@@ -479,6 +595,7 @@ static int ntfs_decompress(u8 *dest, const u32 dest_size,
 	/* Variables for tag and token parsing. */
 	u8 tag;			/* Current tag. */
 	int token;		/* Loop counter for the eight tokens in tag. */
+	int lg;			/* log2 of position in sb, less 4, if positive */
 
 	ntfs_log_trace("Entering, cb_size = 0x%x.\n", (unsigned)cb_size);
 do_next_sb:
@@ -531,6 +648,7 @@ do_next_sb:
 	/* This sb is compressed, decompress it into destination. */
 	/* Forward to the first tag in the sub-block. */
 	cb += 2;
+	lg = 0;
 do_next_tag:
 	if (cb == cb_sb_end) {
 		/* Check if the decompressed sub-block was not full-length. */
@@ -550,10 +668,19 @@ do_next_tag:
 		goto return_overflow;
 	/* Get the next tag and advance to first token. */
 	tag = *cb++;
+	/*
+	 * Eight symbols in a row are the most frequent tag in poorly
+	 * compressible data, copy them at once when they are all there.
+	 */
+	if (!tag && (cb + 8 <= cb_sb_end) && (dest + 8 <= dest_sb_end)) {
+		memcpy(dest, cb, 8);
+		cb += 8;
+		dest += 8;
+		goto do_next_tag;
+	}
 	/* Parse the eight tokens described by the tag. */
 	for (token = 0; token < 8; token++, tag >>= 1) {
-		u16 lg, pt, length, max_non_overlap;
-		register u16 i;
+		u16 pt, length, dist;
 		u8 *dest_back_addr;
 
 		/* Check if we are done / still in range. */
@@ -565,6 +692,8 @@ do_next_tag:
 			 * We have a symbol token, copy the symbol across, and
 			 * advance the source and destination positions.
 			 */
+			if (dest == dest_sb_end)
+				goto return_overflow;
 			*dest++ = *cb++;
 			/* Continue with the next token. */
 			continue;
@@ -577,15 +706,15 @@ do_next_tag:
 			goto return_overflow;
 		/*
 		 * Determine the number of bytes to go back (p) and the number
-		 * of bytes to copy (l). We use an optimized algorithm in which
-		 * we first calculate log2(current destination position in sb),
-		 * which allows determination of l and p in O(1) rather than
-		 * O(n). We just need an arch-optimized log2() function now.
+		 * of bytes to copy (l). Both depend on log2(current destination
+		 * position in sb), which only grows within the sb so is kept
+		 * up to date rather than computed for each phrase.
 		 */
-		lg = 0;
-		for (i = dest - dest_sb_start - 1; i >= 0x10; i >>= 1)
+		while (dest - dest_sb_start - 1 >= (0x10 << lg))
 			lg++;
-		/* Get the phrase token into i. */
+		/* Get the phrase token into pt. */
+		if (cb + 2 > cb_sb_end)
+			goto return_overflow;
 		pt = le16_to_cpup((le16*)cb);
 		/*
 		 * Calculate starting position of the byte sequence in
@@ -600,24 +729,34 @@ do_next_tag:
 		/* Verify destination is in range. */
 		if (dest + length > dest_sb_end)
 			goto return_overflow;
-		/* The number of non-overlapping bytes. */
-		max_non_overlap = dest - dest_back_addr;
-		if (length <= max_non_overlap) {
-			/* The byte sequence doesn't overlap, just copy it. */
-			memcpy(dest, dest_back_addr, length);
-			/* Advance destination pointer. */
+		/* The distance back, i.e. the number of non-overlapping bytes. */
+		dist = dest - dest_back_addr;
+		if ((dist >= 8) && (dest + length + 7 <= dest_sb_end)) {
+			/*
+			 * Copy eight bytes at a time, the sequence may overlap
+			 * with what is being copied, but not within eight
+			 * bytes. Up to seven bytes may be written beyond the
+			 * sequence, they are within the sb and are overwritten
+			 * by the next tokens.
+			 */
+			u8 *to = dest;
+			const u8 *from = dest_back_addr;
+
+			dest += length;
+			do {
+				memcpy(to, from, 8);
+				to += 8;
+				from += 8;
+			} while (to < dest);
+		} else if (dist == 1) {
+			/* A repeated byte. */
+			memset(dest, *dest_back_addr, length);
 			dest += length;
 		} else {
 			/*
-			 * The byte sequence does overlap, copy non-overlapping
-			 * part and then do a slow byte by byte copy for the
-			 * overlapping part. Also, advance the destination
-			 * pointer.
+			 * A short pattern repeated, or near the end of the sb,
+			 * do a byte by byte copy.
 			 */
-			memcpy(dest, dest_back_addr, max_non_overlap);
-			dest += max_non_overlap;
-			dest_back_addr += max_non_overlap;
-			length -= max_non_overlap;
 			while (length--)
 				*dest++ = *dest_back_addr++;
 		}
@@ -685,6 +824,192 @@ restart:
 	return FALSE;
 }
 
+#if CACHE_CBLOCK_SIZE
+
+/*
+ *		Pseudo-hash of a compression block in the block cache
+ *
+ *	All the blocks of a file get the same hash, so that they can
+ *	be dropped together when the file is changed.
+ */
+
+int ntfs_compressed_block_hash(const struct CACHED_GENERIC *item)
+{
+	return ((int)(((const struct CACHED_CBLOCK*)item)->inum
+			& 0x7fffffff));
+}
+
+/*
+ *		Compression block comparing for fetching from cache
+ */
+
+static int cblock_cache_compare(const struct CACHED_GENERIC *cached,
+			const struct CACHED_GENERIC *item)
+{
+	return (!((const struct CACHED_CBLOCK*)cached)->data
+		|| (((const struct CACHED_CBLOCK*)cached)->inum
+			!= ((const struct CACHED_CBLOCK*)item)->inum)
+		|| (((const struct CACHED_CBLOCK*)cached)->vcn
+			!= ((const struct CACHED_CBLOCK*)item)->vcn));
+}
+
+/*
+ *		File comparing for dropping all its blocks from cache
+ */
+
+static int cblock_cache_inode_compare(const struct CACHED_GENERIC *cached,
+			const struct CACHED_GENERIC *item)
+{
+	return (((const struct CACHED_CBLOCK*)cached)->inum
+			!= ((const struct CACHED_CBLOCK*)item)->inum);
+}
+
+/*
+ *		Check whether the blocks of an attribute may be cached
+ *
+ *	Only the unnamed data stream of files is cached, as blocks are
+ *	only known by the file and their first vcn.
+ */
+
+static BOOL cblock_cacheable(ntfs_attr *na)
+{
+	return (na->ni->vol->cblock_cache
+		&& (na->type == AT_DATA) && !na->name_len);
+}
+
+/*
+ *		Get the decompressed contents of a compression block from
+ *	the cache
+ *
+ *	Returns the cb_size bytes of the block, or NULL if not cached
+ */
+
+static const u8 *cblock_cache_fetch(ntfs_attr *na, VCN cb_start_vcn)
+{
+	struct CACHED_CBLOCK item;
+	struct CACHED_CBLOCK *cached;
+
+	if (!cblock_cacheable(na))
+		return ((const u8*)NULL);
+	item.inum = na->ni->mft_no;
+	item.vcn = cb_start_vcn;
+	item.data = (u8*)NULL;
+	item.varsize = 0;
+	cached = (struct CACHED_CBLOCK*)ntfs_fetch_cache(
+				na->ni->vol->cblock_cache,
+				GENERIC(&item), cblock_cache_compare);
+	if (!cached || (cached->varsize != na->compression_block_size))
+		return ((const u8*)NULL);
+	return (cached->data);
+}
+
+/*
+ *		Keep the decompressed contents of a compression block
+ *
+ *	The caller has checked that the attribute is cacheable.
+ */
+
+static void cblock_cache_enter(ntfs_attr *na, VCN cb_start_vcn,
+			const u8 *data)
+{
+	struct CACHED_CBLOCK item;
+
+	item.inum = na->ni->mft_no;
+	item.vcn = cb_start_vcn;
+	item.data = (u8*)data;
+	item.varsize = na->compression_block_size;
+	ntfs_enter_cache(na->ni->vol->cblock_cache,
+			GENERIC(&item), cblock_cache_compare);
+}
+
+/**
+ * ntfs_compressed_invalidate - forget the cached blocks of a file
+ * @na:		ntfs attribute about to be changed
+ *
+ * Drop the decompressed compression blocks kept for the file of @na, once
+ * the data of the attribute has been written or truncated, or before it is
+ * removed. It does nothing for attributes whose blocks are not cached.
+ */
+void ntfs_compressed_invalidate(ntfs_attr *na)
+{
+	struct CACHED_CBLOCK item;
+
+	if (!cblock_cacheable(na)
+	    || !(na->data_flags & ATTR_COMPRESSION_MASK))
+		return;
+	item.inum = na->ni->mft_no;
+	item.data = (u8*)NULL;
+	item.varsize = 0;
+	ntfs_invalidate_cache(na->ni->vol->cblock_cache,
+			GENERIC(&item), cblock_cache_inode_compare, 0);
+}
+
+#else
+
+int ntfs_compressed_block_hash(const struct CACHED_GENERIC *item)
+{
+	return (0);
+}
+
+static BOOL cblock_cacheable(ntfs_attr *na)
+{
+	return (FALSE);
+}
+
+static const u8 *cblock_cache_fetch(ntfs_attr *na, VCN cb_start_vcn)
+{
+	return ((const u8*)NULL);
+}
+
+static void cblock_cache_enter(ntfs_attr *na, VCN cb_start_vcn,
+			const u8 *data)
+{
+}
+
+void ntfs_compressed_invalidate(ntfs_attr *na)
+{
+}
+
+#endif /* CACHE_CBLOCK_SIZE */
+
+/*
+ *		Start reading the next compression block in the background
+ *
+ *	The raw clusters of the cb starting at @cb_start_vcn are loaded
+ *	into the device cache by its asynchronous worker, so that they
+ *	come from memory once the current cb has been decompressed.
+ *	Sparse cbs and devices which cannot read in the background are
+ *	skipped, this is only a hint and errno is left untouched.
+ */
+
+static void ntfs_compressed_readahead(ntfs_attr *na, VCN cb_start_vcn,
+			unsigned int cb_clusters)
+{
+	ntfs_volume *vol;
+	runlist_element *rl;
+	s64 clusters;
+	u64 range[2];
+	int olderrno;
+
+	vol = na->ni->vol;
+	if (!vol->dev->d_ops->ioctl
+	    || (cb_start_vcn << vol->cluster_size_bits)
+			>= na->initialized_size)
+		return;
+	olderrno = errno;
+	rl = ntfs_attr_find_vcn(na, cb_start_vcn);
+	if (rl && (rl->lcn >= 0)) {
+		clusters = rl->length - (cb_start_vcn - rl->vcn);
+		if (clusters > cb_clusters)
+			clusters = cb_clusters;
+		range[0] = (rl->lcn + cb_start_vcn - rl->vcn)
+				<< vol->cluster_size_bits;
+		range[1] = clusters << vol->cluster_size_bits;
+		vol->dev->d_ops->ioctl(vol->dev, NTFS_IOC_READAHEAD, range);
+	}
+	errno = olderrno;
+}
+
 /**
  * ntfs_compressed_attr_pread - read from a compressed attribute
  * @na:		ntfs attribute to read from
@@ -719,6 +1044,8 @@ s64 ntfs_compressed_attr_pread(ntfs_attr *na, s64 pos, s64 count, void *b)
 	ATTR_FLAGS data_flags;
 	FILE_ATTR_FLAGS compression;
 	unsigned int nr_cbs, cb_clusters;
+	const u8 *cached;
+	BOOL keep;
 
 	ntfs_log_trace("Entering for inode 0x%llx, attr 0x%x, pos 0x%llx, count 0x%llx.\n",
 			(unsigned long long)na->ni->mft_no, le32_to_cpu(na->type),
@@ -828,6 +1155,17 @@ do_next_cb:
 		total += to_read;
 		count -= to_read;
 		b = (u8*)b + to_read;
+	} else if ((cached = cblock_cache_fetch(na, vcn))) {
+		/* Compressed cb decompressed previously, copy it. */
+		ntfs_log_debug("Found cached compression block.\n");
+		to_read = min(count, cb_size - ofs);
+		if (nr_cbs || (ofs + to_read == cb_size))
+			ntfs_compressed_readahead(na, start_vcn, cb_clusters);
+		memcpy(b, cached + ofs, to_read);
+		ofs = 0;
+		total += to_read;
+		count -= to_read;
+		b = (u8*)b + to_read;
 	} else if (!ntfs_is_cb_compressed(na, rl, vcn, cb_clusters)) {
 		s64 tdata_size, tinitialized_size;
 		/*
@@ -946,7 +1284,22 @@ do_next_cb:
 		ntfs_log_debug("Successfully read the compression block.\n");
 		/* Do not decompress beyond the requested block */
 		to_read = min(count, cb_size - ofs);
-		decompsz = ((ofs + to_read - 1) | (NTFS_SB_SIZE - 1)) + 1;
+		/*
+		 * When the read goes on into the next cb, or up to the end of
+		 * this one as sequential reads do, have the next cb loaded
+		 * while this one is being decompressed.
+		 */
+		if (nr_cbs || (ofs + to_read == cb_size))
+			ntfs_compressed_readahead(na, start_vcn, cb_clusters);
+		/*
+		 * A cb only read in part is decompressed whole and kept, as
+		 * the next small reads are likely to fall into it again.
+		 */
+		keep = (to_read < cb_size) && cblock_cacheable(na);
+		if (keep)
+			decompsz = cb_size;
+		else
+			decompsz = ((ofs + to_read - 1) | (NTFS_SB_SIZE - 1)) + 1;
 		if (ntfs_decompress(dest, decompsz, cb, cb_size) < 0) {
 			err = errno;
 			free(cb);
@@ -956,6 +1309,8 @@ do_next_cb:
 			errno = err;
 			return -1;
 		}
+		if (keep)
+			cblock_cache_enter(na, vcn, dest);
 		memcpy(b, dest + ofs, to_read);
 		total += to_read;
 		count -= to_read;
@@ -1069,6 +1424,7 @@ static s32 ntfs_comp_set(ntfs_attr *na, runlist_element *rl,
 			s64 offs, u32 insz, const char *inbuf)
 {
 	ntfs_volume *vol;
+	struct COMPRESS_CONTEXT *pctx;
 	char *outbuf;
 	char *pbuf;
 	u32 compsz;
@@ -1094,7 +1450,10 @@ static s32 ntfs_comp_set(ntfs_attr *na, runlist_element *rl,
 	outbuf = (char*)ntfs_malloc(na->compression_block_size
 			+ 2*(na->compression_block_size/NTFS_SB_SIZE)
 			+ 2);
-	if (outbuf) {
+		/* the match finder is shared by all the blocks */
+	pctx = (struct COMPRESS_CONTEXT*)ntfs_malloc(
+			sizeof(struct COMPRESS_CONTEXT));
+	if (outbuf && pctx) {
 		fail = FALSE;
 		compsz = 0;
 		allzeroes = TRUE;
@@ -1104,10 +1463,23 @@ static s32 ntfs_comp_set(ntfs_attr *na, runlist_element *rl,
 			else
 				bsz = insz - p;
 			pbuf = &outbuf[compsz];
-			sz = ntfs_compress_block(&inbuf[p],bsz,pbuf);
+			if (na->compression_level == COMPRESSION_BEST)
+				sz = ntfs_compress_block(pctx,
+						&inbuf[p],bsz,pbuf);
+			else
+				sz = ntfs_compress_block_fast(pctx,
+						&inbuf[p],bsz,pbuf);
 			/* fail if all the clusters (or more) are needed */
-			if (!sz || ((compsz + sz + clsz + 2)
-					 > na->compression_block_size))
+			if ((compsz + sz + clsz + 2)
+					 > na->compression_block_size)
+				fail = TRUE;
+			/*
+			 * When storing, also give up as soon as less than
+			 * one eighth is saved, the data is then written
+			 * uncompressed without compressing the rest.
+			 */
+			else if ((na->compression_level == COMPRESSION_STORE)
+			    && ((compsz + sz) > ((p + bsz) - ((p + bsz) >> 3))))
 				fail = TRUE;
 			else {
 				if (allzeroes) {
@@ -1153,8 +1525,9 @@ static s32 ntfs_comp_set(ntfs_attr *na, runlist_element *rl,
 		} else
 			if (!fail)
 				written = 0;
-		free(outbuf);
 	}
+	free(pctx);
+	free(outbuf);
 	return (written);
 }
 
@@ -1959,3 +2332,257 @@ int ntfs_compressed_close(ntfs_attr *na, runlist_element *wrl, s64 offs,
 		done = FALSE;
 	return (!done);
 }
+
+#ifdef NTFS_TEST
+#include <time.h>
+
+/**
+ * test_cb_reference - Compression test: Decompress a sub-block a byte at a time
+ * @dest:
+ * @cb:
+ * @cb_sb_end:
+ *
+ * Description...
+ *
+ * Returns:
+ */
+static int test_cb_reference(u8 *dest, const u8 *cb, const u8 *cb_sb_end)
+{
+	u8 *dest_sb_start = dest;
+	u8 *dest_sb_end = dest + NTFS_SB_SIZE;
+	int token, i, lg;
+	u16 pt, length;
+	u8 tag;
+	u8 *back;
+
+	while (cb < cb_sb_end) {
+		tag = *cb++;
+		for (token = 0; token < 8 && cb < cb_sb_end; token++, tag >>= 1) {
+			if (!(tag & 1)) {
+				if (dest >= dest_sb_end)
+					return -1;
+				*dest++ = *cb++;
+				continue;
+			}
+			if (dest == dest_sb_start || cb + 2 > cb_sb_end)
+				return -1;
+			lg = 0;
+			for (i = dest - dest_sb_start - 1; i >= 0x10; i >>= 1)
+				lg++;
+			pt = le16_to_cpup((le16*)cb);
+			back = dest - (pt >> (12 - lg)) - 1;
+			length = (pt & (0xfff >> lg)) + 3;
+			if (back < dest_sb_start || dest + length > dest_sb_end)
+				return -1;
+			while (length--)
+				*dest++ = *back++;
+			cb += 2;
+		}
+	}
+	memset(dest, 0, dest_sb_end - dest);
+	return 0;
+}
+
+/**
+ * test_cb_corpus - Compression test: Fill the data to compress
+ * @file:
+ * @corpus:
+ * @size:
+ *
+ * Description...
+ *
+ * Returns:
+ */
+static void test_cb_corpus(const char *file, char *corpus, int size)
+{
+	static const char *words[] = { "the ", "data ", "of ", "NTFS ",
+		"volume ", "\r\n", "cluster ", "0000", "    ", "file " };
+	int len, i;
+	FILE *f;
+
+	len = 0;
+	if (file) {
+		f = fopen(file, "rb");
+		if (f) {
+			len = fread(corpus, 1, size, f);
+			fclose(f);
+		}
+	}
+	srand(1);
+	while (len < size) {
+		const char *w = words[rand() % 10];
+
+		for (i = 0; w[i] && len < size; i++)
+			corpus[len++] = w[i];
+	}
+}
+
+/**
+ * test_cb_bench - Compression test: Time decompressing 4K sub-blocks
+ * @file:
+ *
+ * Description...
+ *
+ * Returns:
+ */
+static void test_cb_bench(const char *file)
+{
+	struct COMPRESS_CONTEXT *pctx;
+	char *corpus, *cbuf;
+	u8 out[NTFS_SB_SIZE];
+	unsigned int *csize;
+	clock_t start;
+	long fast, slow, total;
+	int nr_sb, sb, pass;
+
+	nr_sb = 256;
+	corpus = ntfs_malloc(nr_sb * NTFS_SB_SIZE);
+	cbuf = ntfs_malloc(nr_sb * (NTFS_SB_SIZE + 4));
+	csize = ntfs_malloc(nr_sb * sizeof(unsigned int));
+	pctx = ntfs_malloc(sizeof(struct COMPRESS_CONTEXT));
+	if (!corpus || !cbuf || !csize || !pctx)
+		goto out;
+	test_cb_corpus(file, corpus, nr_sb * NTFS_SB_SIZE);
+	for (sb = 0; sb < nr_sb; sb++)
+		csize[sb] = ntfs_compress_block(pctx,
+				&corpus[sb * NTFS_SB_SIZE], NTFS_SB_SIZE,
+				&cbuf[sb * (NTFS_SB_SIZE + 4)]);
+
+	start = clock();
+	for (pass = 0; pass < 100; pass++)
+		for (sb = 0; sb < nr_sb; sb++) {
+			u8 *c = (u8*)&cbuf[sb * (NTFS_SB_SIZE + 4)];
+
+			if (ntfs_decompress(out, NTFS_SB_SIZE, c, csize[sb])
+			    || memcmp(out, &corpus[sb * NTFS_SB_SIZE],
+					NTFS_SB_SIZE)) {
+				printf("Bench: sub-block %d decompressed wrong\n",
+					sb);
+				goto out;
+			}
+		}
+	fast = (clock() - start) * 1000 / CLOCKS_PER_SEC;
+
+	start = clock();
+	for (pass = 0; pass < 100; pass++)
+		for (sb = 0; sb < nr_sb; sb++) {
+			u8 *c = (u8*)&cbuf[sb * (NTFS_SB_SIZE + 4)];
+
+			if (c[1] & 0x80)
+				test_cb_reference(out, c + 2, c + csize[sb]);
+			else
+				memcpy(out, c + 2, NTFS_SB_SIZE);
+			if (memcmp(out, &corpus[sb * NTFS_SB_SIZE],
+					NTFS_SB_SIZE)) {
+				printf("Bench: sub-block %d decompressed wrong\n",
+					sb);
+				goto out;
+			}
+		}
+	slow = (clock() - start) * 1000 / CLOCKS_PER_SEC;
+
+	total = 0;
+	for (sb = 0; sb < nr_sb; sb++)
+		total += csize[sb];
+	printf("%d sub-blocks of %d bytes, compressed to %ld%%, 100 passes\n",
+		nr_sb, NTFS_SB_SIZE, total * 100 / (nr_sb * NTFS_SB_SIZE));
+	printf("ntfs_decompress: %ld ms, byte at a time: %ld ms\n", fast, slow);
+out:
+	free(pctx);
+	free(corpus);
+	free(cbuf);
+	free(csize);
+}
+
+/**
+ * test_cb_compress - Compression test: Time compressing 4K sub-blocks
+ * @file:
+ *
+ * Description...
+ *
+ * Returns:
+ */
+static void test_cb_compress(const char *file)
+{
+	static const char *names[] = { "best", "fast" };
+	struct COMPRESS_CONTEXT *pctx;
+	char *corpus, *cbuf;
+	u8 out[NTFS_SB_SIZE];
+	unsigned int csize;
+	clock_t start;
+	long elapsed, total;
+	int nr_sb, sb, pass, level;
+
+	nr_sb = 256;
+	corpus = ntfs_malloc(nr_sb * NTFS_SB_SIZE);
+	cbuf = ntfs_malloc(NTFS_SB_SIZE + 4);
+	pctx = ntfs_malloc(sizeof(struct COMPRESS_CONTEXT));
+	if (!corpus || !cbuf || !pctx)
+		goto out;
+	test_cb_corpus(file, corpus, nr_sb * NTFS_SB_SIZE);
+	for (level = COMPRESSION_BEST; level <= COMPRESSION_FAST; level++) {
+		total = 0;
+		start = clock();
+		for (pass = 0; pass < 20; pass++)
+			for (sb = 0; sb < nr_sb; sb++) {
+				if (level == COMPRESSION_BEST)
+					csize = ntfs_compress_block(pctx,
+						&corpus[sb * NTFS_SB_SIZE],
+						NTFS_SB_SIZE, cbuf);
+				else
+					csize = ntfs_compress_block_fast(pctx,
+						&corpus[sb * NTFS_SB_SIZE],
+						NTFS_SB_SIZE, cbuf);
+				total += csize;
+			}
+		elapsed = (clock() - start) * 1000 / CLOCKS_PER_SEC;
+		for (sb = 0; sb < nr_sb; sb++) {
+			if (level == COMPRESSION_BEST)
+				csize = ntfs_compress_block(pctx,
+					&corpus[sb * NTFS_SB_SIZE],
+					NTFS_SB_SIZE, cbuf);
+			else
+				csize = ntfs_compress_block_fast(pctx,
+					&corpus[sb * NTFS_SB_SIZE],
+					NTFS_SB_SIZE, cbuf);
+			if (ntfs_decompress(out, NTFS_SB_SIZE, (u8*)cbuf,
+					csize)
+			    || memcmp(out, &corpus[sb * NTFS_SB_SIZE],
+					NTFS_SB_SIZE)) {
+				printf("Compress: sub-block %d is wrong at"
+					" level %s\n", sb, names[level]);
+				goto out;
+			}
+		}
+		printf("%s: %ld ms for 20 passes over %d sub-blocks,"
+			" compressed to %ld%%\n", names[level], elapsed,
+			nr_sb, total * 100 / (20L * nr_sb * NTFS_SB_SIZE));
+	}
+out:
+	free(pctx);
+	free(corpus);
+	free(cbuf);
+}
+
+/**
+ * test_cb_main - Compression test: Program start (main)
+ * @argc:
+ * @argv:
+ *
+ * Description...
+ *
+ * Returns:
+ */
+int test_cb_main(int argc, char *argv[])
+{
+	if      ((argc == 2) && (strcmp(argv[1], "bench") == 0)) test_cb_bench(NULL);
+	else if ((argc == 3) && (strcmp(argv[1], "bench") == 0)) test_cb_bench(argv[2]);
+	else if ((argc == 2) && (strcmp(argv[1], "compress") == 0)) test_cb_compress(NULL);
+	else if ((argc == 3) && (strcmp(argv[1], "compress") == 0)) test_cb_compress(argv[2]);
+	else
+		printf("cb [bench|compress] {file}\n");
+
+	return 0;
+}
+
+#endif
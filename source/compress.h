@@ -26,6 +26,18 @@
 #include "types.h"
 #include "attrib.h"
 
+/*
+ *		How hard to try when compressing data
+ *
+ *	Values of the compression_level of attributes and volumes, also
+ *	used by the public NTFS_COMPRESS_* levels.
+ */
+typedef enum {
+	COMPRESSION_BEST = 0,	/* lazy matching over hash chains */
+	COMPRESSION_FAST = 1,	/* greedy matching, single probe */
+	COMPRESSION_STORE = 2,	/* fast, storing poorly compressed blocks */
+} ntfs_compression_level;
+
 extern s64 ntfs_compressed_attr_pread(ntfs_attr *na, s64 pos, s64 count,
 		void *b);
 
@@ -37,5 +49,15 @@ extern s64 ntfs_compressed_pwrite(ntfs_attr *na, runlist_element *brl, s64 wpos,
 extern int ntfs_compressed_close(ntfs_attr *na, runlist_element *brl,
 				s64 offs, VCN *update_from);
 
+struct CACHED_GENERIC;
+
+extern int ntfs_compressed_block_hash(const struct CACHED_GENERIC *item);
+
+extern void ntfs_compressed_invalidate(ntfs_attr *na);
+
+#ifdef NTFS_TEST
+int test_cb_main(int argc, char *argv[]);
+#endif
+
 #endif /* defined _NTFS_COMPRESS_H */
 
@@ -297,6 +297,96 @@ out:
 	return ret;
 }
 
+/**
+ * ntfs_preadv - vectored positioned read from disk
+ * @dev:	device to read from
+ * @vec:	fragments to read
+ * @vcnt:	number of fragments in @vec
+ *
+ * This function will read each fragment in @vec from device @dev, letting the
+ * device submit them together, in whatever order suits it best.
+ *
+ * On success, return the total number of bytes read, which is the sum of the
+ * fragment counts. If any fragment could not be read in full, return -1 with
+ * errno set appropriately, the contents of all the fragment buffers are then
+ * undefined.
+ */
+s64 ntfs_preadv(struct ntfs_device *dev, const struct ntfs_io_vec *vec,
+		int vcnt)
+{
+	s64 br, total;
+	int i;
+
+	if (!vec || vcnt < 0) {
+		errno = EINVAL;
+		return -1;
+	}
+	if (dev->d_ops->preadv)
+		return dev->d_ops->preadv(dev, vec, vcnt);
+
+	for (total = 0, i = 0; i < vcnt; i++) {
+		br = ntfs_pread(dev, vec[i].pos, vec[i].count, vec[i].buf);
+		if (br != vec[i].count) {
+			if (br >= 0)
+				errno = EIO;
+			return -1;
+		}
+		total += br;
+	}
+	return total;
+}
+
+/**
+ * ntfs_pwritev - vectored positioned write to disk
+ * @dev:	device to write to
+ * @vec:	fragments to write
+ * @vcnt:	number of fragments in @vec
+ *
+ * This function will write each fragment in @vec to device @dev, letting the
+ * device submit them together, in whatever order suits it best.
+ *
+ * On success, return the total number of bytes written, which is the sum of
+ * the fragment counts. If any fragment could not be written in full, return
+ * -1 with errno set appropriately, any of the fragments may then have been
+ * written.
+ */
+s64 ntfs_pwritev(struct ntfs_device *dev, const struct ntfs_io_vec *vec,
+		int vcnt)
+{
+	s64 written, total;
+	int i;
+
+	if (!vec || vcnt < 0) {
+		errno = EINVAL;
+		return -1;
+	}
+	if (NDevReadOnly(dev)) {
+		errno = EROFS;
+		return -1;
+	}
+	if (dev->d_ops->pwritev) {
+		NDevSetDirty(dev);
+		total = dev->d_ops->pwritev(dev, vec, vcnt);
+		if (NDevSync(dev) && total > 0 && dev->d_ops->sync(dev)) {
+			errno = EIO;
+			return -1;
+		}
+		return total;
+	}
+
+	for (total = 0, i = 0; i < vcnt; i++) {
+		written = ntfs_pwrite(dev, vec[i].pos, vec[i].count,
+				vec[i].buf);
+		if (written != vec[i].count) {
+			if (written >= 0)
+				errno = EIO;
+			return -1;
+		}
+		total += written;
+	}
+	return total;
+}
+
 /**
  * ntfs_mst_pread - multi sector transfer (mst) positioned read
  * @dev:	device to read from
@@ -330,13 +420,18 @@ s64 ntfs_mst_pread(struct ntfs_device *dev, const s64 pos, s64 count,
 		const u32 bksize, void *b)
 {
 	s64 br, i;
+	BOOL was_meta;
 
 	if (bksize & (bksize - 1) || bksize % NTFS_BLOCK_SIZE) {
 		errno = EINVAL;
 		return -1;
 	}
-	/* Do the read. */
+	/* Do the read, mst protected blocks are always metadata. */
+	was_meta = NDevMetadata(dev);
+	NDevSetMetadata(dev);
 	br = ntfs_pread(dev, pos, count * bksize, b);
+	if (!was_meta)
+		NDevClearMetadata(dev);
 	if (br < 0)
 		return br;
 	/*
@@ -387,6 +482,7 @@ s64 ntfs_mst_pwrite(struct ntfs_device *dev, const s64 pos, s64 count,
 		const u32 bksize, void *b)
 {
 	s64 written, i;
+	BOOL was_meta;
 
 	if (count < 0 || bksize % NTFS_BLOCK_SIZE) {
 		errno = EINVAL;
@@ -408,8 +504,12 @@ s64 ntfs_mst_pwrite(struct ntfs_device *dev, const s64 pos, s64 count,
 			break;
 		}
 	}
-	/* Write the prepared data. */
+	/* Write the prepared data, mst protected blocks are always metadata. */
+	was_meta = NDevMetadata(dev);
+	NDevSetMetadata(dev);
 	written = ntfs_pwrite(dev, pos, count * bksize, b);
+	if (!was_meta)
+		NDevClearMetadata(dev);
 	/* Quickly deprotect the data again. */
 	for (i = 0; i < count; ++i)
 		ntfs_mst_post_write_fixup((NTFS_RECORD*)((u8*)b + i * bksize));
@@ -43,6 +43,8 @@ typedef enum {
 	ND_Dirty,	/* 1: Device is dirty, needs sync. */
 	ND_Block,	/* 1: Device is a block device. */
 	ND_Sync,	/* 1: Device is mounted with "-o sync" */
+	ND_Metadata,	/* 1: Current access is for metadata, not file data */
+	ND_Uncached,	/* 1: Current access to file data bypasses the cache */
 } ntfs_device_state_bits;
 
 #define  test_ndev_flag(nd, flag)	   test_bit(ND_##flag, (nd)->d_state)
@@ -69,6 +71,14 @@ typedef enum {
 #define NDevSetSync(nd)		  set_ndev_flag(nd, Sync)
 #define NDevClearSync(nd)	clear_ndev_flag(nd, Sync)
 
+#define NDevMetadata(nd)	 test_ndev_flag(nd, Metadata)
+#define NDevSetMetadata(nd)	  set_ndev_flag(nd, Metadata)
+#define NDevClearMetadata(nd)	clear_ndev_flag(nd, Metadata)
+
+#define NDevUncached(nd)	 test_ndev_flag(nd, Uncached)
+#define NDevSetUncached(nd)	  set_ndev_flag(nd, Uncached)
+#define NDevClearUncached(nd)	clear_ndev_flag(nd, Uncached)
+
 /**
  * struct ntfs_device -
  *
@@ -94,6 +104,53 @@ struct ntfs_device {
 
 struct stat;
 
+/* ioctl discarding a byte range of the device, @argp points to a u64 offset
+ * and length. */
+#ifndef BLKDISCARD
+#define BLKDISCARD	0x1277
+#endif
+
+/* ioctl reading a byte range of the device into its cache ahead of use, @argp
+ * points to a u64 offset and length, the length being reduced to the bytes
+ * now cached when the cache can not hold the whole range. */
+#define NTFS_IOC_PREFETCH	0x4e01
+
+/* ioctl ending a phase of mounting, @argp points to an int ntfs_mount_phase,
+ * numbered as NTFS_MOUNT_PHASE_* in the public ntfs.h. */
+#define NTFS_IOC_MOUNT_PHASE	0x4e02
+
+/* ioctl starting to read a byte range of the device into its cache in the
+ * background, @argp points to a u64 offset and length. Fails with EBUSY if
+ * the previous one has not finished yet, or EOPNOTSUPP if the device can not
+ * read in the background. */
+#define NTFS_IOC_READAHEAD	0x4e03
+
+enum ntfs_mount_phase {
+	NTFS_PHASE_OPEN,
+	NTFS_PHASE_BOOT,
+	NTFS_PHASE_MFT,
+	NTFS_PHASE_MFTMIRR,
+	NTFS_PHASE_BITMAP,
+	NTFS_PHASE_UPCASE,
+	NTFS_PHASE_VOLUME,
+	NTFS_PHASE_ATTRDEF,
+	NTFS_PHASE_SECURE,
+	NTFS_PHASE_LOGFILE,
+	NTFS_PHASE_SETUP,
+};
+
+/**
+ * struct ntfs_io_vec -
+ *
+ * One fragment of a vectored transfer: @count bytes at device position @pos,
+ * read into or written from the data buffer @buf.
+ */
+struct ntfs_io_vec {
+	void *buf;
+	s64 count;
+	s64 pos;
+};
+
 /**
  * struct ntfs_device_operations -
  *
@@ -113,6 +170,11 @@ struct ntfs_device_operations {
 	int (*stat)(struct ntfs_device *dev, struct stat *buf);
 	int (*ioctl)(struct ntfs_device *dev, unsigned long request,
 			void *argp);
+	/* Optional, ntfs_preadv() and ntfs_pwritev() fall back to pread/pwrite */
+	s64 (*preadv)(struct ntfs_device *dev, const struct ntfs_io_vec *vec,
+			int vcnt);
+	s64 (*pwritev)(struct ntfs_device *dev, const struct ntfs_io_vec *vec,
+			int vcnt);
 };
 
 extern struct ntfs_device *ntfs_device_alloc(const char *name, const long state,
@@ -125,6 +187,11 @@ extern s64 ntfs_pread(struct ntfs_device *dev, const s64 pos, s64 count,
 extern s64 ntfs_pwrite(struct ntfs_device *dev, const s64 pos, s64 count,
 		const void *b);
 
+extern s64 ntfs_preadv(struct ntfs_device *dev,
+		const struct ntfs_io_vec *vec, int vcnt);
+extern s64 ntfs_pwritev(struct ntfs_device *dev,
+		const struct ntfs_io_vec *vec, int vcnt);
+
 extern s64 ntfs_mst_pread(struct ntfs_device *dev, const s64 pos, s64 count,
 		const u32 bksize, void *b);
 extern s64 ntfs_mst_pwrite(struct ntfs_device *dev, const s64 pos, s64 count,
@@ -90,29 +90,44 @@ ntfschar NTFS_INDEX_Q[3] = { const_cpu_to_le16('$'), const_cpu_to_le16('Q'),
 ntfschar NTFS_INDEX_R[3] = { const_cpu_to_le16('$'), const_cpu_to_le16('R'),
 		const_cpu_to_le16('\0') };
 
+#if CACHE_INODE_SIZE | CACHE_LOOKUP_SIZE | CACHE_CASE_INDEX_SIZE
+
+/*
+ *		Hash a name or a path (FNV-1a)
+ */
+
+static unsigned int ntfs_dir_name_hash(const unsigned char *name, int count)
+{
+	unsigned int val;
+
+	val = 2166136261U;
+	while (count--)
+		val = (val ^ *name++) * 16777619U;
+	return (val);
+}
+
+#endif
+
 #if CACHE_INODE_SIZE
 
 /*
  *		Pathname hashing
  *
- *	Based on first char and second char (which may be '\0')
+ *	Based on the whole path, as the names in a directory often
+ *	only differ near their end
  */
 
 int ntfs_dir_inode_hash(const struct CACHED_GENERIC *cached)
 {
 	const char *path;
-	const unsigned char *name;
 
 	path = (const char*)cached->variable;
 	if (!path) {
 		ntfs_log_error("Bad inode cache entry\n");
 		return (-1);
 	}
-	name = (const unsigned char*)strrchr(path,'/');
-	if (!name)
-		name = (const unsigned char*)path;
-	return (((name[0] << 1) + name[1] + strlen((const char*)name))
-				% (2*CACHE_INODE_SIZE));
+	return ((int)(ntfs_dir_name_hash((const unsigned char*)path,
+				strlen(path)) & 0x7fffffff));
 }
 
 /*
@@ -200,26 +215,682 @@ static int lookup_cache_inv_compare(const struct CACHED_GENERIC *cached,
 /*
  *		Lookup hashing
  *
- *	Based on first, second and and last char
+ *	Based on the whole name and the parent directory
  */
 
 int ntfs_dir_lookup_hash(const struct CACHED_GENERIC *cached)
 {
-	const unsigned char *name;
-	int count;
+	const struct CACHED_LOOKUP *c = (const struct CACHED_LOOKUP*) cached;
 	unsigned int val;
 
-	name = (const unsigned char*)cached->variable;
-	count = cached->varsize;
-	if (!name || !count) {
+	if (!c->name || !c->namesize) {
 		ntfs_log_error("Bad lookup cache entry\n");
 		return (-1);
 	}
-	val = (name[0] << 2) + (name[1] << 1) + name[count - 1] + count;
-	return (val % (2*CACHE_LOOKUP_SIZE));
+	val = ntfs_dir_name_hash((const unsigned char*)c->name, c->namesize)
+			^ (unsigned int)MREF(c->parent);
+	return ((int)(val & 0x7fffffff));
+}
+
+/*
+ *		Fetch the inode of a name in a directory from the lookup cache
+ *
+ *	The UTF-8 name is upcased when the volume ignores case, the same
+ *	way as ntfs_inode_lookup_by_mbsname() enters it
+ *
+ *	Returns the inode number
+ *		or -1 if not cached, or cached as not found
+ */
+
+static u64 lookup_cache_fetch(ntfs_volume *vol, u64 parent, const char *name)
+{
+	struct CACHED_LOOKUP item;
+	struct CACHED_LOOKUP *cached;
+	char *cached_name;
+	u64 inum;
+
+	inum = (u64)-1;
+	if (vol->lookup_cache) {
+		if (!NVolCaseSensitive(vol)) {
+			cached_name = ntfs_uppercase_mbs(name,
+				vol->upcase, vol->upcase_len);
+			item.name = cached_name;
+		} else {
+			cached_name = (char*)NULL;
+			item.name = name;
+		}
+		if (item.name) {
+			item.namesize = strlen(item.name) + 1;
+			item.parent = parent;
+			cached = (struct CACHED_LOOKUP*)ntfs_fetch_cache(
+					vol->lookup_cache,
+					GENERIC(&item), lookup_cache_compare);
+			if (cached)
+				inum = cached->inum;
+			free(cached_name);
+		}
+	}
+	return (inum);
+}
+
+/*
+ *		Enter a name which has been found into the lookup cache
+ */
+
+static void lookup_cache_enter(ntfs_volume *vol, u64 parent,
+			const char *name, u64 inum)
+{
+	struct CACHED_LOOKUP item;
+	char *cached_name;
+
+	if (vol->lookup_cache) {
+		if (!NVolCaseSensitive(vol)) {
+			cached_name = ntfs_uppercase_mbs(name,
+				vol->upcase, vol->upcase_len);
+			item.name = cached_name;
+		} else {
+			cached_name = (char*)NULL;
+			item.name = name;
+		}
+		if (item.name) {
+			item.namesize = strlen(item.name) + 1;
+			item.parent = parent;
+			item.inum = inum;
+			ntfs_enter_cache(vol->lookup_cache,
+					GENERIC(&item), lookup_cache_compare);
+			free(cached_name);
+		}
+	}
+}
+
+#endif
+
+#if CACHE_CASE_INDEX_SIZE
+
+/*
+ *		Case-insensitive name indexes
+ *
+ *	When names are looked up ignoring case, a directory which gets
+ *	searched repeatedly is given a hash table of its upcased names,
+ *	built by a single pass over its index. Later lookups in this
+ *	directory are then resolved without collating names along the
+ *	B+tree, and a name which is not in the table is not in the
+ *	directory.
+ *
+ *	The tables of a volume are kept most recently used first, and the
+ *	least recently used ones are dropped so that they stay within the
+ *	budget of the volume. The table of a directory is dropped whenever
+ *	a name is inserted into or removed from its index.
+ */
+
+#define CASE_INDEX_THRESHOLD 4	/* lookups before a table is built */
+#define CASE_INDEX_DIRS 32	/* directories tracked per volume */
+
+struct CASE_NAME {
+	struct CASE_NAME *next;
+	u64 mref;
+	unsigned int hash;
+	u8 len;
+	BOOL ambiguous;		/* other entries only differ by case */
+	ntfschar name[0];	/* upcased */
+} ;
+
+struct CASE_INDEX {
+	struct CASE_INDEX *next;
+	u64 dir_mref;		/* directory, with its sequence number */
+	unsigned int lookups;	/* lookups since the table was dropped */
+	unsigned int mask;	/* hash buckets minus one */
+	size_t size;		/* bytes accounted to the volume */
+	BOOL unindexed;		/* not worth a table, or too big for one */
+	struct CASE_NAME **buckets; /* NULL until built */
+} ;
+
+static void case_index_free_list(struct CASE_NAME *list)
+{
+	struct CASE_NAME *next;
+
+	while (list) {
+		next = list->next;
+		free(list);
+		list = next;
+	}
+}
+
+static void case_index_free(ntfs_volume *vol, struct CASE_INDEX *ci)
+{
+	unsigned int i;
+
+	if (ci->buckets) {
+		for (i=0; i<=ci->mask; i++)
+			case_index_free_list(ci->buckets[i]);
+		free(ci->buckets);
+	}
+	vol->case_index_size -= ci->size;
+	if (vol->budget)
+		ntfs_budget_release(vol->budget, NTFS_BUDGET_CASE_INDEX,
+				ci->size);
+	free(ci);
+}
+
+static BOOL case_index_charge(ntfs_volume *vol, size_t size)
+{
+	return (!vol->budget || ntfs_budget_charge(vol->budget,
+					NTFS_BUDGET_CASE_INDEX, size));
+}
+
+/*
+ *		Drop the least recently used tables when memory is wanted
+ *	elsewhere
+ *
+ *	The most recent one is kept, as it may be in the making.
+ */
+
+static void case_index_reclaim(void *data, size_t wanted)
+{
+	ntfs_volume *vol;
+	struct CASE_INDEX *prev;
+	size_t freed;
+
+	vol = (ntfs_volume*)data;
+	freed = 0;
+	while ((freed < wanted) && vol->case_index
+	    && vol->case_index->next) {
+		prev = vol->case_index;
+		while (prev->next->next)
+			prev = prev->next;
+		freed += prev->next->size;
+		case_index_free(vol, prev->next);
+		prev->next = (struct CASE_INDEX*)NULL;
+	}
+}
+
+/*
+ *		Collect the names in an index node
+ *
+ *	The names are upcased and prepended to *plist, until their
+ *	size gets over the limit.
+ *
+ *	Returns 0 if successful
+ *		-1 if there was an error (errno tells why)
+ */
+
+static int case_index_collect(ntfs_inode *dir_ni, struct CASE_NAME **plist,
+			INDEX_HEADER *ih, size_t *size, size_t limit)
+{
+	ntfs_volume *vol = dir_ni->vol;
+	INDEX_ENTRY *ie;
+	struct CASE_NAME *cn;
+	u8 *index_end;
+	u8 len;
+
+	index_end = (u8*)ih + le32_to_cpu(ih->index_length);
+	ie = (INDEX_ENTRY*)((u8*)ih + le32_to_cpu(ih->entries_offset));
+	for (;; ie = (INDEX_ENTRY*)((u8*)ie + le16_to_cpu(ie->length))) {
+		if (((u8*)ie + sizeof(INDEX_ENTRY_HEADER) > index_end)
+		    || ((u8*)ie + le16_to_cpu(ie->length) > index_end)) {
+			errno = EIO;
+			return (-1);
+		}
+		if (ie->ie_flags & INDEX_ENTRY_END)
+			break;
+		if (ntfs_index_entry_inconsistent(ie, COLLATION_FILE_NAME,
+				dir_ni->mft_no)) {
+			errno = EIO;
+			return (-1);
+		}
+		len = ie->key.file_name.file_name_length;
+		*size += sizeof(struct CASE_NAME) + len*sizeof(ntfschar);
+		if (*size > limit) {
+			errno = EFBIG;
+			return (-1);
+		}
+		cn = (struct CASE_NAME*)ntfs_malloc(sizeof(struct CASE_NAME)
+				+ len*sizeof(ntfschar));
+		if (!cn)
+			return (-1);
+		memcpy(cn->name, ie->key.file_name.file_name,
+				len*sizeof(ntfschar));
+		ntfs_name_upcase(cn->name, len, vol->upcase, vol->upcase_len);
+		cn->len = len;
+		cn->mref = le64_to_cpu(ie->indexed_file);
+		cn->hash = ntfs_dir_name_hash((const unsigned char*)cn->name,
+				len*sizeof(ntfschar));
+		cn->ambiguous = FALSE;
+		cn->next = *plist;
+		*plist = cn;
+	}
+	return (0);
+}
+
+/*
+ *		Collect all the names of a directory
+ *
+ *	The index root and the index blocks in use are scanned in the
+ *	order they are stored, which needs no collation. Directories
+ *	small enough for their index root are not worth a table.
+ *
+ *	Returns 0 if successful
+ *		-1 if there was an error (errno tells why)
+ */
+
+static int case_index_collect_all(ntfs_inode *dir_ni,
+			struct CASE_NAME **plist, size_t *size, size_t limit)
+{
+	ntfs_volume *vol = dir_ni->vol;
+	ntfs_attr_search_ctx *ctx;
+	INDEX_ROOT *ir;
+	INDEX_BLOCK *ib;
+	ntfs_attr *ia_na;
+	u8 *bmp;
+	s64 bmp_size;
+	s64 blocks;
+	s64 i;
+	VCN vcn;
+	u32 index_block_size;
+	u8 index_vcn_size_bits;
+	int err;
+
+	ctx = ntfs_attr_get_search_ctx(dir_ni, NULL);
+	if (!ctx)
+		return (-1);
+	if (ntfs_attr_lookup(AT_INDEX_ROOT, NTFS_INDEX_I30, 4,
+			CASE_SENSITIVE, 0, NULL, 0, ctx)) {
+		ntfs_attr_put_search_ctx(ctx);
+		return (-1);
+	}
+	ir = (INDEX_ROOT*)((u8*)ctx->attr +
+			le16_to_cpu(ctx->attr->value_offset));
+	index_block_size = le32_to_cpu(ir->index_block_size);
+	if (!(ir->index.ih_flags & LARGE_INDEX))
+		err = ENODATA;
+	else if ((index_block_size < NTFS_BLOCK_SIZE)
+	    || (index_block_size & (index_block_size - 1)))
+		err = EIO;
+	else if (case_index_collect(dir_ni, plist, &ir->index, size, limit))
+		err = errno;
+	else
+		err = 0;
+	ntfs_attr_put_search_ctx(ctx);
+	if (err) {
+		errno = err;
+		return (-1);
+	}
+	if (vol->cluster_size <= index_block_size)
+		index_vcn_size_bits = vol->cluster_size_bits;
+	else
+		index_vcn_size_bits = NTFS_BLOCK_SIZE_BITS;
+
+	bmp = (u8*)NULL;
+	ib = (INDEX_BLOCK*)NULL;
+	ia_na = ntfs_attr_open(dir_ni, AT_INDEX_ALLOCATION,
+			NTFS_INDEX_I30, 4);
+	if (ia_na) {
+		bmp = (u8*)ntfs_attr_readall(dir_ni, AT_BITMAP,
+				NTFS_INDEX_I30, 4, &bmp_size);
+		ib = (INDEX_BLOCK*)ntfs_malloc(index_block_size);
+	}
+	if (!ia_na || !bmp || !ib)
+		err = (errno ? errno : EIO);
+	else {
+		blocks = ia_na->data_size/index_block_size;
+		if (blocks > (bmp_size << 3))
+			blocks = bmp_size << 3;
+		for (i=0; !err && (i<blocks); i++) {
+			if (!(bmp[i >> 3] & (1 << (i & 7))))
+				continue;
+			vcn = (i*index_block_size) >> index_vcn_size_bits;
+			if ((ntfs_attr_mst_pread(ia_na, i*index_block_size,
+					1, index_block_size, ib) != 1)
+			    || ntfs_index_block_inconsistent(ib,
+					index_block_size, dir_ni->mft_no, vcn))
+				err = EIO;
+			else if (case_index_collect(dir_ni, plist,
+					&ib->index, size, limit))
+				err = errno;
+		}
+	}
+	free(ib);
+	free(bmp);
+	if (ia_na)
+		ntfs_attr_close(ia_na);
+	if (err) {
+		errno = err;
+		return (-1);
+	}
+	return (0);
+}
+
+/*
+ *		Build the table of a directory
+ *
+ *	Names which only differ by case can be found in POSIX namespace.
+ *	They are marked ambiguous, so that the B+tree decides which one
+ *	is meant, as it does without a table.
+ *
+ *	If the table cannot be built, the directory is marked unindexed
+ *	until its table is dropped.
+ */
+
+static void case_index_build(ntfs_inode *dir_ni, struct CASE_INDEX *ci)
+{
+	ntfs_volume *vol = dir_ni->vol;
+	struct CASE_NAME *list;
+	struct CASE_NAME *cn;
+	struct CASE_NAME *old;
+	struct CASE_NAME **buckets;
+	struct CASE_INDEX *prev;
+	size_t size;
+	size_t limit;
+	unsigned int count;
+	unsigned int mask;
+
+	list = (struct CASE_NAME*)NULL;
+	size = 0;
+	limit = (vol->case_index_budget > ci->size
+			? vol->case_index_budget - ci->size : 0);
+	if (case_index_collect_all(dir_ni, &list, &size, limit)) {
+		case_index_free_list(list);
+		ci->unindexed = TRUE;
+		return;
+	}
+	count = 0;
+	for (cn=list; cn; cn=cn->next)
+		count++;
+	mask = 15;
+	while ((mask < count) && (mask < 0x7fffffff))
+		mask = 2*mask + 1;
+	size += (mask + 1)*sizeof(struct CASE_NAME*);
+	buckets = (struct CASE_NAME**)NULL;
+	if ((size <= limit) && case_index_charge(vol, size)) {
+		buckets = (struct CASE_NAME**)ntfs_calloc(
+				(mask + 1)*sizeof(struct CASE_NAME*));
+		if (!buckets && vol->budget)
+			ntfs_budget_release(vol->budget,
+					NTFS_BUDGET_CASE_INDEX, size);
+	}
+	if (!buckets) {
+		case_index_free_list(list);
+		ci->unindexed = TRUE;
+		return;
+	}
+	while (list) {
+		cn = list;
+		list = cn->next;
+		old = buckets[cn->hash & mask];
+		while (old && ((old->hash != cn->hash)
+				|| (old->len != cn->len)
+				|| memcmp(old->name, cn->name,
+					cn->len*sizeof(ntfschar))))
+			old = old->next;
+		if (old) {
+				/* the long and short name of a file */
+			if (old->mref != cn->mref)
+				old->ambiguous = TRUE;
+			free(cn);
+		} else {
+			cn->next = buckets[cn->hash & mask];
+			buckets[cn->hash & mask] = cn;
+		}
+	}
+	ci->buckets = buckets;
+	ci->mask = mask;
+	ci->size += size;
+	vol->case_index_size += size;
+		/* drop the least recently used tables to make room */
+	while (vol->case_index_size > vol->case_index_budget) {
+		prev = vol->case_index;
+		while (prev->next && prev->next->next)
+			prev = prev->next;
+		if (!prev->next)
+			break;
+		case_index_free(vol, prev->next);
+		prev->next = (struct CASE_INDEX*)NULL;
+	}
+}
+
+/*
+ *		Look up a name in the table of a directory
+ *
+ *	The directory is first moved to the head of the tables, and
+ *	its table is built once it has been searched often enough.
+ *
+ *	Returns 1 if the name was found (its reference in *pmref)
+ *		0 if it is not in the directory
+ *		-1 if the B+tree has to be searched
+ */
+
+static int case_index_lookup(ntfs_inode *dir_ni, const ntfschar *uname,
+			int uname_len, u64 *pmref)
+{
+	ntfs_volume *vol = dir_ni->vol;
+	struct CASE_INDEX *ci;
+	struct CASE_INDEX *prev;
+	struct CASE_INDEX *last;
+	struct CASE_NAME *cn;
+	ntfschar upname[NTFS_MAX_NAME_LEN];
+	unsigned int hash;
+	u64 dir_mref;
+	int count;
+
+	dir_mref = MK_MREF(dir_ni->mft_no,
+			le16_to_cpu(dir_ni->mrec->sequence_number));
+	prev = last = (struct CASE_INDEX*)NULL;
+	count = 0;
+	for (ci=vol->case_index; ci && (ci->dir_mref != dir_mref);
+	     ci=ci->next) {
+		if (ci->next)
+			last = ci;
+		prev = ci;
+		count++;
+	}
+	if (ci) {
+		if (prev) {
+			prev->next = ci->next;
+			ci->next = vol->case_index;
+			vol->case_index = ci;
+		}
+	} else {
+		if ((count >= CASE_INDEX_DIRS) && last) {
+			case_index_free(vol, last->next);
+			last->next = (struct CASE_INDEX*)NULL;
+		}
+		if (!case_index_charge(vol, sizeof(struct CASE_INDEX)))
+			return (-1);
+		ci = (struct CASE_INDEX*)ntfs_calloc(
+				sizeof(struct CASE_INDEX));
+		if (!ci) {
+			if (vol->budget)
+				ntfs_budget_release(vol->budget,
+					NTFS_BUDGET_CASE_INDEX,
+					sizeof(struct CASE_INDEX));
+			return (-1);
+		}
+		ci->dir_mref = dir_mref;
+		ci->size = sizeof(struct CASE_INDEX);
+		vol->case_index_size += ci->size;
+		ci->next = vol->case_index;
+		vol->case_index = ci;
+	}
+	if (!ci->buckets) {
+		if (ci->unindexed || (++ci->lookups < CASE_INDEX_THRESHOLD))
+			return (-1);
+		case_index_build(dir_ni, ci);
+		if (!ci->buckets)
+			return (-1);
+	}
+	if (uname_len > NTFS_MAX_NAME_LEN)
+		return (-1);
+	memcpy(upname, uname, uname_len*sizeof(ntfschar));
+	ntfs_name_upcase(upname, uname_len, vol->upcase, vol->upcase_len);
+	hash = ntfs_dir_name_hash((const unsigned char*)upname,
+			uname_len*sizeof(ntfschar));
+	cn = ci->buckets[hash & ci->mask];
+	while (cn && ((cn->hash != hash)
+			|| (cn->len != uname_len)
+			|| memcmp(cn->name, upname,
+				uname_len*sizeof(ntfschar))))
+		cn = cn->next;
+	if (!cn)
+		return (0);
+	if (cn->ambiguous)
+		return (-1);
+	*pmref = cn->mref;
+	return (1);
 }
 
+#endif /* CACHE_CASE_INDEX_SIZE */
+
+/*
+ *		Drop the case-insensitive name index of a directory
+ *
+ *	To be called before a name is inserted into or removed from
+ *	the index of the directory.
+ */
+
+void ntfs_drop_case_index(ntfs_inode *dir_ni)
+{
+#if CACHE_CASE_INDEX_SIZE
+	ntfs_volume *vol = dir_ni->vol;
+	struct CASE_INDEX *ci;
+	struct CASE_INDEX **pprev;
+
+	for (pprev=&vol->case_index; *pprev; pprev=&(*pprev)->next) {
+		ci = *pprev;
+		if (MREF(ci->dir_mref) == dir_ni->mft_no) {
+			*pprev = ci->next;
+			case_index_free(vol, ci);
+			break;
+		}
+	}
 #endif
+}
+
+/*
+ *		Set the bytes the case-insensitive name indexes may use,
+ *	zero to disable them
+ *
+ *	On a volume with a memory budget, they also draw from it, and
+ *	give their least recently used tables back to other components.
+ *	To be called once, before any lookup.
+ */
+
+void ntfs_set_case_index_budget(ntfs_volume *vol, size_t size)
+{
+#if CACHE_CASE_INDEX_SIZE
+	vol->case_index_budget = size;
+	if (vol->budget && size) {
+		vol->case_index_reclaimer.reclaim = case_index_reclaim;
+		vol->case_index_reclaimer.data = vol;
+		vol->case_index_reclaimer.component = NTFS_BUDGET_CASE_INDEX;
+		vol->case_index_reclaimer.priority = NTFS_RECLAIM_CASE_INDEX;
+		ntfs_budget_register(vol->budget, &vol->case_index_reclaimer);
+	}
+#endif
+}
+
+/*
+ *		Free all the case-insensitive name indexes of a volume
+ */
+
+void ntfs_free_case_indexes(ntfs_volume *vol)
+{
+#if CACHE_CASE_INDEX_SIZE
+	struct CASE_INDEX *ci;
+
+	if (vol->budget && vol->case_index_budget)
+		ntfs_budget_unregister(vol->budget,
+				&vol->case_index_reclaimer);
+
+	while (vol->case_index) {
+		ci = vol->case_index;
+		vol->case_index = ci->next;
+		case_index_free(vol, ci);
+	}
+#endif
+}
+
+/*
+ *		Search an index node for a name
+ *
+ *	The entries of the node are located, checking their bounds and
+ *	consistency, then searched by bisection for the first one the name
+ *	does not collate after, so that only a few names have to be collated.
+ *	As the index is ordered on names compared case-sensitively, this is
+ *	the entry a linear search would stop on, whatever the case
+ *	sensitivity. Entries are handled DIR_SEARCH_ENTRIES at a time, which
+ *	covers a full node of usual size.
+ *
+ *	Returns the entry found, possibly the end entry of the node, with
+ *		*prc set to 0 if it matches the name,
+ *	or NULL if the node is inconsistent (errno set)
+ */
+
+#define DIR_SEARCH_ENTRIES 64
+
+static INDEX_ENTRY *ntfs_dir_node_search(ntfs_inode *dir_ni,
+		INDEX_ENTRY *ie, const u8 *index_start, const u8 *index_end,
+		const ntfschar *uname, const ntfschar *upname,
+		const int uname_len, IGNORE_CASE_BOOL case_sensitivity,
+		int *prc)
+{
+	INDEX_ENTRY *tab[DIR_SEARCH_ENTRIES];
+	ntfs_volume *vol = dir_ni->vol;
+	int cnt, lo, hi, mid, rc;
+	BOOL end;
+
+	do {
+		end = FALSE;
+		for (cnt = 0; !end && (cnt < DIR_SEARCH_ENTRIES);
+		    ie = (INDEX_ENTRY*)((u8*)ie + le16_to_cpu(ie->length))) {
+			/* Bounds checks. */
+			if ((const u8*)ie < index_start || (const u8*)ie +
+					sizeof(INDEX_ENTRY_HEADER) > index_end ||
+					(const u8*)ie + le16_to_cpu(ie->length) >
+					index_end) {
+				ntfs_log_error("Index entry out of bounds in "
+					"directory inode %lld.\n",
+					(unsigned long long)dir_ni->mft_no);
+				errno = EIO;
+				return ((INDEX_ENTRY*)NULL);
+			}
+			tab[cnt++] = ie;
+			/*
+			 * The last entry cannot contain a name. It can however
+			 * contain a pointer to a child node in the B+tree.
+			 */
+			if (ie->ie_flags & INDEX_ENTRY_END)
+				end = TRUE;
+			/* The file name must not overflow from the entry */
+			else if (ntfs_index_entry_inconsistent(ie,
+					COLLATION_FILE_NAME, dir_ni->mft_no)) {
+				errno = EIO;
+				return ((INDEX_ENTRY*)NULL);
+			}
+		}
+			/* the end entry collates after any name */
+		lo = 0;
+		hi = (end ? cnt - 1 : cnt);
+		while (lo < hi) {
+			mid = (lo + hi) >> 1;
+			rc = ntfs_names_full_collate_upcased(uname, upname,
+				uname_len,
+				(ntfschar*)&tab[mid]->key.file_name.file_name,
+				tab[mid]->key.file_name.file_name_length,
+				case_sensitivity, vol->upcase, vol->upcase_len);
+			if (!rc) {
+				*prc = 0;
+				return (tab[mid]);
+			}
+			if (rc < 0)
+				hi = mid;
+			else
+				lo = mid + 1;
+		}
+		/* go on with the next entries if the name is after these */
+	} while (!end && (lo == cnt));
+	*prc = -1;
+	return (tab[lo]);
+}
 
 /**
  * ntfs_inode_lookup_by_name - find an inode in a directory given its name
@@ -263,6 +934,7 @@ u64 ntfs_inode_lookup_by_name(ntfs_inode *dir_ni,
 	int eo, rc;
 	u32 index_block_size;
 	u8 index_vcn_size_bits;
+	ntfschar upname[NTFS_MAX_NAME_LEN];
 
 	ntfs_log_trace("Entering\n");
 
@@ -270,6 +942,26 @@ u64 ntfs_inode_lookup_by_name(ntfs_inode *dir_ni,
 		errno = EINVAL;
 		return -1;
 	}
+		/* no longer names can be indexed */
+	if (uname_len > NTFS_MAX_NAME_LEN) {
+		errno = ENOENT;
+		return -1;
+	}
+
+#if CACHE_CASE_INDEX_SIZE
+	if (!NVolCaseSensitive(vol) && vol->case_index_budget) {
+		switch (case_index_lookup(dir_ni, uname, uname_len, &mref)) {
+		case 1 :
+			return mref;
+		case 0 :
+			errno = ENOENT;
+			return -1;
+		default :
+			mref = 0;
+			break;
+		}
+	}
+#endif
 
 	ctx = ntfs_attr_get_search_ctx(dir_ni, NULL);
 	if (!ctx)
@@ -283,6 +975,9 @@ u64 ntfs_inode_lookup_by_name(ntfs_inode *dir_ni,
 		goto put_err_out;
 	}
 	case_sensitivity = (NVolCaseSensitive(vol) ? CASE_SENSITIVE : IGNORE_CASE);
+		/* Upcase the name once for all the collations */
+	memcpy(upname, uname, uname_len*sizeof(ntfschar));
+	ntfs_name_upcase(upname, uname_len, vol->upcase, vol->upcase_len);
 	/* Get to the index root value. */
 	ir = (INDEX_ROOT*)((u8*)ctx->attr +
 			le16_to_cpu(ctx->attr->value_offset));
@@ -299,56 +994,14 @@ u64 ntfs_inode_lookup_by_name(ntfs_inode *dir_ni,
 	ie = (INDEX_ENTRY*)((u8*)&ir->index +
 			le32_to_cpu(ir->index.entries_offset));
 	/*
-	 * Loop until we exceed valid memory (corruption case) or until we
-	 * reach the last entry.
+	 * Search the entries, stopping on the match or on the entry
+	 * to descend from.
 	 */
-	for (;; ie = (INDEX_ENTRY*)((u8*)ie + le16_to_cpu(ie->length))) {
-		/* Bounds checks. */
-		if ((u8*)ie < (u8*)ctx->mrec || (u8*)ie +
-				sizeof(INDEX_ENTRY_HEADER) > index_end ||
-				(u8*)ie + le16_to_cpu(ie->length) >
-				index_end) {
-			ntfs_log_error("Index root entry out of bounds in"
-				" inode %lld\n",
-				(unsigned long long)dir_ni->mft_no);
-			goto put_err_out;
-		}
-		/*
-		 * The last entry cannot contain a name. It can however contain
-		 * a pointer to a child node in the B+tree so we just break out.
-		 */
-		if (ie->ie_flags & INDEX_ENTRY_END)
-			break;
-		
-		/* The file name must not overflow from the entry */
-		if (ntfs_index_entry_inconsistent(ie, COLLATION_FILE_NAME,
-				dir_ni->mft_no)) {
-			errno = EIO;
-			goto put_err_out;
-		}
-		/*
-		 * Not a perfect match, need to do full blown collation so we
-		 * know which way in the B+tree we have to go.
-		 */
-		rc = ntfs_names_full_collate(uname, uname_len,
-				(ntfschar*)&ie->key.file_name.file_name,
-				ie->key.file_name.file_name_length,
-				case_sensitivity, vol->upcase, vol->upcase_len);
-		/*
-		 * If uname collates before the name of the current entry, there
-		 * is definitely no such name in this index but we might need to
-		 * descend into the B+tree so we just break out of the loop.
-		 */
-		if (rc == -1)
-			break;
-		/* The names are not equal, continue the search. */
-		if (rc)
-			continue;
-		/*
-		 * Perfect match, this will never happen as the
-		 * ntfs_are_names_equal() call will have gotten a match but we
-		 * still treat it correctly.
-		 */
+	ie = ntfs_dir_node_search(dir_ni, ie, (u8*)ctx->mrec, index_end,
+			uname, upname, uname_len, case_sensitivity, &rc);
+	if (!ie)
+		goto put_err_out;
+	if (!rc) {
 		mref = le64_to_cpu(ie->indexed_file);
 		ntfs_attr_put_search_ctx(ctx);
 		return mref;
@@ -417,54 +1070,11 @@ descend_into_child_node:
 	/* The first index entry. */
 	ie = (INDEX_ENTRY*)((u8*)&ia->index +
 			le32_to_cpu(ia->index.entries_offset));
-	/*
-	 * Iterate similar to above big loop but applied to index buffer, thus
-	 * loop until we exceed valid memory (corruption case) or until we
-	 * reach the last entry.
-	 */
-	for (;; ie = (INDEX_ENTRY*)((u8*)ie + le16_to_cpu(ie->length))) {
-		/* Bounds check. */
-		if ((u8*)ie < (u8*)ia || (u8*)ie +
-				sizeof(INDEX_ENTRY_HEADER) > index_end ||
-				(u8*)ie + le16_to_cpu(ie->length) >
-				index_end) {
-			ntfs_log_error("Index entry out of bounds in directory "
-				       "inode %lld.\n", 
-				       (unsigned long long)dir_ni->mft_no);
-			errno = EIO;
-			goto close_err_out;
-		}
-		/*
-		 * The last entry cannot contain a name. It can however contain
-		 * a pointer to a child node in the B+tree so we just break out.
-		 */
-		if (ie->ie_flags & INDEX_ENTRY_END)
-			break;
-		
-		/* The file name must not overflow from the entry */
-		if (ntfs_index_entry_inconsistent(ie, COLLATION_FILE_NAME,
-				dir_ni->mft_no)) {
-			errno = EIO;
-			goto close_err_out;
-		}
-		/*
-		 * Not a perfect match, need to do full blown collation so we
-		 * know which way in the B+tree we have to go.
-		 */
-		rc = ntfs_names_full_collate(uname, uname_len,
-				(ntfschar*)&ie->key.file_name.file_name,
-				ie->key.file_name.file_name_length,
-				case_sensitivity, vol->upcase, vol->upcase_len);
-		/*
-		 * If uname collates before the name of the current entry, there
-		 * is definitely no such name in this index but we might need to
-		 * descend into the B+tree so we just break out of the loop.
-		 */
-		if (rc == -1)
-			break;
-		/* The names are not equal, continue the search. */
-		if (rc)
-			continue;
+	ie = ntfs_dir_node_search(dir_ni, ie, (u8*)ia, index_end,
+			uname, upname, uname_len, case_sensitivity, &rc);
+	if (!ie)
+		goto close_err_out;
+	if (!rc) {
 		mref = le64_to_cpu(ie->indexed_file);
 		free(ia);
 		ntfs_attr_close(ia_na);
@@ -652,12 +1262,12 @@ void ntfs_inode_update_mbsname(ntfs_inode *dir_ni, const char *name, u64 inum)
 ntfs_inode *ntfs_pathname_to_inode(ntfs_volume *vol, ntfs_inode *parent,
 		const char *pathname)
 {
-	u64 inum;
+	u64 inum, next;
 	int len, err = 0;
 	char *p, *q;
 	ntfs_inode *ni;
 	ntfs_inode *result = NULL;
-	ntfschar *unicode = NULL;
+	ntfschar unicode[NTFS_MAX_NAME_LEN + 1];
 	char *ascii = NULL;
 #if CACHE_INODE_SIZE
 	struct CACHED_INODE item;
@@ -690,6 +1300,7 @@ ntfs_inode *ntfs_pathname_to_inode(ntfs_volume *vol, ntfs_inode *parent,
 #endif
 	if (parent) {
 		ni = parent;
+		inum = parent->mft_no;
 	} else {
 #if CACHE_INODE_SIZE
 			/*
@@ -718,14 +1329,12 @@ ntfs_inode *ntfs_pathname_to_inode(ntfs_volume *vol, ntfs_inode *parent,
 			goto out;
 		}
 #endif
-		ni = ntfs_inode_open(vol, FILE_root);
-		if (!ni) {
-			ntfs_log_debug("Couldn't open the inode of the root "
-					"directory.\n");
-			err = EIO;
-			result = (ntfs_inode*)NULL;
-			goto out;
-		}
+			/*
+			 * directories are only opened when a name has to
+			 * be searched for in their index
+			 */
+		ni = (ntfs_inode*)NULL;
+		inum = FILE_root;
 	}
 
 	while (p && *p) {
@@ -734,6 +1343,7 @@ ntfs_inode *ntfs_pathname_to_inode(ntfs_volume *vol, ntfs_inode *parent,
 		if (q != NULL) {
 			*q = '\0';
 		}
+		next = (u64)-1;
 #if CACHE_INODE_SIZE
 			/*
 			 * fetch inode for partial path from cache
@@ -746,76 +1356,85 @@ ntfs_inode *ntfs_pathname_to_inode(ntfs_volume *vol, ntfs_inode *parent,
 					vol->xinode_cache, GENERIC(&item),
 					inode_cache_compare);
 			if (cached) {
-				inum = cached->inum;
+				next = cached->inum;
 			}
 		}
+#endif
+#if CACHE_LOOKUP_SIZE
 			/*
-			 * if not in cache, translate, search, then
-			 * insert into cache if found
+			 * fetch inode for name in parent from cache
 			 */
-		if (!cached) {
-			len = ntfs_mbstoucs(p, &unicode);
+		if (next == (u64)-1)
+			next = lookup_cache_fetch(vol, MREF(inum), p);
+#endif
+			/*
+			 * if not in cache, translate, then search the
+			 * directory opened if not done yet
+			 */
+		if (next == (u64)-1) {
+			len = ntfs_mbstoucs_buf(p, unicode,
+					NTFS_MAX_NAME_LEN + 1);
 			if (len < 0) {
-				ntfs_log_perror("Could not convert filename to Unicode:"
-					" '%s'", p);
 				err = errno;
-				goto close;
-			} else if (len > NTFS_MAX_NAME_LEN) {
-				err = ENAMETOOLONG;
+				if (err != ENAMETOOLONG)
+					ntfs_log_perror("Could not convert filename"
+						" to Unicode: '%s'", p);
 				goto close;
 			}
-			inum = ntfs_inode_lookup_by_name(ni, unicode, len);
-			if (!parent && (inum != (u64) -1)) {
-				item.inum = inum;
-				ntfs_enter_cache(vol->xinode_cache,
-						GENERIC(&item),
-						inode_cache_compare);
+			if (!ni) {
+				ni = ntfs_inode_open(vol, MREF(inum));
+				if (!ni) {
+					ntfs_log_debug("Cannot open inode %llu.\n",
+						(unsigned long long)MREF(inum));
+					err = EIO;
+					goto close;
+				}
 			}
+			next = ntfs_inode_lookup_by_name(ni, unicode, len);
+			if (next == (u64) -1) {
+				ntfs_log_debug("Couldn't find name '%s' in pathname "
+						"'%s'.\n", p, pathname);
+				err = ENOENT;
+				goto close;
+			}
+#if CACHE_LOOKUP_SIZE
+			lookup_cache_enter(vol, MREF(inum), p, next);
+#endif
 		}
-#else
-		len = ntfs_mbstoucs(p, &unicode);
-		if (len < 0) {
-			ntfs_log_perror("Could not convert filename to Unicode:"
-					" '%s'", p);
-			err = errno;
-			goto close;
-		} else if (len > NTFS_MAX_NAME_LEN) {
-			err = ENAMETOOLONG;
-			goto close;
+#if CACHE_INODE_SIZE
+			/* insert into cache if found otherwise */
+		if (!parent && !cached) {
+			item.inum = next;
+			ntfs_enter_cache(vol->xinode_cache,
+					GENERIC(&item),
+					inode_cache_compare);
 		}
-		inum = ntfs_inode_lookup_by_name(ni, unicode, len);
 #endif
-		if (inum == (u64) -1) {
-			ntfs_log_debug("Couldn't find name '%s' in pathname "
-					"'%s'.\n", p, pathname);
-			err = ENOENT;
-			goto close;
-		}
 
-		if (ni != parent)
+		if (ni && (ni != parent))
 			if (ntfs_inode_close(ni)) {
+				ni = (ntfs_inode*)NULL;
 				err = errno;
 				goto out;
 			}
+		ni = (ntfs_inode*)NULL;
+		inum = MREF(next);
+
+		if (q) *q++ = PATH_SEP; /* JPA */
+		p = q;
+		while (p && *p && *p == PATH_SEP)
+			p++;
+	}
 
-		inum = MREF(inum);
+	if (!ni) {
 		ni = ntfs_inode_open(vol, inum);
 		if (!ni) {
 			ntfs_log_debug("Cannot open inode %llu: %s.\n",
-					(unsigned long long)inum, p);
+					(unsigned long long)inum, pathname);
 			err = EIO;
 			goto close;
 		}
-	
-		free(unicode);
-		unicode = NULL;
-
-		if (q) *q++ = PATH_SEP; /* JPA */
-		p = q;
-		while (p && *p && *p == PATH_SEP)
-			p++;
 	}
-
 	result = ni;
 	ni = NULL;
 close:
@@ -824,7 +1443,6 @@ close:
 			err = errno;
 out:
 	free(ascii);
-	free(unicode);
 	if (err)
 		errno = err;
 	return result;
@@ -958,7 +1576,7 @@ static u32 ntfs_dir_entry_type(ntfs_inode *dir_ni, MFT_REF mref,
  */
 static int ntfs_filldir(ntfs_inode *dir_ni, s64 *pos, u8 ivcn_bits,
 		const INDEX_TYPE index_type, index_union iu, INDEX_ENTRY *ie,
-		void *dirent, ntfs_filldir_t filldir)
+		void *dirent, ntfs_filldir_fn_t filldir)
 {
 	FILE_NAME_ATTR *fn = &ie->key.file_name;
 	unsigned dt_type;
@@ -1001,7 +1619,7 @@ static int ntfs_filldir(ntfs_inode *dir_ni, s64 *pos, u8 ivcn_bits,
 			res = filldir(dirent, fn->file_name,
 					fn->file_name_length,
 					fn->file_name_type, *pos,
-					mref, dt_type);
+					mref, dt_type, fn);
 		} else {
 			loname = (ntfschar*)ntfs_malloc(2*fn->file_name_length);
 			if (loname) {
@@ -1013,7 +1631,7 @@ static int ntfs_filldir(ntfs_inode *dir_ni, s64 *pos, u8 ivcn_bits,
 				res = filldir(dirent, loname,
 					fn->file_name_length,
 					fn->file_name_type, *pos,
-					mref, dt_type);
+					mref, dt_type, fn);
 				free(loname);
 			} else
 				res = -1;
@@ -1082,6 +1700,27 @@ err_out:
 	return ERR_MREF(-1);
 }
 
+struct READDIR_CONTEXT {
+	void *dirent;
+	ntfs_filldir_t filldir;
+} ;
+
+/*
+ *		Hand an entry to a filldir callback which does not want
+ *		the file name attribute
+ */
+
+static int ntfs_filldir_nofn(void *context, const ntfschar *name,
+		const int name_len, const int name_type, const s64 pos,
+		const MFT_REF mref, const unsigned dt_type,
+		const FILE_NAME_ATTR *fn __attribute__((unused)))
+{
+	struct READDIR_CONTEXT *ctx = (struct READDIR_CONTEXT*)context;
+
+	return (ctx->filldir(ctx->dirent, name, name_len, name_type,
+			pos, mref, dt_type));
+}
+
 /**
  * ntfs_readdir - read the contents of an ntfs directory
  * @dir_ni:	ntfs inode of current directory
@@ -1101,7 +1740,34 @@ err_out:
 int ntfs_readdir(ntfs_inode *dir_ni, s64 *pos,
 		void *dirent, ntfs_filldir_t filldir)
 {
-	s64 i_size, br, ia_pos, bmp_pos, ia_start;
+	struct READDIR_CONTEXT ctx;
+
+	if (!filldir) {
+		errno = EINVAL;
+		return -1;
+	}
+	ctx.dirent = dirent;
+	ctx.filldir = filldir;
+	return (ntfs_readdir_fn(dir_ni, pos, &ctx, ntfs_filldir_nofn));
+}
+
+/**
+ * ntfs_readdir_fn - read the contents of an ntfs directory
+ * @dir_ni:	ntfs inode of current directory
+ * @pos:	current position in directory
+ * @dirent:	context for filldir callback supplied by the caller
+ * @filldir:	filldir callback supplied by the caller
+ *
+ * Same as ntfs_readdir(), but the callback is also given the file name
+ * attribute held in the index entry, with the sizes and times recorded in
+ * the directory. It is NULL for the emulated "." and ".." entries.
+ *
+ * Return 0 on success or -1 on error with errno set to the error code.
+ */
+int ntfs_readdir_fn(ntfs_inode *dir_ni, s64 *pos,
+		void *dirent, ntfs_filldir_fn_t filldir)
+{
+	s64 i_size, br, ia_pos, bmp_pos, ia_start, prefetch_end;
 	ntfs_volume *vol;
 	ntfs_attr *ia_na, *bmp_na = NULL;
 	ntfs_attr_search_ctx *ctx = NULL;
@@ -1154,7 +1820,7 @@ int ntfs_readdir(ntfs_inode *dir_ni, s64 *pos,
 		rc = filldir(dirent, dotdot, 1, FILE_NAME_POSIX, *pos,
 				MK_MREF(dir_ni->mft_no,
 				le16_to_cpu(dir_ni->mrec->sequence_number)),
-				NTFS_DT_DIR);
+				NTFS_DT_DIR, NULL);
 		if (rc)
 			goto err_out;
 		++*pos;
@@ -1169,7 +1835,7 @@ int ntfs_readdir(ntfs_inode *dir_ni, s64 *pos,
 		}
 
 		rc = filldir(dirent, dotdot, 2, FILE_NAME_POSIX, *pos,
-				parent_mref, NTFS_DT_DIR);
+				parent_mref, NTFS_DT_DIR, NULL);
 		if (rc)
 			goto err_out;
 		++*pos;
@@ -1292,6 +1958,7 @@ skip_index_root:
 
 	/* Get the offset into the index allocation attribute. */
 	ia_pos = *pos - vol->mft_record_size;
+	prefetch_end = ia_pos;
 
 	bmp_pos = ia_pos >> index_block_size_bits;
 	if (bmp_pos >> 3 >= bmp_na->data_size) {
@@ -1313,7 +1980,8 @@ skip_index_root:
 		goto err_out;
 	}
 
-	bmp_buf_pos = 0;
+	/* The buffer starts at the byte holding the bit for bmp_pos. */
+	bmp_buf_pos = bmp_pos & 7;
 	/* If the index block is not in use find the next one that is. */
 	while (!(bmp[bmp_buf_pos >> 3] & (1 << (bmp_buf_pos & 7)))) {
 find_next_index_buffer:
@@ -1340,6 +2008,17 @@ find_next_index_buffer:
 
 	ntfs_log_debug("Handling index block 0x%llx.\n", (long long)bmp_pos);
 
+	/*
+	 * Load the index blocks from here on into the cache with large
+	 * reads, rather than reading them one by one in between handing
+	 * out their entries. This is repeated whenever the walk passes
+	 * the end of what the cache could take.
+	 */
+	if (ia_pos >= prefetch_end) {
+		br = ntfs_attr_prefetch(ia_na, ia_pos, i_size - ia_pos);
+		prefetch_end = (br > 0 ? ia_pos + br : i_size);
+	}
+
 	/* Read the index block starting at bmp_pos. */
 	br = ntfs_attr_mst_pread(ia_na, bmp_pos << index_block_size_bits, 1,
 			index_block_size, ia);
@@ -1434,6 +2113,100 @@ err_out:
 }
 
 
+/**
+ * ntfs_readdir_from - read a directory in collation order from a given name
+ * @dir_ni:	ntfs inode of current directory
+ * @name:	unicode name to start from
+ * @name_len:	length of the name in unicode characters, may be zero
+ * @dirent:	context for filldir callback supplied by the caller
+ * @filldir:	filldir callback supplied by the caller
+ *
+ * Look @name up in the index of @dir_ni, then walk the index forward from
+ * there, handing each entry which collates the same as or after @name to the
+ * @filldir callback supplied by the caller, as ntfs_readdir_fn() does. The
+ * entries come sorted the way the index collates them, which is by their
+ * upcased names, and only the blocks on the path to each of them are read,
+ * so that a caller wanting a few entries after a name stops early at little
+ * cost. The "." and ".." entries are not emulated.
+ *
+ * Return 0 once the end of the index is reached, or -1 if the @filldir
+ * callback stopped the walk or on error with errno set to the error code.
+ */
+int ntfs_readdir_from(ntfs_inode *dir_ni, const ntfschar *name, u8 name_len,
+		void *dirent, ntfs_filldir_fn_t filldir)
+{
+	ntfs_index_context *icx;
+	FILE_NAME_ATTR *key;
+	INDEX_ENTRY *ie;
+	s64 pos;
+	int key_len, rc, eo;
+
+	if (!dir_ni || (name_len && !name) || !filldir) {
+		errno = EINVAL;
+		return -1;
+	}
+	if (!(dir_ni->mrec->flags & MFT_RECORD_IS_DIRECTORY)) {
+		errno = ENOTDIR;
+		return -1;
+	}
+
+	key_len = offsetof(FILE_NAME_ATTR, file_name)
+			+ name_len * sizeof(ntfschar);
+	key = (FILE_NAME_ATTR*)ntfs_calloc(key_len);
+	if (!key)
+		return -1;
+	key->file_name_length = name_len;
+	if (name_len)
+		memcpy(key->file_name, name, name_len * sizeof(ntfschar));
+
+	icx = ntfs_index_ctx_get(dir_ni, NTFS_INDEX_I30, 4);
+	if (!icx) {
+		free(key);
+		return -1;
+	}
+		/*
+		 * When the name is not there, the lookup is left on the
+		 * entry it would have been inserted before, in a leaf.
+		 */
+	rc = 0;
+	ie = NULL;
+	if (!ntfs_index_lookup(key, key_len, icx) || (errno == ENOENT))
+		ie = icx->entry;
+	else
+		rc = -1;
+	pos = 0;
+	while (ie) {
+		if (!(ie->ie_flags & INDEX_ENTRY_END)) {
+			if (ntfs_index_entry_inconsistent(ie,
+					COLLATION_FILE_NAME, dir_ni->mft_no)) {
+				errno = EIO;
+				rc = -1;
+				break;
+			}
+			if (icx->is_in_root)
+				rc = ntfs_filldir(dir_ni, &pos,
+					icx->vcn_size_bits, INDEX_TYPE_ROOT,
+					icx->ir, ie, dirent, filldir);
+			else
+				rc = ntfs_filldir(dir_ni, &pos,
+					icx->vcn_size_bits,
+					INDEX_TYPE_ALLOCATION,
+					(INDEX_ALLOCATION*)icx->ib, ie,
+					dirent, filldir);
+			if (rc) {
+				rc = -1;
+				break;
+			}
+		}
+		ie = ntfs_index_next(ie, icx);
+	}
+	eo = errno;
+	ntfs_index_ctx_put(icx);
+	free(key);
+	errno = eo;
+	return (rc);
+}
+
 /**
  * __ntfs_create - create object on ntfs volume
  * @dir_ni:	ntfs inode for directory in which create new object
@@ -2114,7 +2887,7 @@ search:
 						"Leaving inconsistent metadata.\n");
 				continue;
 			}
-			if (ntfs_cluster_free_from_rl(ni->vol, rl)) {
+			if (ntfs_cluster_queue_free_from_rl(ni->vol, rl)) {
 				err = errno;
 				ntfs_log_error("Failed to free clusters.  "
 						"Leaving inconsistent metadata.\n");
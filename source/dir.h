@@ -109,6 +109,20 @@ typedef int (*ntfs_filldir_t)(void *dirent, const ntfschar *name,
 extern int ntfs_readdir(ntfs_inode *dir_ni, s64 *pos,
 		void *dirent, ntfs_filldir_t filldir);
 
+/*
+ * Same as ntfs_filldir_t, also given the file name attribute of the index
+ * entry, or NULL for the emulated "." and ".." entries.
+ */
+typedef int (*ntfs_filldir_fn_t)(void *dirent, const ntfschar *name,
+		const int name_len, const int name_type, const s64 pos,
+		const MFT_REF mref, const unsigned dt_type,
+		const FILE_NAME_ATTR *fn);
+
+extern int ntfs_readdir_fn(ntfs_inode *dir_ni, s64 *pos,
+		void *dirent, ntfs_filldir_fn_t filldir);
+extern int ntfs_readdir_from(ntfs_inode *dir_ni, const ntfschar *name,
+		u8 name_len, void *dirent, ntfs_filldir_fn_t filldir);
+
 ntfs_inode *ntfs_dir_parent_inode(ntfs_inode *ni);
 u32 ntfs_interix_types(ntfs_inode *ni);
 
@@ -119,6 +133,10 @@ int ntfs_set_ntfs_dos_name(ntfs_inode *ni, ntfs_inode *dir_ni,
 int ntfs_remove_ntfs_dos_name(ntfs_inode *ni, ntfs_inode *dir_ni);
 int ntfs_dir_link_cnt(ntfs_inode *ni);
 
+extern void ntfs_drop_case_index(ntfs_inode *dir_ni);
+extern void ntfs_set_case_index_budget(ntfs_volume *vol, size_t size);
+extern void ntfs_free_case_indexes(ntfs_volume *vol);
+
 #if CACHE_INODE_SIZE
 
 struct CACHED_GENERIC;
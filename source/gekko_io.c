@@ -58,12 +58,676 @@
 #include "device_io.h"
 #include "gekko_io.h"
 #include "cache.h"
+#include "budget.h"
 #include "device.h"
 #include "bootsect.h"
 #include "mem_allocate.h"
 
 #define DEV_FD(dev) ((gekko_fd *)dev->d_private)
 
+/* File data opened for uncached access, metadata is always cached */
+#define DEV_UNCACHED(dev) (NDevUncached(dev) && !NDevMetadata(dev))
+
+/* Class of the caller of a device access, as recorded in the trace */
+#define DEV_TRACE_CALLER(dev) (NDevMetadata(dev) ? NTFS_IO_METADATA : (DEV_UNCACHED(dev) ? NTFS_IO_UNCACHED : NTFS_IO_DATA))
+
+/* Fragments of a vectored transfer sorted and merged at once */
+#define IOV_BATCH           32
+
+/* Asynchronous worker thread settings */
+#define ASYNC_STACK_SIZE    (16 * 1024)
+#define ASYNC_PRIORITY      80
+
+/* Caches shared by all partitions mounted from the same device */
+#define MAX_SHARED_CACHES 8
+static NTFS_CACHE *sharedCaches[MAX_SHARED_CACHES] = { NULL };
+static u32 sharedCacheUsers[MAX_SHARED_CACHES] = { 0 };
+
+/* Guards the shared caches and the devoptab table while devices are mounted on several threads */
+static mutex_t devicesLock = LWP_MUTEX_NULL;
+
+/**
+ * Create the lock taken by ntfs_device_gekko_io_lock_devices (called once, by ntfsInit)
+ */
+void ntfs_device_gekko_io_init(void)
+{
+    if (devicesLock == LWP_MUTEX_NULL)
+        LWP_MutexInit(&devicesLock, false);
+}
+
+/**
+ * Lock the shared caches and the devoptab table
+ */
+void ntfs_device_gekko_io_lock_devices(void)
+{
+    if (devicesLock != LWP_MUTEX_NULL)
+        LWP_MutexLock(devicesLock);
+}
+
+/**
+ * Unlock the shared caches and the devoptab table
+ */
+void ntfs_device_gekko_io_unlock_devices(void)
+{
+    if (devicesLock != LWP_MUTEX_NULL)
+        LWP_MutexUnlock(devicesLock);
+}
+
+/**
+ * Find the shared cache of a device, or a free slot for one
+ */
+static int ntfs_device_gekko_io_find_shared_cache(DISC_INTERFACE *interface, u16 sectorSize)
+{
+    int slot = -1;
+    int i;
+
+    for (i = 0; i < MAX_SHARED_CACHES; i++) {
+        if (sharedCaches[i]) {
+            if (sharedCaches[i]->disc == interface && sharedCaches[i]->bytesPerSector == sectorSize)
+                return i;
+        } else if (slot < 0) {
+            slot = i;
+        }
+    }
+
+    return slot;
+}
+
+/**
+ * Empty a bounce buffer pool
+ */
+static void ntfs_device_gekko_io_bounce_init(ntfs_bounce_pool *pool)
+{
+    int i;
+
+    for (i = 0; i < NTFS_BOUNCE_SLOTS; i++) {
+        pool->buffer[i] = NULL;
+        pool->size[i] = 0;
+        pool->busy[i] = false;
+    }
+}
+
+/**
+ * Get an aligned buffer of at least size bytes, reusing an idle one from the pool where possible
+ */
+static void *ntfs_device_gekko_io_bounce_get(gekko_fd *fd, size_t size)
+{
+    ntfs_bounce_pool *pool = &fd->bounce;
+    void *buffer;
+    int slot = -1;
+    int i;
+
+    // Oversized requests are not worth keeping around
+    if (size > NTFS_BOUNCE_MAX_SIZE)
+        return ntfs_align(size);
+
+    LWP_MutexLock(fd->ioLock);
+
+    // Prefer an idle buffer that is already large enough
+    for (i = 0; i < NTFS_BOUNCE_SLOTS; i++) {
+        if (pool->busy[i])
+            continue;
+        if (pool->size[i] >= size) {
+            slot = i;
+            break;
+        }
+        if (slot < 0)
+            slot = i;
+    }
+    if (slot < 0) {
+        LWP_MutexUnlock(fd->ioLock);
+        return ntfs_align(size);
+    }
+
+    // Grow the buffer (if required), rounding up so that it rarely needs to grow again
+    if (pool->size[slot] < size) {
+        size_t grow = (size + 4095) & ~(size_t) 4095;
+        buffer = ntfs_align(grow);
+        if (!buffer) {
+            LWP_MutexUnlock(fd->ioLock);
+            return NULL;
+        }
+        ntfs_free(pool->buffer[slot]);
+        pool->buffer[slot] = buffer;
+        pool->size[slot] = grow;
+    }
+
+    pool->busy[slot] = true;
+    buffer = pool->buffer[slot];
+
+    LWP_MutexUnlock(fd->ioLock);
+
+    return buffer;
+}
+
+/**
+ * Return a buffer to the pool it came from, or free it if it was allocated just for one request
+ */
+static void ntfs_device_gekko_io_bounce_put(gekko_fd *fd, void *buffer)
+{
+    ntfs_bounce_pool *pool = &fd->bounce;
+    int i;
+
+    LWP_MutexLock(fd->ioLock);
+
+    for (i = 0; i < NTFS_BOUNCE_SLOTS; i++) {
+        if (pool->buffer[i] == buffer && pool->busy[i]) {
+            pool->busy[i] = false;
+            LWP_MutexUnlock(fd->ioLock);
+            return;
+        }
+    }
+
+    LWP_MutexUnlock(fd->ioLock);
+
+    ntfs_free(buffer);
+}
+
+/**
+ * Free all buffers held by a bounce buffer pool
+ */
+static void ntfs_device_gekko_io_bounce_destroy(ntfs_bounce_pool *pool)
+{
+    int i;
+
+    for (i = 0; i < NTFS_BOUNCE_SLOTS; i++)
+        ntfs_free(pool->buffer[i]);
+
+    ntfs_device_gekko_io_bounce_init(pool);
+}
+
+/**
+ * Start recording the accesses of a device (if enabled)
+ */
+static void ntfs_device_gekko_io_trace_start(gekko_fd *fd)
+{
+    fd->trace = NULL;
+    fd->traceNext = 0;
+    fd->traceUsed = 0;
+    fd->traceSequence = 0;
+    fd->traceStart = gettime();
+
+    if (!fd->traceSize)
+        return;
+
+    if (LWP_MutexInit(&fd->traceLock, false) < 0) {
+        ntfs_log_debug("Failed to create the trace lock, accesses will not be traced\n");
+        return;
+    }
+
+    fd->trace = (ntfs_io_trace_entry *) ntfs_alloc(fd->traceSize * sizeof(ntfs_io_trace_entry));
+    if (!fd->trace) {
+        ntfs_log_debug("Failed to allocate the trace ring, accesses will not be traced\n");
+        LWP_MutexDestroy(fd->traceLock);
+    }
+}
+
+/**
+ * Stop recording the accesses of a device
+ */
+static void ntfs_device_gekko_io_trace_stop(gekko_fd *fd)
+{
+    if (!fd->trace)
+        return;
+
+    ntfs_free(fd->trace);
+    fd->trace = NULL;
+    LWP_MutexDestroy(fd->traceLock);
+}
+
+/**
+ * Total number of bytes the cache of a device has moved to and from the disc
+ */
+static u64 ntfs_device_gekko_io_trace_traffic(gekko_fd *fd)
+{
+    return fd->cache ? fd->cache->stats.bytesRead + fd->cache->stats.bytesWritten : 0;
+}
+
+/**
+ * Record an access that started at start, overwriting the oldest entry once the ring is full
+ *
+ * The access counts as a hit if the cache moved nothing to or from the disc while it ran.
+ */
+static void ntfs_device_gekko_io_trace(gekko_fd *fd, sec_t sector, sec_t numSectors, bool write, u8 caller, u64 start, u64 traffic)
+{
+    ntfs_io_trace_entry *entry;
+    u64 end = gettime();
+
+    LWP_MutexLock(fd->traceLock);
+
+    entry = &fd->trace[fd->traceNext];
+    entry->sequence = fd->traceSequence++;
+    entry->numSectors = numSectors;
+    entry->sector = sector;
+    entry->time = ticks_to_microsecs(diff_ticks(fd->traceStart, start));
+    entry->duration = ticks_to_microsecs(diff_ticks(start, end));
+    entry->caller = caller;
+    entry->write = write;
+    entry->hit = fd->cache && ntfs_device_gekko_io_trace_traffic(fd) == traffic;
+
+    fd->traceNext = (fd->traceNext + 1) % fd->traceSize;
+    if (fd->traceUsed < fd->traceSize)
+        fd->traceUsed++;
+
+    LWP_MutexUnlock(fd->traceLock);
+}
+
+/**
+ * Cut a number of data pages down to what the device cache may take of the memory budget
+ *
+ * The device cache is given up to half the budget, the rest being left to the other caches
+ * of the volume, but never fewer data pages than it works with.
+ */
+u32 ntfs_device_gekko_io_budget_pages(gekko_fd *fd, u32 pageCount, u32 pageSize)
+{
+    size_t share;
+    u32 low = 4, high = pageCount, mid;
+
+    if (!fd->budget || !fd->budget->limit || !fd->sectorSize || pageCount <= low)
+        return pageCount;
+
+    // Keep the largest number of pages that fits
+    share = fd->budget->limit / 2;
+    if (_NTFS_cache_layoutSize(pageCount, pageSize, fd->cacheMetaPageCount, fd->cacheMetaPageSize, fd->sectorSize, fd->cacheReadAhead) <= share)
+        return pageCount;
+    while (low < high) {
+        mid = low + (high - low + 1) / 2;
+        if (_NTFS_cache_layoutSize(mid, pageSize, fd->cacheMetaPageCount, fd->cacheMetaPageSize, fd->sectorSize, fd->cacheReadAhead) <= share)
+            low = mid;
+        else
+            high = mid - 1;
+    }
+    return low;
+}
+
+/**
+ * Charge the memory held by the device cache to the budget, in place of what was charged before
+ *
+ * A shared cache is charged in full to each volume using it.
+ */
+void ntfs_device_gekko_io_charge_cache(gekko_fd *fd)
+{
+    if (!fd->budget)
+        return;
+
+    ntfs_budget_release(fd->budget, NTFS_BUDGET_DEVICE_CACHE, fd->cacheCharge);
+    fd->cacheCharge = fd->cache ? _NTFS_cache_memoryUsage(fd->cache) : 0;
+    ntfs_budget_add(fd->budget, NTFS_BUDGET_DEVICE_CACHE, fd->cacheCharge);
+}
+
+/**
+ * Start timing the phases of mounting a device, from now until the last phase ends
+ */
+void ntfs_device_gekko_io_time_mount(struct ntfs_device *dev)
+{
+    gekko_fd *fd = DEV_FD(dev);
+
+    if (!fd)
+        return;
+
+    memset(&fd->mountStats, 0, sizeof(ntfs_mount_stats));
+    memset(&fd->phaseCache, 0, sizeof(NTFS_CACHE_STATS));
+    fd->mountStart = fd->phaseStart = gettime();
+    fd->mountTimed = true;
+}
+
+/**
+ * Charge the time and cache traffic since the previous phase of mounting to phase
+ *
+ * A phase may end more than once, in which case its timings add up.
+ */
+void ntfs_device_gekko_io_end_phase(struct ntfs_device *dev, int phase)
+{
+    gekko_fd *fd = DEV_FD(dev);
+    ntfs_mount_phase_stats *stats;
+    NTFS_CACHE_STATS cache;
+    u64 now;
+
+    if (!fd || !fd->mountTimed || phase < 0 || phase >= NTFS_MOUNT_PHASES)
+        return;
+
+    now = gettime();
+    stats = &fd->mountStats.phase[phase];
+    stats->time += ticks_to_microsecs(diff_ticks(fd->phaseStart, now));
+    if (fd->cache) {
+        _NTFS_cache_getStats(fd->cache, &cache, false);
+        stats->reads += cache.reads - fd->phaseCache.reads;
+        stats->writes += cache.writes - fd->phaseCache.writes;
+        stats->bytesRead += cache.bytesRead - fd->phaseCache.bytesRead;
+        stats->bytesWritten += cache.bytesWritten - fd->phaseCache.bytesWritten;
+        fd->phaseCache = cache;
+    }
+    fd->phaseStart = now;
+
+    // The last phase ends the mount
+    if (phase == NTFS_MOUNT_PHASES - 1) {
+        fd->mountStats.time = ticks_to_microsecs(diff_ticks(fd->mountStart, now));
+        fd->mountTimed = false;
+    }
+}
+
+/**
+ * Copy out the timings of the phases of mounting a device
+ */
+void ntfs_device_gekko_io_get_mount_stats(struct ntfs_device *dev, ntfs_mount_stats *stats)
+{
+    gekko_fd *fd = DEV_FD(dev);
+
+    if (fd)
+        *stats = fd->mountStats;
+    else
+        memset(stats, 0, sizeof(ntfs_mount_stats));
+}
+
+/**
+ * Copy out the most recent accesses of a device, oldest first
+ */
+int ntfs_device_gekko_io_get_trace(struct ntfs_device *dev, ntfs_io_trace_entry *entries, int count)
+{
+    gekko_fd *fd = DEV_FD(dev);
+    u32 first, i;
+
+    if (!fd || !fd->trace || count <= 0)
+        return 0;
+
+    LWP_MutexLock(fd->traceLock);
+
+    // Skip the oldest accesses if there are more than the caller has room for
+    if ((u32) count > fd->traceUsed)
+        count = fd->traceUsed;
+    first = (fd->traceNext + fd->traceSize - count) % fd->traceSize;
+    for (i = 0; i < (u32) count; i++)
+        entries[i] = fd->trace[(first + i) % fd->traceSize];
+
+    LWP_MutexUnlock(fd->traceLock);
+
+    return count;
+}
+
+/**
+ * Forget all recorded accesses of a device
+ */
+void ntfs_device_gekko_io_reset_trace(struct ntfs_device *dev)
+{
+    gekko_fd *fd = DEV_FD(dev);
+
+    if (!fd || !fd->trace)
+        return;
+
+    LWP_MutexLock(fd->traceLock);
+    fd->traceNext = 0;
+    fd->traceUsed = 0;
+    fd->traceSequence = 0;
+    fd->traceStart = gettime();
+    LWP_MutexUnlock(fd->traceLock);
+}
+
+/**
+ * Pin the cache page holding a byte range of a device, for reading it in place
+ *
+ * @return A pointer to the range within the page, or NULL if it does not lie within a single data page of the cache
+ */
+const void *ntfs_device_gekko_io_pin(struct ntfs_device *dev, s64 offset, s64 count, void **page)
+{
+    gekko_fd *fd = DEV_FD(dev);
+
+    if (!fd || !fd->cache || DEV_UNCACHED(dev) || offset < 0 || count <= 0 || (u64) (offset + count) > fd->len)
+        return NULL;
+
+    return _NTFS_cache_pin(fd->cache, fd->startSector + (sec_t) (offset / fd->sectorSize), (u32) (offset % fd->sectorSize),
+                           (size_t) count, (NTFS_CACHE_ENTRY **) page);
+}
+
+/**
+ * Release a cache page pinned by ntfs_device_gekko_io_pin
+ */
+void ntfs_device_gekko_io_unpin(struct ntfs_device *dev, void *page)
+{
+    gekko_fd *fd = DEV_FD(dev);
+
+    if (fd && fd->cache && page)
+        _NTFS_cache_unpin(fd->cache, (NTFS_CACHE_ENTRY *) page);
+}
+
+/**
+ * Asynchronous worker, reads the queued requests in order until told to quit
+ */
+static void *ntfs_device_gekko_io_async_thread(void *arg)
+{
+    gekko_fd *fd = (gekko_fd *) arg;
+    gekko_async_req *req;
+    u64 start = 0, traffic = 0;
+
+    LWP_MutexLock(fd->asyncLock);
+
+    while (true) {
+
+        // Wait for a request to be queued
+        while (!fd->asyncCount && !fd->asyncQuit)
+            LWP_CondWait(fd->asyncCond, fd->asyncLock);
+        if (!fd->asyncCount)
+            break;
+        req = fd->asyncQueue[fd->asyncHead];
+        LWP_MutexUnlock(fd->asyncLock);
+
+        // Remember when the read started and what the cache had moved so far (if tracing)
+        if (fd->trace) {
+            start = gettime();
+            traffic = ntfs_device_gekko_io_trace_traffic(fd);
+        }
+
+        // Read the sectors (from disc or cache) while the caller carries on
+        if (req->readahead) {
+            sec_t numSectors = req->numSectors;
+            req->result = _NTFS_cache_prefetch(fd->cache, req->sector, &numSectors);
+        } else if (fd->cache && req->uncached)
+            req->result = _NTFS_cache_readSectorsUncached(fd->cache, req->sector, req->numSectors, req->buffer);
+        else if (fd->cache)
+            req->result = _NTFS_cache_readSectors(fd->cache, req->sector, req->numSectors, req->buffer, req->metadata);
+        else {
+            LWP_MutexLock(fd->ioLock);
+            req->result = fd->interface->readSectors(fd->interface, req->sector, req->numSectors, req->buffer);
+            LWP_MutexUnlock(fd->ioLock);
+        }
+
+        if (fd->trace)
+            ntfs_device_gekko_io_trace(fd, req->sector, req->numSectors, false, NTFS_IO_ASYNC, start, traffic);
+
+        // Complete the request
+        LWP_MutexLock(fd->asyncLock);
+        fd->asyncHead = (fd->asyncHead + 1) % NTFS_ASYNC_QUEUE_DEPTH;
+        fd->asyncCount--;
+        req->done = true;
+        LWP_CondBroadcast(fd->asyncDone);
+    }
+
+    LWP_MutexUnlock(fd->asyncLock);
+
+    return NULL;
+}
+
+/**
+ * Start the asynchronous worker of a device
+ */
+static bool ntfs_device_gekko_io_async_start(gekko_fd *fd)
+{
+    fd->asyncQuit = false;
+    fd->asyncHead = 0;
+    fd->asyncCount = 0;
+    fd->asyncReadahead.done = true;
+
+    if (LWP_MutexInit(&fd->asyncLock, false) < 0)
+        goto fail_lock;
+    if (LWP_CondInit(&fd->asyncCond) < 0)
+        goto fail_cond;
+    if (LWP_CondInit(&fd->asyncDone) < 0)
+        goto fail_done;
+    if (LWP_CreateThread(&fd->asyncThread, ntfs_device_gekko_io_async_thread, fd, NULL, ASYNC_STACK_SIZE, ASYNC_PRIORITY) < 0)
+        goto fail_thread;
+
+    return true;
+
+fail_thread:
+    LWP_CondDestroy(fd->asyncDone);
+fail_done:
+    LWP_CondDestroy(fd->asyncCond);
+fail_cond:
+    LWP_MutexDestroy(fd->asyncLock);
+fail_lock:
+    fd->asyncThread = LWP_THREAD_NULL;
+    return false;
+}
+
+/**
+ * Stop the asynchronous worker of a device, once it has finished all queued requests
+ */
+static void ntfs_device_gekko_io_async_stop(gekko_fd *fd)
+{
+    if (fd->asyncThread == LWP_THREAD_NULL)
+        return;
+
+    LWP_MutexLock(fd->asyncLock);
+    fd->asyncQuit = true;
+    LWP_CondSignal(fd->asyncCond);
+    LWP_MutexUnlock(fd->asyncLock);
+    LWP_JoinThread(fd->asyncThread, NULL);
+
+    LWP_CondDestroy(fd->asyncDone);
+    LWP_CondDestroy(fd->asyncCond);
+    LWP_MutexDestroy(fd->asyncLock);
+    fd->asyncThread = LWP_THREAD_NULL;
+}
+
+/**
+ * Queue a sector read for the asynchronous worker, waiting for room in the queue (if required)
+ */
+static void ntfs_device_gekko_io_async_submit(gekko_fd *fd, gekko_async_req *req)
+{
+    req->done = false;
+    req->result = false;
+
+    LWP_MutexLock(fd->asyncLock);
+    while (fd->asyncCount == NTFS_ASYNC_QUEUE_DEPTH)
+        LWP_CondWait(fd->asyncDone, fd->asyncLock);
+    fd->asyncQueue[(fd->asyncHead + fd->asyncCount) % NTFS_ASYNC_QUEUE_DEPTH] = req;
+    fd->asyncCount++;
+    LWP_CondSignal(fd->asyncCond);
+    LWP_MutexUnlock(fd->asyncLock);
+}
+
+/**
+ * Queue loading sectors into the cache for the asynchronous worker, unless the previous read ahead is still queued
+ * or the queue is full
+ */
+static bool ntfs_device_gekko_io_async_readahead(gekko_fd *fd, sec_t sector, sec_t numSectors)
+{
+    gekko_async_req *req = &fd->asyncReadahead;
+
+    LWP_MutexLock(fd->asyncLock);
+    if (!req->done || fd->asyncCount == NTFS_ASYNC_QUEUE_DEPTH) {
+        LWP_MutexUnlock(fd->asyncLock);
+        return false;
+    }
+    req->sector = sector;
+    req->numSectors = numSectors;
+    req->buffer = NULL;
+    req->metadata = false;
+    req->uncached = false;
+    req->readahead = true;
+    req->done = false;
+    req->result = false;
+    fd->asyncQueue[(fd->asyncHead + fd->asyncCount) % NTFS_ASYNC_QUEUE_DEPTH] = req;
+    fd->asyncCount++;
+    LWP_CondSignal(fd->asyncCond);
+    LWP_MutexUnlock(fd->asyncLock);
+
+    return true;
+}
+
+/**
+ * Wait for a queued sector read to complete
+ */
+static bool ntfs_device_gekko_io_async_wait(gekko_fd *fd, gekko_async_req *req)
+{
+    LWP_MutexLock(fd->asyncLock);
+    while (!req->done)
+        LWP_CondWait(fd->asyncDone, fd->asyncLock);
+    LWP_MutexUnlock(fd->asyncLock);
+
+    return req->result;
+}
+
+/**
+ * Read a large run of sectors through two bounce buffers, copying out of one while the worker fills the other
+ */
+static bool ntfs_device_gekko_io_async_read(struct ntfs_device *dev, sec_t sector, sec_t numSectors, u32 offset, s64 count, u8 *dest)
+{
+    gekko_fd *fd = DEV_FD(dev);
+    sec_t chunk = NTFS_ASYNC_CHUNK_SIZE / fd->sectorSize;
+    gekko_async_req req[2];
+    u8 *buffer[2];
+    bool ok = true;
+    int pending = 0;
+    int i;
+
+    // Get the buffers to read into
+    buffer[0] = (u8 *) ntfs_device_gekko_io_bounce_get(fd, chunk * fd->sectorSize);
+    buffer[1] = (u8 *) ntfs_device_gekko_io_bounce_get(fd, chunk * fd->sectorSize);
+    if (!buffer[0] || !buffer[1]) {
+        ntfs_device_gekko_io_bounce_put(fd, buffer[0]);
+        ntfs_device_gekko_io_bounce_put(fd, buffer[1]);
+        errno = ENOMEM;
+        return false;
+    }
+
+    // Start filling both buffers
+    for (i = 0; i < 2 && numSectors > 0; i++) {
+        req[i].sector = sector;
+        req[i].numSectors = MIN(chunk, numSectors);
+        req[i].buffer = buffer[i];
+        req[i].metadata = NDevMetadata(dev);
+        req[i].uncached = DEV_UNCACHED(dev);
+        req[i].readahead = false;
+        ntfs_device_gekko_io_async_submit(fd, &req[i]);
+        sector += req[i].numSectors;
+        numSectors -= req[i].numSectors;
+        pending++;
+    }
+
+    // Copy out each buffer as it completes and refill it with the next chunk
+    for (i = 0; pending > 0; i ^= 1) {
+        if (!ntfs_device_gekko_io_async_wait(fd, &req[i]))
+            ok = false;
+        pending--;
+
+        if (ok) {
+            s64 size = MIN((s64) (req[i].numSectors * fd->sectorSize) - offset, count);
+            memcpy(dest, buffer[i] + offset, size);
+            dest += size;
+            count -= size;
+            offset = 0;
+
+            if (numSectors > 0) {
+                req[i].sector = sector;
+                req[i].numSectors = MIN(chunk, numSectors);
+                ntfs_device_gekko_io_async_submit(fd, &req[i]);
+                sector += req[i].numSectors;
+                numSectors -= req[i].numSectors;
+                pending++;
+            }
+        }
+    }
+
+    // Return the buffers
+    ntfs_device_gekko_io_bounce_put(fd, buffer[1]);
+    ntfs_device_gekko_io_bounce_put(fd, buffer[0]);
+
+    if (!ok)
+        errno = EIO;
+
+    return ok;
+}
+
 /* Prototypes */
 static s64 ntfs_device_gekko_io_readbytes(struct ntfs_device *dev, s64 offset, s64 count, void *buf);
 static bool ntfs_device_gekko_io_readsectors(struct ntfs_device *dev, sec_t sector, sec_t numSectors, void* buffer);
@@ -138,6 +802,12 @@ static int ntfs_device_gekko_io_open(struct ntfs_device *dev, int flags)
     fd->len = (fd->sectorCount * fd->sectorSize);
     fd->ino = le64_to_cpu(boot->volume_serial_number);
 
+    // The boot sector is read before there is a cache to count it
+    if (fd->mountTimed) {
+        fd->mountStats.phase[NTFS_MOUNT_PHASE_OPEN].reads++;
+        fd->mountStats.phase[NTFS_MOUNT_PHASE_OPEN].bytesRead += fd->sectorSize;
+    }
+
     // Free memory for boot sector
     ntfs_free(boot);
 
@@ -146,8 +816,56 @@ static int ntfs_device_gekko_io_open(struct ntfs_device *dev, int flags)
         NDevSetReadOnly(dev);
     }
 
-    // Create the cache
-    fd->cache = _NTFS_cache_constructor(fd->cachePageCount, fd->cachePageSize, interface, fd->startSector + fd->sectorCount, fd->sectorSize);
+    // Nothing has been bounced through the device yet
+    ntfs_device_gekko_io_bounce_init(&fd->bounce);
+
+    // Join the shared cache of the device (if enabled and one exists)
+    int slot = -1;
+    fd->cache = NULL;
+    ntfs_device_gekko_io_lock_devices();
+    if (fd->cacheShared) {
+        slot = ntfs_device_gekko_io_find_shared_cache(interface, fd->sectorSize);
+        if (slot >= 0 && sharedCaches[slot]) {
+            fd->cache = sharedCaches[slot];
+            _NTFS_cache_extend(fd->cache, fd->startSector + fd->sectorCount);
+            sharedCacheUsers[slot]++;
+        }
+    }
+
+    // Create the cache (if required), within the memory budget of the volume
+    if (!fd->cache) {
+        fd->cachePageCount = ntfs_device_gekko_io_budget_pages(fd, fd->cachePageCount, fd->cachePageSize);
+        fd->cache = _NTFS_cache_constructor(fd->cachePageCount, fd->cachePageSize, fd->cacheMetaPageCount, fd->cacheMetaPageSize, interface, fd->startSector + fd->sectorCount, fd->sectorSize, fd->cachePolicy, fd->cacheReadAhead);
+        if (fd->cache && slot >= 0) {
+            sharedCaches[slot] = fd->cache;
+            sharedCacheUsers[slot] = 1;
+        } else {
+            fd->cacheShared = false;
+        }
+    }
+    ntfs_device_gekko_io_unlock_devices();
+    ntfs_device_gekko_io_charge_cache(fd);
+
+    // Start writing back dirty pages in the background (if required)
+    if (fd->cache && fd->cache->flusher == LWP_THREAD_NULL && fd->cacheFlushAge && !(flags & O_RDONLY)) {
+        if (!_NTFS_cache_startFlusher(fd->cache, fd->cacheFlushAge, fd->cacheFlushThreshold))
+            ntfs_log_debug("Failed to start the cache flusher, dirty pages will only be written on sync\n");
+    }
+
+    // Start recording the device accesses (if required)
+    ntfs_device_gekko_io_trace_start(fd);
+
+    // Initialise the transfer lock
+    LWP_MutexInit(&fd->ioLock, false);
+
+    // Start the asynchronous worker (if required)
+    fd->asyncThread = LWP_THREAD_NULL;
+    if (fd->asyncIO && !ntfs_device_gekko_io_async_start(fd))
+        ntfs_log_debug("Failed to start the asynchronous worker, large reads will be synchronous\n");
+
+    // Count the cache traffic of the mount from here on (a shared cache may have moved data already)
+    if (fd->mountTimed && fd->cache)
+        _NTFS_cache_getStats(fd->cache, &fd->phaseCache, false);
 
     // Mark the device as open
     NDevSetBlock(dev);
@@ -192,12 +910,38 @@ static int ntfs_device_gekko_io_close(struct ntfs_device *dev)
 
     }
 
+    // Stop the asynchronous worker (if running)
+    ntfs_device_gekko_io_async_stop(fd);
+
     // Flush and destroy the cache (if required)
     if (fd->cache) {
         _NTFS_cache_flush(fd->cache);
-        _NTFS_cache_destructor(fd->cache);
+
+        // Shared caches are only destroyed once the last partition using them is closed
+        if (fd->cacheShared) {
+            ntfs_device_gekko_io_lock_devices();
+            int slot = ntfs_device_gekko_io_find_shared_cache(fd->interface, fd->sectorSize);
+            if (slot >= 0 && sharedCaches[slot] == fd->cache && --sharedCacheUsers[slot] == 0) {
+                sharedCaches[slot] = NULL;
+                _NTFS_cache_destructor(fd->cache);
+            }
+            ntfs_device_gekko_io_unlock_devices();
+        } else {
+            _NTFS_cache_destructor(fd->cache);
+        }
+        fd->cache = NULL;
+        ntfs_device_gekko_io_charge_cache(fd);
     }
 
+    // Release the bounce buffers
+    ntfs_device_gekko_io_bounce_destroy(&fd->bounce);
+
+    // Stop recording the device accesses
+    ntfs_device_gekko_io_trace_stop(fd);
+
+    // Deinitialise the transfer lock
+    LWP_MutexDestroy(fd->ioLock);
+
     // Shutdown the device interface
     /*DISC_INTERFACE *interface = fd->interface;
     if (interface) {
@@ -267,6 +1011,171 @@ static s64 ntfs_device_gekko_io_pwrite(struct ntfs_device *dev, const void *buf,
     return ntfs_device_gekko_io_writebytes(dev, offset, count, buf);
 }
 
+/**
+ * Sort the fragments of a vectored transfer by device position
+ */
+static void ntfs_device_gekko_io_sortv(const struct ntfs_io_vec *vec, int vcnt, const struct ntfs_io_vec **order)
+{
+    const struct ntfs_io_vec *v;
+    int i, j;
+
+    for (i = 0; i < vcnt; i++) {
+        v = &vec[i];
+        for (j = i; j > 0 && order[j - 1]->pos > v->pos; j--)
+            order[j] = order[j - 1];
+        order[j] = v;
+    }
+}
+
+/**
+ * Count the sorted fragments that follow on from each other on the device, and can be moved as one bounce buffered transfer
+ */
+static int ntfs_device_gekko_io_mergev(gekko_fd *fd, const struct ntfs_io_vec **order, int vcnt, s64 *span)
+{
+    bool direct = true;
+    int i, n;
+
+    *span = order[0]->count;
+    for (n = 1; n < vcnt && order[n]->pos == order[0]->pos + *span && *span + order[n]->count <= NTFS_BOUNCE_MAX_SIZE; n++)
+        *span += order[n]->count;
+
+    // Fragments that can each go straight to the device gain nothing from being copied
+    for (i = 0; i < n && direct; i++) {
+        direct = (order[i]->pos % fd->sectorSize == 0) && (order[i]->count % fd->sectorSize == 0) &&
+                 SYS_IsDMAAddress(order[i]->buf, 32);
+    }
+
+    return direct ? 1 : n;
+}
+
+/**
+ * Read the fragments of a vectored transfer
+ */
+static s64 ntfs_device_gekko_io_readv(struct ntfs_device *dev, const struct ntfs_io_vec *vec, int vcnt)
+{
+    const struct ntfs_io_vec *order[IOV_BATCH];
+    gekko_fd *fd = DEV_FD(dev);
+    s64 total = 0;
+    s64 span;
+    u8 *buffer;
+    int batch, i, j, n;
+
+    for (; vcnt > 0; vec += batch, vcnt -= batch) {
+
+        // Visit the fragments in disc order so that the cache sees one ascending stream
+        batch = MIN(vcnt, IOV_BATCH);
+        ntfs_device_gekko_io_sortv(vec, batch, order);
+
+        for (i = 0; i < batch; i += n) {
+            n = ntfs_device_gekko_io_mergev(fd, &order[i], batch - i, &span);
+
+            // Read a single fragment straight into its buffer
+            if (n == 1) {
+                if (ntfs_device_gekko_io_readbytes(dev, order[i]->pos, order[i]->count, order[i]->buf) != order[i]->count)
+                    return -1;
+                total += order[i]->count;
+                continue;
+            }
+
+            // Else read the neighbouring fragments as one and scatter them
+            buffer = (u8 *) ntfs_device_gekko_io_bounce_get(fd, span);
+            if (!buffer) {
+                errno = ENOMEM;
+                return -1;
+            }
+            if (ntfs_device_gekko_io_readbytes(dev, order[i]->pos, span, buffer) != span) {
+                ntfs_device_gekko_io_bounce_put(fd, buffer);
+                return -1;
+            }
+            for (j = 0; j < n; j++)
+                memcpy(order[i + j]->buf, buffer + (order[i + j]->pos - order[i]->pos), order[i + j]->count);
+            ntfs_device_gekko_io_bounce_put(fd, buffer);
+            total += span;
+        }
+    }
+
+    return total;
+}
+
+/**
+ *
+ */
+static s64 ntfs_device_gekko_io_preadv(struct ntfs_device *dev, const struct ntfs_io_vec *vec, int vcnt)
+{
+    ntfs_log_trace("dev %p, vec %p, vcnt %d\n", dev, vec, vcnt);
+
+    if (!DEV_FD(dev)) {
+        errno = EBADF;
+        return -1;
+    }
+
+    return ntfs_device_gekko_io_readv(dev, vec, vcnt);
+}
+
+/**
+ * Write the fragments of a vectored transfer
+ */
+static s64 ntfs_device_gekko_io_writev(struct ntfs_device *dev, const struct ntfs_io_vec *vec, int vcnt)
+{
+    const struct ntfs_io_vec *order[IOV_BATCH];
+    gekko_fd *fd = DEV_FD(dev);
+    s64 total = 0;
+    s64 span;
+    u8 *buffer;
+    int batch, i, j, n;
+
+    for (; vcnt > 0; vec += batch, vcnt -= batch) {
+
+        // Visit the fragments in disc order so that the cache can write them back together
+        batch = MIN(vcnt, IOV_BATCH);
+        ntfs_device_gekko_io_sortv(vec, batch, order);
+
+        for (i = 0; i < batch; i += n) {
+            n = ntfs_device_gekko_io_mergev(fd, &order[i], batch - i, &span);
+
+            // Write a single fragment straight from its buffer
+            if (n == 1) {
+                if (ntfs_device_gekko_io_writebytes(dev, order[i]->pos, order[i]->count, order[i]->buf) != order[i]->count)
+                    return -1;
+                total += order[i]->count;
+                continue;
+            }
+
+            // Else gather the neighbouring fragments and write them as one
+            buffer = (u8 *) ntfs_device_gekko_io_bounce_get(fd, span);
+            if (!buffer) {
+                errno = ENOMEM;
+                return -1;
+            }
+            for (j = 0; j < n; j++)
+                memcpy(buffer + (order[i + j]->pos - order[i]->pos), order[i + j]->buf, order[i + j]->count);
+            if (ntfs_device_gekko_io_writebytes(dev, order[i]->pos, span, buffer) != span) {
+                ntfs_device_gekko_io_bounce_put(fd, buffer);
+                return -1;
+            }
+            ntfs_device_gekko_io_bounce_put(fd, buffer);
+            total += span;
+        }
+    }
+
+    return total;
+}
+
+/**
+ *
+ */
+static s64 ntfs_device_gekko_io_pwritev(struct ntfs_device *dev, const struct ntfs_io_vec *vec, int vcnt)
+{
+    ntfs_log_trace("dev %p, vec %p, vcnt %d\n", dev, vec, vcnt);
+
+    if (!DEV_FD(dev)) {
+        errno = EBADF;
+        return -1;
+    }
+
+    return ntfs_device_gekko_io_writev(dev, vec, vcnt);
+}
+
 /**
  *
  */
@@ -310,9 +1219,19 @@ static s64 ntfs_device_gekko_io_readbytes(struct ntfs_device *dev, s64 offset, s
         sec_count = (sec_t) ((buffer_offset + count + fd->sectorSize - 1) / fd->sectorSize);
     }
 
-    // If this read happens to be on the sector boundaries then do the read straight into the destination buffer
+    // If this is a large read that can not go straight into the destination buffer then overlap the reads with copying them out
+    if (fd->asyncThread != LWP_THREAD_NULL && count >= 2 * NTFS_ASYNC_CHUNK_SIZE &&
+        !((buffer_offset == 0) && (count % fd->sectorSize == 0) && SYS_IsDMAAddress(buf, 32))) {
+
+        // Read from the device
+        ntfs_log_trace("asynchronous read from sector %lld (%lld sector(s) long)\n", sec_start, sec_count);
+        if (!ntfs_device_gekko_io_async_read(dev, sec_start, sec_count, buffer_offset, count, buf)) {
+            ntfs_log_perror("asynchronous read failure @ sector %lld (%lld sector(s) long)\n", sec_start, sec_count);
+            return -1;
+        }
 
-    if((buffer_offset == 0) && (count % fd->sectorSize == 0)) {
+    // Else if this read happens to be on the sector boundaries then do the read straight into the destination buffer
+    } else if((buffer_offset == 0) && (count % fd->sectorSize == 0)) {
 
         // Read from the device
         ntfs_log_trace("direct read from sector %lld (%lld sector(s) long)\n", sec_start, sec_count);
@@ -322,13 +1241,24 @@ static s64 ntfs_device_gekko_io_readbytes(struct ntfs_device *dev, s64 offset, s
             return -1;
         }
 
+    // Else if the read lies within a single cache page then copy straight out of the page
+    } else if (fd->cache && !DEV_UNCACHED(dev) && _NTFS_cache_inPage(fd->cache, sec_start, sec_count)) {
+
+        // Read from the cache
+        ntfs_log_trace("cached read from sector %lld (%lld sector(s) long)\n", sec_start, sec_count);
+        if (!_NTFS_cache_readBytes(fd->cache, sec_start, buffer_offset, count, buf, NDevMetadata(dev))) {
+            ntfs_log_perror("cached read failure @ sector %lld (%lld sector(s) long)\n", sec_start, sec_count);
+            errno = EIO;
+            return -1;
+        }
+
     // Else read into a buffer and copy over only what was requested
     }
     else
 	{
 
-        // Allocate a buffer to hold the read data
-        buffer = (u8 *) ntfs_align(sec_count * fd->sectorSize);
+        // Get a buffer to hold the read data
+        buffer = (u8 *) ntfs_device_gekko_io_bounce_get(fd, sec_count * fd->sectorSize);
         if (!buffer) {
             errno = ENOMEM;
             return -1;
@@ -339,14 +1269,14 @@ static s64 ntfs_device_gekko_io_readbytes(struct ntfs_device *dev, s64 offset, s
         ntfs_log_trace("count: %d  sec_count:%d  fd->sectorSize: %d )\n", (u32)count, (u32)sec_count,(u32)fd->sectorSize);
         if (!ntfs_device_gekko_io_readsectors(dev, sec_start, sec_count, buffer)) {
             ntfs_log_perror("buffered read failure @ sector %lld (%lld sector(s) long)\n", sec_start, sec_count);
-            ntfs_free(buffer);
+            ntfs_device_gekko_io_bounce_put(fd, buffer);
             errno = EIO;
             return -1;
         }
 
         // Copy what was requested to the destination buffer
         memcpy(buf, buffer + buffer_offset, count);
-        ntfs_free(buffer);
+        ntfs_device_gekko_io_bounce_put(fd, buffer);
 
     }
 
@@ -411,12 +1341,55 @@ static s64 ntfs_device_gekko_io_writebytes(struct ntfs_device *dev, s64 offset,
             errno = EIO;
             return -1;
         }
+    // Else if the cache is enabled then only update the bytes that changed
+    }
+    else if (fd->cache && !DEV_UNCACHED(dev))
+    {
+        const u8 *src = (const u8 *) buf;
+        s64 remaining = count;
+        bool metadata = NDevMetadata(dev);
+
+        // Write the unaligned head into its sector
+        if (buffer_offset != 0) {
+            u32 size = (u32) MIN(remaining, fd->sectorSize - buffer_offset);
+            if (!_NTFS_cache_writePartialSector(fd->cache, src, sec_start, buffer_offset, size, metadata)) {
+                ntfs_log_perror("cached write failure @ sector %lld\n", sec_start);
+                errno = EIO;
+                return -1;
+            }
+            src += size;
+            remaining -= size;
+            sec_start++;
+        }
+
+        // Write the whole sectors in the middle
+        if (remaining >= fd->sectorSize) {
+            sec_count = (sec_t) (remaining / fd->sectorSize);
+            ntfs_log_trace("cached write to sector %lld (%lld sector(s) long)\n", sec_start, sec_count);
+            if (!ntfs_device_gekko_io_writesectors(dev, sec_start, sec_count, src)) {
+                ntfs_log_perror("cached write failure @ sector %lld (%lld sector(s) long)\n", sec_start, sec_count);
+                errno = EIO;
+                return -1;
+            }
+            src += sec_count * fd->sectorSize;
+            remaining -= sec_count * fd->sectorSize;
+            sec_start += sec_count;
+        }
+
+        // Write the unaligned tail into its sector
+        if (remaining > 0) {
+            if (!_NTFS_cache_writePartialSector(fd->cache, src, sec_start, 0, (u32) remaining, metadata)) {
+                ntfs_log_perror("cached write failure @ sector %lld\n", sec_start);
+                errno = EIO;
+                return -1;
+            }
+        }
     // Else write from a buffer aligned to the sector boundaries
     }
     else
     {
-        // Allocate a buffer to hold the write data
-        buffer = (u8 *) ntfs_align(sec_count * fd->sectorSize);
+        // Get a buffer to hold the write data
+        buffer = (u8 *) ntfs_device_gekko_io_bounce_get(fd, sec_count * fd->sectorSize);
         if (!buffer) {
             errno = ENOMEM;
             return -1;
@@ -428,7 +1401,7 @@ static s64 ntfs_device_gekko_io_writebytes(struct ntfs_device *dev, s64 offset,
         {
             if (!ntfs_device_gekko_io_readsectors(dev, sec_start, 1, buffer)) {
                 ntfs_log_perror("read failure @ sector %lld\n", sec_start);
-                ntfs_free(buffer);
+                ntfs_device_gekko_io_bounce_put(fd, buffer);
                 errno = EIO;
                 return -1;
             }
@@ -437,7 +1410,7 @@ static s64 ntfs_device_gekko_io_writebytes(struct ntfs_device *dev, s64 offset,
         {
             if (!ntfs_device_gekko_io_readsectors(dev, sec_start + sec_count - 1, 1, buffer + ((sec_count-1) * fd->sectorSize))) {
                 ntfs_log_perror("read failure @ sector %lld\n", sec_start + sec_count - 1);
-                ntfs_free(buffer);
+                ntfs_device_gekko_io_bounce_put(fd, buffer);
                 errno = EIO;
                 return -1;
             }
@@ -450,13 +1423,13 @@ static s64 ntfs_device_gekko_io_writebytes(struct ntfs_device *dev, s64 offset,
         ntfs_log_trace("buffered write to sector %lld (%lld sector(s) long)\n", sec_start, sec_count);
         if (!ntfs_device_gekko_io_writesectors(dev, sec_start, sec_count, buffer)) {
             ntfs_log_perror("buffered write failure @ sector %lld\n", sec_start);
-            ntfs_free(buffer);
+            ntfs_device_gekko_io_bounce_put(fd, buffer);
             errno = EIO;
             return -1;
         }
 
-        // Free the buffer
-        ntfs_free(buffer);
+        // Return the buffer
+        ntfs_device_gekko_io_bounce_put(fd, buffer);
     }
 
     // Mark the device as dirty (if we actually wrote anything)
@@ -473,13 +1446,30 @@ static bool ntfs_device_gekko_io_readsectors(struct ntfs_device *dev, sec_t sect
         errno = EBADF;
         return false;
     }
+
+    // Remember when the read started and what the cache had moved so far (if tracing)
+    u64 start = 0, traffic = 0;
+    if (fd->trace) {
+        start = gettime();
+        traffic = ntfs_device_gekko_io_trace_traffic(fd);
+    }
+
     // Read the sectors from disc (or cache, if enabled)
-    if (fd->cache)
-        return _NTFS_cache_readSectors(fd->cache, sector, numSectors, buffer);
-    else
-        return fd->interface->readSectors(fd->interface, sector, numSectors, buffer);
+    bool ok;
+    if (fd->cache && DEV_UNCACHED(dev))
+        ok = _NTFS_cache_readSectorsUncached(fd->cache, sector, numSectors, buffer);
+    else if (fd->cache)
+        ok = _NTFS_cache_readSectors(fd->cache, sector, numSectors, buffer, NDevMetadata(dev));
+    else {
+        LWP_MutexLock(fd->ioLock);
+        ok = fd->interface->readSectors(fd->interface, sector, numSectors, buffer);
+        LWP_MutexUnlock(fd->ioLock);
+    }
 
-    return false;
+    if (fd->trace)
+        ntfs_device_gekko_io_trace(fd, sector, numSectors, false, DEV_TRACE_CALLER(dev), start, traffic);
+
+    return ok;
 }
 
 static bool ntfs_device_gekko_io_writesectors(struct ntfs_device *dev, sec_t sector, sec_t numSectors, const void* buffer)
@@ -491,13 +1481,29 @@ static bool ntfs_device_gekko_io_writesectors(struct ntfs_device *dev, sec_t sec
         return false;
     }
 
+    // Remember when the write started and what the cache had moved so far (if tracing)
+    u64 start = 0, traffic = 0;
+    if (fd->trace) {
+        start = gettime();
+        traffic = ntfs_device_gekko_io_trace_traffic(fd);
+    }
+
     // Write the sectors to disc (or cache, if enabled)
-    if (fd->cache)
-        return _NTFS_cache_writeSectors(fd->cache, sector, numSectors, buffer);
-    else
-        return fd->interface->writeSectors(fd->interface, sector, numSectors, buffer);
+    bool ok;
+    if (fd->cache && DEV_UNCACHED(dev))
+        ok = _NTFS_cache_writeSectorsUncached(fd->cache, sector, numSectors, buffer);
+    else if (fd->cache)
+        ok = _NTFS_cache_writeSectors(fd->cache, sector, numSectors, buffer, NDevMetadata(dev));
+    else {
+        LWP_MutexLock(fd->ioLock);
+        ok = fd->interface->writeSectors(fd->interface, sector, numSectors, buffer);
+        LWP_MutexUnlock(fd->ioLock);
+    }
 
-    return false;
+    if (fd->trace)
+        ntfs_device_gekko_io_trace(fd, sector, numSectors, true, DEV_TRACE_CALLER(dev), start, traffic);
+
+    return ok;
 }
 
 /**
@@ -506,6 +1512,7 @@ static bool ntfs_device_gekko_io_writesectors(struct ntfs_device *dev, sec_t sec
 static int ntfs_device_gekko_io_sync(struct ntfs_device *dev)
 {
 	gekko_fd *fd = DEV_FD(dev);
+    bool ok;
     ntfs_log_trace("dev %p\n", dev);
 
     // Check that the device can be written to
@@ -525,7 +1532,10 @@ static int ntfs_device_gekko_io_sync(struct ntfs_device *dev)
             return -1;
         }
     } else {
-        if (!fd->interface->flush(fd->interface)) {
+        LWP_MutexLock(fd->ioLock);
+        ok = fd->interface->flush(fd->interface);
+        LWP_MutexUnlock(fd->ioLock);
+        if (!ok) {
             errno = EIO;
             return -1;
         }
@@ -633,6 +1643,100 @@ static int ntfs_device_gekko_io_ioctl(struct ntfs_device *dev, unsigned long req
         }
         #endif
 
+        // Discard a byte range of the device
+        case BLKDISCARD: {
+            u64 *range = (u64*)argp;
+            if (!fd->discard) {
+                errno = EOPNOTSUPP;
+                return -1;
+            }
+            if (NDevReadOnly(dev)) {
+                errno = EROFS;
+                return -1;
+            }
+            if (range[0] > fd->len || range[1] > fd->len - range[0]) {
+                errno = EINVAL;
+                return -1;
+            }
+
+            // Only whole sectors can be discarded
+            sec_t sec_start = (sec_t) ((range[0] + fd->sectorSize - 1) / fd->sectorSize);
+            sec_t sec_end = (sec_t) ((range[0] + range[1]) / fd->sectorSize);
+            if (sec_end <= sec_start)
+                return 0;
+
+            // Drop any cached copies first so that they are never written back over the discarded sectors
+            if (fd->cache)
+                _NTFS_cache_discard(fd->cache, fd->startSector + sec_start, sec_end - sec_start);
+
+            ntfs_log_trace("discard sector %lld (%lld sector(s) long)\n", fd->startSector + sec_start, sec_end - sec_start);
+            if (!fd->discard(fd->interface, fd->startSector + sec_start, sec_end - sec_start)) {
+                errno = EIO;
+                return -1;
+            }
+            return 0;
+        }
+
+        // Read a byte range of the device into the cache
+        case NTFS_IOC_PREFETCH: {
+            u64 *range = (u64*)argp;
+            if (!fd->cache) {
+                errno = EOPNOTSUPP;
+                return -1;
+            }
+            if (range[0] > fd->len || range[1] > fd->len - range[0]) {
+                errno = EINVAL;
+                return -1;
+            }
+            if (!range[1])
+                return 0;
+
+            // The cache works in whole sectors
+            sec_t sec_start = (sec_t) (range[0] / fd->sectorSize);
+            sec_t sec_count = (sec_t) ((range[0] + range[1] + fd->sectorSize - 1) / fd->sectorSize) - sec_start;
+            u64 skip = range[0] - ((u64) sec_start * fd->sectorSize);
+
+            if (!_NTFS_cache_prefetch(fd->cache, fd->startSector + sec_start, &sec_count)) {
+                errno = EIO;
+                return -1;
+            }
+
+            if ((u64) sec_count * fd->sectorSize <= skip)
+                range[1] = 0;
+            else if ((u64) sec_count * fd->sectorSize - skip < range[1])
+                range[1] = (u64) sec_count * fd->sectorSize - skip;
+            return 0;
+        }
+
+        // Start reading a byte range of the device into the cache on the asynchronous worker
+        case NTFS_IOC_READAHEAD: {
+            u64 *range = (u64*)argp;
+            if (!fd->cache || fd->asyncThread == LWP_THREAD_NULL || DEV_UNCACHED(dev)) {
+                errno = EOPNOTSUPP;
+                return -1;
+            }
+            if (range[0] > fd->len || range[1] > fd->len - range[0]) {
+                errno = EINVAL;
+                return -1;
+            }
+            if (!range[1])
+                return 0;
+
+            sec_t sec_start = (sec_t) (range[0] / fd->sectorSize);
+            sec_t sec_count = (sec_t) ((range[0] + range[1] + fd->sectorSize - 1) / fd->sectorSize) - sec_start;
+            if (!ntfs_device_gekko_io_async_readahead(fd, fd->startSector + sec_start, sec_count)) {
+                errno = EBUSY;
+                return -1;
+            }
+            return 0;
+        }
+
+        // End a phase of mounting
+        case NTFS_IOC_MOUNT_PHASE: {
+            ntfs_device_gekko_io_end_phase(dev, *(int*)argp);
+            return 0;
+        }
+
         // Unimplemented ioctrl
         default: {
             ntfs_log_perror("Unimplemented ioctrl 0x%lx\n", request);
@@ -659,4 +1763,6 @@ struct ntfs_device_operations ntfs_device_gekko_io_ops = {
     .sync       = ntfs_device_gekko_io_sync,
     .stat       = ntfs_device_gekko_io_stat,
     .ioctl      = ntfs_device_gekko_io_ioctl,
+    .preadv     = ntfs_device_gekko_io_preadv,
+    .pwritev    = ntfs_device_gekko_io_pwritev,
 };
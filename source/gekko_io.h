@@ -25,6 +25,7 @@
 #include "config.h"
 #endif
 
+#include "ntfs.h"
 #include "types.h"
 #include "cache2.h"
 #include <gccore.h>
@@ -32,6 +33,39 @@
 
 #define MAX_SECTOR_SIZE                     4096
 
+/* Bounce buffers kept for reuse, and the largest size to keep around */
+#define NTFS_BOUNCE_SLOTS                   2
+#define NTFS_BOUNCE_MAX_SIZE                (64 * 1024)
+
+/**
+ * ntfs_bounce_pool - Aligned buffers reused for transfers that cannot go straight to the caller
+ *
+ * Access to a pool must be serialised by its owner.
+ */
+typedef struct _ntfs_bounce_pool {
+    void *buffer[NTFS_BOUNCE_SLOTS];        /* Aligned buffers, or NULL when not yet allocated */
+    size_t size[NTFS_BOUNCE_SLOTS];         /* Size of each buffer (in bytes) */
+    bool busy[NTFS_BOUNCE_SLOTS];           /* True while a buffer is handed out */
+} ntfs_bounce_pool;
+
+/* Requests the asynchronous worker can hold at once, and the size of each (in bytes) */
+#define NTFS_ASYNC_QUEUE_DEPTH              2
+#define NTFS_ASYNC_CHUNK_SIZE               (64 * 1024)
+
+/**
+ * gekko_async_req - Sector read queued for the asynchronous worker
+ */
+typedef struct _gekko_async_req {
+    sec_t sector;                           /* First sector to read */
+    sec_t numSectors;                       /* Number of sectors to read */
+    void *buffer;                           /* Aligned destination buffer */
+    bool metadata;                          /* Cache the sectors as metadata */
+    bool uncached;                          /* Read the sectors without caching them */
+    bool readahead;                         /* Only load the sectors into the cache, nobody waits for the request */
+    bool done;                              /* True once the worker has finished with the request */
+    bool result;                            /* True if the read succeeded */
+} gekko_async_req;
+
 /**
  * gekko_fd - Gekko device driver descriptor
  */
@@ -47,12 +81,70 @@ typedef struct _gekko_fd {
     NTFS_CACHE *cache;                      /* Cache */
     u32 cachePageCount;                     /* The number of pages in the cache */
     u32 cachePageSize;                      /* The number of sectors per cache page */
+    u32 cacheMetaPageCount;                 /* The number of pages reserved for metadata */
+    u32 cacheMetaPageSize;                  /* The number of sectors per metadata cache page */
+    u32 cacheReadAhead;                     /* The maximum number of pages read ahead at once */
+    u32 cacheFlushAge;                      /* Milliseconds a page may stay dirty before the flusher writes it back */
+    u32 cacheFlushThreshold;                /* Percentage of dirty pages that wakes the flusher early */
+    NTFS_CACHE_POLICY cachePolicy;          /* The cache page replacement policy */
+    bool cacheShared;                       /* Share the cache with all other partitions on the device */
+    ntfs_discard_fn discard;                /* Discards freed sectors on the device, or NULL if not supported */
+    ntfs_bounce_pool bounce;                /* Aligned buffers for transfers that do not line up with the sectors */
+    bool asyncIO;                           /* Overlap large buffered reads with copying them out using a worker thread */
+    lwp_t asyncThread;                      /* Asynchronous worker thread, or LWP_THREAD_NULL if not running */
+    mutex_t asyncLock;                      /* Protects the request queue */
+    cond_t asyncCond;                       /* Wakes the worker when a request is queued or it must quit */
+    cond_t asyncDone;                       /* Wakes callers when a request completes */
+    bool asyncQuit;                         /* Tells the worker to quit */
+    gekko_async_req *asyncQueue[NTFS_ASYNC_QUEUE_DEPTH]; /* Queued requests, oldest first */
+    u32 asyncHead;                          /* Index of the oldest queued request */
+    u32 asyncCount;                         /* Number of queued requests */
+    gekko_async_req asyncReadahead;         /* The read ahead request, done once the worker has finished with it */
+    ntfs_io_trace_entry *trace;             /* Ring of the most recent device accesses, or NULL if not tracing */
+    u32 traceSize;                          /* The number of entries in the trace ring */
+    u32 traceNext;                          /* Index of the entry the next access is recorded in */
+    u32 traceUsed;                          /* The number of entries holding an access */
+    u32 traceSequence;                      /* Sequence number of the next access */
+    u64 traceStart;                         /* Time the trace was started */
+    mutex_t traceLock;                      /* Serialises all access to the trace */
+    mutex_t ioLock;                         /* Guards the bounce pool and serialises transfers made without a cache, which has a lock of its own */
+    ntfs_mount_stats mountStats;            /* Time and i/o taken by each phase of mounting */
+    bool mountTimed;                        /* True while the phases of mounting are being timed */
+    u64 mountStart;                         /* Time the mount started */
+    u64 phaseStart;                         /* Time the current phase of mounting started */
+    NTFS_CACHE_STATS phaseCache;            /* Cache counters when the current phase started */
+    struct NTFS_BUDGET *budget;             /* Memory budget of the volume the cache is sized to and charged to, or NULL */
+    size_t cacheCharge;                     /* Bytes of the cache charged to the budget */
 } gekko_fd;
 
 /* Forward declarations */
+struct NTFS_BUDGET;
+struct ntfs_device;
 struct ntfs_device_operations;
 
 /* Gekko device driver i/o operations */
 extern struct ntfs_device_operations ntfs_device_gekko_io_ops;
 
+/* Gekko device driver i/o trace */
+extern int ntfs_device_gekko_io_get_trace(struct ntfs_device *dev, ntfs_io_trace_entry *entries, int count);
+extern void ntfs_device_gekko_io_reset_trace(struct ntfs_device *dev);
+
+/* Gekko device driver memory budget */
+extern u32 ntfs_device_gekko_io_budget_pages(gekko_fd *fd, u32 pageCount, u32 pageSize);
+extern void ntfs_device_gekko_io_charge_cache(gekko_fd *fd);
+
+/* Gekko device driver mount timing */
+extern void ntfs_device_gekko_io_time_mount(struct ntfs_device *dev);
+extern void ntfs_device_gekko_io_end_phase(struct ntfs_device *dev, int phase);
+extern void ntfs_device_gekko_io_get_mount_stats(struct ntfs_device *dev, ntfs_mount_stats *stats);
+
+/* Gekko device driver locking of state shared between devices */
+extern void ntfs_device_gekko_io_init(void);
+extern void ntfs_device_gekko_io_lock_devices(void);
+extern void ntfs_device_gekko_io_unlock_devices(void);
+
+/* Gekko device driver cache page pinning */
+extern const void *ntfs_device_gekko_io_pin(struct ntfs_device *dev, s64 offset, s64 count, void **page);
+extern void ntfs_device_gekko_io_unpin(struct ntfs_device *dev, void *page);
+
 #endif /* _GEKKO_IO_H */
@@ -130,12 +130,13 @@ ntfs_index_context *ntfs_index_ctx_get(ntfs_inode *ni,
 	}
 	if (ni->nr_extents == -1)
 		ni = ni->base_ni;
-	icx = ntfs_calloc(sizeof(ntfs_index_context));
+	icx = ntfs_pool_get(&ni->vol->icx_pool);
 	if (icx)
 		*icx = (ntfs_index_context) {
 			.ni = ni,
 			.name = name,
 			.name_len = name_len,
+			.pool = &ni->vol->icx_pool,
 		};
 	return icx;
 }
@@ -170,7 +171,7 @@ static void ntfs_index_ctx_free(ntfs_index_context *icx)
 void ntfs_index_ctx_put(ntfs_index_context *icx)
 {
 	ntfs_index_ctx_free(icx);
-	free(icx);
+	ntfs_pool_put(icx->pool, icx);
 }
 
 /**
@@ -189,6 +190,7 @@ void ntfs_index_ctx_reinit(ntfs_index_context *icx)
 		.ni = icx->ni,
 		.name = icx->name,
 		.name_len = icx->name_len,
+		.pool = icx->pool,
 	};
 }
 
@@ -574,6 +576,7 @@ int ntfs_index_entry_inconsistent(const INDEX_ENTRY *ie,
  *   STATUS_ERROR with errno set if on unexpected error during lookup.
  */
 static int ntfs_ie_lookup(const void *key, const int key_len,
+			  const ntfschar *upkey,
 			  ntfs_index_context *icx, INDEX_HEADER *ih,
 			  VCN *vcn, INDEX_ENTRY **ie_out)
 {
@@ -620,7 +623,17 @@ static int ntfs_ie_lookup(const void *key, const int key_len,
 			errno = EIO;
 			return STATUS_ERROR;
 		}
-		rc = icx->collate(icx->ni->vol, key, key_len,
+		if (upkey) {
+			const FILE_NAME_ATTR *fn = (const FILE_NAME_ATTR*)key;
+			ntfs_volume *vol = icx->ni->vol;
+
+			rc = ntfs_names_full_collate_upcased(fn->file_name,
+				upkey, fn->file_name_length,
+				ie->key.file_name.file_name,
+				ie->key.file_name.file_name_length,
+				CASE_SENSITIVE, vol->upcase, vol->upcase_len);
+		} else
+			rc = icx->collate(icx->ni->vol, key, key_len,
 					&ie->key, le16_to_cpu(ie->key_length));
 		if (rc == NTFS_COLLATION_ERROR) {
 			ntfs_log_error("Collation error. Perhaps a filename "
@@ -640,11 +653,18 @@ static int ntfs_ie_lookup(const void *key, const int key_len,
 			*ie_out = ie;
 			errno = 0;
 			icx->parent_pos[icx->pindex] = item;
+			icx->rightmost = FALSE;
 			return STATUS_OK;
 		}
 		
 		item++;
 	}
+	/*
+	 * Keys inserted in ascending order all land past the last entry,
+	 * at every level of the B+tree.
+	 */
+	if (!ntfs_ie_end(ie))
+		icx->rightmost = FALSE;
 	/*
 	 * We have finished with this index block without success. Check for the
 	 * presence of a child node and if not present return with errno ENOENT,
@@ -774,6 +794,8 @@ int ntfs_index_lookup(const void *key, const int key_len, ntfs_index_context *ic
 	INDEX_ROOT *ir;
 	INDEX_ENTRY *ie;
 	INDEX_BLOCK *ib = NULL;
+	ntfschar upkey[NTFS_MAX_NAME_LEN];
+	const ntfschar *pupkey;
 	int ret, err = 0;
 
 	ntfs_log_trace("Entering\n");
@@ -813,8 +835,25 @@ int ntfs_index_lookup(const void *key, const int key_len, ntfs_index_context *ic
 		goto err_out;
 	}
 	
+		/* file names are upcased once for all the collations */
+	pupkey = (const ntfschar*)NULL;
+	if ((ir->collation_rule == COLLATION_FILE_NAME)
+	    && (key_len >= (int)offsetof(FILE_NAME_ATTR, file_name))) {
+		const FILE_NAME_ATTR *fn = (const FILE_NAME_ATTR*)key;
+
+		if (key_len >= (int)(offsetof(FILE_NAME_ATTR, file_name)
+				+ fn->file_name_length*sizeof(ntfschar))) {
+			memcpy(upkey, fn->file_name,
+				fn->file_name_length*sizeof(ntfschar));
+			ntfs_name_upcase(upkey, fn->file_name_length,
+				ni->vol->upcase, ni->vol->upcase_len);
+			pupkey = upkey;
+		}
+	}
+	
 	old_vcn = VCN_INDEX_ROOT_PARENT;
-	ret = ntfs_ie_lookup(key, key_len, icx, &ir->index, &vcn, &ie);
+	icx->rightmost = TRUE;
+	ret = ntfs_ie_lookup(key, key_len, pupkey, icx, &ir->index, &vcn, &ie);
 	if (ret == STATUS_ERROR) {
 		err = errno;
 		goto err_lookup;
@@ -856,7 +895,7 @@ descend_into_child_node:
 	if (ntfs_ib_read(icx, vcn, ib))
 		goto err_out;
 	
-	ret = ntfs_ie_lookup(key, key_len, icx, &ib->index, &vcn, &ie);
+	ret = ntfs_ie_lookup(key, key_len, pupkey, icx, &ib->index, &vcn, &ie);
 	if (ret != STATUS_KEEP_SEARCHING) {
 		err = errno;
 		if (ret == STATUS_ERROR)
@@ -964,6 +1003,39 @@ static INDEX_ENTRY *ntfs_ie_get_median(INDEX_HEADER *ih)
 	return ie;
 }
 
+/**
+ *  Find where to split a block receiving keys in ascending order
+ *
+ *  Only the last entry is moved to the new block, with the one before it
+ *  going up to the parent, so that the block is left nearly full instead of
+ *  half empty, as nothing more will be inserted into it.  Blocks with too
+ *  few entries for this are split at the median.
+ */
+static INDEX_ENTRY *ntfs_ie_get_append_median(INDEX_HEADER *ih)
+{
+	INDEX_ENTRY *ie, *prev, *median;
+	u8 *ie_end;
+	int i = 0;
+	
+	ntfs_log_trace("Entering\n");
+	
+	ie = ntfs_ie_get_first(ih);
+	ie_end = (u8 *)ntfs_ie_get_end(ih);
+	prev = median = NULL;
+	while ((u8 *)ie < ie_end && !ntfs_ie_end(ie)) {
+		median = prev;
+		prev = ie;
+		ie = ntfs_ie_get_next(ie);
+		i++;
+	}
+	if (i < 4)
+		return ntfs_ie_get_median(ih);
+	
+	ntfs_log_trace("Entries: %d  median: %d\n", i, i - 2);
+	
+	return median;
+}
+
 static s64 ntfs_ibm_vcn_to_pos(ntfs_index_context *icx, VCN vcn)
 {
 	return ntfs_ib_vcn_to_pos(icx, vcn) / icx->block_size;
@@ -1525,7 +1597,10 @@ static int ntfs_ib_split(ntfs_index_context *icx, INDEX_BLOCK *ib)
 	if (ntfs_icx_parent_dec(icx))
 		return STATUS_ERROR;
 	
-	median  = ntfs_ie_get_median(&ib->index);
+	if (icx->rightmost)
+		median = ntfs_ie_get_append_median(&ib->index);
+	else
+		median = ntfs_ie_get_median(&ib->index);
 	new_vcn = ntfs_ibm_get_free(icx);
 	if (new_vcn == -1)
 		return STATUS_ERROR;
@@ -1648,6 +1723,7 @@ int ntfs_index_add_filename(ntfs_inode *ni, FILE_NAME_ATTR *fn, MFT_REF mref)
 	ie->key_length 	 = cpu_to_le16(fn_size);
 	memcpy(&ie->key, fn, fn_size);
 	
+	ntfs_drop_case_index(ni);
 	icx = ntfs_index_ctx_get(ni, NTFS_INDEX_I30, 4);
 	if (!icx)
 		goto out;
@@ -1965,6 +2041,7 @@ int ntfs_index_remove(ntfs_inode *dir_ni,
 	int ret = STATUS_ERROR;
 	ntfs_index_context *icx;
 
+	ntfs_drop_case_index(dir_ni);
 	icx = ntfs_index_ctx_get(dir_ni, NTFS_INDEX_I30, 4);
 	if (!icx)
 		return -1;
@@ -2057,6 +2134,17 @@ static INDEX_ENTRY *ntfs_index_walk_down(INDEX_ENTRY *ie,
 			/* down from non-zero level */
 			
 			ictx->pindex++;
+		}
+			/*
+			 * A walk over the tree visits the blocks in
+			 * collation order, which is unrelated to their
+			 * order on disk, so load as many as the cache
+			 * can hold beforehand in large reads.
+			 */
+		if (!ictx->ia_prefetched && ictx->ia_na) {
+			ntfs_attr_prefetch(ictx->ia_na, 0,
+					ictx->ia_na->initialized_size);
+			ictx->ia_prefetched = TRUE;
 		}
 		ictx->parent_pos[ictx->pindex] = 0;
 		ictx->parent_vcn[ictx->pindex] = vcn;
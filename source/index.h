@@ -130,8 +130,11 @@ typedef struct {
 	int pindex;	     /* maximum it's the number of the parent nodes  */
 	BOOL ib_dirty;
 	BOOL bad_index;
+	BOOL ia_prefetched; /* index blocks were read into the cache */
+	BOOL rightmost;	/* the lookup went past every entry at each level */
 	u32 block_size;
 	u8 vcn_size_bits;
+	struct NTFS_POOL *pool; /* where to release the context */
 } ntfs_index_context;
 
 extern ntfs_index_context *ntfs_index_ctx_get(ntfs_inode *ni,
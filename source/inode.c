@@ -92,7 +92,7 @@ static ntfs_inode *__ntfs_inode_allocate(ntfs_volume *vol)
 {
 	ntfs_inode *ni;
 
-	ni = (ntfs_inode*)ntfs_calloc(sizeof(ntfs_inode));
+	ni = (ntfs_inode*)ntfs_pool_zget(&vol->inode_pool);
 	if (ni)
 		ni->vol = vol;
 	return ni;
@@ -126,8 +126,8 @@ static void __ntfs_inode_release(ntfs_inode *ni)
 			       (long long)ni->mft_no);
 	if (NInoAttrList(ni) && ni->attr_list)
 		free(ni->attr_list);
-	free(ni->mrec);
-	free(ni);
+	ntfs_pool_put(&ni->vol->mrec_pool, ni->mrec);
+	ntfs_pool_put(&ni->vol->inode_pool, ni);
 	return;
 }
 
@@ -408,7 +408,34 @@ err:
 
 void ntfs_inode_nidata_free(const struct CACHED_GENERIC *cached)
 {
-        ntfs_inode_real_close(((const struct CACHED_NIDATA*)cached)->ni);
+	ntfs_inode *ni = ((const struct CACHED_NIDATA*)cached)->ni;
+
+	/*
+	 * With lazy sync the inode may still be dirty. Writing it back
+	 * now could reenter the cache while it is being updated, so it
+	 * is queued and closed once the cache is consistent again.
+	 */
+	if (NInoDirty(ni) || NInoAttrListDirty(ni)) {
+		ni->next_pending = ni->vol->nidata_pending;
+		ni->vol->nidata_pending = ni;
+	} else
+		ntfs_inode_real_close(ni);
+}
+
+/*
+ *		Close the dirty inodes dropped from the cache
+ *
+ *	Writing them back may drop more inodes, which are closed as well.
+ */
+
+static void ntfs_inode_close_pending(ntfs_volume *vol)
+{
+	ntfs_inode *ni;
+
+	while ((ni = vol->nidata_pending)) {
+		vol->nidata_pending = ni->next_pending;
+		ntfs_inode_real_close(ni);
+	}
 }
 
 /*
@@ -417,8 +444,8 @@ void ntfs_inode_nidata_free(const struct CACHED_GENERIC *cached)
 
 int ntfs_inode_nidata_hash(const struct CACHED_GENERIC *item)
 {
-	return (((const struct CACHED_NIDATA*)item)->inum
-			% (2*CACHE_NIDATA_SIZE));
+	return ((int)(((const struct CACHED_NIDATA*)item)->inum
+			& 0x7fffffff));
 }
 
 /*
@@ -448,6 +475,47 @@ void ntfs_inode_invalidate(ntfs_volume *vol, const MFT_REF mref)
 	item.varsize = 0;
 	ntfs_invalidate_cache(vol->nidata_cache,
 				GENERIC(&item),idata_cache_compare,CACHE_FREE);
+	ntfs_inode_close_pending(vol);
+}
+
+/*
+ *		Write back the dirty inodes kept in the cache by lazy sync
+ *
+ *	Each inode is taken out of the cache while it is synced, as if
+ *	it was open, so that syncing its parent directory cannot drop
+ *	it. The cache is searched again after each one, as syncing
+ *	reorders it.
+ *
+ *	Returns 0 if all inodes could be synced, -1 otherwise (inodes
+ *	which could not be synced are closed).
+ */
+
+int ntfs_inode_sync_cached(ntfs_volume *vol)
+{
+	struct CACHED_GENERIC *current;
+	ntfs_inode *ni = (ntfs_inode*)NULL;
+	int res = 0;
+
+	if (!vol->nidata_cache)
+		return (0);
+	do {
+		for (current = vol->nidata_cache->most_recent_entry;
+		     current; current = current->next) {
+			ni = ((struct CACHED_NIDATA*)current)->ni;
+			if (NInoDirty(ni) || NInoAttrListDirty(ni))
+				break;
+		}
+		if (current) {
+			ntfs_remove_cache(vol->nidata_cache, current, 0);
+			if (ntfs_inode_sync(ni)) {
+				res = -1;
+				ntfs_inode_real_close(ni);
+			} else
+				ntfs_inode_close(ni);
+		}
+	} while (current);
+	ntfs_inode_close_pending(vol);
+	return (res);
 }
 
 #endif
@@ -509,17 +577,23 @@ int ntfs_inode_close(ntfs_inode *ni)
 #if CACHE_NIDATA_SIZE
 	BOOL dirty;
 	struct CACHED_NIDATA item;
+	struct CACHED_NIDATA *cached;
+	ntfs_volume *vol;
 
 	if (ni) {
 		debug_double_inode(ni->mft_no,0);
+		vol = ni->vol;
 		/* do not cache system files : could lead to double entries */
-		if (ni->vol && ni->vol->nidata_cache
+		if (vol && vol->nidata_cache
 			&& ((ni->mft_no == FILE_root)
 			    || ((ni->mft_no >= FILE_first_user)
 				&& !(ni->mrec->flags & MFT_RECORD_IS_4)))) {
-			/* If we have dirty metadata, write it out. */
+			/*
+			 * If we have dirty metadata, write it out, unless
+			 * lazy sync leaves it to ntfs_inode_sync_cached().
+			 */
 			dirty = NInoDirty(ni) || NInoAttrListDirty(ni);
-			if (dirty) {
+			if (dirty && !NVolLazySync(vol)) {
 				res = ntfs_inode_sync(ni);
 					/* do a real close if sync failed */
 				if (res)
@@ -534,8 +608,35 @@ int ntfs_inode_close(ntfs_inode *ni)
 				item.pathname = (const char*)NULL;
 				item.varsize = 0;
 				debug_cached_inode(ni);
-				ntfs_enter_cache(ni->vol->nidata_cache,
-					GENERIC(&item), idata_cache_compare);
+				cached = (struct CACHED_NIDATA*)ntfs_enter_cache(
+					vol->nidata_cache, GENERIC(&item),
+					idata_cache_compare);
+				/*
+				 * A copy closed while this one was open is
+				 * stale once this one changed, drop it for
+				 * this one unless it has changes of its own
+				 * still to write back.
+				 */
+				if (cached && (cached->ni != ni) && dirty
+				    && !NInoDirty(cached->ni)
+				    && !NInoAttrListDirty(cached->ni)) {
+					ntfs_invalidate_cache(vol->nidata_cache,
+						GENERIC(&item),
+						idata_cache_compare,
+						CACHE_FREE);
+					cached = (struct CACHED_NIDATA*)
+						ntfs_enter_cache(
+							vol->nidata_cache,
+							GENERIC(&item),
+							idata_cache_compare);
+				}
+				/*
+				 * When the budget refuses the entry, the
+				 * inode is written back and really closed.
+				 */
+				if (!cached || (cached->ni != ni))
+					res = ntfs_inode_real_close(ni);
+				ntfs_inode_close_pending(vol);
 			}
 		} else {
 			/* cache not ready or system file, really close */
@@ -1194,6 +1295,7 @@ int ntfs_inode_add_attrlist(ntfs_inode *ni)
 	ni->attr_list_size = al_len;
 	NInoSetAttrList(ni);
 	NInoAttrListSetDirty(ni);
+	ntfs_inode_forget_attrs(ni);
 
 	/* Free space if there is not enough it for $ATTRIBUTE_LIST. */
 	if (le32_to_cpu(ni->mrec->bytes_allocated) -
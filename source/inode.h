@@ -97,6 +97,26 @@ typedef enum {
 #define NInoFileNameTestAndClearDirty(ni)	\
 				    test_and_clear_nino_flag(ni, FileNameDirty)
 
+#if ATTR_INDEX_SIZE
+
+/**
+ * struct ATTR_INDEX_ENTRY - where an attribute list lookup ended
+ *
+ * Remembers, for an attribute type and name, the offset of its first
+ * attribute list entry and of the attribute record in the mft record that
+ * entry points to.  The name is only kept as a hash, a hit is checked
+ * against the attribute list and the record before being used.
+ */
+struct ATTR_INDEX_ENTRY {
+	ATTR_TYPES type;
+	u16 name_hash;
+	u8 name_len;
+	u16 attr_offset;	/* Offset of the attribute in its record. */
+	u32 al_offset;		/* Offset of the entry in the attribute list. */
+};
+
+#endif
+
 /**
  * struct _ntfs_inode - The NTFS in-memory inode structure.
  *
@@ -164,8 +184,24 @@ struct _ntfs_inode {
 	le32 security_id;
 	le64 quota_charged;
 	le64 usn;
+#if CACHE_NIDATA_SIZE
+	ntfs_inode *next_pending; /* Next inode in vol->nidata_pending */
+#endif
+#if ATTR_INDEX_SIZE
+	struct ATTR_INDEX_ENTRY attr_index[ATTR_INDEX_SIZE]; /* Recent lookups
+				   through the attribute list, valid until
+				   the list changes */
+	u8 attr_index_count;	/* Entries in use in the above */
+	u8 attr_index_next;	/* Entry to be replaced next */
+#endif
 };
 
+#if ATTR_INDEX_SIZE
+#define ntfs_inode_forget_attrs(ni)	((ni)->attr_index_count = 0)
+#else
+#define ntfs_inode_forget_attrs(ni)	do { } while (0)
+#endif
+
 typedef enum {
 	NTFS_UPDATE_ATIME = 1 << 0,
 	NTFS_UPDATE_MTIME = 1 << 1,
@@ -192,6 +228,7 @@ extern int ntfs_inode_real_close(ntfs_inode *ni);
 extern void ntfs_inode_invalidate(ntfs_volume *vol, const MFT_REF mref);
 extern void ntfs_inode_nidata_free(const struct CACHED_GENERIC *cached);
 extern int ntfs_inode_nidata_hash(const struct CACHED_GENERIC *item);
+extern int ntfs_inode_sync_cached(ntfs_volume *vol);
 
 #endif
 
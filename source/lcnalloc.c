@@ -35,6 +35,9 @@
 #ifdef HAVE_ERRNO_H
 #include <errno.h>
 #endif
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
 
 #include "types.h"
 #include "attrib.h"
@@ -45,6 +48,7 @@
 #include "lcnalloc.h"
 #include "logging.h"
 #include "misc.h"
+#include "device.h"
 
 /*
  * Plenty possibilities for big optimizations all over in the cluster
@@ -54,6 +58,8 @@
  */
 #define NTFS_LCNALLOC_BSIZE 4096
 #define NTFS_LCNALLOC_SKIP  NTFS_LCNALLOC_BSIZE
+#define NTFS_BEST_FIT_MIN   (1 << 20) /* bytes, smaller allocations stay first fit */
+#define NTFS_RESV_SIZE      (4 << 20) /* bytes reserved ahead of a growing file */
 
 enum {
 	ZONE_MFT = 1,
@@ -113,9 +119,709 @@ static void update_full_status(ntfs_volume *vol, LCN lcn)
 		}
 }
  
+/*
+ *		Freed cluster runs waiting to be discarded on the device
+ */
+
+#define NTFS_DISCARD_BATCH 16
+
+struct discard_batch {
+	int nr;
+	LCN lcn[NTFS_DISCARD_BATCH];
+	s64 count[NTFS_DISCARD_BATCH];
+} ;
+
+/*
+ *		Send the queued runs to the device as discard ranges
+ *
+ *	Failures are not reported, the clusters have been freed anyway.
+ *	A device which does not support discarding is not asked again.
+ */
+
+static void discard_flush(ntfs_volume *vol, struct discard_batch *batch)
+{
+	u64 range[2];
+	int olderrno;
+	int i;
+
+	olderrno = errno;
+	for (i = 0; (i < batch->nr) && NVolDiscard(vol); i++) {
+		range[0] = batch->lcn[i] << vol->cluster_size_bits;
+		range[1] = batch->count[i] << vol->cluster_size_bits;
+		if (vol->dev->d_ops->ioctl(vol->dev, BLKDISCARD, range)) {
+			if (errno == EOPNOTSUPP)
+				NVolClearDiscard(vol);
+			ntfs_log_debug("Failed to discard clusters (%lld, %lld)\n",
+					(long long)batch->lcn[i],
+					(long long)batch->count[i]);
+		}
+	}
+	batch->nr = 0;
+	errno = olderrno;
+}
+
+/*
+ *		Queue a freed run, merging it with the previous one if adjacent
+ */
+
+static void discard_queue(ntfs_volume *vol, struct discard_batch *batch,
+			LCN lcn, s64 count)
+{
+	if (!NVolDiscard(vol))
+		return;
+	if (batch->nr && (batch->lcn[batch->nr - 1]
+			+ batch->count[batch->nr - 1] == lcn)) {
+		batch->count[batch->nr - 1] += count;
+		return;
+	}
+	if (batch->nr == NTFS_DISCARD_BATCH)
+		discard_flush(vol, batch);
+	batch->lcn[batch->nr] = lcn;
+	batch->count[batch->nr] = count;
+	batch->nr++;
+}
+
+/*
+ *		Freed cluster runs waiting to be cleared in $Bitmap
+ *
+ *	Unlinks and truncations only queue the runs they free, so that
+ *	they do not have to walk the bitmap of a big file. The clusters
+ *	are counted as free straight away, but they stay marked in use
+ *	until ntfs_cluster_free_flush() clears them, so that they cannot
+ *	be allocated again before the record releasing them is written.
+ */
+
+#define NTFS_FREE_QUEUE_STEP 64 /* runs added to the queue at a time */
+
+struct FREE_QUEUE {
+	int nr;
+	int size;
+	s64 clusters;	/* total of the runs queued */
+	struct {
+		LCN lcn;
+		s64 count;
+	} run[1];
+} ;
+
+/*
+ *		Blocks of $Bitmap kept in memory by the allocator
+ *
+ *	Allocations and frees update the blocks in memory, and the dirty
+ *	ones are written back when the volume is synced or when a block
+ *	is evicted to make room for another one, so that a sequence of
+ *	small allocations in the same area costs a single write.
+ */
+
+#define NTFS_LCNBMP_BLOCKS 4
+
+struct LCNBMP_BLOCK {
+	s64 pos;	/* offset in $Bitmap, -1 if the slot is unused */
+	s64 size;	/* bytes of $Bitmap in the block */
+	u32 stamp;	/* last use, for eviction */
+	BOOL dirty;
+	u8 data[NTFS_LCNALLOC_BSIZE];
+} ;
+
+struct LCNBMP_CACHE {
+	u32 stamp;
+	struct LCNBMP_BLOCK block[NTFS_LCNBMP_BLOCKS];
+} ;
+
+static int lcnbmp_write_block(ntfs_volume *vol, struct LCNBMP_BLOCK *block)
+{
+	s64 written;
+
+	written = ntfs_attr_pwrite(vol->lcnbmp_na, block->pos, block->size,
+			block->data);
+	if (written != block->size) {
+		if (written >= 0)
+			errno = EIO;
+		ntfs_log_perror("Bitmap write error (%lld, %lld)",
+				(long long)block->pos, (long long)block->size);
+		return (-1);
+	}
+	block->dirty = FALSE;
+	return (0);
+}
+
+/*
+ *		Find the cached block starting at @pos, or NULL
+ */
+
+static struct LCNBMP_BLOCK *lcnbmp_find(ntfs_volume *vol, s64 pos)
+{
+	struct LCNBMP_CACHE *cache;
+	int i;
+
+	cache = vol->lcnbmp_cache;
+	if (cache)
+		for (i = 0; i < NTFS_LCNBMP_BLOCKS; i++)
+			if (cache->block[i].pos == pos) {
+				cache->block[i].stamp = ++cache->stamp;
+				return (&cache->block[i]);
+			}
+	return ((struct LCNBMP_BLOCK*)NULL);
+}
+
+/*
+ *		Get the block starting at @pos, reading it if not cached
+ *
+ *	Returns NULL with errno set on error, and with errno zero
+ *	when @pos is beyond the end of $Bitmap.
+ */
+
+static struct LCNBMP_BLOCK *lcnbmp_get(ntfs_volume *vol, s64 pos)
+{
+	struct LCNBMP_CACHE *cache;
+	struct LCNBMP_BLOCK *block;
+	s64 br;
+	int i;
+
+	block = lcnbmp_find(vol, pos);
+	if (block)
+		return (block);
+	cache = vol->lcnbmp_cache;
+	if (!cache) {
+		cache = (struct LCNBMP_CACHE*)ntfs_malloc(
+				sizeof(struct LCNBMP_CACHE));
+		if (!cache)
+			return ((struct LCNBMP_BLOCK*)NULL);
+		cache->stamp = 0;
+		for (i = 0; i < NTFS_LCNBMP_BLOCKS; i++) {
+			cache->block[i].pos = -1;
+			cache->block[i].dirty = FALSE;
+		}
+		vol->lcnbmp_cache = cache;
+	}
+		/* take an unused slot, or the least recently used one */
+	block = &cache->block[0];
+	for (i = 1; (i < NTFS_LCNBMP_BLOCKS) && (block->pos >= 0); i++)
+		if ((cache->block[i].pos < 0)
+		    || ((s32)(cache->block[i].stamp - block->stamp) < 0))
+			block = &cache->block[i];
+	if (block->dirty && lcnbmp_write_block(vol, block))
+		return ((struct LCNBMP_BLOCK*)NULL);
+	block->pos = -1;
+	br = ntfs_attr_pread(vol->lcnbmp_na, pos, NTFS_LCNALLOC_BSIZE,
+			block->data);
+	if (br <= 0) {
+		if (!br)
+			errno = 0;
+		return ((struct LCNBMP_BLOCK*)NULL);
+	}
+	block->pos = pos;
+	block->size = br;
+	block->stamp = ++cache->stamp;
+	return (block);
+}
+
+/*
+ *		Copy between a buffer and the cached blocks it overlaps
+ *
+ *	Used for transfers too big to go through the cache, which
+ *	are done directly on $Bitmap.
+ */
+
+static void lcnbmp_overlay(ntfs_volume *vol, s64 pos, s64 count, u8 *b,
+			BOOL write)
+{
+	struct LCNBMP_BLOCK *block;
+	s64 start, end;
+	int i;
+
+	if (!vol->lcnbmp_cache)
+		return;
+	for (i = 0; i < NTFS_LCNBMP_BLOCKS; i++) {
+		block = &vol->lcnbmp_cache->block[i];
+		if (block->pos < 0)
+			continue;
+		start = (block->pos > pos ? block->pos : pos);
+		end = block->pos + block->size;
+		if (end > pos + count)
+			end = pos + count;
+		if (start >= end)
+			continue;
+		if (write)
+			memcpy(block->data + start - block->pos,
+					b + start - pos, end - start);
+		else
+			memcpy(b + start - pos,
+					block->data + start - block->pos,
+					end - start);
+	}
+}
+
+static s64 lcnbmp_io(ntfs_volume *vol, s64 pos, s64 count, u8 *b,
+			BOOL write)
+{
+	struct LCNBMP_BLOCK *block;
+	s64 done, offs, n;
+
+	if (pos < 0 || count < 0) {
+		errno = EINVAL;
+		return (-1);
+	}
+	if (count > NTFS_LCNALLOC_BSIZE) {
+		if (write)
+			done = ntfs_attr_pwrite(vol->lcnbmp_na, pos, count, b);
+		else
+			done = ntfs_attr_pread(vol->lcnbmp_na, pos, count, b);
+		if (done > 0)
+			lcnbmp_overlay(vol, pos, done, b, write);
+		return (done);
+	}
+	done = 0;
+	while (done < count) {
+		offs = (pos + done) & (NTFS_LCNALLOC_BSIZE - 1);
+		block = lcnbmp_get(vol, pos + done - offs);
+		if (!block) {
+			if (errno)
+				return (done ? done : -1);
+			break;
+		}
+		if (offs >= block->size)
+			break;
+		n = block->size - offs;
+		if (n > count - done)
+			n = count - done;
+		if (write) {
+			memcpy(block->data + offs, b + done, n);
+			block->dirty = TRUE;
+		} else
+			memcpy(b + done, block->data + offs, n);
+		done += n;
+	}
+	return (done);
+}
+
+/**
+ * ntfs_cluster_bitmap_pread - read from $Bitmap through the allocator cache
+ * @vol:	mounted ntfs volume
+ * @pos:	byte offset in $Bitmap
+ * @count:	number of bytes to read
+ * @b:		output buffer
+ *
+ * Same as ntfs_attr_pread() on @vol->lcnbmp_na, but taking into account
+ * the updates not yet written back.
+ */
+s64 ntfs_cluster_bitmap_pread(ntfs_volume *vol, s64 pos, s64 count, void *b)
+{
+	return (lcnbmp_io(vol, pos, count, (u8*)b, FALSE));
+}
+
+/**
+ * ntfs_cluster_bitmap_pwrite - write to $Bitmap through the allocator cache
+ * @vol:	mounted ntfs volume
+ * @pos:	byte offset in $Bitmap
+ * @count:	number of bytes to write
+ * @b:		data to write
+ *
+ * Same as ntfs_attr_pwrite() on @vol->lcnbmp_na, except that small writes
+ * are only recorded in memory until ntfs_cluster_bitmap_sync().
+ */
+s64 ntfs_cluster_bitmap_pwrite(ntfs_volume *vol, s64 pos, s64 count,
+			const void *b)
+{
+	return (lcnbmp_io(vol, pos, count, (u8*)b, TRUE));
+}
+
+/**
+ * ntfs_cluster_bitmap_sync - write back the cached updates of $Bitmap
+ * @vol:	mounted ntfs volume
+ *
+ * Return 0 on success, or -1 with errno set if a block could not be
+ * written, in which case it is kept for the next attempt.
+ */
+int ntfs_cluster_bitmap_sync(ntfs_volume *vol)
+{
+	int ret = 0;
+	int i;
+
+	if (vol->lcnbmp_cache)
+		for (i = 0; i < NTFS_LCNBMP_BLOCKS; i++)
+			if (vol->lcnbmp_cache->block[i].dirty
+			    && lcnbmp_write_block(vol,
+					&vol->lcnbmp_cache->block[i]))
+				ret = -1;
+	return (ret);
+}
+
+/*
+ *		Count the clear bits among the first @bits of a part of $Bitmap
+ */
+
+static int count_free_bits(const u8 *buf, int bits)
+{
+	int nr_free;
+	int j;
+
+	nr_free = ntfs_bitmap_count_clear(buf, bits >> 3);
+	for (j = 0; j < (bits & 7); j++)
+		if (!(buf[bits >> 3] & (1 << j)))
+			nr_free++;
+	return (nr_free);
+}
+
+/*
+ *		Build the map of free clusters per group of clusters
+ *
+ *	This reads the whole $Bitmap once, afterwards the allocator skips
+ *	the groups which have no free clusters without reading them, and
+ *	allocations and frees keep the map up to date.
+ *
+ *	Failing to build the map is not an error, the allocator then
+ *	scans $Bitmap as before, and no new attempt is made.
+ */
+
+static void lcn_map_build(ntfs_volume *vol)
+{
+	u16 *map;
+	u8 *buf;
+	s64 groups, br, pos, bits;
+	int chunk, i, n;
+
+	chunk = 16*NTFS_LCNALLOC_BSIZE; /* sixteen groups per read */
+
+	groups = (vol->nr_clusters + NTFS_LCN_MAP_CLUSTERS - 1)
+			>> NTFS_LCN_MAP_BITS;
+	vol->lcn_free_map_size = -1;
+	map = (u16*)ntfs_malloc(groups * sizeof(u16));
+	buf = (u8*)ntfs_malloc(chunk);
+	if (!map || !buf)
+		goto out;
+	i = 0;
+	for (pos = 0; i < groups; pos += br) {
+		br = ntfs_cluster_bitmap_pread(vol, pos, chunk, buf);
+		if (br <= 0) {
+			ntfs_log_debug("Could not read $Bitmap for the map\n");
+			goto out;
+		}
+		for (n = 0; (n < br) && (i < groups);
+				n += NTFS_LCNALLOC_BSIZE, i++) {
+			bits = vol->nr_clusters - ((s64)i << NTFS_LCN_MAP_BITS);
+			if (bits > NTFS_LCN_MAP_CLUSTERS)
+				bits = NTFS_LCN_MAP_CLUSTERS;
+			if (bits > ((br - n) << 3))
+				bits = (br - n) << 3;
+			map[i] = count_free_bits(buf + n, bits);
+		}
+	}
+	vol->lcn_free_map = map;
+	vol->lcn_free_map_size = groups;
+	map = (u16*)NULL;
+out:
+	free(buf);
+	free(map);
+}
+
+/*
+ *		Account for a run of clusters freed in the map
+ */
+
+static void lcn_map_freed(ntfs_volume *vol, LCN lcn, s64 count)
+{
+	s64 i, n;
+
+	if (!vol->lcn_free_map)
+		return;
+	while (count > 0) {
+		i = lcn >> NTFS_LCN_MAP_BITS;
+		n = NTFS_LCN_MAP_CLUSTERS - (lcn & (NTFS_LCN_MAP_CLUSTERS - 1));
+		if (n > count)
+			n = count;
+		if (i >= vol->lcn_free_map_size)
+			break;
+		if (vol->lcn_free_map[i] + n > NTFS_LCN_MAP_CLUSTERS)
+			vol->lcn_free_map[i] = NTFS_LCN_MAP_CLUSTERS;
+		else
+			vol->lcn_free_map[i] += n;
+		lcn += n;
+		count -= n;
+	}
+}
+
+/*
+ *		Find the first group at or after @pos which has free clusters
+ *
+ *	Returns @pos if its own group has some, the start of a later group,
+ *	or @end if there are none before it.
+ */
+
+static LCN lcn_map_next_free(ntfs_volume *vol, LCN pos, LCN end)
+{
+	s64 i;
+
+	i = pos >> NTFS_LCN_MAP_BITS;
+	if ((i >= vol->lcn_free_map_size) || vol->lcn_free_map[i])
+		return (pos);
+	do {
+		i++;
+		pos = i << NTFS_LCN_MAP_BITS;
+	} while ((pos < end) && (i < vol->lcn_free_map_size)
+			&& !vol->lcn_free_map[i]);
+	return (pos < end ? pos : end);
+}
+
+/**
+ * ntfs_cluster_count_free - count the free clusters of a volume
+ * @vol:	mounted ntfs volume
+ *
+ * Read the whole $Bitmap, rebuilding the free cluster map on the way so
+ * that it agrees with the count.
+ *
+ * Return the number of free clusters, or -1 with errno set on error.
+ */
+s64 ntfs_cluster_count_free(ntfs_volume *vol)
+{
+	s64 i, nr_free;
+
+	free(vol->lcn_free_map);
+	vol->lcn_free_map = (u16*)NULL;
+	vol->lcn_free_map_size = 0;
+	lcn_map_build(vol);
+	if (!vol->lcn_free_map) {
+		if (ntfs_cluster_bitmap_sync(vol))
+			return (-1);
+		nr_free = ntfs_attr_get_free_bits(vol->lcnbmp_na);
+		if (nr_free < 0)
+			return (-1);
+	} else {
+		nr_free = 0;
+		for (i = 0; i < vol->lcn_free_map_size; i++)
+			nr_free += vol->lcn_free_map[i];
+	}
+		/* the clusters waiting to be cleared are free as well */
+	if (vol->free_queue)
+		nr_free += vol->free_queue->clusters;
+	return (nr_free);
+}
+
+/*
+ *		State of the search for the best fitting free extent
+ */
+
+struct best_fit {
+	LCN hint;
+	s64 count;
+	LCN run_start;	/* start of the free run being scanned, or -1 */
+	LCN best;
+	s64 best_len;
+} ;
+
+/*
+ *		Note the end of a free run
+ *
+ *	Returns TRUE when the search can stop, because the run at the
+ *	hint or a run of exactly the size wanted has been found.
+ */
+
+static BOOL best_fit_end_run(struct best_fit *bf, LCN end)
+{
+	s64 len;
+
+	if (bf->run_start < 0)
+		return (FALSE);
+	len = end - bf->run_start;
+	if ((bf->hint >= bf->run_start) && (bf->hint + bf->count <= end)) {
+		bf->best = bf->hint;
+		return (TRUE);
+	}
+	if ((len >= bf->count) && ((bf->best < 0) || (len < bf->best_len))) {
+		bf->best = bf->run_start;
+		bf->best_len = len;
+	}
+	bf->run_start = -1;
+	return (bf->best_len == bf->count);
+}
+
+/*
+ *		Find the smallest free extent of at least @count clusters
+ *
+ *	Both data zones are searched, skipping the groups which the free
+ *	cluster map shows as full.  The extent at @hint is preferred when
+ *	it is large enough, so that a file being extended stays contiguous.
+ *
+ *	Returns the first cluster of the extent, or -1 if no extent is
+ *	large enough or $Bitmap could not be read.
+ */
+
+static LCN lcn_best_fit(ntfs_volume *vol, LCN hint, s64 count)
+{
+	struct best_fit bf;
+	LCN zone[2][2];
+	LCN pos, end, base, next;
+	s64 br, size, i, n;
+	u8 *buf;
+	u8 v;
+	int z;
+
+	buf = ntfs_malloc(NTFS_LCNALLOC_BSIZE);
+	if (!buf)
+		return (-1);
+	bf.hint = hint;
+	bf.count = count;
+	bf.best = -1;
+	bf.best_len = 0;
+	zone[0][0] = vol->mft_zone_end;
+	zone[0][1] = vol->nr_clusters;
+	zone[1][0] = 0;
+	zone[1][1] = vol->mft_zone_start;
+	for (z = 0; z < 2; z++) {
+		bf.run_start = -1;
+		pos = zone[z][0];
+		end = zone[z][1];
+		while (pos < end) {
+			if (vol->lcn_free_map) {
+				next = lcn_map_next_free(vol, pos, end);
+				if (next > pos) {
+					if (best_fit_end_run(&bf, pos))
+						goto out;
+					pos = next;
+					continue;
+				}
+			}
+			br = ntfs_cluster_bitmap_pread(vol, pos >> 3,
+					NTFS_LCNALLOC_BSIZE, buf);
+			if (br <= 0) {
+				if (br < 0)
+					bf.best = -1;
+				goto out;
+			}
+			base = pos & ~7;
+			size = br << 3;
+			if (size > end - base)
+				size = end - base;
+			i = pos - base;
+			while (i < size) {
+				v = buf[i >> 3];
+				if (!(i & 7) && (i + 8 <= size)
+						&& (!v || (v == 255))) {
+						/* whole bytes free or in use */
+					n = ntfs_bitmap_skip(buf, i >> 3,
+							size >> 3, v) << 3;
+					if (v) {
+						if (best_fit_end_run(&bf,
+								base + i))
+							goto out;
+					} else if (bf.run_start < 0)
+						bf.run_start = base + i;
+					i = n;
+					continue;
+				}
+				if (v & (1 << (i & 7))) {
+					if (best_fit_end_run(&bf, base + i))
+						goto out;
+				} else if (bf.run_start < 0)
+					bf.run_start = base + i;
+				i++;
+			}
+			pos = base + size;
+		}
+		if (best_fit_end_run(&bf, end))
+			goto out;
+	}
+out:
+	free(buf);
+	return (bf.best);
+}
+
+/**
+ * ntfs_cluster_reserve - keep the clusters after an allocation for its attribute
+ * @na:		attribute the clusters in @rl were allocated to
+ * @rl:		runlist just returned by ntfs_cluster_alloc()
+ *
+ * The reservation only lives in memory: the clusters stay free in $Bitmap,
+ * but other allocations leave them alone, so that files written at the
+ * same time do not take turns at the same zone position.  The next
+ * allocation for @na starts at the reservation, as it is hinted to start
+ * after the last cluster of the attribute.  Other allocations fall back to
+ * the reserved clusters when there is no other free space.
+ */
+void ntfs_cluster_reserve(ntfs_attr *na, const runlist *rl)
+{
+	ntfs_volume *vol = na->ni->vol;
+	LCN end = -1;
+
+	for (; rl->length; rl++)
+		if (rl->lcn >= 0)
+			end = rl->lcn + rl->length;
+	if ((end < 0) || (end >= vol->nr_clusters))
+		return;
+	if (!na->resv_count) {
+		na->resv_next = vol->resv_list;
+		vol->resv_list = na;
+	}
+	na->resv_lcn = end;
+	na->resv_count = NTFS_RESV_SIZE >> vol->cluster_size_bits;
+	if (!na->resv_count)
+		na->resv_count = 1;
+	if (na->resv_count > vol->nr_clusters - end)
+		na->resv_count = vol->nr_clusters - end;
+}
+
+/**
+ * ntfs_cluster_unreserve - give up the clusters reserved for an attribute
+ * @na:		attribute being closed
+ */
+void ntfs_cluster_unreserve(ntfs_attr *na)
+{
+	ntfs_attr **pna;
+
+	if (!na->resv_count)
+		return;
+	for (pna = &na->ni->vol->resv_list; *pna; pna = &(*pna)->resv_next)
+		if (*pna == na) {
+			*pna = na->resv_next;
+			break;
+		}
+	na->resv_count = 0;
+}
+
+/*
+ *		Show the clusters reserved for other attributes as in use
+ *
+ *	The bits set in the copy of $Bitmap are noted in @mask, to be
+ *	cleared again before the copy is written back.
+ *
+ *	Returns TRUE if any bit was set.
+ */
+
+static BOOL resv_overlay(ntfs_volume *vol, LCN own, LCN pos, s64 bits,
+			u8 *buf, u8 *mask)
+{
+	ntfs_attr *na;
+	LCN from, to, lcn;
+	BOOL masked = FALSE;
+	u8 bit;
+
+	for (na = vol->resv_list; na; na = na->resv_next) {
+		if (na->resv_lcn == own)
+			continue;
+		from = na->resv_lcn;
+		to = na->resv_lcn + na->resv_count;
+		if ((to <= pos) || (from >= pos + bits))
+			continue;
+		if (!masked)
+			memset(mask, 0, NTFS_LCNALLOC_BSIZE);
+		masked = TRUE;
+		if (from < pos)
+			from = pos;
+		if (to > pos + bits)
+			to = pos + bits;
+		for (lcn = from - pos; lcn < to - pos; lcn++) {
+			bit = 1 << (lcn & 7);
+			if (!(buf[lcn >> 3] & bit)) {
+				buf[lcn >> 3] |= bit;
+				mask[lcn >> 3] |= bit;
+			}
+		}
+	}
+	return (masked);
+}
+
 static s64 max_empty_bit_range(unsigned char *buf, int size)
 {
-	int i, j, run = 0;
+	int i, j, k, run = 0;
 	int max_range = 0;
 	s64 start_pos = -1;
 	
@@ -125,11 +831,10 @@ static s64 max_empty_bit_range(unsigned char *buf, int size)
 	while (i < size) {
 		switch (*buf) {
 		case 0 :
-			do {
-				buf++;
-				run += 8;
-				i++;
-			} while ((i < size) && !*buf);
+			k = ntfs_bitmap_skip(buf - i, i, size, 0);
+			run += (k - i) * 8;
+			buf += k - i;
+			i = k;
 			break;
 		case 255 :
 			if (run > max_range) {
@@ -137,10 +842,9 @@ static s64 max_empty_bit_range(unsigned char *buf, int size)
 				start_pos = (s64)i * 8 - run;
 			}
 			run = 0;
-			do {
-				buf++;
-				i++;
-			} while ((i < size) && (*buf == 255));
+			k = ntfs_bitmap_skip(buf - i, i, size, 255);
+			buf += k - i;
+			i = k;
 			break;
 		default :
 			for (j = 0; j < 8; j++) {
@@ -169,9 +873,10 @@ static s64 max_empty_bit_range(unsigned char *buf, int size)
 }
 
 static int bitmap_writeback(ntfs_volume *vol, s64 pos, s64 size, void *b, 
-			    u8 *writeback)
+			    u8 *writeback, const u8 *mask)
 {
 	s64 written;
+	s64 i;
 	
 	ntfs_log_trace("Entering\n");
 	
@@ -180,7 +885,12 @@ static int bitmap_writeback(ntfs_volume *vol, s64 pos, s64 size, void *b,
 	
 	*writeback = 0;
 	
-	written = ntfs_attr_pwrite(vol->lcnbmp_na, pos, size, b);
+		/* drop the reservations shown as in use */
+	if (mask)
+		for (i = 0; i < size; i++)
+			((u8*)b)[i] &= ~mask[i];
+	
+	written = ntfs_cluster_bitmap_pwrite(vol, pos, size, b);
 	if (written != size) {
 		if (!written)
 			errno = EIO;
@@ -193,12 +903,14 @@ static int bitmap_writeback(ntfs_volume *vol, s64 pos, s64 size, void *b,
 }
 
 /**
- * ntfs_cluster_alloc - allocate clusters on an ntfs volume
+ * __ntfs_cluster_alloc - allocate clusters on an ntfs volume
  * @vol:	mounted ntfs volume on which to allocate the clusters
  * @start_vcn:	vcn to use for the first allocated cluster
  * @count:	number of clusters to allocate
  * @start_lcn:	starting lcn at which to allocate the clusters (or -1 if none)
  * @zone:	zone from which to allocate the clusters
+ * @use_resv:	whether to leave alone the clusters reserved for other
+ *		attributes (see ntfs_cluster_reserve())
  *
  * Allocate @count clusters preferably starting at cluster @start_lcn or at the
  * current allocator position if @start_lcn is -1, on the mounted ntfs volume
@@ -230,18 +942,22 @@ static int bitmap_writeback(ntfs_volume *vol, s64 pos, s64 size, void *b,
  * function. But it should all be worthwhile, because this allocator: 
  *   1) implements MFT zone reservation
  *   2) causes reduction in fragmentation. 
- * The code is not optimized for speed.
+ * The code is not optimized for speed, except that the groups of clusters
+ * which the free cluster map shows as full are skipped without reading them.
  */
-runlist *ntfs_cluster_alloc(ntfs_volume *vol, VCN start_vcn, s64 count,
-		LCN start_lcn, const NTFS_CLUSTER_ALLOCATION_ZONES zone)
+static runlist *__ntfs_cluster_alloc(ntfs_volume *vol, VCN start_vcn,
+		s64 count, LCN start_lcn,
+		const NTFS_CLUSTER_ALLOCATION_ZONES zone, BOOL use_resv)
 {
 	LCN zone_start, zone_end;  /* current search range */
-	LCN last_read_pos, lcn;
+	LCN last_read_pos, lcn, own;
 	LCN bmp_pos;		/* current bit position inside the bitmap */
 	LCN prev_lcn = 0, prev_run_len = 0;
 	s64 clusters, br;
 	runlist *rl = NULL, *trl;
 	u8 *buf, *byte, bit, writeback;
+	u8 *mask = (u8*)NULL;	/* reserved bits shown as in use in @buf */
+	BOOL masked = FALSE;
 	u8 pass = 1; 	/* 1: inside zone;  2: start of zone */
 	u8 search_zone; /* 4: data2 (start) 1: mft (middle) 2: data1 (end) */
 	u8 done_zones = 0;
@@ -275,6 +991,28 @@ runlist *ntfs_cluster_alloc(ntfs_volume *vol, VCN start_vcn, s64 count,
 	buf = ntfs_malloc(NTFS_LCNALLOC_BSIZE);
 	if (!buf)
 		goto out;
+	if (!vol->lcn_free_map_size)
+		lcn_map_build(vol);
+	if (use_resv && vol->resv_list) {
+		mask = ntfs_malloc(NTFS_LCNALLOC_BSIZE);
+		if (!mask) {
+			free(buf);
+			goto out;
+		}
+	}
+		/* an allocation at a reservation is made for its owner */
+	own = start_lcn;
+	/*
+	 * Under the best fit policy, a large allocation starts at the
+	 * smallest free extent holding it whole, if there is one.
+	 */
+	if (NVolBestFit(vol) && (zone == DATA_ZONE)
+			&& ((count << vol->cluster_size_bits)
+				>= NTFS_BEST_FIT_MIN)) {
+		lcn = lcn_best_fit(vol, start_lcn, count);
+		if (lcn >= 0)
+			start_lcn = lcn;
+	}
 	/*
 	 * If no @start_lcn was requested, use the current zone
 	 * position otherwise use the requested @start_lcn.
@@ -316,8 +1054,14 @@ runlist *ntfs_cluster_alloc(ntfs_volume *vol, VCN start_vcn, s64 count,
 			/* check whether we have exhausted the current zone */
 		if (search_zone & vol->full_zones)
 			goto zone_pass_done;
+			/* skip the groups which have no free clusters */
+		if (used_zone_pos && vol->lcn_free_map) {
+			bmp_pos = lcn_map_next_free(vol, bmp_pos, zone_end);
+			if (bmp_pos >= zone_end)
+				goto zone_pass_done;
+		}
 		last_read_pos = bmp_pos >> 3;
-		br = ntfs_attr_pread(vol->lcnbmp_na, last_read_pos, 
+		br = ntfs_cluster_bitmap_pread(vol, last_read_pos, 
 				     NTFS_LCNALLOC_BSIZE, buf);
 		if (br <= 0) {
 			if (!br)
@@ -334,6 +1078,11 @@ runlist *ntfs_cluster_alloc(ntfs_volume *vol, VCN start_vcn, s64 count,
 		lcn = bmp_pos & 7;
 		bmp_pos &= ~7;
 		writeback = 0;
+			/* never allocate the padding bits past the volume end */
+		if (bmp_pos + buf_size > vol->nr_clusters)
+			buf_size = vol->nr_clusters - bmp_pos;
+		masked = mask && resv_overlay(vol, own, bmp_pos, buf_size,
+					buf, mask);
 		
 		while (lcn < buf_size) {
 			byte = buf + (lcn >> 3);
@@ -341,7 +1090,14 @@ runlist *ntfs_cluster_alloc(ntfs_volume *vol, VCN start_vcn, s64 count,
 			if (has_guess) {
 				if (*byte & bit) {
 					has_guess = 0;
-					break;
+					/*
+					 * A run at a hint ends here, otherwise
+					 * go on with the next largest run of
+					 * this buffer.
+					 */
+					if (!used_zone_pos)
+						break;
+					continue;
 				}
 			} else {
 				lcn = max_empty_bit_range(buf, br);
@@ -368,6 +1124,9 @@ runlist *ntfs_cluster_alloc(ntfs_volume *vol, VCN start_vcn, s64 count,
 			/* Allocate the bitmap bit. */
 			*byte |= bit;
 			writeback = 1;
+			if (vol->lcn_free_map)
+				vol->lcn_free_map[(lcn + bmp_pos)
+						>> NTFS_LCN_MAP_BITS]--;
 			if (NVolFreeSpaceKnown(vol)) {
 				if (vol->free_clusters <= 0)
 					ntfs_log_error("Non-positive free"
@@ -420,12 +1179,18 @@ runlist *ntfs_cluster_alloc(ntfs_volume *vol, VCN start_vcn, s64 count,
 			lcn++;
 		}
 		
-		if (bitmap_writeback(vol, last_read_pos, br, buf, &writeback)) {
+		if (bitmap_writeback(vol, last_read_pos, br, buf, &writeback,
+				masked ? mask : (u8*)NULL)) {
 			err = errno;
 			goto err_ret;
 		}
 		
-		if (!used_zone_pos) {
+		/*
+		 * Leave the hint for the zone position once the run at the
+		 * hint ends, a run reaching the end of the buffer goes on in
+		 * the next one.
+		 */
+		if (!used_zone_pos && !has_guess) {
 			
 			used_zone_pos = 1;
 			
@@ -470,7 +1235,9 @@ zone_pass_done:
 		/* pass == 2 */
 done_zones_check:
 		done_zones |= search_zone;
-		vol->full_zones |= search_zone;
+			/* a zone may only look full for the reservations */
+		if (!mask)
+			vol->full_zones |= search_zone;
 		if (done_zones < (ZONE_MFT + ZONE_DATA1 + ZONE_DATA2)) {
 			ntfs_log_trace("Switching zone.\n");
 			pass = 1;
@@ -534,11 +1301,13 @@ done_ret:
 	rl[rlpos].vcn = rl[rlpos - 1].vcn + rl[rlpos - 1].length;
 	rl[rlpos].lcn = LCN_RL_NOT_MAPPED;
 	rl[rlpos].length = 0;
-	if (bitmap_writeback(vol, last_read_pos, br, buf, &writeback)) {
+	if (bitmap_writeback(vol, last_read_pos, br, buf, &writeback,
+				masked ? mask : (u8*)NULL)) {
 		err = errno;
 		goto err_ret;
 	}
 done_err_ret:
+	free(mask);
 	free(buf);
 	if (err) {
 		errno = err;
@@ -551,7 +1320,8 @@ out:
 
 wb_err_ret:
 	ntfs_log_trace("At wb_err_ret.\n");
-	if (bitmap_writeback(vol, last_read_pos, br, buf, &writeback))
+	if (bitmap_writeback(vol, last_read_pos, br, buf, &writeback,
+			masked ? mask : (u8*)NULL))
 		err = errno;
 err_ret:
 	ntfs_log_trace("At err_ret.\n");
@@ -569,17 +1339,151 @@ err_ret:
 }
 
 /**
- * ntfs_cluster_free_from_rl - free clusters from runlist
+ * ntfs_cluster_alloc - allocate clusters on an ntfs volume
+ *
+ * As __ntfs_cluster_alloc() above, taking the clusters reserved for open
+ * attributes only when there is no other free space left.
+ */
+runlist *ntfs_cluster_alloc(ntfs_volume *vol, VCN start_vcn, s64 count,
+		LCN start_lcn, const NTFS_CLUSTER_ALLOCATION_ZONES zone)
+{
+	runlist *rl;
+	BOOL retry;
+
+	do {
+		rl = __ntfs_cluster_alloc(vol, start_vcn, count, start_lcn,
+					zone, TRUE);
+		if (!rl && (errno == ENOSPC) && vol && vol->resv_list)
+			rl = __ntfs_cluster_alloc(vol, start_vcn, count,
+					start_lcn, zone, FALSE);
+			/* the clusters waiting to be freed may be enough */
+		retry = !rl && (errno == ENOSPC) && vol && vol->free_queue
+			&& vol->free_queue->nr
+			&& !ntfs_cluster_free_flush(vol, -1);
+	} while (retry);
+	return (rl);
+}
+
+/*
+ *		Free a run of clusters, or queue it for later
+ *
+ *	The queue is only used when @defer is set, and the run is freed
+ *	at once when it cannot be queued.
+ *
+ *	Returns 0 if successful, -1 with errno set if $Bitmap could
+ *	not be updated
+ */
+
+static int free_run(ntfs_volume *vol, struct discard_batch *discard,
+			LCN lcn, s64 count, BOOL defer)
+{
+	struct FREE_QUEUE *queue;
+	int n;
+
+	queue = vol->free_queue;
+	if (defer && queue && queue->nr
+	    && (queue->run[queue->nr - 1].lcn
+			+ queue->run[queue->nr - 1].count == lcn)) {
+		queue->run[queue->nr - 1].count += count;
+		queue->clusters += count;
+		return (0);
+	}
+	if (defer && (!queue || (queue->nr == queue->size))) {
+		n = (queue ? queue->size : 0) + NTFS_FREE_QUEUE_STEP;
+		queue = (struct FREE_QUEUE*)realloc(vol->free_queue,
+				sizeof(struct FREE_QUEUE)
+				+ (n - 1)*sizeof(queue->run[0]));
+		if (queue) {
+			if (!vol->free_queue) {
+				queue->nr = 0;
+				queue->clusters = 0;
+			}
+			queue->size = n;
+			vol->free_queue = queue;
+		}
+	}
+	if (defer && queue) {
+		queue->run[queue->nr].lcn = lcn;
+		queue->run[queue->nr].count = count;
+		queue->nr++;
+		queue->clusters += count;
+		return (0);
+	}
+	update_full_status(vol, lcn);
+	if (ntfs_bitmap_clear_run(vol->lcnbmp_na, lcn, count))
+		return (-1);
+	lcn_map_freed(vol, lcn, count);
+	discard_queue(vol, discard, lcn, count);
+	return (0);
+}
+
+/**
+ * ntfs_cluster_free_flush - clear the queued cluster runs in $Bitmap
+ * @vol:	mounted ntfs volume
+ * @budget:	maximum number of clusters to clear, or -1 for all of them
+ *
+ * The clusters have already been counted as free when they were queued,
+ * they can be allocated again once cleared. The oldest runs are cleared
+ * first, a run may be cleared partially to keep within @budget.
+ *
+ * Return 0 on success, or -1 with errno set on error, in which case the
+ * runs not cleared are kept queued.
+ */
+int ntfs_cluster_free_flush(ntfs_volume *vol, s64 budget)
+{
+	struct discard_batch discard;
+	struct FREE_QUEUE *queue;
+	s64 count;
+	int i, ret = 0;
+
+	queue = vol->free_queue;
+	if (!queue || !queue->nr)
+		return (0);
+	discard.nr = 0;
+	for (i = 0; (i < queue->nr) && budget; i++) {
+		count = queue->run[i].count;
+		if ((budget >= 0) && (count > budget))
+			count = budget;
+		if (free_run(vol, &discard, queue->run[i].lcn, count, FALSE)) {
+			ntfs_log_perror("Cluster deallocation failed "
+				       "(%lld, %lld)",
+					(long long)queue->run[i].lcn,
+					(long long)count);
+			ret = -1;
+			break;
+		}
+		queue->clusters -= count;
+		if (budget >= 0)
+			budget -= count;
+		if (count < queue->run[i].count) {
+			queue->run[i].lcn += count;
+			queue->run[i].count -= count;
+			break;
+		}
+	}
+	discard_flush(vol, &discard);
+	queue->nr -= i;
+	memmove(&queue->run[0], &queue->run[i], queue->nr*sizeof(queue->run[0]));
+	return (ret);
+}
+
+/**
+ * __ntfs_cluster_free_from_rl - free clusters from runlist
  * @vol:	mounted ntfs volume on which to free the clusters
  * @rl:		runlist from which deallocate clusters
+ * @defer:	whether to only queue the runs for ntfs_cluster_free_flush()
  *
  * On success return 0 and on error return -1 with errno set to the error code.
  */
-int ntfs_cluster_free_from_rl(ntfs_volume *vol, runlist *rl)
+static int __ntfs_cluster_free_from_rl(ntfs_volume *vol, runlist *rl,
+			BOOL defer)
 {
+	struct discard_batch discard;
 	s64 nr_freed = 0;
 	int ret = -1;
 
+	discard.nr = 0;
+
 	ntfs_log_trace("Entering.\n");
 
 	for (; rl->length; rl++) {
@@ -588,9 +1492,8 @@ int ntfs_cluster_free_from_rl(ntfs_volume *vol, runlist *rl)
 			       (long long)rl->lcn, (long long)rl->length);
 
 		if (rl->lcn >= 0) { 
-			update_full_status(vol,rl->lcn);
-			if (ntfs_bitmap_clear_run(vol->lcnbmp_na, rl->lcn, 
-						  rl->length)) {
+			if (free_run(vol, &discard, rl->lcn, rl->length,
+					defer)) {
 				ntfs_log_perror("Cluster deallocation failed "
 					       "(%lld, %lld)",
 						(long long)rl->lcn, 
@@ -603,6 +1506,7 @@ int ntfs_cluster_free_from_rl(ntfs_volume *vol, runlist *rl)
 
 	ret = 0;
 out:
+	discard_flush(vol, &discard);
 	vol->free_clusters += nr_freed; 
 	if (NVolFreeSpaceKnown(vol)
 	    && (vol->free_clusters > vol->nr_clusters))
@@ -612,6 +1516,24 @@ out:
 	return ret;
 }
 
+int ntfs_cluster_free_from_rl(ntfs_volume *vol, runlist *rl)
+{
+	return (__ntfs_cluster_free_from_rl(vol, rl, FALSE));
+}
+
+/*
+ *		Free clusters from runlist, leaving $Bitmap to be updated later
+ *
+ *	Meant for unlinking, as the clusters cannot be reused before
+ *	ntfs_cluster_free_flush() is called, rollbacks should free the
+ *	clusters at once.
+ */
+
+int ntfs_cluster_queue_free_from_rl(ntfs_volume *vol, runlist *rl)
+{
+	return (__ntfs_cluster_free_from_rl(vol, rl, TRUE));
+}
+
 /*
  *		Basic cluster run free
  *	Returns 0 if successful
@@ -619,17 +1541,18 @@ out:
 
 int ntfs_cluster_free_basic(ntfs_volume *vol, s64 lcn, s64 count)
 {
+	struct discard_batch discard;
 	s64 nr_freed = 0;
 	int ret = -1;
 
+	discard.nr = 0;
+
 	ntfs_log_trace("Entering.\n");
 	ntfs_log_trace("Dealloc lcn 0x%llx, len 0x%llx.\n",
 			       (long long)lcn, (long long)count);
 
 	if (lcn >= 0) { 
-		update_full_status(vol,lcn);
-		if (ntfs_bitmap_clear_run(vol->lcnbmp_na, lcn, 
-						  count)) {
+		if (free_run(vol, &discard, lcn, count, FALSE)) {
 			ntfs_log_perror("Cluster deallocation failed "
 				       "(%lld, %lld)",
 					(long long)lcn, 
@@ -640,6 +1563,7 @@ int ntfs_cluster_free_basic(ntfs_volume *vol, s64 lcn, s64 count)
 	}
 	ret = 0;
 out:
+	discard_flush(vol, &discard);
 	vol->free_clusters += nr_freed;
 	if (vol->free_clusters > vol->nr_clusters)
 		ntfs_log_error("Too many free clusters (%lld > %lld)!",
@@ -649,11 +1573,12 @@ out:
 }
 
 /**
- * ntfs_cluster_free - free clusters on an ntfs volume
+ * __ntfs_cluster_free - free clusters on an ntfs volume
  * @vol:	mounted ntfs volume on which to free the clusters
  * @na:		attribute whose runlist describes the clusters to free
  * @start_vcn:	vcn in @rl at which to start freeing clusters
  * @count:	number of clusters to free or -1 for all clusters
+ * @defer:	whether to only queue the runs for ntfs_cluster_free_flush()
  *
  * Free @count clusters starting at the cluster @start_vcn in the runlist
  * described by the attribute @na from the mounted ntfs volume @vol.
@@ -664,12 +1589,16 @@ out:
  * On success return the number of deallocated clusters (not counting sparse
  * clusters) and on error return -1 with errno set to the error code.
  */
-int ntfs_cluster_free(ntfs_volume *vol, ntfs_attr *na, VCN start_vcn, s64 count)
+static int __ntfs_cluster_free(ntfs_volume *vol, ntfs_attr *na,
+			VCN start_vcn, s64 count, BOOL defer)
 {
+	struct discard_batch discard;
 	runlist *rl;
 	s64 delta, to_free, nr_freed = 0;
 	int ret = -1;
 
+	discard.nr = 0;
+
 	if (!vol || !vol->lcnbmp_na || !na || start_vcn < 0 ||
 			(count < 0 && count != -1)) {
 		ntfs_log_trace("Invalid arguments!\n");
@@ -705,9 +1634,7 @@ int ntfs_cluster_free(ntfs_volume *vol, ntfs_attr *na, VCN start_vcn, s64 count)
 
 	if (rl->lcn != LCN_HOLE) {
 		/* Do the actual freeing of the clusters in this run. */
-		update_full_status(vol,rl->lcn + delta);
-		if (ntfs_bitmap_clear_run(vol->lcnbmp_na, rl->lcn + delta,
-					  to_free))
+		if (free_run(vol, &discard, rl->lcn + delta, to_free, defer))
 			goto leave;
 		nr_freed = to_free;
 	} 
@@ -738,9 +1665,7 @@ int ntfs_cluster_free(ntfs_volume *vol, ntfs_attr *na, VCN start_vcn, s64 count)
 			to_free = count;
 
 		if (rl->lcn != LCN_HOLE) {
-			update_full_status(vol,rl->lcn);
-			if (ntfs_bitmap_clear_run(vol->lcnbmp_na, rl->lcn,
-					to_free)) {
+			if (free_run(vol, &discard, rl->lcn, to_free, defer)) {
 				// FIXME: Eeek! We need rollback! (AIA)
 				ntfs_log_perror("%s: Clearing bitmap run failed",
 						__FUNCTION__);
@@ -763,6 +1688,7 @@ int ntfs_cluster_free(ntfs_volume *vol, ntfs_attr *na, VCN start_vcn, s64 count)
 
 	ret = nr_freed;
 out:
+	discard_flush(vol, &discard);
 	vol->free_clusters += nr_freed ; 
 	if (vol->free_clusters > vol->nr_clusters)
 		ntfs_log_error("Too many free clusters (%lld > %lld)!",
@@ -772,3 +1698,20 @@ leave:
 	ntfs_log_leave("\n");
 	return ret;
 }
+
+int ntfs_cluster_free(ntfs_volume *vol, ntfs_attr *na, VCN start_vcn, s64 count)
+{
+	return (__ntfs_cluster_free(vol, na, start_vcn, count, FALSE));
+}
+
+/*
+ *		Free clusters of an attribute, leaving $Bitmap to be updated later
+ *
+ *	Meant for truncations, see ntfs_cluster_queue_free_from_rl()
+ */
+
+int ntfs_cluster_queue_free(ntfs_volume *vol, ntfs_attr *na, VCN start_vcn,
+			s64 count)
+{
+	return (__ntfs_cluster_free(vol, na, start_vcn, count, TRUE));
+}
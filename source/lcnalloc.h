@@ -38,14 +38,39 @@ typedef enum {
 	LAST_ZONE	= 1,	/* For sanity checking. */
 } NTFS_CLUSTER_ALLOCATION_ZONES;
 
+/*
+ * Clusters summarized by each entry of the free cluster map, the number of
+ * bits in one NTFS_LCNALLOC_BSIZE buffer of $Bitmap.
+ */
+#define NTFS_LCN_MAP_BITS	15
+#define NTFS_LCN_MAP_CLUSTERS	(1 << NTFS_LCN_MAP_BITS)
+
 extern runlist *ntfs_cluster_alloc(ntfs_volume *vol, VCN start_vcn, s64 count,
 		LCN start_lcn, const NTFS_CLUSTER_ALLOCATION_ZONES zone);
 
+extern s64 ntfs_cluster_count_free(ntfs_volume *vol);
+
+extern s64 ntfs_cluster_bitmap_pread(ntfs_volume *vol, s64 pos, s64 count,
+		void *b);
+extern s64 ntfs_cluster_bitmap_pwrite(ntfs_volume *vol, s64 pos, s64 count,
+		const void *b);
+extern int ntfs_cluster_bitmap_sync(ntfs_volume *vol);
+
+extern void ntfs_cluster_reserve(ntfs_attr *na, const runlist *rl);
+extern void ntfs_cluster_unreserve(ntfs_attr *na);
+
+/* Clusters cleared from the queue of freed runs by each slice */
+#define NTFS_FREE_QUEUE_SLICE	(1 << 18)
+
 extern int ntfs_cluster_free_from_rl(ntfs_volume *vol, runlist *rl);
+extern int ntfs_cluster_queue_free_from_rl(ntfs_volume *vol, runlist *rl);
+extern int ntfs_cluster_free_flush(ntfs_volume *vol, s64 budget);
 extern int ntfs_cluster_free_basic(ntfs_volume *vol, s64 lcn, s64 count);
 
 extern int ntfs_cluster_free(ntfs_volume *vol, ntfs_attr *na, VCN start_vcn,
 		s64 count);
+extern int ntfs_cluster_queue_free(ntfs_volume *vol, ntfs_attr *na,
+		VCN start_vcn, s64 count);
 
 #endif /* defined _NTFS_LCNALLOC_H */
 
@@ -536,9 +536,11 @@ BOOL ntfs_check_logfile(ntfs_attr *log_na, RESTART_PAGE_HEADER **rp)
 	 * what could be the beginning of a page (for each page size) rather
 	 * than scanning the whole file byte by byte.  If all potential places
 	 * contain empty and uninitialized records, the log file can be assumed
-	 * to be empty.
+	 * to be empty.  The second restart page is at the log page size, so
+	 * there is no need to look further than the largest page size, which
+	 * saves seeking all over an empty $LogFile.
 	 */
-	for (pos = 0; pos < size; pos <<= 1) {
+	for (pos = 0; (pos < size) && (pos <= MaxLogPageSize); pos <<= 1) {
 		/*
 		 * Read first NTFS_BLOCK_SIZE bytes of potential restart page.
 		 */
@@ -724,10 +726,15 @@ BOOL ntfs_is_logfile_clean(ntfs_attr *log_na, RESTART_PAGE_HEADER *rp)
  * This function assumes that the $LogFile journal has already been consistency
  * checked by a call to ntfs_check_logfile() and that ntfs_is_logfile_clean()
  * has been used to ensure that the $LogFile is clean.
+ *
+ * Rather than filling the whole journal with 0xff, only the first two log
+ * pages, holding the restart pages, and the other places ntfs_check_logfile()
+ * looks for a restart page are overwritten, which is enough for the journal
+ * to be seen as empty.
  */
 int ntfs_empty_logfile(ntfs_attr *na)
 {
-	s64 pos, count;
+	s64 pos, count, done;
 	char buf[NTFS_BUF_SIZE];
 
 	ntfs_log_trace("Entering.\n");
@@ -744,20 +751,29 @@ int ntfs_empty_logfile(ntfs_attr *na)
 	memset(buf, -1, NTFS_BUF_SIZE);
 
 	pos = 0;
-	while ((count = na->data_size - pos) > 0) {
+	while ((pos <= MaxLogPageSize) && ((count = na->data_size - pos) > 0)) {
 		
+			/* the restart pages, then a block at each power of two */
+		if (pos < 2*DefaultLogPageSize)
+			count = 2*DefaultLogPageSize - pos;
+		else
+			count = NTFS_BLOCK_SIZE;
+		if (count > na->data_size - pos)
+			count = na->data_size - pos;
 		if (count > NTFS_BUF_SIZE)
 			count = NTFS_BUF_SIZE;
 
-		count = ntfs_attr_pwrite(na, pos, count, buf);
-		if (count <= 0) {
+		done = ntfs_attr_pwrite(na, pos, count, buf);
+		if (done <= 0) {
 			ntfs_log_perror("Failed to reset $LogFile");
-			if (count != -1)
+			if (done != -1)
 				errno = EIO;
 			return -1;
 		}
-		pos += count;
-		if(pos>=64*1024) break; //only clear first 64kb
+		if (pos < 2*DefaultLogPageSize)
+			pos += done;
+		else
+			pos <<= 1;
 	}
 
 	NVolSetLogFileEmpty(na->ni->vol);
@@ -56,6 +56,8 @@
 #define MaxLogFileSize		0x100000000ULL
 #define DefaultLogPageSize	4096
 #define MinLogRecordPages	48
+#define MaxLogPageSize		65536	/* The restart pages are at 0 and at the
+					   log page size, never beyond this */
 
 /**
  * struct RESTART_PAGE_HEADER - Log file restart page header.
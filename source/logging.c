@@ -78,14 +78,20 @@ struct ntfs_logging {
  * ntfs_log
  * This struct controls all the logging within the library and tools.
  */
-static struct ntfs_logging ntfs_log = {
 #ifdef DEBUG
-	NTFS_LOG_LEVEL_DEBUG | NTFS_LOG_LEVEL_TRACE | NTFS_LOG_LEVEL_ENTER |
-	NTFS_LOG_LEVEL_LEAVE |
+#define NTFS_LOG_DEFAULT_LEVELS	(NTFS_LOG_LEVEL_DEBUG | NTFS_LOG_LEVEL_TRACE | \
+	NTFS_LOG_LEVEL_ENTER | NTFS_LOG_LEVEL_LEAVE | \
+	NTFS_LOG_LEVEL_INFO | NTFS_LOG_LEVEL_QUIET | NTFS_LOG_LEVEL_WARNING | \
+	NTFS_LOG_LEVEL_ERROR | NTFS_LOG_LEVEL_PERROR | NTFS_LOG_LEVEL_CRITICAL | \
+	NTFS_LOG_LEVEL_PROGRESS)
+#else
+#define NTFS_LOG_DEFAULT_LEVELS	(NTFS_LOG_LEVEL_INFO | NTFS_LOG_LEVEL_QUIET | \
+	NTFS_LOG_LEVEL_WARNING | NTFS_LOG_LEVEL_ERROR | NTFS_LOG_LEVEL_PERROR | \
+	NTFS_LOG_LEVEL_CRITICAL | NTFS_LOG_LEVEL_PROGRESS)
 #endif
-	NTFS_LOG_LEVEL_INFO | NTFS_LOG_LEVEL_QUIET | NTFS_LOG_LEVEL_WARNING |
-	NTFS_LOG_LEVEL_ERROR | NTFS_LOG_LEVEL_PERROR | NTFS_LOG_LEVEL_CRITICAL |
-	NTFS_LOG_LEVEL_PROGRESS,
+
+static struct ntfs_logging ntfs_log = {
+	NTFS_LOG_DEFAULT_LEVELS,
 	NTFS_LOG_FLAG_ONLYNAME,
 #ifdef DEBUG
 	ntfs_log_handler_outerr
@@ -94,6 +100,28 @@ static struct ntfs_logging ntfs_log = {
 #endif
 };
 
+/**
+ * ntfs_log_active
+ * The levels of ntfs_log, or none while the null handler is installed, so
+ * the logging macros skip formatting messages nobody will see.
+ */
+#ifdef DEBUG
+u32 ntfs_log_active = NTFS_LOG_DEFAULT_LEVELS;
+#else
+u32 ntfs_log_active = 0;
+#endif
+
+/**
+ * ntfs_log_update_active - Recompute ntfs_log_active after a change
+ */
+static void ntfs_log_update_active(void)
+{
+	if (ntfs_log.handler == ntfs_log_handler_null)
+		ntfs_log_active = 0;
+	else
+		ntfs_log_active = ntfs_log.levels;
+}
+
 
 /**
  * ntfs_log_get_levels - Get a list of the current logging levels
@@ -121,6 +149,7 @@ u32 ntfs_log_set_levels(u32 levels)
 	u32 old;
 	old = ntfs_log.levels;
 	ntfs_log.levels |= levels;
+	ntfs_log_update_active();
 	return old;
 }
 
@@ -138,6 +167,7 @@ u32 ntfs_log_clear_levels(u32 levels)
 	u32 old;
 	old = ntfs_log.levels;
 	ntfs_log.levels &= (~levels);
+	ntfs_log_update_active();
 	return old;
 }
 
@@ -295,6 +325,7 @@ void ntfs_log_set_handler(ntfs_log_handler *handler)
 #endif
 	} else
 		ntfs_log.handler = ntfs_log_handler_null;
+	ntfs_log_update_active();
 }
 
 /**
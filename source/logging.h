@@ -87,32 +87,96 @@ int ntfs_log_redirect(const char *function, const char *file, int line,
 #define NTFS_LOG_FLAG_FUNCTION	(1 << 3) /* Show the function name containing the message */
 #define NTFS_LOG_FLAG_ONLYNAME	(1 << 4) /* Only display the filename, not the pathname */
 
-/* Macros to simplify logging.  One for each level defined above.
- * Note, ntfs_log_debug/trace have effect only if DEBUG is defined.
- */
-#define ntfs_log_critical(FORMAT, ARGS...) ntfs_log_redirect(__FUNCTION__,__FILE__,__LINE__,NTFS_LOG_LEVEL_CRITICAL,NULL,FORMAT,##ARGS)
-#define ntfs_log_error(FORMAT, ARGS...) ntfs_log_redirect(__FUNCTION__,__FILE__,__LINE__,NTFS_LOG_LEVEL_ERROR,NULL,FORMAT,##ARGS)
-#define ntfs_log_info(FORMAT, ARGS...) ntfs_log_redirect(__FUNCTION__,__FILE__,__LINE__,NTFS_LOG_LEVEL_INFO,NULL,FORMAT,##ARGS)
-#define ntfs_log_perror(FORMAT, ARGS...) ntfs_log_redirect(__FUNCTION__,__FILE__,__LINE__,NTFS_LOG_LEVEL_PERROR,NULL,FORMAT,##ARGS)
-#define ntfs_log_progress(FORMAT, ARGS...) ntfs_log_redirect(__FUNCTION__,__FILE__,__LINE__,NTFS_LOG_LEVEL_PROGRESS,NULL,FORMAT,##ARGS)
-#define ntfs_log_quiet(FORMAT, ARGS...) ntfs_log_redirect(__FUNCTION__,__FILE__,__LINE__,NTFS_LOG_LEVEL_QUIET,NULL,FORMAT,##ARGS)
-#define ntfs_log_verbose(FORMAT, ARGS...) ntfs_log_redirect(__FUNCTION__,__FILE__,__LINE__,NTFS_LOG_LEVEL_VERBOSE,NULL,FORMAT,##ARGS)
-#define ntfs_log_warning(FORMAT, ARGS...) ntfs_log_redirect(__FUNCTION__,__FILE__,__LINE__,NTFS_LOG_LEVEL_WARNING,NULL,FORMAT,##ARGS)
-
-/* By default debug and trace messages are compiled into the program,
- * but not displayed.
+/* Logging levels compiled into the library.  By default debug, trace, enter
+ * and leave messages only exist if DEBUG is defined.  Build with
+ * -DNTFS_LOG_LEVELS=<mask of NTFS_LOG_LEVEL_*> to choose otherwise, for
+ * instance -DNTFS_LOG_LEVELS=0 to drop every message from the library.
  */
+#ifndef NTFS_LOG_LEVELS
 #ifdef DEBUG
-#define ntfs_log_debug(FORMAT, ARGS...) ntfs_log_redirect(__FUNCTION__,__FILE__,__LINE__,NTFS_LOG_LEVEL_DEBUG,NULL,FORMAT,##ARGS)
-#define ntfs_log_trace(FORMAT, ARGS...) ntfs_log_redirect(__FUNCTION__,__FILE__,__LINE__,NTFS_LOG_LEVEL_TRACE,NULL,FORMAT,##ARGS)
-#define ntfs_log_enter(FORMAT, ARGS...) ntfs_log_redirect(__FUNCTION__,__FILE__,__LINE__,NTFS_LOG_LEVEL_ENTER,NULL,FORMAT,##ARGS)
-#define ntfs_log_leave(FORMAT, ARGS...) ntfs_log_redirect(__FUNCTION__,__FILE__,__LINE__,NTFS_LOG_LEVEL_LEAVE,NULL,FORMAT,##ARGS)
+#define NTFS_LOG_LEVELS	0x00000fff
+#else
+#define NTFS_LOG_LEVELS	(NTFS_LOG_LEVEL_QUIET | NTFS_LOG_LEVEL_INFO | \
+	NTFS_LOG_LEVEL_VERBOSE | NTFS_LOG_LEVEL_PROGRESS | \
+	NTFS_LOG_LEVEL_WARNING | NTFS_LOG_LEVEL_ERROR | \
+	NTFS_LOG_LEVEL_PERROR | NTFS_LOG_LEVEL_CRITICAL)
+#endif
+#endif /* NTFS_LOG_LEVELS */
+
+/* Levels which currently reach a handler that prints: none while the null
+ * handler is installed.  Checked before the arguments are evaluated.
+ */
+extern u32 ntfs_log_active;
+
+#define ntfs_log_message(LEVEL, FORMAT, ARGS...) \
+	do { \
+		if (ntfs_log_active & (LEVEL)) \
+			ntfs_log_redirect(__FUNCTION__,__FILE__,__LINE__,LEVEL,NULL,FORMAT,##ARGS); \
+	} while (0)
+
+/* Macros to simplify logging.  One for each level defined above.
+ * A level missing from NTFS_LOG_LEVELS compiles to nothing.
+ */
+#if NTFS_LOG_LEVELS & NTFS_LOG_LEVEL_CRITICAL
+#define ntfs_log_critical(FORMAT, ARGS...) ntfs_log_message(NTFS_LOG_LEVEL_CRITICAL,FORMAT,##ARGS)
+#else
+#define ntfs_log_critical(FORMAT, ARGS...)do {} while (0)
+#endif
+#if NTFS_LOG_LEVELS & NTFS_LOG_LEVEL_ERROR
+#define ntfs_log_error(FORMAT, ARGS...) ntfs_log_message(NTFS_LOG_LEVEL_ERROR,FORMAT,##ARGS)
+#else
+#define ntfs_log_error(FORMAT, ARGS...)do {} while (0)
+#endif
+#if NTFS_LOG_LEVELS & NTFS_LOG_LEVEL_INFO
+#define ntfs_log_info(FORMAT, ARGS...) ntfs_log_message(NTFS_LOG_LEVEL_INFO,FORMAT,##ARGS)
+#else
+#define ntfs_log_info(FORMAT, ARGS...)do {} while (0)
+#endif
+#if NTFS_LOG_LEVELS & NTFS_LOG_LEVEL_PERROR
+#define ntfs_log_perror(FORMAT, ARGS...) ntfs_log_message(NTFS_LOG_LEVEL_PERROR,FORMAT,##ARGS)
+#else
+#define ntfs_log_perror(FORMAT, ARGS...)do {} while (0)
+#endif
+#if NTFS_LOG_LEVELS & NTFS_LOG_LEVEL_PROGRESS
+#define ntfs_log_progress(FORMAT, ARGS...) ntfs_log_message(NTFS_LOG_LEVEL_PROGRESS,FORMAT,##ARGS)
+#else
+#define ntfs_log_progress(FORMAT, ARGS...)do {} while (0)
+#endif
+#if NTFS_LOG_LEVELS & NTFS_LOG_LEVEL_QUIET
+#define ntfs_log_quiet(FORMAT, ARGS...) ntfs_log_message(NTFS_LOG_LEVEL_QUIET,FORMAT,##ARGS)
+#else
+#define ntfs_log_quiet(FORMAT, ARGS...)do {} while (0)
+#endif
+#if NTFS_LOG_LEVELS & NTFS_LOG_LEVEL_VERBOSE
+#define ntfs_log_verbose(FORMAT, ARGS...) ntfs_log_message(NTFS_LOG_LEVEL_VERBOSE,FORMAT,##ARGS)
+#else
+#define ntfs_log_verbose(FORMAT, ARGS...)do {} while (0)
+#endif
+#if NTFS_LOG_LEVELS & NTFS_LOG_LEVEL_WARNING
+#define ntfs_log_warning(FORMAT, ARGS...) ntfs_log_message(NTFS_LOG_LEVEL_WARNING,FORMAT,##ARGS)
+#else
+#define ntfs_log_warning(FORMAT, ARGS...)do {} while (0)
+#endif
+#if NTFS_LOG_LEVELS & NTFS_LOG_LEVEL_DEBUG
+#define ntfs_log_debug(FORMAT, ARGS...) ntfs_log_message(NTFS_LOG_LEVEL_DEBUG,FORMAT,##ARGS)
 #else
 #define ntfs_log_debug(FORMAT, ARGS...)do {} while (0)
+#endif
+#if NTFS_LOG_LEVELS & NTFS_LOG_LEVEL_TRACE
+#define ntfs_log_trace(FORMAT, ARGS...) ntfs_log_message(NTFS_LOG_LEVEL_TRACE,FORMAT,##ARGS)
+#else
 #define ntfs_log_trace(FORMAT, ARGS...)do {} while (0)
+#endif
+#if NTFS_LOG_LEVELS & NTFS_LOG_LEVEL_ENTER
+#define ntfs_log_enter(FORMAT, ARGS...) ntfs_log_message(NTFS_LOG_LEVEL_ENTER,FORMAT,##ARGS)
+#else
 #define ntfs_log_enter(FORMAT, ARGS...)do {} while (0)
+#endif
+#if NTFS_LOG_LEVELS & NTFS_LOG_LEVEL_LEAVE
+#define ntfs_log_leave(FORMAT, ARGS...) ntfs_log_message(NTFS_LOG_LEVEL_LEAVE,FORMAT,##ARGS)
+#else
 #define ntfs_log_leave(FORMAT, ARGS...)do {} while (0)
-#endif /* DEBUG */
+#endif
 
 void ntfs_log_early_error(const char *format, ...)
                 __attribute__((format(printf, 1, 2)));
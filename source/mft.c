@@ -55,9 +55,164 @@
 #include "layout.h"
 #include "lcnalloc.h"
 #include "mft.h"
+#include "cache.h"
 #include "logging.h"
 #include "misc.h"
 
+#if CACHE_MFTREC_SIZE
+
+/*
+ *		Pseudo-hash of an mft record in the record cache
+ */
+
+int ntfs_mft_record_hash(const struct CACHED_GENERIC *item)
+{
+	return ((int)(((const struct CACHED_MFTREC*)item)->inum
+			& 0x7fffffff));
+}
+
+/*
+ *		mft record number comparing for entering/fetching from cache
+ */
+
+static int mftrec_cache_compare(const struct CACHED_GENERIC *cached,
+			const struct CACHED_GENERIC *item)
+{
+	return (!((const struct CACHED_MFTREC*)cached)->mrec
+		|| (((const struct CACHED_MFTREC*)cached)->inum
+			!= ((const struct CACHED_MFTREC*)item)->inum));
+}
+
+/*
+ *		Keep a copy of an mst deprotected mft record in the cache,
+ *	replacing the one held for the same record
+ */
+
+static void mftrec_cache_enter(const ntfs_volume *vol, u64 mft_no,
+			const MFT_RECORD *b)
+{
+	struct CACHED_MFTREC item;
+	struct CACHED_MFTREC *cached;
+
+	item.inum = mft_no;
+	item.mrec = (MFT_RECORD*)b;
+	item.varsize = vol->mft_record_size;
+	cached = (struct CACHED_MFTREC*)ntfs_enter_cache(vol->mftrec_cache,
+				GENERIC(&item), mftrec_cache_compare);
+	if (cached && cached->mrec)
+		memcpy(cached->mrec, b, vol->mft_record_size);
+}
+
+/*
+ *		Update the cache after mft records have been written
+ *
+ *	The records are kept as written, deprotected with their new usn.
+ *	When the write failed, what the disk holds is no longer known and
+ *	the copies are dropped.
+ */
+
+static void mftrec_cache_written(const ntfs_volume *vol, u64 mft_no,
+			s64 count, const MFT_RECORD *b, BOOL written)
+{
+	struct CACHED_MFTREC item;
+	s64 i;
+
+	item.mrec = (MFT_RECORD*)NULL;
+	item.varsize = 0;
+	for (i = 0; i < count; i++) {
+		if (written)
+			mftrec_cache_enter(vol, mft_no + i,
+				(const MFT_RECORD*)((const u8*)b
+					+ (i << vol->mft_record_size_bits)));
+		else {
+			item.inum = mft_no + i;
+			ntfs_invalidate_cache(vol->mftrec_cache,
+				GENERIC(&item), mftrec_cache_compare, 0);
+		}
+	}
+}
+
+/*
+ *		Read an mft record from the cache, or from disk along with
+ *	the other records of its cluster
+ *
+ *	Files created together usually get records next to each other,
+ *	so reading the neighbours ahead saves further reads when their
+ *	inodes are opened in turn.
+ */
+
+static int mftrec_cache_read(const ntfs_volume *vol, u64 mft_no,
+			MFT_RECORD *b)
+{
+	struct CACHED_MFTREC item;
+	struct CACHED_MFTREC *cached;
+	u8 *buf;
+	s64 first, count, i, br;
+
+	item.inum = mft_no;
+	item.mrec = (MFT_RECORD*)NULL;
+	item.varsize = 0;
+	cached = (struct CACHED_MFTREC*)ntfs_fetch_cache(vol->mftrec_cache,
+				GENERIC(&item), mftrec_cache_compare);
+	if (cached) {
+		memcpy(b, cached->mrec, vol->mft_record_size);
+		return 0;
+	}
+
+	first = mft_no;
+	count = 1;
+	if (vol->cluster_size_bits > vol->mft_record_size_bits) {
+		count = 1 << (vol->cluster_size_bits
+				- vol->mft_record_size_bits);
+		first = mft_no & ~(count - 1);
+		count = min(count, (vol->mft_na->initialized_size
+				>> vol->mft_record_size_bits) - first);
+	}
+	buf = (count > 1 ? ntfs_malloc(count << vol->mft_record_size_bits)
+			: (u8*)NULL);
+	if (buf) {
+		br = ntfs_attr_mst_pread(vol->mft_na,
+				first << vol->mft_record_size_bits, count,
+				vol->mft_record_size, buf);
+		if (br == count) {
+			for (i = 0; i < count; i++)
+				mftrec_cache_enter(vol, first + i,
+					(MFT_RECORD*)(buf
+					  + (i << vol->mft_record_size_bits)));
+			memcpy(b, buf + ((mft_no - first)
+					<< vol->mft_record_size_bits),
+				vol->mft_record_size);
+			free(buf);
+			return 0;
+		}
+		free(buf);
+	}
+
+	/* Read the record alone when its neighbours cannot be had */
+	br = ntfs_attr_mst_pread(vol->mft_na,
+			mft_no << vol->mft_record_size_bits, 1,
+			vol->mft_record_size, b);
+	if (br != 1) {
+		if (br != -1)
+			errno = EIO;
+		ntfs_log_perror("Failed to read of MFT, mft=%llu count=1 "
+				"br=%lld", (unsigned long long)mft_no,
+				(long long)br);
+		return -1;
+	}
+	mftrec_cache_enter(vol, mft_no, b);
+	return 0;
+}
+
+#else
+
+int ntfs_mft_record_hash(const struct CACHED_GENERIC *item)
+{
+	return (0);
+}
+
+#endif /* CACHE_MFTREC_SIZE */
+
 /**
  * ntfs_mft_records_read - read records from the mft from disk
  * @vol:	volume to read from
@@ -104,6 +259,10 @@ int ntfs_mft_records_read(const ntfs_volume *vol, const MFT_REF mref,
 				vol->mft_record_size_bits);
 		return -1;
 	}
+#if CACHE_MFTREC_SIZE
+	if (count == 1 && vol->mftrec_cache)
+		return mftrec_cache_read(vol, m, b);
+#endif
 	br = ntfs_attr_mst_pread(vol->mft_na, m << vol->mft_record_size_bits,
 			count, vol->mft_record_size, b);
 	if (br != count) {
@@ -188,6 +347,10 @@ int ntfs_mft_records_write(const ntfs_volume *vol, const MFT_REF mref,
 	}
 	bw = ntfs_attr_mst_pwrite(vol->mft_na, m << vol->mft_record_size_bits,
 			count, vol->mft_record_size, b);
+#if CACHE_MFTREC_SIZE
+	if (vol->mftrec_cache)
+		mftrec_cache_written(vol, m, count, b, bw == count);
+#endif
 	if (bw != count) {
 		if (bw != -1)
 			errno = EIO;
@@ -358,7 +521,7 @@ int ntfs_file_record_read(const ntfs_volume *vol, const MFT_REF mref,
 	
 	m = *mrec;
 	if (!m) {
-		m = ntfs_malloc(vol->mft_record_size);
+		m = ntfs_pool_get((struct NTFS_POOL*)&vol->mrec_pool);
 		if (!m)
 			return -1;
 	}
@@ -381,7 +544,7 @@ int ntfs_file_record_read(const ntfs_volume *vol, const MFT_REF mref,
 	return 0;
 err_out:
 	if (m != *mrec)
-		free(m);
+		ntfs_pool_put((struct NTFS_POOL*)&vol->mrec_pool, m);
 	return -1;
 }
 
@@ -634,8 +797,12 @@ static int ntfs_mft_bitmap_find_free_rec(ntfs_volume *vol, ntfs_inode *base_ni)
 					goto out;
 				
 				byte = buf + (bit >> 3);
-				if (*byte == 0xff)
+				if (*byte == 0xff) {
+						/* skip to the next byte with a free bit */
+					bit = (ntfs_bitmap_skip(buf, (bit >> 3) + 1,
+						size >> 3, 0xff) << 3) - 8;
 					continue;
+				}
 				
 				/* Note: ffz() result must be zero based. */
 				b = ntfs_ffz((unsigned long)*byte);
@@ -749,6 +916,7 @@ static int ntfs_mft_bitmap_extend_allocation_i(ntfs_volume *vol)
 				"the mft bitmap.\n");
 		return STATUS_ERROR;
 	}
+	mftbmp_na->rl_cursor = NULL;
 	rl = ntfs_runlists_merge(mftbmp_na->rl, rl2);
 	if (!rl) {
 		err = errno;
@@ -879,11 +1047,8 @@ undo_alloc:
 	rl->lcn = rl[1].lcn;
 	rl->length = 0;
 	
-	/* FIXME: use an ntfs_cluster_free_* function */
-	if (ntfs_bitmap_clear_bit(vol->lcnbmp_na, lcn))
+	if (ntfs_cluster_free_basic(vol, lcn, 1))
 		ntfs_log_error("Failed to free cluster.%s\n", es);
-	else
-		vol->free_clusters++;
 	if (mp_rebuilt) {
 		if (ntfs_mapping_pairs_build(vol, (u8*)a +
 				le16_to_cpu(a->mapping_pairs_offset),
@@ -1022,17 +1187,19 @@ out:
 /**
  * ntfs_mft_data_extend_allocation - extend mft data attribute
  * @vol:	volume on which to extend the mft data attribute
+ * @records:	number of mft records to extend it by
  *
- * Extend the mft data attribute on the ntfs volume @vol by 16 mft records
- * worth of clusters or if not enough space for this by one mft record worth
- * of clusters.
+ * Extend the mft data attribute on the ntfs volume @vol by @records mft
+ * records worth of clusters, in a single allocation from the mft zone
+ * following the end of $MFT.  If there is not enough space for this, the
+ * request is halved until it fits, down to one mft record worth of clusters.
  *
  * Note:  Only changes allocated_size, i.e. does not touch initialized_size or
  * data_size.
  *
  * Return 0 on success and -1 on error with errno set to the error code.
  */
-static int ntfs_mft_data_extend_allocation(ntfs_volume *vol)
+static int ntfs_mft_data_extend_allocation(ntfs_volume *vol, s64 records)
 {
 	LCN lcn;
 	VCN old_last_vcn;
@@ -1073,9 +1240,9 @@ static int ntfs_mft_data_extend_allocation(ntfs_volume *vol)
 	min_nr = vol->mft_record_size >> vol->cluster_size_bits;
 	if (!min_nr)
 		min_nr = 1;
-	/* Want to allocate 16 mft records worth of clusters. */
-	nr = vol->mft_record_size << 4 >> vol->cluster_size_bits;
-	if (!nr)
+	/* Want to allocate @records mft records worth of clusters. */
+	nr = records * vol->mft_record_size >> vol->cluster_size_bits;
+	if (nr < min_nr)
 		nr = min_nr;
 	
 	old_last_vcn = rl[1].vcn;
@@ -1090,16 +1257,20 @@ static int ntfs_mft_data_extend_allocation(ntfs_volume *vol)
 		}
 		/*
 		 * There is not enough space to do the allocation, but there
-		 * might be enough space to do a minimal allocation so try that
+		 * might be enough space to do a smaller one so try that
 		 * before failing.
 		 */
-		nr = min_nr;
+		nr >>= 1;
+		if (nr < min_nr)
+			nr = min_nr;
+		vol->mft_grow_records = 0;
 		ntfs_log_debug("Retrying mft data allocation with minimal cluster "
 				"count %lli.\n", (long long)nr);
 	} while (1);
 	
 	ntfs_log_debug("Allocated %lld clusters.\n", (long long)nr);
 	
+	mft_na->rl_cursor = NULL;
 	rl = ntfs_runlists_merge(mft_na->rl, rl2);
 	if (!rl) {
 		err = errno;
@@ -1231,6 +1402,7 @@ undo_alloc:
 	if (ntfs_cluster_free(vol, mft_na, old_last_vcn, -1) < 0)
 		ntfs_log_error("Failed to free clusters from mft data "
 				"attribute.%s\n", es);
+	mft_na->rl_cursor = NULL;
 	if (ntfs_rl_truncate(&mft_na->rl, old_last_vcn))
 		ntfs_log_error("Failed to truncate mft data attribute "
 				"runlist.%s\n", es);
@@ -1257,6 +1429,97 @@ undo_alloc:
 }
 
 
+/*
+ *		Get the number of mft records to extend $MFT/$DATA by when
+ *	it fills up
+ *
+ *	The step doubles each time it does, from 16 records, so that
+ *	creating many files extends $MFT in a few large extents rather
+ *	than in many small ones between their data.
+ */
+
+static s64 ntfs_mft_grow_records(ntfs_volume *vol)
+{
+	s64 records;
+
+	records = vol->mft_grow_records;
+	if (records < NTFS_MFT_GROW_MIN)
+		records = NTFS_MFT_GROW_MIN;
+	vol->mft_grow_records = records << 1;
+	if (vol->mft_grow_records > NTFS_MFT_GROW_MAX)
+		vol->mft_grow_records = NTFS_MFT_GROW_MAX;
+	return (records);
+}
+
+/**
+ * ntfs_mft_preextend - make room for more mft records in one allocation
+ * @vol:	volume on which to extend $MFT
+ * @count:	number of mft records to make room for
+ *
+ * Extend the allocation of $MFT/$DATA so that at least @count mft records
+ * lie allocated beyond those initialized, and the allocation of the mft
+ * bitmap so that it covers them.  The clusters are taken at once from the
+ * mft zone following the end of $MFT, the records themselves are only
+ * formatted as they are allocated.
+ *
+ * Return 0 on success and -1 on error with errno set to the error code.
+ */
+int ntfs_mft_preextend(ntfs_volume *vol, s64 count)
+{
+	ntfs_attr *mft_na, *mftbmp_na;
+	s64 have, old_allocated_size;
+	int ret = STATUS_ERROR;
+
+	ntfs_log_enter("Entering with count %lld\n", (long long)count);
+	if (!vol || !vol->mft_na || !vol->mftbmp_na || (count < 0)) {
+		errno = EINVAL;
+		goto out;
+	}
+	if (NVolReadOnly(vol)) {
+		errno = EROFS;
+		goto out;
+	}
+	mft_na = vol->mft_na;
+	mftbmp_na = vol->mftbmp_na;
+	have = (mft_na->allocated_size - mft_na->initialized_size)
+			>> vol->mft_record_size_bits;
+		/* do not take the last free clusters piecemeal for a request
+		   which cannot be met anyway */
+	if (have < count) {
+		if (!NVolFreeSpaceKnown(vol) && ntfs_volume_get_free_space(vol))
+			goto out;
+		if (((count - have) << vol->mft_record_size_bits
+				>> vol->cluster_size_bits) > vol->free_clusters) {
+			errno = ENOSPC;
+			goto out;
+		}
+	}
+	while (have < count) {
+		if (ntfs_mft_data_extend_allocation(vol, count - have)
+				== STATUS_ERROR)
+			goto out;
+		have = (mft_na->allocated_size - mft_na->initialized_size)
+				>> vol->mft_record_size_bits;
+	}
+	old_allocated_size = mftbmp_na->allocated_size;
+	while ((mftbmp_na->allocated_size << 3)
+			< (mft_na->allocated_size >> vol->mft_record_size_bits)) {
+		ret = ntfs_mft_bitmap_extend_allocation(vol);
+		if (ret == STATUS_KEEP_SEARCHING)
+			ret = ntfs_mft_bitmap_extend_allocation(vol);
+		if (ret != STATUS_OK) {
+			ret = STATUS_ERROR;
+			goto out;
+		}
+	}
+	vol->free_mft_records +=
+		(mftbmp_na->allocated_size - old_allocated_size) << 3;
+	ret = ntfs_inode_sync(mft_na->ni);
+out:
+	ntfs_log_leave("\n");
+	return ret;
+}
+
 static int ntfs_mft_record_init(ntfs_volume *vol, s64 size)
 {
 	int ret = -1;
@@ -1283,7 +1546,8 @@ static int ntfs_mft_record_init(ntfs_volume *vol, s64 size)
 			(long long)mft_na->data_size,
 			(long long)mft_na->initialized_size);
 	while (size > mft_na->allocated_size) {
-		if (ntfs_mft_data_extend_allocation(vol) == STATUS_ERROR)
+		if (ntfs_mft_data_extend_allocation(vol,
+				ntfs_mft_grow_records(vol)) == STATUS_ERROR)
 			goto out;
 		ntfs_log_debug("Status of mft data after allocation extension: "
 				"allocated_size 0x%llx, data_size 0x%llx, "
@@ -1510,12 +1774,12 @@ found_free_rec:
 	 * is not zero as well as the update sequence number if it is not zero
 	 * or -1 (0xffff).
 	 */
-	m = ntfs_malloc(vol->mft_record_size);
+	m = ntfs_pool_get(&vol->mrec_pool);
 	if (!m)
 		goto undo_mftbmp_alloc;
 	
 	if (ntfs_mft_record_read(vol, bit, m)) {
-		free(m);
+		ntfs_pool_put(&vol->mrec_pool, m);
 		goto undo_mftbmp_alloc;
 	}
 	/* Sanity check that the mft record is really not in use. */
@@ -1524,7 +1788,7 @@ found_free_rec:
 	    && (m->flags & MFT_RECORD_IN_USE))) {
 		ntfs_log_error("Inode %lld is used but it wasn't marked in "
 			       "$MFT bitmap. Fixed.\n", (long long)bit);
-		free(m);
+		ntfs_pool_put(&vol->mrec_pool, m);
 		goto undo_mftbmp_alloc;
 	}
 
@@ -1541,7 +1805,7 @@ found_free_rec:
 		usn = const_cpu_to_le16(1);
 	if (ntfs_mft_record_layout(vol, bit, m)) {
 		ntfs_log_error("Failed to re-format mft record.\n");
-		free(m);
+		ntfs_pool_put(&vol->mrec_pool, m);
 		goto undo_mftbmp_alloc;
 	}
 	if (seq_no)
@@ -1555,7 +1819,7 @@ found_free_rec:
 	ni = ntfs_inode_allocate(vol);
 	if (!ni) {
 		ntfs_log_error("Failed to allocate buffer for inode.\n");
-		free(m);
+		ntfs_pool_put(&vol->mrec_pool, m);
 		goto undo_mftbmp_alloc;
 	}
 	ni->mft_no = bit;
@@ -1580,8 +1844,8 @@ found_free_rec:
 		i = (base_ni->nr_extents + 4) * sizeof(ntfs_inode *);
 		extent_nis = ntfs_malloc(i);
 		if (!extent_nis) {
-			free(m);
-			free(ni);
+			ntfs_pool_put(&vol->mrec_pool, m);
+			ntfs_pool_put(&vol->inode_pool, ni);
 			goto undo_mftbmp_alloc;
 		}
 		if (base_ni->nr_extents) {
@@ -1607,6 +1871,7 @@ found_free_rec:
 	/* Return the opened, allocated inode of the allocated mft record. */
 	ntfs_log_error("allocated %sinode %lld\n",
 			base_ni ? "extent " : "", (long long)bit);
+	vol->free_mft_records--;
 out:
 	ntfs_log_leave("\n");	
 	return ni;
@@ -1830,7 +2095,7 @@ found_free_rec:
 	 * is not zero as well as the update sequence number if it is not zero
 	 * or -1 (0xffff).
 	 */
-	m = ntfs_malloc(vol->mft_record_size);
+	m = ntfs_pool_get(&vol->mrec_pool);
 	if (!m)
 		goto undo_mftbmp_alloc;
 	
@@ -1844,7 +2109,7 @@ found_free_rec:
 	if (ntfs_mft_record_read(vol, bit, m)) {
 		if (oldwarn)
 			NVolClearNoFixupWarn(vol);
-		free(m);
+		ntfs_pool_put(&vol->mrec_pool, m);
 		goto undo_mftbmp_alloc;
 	}
 	if (oldwarn)
@@ -1854,7 +2119,7 @@ found_free_rec:
 	if (ntfs_is_file_record(m->magic) && (m->flags & MFT_RECORD_IN_USE)) {
 		ntfs_log_error("Inode %lld is used but it wasn't marked in "
 			       "$MFT bitmap. Fixed.\n", (long long)bit);
-		free(m);
+		ntfs_pool_put(&vol->mrec_pool, m);
 		goto retry;
 	}
 	seq_no = m->sequence_number;
@@ -1870,7 +2135,7 @@ found_free_rec:
 		usn = const_cpu_to_le16(1);
 	if (ntfs_mft_record_layout(vol, bit, m)) {
 		ntfs_log_error("Failed to re-format mft record.\n");
-		free(m);
+		ntfs_pool_put(&vol->mrec_pool, m);
 		goto undo_mftbmp_alloc;
 	}
 	if (seq_no)
@@ -1884,7 +2149,7 @@ found_free_rec:
 	ni = ntfs_inode_allocate(vol);
 	if (!ni) {
 		ntfs_log_error("Failed to allocate buffer for inode.\n");
-		free(m);
+		ntfs_pool_put(&vol->mrec_pool, m);
 		goto undo_mftbmp_alloc;
 	}
 	ni->mft_no = bit;
@@ -1910,8 +2175,8 @@ found_free_rec:
 			i = (base_ni->nr_extents + 4) * sizeof(ntfs_inode *);
 			extent_nis = ntfs_malloc(i);
 			if (!extent_nis) {
-				free(m);
-				free(ni);
+				ntfs_pool_put(&vol->mrec_pool, m);
+				ntfs_pool_put(&vol->inode_pool, ni);
 				goto undo_mftbmp_alloc;
 			}
 			if (base_ni->nr_extents) {
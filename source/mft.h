@@ -29,9 +29,21 @@
 #include "layout.h"
 #include "logging.h"
 
+/*
+ *	Mft records $MFT/$DATA is extended by when it fills up, the step
+ *	doubling from the first to the last as files keep being created
+ */
+
+#define NTFS_MFT_GROW_MIN 16
+#define NTFS_MFT_GROW_MAX 1024
+
 extern int ntfs_mft_records_read(const ntfs_volume *vol, const MFT_REF mref,
 		const s64 count, MFT_RECORD *b);
 
+struct CACHED_GENERIC;
+
+extern int ntfs_mft_record_hash(const struct CACHED_GENERIC *item);
+
 /**
  * ntfs_mft_record_read - read a record from the mft
  * @vol:	volume to read from
@@ -124,6 +136,8 @@ extern int ntfs_mft_record_format(const ntfs_volume *vol, const MFT_REF mref);
 
 extern ntfs_inode *ntfs_mft_record_alloc(ntfs_volume *vol, ntfs_inode *base_ni);
 
+extern int ntfs_mft_preextend(ntfs_volume *vol, s64 count);
+
 extern ntfs_inode *ntfs_mft_rec_alloc(ntfs_volume *vol, BOOL mft_data);
 
 extern int ntfs_mft_record_free(ntfs_volume *vol, ntfs_inode *ni);
@@ -46,6 +46,82 @@ is_valid_record(u32 size, u16 usa_ofs, u16 usa_count)
 		usa_ofs + ((u32)usa_count * 2) <= NTFS_BLOCK_SIZE - 2;
 }
 
+/*
+ * Fixup kernels.  The update sequence array holds one le16 for every
+ * NTFS_BLOCK_SIZE stride of the record, whatever the sector size of the
+ * device, so a 1 KiB mft record always has 2 fixups and a 4 KiB index block or
+ * mft record 8.  The kernels are forced inline and called with those counts as
+ * constants, which lets the compiler unroll them into straight line loads and
+ * stores.  The check folds the differences of all the strides together so
+ * that a whole record takes a single branch.
+ */
+#define MST_STRIDE	(NTFS_BLOCK_SIZE/sizeof(u16))
+
+static __inline__ __attribute__((always_inline)) BOOL
+mst_check(const u16 *data_pos, u16 usn, const int count)
+{
+	u16 diff = 0;
+	int i;
+
+	for (i = 0; i < count; i++)
+		diff |= data_pos[i*MST_STRIDE] ^ usn;
+	return !diff;
+}
+
+static __inline__ __attribute__((always_inline)) void
+mst_restore(u16 *data_pos, const u16 *usa_pos, const int count)
+{
+	int i;
+
+	for (i = 0; i < count; i++)
+		data_pos[i*MST_STRIDE] = usa_pos[i];
+}
+
+static __inline__ __attribute__((always_inline)) void
+mst_protect(u16 *data_pos, u16 *usa_pos, u16 usn, const int count)
+{
+	int i;
+
+	for (i = 0; i < count; i++) {
+		usa_pos[i] = data_pos[i*MST_STRIDE];
+		data_pos[i*MST_STRIDE] = usn;
+	}
+}
+
+/*
+ * Select the kernel for the number of fixups of a record, the common
+ * geometries getting one unrolled for them.
+ */
+#define MST_KERNEL(count, kernel, ...) \
+	do { \
+		switch (count) { \
+		case 2: \
+			kernel(__VA_ARGS__, 2); \
+			break; \
+		case 8: \
+			kernel(__VA_ARGS__, 8); \
+			break; \
+		default: \
+			kernel(__VA_ARGS__, count); \
+			break; \
+		} \
+	} while (0)
+
+#define MST_CHECK(count, ok, data_pos, usn) \
+	do { \
+		switch (count) { \
+		case 2: \
+			ok = mst_check(data_pos, usn, 2); \
+			break; \
+		case 8: \
+			ok = mst_check(data_pos, usn, 8); \
+			break; \
+		default: \
+			ok = mst_check(data_pos, usn, count); \
+			break; \
+		} \
+	} while (0)
+
 /**
  * ntfs_mst_post_read_fixup - deprotect multi sector transfer protected data
  * @b:		pointer to the data to deprotect
@@ -67,6 +143,7 @@ int ntfs_mst_post_read_fixup_warn(NTFS_RECORD *b, const u32 size,
 {
 	u16 usa_ofs, usa_count, usn;
 	u16 *usa_pos, *data_pos;
+	BOOL ok;
 
 	ntfs_log_trace("Entering\n");
 
@@ -101,8 +178,14 @@ int ntfs_mst_post_read_fixup_warn(NTFS_RECORD *b, const u32 size,
 	 */
 	data_pos = (u16*)b + NTFS_BLOCK_SIZE/sizeof(u16) - 1;
 	/*
-	 * Check for incomplete multi sector transfer(s).
+	 * Check for incomplete multi sector transfer(s), all at once and then
+	 * stride by stride to report the first one found.
 	 */
+	MST_CHECK(usa_count - 1, ok, data_pos, usn);
+	if (ok) {
+		MST_KERNEL(usa_count - 1, mst_restore, data_pos, usa_pos + 1);
+		return 0;
+	}
 	while (--usa_count) {
 		if (*data_pos != usn) {
 			/*
@@ -120,19 +203,7 @@ int ntfs_mst_post_read_fixup_warn(NTFS_RECORD *b, const u32 size,
 		}
 		data_pos += NTFS_BLOCK_SIZE/sizeof(u16);
 	}
-	/* Re-setup the variables. */
-	usa_count = le16_to_cpu(b->usa_count);
-	data_pos = (u16*)b + NTFS_BLOCK_SIZE/sizeof(u16) - 1;
-	/* Fixup all sectors. */
-	while (--usa_count) {
-		/*
-		 * Increment position in usa and restore original data from
-		 * the usa into the data buffer.
-		 */
-		*data_pos = *(++usa_pos);
-		/* Increment position in data as well. */
-		data_pos += NTFS_BLOCK_SIZE/sizeof(u16);
-	}
+	/* Not reached, one of the strides did not match. */
 	return 0;
 }
 
@@ -203,18 +274,12 @@ int ntfs_mst_pre_write_fixup(NTFS_RECORD *b, const u32 size)
 	*usa_pos = le_usn;
 	/* Position in data of first le16 that needs fixing up. */
 	data_pos = (le16*)b + NTFS_BLOCK_SIZE/sizeof(le16) - 1;
-	/* Fixup all sectors. */
-	while (--usa_count) {
-		/*
-		 * Increment the position in the usa and save the
-		 * original data from the data buffer into the usa.
-		 */
-		*(++usa_pos) = *data_pos;
-		/* Apply fixup to data. */
-		*data_pos = le_usn;
-		/* Increment position in data as well. */
-		data_pos += NTFS_BLOCK_SIZE/sizeof(le16);
-	}
+	/*
+	 * Save the original data of each sector into the usa and replace it
+	 * with the usn.
+	 */
+	MST_KERNEL(usa_count - 1, mst_protect, (u16*)data_pos,
+			(u16*)usa_pos + 1, (u16)le_usn);
 	return 0;
 }
 
@@ -242,16 +307,7 @@ void ntfs_mst_post_write_fixup(NTFS_RECORD *b)
 	/* Position in protected data of first u16 that needs fixing up. */
 	data_pos = (u16*)b + NTFS_BLOCK_SIZE/sizeof(u16) - 1;
 
-	/* Fixup all sectors. */
-	while (--usa_count) {
-		/*
-		 * Increment position in usa and restore original data from
-		 * the usa into the data buffer.
-		 */
-		*data_pos = *(++usa_pos);
-
-		/* Increment position in data as well. */
-		data_pos += NTFS_BLOCK_SIZE/sizeof(u16);
-	}
+	/* Restore the original data of all sectors from the usa. */
+	MST_KERNEL(usa_count - 1, mst_restore, data_pos, usa_pos + 1);
 }
 
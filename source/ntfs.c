@@ -33,14 +33,17 @@
 #ifdef HAVE_STRING_H
 #include <string.h>
 #endif
+#include <malloc.h>
 
 #include "ntfs.h"
 #include "ntfsinternal.h"
 #include "ntfsfile.h"
 #include "ntfsdir.h"
 #include "gekko_io.h"
+#include "ntfsstats.h"
 #include "cache.h"
 #include "bootsect.h"
+#include "mft.h"
 
 // NTFS device driver devoptab
 static const devoptab_t devops_ntfs = {
@@ -86,6 +89,9 @@ void ntfsInit (void)
     if (!isInit) {
         isInit = true;
 
+        // Create the lock that lets devices be mounted on several threads
+        ntfs_device_gekko_io_init();
+
         // Set the log handler
         #ifdef NTFS_ENABLE_LOG
         ntfs_log_set_handler(ntfs_log_handler_stderr);
@@ -97,22 +103,189 @@ void ntfsInit (void)
     return;
 }
 
+/**
+ * ntfs_probe - The first sectors of a device, read in one transfer while looking for partitions
+ */
+typedef struct _ntfs_probe {
+    DISC_INTERFACE *interface;              /* Device being probed */
+    u8 *window;                             /* The first sectors of the device */
+    sec_t count;                            /* Number of sectors held in window */
+    u32 sectorSize;                         /* Size of a sector in bytes */
+    u8 *scratch;                            /* The last sector read from outside the window */
+} ntfs_probe;
+
+static bool ntfsProbeOpen (ntfs_probe *probe, DISC_INTERFACE *interface)
+{
+    u32 size = interface->bytesPerSector;
+
+    // Only batch the probe when the interface says how large its sectors are,
+    // otherwise read one sector at a time into buffers large enough for any of them
+    probe->interface = interface;
+    probe->sectorSize = 512;
+    probe->count = 1;
+    if (size >= 512 && size <= MAX_SECTOR_SIZE && !(size & (size - 1))) {
+        probe->sectorSize = size;
+        probe->count = NTFS_PROBE_SECTORS;
+        if (interface->numberOfSectors && interface->numberOfSectors < probe->count)
+            probe->count = interface->numberOfSectors;
+    }
+    probe->window = (u8*)memalign(32, probe->count > 1 ? probe->count * probe->sectorSize : MAX_SECTOR_SIZE);
+    probe->scratch = (u8*)memalign(32, MAX_SECTOR_SIZE);
+    if (!probe->window || !probe->scratch) {
+        ntfs_free(probe->window);
+        ntfs_free(probe->scratch);
+        errno = ENOMEM;
+        return false;
+    }
+
+    // Read the start of the device, falling back to its first sector alone if the transfer is refused
+    if (interface->readSectors(interface, 0, probe->count, probe->window))
+        return true;
+    probe->count = 1;
+    if (interface->readSectors(interface, 0, 1, probe->window))
+        return true;
+
+    ntfs_free(probe->window);
+    ntfs_free(probe->scratch);
+    errno = EIO;
+    return false;
+}
+
+static void ntfsProbeClose (ntfs_probe *probe)
+{
+    ntfs_free(probe->window);
+    ntfs_free(probe->scratch);
+}
+
+static const u8 *ntfsProbeSector (ntfs_probe *probe, sec_t sector)
+{
+    // Sectors near the start of the device were read up front
+    if (sector < probe->count)
+        return probe->window + sector * probe->sectorSize;
+
+    if (!probe->interface->readSectors(probe->interface, sector, 1, probe->scratch))
+        return NULL;
+
+    return probe->scratch;
+}
+
+static bool ntfsProbeBootSector (ntfs_probe *probe, sec_t sector)
+{
+    const u8 *buffer = ntfsProbeSector(probe, sector);
+
+    return buffer && ntfs_boot_sector_is_ntfs((NTFS_BOOT_SECTOR*)buffer);
+}
+
+static u32 ntfsCrc32 (u32 crc, const u8 *data, size_t len)
+{
+    int i;
+
+    // Reflected CRC-32 (IEEE 802.3), as used by the GUID partition table
+    while (len--) {
+        crc ^= *data++;
+        for (i = 0; i < 8; i++)
+            crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+    }
+
+    return crc;
+}
+
+static bool ntfsProbeGpt (ntfs_probe *probe, sec_t *partition_starts, int *partition_count)
+{
+    const u8 *buffer;
+    const GPT_PARTITION_ENTRY *entry;
+    GPT_HEADER header;
+    u8 *entries = NULL;
+    const u8 *array;
+    u32 header_size, entry_size, entry_count, crc, i;
+    u64 array_lba, array_sectors, first_lba;
+    size_t array_size;
+    static const u8 zero[4] = {0};
+    static const u8 unused[16] = {0};
+
+    // Read and validate the primary header, which follows the protective MBR
+    buffer = ntfsProbeSector(probe, 1);
+    if (!buffer)
+        return false;
+    memcpy(&header, buffer, sizeof(GPT_HEADER));
+    header_size = le32_to_cpu(header.header_size);
+    if (header.signature != GPT_SIGNATURE || header_size < sizeof(GPT_HEADER) || header_size > probe->sectorSize ||
+        le64_to_cpu(header.current_lba) != 1) {
+        ntfs_log_debug("No valid GUID Partition Table header found\n");
+        return false;
+    }
+    crc = ntfsCrc32(0xFFFFFFFF, buffer, offsetof(GPT_HEADER, header_crc32));
+    crc = ntfsCrc32(crc, zero, sizeof(zero));
+    crc = ntfsCrc32(crc, buffer + offsetof(GPT_HEADER, reserved), header_size - offsetof(GPT_HEADER, reserved));
+    if (~crc != le32_to_cpu(header.header_crc32)) {
+        ntfs_log_debug("GUID Partition Table header checksum mismatch\n");
+        return false;
+    }
+
+    // Work out where the partition entry array is and how large it is
+    entry_size = le32_to_cpu(header.sizeof_partition_entry);
+    entry_count = le32_to_cpu(header.num_partition_entries);
+    array_lba = le64_to_cpu(header.partition_entry_lba);
+    if (entry_size < sizeof(GPT_PARTITION_ENTRY) || (entry_size & 7) || array_lba < 2 ||
+        entry_count > NTFS_MAX_GPT_ENTRIES_SIZE / entry_size) {
+        ntfs_log_debug("GUID Partition Table entry array is invalid\n");
+        return false;
+    }
+    array_size = (size_t)entry_count * entry_size;
+    array_sectors = (array_size + probe->sectorSize - 1) / probe->sectorSize;
+
+    // The array normally sits right after the header, inside the sectors already read;
+    // if it does not, read all of it in one transfer
+    if (array_lba + array_sectors <= probe->count) {
+        array = probe->window + array_lba * probe->sectorSize;
+    } else {
+        entries = (u8*)memalign(32, array_sectors * probe->sectorSize);
+        if (!entries)
+            return false;
+        if (!probe->interface->readSectors(probe->interface, array_lba, array_sectors, entries)) {
+            ntfs_free(entries);
+            return false;
+        }
+        array = entries;
+    }
+    if (~ntfsCrc32(0xFFFFFFFF, array, array_size) != le32_to_cpu(header.partition_entry_array_crc32)) {
+        ntfs_log_debug("GUID Partition Table entry array checksum mismatch\n");
+        ntfs_free(entries);
+        return false;
+    }
+    ntfs_log_debug("Valid GUID Partition Table found, %u entries\n", entry_count);
+
+    // Search the entries for all NTFS partitions, whatever type they claim to be
+    for (i = 0; i < entry_count && *partition_count < NTFS_MAX_PARTITIONS; i++) {
+        entry = (const GPT_PARTITION_ENTRY*)(array + i * entry_size);
+        first_lba = le64_to_cpu(entry->first_lba);
+        if (!memcmp(entry->type_guid, unused, sizeof(unused)) || !first_lba || first_lba > le64_to_cpu(entry->last_lba))
+            continue;
+        if (ntfsProbeBootSector(probe, first_lba)) {
+            ntfs_log_debug("GPT Partition %u: Valid NTFS boot sector found, sector %llu\n", i + 1, (unsigned long long)first_lba);
+            partition_starts[*partition_count] = first_lba;
+            (*partition_count)++;
+        }
+    }
+
+    ntfs_free(entries);
+
+    return true;
+}
+
 int ntfsFindPartitions (DISC_INTERFACE *interface, sec_t **partitions)
 {
     MASTER_BOOT_RECORD mbr;
     PARTITION_RECORD *partition = NULL;
+    const EXTENDED_BOOT_RECORD *ebr;
     sec_t partition_starts[NTFS_MAX_PARTITIONS] = {0};
     int partition_count = 0;
     sec_t part_lba = 0;
+    ntfs_probe probe;
+    bool gpt = false;
+    u8 type;
     int i;
 
-    union {
-        u8 buffer[MAX_SECTOR_SIZE] ATTRIBUTE_ALIGN(32);
-        MASTER_BOOT_RECORD mbr;
-        EXTENDED_BOOT_RECORD ebr;
-        NTFS_BOOT_SECTOR boot;
-    } sector;
-
     // Sanity check
     if (!interface) {
         errno = EINVAL;
@@ -133,13 +306,11 @@ int ntfsFindPartitions (DISC_INTERFACE *interface, sec_t **partitions)
         return 0;
     }
 
-    // Read the first sector on the device
-    if (!interface->readSectors(interface, 0, 1, &sector.buffer)) {
-        errno = EIO;
+    // Read the first sectors on the device, enough to hold the MBR, a GUID partition table and any stray boot sector
+    if (!ntfsProbeOpen(&probe, interface))
         return -1;
-    }
 
-    if (ntfs_boot_sector_is_ntfs(&sector.boot)) {
+    if (ntfs_boot_sector_is_ntfs((NTFS_BOOT_SECTOR*)probe.window)) {
         ntfs_log_debug("Valid NTFS boot sector found\n");
         if (partition_count < NTFS_MAX_PARTITIONS) {
             partition_starts[partition_count] = 0;
@@ -147,12 +318,21 @@ int ntfsFindPartitions (DISC_INTERFACE *interface, sec_t **partitions)
         }
 
     // If this is the devices master boot record
-    } else if (sector.mbr.signature == MBR_SIGNATURE) {
-        memcpy(&mbr, &sector, sizeof(MASTER_BOOT_RECORD));
+    } else if (((MASTER_BOOT_RECORD*)probe.window)->signature == MBR_SIGNATURE) {
+        memcpy(&mbr, probe.window, sizeof(MASTER_BOOT_RECORD));
         ntfs_log_debug("Valid Master Boot Record found\n");
 
-        // Search the partition table for all NTFS partitions (max. 4 primary partitions)
+        // A protective partition means the device is laid out by the GUID partition table that follows;
+        // any other entries beside it (a hybrid MBR) only mirror partitions of that table
         for (i = 0; i < 4; i++) {
+            if (mbr.partitions[i].type == PARTITION_TYPE_GPT_PROTECTIVE) {
+                gpt = ntfsProbeGpt(&probe, partition_starts, &partition_count);
+                break;
+            }
+        }
+
+        // Search the partition table for all NTFS partitions (max. 4 primary partitions)
+        for (i = 0; i < 4 && !gpt; i++) {
             partition = &mbr.partitions[i];
             part_lba = le32_to_cpu(mbr.partitions[i].lba_start);
 
@@ -172,16 +352,14 @@ int ntfsFindPartitions (DISC_INTERFACE *interface, sec_t **partitions)
                     ntfs_log_debug("Partition %i: Claims to be NTFS\n", i + 1);
 
                     // Read and validate the NTFS partition
-                    if (interface->readSectors(interface, part_lba, 1, &sector)) {
-                        if (ntfs_boot_sector_is_ntfs(&sector.boot)) {
-                            ntfs_log_debug("Partition %i: Valid NTFS boot sector found\n", i + 1);
-                            if (partition_count < NTFS_MAX_PARTITIONS) {
-                                partition_starts[partition_count] = part_lba;
-                                partition_count++;
-                            }
-                        } else {
-                            ntfs_log_debug("Partition %i: Invalid NTFS boot sector, not actually NTFS\n", i + 1);
+                    if (ntfsProbeBootSector(&probe, part_lba)) {
+                        ntfs_log_debug("Partition %i: Valid NTFS boot sector found\n", i + 1);
+                        if (partition_count < NTFS_MAX_PARTITIONS) {
+                            partition_starts[partition_count] = part_lba;
+                            partition_count++;
                         }
+                    } else {
+                        ntfs_log_debug("Partition %i: Invalid NTFS boot sector, not actually NTFS\n", i + 1);
                     }
 
                     break;
@@ -199,28 +377,28 @@ int ntfsFindPartitions (DISC_INTERFACE *interface, sec_t **partitions)
                     do {
 
                         // Read and validate the extended boot record
-                        if (interface->readSectors(interface, ebr_lba + next_erb_lba, 1, &sector)) {
-                            if (sector.ebr.signature == EBR_SIGNATURE) {
+                        ebr = (const EXTENDED_BOOT_RECORD*)ntfsProbeSector(&probe, ebr_lba + next_erb_lba);
+                        if (ebr) {
+                            if (ebr->signature == EBR_SIGNATURE) {
                                 ntfs_log_debug("Logical Partition @ %lld: %s type 0x%x\n", ebr_lba + next_erb_lba,
-                                               sector.ebr.partition.status == PARTITION_STATUS_BOOTABLE ? "bootable (active)" : "non-bootable",
-                                               sector.ebr.partition.type);
+                                               ebr->partition.status == PARTITION_STATUS_BOOTABLE ? "bootable (active)" : "non-bootable",
+                                               ebr->partition.type);
 
                                 // Get the start sector of the current partition
                                 // and the next extended boot record in the chain
-                                part_lba = ebr_lba + next_erb_lba + le32_to_cpu(sector.ebr.partition.lba_start);
-                                next_erb_lba = le32_to_cpu(sector.ebr.next_ebr.lba_start);
+                                part_lba = ebr_lba + next_erb_lba + le32_to_cpu(ebr->partition.lba_start);
+                                next_erb_lba = le32_to_cpu(ebr->next_ebr.lba_start);
+                                type = ebr->partition.type;
 
                                 // Check if this partition has a valid NTFS boot record
-                                if (interface->readSectors(interface, part_lba, 1, &sector)) {
-                                    if (ntfs_boot_sector_is_ntfs(&sector.boot)) {
-                                        ntfs_log_debug("Logical Partition @ %lld: Valid NTFS boot sector found\n", part_lba);
-                                        if(sector.ebr.partition.type != PARTITION_TYPE_NTFS) {
-                                            ntfs_log_warning("Logical Partition @ %lld: Is NTFS but type is 0x%x; 0x%x was expected\n", part_lba, sector.ebr.partition.type, PARTITION_TYPE_NTFS);
-                                        }
-                                        if (partition_count < NTFS_MAX_PARTITIONS) {
-                                            partition_starts[partition_count] = part_lba;
-                                            partition_count++;
-                                        }
+                                if (ntfsProbeBootSector(&probe, part_lba)) {
+                                    ntfs_log_debug("Logical Partition @ %lld: Valid NTFS boot sector found\n", part_lba);
+                                    if (type != PARTITION_TYPE_NTFS) {
+                                        ntfs_log_warning("Logical Partition @ %lld: Is NTFS but type is 0x%x; 0x%x was expected\n", part_lba, type, PARTITION_TYPE_NTFS);
+                                    }
+                                    if (partition_count < NTFS_MAX_PARTITIONS) {
+                                        partition_starts[partition_count] = part_lba;
+                                        partition_count++;
                                     }
                                 }
 
@@ -240,16 +418,14 @@ int ntfsFindPartitions (DISC_INTERFACE *interface, sec_t **partitions)
 
                     // Check if this partition has a valid NTFS boot record anyway,
                     // it might be misrepresented due to a lazy partition editor
-                    if (interface->readSectors(interface, part_lba, 1, &sector)) {
-                        if (ntfs_boot_sector_is_ntfs(&sector.boot)) {
-                            ntfs_log_debug("Partition %i: Valid NTFS boot sector found\n", i + 1);
-                            if(partition->type != PARTITION_TYPE_NTFS) {
-                                ntfs_log_warning("Partition %i: Is NTFS but type is 0x%x; 0x%x was expected\n", i + 1, partition->type, PARTITION_TYPE_NTFS);
-                            }
-                            if (partition_count < NTFS_MAX_PARTITIONS) {
-                                partition_starts[partition_count] = part_lba;
-                                partition_count++;
-                            }
+                    if (ntfsProbeBootSector(&probe, part_lba)) {
+                        ntfs_log_debug("Partition %i: Valid NTFS boot sector found\n", i + 1);
+                        if(partition->type != PARTITION_TYPE_NTFS) {
+                            ntfs_log_warning("Partition %i: Is NTFS but type is 0x%x; 0x%x was expected\n", i + 1, partition->type, PARTITION_TYPE_NTFS);
+                        }
+                        if (partition_count < NTFS_MAX_PARTITIONS) {
+                            partition_starts[partition_count] = part_lba;
+                            partition_count++;
                         }
                     }
 
@@ -267,19 +443,19 @@ int ntfsFindPartitions (DISC_INTERFACE *interface, sec_t **partitions)
 
         // As a last-ditched effort, search the first 64 sectors of the device for stray NTFS partitions
         for (i = 1; i < 64; i++) {
-            if (interface->readSectors(interface, i, 1, &sector)) {
-                if (ntfs_boot_sector_is_ntfs(&sector.boot)) {
-                    ntfs_log_debug("Valid NTFS boot sector found at sector %d!\n", i);
-                    if (partition_count < NTFS_MAX_PARTITIONS) {
-                        partition_starts[partition_count] = i;
-                        partition_count++;
-                    }
+            if (ntfsProbeBootSector(&probe, i)) {
+                ntfs_log_debug("Valid NTFS boot sector found at sector %d!\n", i);
+                if (partition_count < NTFS_MAX_PARTITIONS) {
+                    partition_starts[partition_count] = i;
+                    partition_count++;
                 }
             }
         }
 
     }
 
+    ntfsProbeClose(&probe);
+
     // Return the found partitions (if any)
     if (partition_count > 0) {
         *partitions = (sec_t*)ntfs_malloc(sizeof(sec_t) * partition_count);
@@ -350,6 +526,233 @@ int ntfsMountAll (ntfs_md **mounts, u32 flags)
     return 0;
 }
 
+// Per-device threads used by ntfsMountAllParallel
+#define MOUNT_STACK_SIZE    (64 * 1024)
+#define MOUNT_PRIORITY      64
+
+typedef struct _ntfs_mount_batch ntfs_mount_batch;
+
+/**
+ * ntfs_mount_worker - A device being probed and mounted by ntfsMountAllParallel
+ */
+typedef struct _ntfs_mount_worker {
+    ntfs_mount_batch *batch;                /* Batch the device belongs to */
+    const INTERFACE_ID *disc;               /* Device to probe and mount */
+    bool primary;                           /* True if ntfsMountAllParallel waits for this device */
+    lwp_t thread;                           /* Thread doing the work, or LWP_THREAD_NULL if done by the caller */
+} ntfs_mount_worker;
+
+/**
+ * ntfs_mount_batch - The devices handled by one call of ntfsMountAllParallel
+ */
+struct _ntfs_mount_batch {
+    mutex_t lock;                           /* Guards the fields below */
+    cond_t done;                            /* Signalled as each device finishes */
+    u32 flags;                              /* Mounting flags */
+    int pending;                            /* Devices still being handled */
+    int pendingPrimary;                     /* Primary devices still being handled */
+    int error;                              /* Error to report, or 0 */
+    bool reserved[NTFS_MAX_MOUNTS];         /* Mount names taken by a mount still in progress */
+    ntfs_md mount_points[NTFS_MAX_MOUNTS];  /* Mounts made so far */
+    int mount_count;                        /* Number of entries in mount_points */
+    ntfs_mount_callback callback;           /* Called once every device has been handled */
+    void *data;                             /* User data for callback */
+    ntfs_mount_worker *workers;             /* One worker per device */
+    int worker_count;                       /* Number of entries in workers */
+};
+
+// The batch whose devices were left to finish in the background, if any
+static ntfs_mount_batch *ntfsPendingBatch = NULL;
+
+static ntfs_md *ntfsCopyMounts (ntfs_mount_batch *batch, int *count)
+{
+    ntfs_md *mounts = NULL;
+
+    *count = batch->mount_count;
+    if (batch->mount_count > 0) {
+        mounts = (ntfs_md*)ntfs_malloc(sizeof(ntfs_md) * batch->mount_count);
+        if (mounts)
+            memcpy(mounts, batch->mount_points, sizeof(ntfs_md) * batch->mount_count);
+        else
+            *count = 0;
+    }
+
+    return mounts;
+}
+
+static void *ntfsMountWorker (void *arg)
+{
+    ntfs_mount_worker *worker = (ntfs_mount_worker*)arg;
+    ntfs_mount_batch *batch = worker->batch;
+    const INTERFACE_ID *disc = worker->disc;
+    sec_t *partitions = NULL;
+    int partition_count = 0;
+    ntfs_md *mounts = NULL;
+    int count = 0;
+    bool mounted, last;
+    char name[128];
+    int j, k;
+
+    // Find the partitions of this device while the other devices do the same
+    partition_count = ntfsFindPartitions(disc->interface, &partitions);
+    if (partition_count > 0 && partitions) {
+        for (j = 0, k = 0; j < partition_count; j++) {
+
+            // Find the next unused mount name, reserving it against the other devices of the batch
+            LWP_MutexLock(batch->lock);
+            do {
+                sprintf(name, "%s%i", NTFS_MOUNT_PREFIX, k++);
+            } while (k < NTFS_MAX_MOUNTS && (batch->reserved[k - 1] || ntfsGetDevice(name, false)));
+            if (k >= NTFS_MAX_MOUNTS) {
+                batch->error = EADDRNOTAVAIL;
+                LWP_MutexUnlock(batch->lock);
+                break;
+            }
+            batch->reserved[k - 1] = true;
+            LWP_MutexUnlock(batch->lock);
+
+            // Mount the partition
+            mounted = ntfsMount(name, disc->interface, partitions[j], CACHE_DEFAULT_PAGE_SIZE, CACHE_DEFAULT_PAGE_COUNT, batch->flags);
+
+            // Record the mount, or give its name back
+            LWP_MutexLock(batch->lock);
+            batch->reserved[k - 1] = false;
+            if (mounted && batch->mount_count < NTFS_MAX_MOUNTS) {
+                strcpy(batch->mount_points[batch->mount_count].name, name);
+                batch->mount_points[batch->mount_count].interface = disc->interface;
+                batch->mount_points[batch->mount_count].startSector = partitions[j];
+                batch->mount_count++;
+            }
+            LWP_MutexUnlock(batch->lock);
+
+        }
+        ntfs_free(partitions);
+    }
+
+    // This device is done; the last one to finish reports every mount
+    LWP_MutexLock(batch->lock);
+    batch->pending--;
+    if (worker->primary)
+        batch->pendingPrimary--;
+    last = (batch->pending == 0);
+    if (last && batch->callback)
+        mounts = ntfsCopyMounts(batch, &count);
+    LWP_CondBroadcast(batch->done);
+    LWP_MutexUnlock(batch->lock);
+    if (last && batch->callback)
+        batch->callback(mounts, count, batch->data);
+
+    return NULL;
+}
+
+static void ntfsFreeBatch (ntfs_mount_batch *batch)
+{
+    int i;
+
+    // Wait for every device of the batch, then release it
+    for (i = 0; i < batch->worker_count; i++) {
+        if (batch->workers[i].thread != LWP_THREAD_NULL)
+            LWP_JoinThread(batch->workers[i].thread, NULL);
+    }
+    LWP_CondDestroy(batch->done);
+    LWP_MutexDestroy(batch->lock);
+    ntfs_free(batch->workers);
+    ntfs_free(batch);
+}
+
+void ntfsMountAllWait (void)
+{
+    if (ntfsPendingBatch) {
+        ntfsFreeBatch(ntfsPendingBatch);
+        ntfsPendingBatch = NULL;
+    }
+}
+
+int ntfsMountAllParallel (ntfs_md **mounts, u32 flags, const char *primary, ntfs_mount_callback callback, void *data)
+{
+    const INTERFACE_ID *discs = ntfsGetDiscInterfaces();
+    ntfs_mount_batch *batch = NULL;
+    ntfs_mount_worker *worker = NULL;
+    int mount_count = 0;
+    bool waitAll, background;
+    int error = 0;
+    int i;
+
+    // Initialise ntfs-3g
+    ntfsInit();
+
+    // Finish off any earlier batch still running in the background
+    ntfsMountAllWait();
+
+    // Allocate the batch, with one worker per known device
+    batch = (ntfs_mount_batch*)ntfs_calloc(sizeof(ntfs_mount_batch));
+    if (!batch) {
+        errno = ENOMEM;
+        return -1;
+    }
+    for (i = 0; discs[i].name != NULL && discs[i].interface != NULL; i++);
+    batch->workers = (ntfs_mount_worker*)ntfs_calloc(sizeof(ntfs_mount_worker) * (i ? i : 1));
+    if (!batch->workers) {
+        ntfs_free(batch);
+        errno = ENOMEM;
+        return -1;
+    }
+    LWP_MutexInit(&batch->lock, false);
+    LWP_CondInit(&batch->done);
+    batch->flags = flags;
+    batch->callback = callback;
+    batch->data = data;
+    batch->worker_count = i;
+    batch->pending = i;
+    for (i = 0; i < batch->worker_count; i++) {
+        worker = &batch->workers[i];
+        worker->batch = batch;
+        worker->disc = &discs[i];
+        worker->primary = (primary && strcmp(discs[i].name, primary) == 0);
+        worker->thread = LWP_THREAD_NULL;
+        if (worker->primary)
+            batch->pendingPrimary++;
+    }
+
+    waitAll = (batch->pendingPrimary == 0);
+
+    // Probe and mount each device on its own thread, or here if no thread can be had
+    for (i = 0; i < batch->worker_count; i++) {
+        worker = &batch->workers[i];
+        if (LWP_CreateThread(&worker->thread, ntfsMountWorker, worker, NULL, MOUNT_STACK_SIZE, MOUNT_PRIORITY) < 0) {
+            worker->thread = LWP_THREAD_NULL;
+            ntfsMountWorker(worker);
+        }
+    }
+
+    // Wait for the primary devices, or for all of them if there are none
+    LWP_MutexLock(batch->lock);
+    while (waitAll ? batch->pending > 0 : batch->pendingPrimary > 0)
+        LWP_CondWait(batch->done, batch->lock);
+    if (mounts)
+        *mounts = ntfsCopyMounts(batch, &mount_count);
+    error = batch->error;
+    background = (batch->pending > 0);
+    LWP_MutexUnlock(batch->lock);
+
+    // Leave the other devices to finish in the background
+    if (background)
+        ntfsPendingBatch = batch;
+    else
+        ntfsFreeBatch(batch);
+
+    if (error) {
+        if (mounts) {
+            ntfs_free(*mounts);
+            *mounts = NULL;
+        }
+        errno = error;
+        return -1;
+    }
+
+    return mount_count;
+}
+
 int ntfsMountDevice (DISC_INTERFACE *interface, ntfs_md **mounts, u32 flags)
 {
     const INTERFACE_ID *discs = ntfsGetDiscInterfaces();
@@ -423,10 +826,54 @@ int ntfsMountDevice (DISC_INTERFACE *interface, ntfs_md **mounts, u32 flags)
     return 0;
 }
 
+void ntfsInitMountOptions (ntfs_mount_opts *opts)
+{
+    opts->cachePageCount = CACHE_DEFAULT_PAGE_COUNT;
+    opts->cachePageSize = CACHE_DEFAULT_PAGE_SIZE;
+    opts->cacheMetaPageCount = CACHE_DEFAULT_META_PAGE_COUNT;
+    opts->cacheMetaPageSize = CACHE_DEFAULT_META_PAGE_SIZE;
+    opts->cacheReadAhead = CACHE_DEFAULT_READ_AHEAD;
+    opts->cacheFlushAge = CACHE_DEFAULT_FLUSH_AGE;
+    opts->cacheFlushThreshold = CACHE_DEFAULT_FLUSH_THRESHOLD;
+    opts->flags = NTFS_DEFAULT;
+    opts->discard = NULL;
+    opts->ioTraceSize = 0;
+    opts->lazySyncAge = LAZY_SYNC_DEFAULT_AGE;
+    opts->inodeCacheSize = CACHE_INODE_SIZE;
+    opts->nidataCacheSize = CACHE_NIDATA_SIZE;
+    opts->lookupCacheSize = CACHE_LOOKUP_SIZE;
+    opts->securidCacheSize = CACHE_SECURID_SIZE;
+    opts->legacyCacheSize = CACHE_LEGACY_SIZE;
+    opts->mftRecordCacheSize = CACHE_MFTREC_SIZE;
+    opts->caseIndexSize = CACHE_CASE_INDEX_SIZE;
+    opts->sdhCacheSize = CACHE_SDH_SIZE;
+    opts->reparseCacheSize = CACHE_REPARSE_SIZE;
+    opts->compressedBlockCacheSize = CACHE_CBLOCK_SIZE;
+    opts->compressionLevel = NTFS_COMPRESS_BEST;
+    opts->groupCommitWindow = GROUP_COMMIT_DEFAULT_WINDOW;
+    opts->memoryBudget = 0;
+    opts->mftPreextend = 0;
+}
+
 bool ntfsMount (const char *name, DISC_INTERFACE *interface, sec_t startSector, u32 cachePageCount, u32 cachePageSize, u32 flags)
 {
+    ntfs_mount_opts opts;
+
+    ntfsInitMountOptions(&opts);
+    opts.cachePageCount = cachePageCount;
+    opts.cachePageSize = cachePageSize;
+    opts.flags = flags;
+
+    return ntfsMountEx(name, interface, startSector, &opts);
+}
+
+bool ntfsMountEx (const char *name, DISC_INTERFACE *interface, sec_t startSector, const ntfs_mount_opts *opts)
+{
+    ntfs_mount_opts defaults;
+    struct LRU_CACHE_SIZES lru_sizes;
     ntfs_vd *vd = NULL;
     gekko_fd *fd = NULL;
+    u32 flags;
 
     // Sanity check
     if (!name || !interface) {
@@ -434,6 +881,13 @@ bool ntfsMount (const char *name, DISC_INTERFACE *interface, sec_t startSector,
         return false;
     }
 
+    // Use the default mount options if none were given
+    if (!opts) {
+        ntfsInitMountOptions(&defaults);
+        opts = &defaults;
+    }
+    flags = opts->flags;
+
     // Initialise ntfs-3g
     ntfsInit();
 
@@ -463,7 +917,12 @@ bool ntfsMount (const char *name, DISC_INTERFACE *interface, sec_t startSector,
     vd->gid = 0;
     vd->fmask = 0;
     vd->dmask = 0;
+    vd->noPermissions = (flags & NTFS_NO_PERMISSIONS);
     vd->atime = ((flags & NTFS_UPDATE_ACCESS_TIMES) ? ATIME_ENABLED : ATIME_DISABLED);
+    vd->lazySyncAge = opts->lazySyncAge;
+    vd->commitWindow = opts->groupCommitWindow;
+    ntfs_budget_init(&vd->budget, opts->memoryBudget);
+    vd->opStats = NULL;
 
     // Allocate the device driver descriptor
     fd = (gekko_fd*)ntfs_malloc(sizeof(gekko_fd));
@@ -478,8 +937,20 @@ bool ntfsMount (const char *name, DISC_INTERFACE *interface, sec_t startSector,
     fd->startSector = startSector;
     fd->sectorSize = 0;
     fd->sectorCount = 0;
-    fd->cachePageCount = cachePageCount;
-    fd->cachePageSize = cachePageSize;
+    fd->cachePageCount = opts->cachePageCount;
+    fd->cachePageSize = opts->cachePageSize;
+    fd->cacheMetaPageCount = opts->cacheMetaPageCount;
+    fd->cacheMetaPageSize = opts->cacheMetaPageSize;
+    fd->cacheReadAhead = opts->cacheReadAhead;
+    fd->cacheFlushAge = opts->cacheFlushAge;
+    fd->cacheFlushThreshold = opts->cacheFlushThreshold;
+    fd->cachePolicy = (flags & NTFS_CACHE_LRU) ? NTFS_CACHE_POLICY_LRU : NTFS_CACHE_POLICY_2Q;
+    fd->cacheShared = (flags & NTFS_SHARE_CACHE) ? true : false;
+    fd->asyncIO = (flags & NTFS_ASYNC_IO) ? true : false;
+    fd->discard = (flags & NTFS_DISCARD) ? opts->discard : NULL;
+    fd->traceSize = opts->ioTraceSize;
+    fd->budget = &vd->budget;
+    fd->cacheCharge = 0;
 
     // Allocate the device driver
     vd->dev = ntfs_device_alloc(name, 0, &ntfs_device_gekko_io_ops, fd);
@@ -489,6 +960,9 @@ bool ntfsMount (const char *name, DISC_INTERFACE *interface, sec_t startSector,
         return false;
     }
 
+    // Time the phases of the mount, the first ending once the device is open
+    ntfs_device_gekko_io_time_mount(vd->dev);
+
     // Build the mount flags
     if (flags & NTFS_READ_ONLY)
     	vd->flags |= NTFS_MNT_RDONLY;
@@ -503,6 +977,8 @@ bool ntfsMount (const char *name, DISC_INTERFACE *interface, sec_t startSector,
         vd->flags |= NTFS_MNT_RECOVER;
     if (flags & NTFS_IGNORE_HIBERFILE)
         vd->flags |= NTFS_MNT_IGNORE_HIBERFILE;
+    if (flags & NTFS_FAST_MOUNT)
+        vd->flags |= NTFS_MNT_FAST;
 
     if (vd->flags & NTFS_MNT_RDONLY)
         ntfs_log_debug("Mounting \"%s\" as read-only\n", name);
@@ -522,17 +998,67 @@ bool ntfsMount (const char *name, DISC_INTERFACE *interface, sec_t startSector,
         return false;
     }
 
+    // Create the ntfs-3g lookup caches, which ntfs_mount() would have set up, drawing on what the device cache left of the budget
+    vd->vol->budget = &vd->budget;
+    lru_sizes.inode = opts->inodeCacheSize;
+    lru_sizes.nidata = opts->nidataCacheSize;
+    lru_sizes.lookup = opts->lookupCacheSize;
+    lru_sizes.securid = opts->securidCacheSize;
+    lru_sizes.legacy = opts->legacyCacheSize;
+    lru_sizes.mftrec = opts->mftRecordCacheSize;
+    lru_sizes.sdh = opts->sdhCacheSize;
+    lru_sizes.reparse = opts->reparseCacheSize;
+    lru_sizes.cblock = opts->compressedBlockCacheSize;
+    ntfs_create_sized_lru_caches(vd->vol, &lru_sizes);
+    ntfs_set_case_index_budget(vd->vol, opts->caseIndexSize);
+    vd->vol->compression_level = (opts->compressionLevel <= NTFS_COMPRESS_STORE) ? opts->compressionLevel : NTFS_COMPRESS_BEST;
+
     ntfs_set_shown_files(vd->vol, flags & NTFS_SHOW_SYSTEM_FILES, flags & NTFS_SHOW_HIDDEN_FILES, TRUE);
 
     if (flags & NTFS_IGNORE_CASE)
         ntfs_set_ignore_case(vd->vol);
 
+    // Account for the case tables, unless they are the ones built into the library
+    if (!ntfs_case_table_is_shared(vd->vol->upcase))
+        ntfs_budget_add(&vd->budget, NTFS_BUDGET_CASE_TABLES, vd->vol->upcase_len * sizeof(ntfschar));
+    if (vd->vol->locase && !ntfs_case_table_is_shared(vd->vol->locase))
+        ntfs_budget_add(&vd->budget, NTFS_BUDGET_CASE_TABLES, vd->vol->upcase_len * sizeof(ntfschar));
+
+    // Discard freed clusters (if supported)
+    if (fd->discard && !NVolReadOnly(vd->vol))
+        NVolSetDiscard(vd->vol);
+
+    // Place large allocations in the best fitting free extent (if requested)
+    if (flags & NTFS_BEST_FIT)
+        NVolSetBestFit(vd->vol);
+
+    // Leave closed entries dirty in the inode cache (if requested)
+    if ((flags & NTFS_LAZY_SYNC) && !NVolReadOnly(vd->vol))
+        NVolSetLazySync(vd->vol);
+
+    // Make room in $MFT for the entries about to be created (if requested), which the mount can do without
+    if (opts->mftPreextend && !NVolReadOnly(vd->vol) &&
+        (ntfs_volume_check_deferred(vd->vol) || ntfs_mft_preextend(vd->vol, opts->mftPreextend)))
+        ntfs_log_perror("Could not make room for %u MFT records", (unsigned int) opts->mftPreextend);
+
     // Initialise the volume descriptor
     if (ntfsInitVolume(vd)) {
         ntfs_umount(vd->vol, true);
         ntfs_free(vd);
         return false;
     }
+    ntfs_device_gekko_io_end_phase(vd->dev, NTFS_MOUNT_PHASE_SETUP);
+
+    // Keep operation statistics (if requested)
+    if (flags & NTFS_OP_STATS) {
+        vd->opStats = ntfsCreateOpRecorder();
+        if (!vd->opStats) {
+            ntfsDeinitVolume(vd);
+            ntfs_umount(vd->vol, true);
+            ntfs_free(vd);
+            return false;
+        }
+    }
 
     // Add the device to the devoptab table
     if (ntfsAddDevice(name, vd)) {
@@ -611,6 +1137,12 @@ bool ntfsSetVolumeName (const char *name, const char *volumeName)
     // Lock
     ntfsLock(vd);
 
+    // Run any checks the volume must pass before it is written to
+    if (ntfsCheckDeferred(vd)) {
+        ntfsUnlock(vd);
+        return false;
+    }
+
     // Convert the new volume name to unicode
     ulabel_len = ntfsLocalToUnicode(volumeName, &ulabel) * sizeof(ntfschar);
     if (ulabel_len < 0) {
@@ -671,6 +1203,453 @@ bool ntfsSetVolumeName (const char *name, const char *volumeName)
     return true;
 }
 
+bool ntfsSetCacheParams (const char *name, u32 cachePageCount, u32 cachePageSize)
+{
+    ntfs_vd *vd = NULL;
+    gekko_fd *fd = NULL;
+
+    // Sanity check
+    if (!name || !cachePageCount || !cachePageSize) {
+        errno = EINVAL;
+        return false;
+    }
+
+    // Get the devices volume descriptor
+    vd = ntfsGetVolume(name, false);
+    if (!vd) {
+        errno = ENODEV;
+        return false;
+    }
+
+    // Lock
+    ntfsLock(vd);
+
+    // Rebuild the device cache with the new geometry
+    fd = (gekko_fd *)vd->dev->d_private;
+    if (!fd->cache) {
+        ntfsUnlock(vd);
+        errno = EINVAL;
+        return false;
+    }
+
+    cachePageCount = ntfs_device_gekko_io_budget_pages(fd, cachePageCount, cachePageSize);
+    if (!_NTFS_cache_reconfigure(fd->cache, cachePageCount, cachePageSize, fd->cacheMetaPageCount, fd->cacheMetaPageSize, fd->cacheReadAhead)) {
+        ntfsUnlock(vd);
+        return false;
+    }
+
+    fd->cachePageCount = cachePageCount;
+    fd->cachePageSize = cachePageSize;
+    ntfs_device_gekko_io_charge_cache(fd);
+
+    // Unlock
+    ntfsUnlock(vd);
+
+    return true;
+}
+
+static void ntfsReadLruStats (struct CACHE_HEADER *cache, ntfs_lru_stats *stats, bool reset)
+{
+    if (!cache)
+        return;
+
+    if (stats) {
+        stats->reads = cache->reads;
+        stats->writes = cache->writes;
+        stats->hits = cache->hits;
+    }
+
+    if (reset) {
+        cache->reads = 0;
+        cache->writes = 0;
+        cache->hits = 0;
+    }
+}
+
+static void ntfsReadCacheStats (ntfs_vd *vd, ntfs_cache_stats *stats, bool reset)
+{
+    gekko_fd *fd = (gekko_fd *)vd->dev->d_private;
+    NTFS_CACHE_STATS cache_stats;
+
+    // Read the device cache statistics
+    if (fd->cache) {
+        _NTFS_cache_getStats(fd->cache, &cache_stats, reset);
+        if (stats) {
+            stats->hits = cache_stats.hits;
+            stats->misses = cache_stats.misses;
+            stats->readAheadPages = cache_stats.readAheadPages;
+            stats->bypassReads = cache_stats.bypassReads;
+            stats->bypassWrites = cache_stats.bypassWrites;
+            stats->evictions = cache_stats.evictions;
+            stats->writebacks = cache_stats.writebacks;
+            stats->bytesRead = cache_stats.bytesRead;
+            stats->bytesWritten = cache_stats.bytesWritten;
+            stats->reads = cache_stats.reads;
+            stats->writes = cache_stats.writes;
+        }
+    }
+
+    // Read the ntfs-3g lookup cache statistics
+#if CACHE_INODE_SIZE
+    ntfsReadLruStats(vd->vol->xinode_cache, stats ? &stats->inodeCache : NULL, reset);
+#endif
+#if CACHE_NIDATA_SIZE
+    ntfsReadLruStats(vd->vol->nidata_cache, stats ? &stats->nidataCache : NULL, reset);
+#endif
+#if CACHE_LOOKUP_SIZE
+    ntfsReadLruStats(vd->vol->lookup_cache, stats ? &stats->lookupCache : NULL, reset);
+#endif
+#if CACHE_SECURID_SIZE
+    ntfsReadLruStats(vd->vol->securid_cache, stats ? &stats->securidCache : NULL, reset);
+#endif
+#if CACHE_LEGACY_SIZE
+    ntfsReadLruStats(vd->vol->legacy_cache, stats ? &stats->legacyCache : NULL, reset);
+#endif
+#if CACHE_MFTREC_SIZE
+    ntfsReadLruStats(vd->vol->mftrec_cache, stats ? &stats->mftRecordCache : NULL, reset);
+#endif
+#if CACHE_SDH_SIZE
+    ntfsReadLruStats(vd->vol->sdh_cache, stats ? &stats->sdhCache : NULL, reset);
+#endif
+#if CACHE_REPARSE_SIZE
+    ntfsReadLruStats(vd->vol->reparse_cache, stats ? &stats->reparseCache : NULL, reset);
+#endif
+#if CACHE_CBLOCK_SIZE
+    ntfsReadLruStats(vd->vol->cblock_cache, stats ? &stats->compressedBlockCache : NULL, reset);
+#endif
+}
+
+bool ntfsGetCacheStats (const char *name, ntfs_cache_stats *stats)
+{
+    ntfs_vd *vd = NULL;
+
+    // Sanity check
+    if (!name || !stats) {
+        errno = EINVAL;
+        return false;
+    }
+
+    // Get the devices volume descriptor
+    vd = ntfsGetVolume(name, false);
+    if (!vd) {
+        errno = ENODEV;
+        return false;
+    }
+
+    // Take a snapshot of the statistics
+    memset(stats, 0, sizeof(ntfs_cache_stats));
+    ntfsLock(vd);
+    ntfsReadCacheStats(vd, stats, false);
+    ntfsUnlock(vd);
+
+    return true;
+}
+
+static u64 ntfsRunlistSize (ntfs_attr *na)
+{
+    runlist_element *rl;
+    u64 count = 1;
+
+    if (!na || !NAttrNonResident(na) || !na->rl)
+        return 0;
+
+    // Runlists are allocated in steps of 4096 bytes, the terminator included
+    for (rl = na->rl; rl->length; rl++)
+        count++;
+    return (count * sizeof(runlist_element) + 0xfff) & ~0xfff;
+}
+
+bool ntfsGetMemoryUsage (const char *name, ntfs_memory_usage *usage)
+{
+    ntfs_vd *vd = NULL;
+    ntfs_file_state *file;
+    ntfs_dir_state *dir;
+    ntfs_dir_entry *entry;
+    int i;
+
+    // Sanity check
+    if (!name || !usage) {
+        errno = EINVAL;
+        return false;
+    }
+
+    // Get the devices volume descriptor
+    vd = ntfsGetVolume(name, false);
+    if (!vd) {
+        errno = ENODEV;
+        return false;
+    }
+
+    memset(usage, 0, sizeof(ntfs_memory_usage));
+    ntfsLock(vd);
+
+    // Read what the caches have charged to the budget
+    usage->budget = vd->budget.limit;
+    for (i = 0; i < NTFS_BUDGET_COMPONENTS; i++) {
+        usage->used[i] = vd->budget.used[i];
+        usage->reclaimed[i] = vd->budget.reclaimed[i];
+    }
+    usage->denied = vd->budget.denied;
+
+    // Count the runlists kept mapped, which are needed while the files are open
+    usage->used[NTFS_MEMORY_RUNLISTS] = ntfsRunlistSize(vd->vol->mft_na) + ntfsRunlistSize(vd->vol->mftbmp_na) + ntfsRunlistSize(vd->vol->lcnbmp_na);
+    for (file = vd->firstOpenFile; file; file = file->nextOpenFile)
+        usage->used[NTFS_MEMORY_RUNLISTS] += ntfsRunlistSize(file->data_na);
+
+    // Count the entries read ahead for open directories, and those kept for reuse
+    for (dir = vd->firstOpenDir; dir; dir = dir->nextOpenDir) {
+        for (entry = dir->first; entry; entry = entry->next)
+            usage->used[NTFS_MEMORY_DIR_ENTRIES] += sizeof(ntfs_dir_entry) + (entry->name ? strlen(entry->name) + 1 : 0);
+        for (entry = dir->spare; entry; entry = entry->next)
+            usage->used[NTFS_MEMORY_DIR_ENTRIES] += sizeof(ntfs_dir_entry);
+    }
+
+    ntfsUnlock(vd);
+
+    for (i = 0; i < NTFS_MEMORY_COMPONENTS; i++)
+        usage->total += usage->used[i];
+
+    return true;
+}
+
+bool ntfsResetCacheStats (const char *name)
+{
+    ntfs_vd *vd = NULL;
+
+    // Sanity check
+    if (!name) {
+        errno = EINVAL;
+        return false;
+    }
+
+    // Get the devices volume descriptor
+    vd = ntfsGetVolume(name, false);
+    if (!vd) {
+        errno = ENODEV;
+        return false;
+    }
+
+    // Reset the statistics
+    ntfsLock(vd);
+    ntfsReadCacheStats(vd, NULL, true);
+    ntfsUnlock(vd);
+
+    return true;
+}
+
+bool ntfsGetOpStats (const char *name, ntfs_volume_op_stats *stats)
+{
+    ntfs_vd *vd = NULL;
+
+    // Sanity check
+    if (!name || !stats) {
+        errno = EINVAL;
+        return false;
+    }
+
+    // Get the devices volume descriptor
+    vd = ntfsGetVolume(name, false);
+    if (!vd) {
+        errno = ENODEV;
+        return false;
+    }
+    if (!vd->opStats) {
+        errno = EOPNOTSUPP;
+        return false;
+    }
+
+    // Copy out the statistics, which are kept apart from the volume lock so as not to wait on it
+    ntfsGetOpRecorderStats(vd->opStats, stats);
+
+    return true;
+}
+
+bool ntfsResetOpStats (const char *name)
+{
+    ntfs_vd *vd = NULL;
+
+    // Sanity check
+    if (!name) {
+        errno = EINVAL;
+        return false;
+    }
+
+    // Get the devices volume descriptor
+    vd = ntfsGetVolume(name, false);
+    if (!vd) {
+        errno = ENODEV;
+        return false;
+    }
+    if (!vd->opStats) {
+        errno = EOPNOTSUPP;
+        return false;
+    }
+
+    // Reset the statistics
+    ntfsResetOpRecorder(vd->opStats);
+
+    return true;
+}
+
+int ntfsGetIOTrace (const char *name, ntfs_io_trace_entry *entries, int count)
+{
+    ntfs_vd *vd = NULL;
+
+    // Sanity check
+    if (!name || !entries || count < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    // Get the devices volume descriptor
+    vd = ntfsGetVolume(name, false);
+    if (!vd) {
+        errno = ENODEV;
+        return -1;
+    }
+
+    // Copy out the most recent accesses
+    ntfsLock(vd);
+    count = ntfs_device_gekko_io_get_trace(vd->dev, entries, count);
+    ntfsUnlock(vd);
+
+    return count;
+}
+
+bool ntfsRecountFreeSpace (const char *name)
+{
+    ntfs_vd *vd = NULL;
+    bool res;
+
+    // Sanity check
+    if (!name) {
+        errno = EINVAL;
+        return false;
+    }
+
+    // Get the devices volume descriptor
+    vd = ntfsGetVolume(name, false);
+    if (!vd) {
+        errno = ENODEV;
+        return false;
+    }
+
+    // Lock
+    ntfsLock(vd);
+
+    // Read the bitmaps again
+    res = !ntfs_volume_get_free_space(vd->vol);
+
+    // Unlock
+    ntfsUnlock(vd);
+
+    return res;
+}
+
+bool ntfsExtendMft (const char *name, u32 records)
+{
+    ntfs_vd *vd = NULL;
+    bool res;
+
+    // Sanity check
+    if (!name) {
+        errno = EINVAL;
+        return false;
+    }
+
+    // Get the devices volume descriptor
+    vd = ntfsGetVolume(name, false);
+    if (!vd) {
+        errno = ENODEV;
+        return false;
+    }
+
+    // Lock
+    ntfsLock(vd);
+
+    // Extend $MFT and its bitmap, once the volume has passed any checks it must before it is written to
+    res = !ntfsCheckDeferred(vd) && !ntfs_mft_preextend(vd->vol, records);
+
+    // Unlock
+    ntfsUnlock(vd);
+
+    return res;
+}
+
+bool ntfsGetMountStats (const char *name, ntfs_mount_stats *stats)
+{
+    ntfs_vd *vd = NULL;
+
+    // Sanity check
+    if (!name || !stats) {
+        errno = EINVAL;
+        return false;
+    }
+
+    // Get the devices volume descriptor
+    vd = ntfsGetVolume(name, false);
+    if (!vd) {
+        errno = ENODEV;
+        return false;
+    }
+
+    // Copy out the timings, which no longer change once mounted
+    ntfs_device_gekko_io_get_mount_stats(vd->dev, stats);
+
+    return true;
+}
+
+bool ntfsResetIOTrace (const char *name)
+{
+    ntfs_vd *vd = NULL;
+
+    // Sanity check
+    if (!name) {
+        errno = EINVAL;
+        return false;
+    }
+
+    // Get the devices volume descriptor
+    vd = ntfsGetVolume(name, false);
+    if (!vd) {
+        errno = ENODEV;
+        return false;
+    }
+
+    // Forget the recorded accesses
+    ntfsLock(vd);
+    ntfs_device_gekko_io_reset_trace(vd->dev);
+    ntfsUnlock(vd);
+
+    return true;
+}
+
+bool ntfsSyncVolume (const char *name)
+{
+    ntfs_vd *vd = NULL;
+    int res;
+
+    // Sanity check
+    if (!name) {
+        errno = EINVAL;
+        return false;
+    }
+
+    // Get the devices volume descriptor
+    vd = ntfsGetVolume(name, false);
+    if (!vd) {
+        errno = ENODEV;
+        return false;
+    }
+
+    // Write back the deferred entries and flush the device
+    ntfsLock(vd);
+    res = ntfsSyncAll(vd);
+    ntfsUnlock(vd);
+
+    return (res == 0);
+}
+
 const devoptab_t *ntfsGetDevOpTab (void)
 {
     return &devops_ntfs;
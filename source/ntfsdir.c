@@ -41,6 +41,7 @@
 #include <string.h>
 #endif
 
+#include "ntfs.h"
 #include "ntfsinternal.h"
 #include "ntfsdir.h"
 #include "device.h"
@@ -48,6 +49,28 @@
 
 #define STATE(x)    ((ntfs_dir_state*)(x)->dirStruct)
 
+/**
+ * PRIVATE: Release the entries read before the given one, keeping them for reuse
+ */
+static void ntfsReleaseDirEntries (ntfs_dir_state *dir, ntfs_dir_entry *until)
+{
+    while (dir->first && dir->first != until) {
+        ntfs_dir_entry *next = dir->first->next;
+        ntfs_free(dir->first->name);
+        dir->first->next = dir->spare;
+        dir->spare = dir->first;
+        dir->first = next;
+    }
+
+    // Nothing read is left
+    if (!dir->first) {
+        dir->current = NULL;
+        dir->last = NULL;
+    }
+
+    return;
+}
+
 void ntfsCloseDir (ntfs_dir_state *dir)
 {
     // Sanity check
@@ -55,11 +78,11 @@ void ntfsCloseDir (ntfs_dir_state *dir)
         return;
 
     // Free the directory entries (if any)
-    while (dir->first) {
-        ntfs_dir_entry *next = dir->first->next;
-        ntfs_free(dir->first->name);
-        ntfs_free(dir->first);
-        dir->first = next;
+    ntfsReleaseDirEntries(dir, NULL);
+    while (dir->spare) {
+        ntfs_dir_entry *next = dir->spare->next;
+        ntfs_free(dir->spare);
+        dir->spare = next;
     }
 
     // Close the directory (if open)
@@ -68,8 +91,7 @@ void ntfsCloseDir (ntfs_dir_state *dir)
 
     // Reset the directory state
     dir->ni = NULL;
-    dir->first = NULL;
-    dir->current = NULL;
+    dir->position = -1;
 
     return;
 }
@@ -396,7 +418,8 @@ int ntfs_statvfs_r (struct _reent *r, const char *path, struct statvfs *buf)
     // Zero out the stat buffer
     memset(buf, 0, sizeof(struct statvfs));
 
-    if (ntfs_volume_get_free_space(vd->vol)) {
+    // Count the free space on the first call, it is kept up to date afterwards
+    if (!NVolFreeSpaceKnown(vd->vol) && ntfs_volume_get_free_space(vd->vol)) {
         ntfsUnlock(vd);
         r->_errno = EIO;
         return -1;
@@ -447,10 +470,9 @@ int ntfs_statvfs_r (struct _reent *r, const char *path, struct statvfs *buf)
 /**
  * PRIVATE: Callback for directory walking
  */
-int ntfs_readdir_filler (DIR_ITER *dirState, const ntfschar *name, const int name_len, const int name_type,
-                         const s64 pos, const MFT_REF mref, const unsigned dt_type)
+int ntfs_readdir_filler (ntfs_dir_state *dir, const ntfschar *name, const int name_len, const int name_type,
+                         const s64 pos, const MFT_REF mref, const unsigned dt_type, const FILE_NAME_ATTR *fn)
 {
-    ntfs_dir_state *dir = STATE(dirState);
     ntfs_dir_entry *entry = NULL;
     char *entry_name = NULL;
 
@@ -465,42 +487,160 @@ int ntfs_readdir_filler (DIR_ITER *dirState, const ntfschar *name, const int nam
         return 0;
     }
 
+    // Stop at this entry once the batch is full, the next read starts again from it
+    if (!dir->batch) {
+        return 1;
+    }
+
     // Convert the entry name to our current local
     if (ntfsUnicodeToLocal(name, name_len, &entry_name, 0) < 0) {
         return -1;
     }
 
-    // Allocate a new directory entry
-    entry = (ntfs_dir_entry *) ntfs_malloc(sizeof(ntfs_dir_entry));
-    if (!entry) {
-        ntfs_free(entry_name);
-        return -1;
+    // Reuse a released directory entry, or allocate a new one
+    if (dir->spare) {
+        entry = dir->spare;
+        dir->spare = entry->next;
+    } else {
+        entry = (ntfs_dir_entry *) ntfs_malloc(sizeof(ntfs_dir_entry));
+        if (!entry) {
+            ntfs_free(entry_name);
+            return -1;
+        }
     }
 
     // Setup the entry
     entry->name = entry_name;
     entry->mref = mref;
     entry->type = dt_type;
+    if (fn) {
+        entry->data_size = sle64_to_cpu(fn->data_size);
+        entry->allocated_size = sle64_to_cpu(fn->allocated_size);
+        entry->last_access_time = fn->last_access_time;
+        entry->last_data_change_time = fn->last_data_change_time;
+        entry->last_mft_change_time = fn->last_mft_change_time;
+    } else {
+        entry->data_size = entry->allocated_size = 0;
+        entry->last_access_time = dir->ni->last_access_time;
+        entry->last_data_change_time = dir->ni->last_data_change_time;
+        entry->last_mft_change_time = dir->ni->last_mft_change_time;
+    }
     entry->next = NULL;
 
-    // Link the entry to the directory
-    if (!dir->first) {
+    // Link the entry to the end of the directory
+    if (dir->last)
+        dir->last->next = entry;
+    else
         dir->first = entry;
-    } else {
-        ntfs_dir_entry *last = dir->first;
-        while (last->next) last = last->next;
-        last->next = entry;
+    dir->last = entry;
+    if (!dir->current)
+        dir->current = entry;
+
+    if (dir->batch > 0)
+        dir->batch--;
+
+    return 0;
+}
+
+/**
+ * PRIVATE: Fill in the status of a directory entry from what the directory index records of it
+ */
+void ntfsDirEntryStat (ntfs_vd *vd, const ntfs_dir_entry *entry, struct stat *st)
+{
+    memset(st, 0, sizeof(struct stat));
+    st->st_dev = vd->id;
+    st->st_uid = vd->uid;
+    st->st_gid = vd->gid;
+    st->st_ino = MREF(entry->mref);
+    st->st_nlink = 1;
+    st->st_size = entry->data_size;
+    st->st_blocks = (entry->allocated_size + S_BLKSIZE - 1) / S_BLKSIZE;
+    st->st_atim = ntfs2timespec(entry->last_access_time);
+    st->st_ctim = ntfs2timespec(entry->last_mft_change_time);
+    st->st_mtim = ntfs2timespec(entry->last_data_change_time);
+    switch (entry->type) {
+        case NTFS_DT_DIR:
+            st->st_mode = S_IFDIR | (0777 & ~vd->dmask);
+            break;
+        case NTFS_DT_LNK:
+            st->st_mode = S_IFLNK | 0777;
+            break;
+        case NTFS_DT_FIFO:
+            st->st_mode = S_IFIFO;
+            break;
+        case NTFS_DT_SOCK:
+            st->st_mode = S_IFSOCK;
+            break;
+        case NTFS_DT_BLK:
+            st->st_mode = S_IFBLK;
+            break;
+        case NTFS_DT_CHR:
+            st->st_mode = S_IFCHR;
+            break;
+        case NTFS_DT_REPARSE:
+            st->st_mode = S_IFLNK | 0777;
+            break;
+        default:
+            st->st_mode = S_IFREG | (0777 & ~vd->fmask);
+            break;
+    }
+}
+
+/**
+ * PRIVATE: Read up to count more entries of a directory (-1 for all of them)
+ */
+static int ntfsReadDirEntries (ntfs_dir_state *dir, int count)
+{
+    int res;
+
+    // Check that there is anything left to read
+    if (dir->position < 0)
+        return 0;
+
+    // Write back the entries left dirty by lazy sync, so that the index holds their sizes and times
+    if (dir->vd->lazySyncStart) {
+        ntfs_inode_sync_cached(dir->vd->vol);
+        dir->vd->lazySyncStart = 0;
     }
 
+    // Read from where the last batch stopped
+    dir->batch = count;
+    res = ntfs_readdir_fn(dir->ni, &dir->position, dir, (ntfs_filldir_fn_t)ntfs_readdir_filler);
+
+    // A full batch ends the walk early, anything else stopping it is an error
+    if (res && dir->batch)
+        return -1;
+
+    // Note that the end of the index has been reached
+    if (!res)
+        dir->position = -1;
+
     return 0;
 }
 
+void ntfsSnapshotOpenDirs (ntfs_vd *vd, ntfs_inode *dir_ni)
+{
+    ntfs_dir_state *dir;
+
+    // Sanity check
+    if (!vd || !dir_ni)
+        return;
+
+    // Entries move within the index as it changes, so an iteration can no longer resume from a
+    // position once the directory is modified; read the rest of each one into memory beforehand
+    for (dir = vd->firstOpenDir; dir; dir = dir->nextOpenDir) {
+        if (dir->ni && dir->ni->mft_no == dir_ni->mft_no)
+            ntfsReadDirEntries(dir, -1);
+    }
+
+    return;
+}
+
 DIR_ITER *ntfs_diropen_r (struct _reent *r, DIR_ITER *dirState, const char *path)
 {
     ntfs_log_trace("dirState %p, path %s\n", dirState, path);
 
     ntfs_dir_state* dir = STATE(dirState);
-    s64 position = 0;
 
     // Get the volume descriptor for this path
     dir->vd = ntfsGetVolume(path, true);
@@ -528,18 +668,17 @@ DIR_ITER *ntfs_diropen_r (struct _reent *r, DIR_ITER *dirState, const char *path
         return NULL;
     }
 
-    // Read the directory
-    dir->first = dir->current = NULL;
-    if (ntfs_readdir(dir->ni, &position, dirState, (ntfs_filldir_t)ntfs_readdir_filler)) {
+    // Read the first batch of entries in the directory
+    dir->first = dir->current = dir->last = NULL;
+    dir->spare = NULL;
+    dir->position = 0;
+    if (ntfsReadDirEntries(dir, NTFS_DIR_BATCH)) {
         ntfsCloseDir(dir);
         ntfsUnlock(dir->vd);
         r->_errno = errno;
         return NULL;
     }
 
-    // Move to the first entry in the directory
-    dir->current = dir->first;
-
     // Update directory times
     ntfsUpdateTimes(dir->vd, dir->ni, NTFS_UPDATE_ATIME);
 
@@ -575,8 +714,9 @@ int ntfs_dirreset_r (struct _reent *r, DIR_ITER *dirState)
     // Lock
     ntfsLock(dir->vd);
 
-    // Move to the first entry in the directory
-    dir->current = dir->first;
+    // Move back to the first entry in the directory, it is read again on the next call
+    ntfsReleaseDirEntries(dir, NULL);
+    dir->position = 0;
 
     // Update directory times
     ntfsUpdateTimes(dir->vd, dir->ni, NTFS_UPDATE_ATIME);
@@ -602,6 +742,13 @@ int ntfs_dirnext_r (struct _reent *r, DIR_ITER *dirState, char *filename, struct
     // Lock
     ntfsLock(dir->vd);
 
+    // Read the next batch of entries once the current one runs out
+    if (!dir->current && ntfsReadDirEntries(dir, NTFS_DIR_BATCH)) {
+        ntfsUnlock(dir->vd);
+        r->_errno = errno;
+        return -1;
+    }
+
     // Check that there is a entry waiting to be fetched
     if (!dir->current) {
         ntfsUnlock(dir->vd);
@@ -611,39 +758,12 @@ int ntfs_dirnext_r (struct _reent *r, DIR_ITER *dirState, char *filename, struct
 
     // Fetch the current entry
     strncpy(filename, dir->current->name, NAME_MAX + 1);
-    if(filestat != NULL) {
-        memset(filestat, 0, sizeof(struct stat));
-        filestat->st_ino = MREF(dir->current->mref);
-        switch (dir->current->type) {
-            case NTFS_DT_DIR:
-                filestat->st_mode = S_IFDIR | (0777 & ~dir->vd->dmask);
-                break;
-            case NTFS_DT_LNK:
-                filestat->st_mode = S_IFLNK | 0777;
-                break;
-            case NTFS_DT_FIFO:
-                filestat->st_mode = S_IFIFO;
-                break;
-            case NTFS_DT_SOCK:
-                filestat->st_mode = S_IFSOCK;
-                break;
-            case NTFS_DT_BLK:
-                filestat->st_mode = S_IFBLK;
-                break;
-            case NTFS_DT_CHR:
-                filestat->st_mode = S_IFCHR;
-                break;
-            case NTFS_DT_REPARSE:
-                filestat->st_mode = S_IFLNK | 0777;
-                break;
-            default:
-                filestat->st_mode = S_IFREG | (0777 & ~dir->vd->fmask);
-                break;
-        }
-    }
+    if(filestat != NULL)
+        ntfsDirEntryStat(dir->vd, dir->current, filestat);
 
-    // Move to the next entry in the directory
+    // Move to the next entry in the directory, releasing this one
     dir->current = dir->current->next;
+    ntfsReleaseDirEntries(dir, dir->current);
 
     // Update directory times
     ntfsUpdateTimes(dir->vd, dir->ni, NTFS_UPDATE_ATIME);
@@ -686,3 +806,582 @@ int ntfs_dirclose_r (struct _reent *r, DIR_ITER *dirState)
 
     return 0;
 }
+
+/**
+ * PRIVATE: An entry of ntfsCreateEntries, with its name as it is collated in the directory index
+ */
+typedef struct _ntfs_create_item {
+    ntfs_create_entry *entry;
+    ntfschar *uname;
+    ntfschar *key;
+    int uname_len;
+    u64 mref;
+} ntfs_create_item;
+
+/**
+ * PRIVATE: Order entries as the directory index does, by their upcased names
+ */
+static int ntfsCompareCreateItems (const void *a, const void *b)
+{
+    const ntfs_create_item *ia = (const ntfs_create_item*)a;
+    const ntfs_create_item *ib = (const ntfs_create_item*)b;
+    int len = (ia->uname_len < ib->uname_len) ? ia->uname_len : ib->uname_len;
+    int i;
+
+    for (i = 0; i < len; i++) {
+        if (ia->key[i] != ib->key[i])
+            return (le16_to_cpu(ia->key[i]) < le16_to_cpu(ib->key[i])) ? -1 : 1;
+    }
+
+    return ia->uname_len - ib->uname_len;
+}
+
+int ntfsCreateEntries (const char *path, ntfs_create_entry *entries, int count)
+{
+    ntfs_vd *vd = NULL;
+    ntfs_inode *dir_ni = NULL, *ni = NULL;
+    ntfs_create_item *items = NULL;
+    le32 securid;
+    int created = 0;
+    int i, items_count = 0;
+
+    // Sanity check
+    if (!path || (count && !entries) || count < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    // Get the volume descriptor for this path
+    vd = ntfsGetVolume(path, true);
+    if (!vd) {
+        errno = ENODEV;
+        return -1;
+    }
+
+    // You cannot create entries on a read-only mount
+    if (NVolReadOnly(vd->vol)) {
+        errno = EROFS;
+        return -1;
+    }
+
+    // Lock
+    ntfsLock(vd);
+
+    // Run any checks the volume must pass before it is written to
+    if (ntfsCheckDeferred(vd)) {
+        created = -1;
+        goto cleanup;
+    }
+
+    // Open the directory
+    dir_ni = ntfsOpenEntry(vd, path);
+    if (!dir_ni) {
+        created = -1;
+        goto cleanup;
+    }
+    if (!(dir_ni->mrec->flags & MFT_RECORD_IS_DIRECTORY)) {
+        errno = ENOTDIR;
+        created = -1;
+        goto cleanup;
+    }
+
+    // Convert the names to unicode, keeping an upcased copy to sort them by
+    items = ntfs_calloc(count * sizeof(ntfs_create_item));
+    if (count && !items) {
+        created = -1;
+        goto cleanup;
+    }
+    for (i = 0; i < count; i++) {
+        ntfs_create_item *item = &items[items_count];
+        entries[i].error = 0;
+        if (!entries[i].name || !entries[i].name[0] || strchr(entries[i].name, PATH_SEP) ||
+            (entries[i].type != S_IFREG && entries[i].type != S_IFDIR)) {
+            entries[i].error = EINVAL;
+            continue;
+        }
+        item->uname_len = ntfsLocalToUnicode(entries[i].name, &item->uname);
+        if (item->uname_len <= 0) {
+            entries[i].error = EINVAL;
+            continue;
+        }
+        if (item->uname_len > NTFS_MAX_NAME_LEN) {
+            entries[i].error = ENAMETOOLONG;
+            ntfs_free(item->uname);
+            continue;
+        }
+        item->key = ntfs_malloc(item->uname_len * sizeof(ntfschar));
+        if (!item->key) {
+            entries[i].error = ENOMEM;
+            ntfs_free(item->uname);
+            continue;
+        }
+        memcpy(item->key, item->uname, item->uname_len * sizeof(ntfschar));
+        ntfs_name_upcase(item->key, item->uname_len, vd->vol->upcase, vd->vol->upcase_len);
+        item->entry = &entries[i];
+        items_count++;
+    }
+
+    // Insert the names in index order, so that each insertion lands next to the previous one
+    qsort(items, items_count, sizeof(ntfs_create_item), ntfsCompareCreateItems);
+
+    // Read the rest of any open iteration of the directory before it changes
+    ntfsSnapshotOpenDirs(vd, dir_ni);
+
+    // Create the entries
+    securid = ntfsCreateSecurityId(vd);
+    for (i = 0; i < items_count; i++) {
+        ni = ntfs_create(dir_ni, securid, items[i].uname, items[i].uname_len, items[i].entry->type);
+        if (!ni) {
+            items[i].entry->error = errno;
+            continue;
+        }
+
+        // Mark the entry for archiving
+        ni->flags |= FILE_ATTR_ARCHIVE;
+        NInoSetDirty(ni);
+        items[i].mref = MK_MREF(ni->mft_no, le16_to_cpu(ni->mrec->sequence_number));
+
+        // Close the entry, its record is written with the rest of the batch when the device is synced
+        if (NVolLazySync(vd->vol))
+            ntfsSyncDeferred(vd, ni);
+        if (ntfs_inode_close(ni))
+            items[i].entry->error = errno;
+        else
+            created++;
+    }
+
+    // Update the directories times and close it, without syncing the device yet
+    if (created)
+        ntfsUpdateTimes(vd, dir_ni, NTFS_UPDATE_MCTIME);
+    if (NInoDirty(dir_ni) && NVolLazySync(vd->vol))
+        ntfsSyncDeferred(vd, dir_ni);
+    ntfs_inode_close(dir_ni);
+    dir_ni = NULL;
+
+    // Set the attributes asked for, which also updates the index entries in the (now closed) directory
+    for (i = 0; i < items_count; i++) {
+        u32 attributes = items[i].entry->attributes & (NTFS_ENTRY_READONLY | NTFS_ENTRY_HIDDEN | NTFS_ENTRY_SYSTEM);
+        if (!attributes || !items[i].mref || items[i].entry->error)
+            continue;
+        ni = ntfs_inode_open(vd->vol, items[i].mref);
+        if (!ni) {
+            items[i].entry->error = errno;
+            continue;
+        }
+        ni->flags |= attributes;
+        NInoFileNameSetDirty(ni);
+        NInoSetDirty(ni);
+        if (NVolLazySync(vd->vol))
+            ntfsSyncDeferred(vd, ni);
+        if (ntfs_inode_close(ni))
+            items[i].entry->error = errno;
+    }
+
+    // Sync the device once for the whole batch
+    if (!NVolLazySync(vd->vol))
+        ntfs_device_sync(vd->dev);
+
+cleanup:
+
+    // Close the directory, keeping the reason it could not be used
+    if (dir_ni) {
+        int err = errno;
+        ntfsCloseEntry(vd, dir_ni);
+        errno = err;
+    }
+
+    for (i = 0; i < items_count; i++) {
+        ntfs_free(items[i].uname);
+        ntfs_free(items[i].key);
+    }
+    if (items)
+        ntfs_free(items);
+
+    // Unlock
+    ntfsUnlock(vd);
+
+    return created;
+}
+
+/**
+ * PRIVATE: A listing by ntfsListDir in progress
+ */
+typedef struct _ntfs_list_state {
+    ntfs_vd *vd;
+    ntfschar *after;                        /* Name the listing starts after, or NULL */
+    int after_len;
+    ntfschar *pattern;                      /* Pattern the names are matched against (upcased unless case sensitive), or NULL */
+    int pattern_len;
+    ntfschar *prefix;                       /* Upcased literal start of the pattern, which all names listed begin with */
+    int prefix_len;
+    ntfs_list_callback callback;
+    void *arg;
+    int listed;                             /* Entries given to the callback so far */
+    bool stopped;                           /* The walk was ended on purpose rather than by an error */
+} ntfs_list_state;
+
+/**
+ * PRIVATE: Upcase a single character as the directory index collates it
+ */
+static inline ntfschar ntfsUpcaseChar (ntfs_volume *vol, ntfschar c)
+{
+    u16 u = le16_to_cpu(c);
+    return (u < vol->upcase_len) ? vol->upcase[u] : c;
+}
+
+/**
+ * PRIVATE: Match a name against a pattern of '*' and '?' wildcards
+ */
+static bool ntfsMatchName (ntfs_volume *vol, const ntfschar *pattern, int pattern_len, const ntfschar *name, int name_len)
+{
+    bool ignore_case = !NVolCaseSensitive(vol);
+    int p = 0, n = 0, star = -1, mark = 0;
+
+    while (n < name_len) {
+        if (p < pattern_len && pattern[p] == const_cpu_to_le16('*')) {
+            star = p++;
+            mark = n;
+        } else if (p < pattern_len && (pattern[p] == const_cpu_to_le16('?') ||
+                   pattern[p] == (ignore_case ? ntfsUpcaseChar(vol, name[n]) : name[n]))) {
+            p++;
+            n++;
+        } else if (star >= 0) {
+            // Let the last '*' swallow one more character and try again from there
+            p = star + 1;
+            n = ++mark;
+        } else {
+            return false;
+        }
+    }
+
+    while (p < pattern_len && pattern[p] == const_cpu_to_le16('*'))
+        p++;
+
+    return (p == pattern_len);
+}
+
+/**
+ * PRIVATE: Callback for directory listing
+ */
+static int ntfs_list_filler (ntfs_list_state *list, const ntfschar *name, const int name_len, const int name_type,
+                             const s64 pos, const MFT_REF mref, const unsigned dt_type, const FILE_NAME_ATTR *fn)
+{
+    ntfs_volume *vol = list->vd->vol;
+    ntfs_dir_entry entry;
+    struct stat st;
+    char name_buf[NTFS_MAX_NAME_BYTES];
+    char *entry_name = name_buf;
+    int i, res;
+
+    // Ignore DOS file names
+    if (name_type == FILE_NAME_DOS || !fn) {
+        return 0;
+    }
+
+    // Skip the name the listing starts after
+    if (list->after && ntfs_names_full_collate(fn->file_name, fn->file_name_length, list->after, list->after_len,
+                                               CASE_SENSITIVE, vol->upcase, vol->upcase_len) <= 0) {
+        return 0;
+    }
+
+    // The names beginning with the literal start of the pattern are all together in the index, stop once past them
+    if (list->prefix_len > fn->file_name_length) {
+        list->stopped = true;
+        return 1;
+    }
+    for (i = 0; i < list->prefix_len; i++) {
+        if (ntfsUpcaseChar(vol, fn->file_name[i]) != list->prefix[i]) {
+            list->stopped = true;
+            return 1;
+        }
+    }
+
+    // Check the whole name against the pattern
+    if (list->pattern && !ntfsMatchName(vol, list->pattern, list->pattern_len, fn->file_name, fn->file_name_length)) {
+        return 0;
+    }
+
+    // Convert the entry name to our current local
+    if (ntfsUnicodeToLocal(name, name_len, &entry_name, sizeof(name_buf)) < 0) {
+        return -1;
+    }
+
+    // Hand the entry over, with the status the index records for it
+    entry.mref = mref;
+    entry.type = dt_type;
+    entry.data_size = sle64_to_cpu(fn->data_size);
+    entry.allocated_size = sle64_to_cpu(fn->allocated_size);
+    entry.last_access_time = fn->last_access_time;
+    entry.last_data_change_time = fn->last_data_change_time;
+    entry.last_mft_change_time = fn->last_mft_change_time;
+    ntfsDirEntryStat(list->vd, &entry, &st);
+    res = list->callback(entry_name, &st, list->arg);
+    list->listed++;
+
+    if (res) {
+        list->stopped = true;
+        return 1;
+    }
+
+    return 0;
+}
+
+int ntfsListDir (const char *path, const char *after, const char *pattern, ntfs_list_callback callback, void *arg)
+{
+    ntfs_list_state list = { 0 };
+    ntfs_inode *dir_ni = NULL;
+    ntfschar *key = NULL;
+    int key_len = 0;
+    int i, res = -1;
+
+    // Sanity check
+    if (!path || !callback) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    // Get the volume descriptor for this path
+    list.vd = ntfsGetVolume(path, true);
+    if (!list.vd) {
+        errno = ENODEV;
+        return -1;
+    }
+    list.callback = callback;
+    list.arg = arg;
+
+    // Convert the name to start after and the pattern to unicode
+    if (after && after[0]) {
+        list.after_len = ntfsLocalToUnicode(after, &list.after);
+        if (list.after_len <= 0 || list.after_len > NTFS_MAX_NAME_LEN) {
+            errno = (list.after_len > 0) ? ENAMETOOLONG : EINVAL;
+            goto cleanup;
+        }
+    }
+    if (pattern && pattern[0]) {
+        list.pattern_len = ntfsLocalToUnicode(pattern, &list.pattern);
+        if (list.pattern_len <= 0) {
+            errno = EINVAL;
+            goto cleanup;
+        }
+        if (!NVolCaseSensitive(list.vd->vol))
+            ntfs_name_upcase(list.pattern, list.pattern_len, list.vd->vol->upcase, list.vd->vol->upcase_len);
+
+        // Take the characters before the first wildcard as the prefix every name listed has
+        while (list.prefix_len < list.pattern_len && list.prefix_len < NTFS_MAX_NAME_LEN &&
+               list.pattern[list.prefix_len] != const_cpu_to_le16('*') &&
+               list.pattern[list.prefix_len] != const_cpu_to_le16('?'))
+            list.prefix_len++;
+        if (list.prefix_len) {
+            list.prefix = ntfs_malloc(list.prefix_len * sizeof(ntfschar));
+            if (!list.prefix)
+                goto cleanup;
+            memcpy(list.prefix, list.pattern, list.prefix_len * sizeof(ntfschar));
+            ntfs_name_upcase(list.prefix, list.prefix_len, list.vd->vol->upcase, list.vd->vol->upcase_len);
+        }
+    }
+
+    // Start from the prefix, or from the name to start after once that is beyond it
+    key = list.after;
+    key_len = list.after_len;
+    if (list.prefix && (!key || ntfs_names_full_collate(list.prefix, list.prefix_len, key, key_len, CASE_SENSITIVE,
+                                                        list.vd->vol->upcase, list.vd->vol->upcase_len) > 0)) {
+        key = ntfs_malloc(list.prefix_len * sizeof(ntfschar));
+        if (!key)
+            goto cleanup;
+        key_len = list.prefix_len;
+
+        // Equal upcased names are ordered by their code units, so look up the lowest case of each character
+        for (i = 0; i < key_len; i++) {
+            key[i] = list.prefix[i];
+            if (list.vd->vol->locase) {
+                u16 u = le16_to_cpu(key[i]);
+                if (le16_to_cpu(list.vd->vol->locase[u]) < u)
+                    key[i] = list.vd->vol->locase[u];
+            }
+        }
+    }
+
+    // Lock
+    ntfsLock(list.vd);
+
+    // Open the directory
+    dir_ni = ntfsOpenEntry(list.vd, path);
+    if (!dir_ni)
+        goto unlock;
+    if (!(dir_ni->mrec->flags & MFT_RECORD_IS_DIRECTORY)) {
+        errno = ENOTDIR;
+        goto unlock;
+    }
+
+    // Write back the entries left dirty by lazy sync, so that the index holds their sizes and times
+    if (list.vd->lazySyncStart) {
+        ntfs_inode_sync_cached(list.vd->vol);
+        list.vd->lazySyncStart = 0;
+    }
+
+    // Walk the index from the start key on
+    if (ntfs_readdir_from(dir_ni, key, key_len, &list, (ntfs_filldir_fn_t)ntfs_list_filler) && !list.stopped)
+        goto unlock;
+    res = list.listed;
+
+    // Update directory times
+    ntfsUpdateTimes(list.vd, dir_ni, NTFS_UPDATE_ATIME);
+
+unlock:
+
+    // Close the directory, keeping the reason it could not be listed
+    if (dir_ni) {
+        int err = errno;
+        ntfsCloseEntry(list.vd, dir_ni);
+        errno = err;
+    }
+
+    // Unlock
+    ntfsUnlock(list.vd);
+
+cleanup:
+    if (key && key != list.after)
+        ntfs_free(key);
+    if (list.after)
+        ntfs_free(list.after);
+    if (list.pattern)
+        ntfs_free(list.pattern);
+    if (list.prefix)
+        ntfs_free(list.prefix);
+
+    return res;
+}
+
+static int ntfsAddStream (ntfs_stream_entry *streams, int max, int count, char *names, size_t size, size_t *used,
+                          const char *name, int name_len, u64 len, u32 type)
+{
+    // Entries past the end of the array are only counted
+    if (count < max) {
+        if (*used + name_len + 1 > size) {
+            errno = ERANGE;
+            return -1;
+        }
+        memcpy(names + *used, name, name_len);
+        names[*used + name_len] = '\0';
+        streams[count].name = names + *used;
+        streams[count].size = len;
+        streams[count].type = type;
+        *used += name_len + 1;
+    }
+
+    return count + 1;
+}
+
+static int ntfsAddEaStreams (ntfs_stream_entry *streams, int max, int count, char *names, size_t size, size_t *used,
+                             const u8 *value, s64 value_len)
+{
+    const EA_ATTR *ea;
+    s64 offs = 0;
+    u32 next;
+
+    // Each extended attribute is packed after the previous one
+    while (count >= 0 && offs + (s64)sizeof(EA_ATTR) <= value_len) {
+        ea = (const EA_ATTR*)(value + offs);
+        if (offs + (s64)sizeof(EA_ATTR) + ea->name_length > value_len)
+            break;
+        count = ntfsAddStream(streams, max, count, names, size, used, (const char*)ea->name, ea->name_length,
+                              le16_to_cpu(ea->value_length), NTFS_STREAM_EA);
+        next = le32_to_cpu(ea->next_entry_offset);
+        if (!next)
+            break;
+        offs += next;
+    }
+
+    return count;
+}
+
+int ntfsListStreams (const char *path, ntfs_stream_entry *streams, int max, char *names, size_t size)
+{
+    ntfs_vd *vd = NULL;
+    ntfs_inode *ni = NULL;
+    ntfs_attr_search_ctx *ctx = NULL;
+    const ATTR_RECORD *a;
+    char name_buf[NTFS_MAX_NAME_BYTES];
+    char *name;
+    u8 *value;
+    s64 value_len;
+    size_t used = 0;
+    int count = 0, len, res = -1;
+
+    // Sanity check
+    if (!path || max < 0 || (max && !streams) || (size && !names)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    // Get the volume descriptor for this path
+    vd = ntfsGetVolume(path, true);
+    if (!vd) {
+        errno = ENODEV;
+        return -1;
+    }
+
+    // Lock
+    ntfsLock(vd);
+
+    // Find the entry
+    ni = ntfsOpenEntry(vd, path);
+    if (!ni)
+        goto cleanup;
+    ctx = ntfs_attr_get_search_ctx(ni, NULL);
+    if (!ctx)
+        goto cleanup;
+
+    // Walk every attribute of the entry once, in its own record and any others its attribute list names
+    while (count >= 0 && !ntfs_attr_lookup(AT_UNUSED, NULL, 0, CASE_SENSITIVE, 0, NULL, 0, ctx)) {
+        a = ctx->attr;
+
+        // Only the first extent of a non-resident attribute gives its size
+        if (a->non_resident && a->lowest_vcn)
+            continue;
+
+        // Named data streams
+        if (a->type == AT_DATA && a->name_length) {
+            name = name_buf;
+            len = ntfsUnicodeToLocal((const ntfschar*)((const u8*)a + le16_to_cpu(a->name_offset)), a->name_length,
+                                     &name, sizeof(name_buf));
+            if (len < 0)
+                break;
+            count = ntfsAddStream(streams, max, count, names, size, &used, name, len,
+                                  a->non_resident ? sle64_to_cpu(a->data_size) : le32_to_cpu(a->value_length),
+                                  NTFS_STREAM_DATA);
+
+        // Extended attributes, read from the record when they are resident
+        } else if (a->type == AT_EA) {
+            if (!a->non_resident) {
+                count = ntfsAddEaStreams(streams, max, count, names, size, &used,
+                                         (const u8*)a + le16_to_cpu(a->value_offset), le32_to_cpu(a->value_length));
+            } else {
+                value = ntfs_attr_readall(ni, AT_EA, NULL, 0, &value_len);
+                if (!value)
+                    break;
+                count = ntfsAddEaStreams(streams, max, count, names, size, &used, value, value_len);
+                free(value);
+            }
+        }
+
+    }
+    if (count >= 0 && errno == ENOENT)
+        res = count;
+
+cleanup:
+
+    // Close the entry, keeping the reason it could not be listed
+    if (ctx)
+        ntfs_attr_put_search_ctx(ctx);
+    if (ni) {
+        int err = errno;
+        ntfsCloseEntry(vd, ni);
+        errno = err;
+    }
+
+    // Unlock
+    ntfsUnlock(vd);
+
+    return res;
+}
@@ -26,6 +26,8 @@
 #include "ntfsinternal.h"
 #include <sys/reent.h>
 
+#define NTFS_DIR_BATCH                  64      /* Number of directory entries read from the index at a time */
+
 /**
  * ntfs_dir_entry - Directory entry
  */
@@ -33,6 +35,11 @@ typedef struct _ntfs_dir_entry {
     char *name;
     MFT_REF mref;
     unsigned type;
+    s64 data_size;                          /* Sizes and times recorded in the directory index */
+    s64 allocated_size;
+    ntfs_time last_access_time;
+    ntfs_time last_data_change_time;
+    ntfs_time last_mft_change_time;
     struct _ntfs_dir_entry *next;
 } ntfs_dir_entry;
 
@@ -42,14 +49,20 @@ typedef struct _ntfs_dir_entry {
 typedef struct _ntfs_dir_state {
     ntfs_vd *vd;                            /* Volume this directory belongs to */
     ntfs_inode *ni;                         /* Directory descriptor */
-    ntfs_dir_entry *first;                  /* The first entry in the directory */
+    ntfs_dir_entry *first;                  /* The first entry read and not yet released */
     ntfs_dir_entry *current;                /* The current entry in the directory */
+    ntfs_dir_entry *last;                   /* The last entry read from the directory */
+    ntfs_dir_entry *spare;                  /* Released entries kept for the next batch */
+    s64 position;                           /* Index position of the next entry to read (-1 once all are read) */
+    int batch;                              /* Entries still wanted by the current read (-1 for no limit) */
     struct _ntfs_dir_state *prevOpenDir;    /* The previous entry in a double-linked FILO list of open directories */
     struct _ntfs_dir_state *nextOpenDir;    /* The next entry in a double-linked FILO list of open directories */
 } ntfs_dir_state;
 
 /* Directory state routines */
 void ntfsCloseDir (ntfs_dir_state *file);
+void ntfsSnapshotOpenDirs (ntfs_vd *vd, ntfs_inode *dir_ni);
+void ntfsDirEntryStat (ntfs_vd *vd, const ntfs_dir_entry *entry, struct stat *st);
 
 /* Gekko devoptab directory routines for NTFS-based devices */
 extern int ntfs_stat_r (struct _reent *r, const char *path, struct stat *st);
@@ -40,18 +40,152 @@
 #ifdef HAVE_STRING_H
 #include <string.h>
 #endif
+#ifdef HAVE_LIMITS_H
+#include <limits.h>
+#endif
+#include <malloc.h>
 
+#include "ntfs.h"
 #include "ntfsinternal.h"
 #include "ntfsfile.h"
+#include "gekko_io.h"
 
 #define STATE(x)    ((ntfs_file_state*)x)
 
+ntfs_file_state *ntfsGetFileState (int fd)
+{
+    __handle *handle = __get_handle(fd);
+
+    // Check that the descriptor is an open file on one of our devices
+    if (!handle || !handle->fileStruct || !ntfsIsOurDevOpTab(devoptab_list[handle->device])) {
+        errno = EBADF;
+        return NULL;
+    }
+
+    // Check that the volume it was opened on is still mounted
+    ntfs_file_state *file = STATE(handle->fileStruct);
+    if (!file->vd || !file->ni || !file->data_na) {
+        errno = EBADF;
+        return NULL;
+    }
+
+    return file;
+}
+
+/**
+ * Allocate clusters ahead of a write that carries a file on past the end of its allocation
+ *
+ * The amount allocated ahead doubles each time, so a long run of appends only
+ * allocates clusters and rewrites the mapping pairs a logarithmic number of
+ * times and tends to stay contiguous. Whatever is not written to by the time
+ * the file is closed is given back then. Failing to allocate ahead is not an
+ * error, the write then allocates just what it needs.
+ */
+static void ntfsGrowAllocation (ntfs_file_state *file, s64 pos, s64 end)
+{
+    ntfs_attr *na = file->data_na;
+    ntfs_volume *vol = file->vd->vol;
+    s64 target, spare;
+    int err = errno;
+
+    // Only plain non-resident data written on from within its allocation grows this way
+    if (!NAttrNonResident(na) || (na->data_flags & (ATTR_COMPRESSION_MASK | ATTR_IS_ENCRYPTED)))
+        return;
+    if (end <= na->allocated_size || pos > na->allocated_size)
+        return;
+
+    // Leave most of the free space to everything else
+    spare = (vol->free_clusters << vol->cluster_size_bits) / 4;
+    target = end + MIN(file->growWindow, spare);
+    if (target <= end)
+        return;
+
+    if (ntfs_attr_preallocate(na, target, TRUE)) {
+        file->growWindow = NTFS_GROW_WINDOW_MIN;
+        errno = err;
+        return;
+    }
+
+    file->growEnd = na->allocated_size;
+    file->growWindow = MIN(file->growWindow * 2, NTFS_GROW_WINDOW_MAX);
+}
+
+/**
+ * Write out the data gathered in the write-behind buffer of a file (if any)
+ */
+static bool ntfsFlushWriteBuffer (ntfs_file_state *file)
+{
+    u8 *ptr = file->writeBuffer;
+    size_t len = file->writeBufferLen;
+    s64 pos = file->writeBufferPos;
+    bool ok = true;
+
+    // Short circuit cases where we don't actually have to do anything
+    if (!len)
+        return true;
+
+    // The buffer is empty from here on, even if writing it out fails
+    file->writeBufferLen = 0;
+
+    // Allocate ahead of the data if the file is growing
+    ntfsGrowAllocation(file, pos, pos + len);
+
+    // Write to the files data attribute
+    while (len) {
+        s64 ret = ntfs_attr_pwrite(file->data_na, pos, len, ptr);
+        if (ret <= 0) {
+            ok = false;
+            break;
+        }
+        ptr += ret;
+        pos += ret;
+        len -= ret;
+    }
+
+    // Update the files data length, which may be short of what was buffered if the write failed
+    file->len = file->data_na->data_size;
+
+    return ok;
+}
+
+/**
+ * Release a range of a file mapped by ntfsMapRange
+ */
+static void ntfsReleaseMapping (ntfs_file_state *file, ntfs_file_mapping *mapping)
+{
+    if (mapping->page)
+        ntfs_device_gekko_io_unpin(file->vd->dev, mapping->page);
+    if (mapping->buffer)
+        ntfs_free(mapping->buffer);
+    ntfs_free(mapping);
+}
+
 void ntfsCloseFile (ntfs_file_state *file)
 {
+    ntfs_file_mapping *mapping;
+
     // Sanity check
     if (!file || !file->vd)
         return;
 
+    // Release any ranges still mapped
+    while ((mapping = file->mappings) != NULL) {
+        file->mappings = mapping->next;
+        ntfsReleaseMapping(file, mapping);
+    }
+
+    // Write out and release the write-behind buffer
+    if (file->data_na)
+        ntfsFlushWriteBuffer(file);
+    if (file->writeBuffer) {
+        ntfs_free(file->writeBuffer);
+        file->writeBuffer = NULL;
+    }
+
+    // Give back the clusters allocated ahead of the data that were never written to
+    if (file->data_na && file->growEnd)
+        ntfs_attr_trim_allocation(file->data_na);
+
     // Special case fix ups for compressed and/or encrypted files
     if (file->compressed)
         ntfs_attr_pclose(file->data_na);
@@ -60,14 +194,16 @@ void ntfsCloseFile (ntfs_file_state *file)
         ntfs_efs_fixup_attribute(NULL, file->data_na);
 #endif
     // Close the file data attribute (if open)
-    if (file->data_na)
+    if (file->data_na) {
         ntfs_attr_close(file->data_na);
+        file->data_na = NULL;
+    }
 
     // Sync the file (and its attributes) to disc
     if(file->write)
     {
         ntfsUpdateTimes(file->vd, file->ni, NTFS_UPDATE_ATIME | NTFS_UPDATE_CTIME);
-        ntfsSync(file->vd, file->ni);
+        ntfsSyncDeferred(file->vd, file->ni);
     }
 
     if (file->read)
@@ -87,27 +223,30 @@ void ntfsCloseFile (ntfs_file_state *file)
     file->pos = 0;
     file->len = 0;
 
+    // Deinitialise the file lock
+    LWP_MutexDestroy(file->lock);
+
     return;
 }
 
-int ntfs_open_r (struct _reent *r, void *fileStruct, const char *path, int flags, int mode)
+void ntfsReleaseIdleRunlists (ntfs_vd *vd)
 {
-    ntfs_log_trace("fileStruct %p, path %s, flags %i, mode %i\n", (void *) fileStruct, path, flags, mode);
-
-    ntfs_file_state* file = STATE(fileStruct);
-
-    // Get the volume descriptor for this path
-    file->vd = ntfsGetVolume(path, true);
-    if (!file->vd) {
-        r->_errno = ENODEV;
-        return -1;
+    ntfs_file_state *file;
+    u64 now = gettime();
+
+    // Free the runlists of the open files left unused for a while, they are decoded again from the mapping pairs when needed
+    for (file = vd->firstOpenFile; file; file = file->nextOpenFile) {
+        if (file->data_na && NAttrNonResident(file->data_na) && file->data_na->rl &&
+            diff_ticks(file->lastUsed, now) >= millisecs_to_ticks(NTFS_RUNLIST_IDLE_TIME))
+            ntfs_attr_release_runlist(file->data_na);
     }
+}
 
-    // Lock
-    ntfsLock(file->vd);
-
+static bool ntfsSetOpenMode (ntfs_file_state *file, int flags)
+{
     // Determine which mode the file is opened for
     file->flags = flags;
+    file->uncached = (flags & NTFS_O_DIRECT) ? true : false;
     if ((flags & 0x03) == O_RDONLY) {
         file->read = true;
         file->write = false;
@@ -121,44 +260,19 @@ int ntfs_open_r (struct _reent *r, void *fileStruct, const char *path, int flags
         file->write = true;
         file->append = (flags & O_APPEND);
     } else {
-        r->_errno = EACCES;
-        ntfsUnlock(file->vd);
-        return -1;
-    }
-
-    // Try and find the file and (if found) ensure that it is not a directory
-    file->ni = ntfsOpenEntry(file->vd, path);
-    if (file->ni && (file->ni->mrec->flags & MFT_RECORD_IS_DIRECTORY)) {
-        ntfsCloseEntry(file->vd, file->ni);
-        ntfsUnlock(file->vd);
-        r->_errno = EISDIR;
-        return -1;
-    }
-
-    // Are we creating this file?
-    if ((flags & O_CREAT) && !file->ni) {
-
-        // Create the file
-        file->ni = ntfsCreate(file->vd, path, S_IFREG, NULL);
-        if (!file->ni) {
-            ntfsUnlock(file->vd);
-            return -1;
-        }
-
+        return false;
     }
 
-    // Sanity check, the file should be open by now
-    if (!file->ni) {
-        ntfsUnlock(file->vd);
-        r->_errno = ENOENT;
-        return -1;
-    }
+    return true;
+}
 
+static int ntfsOpenData (struct _reent *r, ntfs_file_state *file, int flags)
+{
     // Open the files data attribute
     file->data_na = ntfs_attr_open(file->ni, AT_DATA, AT_UNNAMED, 0);
     if(!file->data_na) {
         ntfsCloseEntry(file->vd, file->ni);
-        ntfsUnlock(file->vd);
+        r->_errno = errno;
         return -1;
     }
 
@@ -170,16 +284,14 @@ int ntfs_open_r (struct _reent *r, void *fileStruct, const char *path, int flags
     if (file->encrypted) {
         ntfs_attr_close(file->data_na);
         ntfsCloseEntry(file->vd, file->ni);
-        ntfsUnlock(file->vd);
         r->_errno = EACCES;
         return -1;
     }
 
-    // Make sure we aren't trying to write to a read-only file
-    if ((file->ni->flags & FILE_ATTR_READONLY) && file->write) {
+    // Make sure we aren't trying to write to a read-only file (or volume)
+    if (((file->ni->flags & FILE_ATTR_READONLY) || NVolReadOnly(file->vd->vol)) && file->write) {
         ntfs_attr_close(file->data_na);
         ntfsCloseEntry(file->vd, file->ni);
-        ntfsUnlock(file->vd);
         r->_errno = EROFS;
         return -1;
     }
@@ -189,7 +301,6 @@ int ntfs_open_r (struct _reent *r, void *fileStruct, const char *path, int flags
         if (ntfs_attr_truncate(file->data_na, 0)) {
             ntfs_attr_close(file->data_na);
             ntfsCloseEntry(file->vd, file->ni);
-            ntfsUnlock(file->vd);
             r->_errno = errno;
             return -1;
         }
@@ -199,6 +310,19 @@ int ntfs_open_r (struct _reent *r, void *fileStruct, const char *path, int flags
     file->pos = 0;
     file->len = file->data_na->data_size;
 
+    // Small writes are gathered into a cluster (or more) before being written out, unless the cache is bypassed
+    file->writeBuffer = NULL;
+    file->writeBufferSize = file->uncached ? 0 : MAX(file->vd->vol->cluster_size, NTFS_WRITE_BUFFER_SIZE);
+    file->writeBufferPos = 0;
+    file->writeBufferLen = 0;
+    file->growEnd = 0;
+    file->growWindow = NTFS_GROW_WINDOW_MIN;
+    file->mappings = NULL;
+    file->lastUsed = gettime();
+
+    // Initialise the file lock (taken after the volume lock, never before it)
+    LWP_MutexInit(&file->lock, false);
+
     ntfs_log_trace("file->len %llu\n", file->len);
 
     // Update file times
@@ -215,12 +339,161 @@ int ntfs_open_r (struct _reent *r, void *fileStruct, const char *path, int flags
     file->vd->firstOpenFile = file;
     file->vd->openFileCount++;
 
+    return 0;
+}
+
+int ntfs_open_r (struct _reent *r, void *fileStruct, const char *path, int flags, int mode)
+{
+    ntfs_log_trace("fileStruct %p, path %s, flags %i, mode %i\n", (void *) fileStruct, path, flags, mode);
+
+    ntfs_file_state* file = STATE(fileStruct);
+
+    // Get the volume descriptor for this path
+    file->vd = ntfsGetVolume(path, true);
+    if (!file->vd) {
+        r->_errno = ENODEV;
+        return -1;
+    }
+
+    // Lock
+    ntfsLock(file->vd);
+
+    // Determine which mode the file is opened for
+    if (!ntfsSetOpenMode(file, flags)) {
+        r->_errno = EACCES;
+        ntfsUnlock(file->vd);
+        return -1;
+    }
+
+    // Run any checks the volume must pass before it is written to
+    if (file->write && ntfsCheckDeferred(file->vd)) {
+        r->_errno = errno;
+        ntfsUnlock(file->vd);
+        return -1;
+    }
+
+    // Try and find the file and (if found) ensure that it is not a directory
+    file->ni = ntfsOpenEntry(file->vd, path);
+    if (file->ni && (file->ni->mrec->flags & MFT_RECORD_IS_DIRECTORY)) {
+        ntfsCloseEntry(file->vd, file->ni);
+        ntfsUnlock(file->vd);
+        r->_errno = EISDIR;
+        return -1;
+    }
+
+    // Are we creating this file?
+    if ((flags & O_CREAT) && !file->ni) {
+
+        // Create the file
+        file->ni = ntfsCreate(file->vd, path, S_IFREG, NULL);
+        if (!file->ni) {
+            ntfsUnlock(file->vd);
+            return -1;
+        }
+
+    }
+
+    // Sanity check, the file should be open by now
+    if (!file->ni) {
+        ntfsUnlock(file->vd);
+        r->_errno = ENOENT;
+        return -1;
+    }
+
+    // Open the files data and add it to the open files
+    if (ntfsOpenData(r, file, flags)) {
+        ntfsUnlock(file->vd);
+        return -1;
+    }
+
     // Unlock
     ntfsUnlock(file->vd);
 
     return (int)fileStruct;
 }
 
+int ntfsOpenByRef (const char *name, u64 mref, int flags)
+{
+    struct _reent r;
+    ntfs_file_state *file = NULL;
+    ntfs_vd *vd = NULL;
+    int fd;
+
+    // Get the volume descriptor for this device
+    vd = ntfsGetVolume(name, false);
+    if (!vd) {
+        errno = ENODEV;
+        return -1;
+    }
+
+    // You can only open files this way, never system files or directories
+    if (MREF(mref) < FILE_first_user || (flags & O_CREAT)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    // Allocate a descriptor on the device, as open() would
+    fd = __alloc_handle(FindDevice(name));
+    if (fd < 0) {
+        errno = EMFILE;
+        return -1;
+    }
+    file = STATE(__get_handle(fd)->fileStruct);
+    file->vd = vd;
+
+    // Lock
+    ntfsLock(vd);
+
+    // Determine which mode the file is opened for
+    if (!ntfsSetOpenMode(file, flags)) {
+        ntfsUnlock(vd);
+        __release_handle(fd);
+        errno = EACCES;
+        return -1;
+    }
+
+    // Run any checks the volume must pass before it is written to
+    if (file->write && ntfsCheckDeferred(vd)) {
+        ntfsUnlock(vd);
+        __release_handle(fd);
+        return -1;
+    }
+
+    // Open the entry straight from its record, which must still hold the same entry
+    file->ni = ntfs_inode_open(vd->vol, MREF(mref));
+    if (file->ni && ((MSEQNO(mref) && MSEQNO(mref) != le16_to_cpu(file->ni->mrec->sequence_number)) ||
+                     file->ni->mrec->base_mft_record)) {
+        ntfsCloseEntry(vd, file->ni);
+        file->ni = NULL;
+        errno = ENOENT;
+    }
+    if (!file->ni) {
+        ntfsUnlock(vd);
+        __release_handle(fd);
+        return -1;
+    }
+    if (file->ni->mrec->flags & MFT_RECORD_IS_DIRECTORY) {
+        ntfsCloseEntry(vd, file->ni);
+        ntfsUnlock(vd);
+        __release_handle(fd);
+        errno = EISDIR;
+        return -1;
+    }
+
+    // Open the files data and add it to the open files
+    if (ntfsOpenData(&r, file, flags)) {
+        ntfsUnlock(vd);
+        __release_handle(fd);
+        errno = r._errno;
+        return -1;
+    }
+
+    // Unlock
+    ntfsUnlock(vd);
+
+    return fd;
+}
+
 int ntfs_close_r (struct _reent *r, void *fd)
 {
     ntfs_log_trace("fd %p\n", (void *) fd);
@@ -236,6 +509,13 @@ int ntfs_close_r (struct _reent *r, void *fd)
     // Lock
     ntfsLock(file->vd);
 
+    // Write out anything still buffered, so that a failure can be reported
+    int ret = 0;
+    if (file->data_na && !ntfsFlushWriteBuffer(file)) {
+        r->_errno = errno;
+        ret = -1;
+    }
+
     // Close the file
     ntfsCloseFile(file);
 
@@ -251,7 +531,76 @@ int ntfs_close_r (struct _reent *r, void *fd)
     // Unlock
     ntfsUnlock(file->vd);
 
-    return 0;
+    return ret;
+}
+
+/**
+ * Write to a file at the given position, advancing it past the data written
+ *
+ * The volume must be locked exclusively by the caller.
+ */
+static ssize_t ntfsFileWrite (ntfs_file_state *file, const char *ptr, size_t len, off_t *pos)
+{
+    ssize_t written = 0;
+
+    // Write out the buffered data first if this write does not carry straight on from it, or would overflow it
+    if (file->writeBufferLen &&
+        (*pos != file->writeBufferPos + file->writeBufferLen ||
+         file->writeBufferLen + len > file->writeBufferSize)) {
+        if (!ntfsFlushWriteBuffer(file))
+            return -1;
+    }
+
+    // Gather small writes into the write-behind buffer (if it can be allocated)
+    if (len < file->writeBufferSize && !file->writeBuffer)
+        file->writeBuffer = (u8 *) ntfs_malloc(file->writeBufferSize);
+    if (len < file->writeBufferSize && file->writeBuffer) {
+        if (!file->writeBufferLen)
+            file->writeBufferPos = *pos;
+        memcpy(file->writeBuffer + file->writeBufferLen, ptr, len);
+        file->writeBufferLen += len;
+        *pos += len;
+        written = len;
+        len = 0;
+
+        // The buffered data counts towards the files length straight away
+        file->len = MAX(file->len, (u64) (file->writeBufferPos + file->writeBufferLen));
+
+        // Write the buffer out as soon as it fills up
+        if (file->writeBufferLen == file->writeBufferSize && !ntfsFlushWriteBuffer(file))
+            return -1;
+    }
+
+    // Allocate ahead of the data if the file is growing
+    if (len)
+        ntfsGrowAllocation(file, *pos, *pos + len);
+
+    // Keep the file data out of the device cache (if requested)
+    if (file->uncached)
+        NDevSetUncached(file->vd->dev);
+
+    // Write to the files data atrribute
+    file->lastUsed = gettime();
+    while (len) {
+        ssize_t ret = ntfs_attr_pwrite(file->data_na, *pos, len, ptr);
+        if (ret <= 0) {
+            NDevClearUncached(file->vd->dev);
+            return -1;
+        }
+        len -= ret;
+        *pos += ret;
+        written += ret;
+    }
+    NDevClearUncached(file->vd->dev);
+
+    // Mark the file for archiving (if we actually wrote something)
+    if (written)
+        file->ni->flags |= FILE_ATTR_ARCHIVE;
+
+    // Update the files data length (including anything still buffered)
+    file->len = MAX((u64) file->data_na->data_size, file->writeBufferLen ? (u64) (file->writeBufferPos + file->writeBufferLen) : 0);
+
+    return written;
 }
 
 ssize_t ntfs_write_r (struct _reent *r, void *fd, const char *ptr, size_t len)
@@ -289,17 +638,12 @@ ssize_t ntfs_write_r (struct _reent *r, void *fd, const char *ptr, size_t len)
         file->pos = file->len;
     }
 
-    // Write to the files data atrribute
-    while (len) {
-        ssize_t ret = ntfs_attr_pwrite(file->data_na, file->pos, len, ptr);
-        if (ret <= 0) {
-            ntfsUnlock(file->vd);
-            r->_errno = errno;
-            return -1;
-        }
-        len -= ret;
-        file->pos += ret;
-        written += ret;
+    // Write at the current position
+    written = ntfsFileWrite(file, ptr, len, &file->pos);
+    if (written < 0) {
+        ntfsUnlock(file->vd);
+        r->_errno = errno;
+        return -1;
     }
 
     // If we are in append mode, restore the current position to were it was prior to this write
@@ -307,25 +651,127 @@ ssize_t ntfs_write_r (struct _reent *r, void *fd, const char *ptr, size_t len)
         file->pos = old_pos;
     }
 
-    // Mark the file for archiving (if we actually wrote something)
-    if (written)
-        file->ni->flags |= FILE_ATTR_ARCHIVE;
-
-    // Update the files data length
-    file->len = file->data_na->data_size;
-
     // Unlock
     ntfsUnlock(file->vd);
 
     return written;
 }
 
+/**
+ * Check whether a file can be read while other threads share the volume
+ *
+ * Reads that may map runlist fragments, decompress, decrypt, walk an attribute
+ * list or toggle the device cache alter state outside the file and must hold
+ * the volume lock exclusively.
+ */
+static bool ntfsCanReadShared (ntfs_file_state *file)
+{
+    ntfs_attr *na = file->data_na;
+
+    if (file->uncached || file->writeBufferLen)
+        return false;
+
+    if (NAttrNonResident(na))
+        return NAttrFullyMapped(na) && na->rl && !(na->data_flags & (ATTR_COMPRESSION_MASK | ATTR_IS_ENCRYPTED));
+
+    return !NInoAttrList(file->ni);
+}
+
+/**
+ * Take the locks needed to read a file, sharing the volume with other readers where the file allows it
+ *
+ * @return True if the volume was locked shared, false if it was locked exclusively
+ */
+static bool ntfsReadLock (ntfs_file_state *file)
+{
+    ntfsLockShared(file->vd);
+    LWP_MutexLock(file->lock);
+    if (ntfsCanReadShared(file))
+        return true;
+
+    LWP_MutexUnlock(file->lock);
+    ntfsUnlockShared(file->vd);
+    ntfsLock(file->vd);
+    LWP_MutexLock(file->lock);
+
+    // Map the whole runlist up front so that later reads of the file can be shared, unless it spans
+    // several extents, which are only mapped as they are read so that memory stays bounded
+    if (NAttrNonResident(file->data_na) && !NAttrFullyMapped(file->data_na) && !NInoAttrList(file->ni))
+        ntfs_attr_map_whole_runlist(file->data_na);
+
+    return false;
+}
+
+/**
+ * Release the locks taken by a read of a file
+ */
+static void ntfsReadUnlock (ntfs_file_state *file, bool shared)
+{
+    LWP_MutexUnlock(file->lock);
+    if (shared)
+        ntfsUnlockShared(file->vd);
+    else
+        ntfsUnlock(file->vd);
+}
+
+/**
+ * Read from a file at the given position, advancing it past the data read
+ *
+ * The file must be locked for reading by the caller (see ntfsReadLock). Reads
+ * are cut short at the end of the file, with errno set to EOVERFLOW.
+ */
+static ssize_t ntfsFileRead (ntfs_file_state *file, char *ptr, size_t len, off_t *pos)
+{
+    ssize_t read = 0;
+
+    // Write out any buffered data so that it can be read back
+    if (!ntfsFlushWriteBuffer(file))
+        return -1;
+
+    // Don't read past the end of file
+    if (*pos >= file->len) {
+        errno = EOVERFLOW;
+        return 0;
+    }
+    if (*pos + len > file->len) {
+        errno = EOVERFLOW;
+        len = file->len - *pos;
+        ntfs_log_trace("EOVERFLOW");
+    }
+
+	ntfs_log_trace("pos:%d, len:%d, file->len:%d \n", (u32)*pos, (u32)len, (u32)file->len);
+
+    // Keep the file data out of the device cache (if requested)
+    if (file->uncached)
+        NDevSetUncached(file->vd->dev);
+
+    // Read from the files data attribute
+    file->lastUsed = gettime();
+    while (len) {
+        ssize_t ret = ntfs_attr_pread(file->data_na, *pos, len, ptr);
+        if (ret <= 0 || ret > len) {
+            if (file->uncached)
+                NDevClearUncached(file->vd->dev);
+            return -1;
+        }
+        ptr += ret;
+        len -= ret;
+        *pos += ret;
+        read += ret;
+    }
+    if (file->uncached)
+        NDevClearUncached(file->vd->dev);
+
+    return read;
+}
+
 ssize_t ntfs_read_r (struct _reent *r, void *fd, char *ptr, size_t len)
 {
     ntfs_log_trace("fd %p, ptr %p, len %u\n", (void *) fd, ptr, len);
 
     ntfs_file_state* file = STATE(fd);
     ssize_t read = 0;
+    bool shared;
 
     // Sanity check
     if (!file || !file->vd || !file->ni || !file->data_na) {
@@ -339,44 +785,68 @@ ssize_t ntfs_read_r (struct _reent *r, void *fd, char *ptr, size_t len)
     }
 
     // Lock
-    ntfsLock(file->vd);
+    shared = ntfsReadLock(file);
 
     // Check that we are allowed to read from this file
     if (!file->read) {
-        ntfsUnlock(file->vd);
+        ntfsReadUnlock(file, shared);
         r->_errno = EACCES;
         return -1;
     }
 
-    // Don't read past the end of file
-    if (file->pos + len > file->len) {
-        r->_errno = EOVERFLOW;
-        len = file->len - file->pos;
-        ntfs_log_trace("EOVERFLOW");
+    // Read from the current position
+    read = ntfsFileRead(file, ptr, len, &file->pos);
+    if (read < 0 || (size_t) read < len)
+        r->_errno = errno;
+
+    // Unlock
+    ntfsReadUnlock(file, shared);
+
+    return read;
+}
+
+/**
+ * Find the start of the data or hole of a file at or after the given position
+ *
+ * Holes are only reported for the unallocated runs of sparse files, the data
+ * of compressed and encrypted files is treated as having none. Every file
+ * ends in a hole.
+ *
+ * @return The position found or -1 if there is no data at or after POS (errno ENXIO)
+ */
+static off_t ntfsSeekDataHole (ntfs_file_state *file, off_t pos, bool hole)
+{
+    ntfs_attr *na = file->data_na;
+    ntfs_volume *vol = file->vd->vol;
+    runlist_element *rl;
+
+    if (pos < 0 || pos >= file->len) {
+        errno = ENXIO;
+        return -1;
     }
 
-	ntfs_log_trace("file->pos:%d, len:%d, file->len:%d \n", (u32)file->pos, (u32)len, (u32)file->len);
+    // Short circuit files which cannot have holes
+    if (!NAttrNonResident(na) || !NAttrSparse(na) || (na->data_flags & (ATTR_COMPRESSION_MASK | ATTR_IS_ENCRYPTED)))
+        return hole ? (off_t) file->len : pos;
 
-    // Read from the files data attribute
-    while (len) {
-        ssize_t ret = ntfs_attr_pread(file->data_na, file->pos, len, ptr);
-        if (ret <= 0 || ret > len) {
-            ntfsUnlock(file->vd);
-            r->_errno = errno;
-            return -1;
-        }
-        ptr += ret;
-        len -= ret;
-        file->pos += ret;
-        read += ret;
+    // Walk the runlist from the run holding the position
+    if (ntfs_attr_map_whole_runlist(na))
+        return -1;
+    rl = ntfs_attr_find_vcn(na, pos >> vol->cluster_size_bits);
+    for (; rl && rl->length; rl++) {
+        if ((rl->lcn == LCN_HOLE) == hole)
+            break;
     }
-    //ntfs_log_trace("file->pos: %d \n", (u32)file->pos);
-    // Update file times (if we actually read something)
 
-    // Unlock
-    ntfsUnlock(file->vd);
+    // Past the last run there is only the hole at the end of the file
+    if (!rl || !rl->length || (off_t) (rl->vcn << vol->cluster_size_bits) >= file->len) {
+        if (hole)
+            return file->len;
+        errno = ENXIO;
+        return -1;
+    }
 
-    return read;
+    return MAX(pos, (off_t) (rl->vcn << vol->cluster_size_bits));
 }
 
 off_t ntfs_seek_r (struct _reent *r, void *fd, off_t pos, int dir)
@@ -395,11 +865,29 @@ off_t ntfs_seek_r (struct _reent *r, void *fd, off_t pos, int dir)
     // Lock
     ntfsLock(file->vd);
 
+    // Write out any buffered data before moving away from it
+    if (!ntfsFlushWriteBuffer(file)) {
+        ntfsUnlock(file->vd);
+        r->_errno = errno;
+        return -1;
+    }
+
     // Set the files current position
     switch(dir) {
         case SEEK_SET: position = file->pos = MIN(MAX(pos, 0), file->len); break;
         case SEEK_CUR: position = file->pos = MIN(MAX(file->pos + pos, 0), file->len); break;
         case SEEK_END: position = file->pos = MIN(MAX(file->len + pos, 0), file->len); break;
+        case NTFS_SEEK_DATA:
+        case NTFS_SEEK_HOLE: {
+            position = ntfsSeekDataHole(file, pos, dir == NTFS_SEEK_HOLE);
+            if (position < 0) {
+                ntfsUnlock(file->vd);
+                r->_errno = errno;
+                return -1;
+            }
+            file->pos = position;
+            break;
+        }
     }
 
     // Unlock
@@ -424,6 +912,15 @@ int ntfs_fstat_r (struct _reent *r, void *fd, struct stat *st)
     if (!st)
         return 0;
 
+    // Write out any buffered data so that the stats include it
+    ntfsLock(file->vd);
+    bool flushed = ntfsFlushWriteBuffer(file);
+    ntfsUnlock(file->vd);
+    if (!flushed) {
+        r->_errno = errno;
+        return -1;
+    }
+
     // Get the file stats
     int ret = ntfsStat(file->vd, file->ni, st);
     if (ret)
@@ -454,6 +951,13 @@ int ntfs_ftruncate_r (struct _reent *r, void *fd, off_t len)
         return -1;
     }
 
+    // Write out any buffered data before resizing under it
+    if (!ntfsFlushWriteBuffer(file)) {
+        ntfsUnlock(file->vd);
+        r->_errno = errno;
+        return -1;
+    }
+
     // For compressed files, only deleting and expanding contents are implemented
     if (file->compressed &&
         len > 0 &&
@@ -511,16 +1015,1182 @@ int ntfs_fsync_r (struct _reent *r, void *fd)
         return -1;
     }
 
+    // Let a device flush that is about to start know this sync is coming, so that they can share it
+    ntfsCommitJoin(file->vd);
+
     // Lock
     ntfsLock(file->vd);
 
-    // Sync the file (and its attributes) to disc
-    int ret = ntfsSync(file->vd, file->ni);
+    // Write out any buffered data, then the file (and its attributes) to the device cache
+    int ret = -1;
+    if (ntfsFlushWriteBuffer(file))
+        ret = ntfsSyncEntry(file->vd, file->ni);
+
+    // Unlock
+    ntfsUnlock(file->vd);
+
+    // Sync the device, together with any other syncs close by
+    if (ret)
+        ntfsCommitLeave(file->vd);
+    else
+        ret = ntfsCommit(file->vd, true);
     if (ret)
         r->_errno = errno;
 
+    return ret;
+}
+
+bool ntfsPreallocate (int fd, off_t offset, off_t len, int flags)
+{
+    ntfs_log_trace("fd %i, offset %lld, len %lld, flags %i\n", fd, (s64) offset, (s64) len, flags);
+
+    ntfs_file_state* file = ntfsGetFileState(fd);
+    bool bestFit;
+    int res;
+
+    if (!file)
+        return false;
+
+    // Sanity check
+    if (offset < 0 || len <= 0) {
+        errno = EINVAL;
+        return false;
+    }
+
+    // Lock
+    ntfsLock(file->vd);
+
+    // Check that we are allowed to write to this file
+    if (!file->write) {
+        ntfsUnlock(file->vd);
+        errno = EBADF;
+        return false;
+    }
+
+    // Write out any buffered data first
+    if (!ntfsFlushWriteBuffer(file)) {
+        ntfsUnlock(file->vd);
+        return false;
+    }
+
+    // Use the best fitting free extent for this call only (if requested)
+    bestFit = NVolBestFit(file->vd->vol);
+    if (flags & NTFS_PREALLOC_BEST_FIT)
+        NVolSetBestFit(file->vd->vol);
+
+    // Allocate the clusters up to the end of the range
+    res = ntfs_attr_preallocate(file->data_na, offset + len, (flags & NTFS_PREALLOC_KEEP_SIZE) ? TRUE : FALSE);
+    if (!bestFit)
+        NVolClearBestFit(file->vd->vol);
+    if (res) {
+        ntfsUnlock(file->vd);
+        return false;
+    }
+
+    // Mark the file for archiving and update file times (if we actually changed its length)
+    if (file->len != file->data_na->data_size) {
+        file->ni->flags |= FILE_ATTR_ARCHIVE;
+        ntfsUpdateTimes(file->vd, file->ni, NTFS_UPDATE_MCTIME);
+    }
+
+    // Update the files data length
+    file->len = file->data_na->data_size;
+
+    // The clusters asked for are kept when the file is closed
+    file->growEnd = 0;
+
+    // Sync the file (and its attributes) to disc
+    ntfsSync(file->vd, file->ni);
+
     // Unlock
     ntfsUnlock(file->vd);
 
-    return ret;
+    return true;
+}
+
+bool ntfsSetCompressionLevel (int fd, int level)
+{
+    ntfs_log_trace("fd %i, level %i\n", fd, level);
+
+    ntfs_file_state* file = ntfsGetFileState(fd);
+
+    if (!file)
+        return false;
+
+    // Sanity check
+    if (level < NTFS_COMPRESS_BEST || level > NTFS_COMPRESS_STORE) {
+        errno = EINVAL;
+        return false;
+    }
+
+    // Lock
+    ntfsLock(file->vd);
+
+    // Compression blocks are compressed when written out of the write buffer, so this covers the data still buffered
+    file->data_na->compression_level = level;
+
+    // Unlock
+    ntfsUnlock(file->vd);
+
+    return true;
+}
+
+ssize_t ntfsPread (int fd, void *buf, size_t len, off_t offset)
+{
+    ntfs_log_trace("fd %i, buf %p, len %u, offset %lld\n", fd, buf, len, (s64) offset);
+
+    ntfs_file_state* file = ntfsGetFileState(fd);
+    ssize_t read;
+    bool shared;
+
+    if (!file)
+        return -1;
+
+    // Sanity check
+    if (offset < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    // Short circuit cases where we don't actually have to do anything
+    if (!buf || len <= 0)
+        return 0;
+
+    // Lock
+    shared = ntfsReadLock(file);
+
+    // Check that we are allowed to read from this file
+    if (!file->read) {
+        ntfsReadUnlock(file, shared);
+        errno = EBADF;
+        return -1;
+    }
+
+    // Read from the given position, leaving the file position alone
+    read = ntfsFileRead(file, (char *) buf, len, &offset);
+
+    // Unlock
+    ntfsReadUnlock(file, shared);
+
+    return read;
+}
+
+ssize_t ntfsPwrite (int fd, const void *buf, size_t len, off_t offset)
+{
+    ntfs_log_trace("fd %i, buf %p, len %u, offset %lld\n", fd, buf, len, (s64) offset);
+
+    ntfs_file_state* file = ntfsGetFileState(fd);
+    ssize_t written;
+
+    if (!file)
+        return -1;
+
+    // Sanity check
+    if (offset < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    // Short circuit cases where we don't actually have to do anything
+    if (!buf || len <= 0)
+        return 0;
+
+    // Lock
+    ntfsLock(file->vd);
+
+    // Check that we are allowed to write to this file
+    if (!file->write) {
+        ntfsUnlock(file->vd);
+        errno = EBADF;
+        return -1;
+    }
+
+    // Write at the given position, leaving the file position alone (even in append mode)
+    written = ntfsFileWrite(file, (const char *) buf, len, &offset);
+
+    // Unlock
+    ntfsUnlock(file->vd);
+
+    return written;
+}
+
+/**
+ * Pin the device cache page holding a range of a file, for reading the range in place
+ *
+ * Only ranges of plain non-resident data that are fully initialised and lie
+ * within one run and one cache page can be pinned, the file must be locked for
+ * reading by the caller (see ntfsReadLock).
+ *
+ * @return A pointer to the range within the page, or NULL if it can not be pinned
+ */
+static const void *ntfsPinRange (ntfs_file_state *file, off_t offset, size_t len, void **page)
+{
+    ntfs_attr *na = file->data_na;
+    ntfs_volume *vol = file->vd->vol;
+    runlist_element *rl;
+    VCN vcn, last;
+
+    if (file->uncached || !NAttrNonResident(na) || (na->data_flags & (ATTR_COMPRESSION_MASK | ATTR_IS_ENCRYPTED)))
+        return NULL;
+    if (offset + len > na->initialized_size)
+        return NULL;
+
+    // Find the run holding the start of the range, which must hold the rest of it too
+    file->lastUsed = gettime();
+    vcn = offset >> vol->cluster_size_bits;
+    last = (offset + len - 1) >> vol->cluster_size_bits;
+    rl = ntfs_attr_find_vcn(na, vcn);
+    if (!rl || rl->lcn < 0 || last >= rl->vcn + rl->length)
+        return NULL;
+
+    return ntfs_device_gekko_io_pin(vol->dev, ((rl->lcn + vcn - rl->vcn) << vol->cluster_size_bits) +
+                                    (offset & (vol->cluster_size - 1)), len, page);
+}
+
+bool ntfsMapRange (int fd, off_t offset, size_t len, const void **ptr)
+{
+    ntfs_log_trace("fd %i, offset %lld, len %u, ptr %p\n", fd, (s64) offset, len, ptr);
+
+    ntfs_file_state* file = ntfsGetFileState(fd);
+    ntfs_file_mapping *mapping;
+    off_t pos = offset;
+    bool shared;
+
+    if (!file)
+        return false;
+
+    // Sanity check
+    if (offset < 0 || !len || !ptr) {
+        errno = EINVAL;
+        return false;
+    }
+
+    mapping = (ntfs_file_mapping *) ntfs_malloc(sizeof(ntfs_file_mapping));
+    if (!mapping)
+        return false;
+    mapping->page = NULL;
+    mapping->buffer = NULL;
+
+    // Lock
+    shared = ntfsReadLock(file);
+
+    // Check that we are allowed to read from this file
+    if (!file->read) {
+        ntfsReadUnlock(file, shared);
+        ntfs_free(mapping);
+        errno = EBADF;
+        return false;
+    }
+
+    // Write out any buffered data so that it is mapped too
+    if (!ntfsFlushWriteBuffer(file)) {
+        ntfsReadUnlock(file, shared);
+        ntfs_free(mapping);
+        return false;
+    }
+
+    // The range must lie within the file
+    if (offset >= file->len || len > file->len - offset) {
+        ntfsReadUnlock(file, shared);
+        ntfs_free(mapping);
+        errno = EOVERFLOW;
+        return false;
+    }
+
+    // Map the range straight out of the device cache, else read it into a buffer of its own
+    mapping->ptr = ntfsPinRange(file, offset, len, &mapping->page);
+    if (!mapping->ptr) {
+        mapping->page = NULL;
+        mapping->buffer = (u8 *) ntfs_malloc(len);
+        if (!mapping->buffer || ntfsFileRead(file, (char *) mapping->buffer, len, &pos) != (ssize_t) len) {
+            ntfsReadUnlock(file, shared);
+            ntfs_free(mapping->buffer);
+            ntfs_free(mapping);
+            return false;
+        }
+        mapping->ptr = mapping->buffer;
+    }
+
+    mapping->next = file->mappings;
+    file->mappings = mapping;
+    *ptr = mapping->ptr;
+
+    // Unlock
+    ntfsReadUnlock(file, shared);
+
+    return true;
+}
+
+bool ntfsUnmapRange (int fd, const void *ptr)
+{
+    ntfs_log_trace("fd %i, ptr %p\n", fd, ptr);
+
+    ntfs_file_state* file = ntfsGetFileState(fd);
+    ntfs_file_mapping **link, *mapping = NULL;
+
+    if (!file)
+        return false;
+
+    // Lock
+    ntfsLockShared(file->vd);
+    LWP_MutexLock(file->lock);
+
+    // Find the mapping and take it off the file
+    for (link = &file->mappings; *link; link = &(*link)->next) {
+        if ((*link)->ptr == ptr) {
+            mapping = *link;
+            *link = mapping->next;
+            break;
+        }
+    }
+
+    if (mapping)
+        ntfsReleaseMapping(file, mapping);
+
+    // Unlock
+    LWP_MutexUnlock(file->lock);
+    ntfsUnlockShared(file->vd);
+
+    if (!mapping) {
+        errno = EINVAL;
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * Add a range to the extents of a file, merging it into the previous extent where it carries straight on from it
+ *
+ * The latest extent is held back in LAST until the next one is known, extents
+ * beyond the first MAX are only counted.
+ */
+static void ntfsAddExtent (ntfs_file_extent *extents, int max, int *count, ntfs_file_extent *last,
+                           u64 offset, u64 length, sec_t sector, u32 flags, u32 sectorSize)
+{
+    // Carry on the previous extent (if this range follows on from it)
+    if (last->length && last->offset + last->length == offset && last->flags == flags &&
+        ((flags & (NTFS_EXTENT_HOLE | NTFS_EXTENT_RESIDENT)) || last->sector + last->length / sectorSize == sector)) {
+        last->length += length;
+        return;
+    }
+
+    // Emit the previous extent and start a new one
+    if (last->length) {
+        if (*count < max)
+            extents[*count] = *last;
+        (*count)++;
+    }
+    last->offset = offset;
+    last->length = length;
+    last->sector = sector;
+    last->flags = flags;
+}
+
+int ntfsGetFileExtents (int fd, ntfs_file_extent *extents, int max)
+{
+    ntfs_log_trace("fd %i, extents %p, max %i\n", fd, extents, max);
+
+    ntfs_file_state* file = ntfsGetFileState(fd);
+    ntfs_file_extent last = { 0 };
+    ntfs_volume *vol;
+    ntfs_attr *na;
+    gekko_fd *gfd;
+    runlist_element *rl;
+    u32 flags = 0;
+    int count = 0;
+
+    if (!file)
+        return -1;
+
+    // Sanity check
+    if (max < 0 || (max && !extents)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    // Lock
+    ntfsLock(file->vd);
+
+    vol = file->vd->vol;
+    na = file->data_na;
+    gfd = (gekko_fd *) vol->dev->d_private;
+
+    // Write out any buffered data, and everything the device cache holds, so that the disc is up to date
+    if (!ntfsFlushWriteBuffer(file) || (!NVolReadOnly(vol) && (ntfs_cluster_bitmap_sync(vol) || ntfs_device_sync(vol->dev)))) {
+        ntfsUnlock(file->vd);
+        return -1;
+    }
+
+    // Resident data has no sectors of its own
+    if (!NAttrNonResident(na)) {
+        if (file->len)
+            ntfsAddExtent(extents, max, &count, &last, 0, file->len, 0, NTFS_EXTENT_RESIDENT, gfd->sectorSize);
+        goto done;
+    }
+
+    if (ntfs_attr_map_whole_runlist(na)) {
+        ntfsUnlock(file->vd);
+        return -1;
+    }
+
+    if (na->data_flags & ATTR_COMPRESSION_MASK)
+        flags |= NTFS_EXTENT_COMPRESSED;
+    if (na->data_flags & ATTR_IS_ENCRYPTED)
+        flags |= NTFS_EXTENT_ENCRYPTED;
+
+    // Translate each run (up to the end of the file) into sectors of the device, splitting it where the initialized data ends
+    for (rl = na->rl; rl && rl->length && (u64) (rl->vcn << vol->cluster_size_bits) < file->len; rl++) {
+        s64 start = rl->vcn << vol->cluster_size_bits;
+        s64 end = MIN((rl->vcn + rl->length) << vol->cluster_size_bits, (s64) file->len);
+        s64 split;
+        sec_t sector;
+
+        if (rl->lcn == LCN_HOLE) {
+            ntfsAddExtent(extents, max, &count, &last, start, end - start, 0, flags | NTFS_EXTENT_HOLE, gfd->sectorSize);
+            continue;
+        }
+        if (rl->lcn < 0) {
+            ntfsUnlock(file->vd);
+            errno = EIO;
+            return -1;
+        }
+
+        sector = gfd->startSector + (sec_t) ((rl->lcn << vol->cluster_size_bits) / gfd->sectorSize);
+
+        // A sector holding the end of the initialized data is left to be read through the file
+        split = MIN(end, na->initialized_size);
+        if (split < end)
+            split -= split % gfd->sectorSize;
+        if (split > start) {
+            ntfsAddExtent(extents, max, &count, &last, start, split - start, sector, flags, gfd->sectorSize);
+            sector += (sec_t) ((split - start) / gfd->sectorSize);
+            start = split;
+        }
+        if (start < end)
+            ntfsAddExtent(extents, max, &count, &last, start, end - start, sector, flags | NTFS_EXTENT_UNWRITTEN, gfd->sectorSize);
+    }
+
+done:
+    // Emit the last extent
+    if (last.length) {
+        if (count < max)
+            extents[count] = last;
+        count++;
+    }
+
+    // Unlock
+    ntfsUnlock(file->vd);
+
+    return count;
+}
+
+/**
+ * Find the open file (if any) with the same entry as NI
+ */
+static ntfs_file_state *ntfsFindOpenFile (ntfs_vd *vd, ntfs_inode *ni)
+{
+    ntfs_file_state *file;
+
+    for (file = vd->firstOpenFile; file; file = file->nextOpenFile) {
+        if (file->ni && file->ni->mft_no == ni->mft_no)
+            return file;
+    }
+
+    return NULL;
+}
+
+/**
+ * Check whether an attribute already holds LEN bytes of BUF
+ */
+static bool ntfsDataMatches (ntfs_attr *na, const void *buf, size_t len)
+{
+    size_t chunk = MIN(len, 65536);
+    size_t done = 0;
+    s64 read;
+    u8 *data;
+
+    // Compare the data in chunks, so that large files do not need a buffer of their size
+    if ((size_t)na->data_size != len)
+        return false;
+    if (!len)
+        return true;
+    data = (u8 *) ntfs_malloc(chunk);
+    if (!data)
+        return false;
+    while (done < len) {
+        read = ntfs_attr_pread(na, done, MIN(chunk, len - done), data);
+        if (read <= 0 || memcmp(data, (const u8 *) buf + done, read))
+            break;
+        done += read;
+    }
+    ntfs_free(data);
+
+    return done == len;
+}
+
+bool ntfsDefragFile (const char *path, int flags)
+{
+    ntfs_log_trace("path %s, flags %i\n", path, flags);
+
+    ntfs_vd *vd = NULL;
+    ntfs_inode *ni = NULL;
+    ntfs_attr *na = NULL;
+    bool res = false;
+
+    // Sanity check
+    if (!path) {
+        errno = EINVAL;
+        return false;
+    }
+
+    // Get the volume descriptor for this path
+    vd = ntfsGetVolume(path, true);
+    if (!vd) {
+        errno = ENODEV;
+        return false;
+    }
+
+    // You cannot move files on a read-only mount
+    if (NVolReadOnly(vd->vol)) {
+        errno = EROFS;
+        return false;
+    }
+
+    // Lock
+    ntfsLock(vd);
+
+    // Run any checks the volume must pass before it is written to
+    if (ntfsCheckDeferred(vd))
+        goto cleanup;
+
+    // Find the file
+    ni = ntfsOpenEntry(vd, path);
+    if (!ni)
+        goto cleanup;
+
+    // Only regular files outside the system files can be moved
+    if (ni->mrec->flags & MFT_RECORD_IS_DIRECTORY) {
+        errno = EISDIR;
+        goto cleanup;
+    }
+    if (ni->mft_no < FILE_first_user) {
+        errno = EPERM;
+        goto cleanup;
+    }
+
+    // Open descriptors keep a runlist of their own, which would go stale
+    if (ntfsFindOpenFile(vd, ni)) {
+
+        // Drop our copy of the entry without leaving it in the inode cache, where it would shadow the open one
+        ntfs_inode_real_close(ni);
+        ni = NULL;
+        errno = EBUSY;
+        goto cleanup;
+    }
+
+    // Open the files data attribute
+    na = ntfs_attr_open(ni, AT_DATA, AT_UNNAMED, 0);
+    if (!na)
+        goto cleanup;
+
+    // Copy the clusters into fewer extents and switch the file over to them
+    if (ntfs_attr_defragment(na, (flags & NTFS_DEFRAG_PARTIAL) ? TRUE : FALSE))
+        goto cleanup;
+
+    res = true;
+
+cleanup:
+
+    // Close the data attribute, then sync the file so that the old clusters are freed on disc
+    if (na)
+        ntfs_attr_close(na);
+    if (ni) {
+        int err = errno;
+        if (res)
+            ntfsSync(vd, ni);
+        ntfsCloseEntry(vd, ni);
+        errno = err;
+    }
+
+    // Unlock
+    ntfsUnlock(vd);
+
+    return res;
+}
+
+ssize_t ntfsReadFile (const char *path, void *buf, size_t maxlen)
+{
+    ntfs_log_trace("path %s, buf %p, maxlen %u\n", path, buf, (unsigned int) maxlen);
+
+    ntfs_vd *vd = NULL;
+    ntfs_inode *ni = NULL;
+    ntfs_attr_search_ctx *ctx = NULL;
+    ntfs_attr *na = NULL;
+    ntfs_file_state *file;
+    ATTR_RECORD *a;
+    bool owned = true;
+    ssize_t res = -1;
+    s64 size, done, read;
+
+    // Sanity check
+    if (!path || (!buf && maxlen)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    // Get the volume descriptor for this path
+    vd = ntfsGetVolume(path, true);
+    if (!vd) {
+        errno = ENODEV;
+        return -1;
+    }
+
+    // Lock
+    ntfsLock(vd);
+
+    // Find the file and ensure that it is not a directory
+    ni = ntfsOpenEntry(vd, path);
+    if (!ni)
+        goto cleanup;
+    if (ni->mrec->flags & MFT_RECORD_IS_DIRECTORY) {
+        errno = EISDIR;
+        goto cleanup;
+    }
+
+    // An open descriptor may hold data that has not reached the record yet, read through its entry instead
+    file = ntfsFindOpenFile(vd, ni);
+    if (file) {
+        ntfs_inode_real_close(ni);
+        ni = file->ni;
+        owned = false;
+        if (file->data_na && !ntfsFlushWriteBuffer(file))
+            goto cleanup;
+    }
+
+    // Find the files data attribute
+    ctx = ntfs_attr_get_search_ctx(ni, NULL);
+    if (!ctx)
+        goto cleanup;
+    if (ntfs_attr_lookup(AT_DATA, AT_UNNAMED, 0, CASE_SENSITIVE, 0, NULL, 0, ctx))
+        goto cleanup;
+    a = ctx->attr;
+
+    // Resident data is copied straight out of the record, without opening the attribute
+    if (!a->non_resident && !(a->flags & (ATTR_COMPRESSION_MASK | ATTR_IS_ENCRYPTED)) &&
+        !(ni->flags & FILE_ATTR_ENCRYPTED)) {
+        size = le32_to_cpu(a->value_length);
+        if (le16_to_cpu(a->value_offset) + size > le32_to_cpu(a->length)) {
+            errno = EIO;
+            goto cleanup;
+        }
+        if (maxlen)
+            memcpy(buf, (u8 *) a + le16_to_cpu(a->value_offset), MIN((size_t) size, maxlen));
+        res = size;
+        goto done;
+    }
+    ntfs_attr_put_search_ctx(ctx);
+    ctx = NULL;
+
+    // Anything else is read through the attribute
+    na = ntfs_attr_open(ni, AT_DATA, AT_UNNAMED, 0);
+    if (!na)
+        goto cleanup;
+    if (NAttrEncrypted(na) || (ni->flags & FILE_ATTR_ENCRYPTED)) {
+        errno = EACCES;
+        goto cleanup;
+    }
+    size = na->data_size;
+
+    // The size is returned, so it must fit
+    if (size > SSIZE_MAX) {
+        errno = EFBIG;
+        goto cleanup;
+    }
+    for (done = 0; done < MIN(size, (s64) maxlen); done += read) {
+        read = ntfs_attr_pread(na, done, MIN(size, (s64) maxlen) - done, (u8 *) buf + done);
+        if (read <= 0) {
+            if (!read)
+                errno = EIO;
+            goto cleanup;
+        }
+    }
+    res = size;
+
+done:
+
+    // The access time is only written back when it is kept, nothing else of the entry has changed
+    ntfsUpdateTimes(vd, ni, NTFS_UPDATE_ATIME);
+
+cleanup:
+
+    // Close the data attribute and the entry
+    if (ctx)
+        ntfs_attr_put_search_ctx(ctx);
+    if (na)
+        ntfs_attr_close(na);
+    if (ni && owned) {
+        int err = errno;
+        ntfsCloseEntry(vd, ni);
+        errno = err;
+    }
+
+    // Unlock
+    ntfsUnlock(vd);
+
+    return res;
+}
+
+ssize_t ntfsWriteFile (const char *path, const void *buf, size_t len)
+{
+    ntfs_log_trace("path %s, buf %p, len %u\n", path, buf, (unsigned int) len);
+
+    ntfs_vd *vd = NULL;
+    ntfs_inode *ni = NULL;
+    ntfs_attr_search_ctx *ctx = NULL;
+    ntfs_attr *na = NULL;
+    ATTR_RECORD *a;
+    bool created = false;
+    bool compressed;
+    ssize_t res = -1;
+    s64 done, written;
+
+    // Sanity check
+    if (!path || (!buf && len) || (ssize_t) len < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    // Get the volume descriptor for this path
+    vd = ntfsGetVolume(path, true);
+    if (!vd) {
+        errno = ENODEV;
+        return -1;
+    }
+
+    // You cannot write to a read-only mount
+    if (NVolReadOnly(vd->vol)) {
+        errno = EROFS;
+        return -1;
+    }
+
+    // Lock
+    ntfsLock(vd);
+
+    // Run any checks the volume must pass before it is written to
+    if (ntfsCheckDeferred(vd))
+        goto cleanup;
+
+    // Find the file, creating it if it does not exist
+    ni = ntfsOpenEntry(vd, path);
+    if (!ni && errno == ENOENT) {
+        ni = ntfsCreate(vd, path, S_IFREG, NULL);
+        created = true;
+    }
+    if (!ni)
+        goto cleanup;
+
+    // Only writable regular files can be written to
+    if (ni->mrec->flags & MFT_RECORD_IS_DIRECTORY) {
+        errno = EISDIR;
+        goto cleanup;
+    }
+    if (ni->flags & FILE_ATTR_READONLY) {
+        errno = EROFS;
+        goto cleanup;
+    }
+
+    // Open descriptors keep sizes of their own, which would go stale
+    if (ntfsFindOpenFile(vd, ni)) {
+        ntfs_inode_real_close(ni);
+        ni = NULL;
+        errno = EBUSY;
+        goto cleanup;
+    }
+
+    // Leave the file untouched if it already holds the data, comparing resident data in the record
+    if (!created) {
+        ctx = ntfs_attr_get_search_ctx(ni, NULL);
+        if (!ctx)
+            goto cleanup;
+        if (ntfs_attr_lookup(AT_DATA, AT_UNNAMED, 0, CASE_SENSITIVE, 0, NULL, 0, ctx))
+            goto cleanup;
+        a = ctx->attr;
+        if (!a->non_resident && !(a->flags & (ATTR_COMPRESSION_MASK | ATTR_IS_ENCRYPTED)) &&
+            le32_to_cpu(a->value_length) == len &&
+            le16_to_cpu(a->value_offset) + len <= le32_to_cpu(a->length) &&
+            (!len || !memcmp((u8 *) a + le16_to_cpu(a->value_offset), buf, len))) {
+            res = len;
+            goto cleanup;
+        }
+        ntfs_attr_put_search_ctx(ctx);
+        ctx = NULL;
+    }
+
+    // Open the files data attribute
+    na = ntfs_attr_open(ni, AT_DATA, AT_UNNAMED, 0);
+    if (!na)
+        goto cleanup;
+    if (NAttrEncrypted(na) || (ni->flags & FILE_ATTR_ENCRYPTED)) {
+        errno = EACCES;
+        goto cleanup;
+    }
+    compressed = NAttrCompressed(na) || (ni->flags & FILE_ATTR_COMPRESSED);
+    if (!created && NAttrNonResident(na) && !compressed && ntfsDataMatches(na, buf, len)) {
+        res = len;
+        goto cleanup;
+    }
+
+    // Compressed data is written from the start of the file, other data is overwritten in place
+    if (compressed ? ntfs_attr_truncate(na, 0) : (na->data_size > (s64) len && ntfs_attr_truncate(na, len)))
+        goto cleanup;
+    for (done = 0; done < (s64) len; done += written) {
+        written = ntfs_attr_pwrite(na, done, len - done, (const u8 *) buf + done);
+        if (written <= 0) {
+            if (!written)
+                errno = EIO;
+            break;
+        }
+    }
+    if (compressed && ntfs_attr_pclose(na))
+        goto cleanup;
+    if (done < (s64) len)
+        goto cleanup;
+
+    // Mark the file as changed, its entry is written back with the rest of the deferred syncs
+    ni->flags |= FILE_ATTR_ARCHIVE;
+    ntfsUpdateTimes(vd, ni, NTFS_UPDATE_MCTIME);
+    res = len;
+
+cleanup:
+
+    // Close the data attribute and the entry, which is only written back if it changed
+    if (ctx)
+        ntfs_attr_put_search_ctx(ctx);
+    if (na)
+        ntfs_attr_close(na);
+    if (ni) {
+        int err = errno;
+        if (res >= 0 && NInoDirty(ni))
+            ntfsSyncDeferred(vd, ni);
+        ntfsCloseEntry(vd, ni);
+        errno = err;
+    }
+
+    // Unlock
+    ntfsUnlock(vd);
+
+    return res;
+}
+
+/**
+ * Check whether LEN bytes of BUF are all zeroes
+ */
+static bool ntfsIsZero (const u8 *buf, s64 len)
+{
+    while (len && !*buf) {
+        buf++;
+        len--;
+    }
+
+    return !len;
+}
+
+/**
+ * Copy LEN bytes at POS of one data attribute to the same place in another
+ *
+ * Clusters that read back as zeroes are left out when SKIPZEROES is set, the
+ * destination already reading as zeroes there.
+ */
+static bool ntfsCopyRange (ntfs_attr *src, ntfs_attr *dst, s64 pos, s64 len, u8 *buf, bool uncached, bool skipZeroes)
+{
+    s64 cluster = dst->ni->vol->cluster_size;
+    s64 chunk, read, written, start, end;
+
+    while (len > 0) {
+        chunk = MIN(len, NTFS_COPY_BUFFER_SIZE);
+
+        // Read straight into the aligned buffer, passing the device cache by (if requested)
+        if (uncached)
+            NDevSetUncached(src->ni->vol->dev);
+        read = ntfs_attr_pread(src, pos, chunk, buf);
+        if (uncached)
+            NDevClearUncached(src->ni->vol->dev);
+        if (read <= 0) {
+            if (!read)
+                errno = EIO;
+            return false;
+        }
+
+        // Write it out in one go, or each run of clusters holding more than zeroes
+        if (uncached)
+            NDevSetUncached(dst->ni->vol->dev);
+        for (start = 0; start < read; start = end) {
+            end = read;
+            if (skipZeroes) {
+                while (start < read && ntfsIsZero(buf + start, MIN(cluster, read - start)))
+                    start += cluster;
+                for (end = start; end < read && !ntfsIsZero(buf + end, MIN(cluster, read - end)); end += cluster);
+                end = MIN(end, read);
+            }
+            for (; start < end; start += written) {
+                written = ntfs_attr_pwrite(dst, pos + start, end - start, buf + start);
+                if (written <= 0) {
+                    if (!written)
+                        errno = EIO;
+                    break;
+                }
+            }
+            if (start < end)
+                break;
+        }
+        if (uncached)
+            NDevClearUncached(dst->ni->vol->dev);
+        if (start < end)
+            return false;
+
+        pos += read;
+        len -= read;
+    }
+
+    return true;
+}
+
+/**
+ * Copy a data stream of an entry to another entry, creating it there if it is named
+ */
+static bool ntfsCopyStream (ntfs_inode *src_ni, ntfs_inode *dst_ni, ntfschar *name, u32 name_len, u8 *buf, bool uncached)
+{
+    ntfs_attr *src = NULL, *dst = NULL;
+    runlist_element *rl;
+    bool compressed, holes, bestFit;
+    bool res = false;
+    s64 start, end;
+    int ret;
+    u8 bits;
+
+    // Open the stream to copy, encrypted data can not be read back as it is stored
+    src = ntfs_attr_open(src_ni, AT_DATA, name, name_len);
+    if (!src)
+        goto cleanup;
+    if (NAttrEncrypted(src) || (src_ni->flags & FILE_ATTR_ENCRYPTED)) {
+        errno = EACCES;
+        goto cleanup;
+    }
+
+    // Open the stream of the copy, the unnamed one was made with the entry
+    if (name_len && ntfs_attr_add(dst_ni, AT_DATA, name, name_len, NULL, 0))
+        goto cleanup;
+    dst = ntfs_attr_open(dst_ni, AT_DATA, name, name_len);
+    if (!dst)
+        goto cleanup;
+    compressed = (dst->data_flags & ATTR_COMPRESSION_MASK) || (dst_ni->flags & FILE_ATTR_COMPRESSED);
+
+    // Sparse, compressed and partly initialised data may hold holes, which are only kept by leaving them unwritten
+    holes = NAttrNonResident(src) && ((src->data_flags & (ATTR_COMPRESSION_MASK | ATTR_IS_SPARSE)) ||
+                                      src->initialized_size < src->data_size);
+
+    // Size the copy first, allocating all of its clusters at once in the best fitting free extent when there are no holes
+    if (!compressed) {
+        if (holes) {
+            if (ntfs_attr_truncate(dst, src->data_size))
+                goto cleanup;
+        } else {
+            bestFit = NVolBestFit(dst_ni->vol);
+            NVolSetBestFit(dst_ni->vol);
+            ret = ntfs_attr_preallocate(dst, src->data_size, FALSE);
+            if (!bestFit)
+                NVolClearBestFit(dst_ni->vol);
+            if (ret)
+                goto cleanup;
+        }
+    }
+
+    // Copy the runs holding data of plain sparse streams, anything else from start to end
+    if (holes && !compressed && !(src->data_flags & ATTR_COMPRESSION_MASK)) {
+        if (ntfs_attr_map_whole_runlist(src))
+            goto cleanup;
+        bits = src_ni->vol->cluster_size_bits;
+        for (rl = src->rl; rl->length; rl++) {
+            if (rl->lcn < 0)
+                continue;
+            start = rl->vcn << bits;
+            end = MIN((rl->vcn + rl->length) << bits, src->initialized_size);
+            if (start < end && !ntfsCopyRange(src, dst, start, end - start, buf, uncached, false))
+                goto cleanup;
+        }
+    } else if (!ntfsCopyRange(src, dst, 0, src->data_size, buf, uncached, holes && !compressed)) {
+        goto cleanup;
+    }
+
+    // Compressed data is only complete once its last compression block is written out
+    if (compressed && ntfs_attr_pclose(dst))
+        goto cleanup;
+
+    res = true;
+
+cleanup:
+
+    // Close both streams
+    if (dst)
+        ntfs_attr_close(dst);
+    if (src)
+        ntfs_attr_close(src);
+
+    return res;
+}
+
+bool ntfsCopyFile (const char *src, const char *dst, int flags)
+{
+    ntfs_log_trace("src %s, dst %s, flags %i\n", src, dst, flags);
+
+    ntfs_vd *src_vd = NULL, *dst_vd = NULL;
+    ntfs_inode *src_ni = NULL, *dst_ni = NULL;
+    ntfs_attr_search_ctx *ctx = NULL;
+    ntfs_file_state *file;
+    ntfschar name[NTFS_MAX_NAME_LEN];
+    ATTR_RECORD *a;
+    bool owned = true;
+    bool created = false;
+    bool res = false;
+    u32 name_len;
+    u8 *buf = NULL;
+
+    // Sanity check
+    if (!src || !dst || (flags & ~(NTFS_COPY_OVERWRITE | NTFS_COPY_UNCACHED))) {
+        errno = EINVAL;
+        return false;
+    }
+
+    // Get the volume descriptors for both paths
+    src_vd = ntfsGetVolume(src, true);
+    dst_vd = ntfsGetVolume(dst, true);
+    if (!src_vd || !dst_vd) {
+        errno = ENODEV;
+        return false;
+    }
+
+    // You cannot copy to a read-only mount
+    if (NVolReadOnly(dst_vd->vol)) {
+        errno = EROFS;
+        return false;
+    }
+
+    // Transfers go straight between the device and an aligned buffer of their own
+    buf = (u8 *) memalign(32, NTFS_COPY_BUFFER_SIZE);
+    if (!buf) {
+        errno = ENOMEM;
+        return false;
+    }
+
+    // Lock both partitions for the whole copy, always in the same order so that copies going the other way can not deadlock
+    ntfsLock(src_vd < dst_vd ? src_vd : dst_vd);
+    ntfsLock(src_vd < dst_vd ? dst_vd : src_vd);
+
+    // Run any checks the destination must pass before it is written to
+    if (ntfsCheckDeferred(dst_vd))
+        goto cleanup;
+
+    // Find the file to copy and ensure that it is not a directory
+    src_ni = ntfsOpenEntry(src_vd, src);
+    if (!src_ni)
+        goto cleanup;
+    if (src_ni->mrec->flags & MFT_RECORD_IS_DIRECTORY) {
+        errno = EISDIR;
+        goto cleanup;
+    }
+
+    // An open descriptor may hold data that has not reached the record yet, copy through its entry instead
+    file = ntfsFindOpenFile(src_vd, src_ni);
+    if (file) {
+        ntfs_inode_real_close(src_ni);
+        src_ni = file->ni;
+        owned = false;
+        if (file->data_na && !ntfsFlushWriteBuffer(file))
+            goto cleanup;
+    }
+
+    // Replace the destination if it exists (and we are allowed to)
+    dst_ni = ntfsOpenEntry(dst_vd, dst);
+    if (dst_ni) {
+        if (dst_vd == src_vd && dst_ni->mft_no == src_ni->mft_no)
+            errno = EINVAL;
+        else if (!(flags & NTFS_COPY_OVERWRITE))
+            errno = EEXIST;
+        else if (dst_ni->mrec->flags & MFT_RECORD_IS_DIRECTORY)
+            errno = EISDIR;
+        else if (ntfsFindOpenFile(dst_vd, dst_ni))
+            errno = EBUSY;
+        else
+            errno = 0;
+        if (errno) {
+            ntfs_inode_real_close(dst_ni);
+            dst_ni = NULL;
+            goto cleanup;
+        }
+        ntfsCloseEntry(dst_vd, dst_ni);
+        dst_ni = NULL;
+        if (ntfsUnlink(dst_vd, dst, 0))
+            goto cleanup;
+    } else if (errno != ENOENT) {
+        goto cleanup;
+    }
+
+    // Create the copy
+    dst_ni = ntfsCreate(dst_vd, dst, S_IFREG, NULL);
+    if (!dst_ni)
+        goto cleanup;
+    created = true;
+
+    // Copy every data stream, taking each from the first extent of its attribute
+    ctx = ntfs_attr_get_search_ctx(src_ni, NULL);
+    if (!ctx)
+        goto cleanup;
+    while (!ntfs_attr_lookup(AT_DATA, NULL, 0, CASE_SENSITIVE, 0, NULL, 0, ctx)) {
+        a = ctx->attr;
+        if (a->non_resident && a->lowest_vcn)
+            continue;
+        name_len = MIN(a->name_length, NTFS_MAX_NAME_LEN);
+        memcpy(name, (u8 *) a + le16_to_cpu(a->name_offset), name_len * sizeof(ntfschar));
+        if (!ntfsCopyStream(src_ni, dst_ni, name_len ? name : AT_UNNAMED, name_len, buf,
+                            (flags & NTFS_COPY_UNCACHED) ? true : false))
+            goto cleanup;
+    }
+    if (errno != ENOENT)
+        goto cleanup;
+
+    // Mark the copy for archiving and update file times
+    dst_ni->flags |= FILE_ATTR_ARCHIVE;
+    ntfsUpdateTimes(dst_vd, dst_ni, NTFS_UPDATE_MCTIME);
+    ntfsUpdateTimes(src_vd, src_ni, NTFS_UPDATE_ATIME);
+
+    res = true;
+
+cleanup:
+
+    // Close both entries, removing a copy that could not be finished
+    if (ctx)
+        ntfs_attr_put_search_ctx(ctx);
+    if (src_ni && owned) {
+        int err = errno;
+        ntfsCloseEntry(src_vd, src_ni);
+        errno = err;
+    }
+    if (dst_ni) {
+        int err = errno;
+        if (res)
+            ntfsSyncDeferred(dst_vd, dst_ni);
+        ntfsCloseEntry(dst_vd, dst_ni);
+        if (!res && created)
+            ntfsUnlink(dst_vd, dst, 0);
+        errno = err;
+    }
+
+    // Unlock
+    ntfsUnlock(src_vd < dst_vd ? dst_vd : src_vd);
+    ntfsUnlock(src_vd < dst_vd ? src_vd : dst_vd);
+
+    free(buf);
+
+    return res;
 }
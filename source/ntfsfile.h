@@ -30,6 +30,29 @@
 #include "ntfsinternal.h"
 #include <sys/reent.h>
 
+/* Smallest write-behind buffer, volumes with larger clusters buffer a whole cluster */
+#define NTFS_WRITE_BUFFER_SIZE              4096
+
+/* Bytes moved at a time by ntfsCopyFile */
+#define NTFS_COPY_BUFFER_SIZE               (1024 * 1024)
+
+/* Clusters allocated ahead of a file growing at its end, doubling each time from the smallest to the largest amount */
+#define NTFS_GROW_WINDOW_MIN                65536
+#define NTFS_GROW_WINDOW_MAX                (16 * 1024 * 1024)
+
+/* Milliseconds a file may go without being read or written before its runlist is released, to be decoded again when next needed */
+#define NTFS_RUNLIST_IDLE_TIME              2000
+
+/**
+ * ntfs_file_mapping - A range of a file mapped by ntfsMapRange
+ */
+typedef struct _ntfs_file_mapping {
+    const void *ptr;                        /* Address the range was mapped at */
+    void *page;                             /* Pinned device cache page holding the range, or NULL if copied */
+    u8 *buffer;                             /* Buffer the range was copied into, or NULL if pinned in place */
+    struct _ntfs_file_mapping *next;        /* The next mapping of the same file */
+} ntfs_file_mapping;
+
 /**
  * ntfs_file_state - File state
  */
@@ -43,14 +66,26 @@ typedef struct _ntfs_file_state {
     bool append;                            /* True if allowed to append to file */
     bool compressed;                        /* True if file data is compressed */
     bool encrypted;                         /* True if file data is encryted */
+    bool uncached;                          /* True if file data bypasses the device cache */
     off_t pos;                              /* Current position within the file (in bytes) */
     u64 len;                                /* Total length of the file (in bytes) */
+    u8 *writeBuffer;                        /* Write-behind buffer gathering small contiguous writes, or NULL if not yet allocated */
+    size_t writeBufferSize;                 /* Size of the write-behind buffer (in bytes) */
+    off_t writeBufferPos;                   /* Position within the file of the buffered data (in bytes) */
+    size_t writeBufferLen;                  /* Amount of data waiting in the write-behind buffer (in bytes) */
+    s64 growEnd;                            /* End of the allocation made ahead of the data (in bytes), or 0 if none to trim */
+    s64 growWindow;                         /* Amount to allocate ahead of the data the next time the file outgrows its allocation (in bytes) */
+    ntfs_file_mapping *mappings;            /* Ranges of the file currently mapped, most recent first */
+    u64 lastUsed;                           /* Time the file data was last read or written */
+    mutex_t lock;                           /* Serialises readers of this file while they share the volume lock */
     struct _ntfs_file_state *prevOpenFile;  /* The previous entry in a double-linked FILO list of open files */
     struct _ntfs_file_state *nextOpenFile;  /* The next entry in a double-linked FILO list of open files */
 } ntfs_file_state;
 
 /* File state routines */
 void ntfsCloseFile (ntfs_file_state *file);
+ntfs_file_state *ntfsGetFileState (int fd);
+void ntfsReleaseIdleRunlists (ntfs_vd *vd);
 
 /* Gekko devoptab file routines for NTFS-based devices */
 extern int ntfs_open_r (struct _reent *r, void *fileStruct, const char *path, int flags, int mode);
@@ -38,6 +38,9 @@
 #include "ntfsinternal.h"
 #include "ntfsdir.h"
 #include "ntfsfile.h"
+#include "ntfsscan.h"
+#include "ntfsstats.h"
+#include "gekko_io.h"
 
 #if defined(__wii__)
 #include <sdcard/wiisd_io.h>
@@ -89,14 +92,20 @@ int ntfsAddDevice (const char *name, void *deviceData)
     devname = (char*)(dev + 1);
     strcpy(devname, name);
 
-    // Setup the devoptab
+    // Setup the devoptab, timing every call if the volume keeps operation statistics
+    if (((ntfs_vd*)deviceData)->opStats)
+        devoptab_ntfs = ntfsGetOpStatsDevOpTab();
     memcpy(dev, devoptab_ntfs, sizeof(devoptab_t));
     dev->name = devname;
     dev->deviceData = deviceData;
 
     // Add the device to the devoptab table (if there is a free slot)
-    if (AddDevice(dev) >= 0)
+    ntfs_device_gekko_io_lock_devices();
+    if (AddDevice(dev) >= 0) {
+        ntfs_device_gekko_io_unlock_devices();
         return 0;
+    }
+    ntfs_device_gekko_io_unlock_devices();
 
     // If we reach here then there are no free slots in the devoptab table for this device
     errno = EADDRNOTAVAIL;
@@ -111,7 +120,9 @@ void ntfsRemoveDevice (const char *name)
     sprintf(devname, "%s:", name);
 
     // Find and remove the specified device from the devoptab table
+    ntfs_device_gekko_io_lock_devices();
     RemoveDevice(devname);
+    ntfs_device_gekko_io_unlock_devices();
 }
 
 const devoptab_t *ntfsGetDevice (const char *path, bool useDefaultDevice)
@@ -133,17 +144,106 @@ const INTERFACE_ID *ntfsGetDiscInterfaces (void)
     return ntfs_disc_interfaces;
 }
 
+bool ntfsIsOurDevOpTab (const devoptab_t *devoptab)
+{
+    const devoptab_t *devoptab_ntfs = ntfsGetDevOpTab();
+
+    // Mounts keeping operation statistics are given the timing devoptab instead of the plain one
+    return devoptab && devoptab_ntfs && (devoptab->open_r == devoptab_ntfs->open_r ||
+                                         devoptab->open_r == ntfsGetOpStatsDevOpTab()->open_r);
+}
+
 ntfs_vd *ntfsGetVolume (const char *path, bool useDefaultDevice)
 {
     // Get the volume descriptor from the paths associated devoptab (if found)
-    const devoptab_t *devoptab_ntfs = ntfsGetDevOpTab();
     const devoptab_t *devoptab = ntfsGetDevice(path, useDefaultDevice);
-    if (devoptab && devoptab_ntfs && (devoptab->open_r == devoptab_ntfs->open_r))
+    if (ntfsIsOurDevOpTab(devoptab))
         return (ntfs_vd*)devoptab->deviceData;
 
     return NULL;
 }
 
+void ntfsLock (ntfs_vd *vd)
+{
+    lwp_t self = LWP_GetSelf();
+    u64 start = 0;
+
+    LWP_MutexLock(vd->lock);
+
+    // The owner may take the lock again, as the volume routines call each other
+    if (vd->lockOwner == self) {
+        vd->lockDepth++;
+        LWP_MutexUnlock(vd->lock);
+        return;
+    }
+
+    // Wait for the owner and all readers to let go, holding back new readers meanwhile
+    vd->lockWriters++;
+    if (vd->opStats && (vd->lockOwner != LWP_THREAD_NULL || vd->lockReaders))
+        start = gettime();
+    while (vd->lockOwner != LWP_THREAD_NULL || vd->lockReaders)
+        LWP_CondWait(vd->lockCond, vd->lock);
+    vd->lockWriters--;
+    if (start)
+        ntfsRecordLockWait(vd, start);
+    vd->lockOwner = self;
+    vd->lockDepth = 1;
+
+    LWP_MutexUnlock(vd->lock);
+}
+
+void ntfsUnlock (ntfs_vd *vd)
+{
+    LWP_MutexLock(vd->lock);
+
+    if (vd->lockOwner == LWP_GetSelf() && --vd->lockDepth == 0) {
+        vd->lockOwner = LWP_THREAD_NULL;
+        LWP_CondBroadcast(vd->lockCond);
+    }
+
+    LWP_MutexUnlock(vd->lock);
+}
+
+void ntfsLockShared (ntfs_vd *vd)
+{
+    u64 start = 0;
+
+    LWP_MutexLock(vd->lock);
+
+    // The owner already excludes everyone else, so it just takes the lock again
+    if (vd->lockOwner == LWP_GetSelf()) {
+        vd->lockDepth++;
+        LWP_MutexUnlock(vd->lock);
+        return;
+    }
+
+    if (vd->opStats && (vd->lockOwner != LWP_THREAD_NULL || vd->lockWriters))
+        start = gettime();
+    while (vd->lockOwner != LWP_THREAD_NULL || vd->lockWriters)
+        LWP_CondWait(vd->lockCond, vd->lock);
+    vd->lockReaders++;
+    if (start)
+        ntfsRecordLockWait(vd, start);
+
+    LWP_MutexUnlock(vd->lock);
+}
+
+void ntfsUnlockShared (ntfs_vd *vd)
+{
+    LWP_MutexLock(vd->lock);
+
+    if (vd->lockOwner == LWP_GetSelf()) {
+        if (--vd->lockDepth == 0) {
+            vd->lockOwner = LWP_THREAD_NULL;
+            LWP_CondBroadcast(vd->lockCond);
+        }
+    } else if (vd->lockReaders && --vd->lockReaders == 0) {
+        LWP_CondBroadcast(vd->lockCond);
+    }
+
+    LWP_MutexUnlock(vd->lock);
+}
+
 int ntfsInitVolume (ntfs_vd *vd)
 {
     // Sanity check
@@ -154,6 +254,11 @@ int ntfsInitVolume (ntfs_vd *vd)
 
     // Initialise the volume lock
     LWP_MutexInit(&vd->lock, false);
+    LWP_CondInit(&vd->lockCond);
+    vd->lockOwner = LWP_THREAD_NULL;
+    vd->lockDepth = 0;
+    vd->lockReaders = 0;
+    vd->lockWriters = 0;
 
     // Reset the volumes name cache
     vd->name[0] = '\0';
@@ -161,11 +266,28 @@ int ntfsInitVolume (ntfs_vd *vd)
     // Reset the volumes current directory
     vd->cwd_ni = NULL;
 
+    // No security id has been shared between new entries yet
+    vd->securid = const_cpu_to_le32(0);
+
+    // Nothing has been left dirty yet
+    vd->lazySyncStart = 0;
+
+    // Initialise the group commit
+    LWP_MutexInit(&vd->commitLock, false);
+    LWP_CondInit(&vd->commitCond);
+    vd->commitPending = 0;
+    vd->commitRunning = false;
+    vd->commitStarted = 0;
+    vd->commitDone = 0;
+    vd->commitFailed = 0;
+    vd->commitErrno = 0;
+
     // Reset open directory and file stats
     vd->openDirCount = 0;
     vd->openFileCount = 0;
     vd->firstOpenDir = NULL;
     vd->firstOpenFile = NULL;
+    vd->firstOpenScan = NULL;
 
     return 0;
 }
@@ -197,11 +319,15 @@ void ntfsDeinitVolume (ntfs_vd *vd)
         nextFile = nextFile->nextOpenFile;
     }
 
+    // Leave any scans which are still open with nothing to scan
+    ntfsDetachScans(vd);
+
     // Reset open directory and file stats
     vd->openDirCount = 0;
     vd->openFileCount = 0;
     vd->firstOpenDir = NULL;
     vd->firstOpenFile = NULL;
+    vd->firstOpenScan = NULL;
 
     // Close the volumes current directory (if any)
     if (vd->cwd_ni) {
@@ -215,9 +341,18 @@ void ntfsDeinitVolume (ntfs_vd *vd)
     // Unlock
     ntfsUnlock(vd);
 
+    // Deinitialise the group commit
+    LWP_CondDestroy(vd->commitCond);
+    LWP_MutexDestroy(vd->commitLock);
+
     // Deinitialise the volume lock
+    LWP_CondDestroy(vd->lockCond);
     LWP_MutexDestroy(vd->lock);
 
+    // Release the operation statistics, once nothing is left to wait for the lock
+    ntfsDestroyOpRecorder(vd->opStats);
+    vd->opStats = NULL;
+
     return;
 }
 
@@ -275,7 +410,7 @@ ntfs_inode *ntfsParseEntry (ntfs_vd *vd, const char *path, int reparseLevel)
             ntfsCloseEntry(vd, ni);
 
             // Parse the entries target
-            ni = ntfsParseEntry(vd, target, reparseLevel++);
+            ni = ntfsParseEntry(vd, target, reparseLevel + 1);
 
             // Clean up
             ntfs_free(target);
@@ -298,17 +433,54 @@ void ntfsCloseEntry (ntfs_vd *vd, ntfs_inode *ni)
 
     // Sync the entry (if it is dirty)
     if (NInoDirty(ni))
-        ntfsSync(vd, ni);
+        ntfsSyncDeferred(vd, ni);
 
     // Close the entry
     ntfs_inode_close(ni);
 
+    // Clear some of the clusters left queued by unlinks and truncations, a slice at a time
+    ntfs_cluster_free_flush(vd->vol, NTFS_FREE_QUEUE_SLICE);
+
+    // Release the runlists of the files which have not been used for a while
+    ntfsReleaseIdleRunlists(vd);
+
+    // Write back the entries left dirty once the oldest has waited long enough
+    if (vd->lazySyncStart && vd->lazySyncAge &&
+        diff_ticks(vd->lazySyncStart, gettime()) >= millisecs_to_ticks(vd->lazySyncAge))
+        ntfsSyncAll(vd);
+
     // Unlock
     ntfsUnlock(vd);
 
     return;
 }
 
+le32 ntfsCreateSecurityId (ntfs_vd *vd)
+{
+    struct SECURITY_CONTEXT scx;
+
+    // Each new entry gets a security descriptor of its own, unless permissions are skipped
+    if (!vd->noPermissions || vd->securid || !vd->vol->secure_ni)
+        return vd->securid;
+
+    // Find the descriptor giving everybody full access in $Secure (adding it the first time), once per mount
+    memset(&scx, 0, sizeof(struct SECURITY_CONTEXT));
+    scx.vol = vd->vol;
+    vd->securid = ntfs_alloc_securid(&scx, vd->uid, vd->gid, 0777, TRUE);
+
+    return vd->securid;
+}
+
+int ntfsCheckDeferred (ntfs_vd *vd)
+{
+    // Nothing left to check (or the checks have already run)
+    if (!vd->vol->deferred_flags)
+        return 0;
+
+    // Finish the checks a fast mount left for the first write, with no entries open that they could open again
+    return ntfs_volume_check_deferred(vd->vol);
+}
+
 ntfs_inode *ntfsCreate (ntfs_vd *vd, const char *path, mode_t type, const char *target)
 {
     ntfs_inode *dir_ni = NULL, *ni = NULL;
@@ -342,6 +514,10 @@ ntfs_inode *ntfsCreate (ntfs_vd *vd, const char *path, mode_t type, const char *
     // Lock
     ntfsLock(vd);
 
+    // Run any checks the volume must pass before it is written to
+    if (ntfsCheckDeferred(vd))
+        goto cleanup;
+
     // Get the unicode name for the entry and find its parent directory
     // TODO: This looks horrible, clean it up
     dir = strdup(path);
@@ -372,6 +548,9 @@ ntfs_inode *ntfsCreate (ntfs_vd *vd, const char *path, mode_t type, const char *
         goto cleanup;
     }
 
+    // Read the rest of any open iteration of the parent directory before it changes
+    ntfsSnapshotOpenDirs(vd, dir_ni);
+
     // Create the entry
     switch (type) {
 
@@ -386,13 +565,13 @@ ntfs_inode *ntfsCreate (ntfs_vd *vd, const char *path, mode_t type, const char *
                 errno = EINVAL;
                 goto cleanup;
             }
-            ni = ntfs_create_symlink(dir_ni, 0, uname, uname_len,  utarget, utarget_len);
+            ni = ntfs_create_symlink(dir_ni, ntfsCreateSecurityId(vd), uname, uname_len,  utarget, utarget_len);
             break;
 
         // Directory or file
         case S_IFDIR:
         case S_IFREG:
-            ni = ntfs_create(dir_ni, 0, uname, uname_len, type);
+            ni = ntfs_create(dir_ni, ntfsCreateSecurityId(vd), uname, uname_len, type);
             break;
 
     }
@@ -407,7 +586,7 @@ ntfs_inode *ntfsCreate (ntfs_vd *vd, const char *path, mode_t type, const char *
         NInoSetDirty(ni);
 
         // Sync the entry to disc
-        ntfsSync(vd, ni);
+        ntfsSyncDeferred(vd, ni);
 
         // Update parent directories times
         ntfsUpdateTimes(vd, dir_ni, NTFS_UPDATE_MCTIME);
@@ -466,6 +645,12 @@ int ntfsLink (ntfs_vd *vd, const char *old_path, const char *new_path)
     // Lock
     ntfsLock(vd);
 
+    // Run any checks the volume must pass before it is written to
+    if (ntfsCheckDeferred(vd)) {
+        res = -1;
+        goto cleanup;
+    }
+
     // Get the unicode name for the entry and find its parent directory
     // TODO: This looks horrible, clean it up
     dir = strdup(new_path);
@@ -501,6 +686,9 @@ int ntfsLink (ntfs_vd *vd, const char *old_path, const char *new_path)
         goto cleanup;
     }
 
+    // Read the rest of any open iteration of the parent directory before it changes
+    ntfsSnapshotOpenDirs(vd, dir_ni);
+
     // Link the entry to its new parent
     if (ntfs_link(ni, dir_ni, uname, uname_len)) {
         res = -1;
@@ -511,7 +699,7 @@ int ntfsLink (ntfs_vd *vd, const char *old_path, const char *new_path)
     ntfsUpdateTimes(vd, dir_ni, NTFS_UPDATE_MCTIME);
 
     // Sync the entry to disc
-    ntfsSync(vd, ni);
+    ntfsSyncDeferred(vd, ni);
 
 cleanup:
 
@@ -558,6 +746,12 @@ int ntfsUnlink (ntfs_vd *vd, const char *path, mode_t type)
     // Lock
     ntfsLock(vd);
 
+    // Run any checks the volume must pass before it is written to
+    if (ntfsCheckDeferred(vd)) {
+        res = -1;
+        goto cleanup;
+    }
+
     // Get the unicode name for the entry and find its parent directory
     // TODO: This looks horrible
     dir = strdup(path);
@@ -613,12 +807,16 @@ int ntfsUnlink (ntfs_vd *vd, const char *path, mode_t type)
         goto cleanup;
     }
 
+    // Read the rest of any open iteration of the parent directory before it changes
+    ntfsSnapshotOpenDirs(vd, dir_ni);
+
     // Unlink the entry from its parent
     if (ntfs_delete(vd->vol, path, ni, dir_ni, uname, uname_len)) {
         res = -1;
     }
 
-    // Force the underlying device to sync
+    // Write back the freed clusters and force the underlying device to sync
+    ntfs_cluster_bitmap_sync(vd->vol);
     ntfs_device_sync(vd->dev);
 
     // ntfs_delete() ALWAYS closes ni and dir_ni; so no need for us to anymore
@@ -644,7 +842,7 @@ cleanup:
     return res;
 }
 
-int ntfsSync (ntfs_vd *vd, ntfs_inode *ni)
+int ntfsSyncEntry (ntfs_vd *vd, ntfs_inode *ni)
 {
     int res = 0;
 
@@ -666,14 +864,175 @@ int ntfsSync (ntfs_vd *vd, ntfs_inode *ni)
     // Sync the entry
     res = ntfs_inode_sync(ni);
 
-    // Force the underlying device to sync
-    ntfs_device_sync(vd->dev);
+    // Write back the entries left dirty by lazy sync, as the device is about to be synced anyway
+    if (vd->lazySyncStart) {
+        ntfs_inode_sync_cached(vd->vol);
+        vd->lazySyncStart = 0;
+    }
+
+    // Write back the cluster bitmap updates held by the allocator
+    if (ntfs_cluster_bitmap_sync(vd->vol))
+        res = -1;
 
     // Unlock
     ntfsUnlock(vd);
 
     return res;
+}
+
+void ntfsCommitJoin (ntfs_vd *vd)
+{
+    // Let a commit about to start know that this sync is on its way
+    LWP_MutexLock(vd->commitLock);
+    vd->commitPending++;
+    LWP_MutexUnlock(vd->commitLock);
+}
+
+void ntfsCommitLeave (ntfs_vd *vd)
+{
+    // The sync will not come after all, so stop any commit waiting for it
+    LWP_MutexLock(vd->commitLock);
+    vd->commitPending--;
+    LWP_CondBroadcast(vd->commitCond);
+    LWP_MutexUnlock(vd->commitLock);
+}
+
+int ntfsCommit (ntfs_vd *vd, bool joined)
+{
+    struct timespec interval;
+    u64 generation, end, now;
+    bool held;
+    int res;
+
+    // Sanity check
+    if (!vd) {
+        errno = ENODEV;
+        return -1;
+    }
+
+    // A caller holding the volume lock keeps other syncs from getting here, so it must not wait for them
+    LWP_MutexLock(vd->lock);
+    held = (vd->lockOwner == LWP_GetSelf());
+    LWP_MutexUnlock(vd->lock);
+
+    LWP_MutexLock(vd->commitLock);
+
+    if (joined) {
+        vd->commitPending--;
+        LWP_CondBroadcast(vd->commitCond);
+    }
+
+    // Whatever was written before now is only on the device once a commit starting from here on has finished
+    generation = vd->commitStarted + 1;
+    while (vd->commitDone < generation) {
+
+        // Share the commit of whoever is leading one
+        if (vd->commitRunning) {
+            LWP_CondWait(vd->commitCond, vd->commitLock);
+            continue;
+        }
+
+        // Lead this one, giving the syncs under way a little while to join it first
+        vd->commitRunning = true;
+        if (!held && vd->commitWindow && vd->commitPending) {
+            end = gettime() + microsecs_to_ticks(vd->commitWindow);
+            while (vd->commitPending && (now = gettime()) < end) {
+                interval.tv_sec = ticks_to_secs(end - now);
+                interval.tv_nsec = ticks_to_nanosecs(end - now) % 1000000000;
+                LWP_CondTimedWait(vd->commitCond, vd->commitLock, &interval);
+            }
+        }
+        vd->commitStarted = generation;
+        LWP_MutexUnlock(vd->commitLock);
+
+        // Write the device cache back in one sorted pass and flush the device, once for everyone waiting
+        res = ntfs_device_sync(vd->dev);
+
+        LWP_MutexLock(vd->commitLock);
+        if (res) {
+            vd->commitFailed = generation;
+            vd->commitErrno = errno;
+        }
+        vd->commitDone = generation;
+        vd->commitRunning = false;
+        LWP_CondBroadcast(vd->commitCond);
+    }
+
+    // Fail if this commit, or a later one that also covered it, did
+    res = 0;
+    if (vd->commitFailed >= generation) {
+        errno = vd->commitErrno;
+        res = -1;
+    }
+
+    LWP_MutexUnlock(vd->commitLock);
+
+    return res;
+}
 
+int ntfsSync (ntfs_vd *vd, ntfs_inode *ni)
+{
+    int res;
+
+    // Write back the entry, then sync the device along with any other syncs doing the same
+    res = ntfsSyncEntry(vd, ni);
+    if (vd && ntfsCommit(vd, false))
+        res = -1;
+
+    return res;
+}
+
+int ntfsSyncDeferred (ntfs_vd *vd, ntfs_inode *ni)
+{
+    // Sanity check
+    if (!vd) {
+        errno = ENODEV;
+        return -1;
+    }
+
+    // Sync the entry now, unless lazy sync leaves it dirty in the inode cache once it is closed
+    if (!NVolLazySync(vd->vol))
+        return ntfsSync(vd, ni);
+
+    // Remember how long the oldest entry has been waiting
+    ntfsLock(vd);
+    if (!vd->lazySyncStart)
+        vd->lazySyncStart = gettime();
+    ntfsUnlock(vd);
+
+    return 0;
+}
+
+int ntfsSyncAll (ntfs_vd *vd)
+{
+    int res = 0;
+
+    // Sanity check
+    if (!vd) {
+        errno = ENODEV;
+        return -1;
+    }
+
+    // Lock
+    ntfsLock(vd);
+
+    // Write back the entries left dirty by lazy sync
+    if (ntfs_inode_sync_cached(vd->vol))
+        res = -1;
+    vd->lazySyncStart = 0;
+
+    // Clear the clusters left queued by unlinks and truncations, then write back the cluster bitmap updates held by the allocator
+    if (ntfs_cluster_free_flush(vd->vol, -1) || ntfs_cluster_bitmap_sync(vd->vol))
+        res = -1;
+
+    // Force the underlying device to sync
+    if (!NVolReadOnly(vd->vol) && ntfs_device_sync(vd->dev))
+        res = -1;
+
+    // Unlock
+    ntfsUnlock(vd);
+
+    return res;
 }
 
 int ntfsStat (ntfs_vd *vd, ntfs_inode *ni, struct stat *st)
@@ -755,6 +1114,10 @@ void ntfsUpdateTimes (ntfs_vd *vd, ntfs_inode *ni, ntfs_time_update_flags mask)
     if (vd && vd->atime == ATIME_DISABLED)
         mask &= ~NTFS_UPDATE_ATIME;
 
+    // Reading is no reason to write to a volume which has not passed the checks a fast mount left for its first write
+    if (vd && vd->vol->deferred_flags)
+        mask &= ~NTFS_UPDATE_ATIME;
+
     // Update entry times
     if (ni && mask)
         ntfs_inode_update_times(ni, mask);
@@ -781,6 +1144,7 @@ const char *ntfsRealPath (const char *path)
 
 int ntfsUnicodeToLocal (const ntfschar *ins, const int ins_len, char **outs, int outs_len)
 {
+    char *buf = *outs;
     int len = 0;
     int i;
 
@@ -788,32 +1152,18 @@ int ntfsUnicodeToLocal (const ntfschar *ins, const int ins_len, char **outs, int
     if (!ins || !ins_len || !outs)
         return 0;
 
-    char * ucstombs_out = NULL;
-
-    // Convert the unicode string to our current local
-    len = ntfs_ucstombs(ins, ins_len, &ucstombs_out, outs_len);
-
-    if(ucstombs_out)
-    {
-        //use proper allocation
-        *outs = (char *) ntfs_malloc(strlen(ucstombs_out) + 1);
-        if(!*outs)
-        {
-            errno = ENOMEM;
-            return -1;
-        }
-        strcpy(*outs, ucstombs_out);
-        free(ucstombs_out);
-        ucstombs_out = NULL;
-    }
+    // Convert the unicode string to our current local, straight into the callers buffer if given one
+    if (!buf)
+        outs_len = 0;
+    len = ntfs_ucstombs(ins, ins_len, outs, outs_len);
 
     if (len == -1 && errno == EILSEQ)
     {
         // The string could not be converted to the current local,
         // do it manually by replacing non-ASCII characters with underscores
-        if (!*outs || outs_len >= ins_len)
+        if (!buf || outs_len > ins_len)
         {
-            if (!*outs)
+            if (!buf)
             {
                 *outs = (char *) ntfs_malloc(ins_len + 1);
                 if (!*outs) {
@@ -825,9 +1175,9 @@ int ntfsUnicodeToLocal (const ntfschar *ins, const int ins_len, char **outs, int
                 ntfschar uc = le16_to_cpu(ins[i]);
                 if (uc > 0xff)
                     uc = (ntfschar)'_';
-                *outs[i] = (char)uc;
+                (*outs)[i] = (char)uc;
             }
-            *outs[ins_len] = (ntfschar)'\0';
+            (*outs)[ins_len] = '\0';
             len = ins_len;
         }
     }
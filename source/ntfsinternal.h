@@ -36,6 +36,7 @@
 #include "dir.h"
 #include "inode.h"
 #include "attrib.h"
+#include "lcnalloc.h"
 #include "reparse.h"
 #include "security.h"
 #include "efs.h"
@@ -50,11 +51,16 @@
 #define NTFS_MAX_PARTITIONS                 32 /* Maximum number of partitions that can be found */
 #define NTFS_MAX_MOUNTS                     10 /* Maximum number of mounts available at one time */
 #define NTFS_MAX_SYMLINK_DEPTH              10 /* Maximum search depth when resolving symbolic links */
+#define NTFS_MAX_NAME_BYTES                 (NTFS_MAX_NAME_LEN * 3 + 1) /* Maximum size of a local (UTF-8) name, with its terminator */
 
 #define NTFS_OEM_ID                         cpu_to_le64(0x202020205346544eULL) /* "NTFS    " */
 
 #define MBR_SIGNATURE                       cpu_to_le16(0xAA55)
 #define EBR_SIGNATURE                       cpu_to_le16(0xAA55)
+#define GPT_SIGNATURE                       cpu_to_le64(0x5452415020494645ULL) /* "EFI PART" */
+
+#define NTFS_PROBE_SECTORS                  64 /* Sectors read in one go from the start of a device to find its partitions */
+#define NTFS_MAX_GPT_ENTRIES_SIZE           (1024 * 1024) /* Largest GUID partition entry array that will be read */
 
 #define PARTITION_STATUS_NONBOOTABLE        0x00 /* Non-bootable */
 #define PARTITION_STATUS_BOOTABLE           0x80 /* Bootable (active) */
@@ -63,10 +69,12 @@
 #define PARTITION_TYPE_DOS33_EXTENDED       0x05 /* DOS 3.3+ extended partition */
 #define PARTITION_TYPE_NTFS                 0x07 /* Windows NT NTFS */
 #define PARTITION_TYPE_WIN95_EXTENDED       0x0F /* Windows 95 extended partition */
+#define PARTITION_TYPE_GPT_PROTECTIVE       0xEE /* Protective partition covering a GUID partition table */
 
 /* Forward declarations */
 struct _ntfs_file_state;
 struct _ntfs_dir_state;
+struct _ntfs_op_recorder;
 
 /**
  * PRIMARY_PARTITION - Block device partition record
@@ -100,6 +108,38 @@ typedef struct _EXTENDED_BOOT_RECORD {
     u16 signature;                          /* EBR signature; 0xAA55 */
 } __attribute__((__packed__)) EXTENDED_BOOT_RECORD;
 
+/**
+ * GPT_HEADER - GUID partition table header
+ */
+typedef struct _GPT_HEADER {
+    u64 signature;                          /* GPT signature; "EFI PART" */
+    u32 revision;                           /* Revision of the header format */
+    u32 header_size;                        /* Size of this header in bytes */
+    u32 header_crc32;                       /* CRC32 of the header, computed with this field zeroed */
+    u32 reserved;                           /* Must be zero */
+    u64 current_lba;                        /* Sector holding this header */
+    u64 backup_lba;                         /* Sector holding the other header */
+    u64 first_usable_lba;                   /* First sector partitions may use */
+    u64 last_usable_lba;                    /* Last sector partitions may use */
+    u8 disk_guid[16];                       /* Disk identifier */
+    u64 partition_entry_lba;                /* First sector of the partition entry array */
+    u32 num_partition_entries;              /* Number of entries in the array */
+    u32 sizeof_partition_entry;             /* Size of each entry in bytes */
+    u32 partition_entry_array_crc32;        /* CRC32 of the whole entry array */
+} __attribute__((__packed__)) GPT_HEADER;
+
+/**
+ * GPT_PARTITION_ENTRY - GUID partition table entry
+ */
+typedef struct _GPT_PARTITION_ENTRY {
+    u8 type_guid[16];                       /* Partition type; all zero if the entry is unused */
+    u8 unique_guid[16];                     /* Partition identifier */
+    u64 first_lba;                          /* First sector of partition */
+    u64 last_lba;                           /* Last sector of partition (inclusive) */
+    u64 attributes;                         /* Attribute flags */
+    u16 name[36];                           /* Partition name (UTF-16LE) */
+} __attribute__((__packed__)) GPT_PARTITION_ENTRY;
+
 /**
  * INTERFACE_ID - Disc interface identifier
  */
@@ -122,7 +162,12 @@ typedef enum {
 typedef struct _ntfs_vd {
     struct ntfs_device *dev;                /* NTFS device handle */
     ntfs_volume *vol;                       /* NTFS volume handle */
-    mutex_t lock;                           /* Volume lock mutex */
+    mutex_t lock;                           /* Volume lock mutex, guards the lock state below */
+    cond_t lockCond;                        /* Wakes threads waiting for the volume lock */
+    lwp_t lockOwner;                        /* Thread holding the volume lock exclusively, or LWP_THREAD_NULL */
+    u32 lockDepth;                          /* Number of times the owner has taken the volume lock */
+    u32 lockReaders;                        /* Number of threads sharing the volume lock */
+    u32 lockWriters;                        /* Number of threads waiting to take the volume lock exclusively */
     s64 id;                                 /* Filesystem id */
     u32 flags;                              /* Mount flags */
     char name[128];                         /* Volume name (cached) */
@@ -130,31 +175,42 @@ typedef struct _ntfs_vd {
     u16 gid;                                /* Group id for entry creation */
     u16 fmask;                              /* Unix style permission mask for file creation */
     u16 dmask;                              /* Unix style permission mask for directory creation */
+    bool noPermissions;                     /* New entries share one security id instead of each having a security descriptor */
+    le32 securid;                           /* Security id shared by new entries, 0 until the first is created */
     ntfs_atime_t atime;                     /* Entry access time update strategy */
+    u32 lazySyncAge;                        /* Milliseconds an entry may stay dirty under lazy sync before it is written back */
+    u64 lazySyncStart;                      /* Time the oldest entry left dirty by lazy sync was closed, or 0 if there are none */
+    mutex_t commitLock;                     /* Group commit mutex, guards the commit state below */
+    cond_t commitCond;                      /* Wakes threads waiting for a group commit, or for fsyncs to join one */
+    u32 commitWindow;                       /* Microseconds a group commit waits for the fsyncs under way to join it */
+    u32 commitPending;                      /* Number of fsyncs writing back their entry that have yet to join a commit */
+    bool commitRunning;                     /* A thread is leading a group commit */
+    u64 commitStarted;                      /* Generation of the last group commit to start flushing the device */
+    u64 commitDone;                         /* Generation of the last group commit to finish */
+    u64 commitFailed;                       /* Generation of the last group commit that failed, 0 if none has */
+    int commitErrno;                        /* Why it failed */
+    struct NTFS_BUDGET budget;              /* Memory the device cache and the other caches of the volume share out */
+    struct _ntfs_op_recorder *opStats;      /* Operation statistics, or NULL unless mounted with NTFS_OP_STATS */
     ntfs_inode *cwd_ni;                     /* Current directory */
     struct _ntfs_dir_state *firstOpenDir;   /* The start of a FILO linked list of currently opened directories */
     struct _ntfs_file_state *firstOpenFile; /* The start of a FILO linked list of currently opened files */
+    struct _ntfs_scan *firstOpenScan;       /* The start of a FILO linked list of currently open volume scans */
     u16 openDirCount;                       /* The total number of directories currently open in this volume */
     u16 openFileCount;                      /* The total number of files currently open in this volume */
 } ntfs_vd;
 
-/* Lock volume */
-static inline void ntfsLock (ntfs_vd *vd)
-{
-    LWP_MutexLock(vd->lock);
-}
-
-/* Unlock volume */
-static inline void ntfsUnlock (ntfs_vd *vd)
-{
-    LWP_MutexUnlock(vd->lock);
-}
+/* Volume locking routines */
+void ntfsLock (ntfs_vd *vd);
+void ntfsUnlock (ntfs_vd *vd);
+void ntfsLockShared (ntfs_vd *vd);
+void ntfsUnlockShared (ntfs_vd *vd);
 
 /* Gekko device related routines */
 int ntfsAddDevice (const char *name, void *deviceData);
 void ntfsRemoveDevice (const char *name);
 const devoptab_t *ntfsGetDevice (const char *path, bool useDefaultDevice);
 const devoptab_t *ntfsGetDevOpTab (void);
+bool ntfsIsOurDevOpTab (const devoptab_t *devoptab);
 const INTERFACE_ID* ntfsGetDiscInterfaces (void);
 
 /* Miscellaneous helper/support routines */
@@ -165,9 +221,17 @@ ntfs_inode *ntfsOpenEntry (ntfs_vd *vd, const char *path);
 ntfs_inode *ntfsParseEntry (ntfs_vd *vd, const char *path, int reparseLevel);
 void ntfsCloseEntry (ntfs_vd *vd, ntfs_inode *ni);
 ntfs_inode *ntfsCreate (ntfs_vd *vd, const char *path, mode_t type, const char *target);
+le32 ntfsCreateSecurityId (ntfs_vd *vd);
+int ntfsCheckDeferred (ntfs_vd *vd);
 int ntfsLink (ntfs_vd *vd, const char *old_path, const char *new_path);
 int ntfsUnlink (ntfs_vd *vd, const char *path, mode_t type);
 int ntfsSync (ntfs_vd *vd, ntfs_inode *ni);
+int ntfsSyncEntry (ntfs_vd *vd, ntfs_inode *ni);
+void ntfsCommitJoin (ntfs_vd *vd);
+void ntfsCommitLeave (ntfs_vd *vd);
+int ntfsCommit (ntfs_vd *vd, bool joined);
+int ntfsSyncDeferred (ntfs_vd *vd, ntfs_inode *ni);
+int ntfsSyncAll (ntfs_vd *vd);
 int ntfsStat (ntfs_vd *vd, ntfs_inode *ni, struct stat *st);
 void ntfsUpdateTimes (ntfs_vd *vd, ntfs_inode *ni, ntfs_time_update_flags mask);
 
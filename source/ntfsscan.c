@@ -0,0 +1,900 @@
+/**
+ * ntfsscan.c - Whole volume scans in MFT order for NTFS-based devices.
+ *
+ * This program/include file is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program/include file is distributed in the hope that it will be
+ * useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+#ifdef HAVE_ERRNO_H
+#include <errno.h>
+#endif
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+
+#include "ntfs.h"
+#include "ntfsinternal.h"
+#include "ntfsdir.h"
+#include "ntfsfile.h"
+#include "ntfsscan.h"
+
+/**
+ * PRIVATE: Leave the scans of a volume which is going away with nothing more to scan
+ */
+void ntfsDetachScans (ntfs_vd *vd)
+{
+    ntfs_scan *scan;
+
+    for (scan = vd->firstOpenScan; scan; scan = scan->nextOpenScan) {
+        ntfs_log_warning("Detaching orphaned volume scan @ %p\n", scan);
+        scan->vd = NULL;
+    }
+
+    return;
+}
+
+/**
+ * PRIVATE: Read the next window of the MFT which has records in use, from the first of them to the last
+ *
+ * @return 1 if records were read, 0 once past the end of the MFT or -1 if an error occurred (see errno)
+ */
+static int ntfsScanReadWindow (ntfs_scan *scan)
+{
+    ntfs_volume *vol = scan->vd->vol;
+    s64 total, count, bytes, i;
+    s64 first = -1, last = -1;
+
+    // Write back the records left dirty by lazy sync, so that the MFT holds them as they are
+    if (scan->vd->lazySyncStart) {
+        ntfs_inode_sync_cached(vol);
+        scan->vd->lazySyncStart = 0;
+    }
+
+    for (;;) {
+
+        // Move on to the window after the last one, stopping at the end of the initialised records
+        scan->windowStart = scan->windowEnd;
+        total = vol->mft_na->initialized_size >> vol->mft_record_size_bits;
+        if (scan->windowStart >= total)
+            return 0;
+        count = MIN(scan->windowRecords, total - scan->windowStart);
+        scan->windowEnd = scan->windowStart + count;
+
+        // Read the bits of the window from the MFT bitmap, anything it does not cover is not in use
+        bytes = (count + 7) >> 3;
+        i = ntfs_attr_pread(vol->mftbmp_na, scan->windowStart >> 3, bytes, scan->bitmap);
+        if (i < 0)
+            return -1;
+        if (i < bytes)
+            memset(scan->bitmap + i, 0, bytes - i);
+
+        // Find the first and last records in use, whole bytes at a time
+        for (i = 0; i < bytes && first < 0; i++) {
+            if (scan->bitmap[i])
+                first = (i << 3) + __builtin_ctz(scan->bitmap[i]);
+        }
+        for (i = bytes - 1; i >= 0 && last < 0; i--) {
+            if (scan->bitmap[i])
+                last = (i << 3) + 31 - __builtin_clz(scan->bitmap[i]);
+        }
+        last = MIN(last, count - 1);
+        if (first >= 0 && first <= last)
+            break;
+        first = last = -1;
+    }
+
+    // Read the records between them in one go
+    scan->readStart = scan->windowStart + first;
+    scan->readEnd = scan->windowStart + last + 1;
+    count = scan->readEnd - scan->readStart;
+    ntfs_attr_prefetch(vol->mft_na, scan->readStart << vol->mft_record_size_bits, count << vol->mft_record_size_bits);
+    if (ntfs_mft_records_read(vol, scan->readStart, count, (MFT_RECORD *) scan->records))
+        return -1;
+    scan->record = scan->readStart;
+
+    return 1;
+}
+
+/**
+ * PRIVATE: Take the status of the record being scanned from its attributes
+ *
+ * @return true if the names of the record are to be handed out
+ */
+static bool ntfsScanRecord (ntfs_scan *scan, MFT_RECORD *m)
+{
+    ntfs_volume *vol = scan->vd->vol;
+    u32 offset, bytes_in_use = le32_to_cpu(m->bytes_in_use);
+    u64 mft_no = scan->record;
+    bool found = false, metadata, hidden;
+
+    // Only base records in use have names of their own
+    if (!(scan->bitmap[(mft_no - scan->windowStart) >> 3] & (1 << ((mft_no - scan->windowStart) & 7))))
+        return false;
+    if (!ntfs_is_file_record(m->magic) || !(m->flags & MFT_RECORD_IN_USE) || m->base_mft_record)
+        return false;
+    if (mft_no == FILE_root || bytes_in_use > vol->mft_record_size || le16_to_cpu(m->attrs_offset) >= bytes_in_use)
+        return false;
+
+    scan->dataSize = scan->allocatedSize = -1;
+
+    // Walk the attributes, looking for the standard information and the unnamed data stream
+    for (offset = le16_to_cpu(m->attrs_offset); offset + 8 <= bytes_in_use; ) {
+        ATTR_RECORD *a = (ATTR_RECORD *) ((u8 *) m + offset);
+        u32 length;
+
+        if (a->type == AT_END)
+            break;
+        length = le32_to_cpu(a->length);
+        if (length < offsetof(ATTR_RECORD, resident_end) || length > bytes_in_use - offset)
+            break;
+
+        if (a->type == AT_STANDARD_INFORMATION && !a->non_resident &&
+            le32_to_cpu(a->value_length) >= offsetof(STANDARD_INFORMATION, v1_end) &&
+            le16_to_cpu(a->value_offset) + le32_to_cpu(a->value_length) <= length) {
+            STANDARD_INFORMATION *si = (STANDARD_INFORMATION *) ((u8 *) a + le16_to_cpu(a->value_offset));
+            scan->attributes = le32_to_cpu(si->file_attributes);
+            scan->lastAccessTime = si->last_access_time;
+            scan->lastDataChangeTime = si->last_data_change_time;
+            scan->lastMftChangeTime = si->last_mft_change_time;
+            found = true;
+        } else if (a->type == AT_DATA && !a->name_length) {
+            if (!a->non_resident) {
+                scan->dataSize = le32_to_cpu(a->value_length);
+                scan->allocatedSize = (scan->dataSize + 7) & ~7;
+            } else if (length >= offsetof(ATTR_RECORD, non_resident_end) && !a->lowest_vcn) {
+                scan->dataSize = sle64_to_cpu(a->data_size);
+                scan->allocatedSize = sle64_to_cpu(a->allocated_size);
+            }
+        }
+
+        offset += length;
+    }
+    if (!found)
+        return false;
+
+    // Leave out what the mount hides, as a directory listing does
+    metadata = (mft_no < FILE_first_user);
+    hidden = (scan->attributes & FILE_ATTR_HIDDEN);
+    if (!((!metadata && (NVolShowHidFiles(vol) || !hidden)) ||
+          (NVolShowSysFiles(vol) && (NVolShowHidFiles(vol) || metadata))))
+        return false;
+
+    if (m->flags & MFT_RECORD_IS_DIRECTORY)
+        scan->attributes |= FILE_ATTR_DIRECTORY;
+
+    scan->attrOffset = le16_to_cpu(m->attrs_offset);
+
+    return true;
+}
+
+/**
+ * PRIVATE: Hand out the next name of the record being scanned
+ *
+ * @return 1 if a name was found, 0 if the record has no more names or -1 if an error occurred (see errno)
+ */
+static int ntfsScanName (ntfs_scan *scan, MFT_RECORD *m, ntfs_scan_entry *entry)
+{
+    ntfs_volume *vol = scan->vd->vol;
+    u32 bytes_in_use = le32_to_cpu(m->bytes_in_use);
+    ntfschar loname[NTFS_MAX_NAME_LEN];
+    const ntfschar *name;
+    char *entry_name;
+    ntfs_dir_entry dirent;
+    FILE_NAME_ATTR *fn;
+
+    while (scan->attrOffset + 8 <= bytes_in_use) {
+        ATTR_RECORD *a = (ATTR_RECORD *) ((u8 *) m + scan->attrOffset);
+        u32 length, value_length;
+
+        if (a->type == AT_END)
+            break;
+        length = le32_to_cpu(a->length);
+        if (length < offsetof(ATTR_RECORD, resident_end) || length > bytes_in_use - scan->attrOffset)
+            break;
+        scan->attrOffset += length;
+
+        // Names are always resident, and short DOS names only duplicate a long one
+        if (a->type != AT_FILE_NAME || a->non_resident)
+            continue;
+        value_length = le32_to_cpu(a->value_length);
+        if (value_length < sizeof(FILE_NAME_ATTR) || le16_to_cpu(a->value_offset) + value_length > length)
+            continue;
+        fn = (FILE_NAME_ATTR *) ((u8 *) a + le16_to_cpu(a->value_offset));
+        if (fn->file_name_type == FILE_NAME_DOS || !fn->file_name_length ||
+            sizeof(FILE_NAME_ATTR) + fn->file_name_length * sizeof(ntfschar) > value_length)
+            continue;
+
+        // Convert the name to our current local, lowercased when the mount ignores case
+        name = fn->file_name;
+        if (!NVolCaseSensitive(vol)) {
+            memcpy(loname, fn->file_name, fn->file_name_length * sizeof(ntfschar));
+            ntfs_name_locase(loname, fn->file_name_length, vol->locase, vol->upcase_len);
+            name = loname;
+        }
+        entry_name = scan->name;
+        if (ntfsUnicodeToLocal(name, fn->file_name_length, &entry_name, sizeof(scan->name)) < 0)
+            return -1;
+
+        // Fill in the entry, with the sizes held by the data stream when the base record has them
+        dirent.mref = MK_MREF(scan->record, le16_to_cpu(m->sequence_number));
+        if (m->flags & MFT_RECORD_IS_DIRECTORY)
+            dirent.type = NTFS_DT_DIR;
+        else if (scan->attributes & FILE_ATTR_REPARSE_POINT)
+            dirent.type = NTFS_DT_REPARSE;
+        else
+            dirent.type = NTFS_DT_REG;
+        if (scan->dataSize >= 0) {
+            dirent.data_size = scan->dataSize;
+            dirent.allocated_size = scan->allocatedSize;
+        } else {
+            dirent.data_size = sle64_to_cpu(fn->data_size);
+            dirent.allocated_size = sle64_to_cpu(fn->allocated_size);
+        }
+        dirent.last_access_time = scan->lastAccessTime;
+        dirent.last_data_change_time = scan->lastDataChangeTime;
+        dirent.last_mft_change_time = scan->lastMftChangeTime;
+
+        entry->mref = dirent.mref;
+        entry->parent = le64_to_cpu(fn->parent_directory);
+        entry->name = scan->name;
+        entry->attributes = scan->attributes;
+        ntfsDirEntryStat(scan->vd, &dirent, &entry->st);
+
+        // Keep the path of the name for whoever is tracking them
+        if (scan->tree && !ntfsPathTreeSet(scan->tree, entry->mref, entry->parent, entry->name, dirent.type == NTFS_DT_DIR))
+            return -1;
+
+        return 1;
+    }
+
+    return 0;
+}
+
+ntfs_scan *ntfsScanOpen (const char *name)
+{
+    ntfs_vd *vd = NULL;
+    ntfs_scan *scan = NULL;
+    u32 bits;
+
+    // Sanity check
+    if (!name) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    // Get the devices volume descriptor
+    vd = ntfsGetVolume(name, false);
+    if (!vd) {
+        errno = ENODEV;
+        return NULL;
+    }
+
+    // Allocate the scan along with room for a window of records and its bits
+    scan = (ntfs_scan *) ntfs_calloc(sizeof(ntfs_scan));
+    if (!scan)
+        return NULL;
+    bits = vd->vol->mft_record_size_bits;
+    scan->windowRecords = MAX((NTFS_SCAN_CHUNK_SIZE >> bits) & ~7, 8);
+    scan->records = (u8 *) ntfs_malloc(scan->windowRecords << bits);
+    scan->bitmap = (u8 *) ntfs_malloc(scan->windowRecords >> 3);
+    if (!scan->records || !scan->bitmap) {
+        ntfs_free(scan->records);
+        ntfs_free(scan->bitmap);
+        ntfs_free(scan);
+        return NULL;
+    }
+    scan->vd = vd;
+
+    // Lock
+    ntfsLock(vd);
+
+    // Insert the scan into the double-linked FILO list of open scans
+    if (vd->firstOpenScan) {
+        scan->nextOpenScan = vd->firstOpenScan;
+        vd->firstOpenScan->prevOpenScan = scan;
+    } else {
+        scan->nextOpenScan = NULL;
+    }
+    scan->prevOpenScan = NULL;
+    vd->firstOpenScan = scan;
+
+    // Unlock
+    ntfsUnlock(vd);
+
+    return scan;
+}
+
+int ntfsScanNext (ntfs_scan *scan, ntfs_scan_entry *entry)
+{
+    MFT_RECORD *m;
+    int res = 0;
+
+    // Sanity check
+    if (!scan || !entry) {
+        errno = EINVAL;
+        return -1;
+    }
+    if (!scan->vd) {
+        errno = ENODEV;
+        return -1;
+    }
+
+    // Lock
+    ntfsLock(scan->vd);
+
+    for (;;) {
+
+        // Move on to the next record with names to hand out, reading further windows as needed
+        while (!scan->attrOffset) {
+            if (scan->record >= scan->readEnd) {
+                res = ntfsScanReadWindow(scan);
+                if (res <= 0)
+                    goto unlock;
+            }
+            m = (MFT_RECORD *) (scan->records + ((scan->record - scan->readStart) << scan->vd->vol->mft_record_size_bits));
+            if (!ntfsScanRecord(scan, m))
+                scan->record++;
+        }
+
+        // Hand out its next name, or move past it once there are none left
+        m = (MFT_RECORD *) (scan->records + ((scan->record - scan->readStart) << scan->vd->vol->mft_record_size_bits));
+        res = ntfsScanName(scan, m, entry);
+        if (res)
+            break;
+        scan->attrOffset = 0;
+        scan->record++;
+    }
+
+unlock:
+
+    // Unlock
+    ntfsUnlock(scan->vd);
+
+    return res;
+}
+
+bool ntfsScanTrackPaths (ntfs_scan *scan, ntfs_path_tree *tree)
+{
+    // Sanity check
+    if (!scan) {
+        errno = EINVAL;
+        return false;
+    }
+
+    scan->tree = tree;
+
+    return true;
+}
+
+void ntfsScanClose (ntfs_scan *scan)
+{
+    // Sanity check
+    if (!scan)
+        return;
+
+    // Remove the scan from the double-linked FILO list of open scans, unless its volume has gone already
+    if (scan->vd) {
+        ntfsLock(scan->vd);
+        if (scan->nextOpenScan)
+            scan->nextOpenScan->prevOpenScan = scan->prevOpenScan;
+        if (scan->prevOpenScan)
+            scan->prevOpenScan->nextOpenScan = scan->nextOpenScan;
+        else
+            scan->vd->firstOpenScan = scan->nextOpenScan;
+        ntfsUnlock(scan->vd);
+    }
+
+    // Free the scan
+    ntfs_free(scan->records);
+    ntfs_free(scan->bitmap);
+    ntfs_free(scan);
+
+    return;
+}
+
+/**
+ * PRIVATE: Add the extents of a runlist to the layout of the streams
+ *
+ * @return The number of extents of the runlist
+ */
+static u64 ntfsFragAddRunlist (ntfs_frag_stats *stats, const runlist_element *rl, bool compressed)
+{
+    u64 extents = 0, length = 0;
+    LCN next = LCN_HOLE;
+
+    for (; rl->length; rl++) {
+        if (rl->lcn == LCN_HOLE)
+            stats->sparseClusters += rl->length;
+        if (rl->lcn < 0)
+            continue;
+
+        // Runs which follow each other on the disc make up one extent
+        if (rl->lcn != next) {
+            extents++;
+            length = 0;
+        }
+        length += rl->length;
+        next = rl->lcn + rl->length;
+        stats->largestExtent = MAX(stats->largestExtent, length);
+        stats->clusters += rl->length;
+        if (compressed)
+            stats->compressedClusters += rl->length;
+    }
+    stats->extents += extents;
+
+    return extents;
+}
+
+/**
+ * PRIVATE: Fill in the figures derived from the others, and those of the MFT itself
+ */
+static bool ntfsFragFinish (ntfs_vd *vd, ntfs_frag_stats *stats)
+{
+    ntfs_volume *vol = vd->vol;
+    ntfs_frag_stats mft = { 0 };
+
+    if (ntfs_attr_map_whole_runlist(vol->mft_na))
+        return false;
+    stats->mftExtents = ntfsFragAddRunlist(&mft, vol->mft_na->rl, false);
+    stats->mftClusters = mft.clusters;
+    stats->averageExtent = stats->extents ? stats->clusters / stats->extents : 0;
+    stats->clusterSize = vol->cluster_size;
+
+    return true;
+}
+
+bool ntfsGetFileFragStats (const char *path, ntfs_frag_stats *stats)
+{
+    ntfs_vd *vd = NULL;
+    ntfs_inode *ni = NULL;
+    ntfs_attr *na = NULL, *data_na;
+    ntfs_file_state *file;
+    bool res = false;
+
+    // Sanity check
+    if (!path || !stats) {
+        errno = EINVAL;
+        return false;
+    }
+
+    // Get the volume descriptor for this path
+    vd = ntfsGetVolume(path, true);
+    if (!vd) {
+        errno = ENODEV;
+        return false;
+    }
+
+    // Lock
+    ntfsLock(vd);
+
+    // Find the file
+    ni = ntfsOpenEntry(vd, path);
+    if (!ni)
+        goto cleanup;
+
+    // Use the runlist of an open descriptor of the file, which may be ahead of the record, else read the stream's own
+    data_na = NULL;
+    for (file = vd->firstOpenFile; file; file = file->nextOpenFile) {
+        if (file->ni && file->ni->mft_no == ni->mft_no) {
+            data_na = file->data_na;
+            break;
+        }
+    }
+    if (data_na) {
+
+        // Drop our copy of the entry without leaving it in the inode cache, where it would shadow the open one
+        ntfs_inode_real_close(ni);
+        ni = NULL;
+    } else {
+        na = ntfs_attr_open(ni, AT_DATA, AT_UNNAMED, 0);
+        if (!na)
+            goto cleanup;
+        data_na = na;
+    }
+
+    // Decode the whole runlist and count its extents
+    memset(stats, 0, sizeof(ntfs_frag_stats));
+    if (NAttrNonResident(data_na)) {
+        if (ntfs_attr_map_whole_runlist(data_na))
+            goto cleanup;
+        stats->streams = 1;
+        if (ntfsFragAddRunlist(stats, data_na->rl, NAttrCompressed(data_na)) > 1)
+            stats->fragmentedStreams = 1;
+    }
+    res = ntfsFragFinish(vd, stats);
+
+cleanup:
+
+    // Close the data attribute and the file
+    if (na)
+        ntfs_attr_close(na);
+    if (ni)
+        ntfsCloseEntry(vd, ni);
+
+    // Unlock
+    ntfsUnlock(vd);
+
+    return res;
+}
+
+bool ntfsGetVolumeFragStats (const char *name, ntfs_frag_stats *stats)
+{
+    ntfs_scan *scan = NULL;
+    ntfs_volume *vol;
+    runlist_element *rl;
+    MFT_RECORD *m;
+    s64 record;
+    u64 base, extents;
+    int res;
+
+    // Sanity check
+    if (!name || !stats) {
+        errno = EINVAL;
+        return false;
+    }
+
+    // Read the MFT as a scan does, without handing out any names
+    scan = ntfsScanOpen(name);
+    if (!scan)
+        return false;
+    vol = scan->vd->vol;
+    memset(stats, 0, sizeof(ntfs_frag_stats));
+
+    // Lock
+    ntfsLock(scan->vd);
+
+    while ((res = ntfsScanReadWindow(scan)) > 0) {
+        for (record = scan->readStart; record < scan->readEnd; record++) {
+            u32 offset, bytes_in_use;
+
+            // Take every record in use, extents along with base records, but leave out those of the system files
+            if (!(scan->bitmap[(record - scan->windowStart) >> 3] & (1 << ((record - scan->windowStart) & 7))))
+                continue;
+            m = (MFT_RECORD *) (scan->records + ((record - scan->readStart) << vol->mft_record_size_bits));
+            if (!ntfs_is_file_record(m->magic) || !(m->flags & MFT_RECORD_IN_USE))
+                continue;
+            base = m->base_mft_record ? MREF_LE(m->base_mft_record) : (u64) record;
+            bytes_in_use = le32_to_cpu(m->bytes_in_use);
+            if (base < FILE_first_user || bytes_in_use > vol->mft_record_size)
+                continue;
+
+            // Decode the runlist of each part of a non-resident data stream held by the record
+            for (offset = le16_to_cpu(m->attrs_offset); offset + 8 <= bytes_in_use; ) {
+                ATTR_RECORD *a = (ATTR_RECORD *) ((u8 *) m + offset);
+                u32 length;
+
+                if (a->type == AT_END)
+                    break;
+                length = le32_to_cpu(a->length);
+                if (length < offsetof(ATTR_RECORD, resident_end) || length > bytes_in_use - offset)
+                    break;
+                offset += length;
+                if (a->type != AT_DATA || !a->non_resident || length < offsetof(ATTR_RECORD, non_resident_end) ||
+                    le16_to_cpu(a->mapping_pairs_offset) >= length)
+                    continue;
+                rl = ntfs_mapping_pairs_decompress(vol, a, NULL);
+                if (!rl) {
+                    ntfs_log_debug("Could not decode a runlist of inode %lld\n", (long long) base);
+                    continue;
+                }
+                extents = ntfsFragAddRunlist(stats, rl, (a->flags & ATTR_IS_COMPRESSED) != 0);
+                free(rl);
+
+                // Count each stream once, from its first part, fragmented when it spans several records
+                if (!a->lowest_vcn) {
+                    stats->streams++;
+                    if (extents > 1 || ((sle64_to_cpu(a->highest_vcn) + 1) << vol->cluster_size_bits) < sle64_to_cpu(a->allocated_size))
+                        stats->fragmentedStreams++;
+                }
+            }
+        }
+    }
+    if (!res && !ntfsFragFinish(scan->vd, stats))
+        res = -1;
+
+    // Unlock
+    ntfsUnlock(scan->vd);
+
+    ntfsScanClose(scan);
+
+    return (res == 0);
+}
+
+/**
+ * PRIVATE: Hash an MFT number to the slot its node is looked for from
+ */
+static inline u32 ntfsPathTreeHash (ntfs_path_tree *tree, u64 mft_no)
+{
+    return ((u32) mft_no * 0x9e3779b1) & tree->slotMask;
+}
+
+/**
+ * PRIVATE: Find the slot holding the node of an MFT number, or the empty slot it would go in
+ */
+static u32 *ntfsPathTreeFind (ntfs_path_tree *tree, u64 mft_no)
+{
+    u32 i = ntfsPathTreeHash(tree, mft_no);
+
+    while (tree->slots[i] && MREF(tree->nodes[tree->slots[i] - 1].mref) != mft_no)
+        i = (i + 1) & tree->slotMask;
+
+    return &tree->slots[i];
+}
+
+/**
+ * PRIVATE: Double the number of slots of a path tree and hash its nodes into them again
+ */
+static bool ntfsPathTreeGrowSlots (ntfs_path_tree *tree)
+{
+    u32 *slots = tree->slots;
+    u32 count = (tree->slotMask + 1) << 1;
+    u32 i;
+
+    tree->slots = (u32 *) ntfs_calloc(count * sizeof(u32));
+    if (!tree->slots) {
+        tree->slots = slots;
+        return false;
+    }
+    tree->slotMask = count - 1;
+    for (i = 0; i < tree->nodeCount; i++)
+        *ntfsPathTreeFind(tree, MREF(tree->nodes[i].mref)) = i + 1;
+    ntfs_free(slots);
+
+    return true;
+}
+
+/**
+ * PRIVATE: Store a name in the name arena of a path tree, dropping the names no longer used once they take up much of it
+ */
+static bool ntfsPathTreeStoreName (ntfs_path_tree *tree, const char *name, u16 length, u32 *offset)
+{
+    char *names;
+    u32 size, i;
+
+    if (tree->namesUsed + length > tree->namesSize) {
+
+        // Copy the names still used into an arena of their own, or grow the arena when that will not make room
+        size = tree->namesSize;
+        if (tree->namesFree < tree->namesUsed / 2 || tree->namesUsed - tree->namesFree + length > size)
+            size = MAX(size * 2, tree->namesUsed - tree->namesFree + length);
+        names = (char *) ntfs_malloc(size);
+        if (!names)
+            return false;
+        tree->namesUsed = 0;
+        for (i = 0; i < tree->nodeCount; i++) {
+            memcpy(names + tree->namesUsed, tree->names + tree->nodes[i].nameOffset, tree->nodes[i].nameLength);
+            tree->nodes[i].nameOffset = tree->namesUsed;
+            tree->namesUsed += tree->nodes[i].nameLength;
+        }
+        ntfs_free(tree->names);
+        tree->names = names;
+        tree->namesSize = size;
+        tree->namesFree = 0;
+    }
+
+    memcpy(tree->names + tree->namesUsed, name, length);
+    *offset = tree->namesUsed;
+    tree->namesUsed += length;
+
+    return true;
+}
+
+ntfs_path_tree *ntfsPathTreeCreate (u32 flags)
+{
+    ntfs_path_tree *tree = NULL;
+
+    // Allocate the tree along with a few of each thing it holds, they grow as it does
+    tree = (ntfs_path_tree *) ntfs_calloc(sizeof(ntfs_path_tree));
+    if (!tree)
+        return NULL;
+    tree->flags = flags;
+    tree->nodeSize = 256;
+    tree->nodes = (ntfs_path_node *) ntfs_malloc(tree->nodeSize * sizeof(ntfs_path_node));
+    tree->slotMask = 511;
+    tree->slots = (u32 *) ntfs_calloc((tree->slotMask + 1) * sizeof(u32));
+    tree->namesSize = 4096;
+    tree->names = (char *) ntfs_malloc(tree->namesSize);
+    if (!tree->nodes || !tree->slots || !tree->names) {
+        ntfsPathTreeDestroy(tree);
+        return NULL;
+    }
+
+    return tree;
+}
+
+bool ntfsPathTreeSet (ntfs_path_tree *tree, u64 mref, u64 parent, const char *name, bool directory)
+{
+    ntfs_path_node *node;
+    size_t length;
+    u32 *slot;
+
+    // Sanity check
+    if (!tree || !name || !name[0] || strchr(name, PATH_SEP) || MREF(mref) == FILE_root) {
+        errno = EINVAL;
+        return false;
+    }
+    length = strlen(name);
+    if (length > 0xffff) {
+        errno = ENAMETOOLONG;
+        return false;
+    }
+
+    // Files are named from the path of their directory when only directories are kept
+    if (!directory && (tree->flags & NTFS_PATH_TREE_DIRS_ONLY))
+        return true;
+
+    // Move or rename the entry when the tree holds it already
+    slot = ntfsPathTreeFind(tree, MREF(mref));
+    if (*slot) {
+        node = &tree->nodes[*slot - 1];
+        node->mref = mref;
+        node->parent = parent;
+        if (node->nameLength != length || memcmp(tree->names + node->nameOffset, name, length)) {
+            tree->namesFree += node->nameLength;
+            node->nameLength = 0;
+            if (!ntfsPathTreeStoreName(tree, name, length, &node->nameOffset))
+                return false;
+            node->nameLength = length;
+        }
+        return true;
+    }
+
+    // Make room for another node, keeping the slots no more than three quarters full
+    if (tree->nodeCount == tree->nodeSize) {
+        node = (ntfs_path_node *) ntfs_realloc(tree->nodes, tree->nodeSize * 2 * sizeof(ntfs_path_node));
+        if (!node)
+            return false;
+        tree->nodes = node;
+        tree->nodeSize *= 2;
+    }
+    if ((tree->nodeCount + 1) * 4 > (tree->slotMask + 1) * 3) {
+        if (!ntfsPathTreeGrowSlots(tree))
+            return false;
+        slot = ntfsPathTreeFind(tree, MREF(mref));
+    }
+
+    // Add the entry
+    node = &tree->nodes[tree->nodeCount];
+    node->mref = mref;
+    node->parent = parent;
+    node->nameLength = 0;
+    if (!ntfsPathTreeStoreName(tree, name, length, &node->nameOffset))
+        return false;
+    node->nameLength = length;
+    *slot = ++tree->nodeCount;
+
+    return true;
+}
+
+bool ntfsPathTreeRemove (ntfs_path_tree *tree, u64 mref)
+{
+    u32 *slot;
+    u32 hole, i, k, index;
+
+    // Sanity check
+    if (!tree) {
+        errno = EINVAL;
+        return false;
+    }
+
+    // Find the entry
+    slot = ntfsPathTreeFind(tree, MREF(mref));
+    if (!*slot) {
+        errno = ENOENT;
+        return false;
+    }
+    index = *slot - 1;
+    tree->namesFree += tree->nodes[index].nameLength;
+
+    // Empty its slot, moving back the nodes after it which could not have their own slots
+    hole = slot - tree->slots;
+    for (i = (hole + 1) & tree->slotMask; tree->slots[i]; i = (i + 1) & tree->slotMask) {
+        k = ntfsPathTreeHash(tree, MREF(tree->nodes[tree->slots[i] - 1].mref));
+        if ((hole <= i) ? (hole < k && k <= i) : (hole < k || k <= i))
+            continue;
+        tree->slots[hole] = tree->slots[i];
+        hole = i;
+    }
+    tree->slots[hole] = 0;
+
+    // Fill the place of its node with the last one
+    if (index != --tree->nodeCount) {
+        tree->nodes[index] = tree->nodes[tree->nodeCount];
+        *ntfsPathTreeFind(tree, MREF(tree->nodes[index].mref)) = index + 1;
+    }
+
+    return true;
+}
+
+int ntfsPathTreeGetPath (ntfs_path_tree *tree, u64 mref, char *path, size_t size)
+{
+    ntfs_path_node *node;
+    size_t length = 0;
+    u64 ref;
+    u32 *slot;
+    int depth;
+
+    // Sanity check
+    if (!tree || !path) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    // Add up the names from the entry up to the root directory, checking that every ancestor is the one referred to
+    for (ref = mref, depth = 0; MREF(ref) != FILE_root; ref = node->parent, depth++) {
+        if (depth == NTFS_PATH_TREE_MAX_DEPTH) {
+            errno = ELOOP;
+            return -1;
+        }
+        slot = ntfsPathTreeFind(tree, MREF(ref));
+        if (!*slot) {
+            errno = ENOENT;
+            return -1;
+        }
+        node = &tree->nodes[*slot - 1];
+        if (MSEQNO(ref) && MSEQNO(ref) != MSEQNO(node->mref)) {
+            errno = ENOENT;
+            return -1;
+        }
+        length += 1 + node->nameLength;
+    }
+
+    // The root directory is a path of its own
+    if (!length) {
+        if (size < 2) {
+            errno = ERANGE;
+            return -1;
+        }
+        path[0] = PATH_SEP;
+        path[1] = '\0';
+        return 1;
+    }
+    if (length >= size) {
+        errno = ERANGE;
+        return -1;
+    }
+
+    // Fill in the path from its end
+    path[length] = '\0';
+    for (ref = mref, size = length; MREF(ref) != FILE_root; ref = node->parent) {
+        node = &tree->nodes[*ntfsPathTreeFind(tree, MREF(ref)) - 1];
+        size -= node->nameLength;
+        memcpy(path + size, tree->names + node->nameOffset, node->nameLength);
+        path[--size] = PATH_SEP;
+    }
+
+    return length;
+}
+
+void ntfsPathTreeDestroy (ntfs_path_tree *tree)
+{
+    // Sanity check
+    if (!tree)
+        return;
+
+    // Free the tree
+    ntfs_free(tree->nodes);
+    ntfs_free(tree->slots);
+    ntfs_free(tree->names);
+    ntfs_free(tree);
+
+    return;
+}
@@ -0,0 +1,83 @@
+/**
+ * ntfsscan.h - Whole volume scans in MFT order for NTFS-based devices.
+ *
+ * This program/include file is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program/include file is distributed in the hope that it will be
+ * useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef _NTFSSCAN_H
+#define _NTFSSCAN_H
+
+#include "ntfs.h"
+#include "ntfsinternal.h"
+
+#define NTFS_SCAN_CHUNK_SIZE            65536   /* Bytes of MFT records read at a time */
+#define NTFS_PATH_TREE_MAX_DEPTH        1024    /* Number of ancestors a path is looked up through before giving up on it */
+
+/**
+ * ntfs_path_node - A name kept by a path tree
+ */
+typedef struct _ntfs_path_node {
+    u64 mref;                               /* MFT reference of the entry */
+    u64 parent;                             /* MFT reference of the directory it is in */
+    u32 nameOffset;                         /* Offset of the name in the name arena */
+    u16 nameLength;                         /* Length of the name in bytes, without a terminator */
+} ntfs_path_node;
+
+/**
+ * ntfs_path_tree - Directory tree of a volume, kept in memory
+ */
+struct _ntfs_path_tree {
+    u32 flags;                              /* NTFS_PATH_TREE_* */
+    ntfs_path_node *nodes;                  /* Nodes in no particular order */
+    u32 nodeCount;
+    u32 nodeSize;                           /* Number of nodes there is room for */
+    u32 *slots;                             /* Open addressed hash of the nodes by MFT number, holding node index + 1 (0 for none) */
+    u32 slotMask;                           /* Number of slots - 1 */
+    char *names;                            /* Arena of names, including ones which are no longer used */
+    u32 namesUsed;
+    u32 namesSize;
+    u32 namesFree;                          /* Bytes of the arena held by names which are no longer used */
+};
+
+/**
+ * ntfs_scan - Volume scan state
+ */
+struct _ntfs_scan {
+    ntfs_vd *vd;                            /* Volume being scanned, or NULL once it has been unmounted */
+    u8 *bitmap;                             /* MFT bitmap bits of the window */
+    u8 *records;                            /* Records read from the window, from the first one in use to the last */
+    u32 windowRecords;                      /* Number of records one window spans (a multiple of 8) */
+    s64 windowStart;                        /* Number of the first record of the window */
+    s64 windowEnd;                          /* Number of the record after the window */
+    s64 readStart;                          /* Number of the first record held in records */
+    s64 readEnd;                            /* Number of the record after the last one held in records */
+    s64 record;                             /* Number of the record being handed out */
+    u32 attrOffset;                         /* Offset of the next attribute to look for names at, or 0 to move on to the next record */
+    u32 attributes;                         /* File attributes of the record being handed out */
+    s64 dataSize;                           /* Size of the unnamed data stream of the record, or -1 if it is not in the base record */
+    s64 allocatedSize;
+    ntfs_time lastAccessTime;               /* Times of the record being handed out */
+    ntfs_time lastDataChangeTime;
+    ntfs_time lastMftChangeTime;
+    char name[NTFS_MAX_NAME_BYTES];         /* Name handed out last */
+    ntfs_path_tree *tree;                   /* Tree each name handed out is added to, or NULL */
+    struct _ntfs_scan *prevOpenScan;        /* The previous entry in a double-linked FILO list of open scans */
+    struct _ntfs_scan *nextOpenScan;        /* The next entry in a double-linked FILO list of open scans */
+};
+
+/* Volume scan routines */
+void ntfsDetachScans (ntfs_vd *vd);
+
+#endif /* _NTFSSCAN_H */
@@ -0,0 +1,382 @@
+/**
+ * ntfsstats.c - Operation statistics for NTFS-based devices.
+ *
+ * This program/include file is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program/include file is distributed in the hope that it will be
+ * useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+#ifdef HAVE_ERRNO_H
+#include <errno.h>
+#endif
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+
+#include "ntfs.h"
+#include "ntfsinternal.h"
+#include "ntfsdir.h"
+#include "ntfsfile.h"
+#include "ntfsstats.h"
+
+ntfs_op_recorder *ntfsCreateOpRecorder (void)
+{
+    ntfs_op_recorder *recorder;
+
+    recorder = (ntfs_op_recorder *) ntfs_calloc(sizeof(ntfs_op_recorder));
+    if (!recorder)
+        return NULL;
+
+    if (LWP_MutexInit(&recorder->lock, false)) {
+        ntfs_free(recorder);
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    return recorder;
+}
+
+void ntfsDestroyOpRecorder (ntfs_op_recorder *recorder)
+{
+    if (!recorder)
+        return;
+
+    LWP_MutexDestroy(recorder->lock);
+    ntfs_free(recorder);
+}
+
+/**
+ * Add one timed call to the statistics of an entry point (or of the volume lock)
+ */
+static void ntfsRecordTime (ntfs_op_stats *stats, u64 start, bool failed)
+{
+    u64 time = ticks_to_microsecs(diff_ticks(start, gettime()));
+    int bucket = 0;
+
+    // Find the log2 bucket of the time taken, the last holding everything longer
+    if (time > 1)
+        bucket = MIN(63 - __builtin_clzll(time), NTFS_OP_HISTOGRAM_BUCKETS - 1);
+
+    stats->calls++;
+    if (failed)
+        stats->errors++;
+    stats->time += time;
+    if (time > stats->maxTime)
+        stats->maxTime = MIN(time, 0xFFFFFFFF);
+    stats->histogram[bucket]++;
+}
+
+static void ntfsRecordOp (ntfs_vd *vd, int op, u64 start, bool failed)
+{
+    ntfs_op_recorder *recorder;
+
+    // Calls on paths of no mounted volume fail before they reach one, and are not counted anywhere
+    if (!vd || !(recorder = vd->opStats))
+        return;
+
+    LWP_MutexLock(recorder->lock);
+    ntfsRecordTime(&recorder->stats.op[op], start, failed);
+    LWP_MutexUnlock(recorder->lock);
+}
+
+/**
+ * PRIVATE: Count a wait for the volume lock that started at START, called once it is taken
+ */
+void ntfsRecordLockWait (ntfs_vd *vd, u64 start)
+{
+    ntfs_op_recorder *recorder = vd->opStats;
+
+    LWP_MutexLock(recorder->lock);
+    ntfsRecordTime(&recorder->stats.lockWait, start, false);
+    LWP_MutexUnlock(recorder->lock);
+}
+
+void ntfsGetOpRecorderStats (ntfs_op_recorder *recorder, ntfs_volume_op_stats *stats)
+{
+    LWP_MutexLock(recorder->lock);
+    *stats = recorder->stats;
+    LWP_MutexUnlock(recorder->lock);
+}
+
+void ntfsResetOpRecorder (ntfs_op_recorder *recorder)
+{
+    LWP_MutexLock(recorder->lock);
+    memset(&recorder->stats, 0, sizeof(ntfs_volume_op_stats));
+    LWP_MutexUnlock(recorder->lock);
+}
+
+/*
+ * Each entry point is timed as a whole around the handler it wraps. The volume is found
+ * before the call, as closing or opening may change what the state it points to means.
+ */
+
+static int ntfs_stats_open_r (struct _reent *r, void *fileStruct, const char *path, int flags, int mode)
+{
+    ntfs_vd *vd = ntfsGetVolume(path, true);
+    u64 start = gettime();
+    int ret = ntfs_open_r(r, fileStruct, path, flags, mode);
+
+    ntfsRecordOp(vd, NTFS_OP_OPEN, start, ret == -1);
+    return ret;
+}
+
+static int ntfs_stats_close_r (struct _reent *r, void *fd)
+{
+    ntfs_vd *vd = ((ntfs_file_state *) fd)->vd;
+    u64 start = gettime();
+    int ret = ntfs_close_r(r, fd);
+
+    ntfsRecordOp(vd, NTFS_OP_CLOSE, start, ret == -1);
+    return ret;
+}
+
+static ssize_t ntfs_stats_write_r (struct _reent *r, void *fd, const char *ptr, size_t len)
+{
+    ntfs_vd *vd = ((ntfs_file_state *) fd)->vd;
+    u64 start = gettime();
+    ssize_t ret = ntfs_write_r(r, fd, ptr, len);
+
+    ntfsRecordOp(vd, NTFS_OP_WRITE, start, ret == -1);
+    return ret;
+}
+
+static ssize_t ntfs_stats_read_r (struct _reent *r, void *fd, char *ptr, size_t len)
+{
+    ntfs_vd *vd = ((ntfs_file_state *) fd)->vd;
+    u64 start = gettime();
+    ssize_t ret = ntfs_read_r(r, fd, ptr, len);
+
+    ntfsRecordOp(vd, NTFS_OP_READ, start, ret == -1);
+    return ret;
+}
+
+static off_t ntfs_stats_seek_r (struct _reent *r, void *fd, off_t pos, int dir)
+{
+    ntfs_vd *vd = ((ntfs_file_state *) fd)->vd;
+    u64 start = gettime();
+    off_t ret = ntfs_seek_r(r, fd, pos, dir);
+
+    ntfsRecordOp(vd, NTFS_OP_SEEK, start, ret == -1);
+    return ret;
+}
+
+static int ntfs_stats_fstat_r (struct _reent *r, void *fd, struct stat *st)
+{
+    ntfs_vd *vd = ((ntfs_file_state *) fd)->vd;
+    u64 start = gettime();
+    int ret = ntfs_fstat_r(r, fd, st);
+
+    ntfsRecordOp(vd, NTFS_OP_FSTAT, start, ret == -1);
+    return ret;
+}
+
+static int ntfs_stats_stat_r (struct _reent *r, const char *path, struct stat *st)
+{
+    ntfs_vd *vd = ntfsGetVolume(path, true);
+    u64 start = gettime();
+    int ret = ntfs_stat_r(r, path, st);
+
+    ntfsRecordOp(vd, NTFS_OP_STAT, start, ret == -1);
+    return ret;
+}
+
+static int ntfs_stats_unlink_r (struct _reent *r, const char *name)
+{
+    ntfs_vd *vd = ntfsGetVolume(name, true);
+    u64 start = gettime();
+    int ret = ntfs_unlink_r(r, name);
+
+    ntfsRecordOp(vd, NTFS_OP_UNLINK, start, ret == -1);
+    return ret;
+}
+
+static int ntfs_stats_chdir_r (struct _reent *r, const char *name)
+{
+    ntfs_vd *vd = ntfsGetVolume(name, true);
+    u64 start = gettime();
+    int ret = ntfs_chdir_r(r, name);
+
+    ntfsRecordOp(vd, NTFS_OP_CHDIR, start, ret == -1);
+    return ret;
+}
+
+static int ntfs_stats_rename_r (struct _reent *r, const char *oldName, const char *newName)
+{
+    ntfs_vd *vd = ntfsGetVolume(oldName, true);
+    u64 start = gettime();
+    int ret = ntfs_rename_r(r, oldName, newName);
+
+    ntfsRecordOp(vd, NTFS_OP_RENAME, start, ret == -1);
+    return ret;
+}
+
+static int ntfs_stats_mkdir_r (struct _reent *r, const char *path, int mode)
+{
+    ntfs_vd *vd = ntfsGetVolume(path, true);
+    u64 start = gettime();
+    int ret = ntfs_mkdir_r(r, path, mode);
+
+    ntfsRecordOp(vd, NTFS_OP_MKDIR, start, ret == -1);
+    return ret;
+}
+
+static DIR_ITER *ntfs_stats_diropen_r (struct _reent *r, DIR_ITER *dirState, const char *path)
+{
+    ntfs_vd *vd = ntfsGetVolume(path, true);
+    u64 start = gettime();
+    DIR_ITER *ret = ntfs_diropen_r(r, dirState, path);
+
+    ntfsRecordOp(vd, NTFS_OP_DIROPEN, start, ret == NULL);
+    return ret;
+}
+
+static int ntfs_stats_dirreset_r (struct _reent *r, DIR_ITER *dirState)
+{
+    ntfs_vd *vd = ((ntfs_dir_state *) dirState->dirStruct)->vd;
+    u64 start = gettime();
+    int ret = ntfs_dirreset_r(r, dirState);
+
+    ntfsRecordOp(vd, NTFS_OP_DIRRESET, start, ret == -1);
+    return ret;
+}
+
+static int ntfs_stats_dirnext_r (struct _reent *r, DIR_ITER *dirState, char *filename, struct stat *filestat)
+{
+    ntfs_vd *vd = ((ntfs_dir_state *) dirState->dirStruct)->vd;
+    u64 start = gettime();
+    int ret = ntfs_dirnext_r(r, dirState, filename, filestat);
+
+    // Running out of entries is how every listing ends, not a failure
+    ntfsRecordOp(vd, NTFS_OP_DIRNEXT, start, ret == -1 && r->_errno != ENOENT);
+    return ret;
+}
+
+static int ntfs_stats_dirclose_r (struct _reent *r, DIR_ITER *dirState)
+{
+    ntfs_vd *vd = ((ntfs_dir_state *) dirState->dirStruct)->vd;
+    u64 start = gettime();
+    int ret = ntfs_dirclose_r(r, dirState);
+
+    ntfsRecordOp(vd, NTFS_OP_DIRCLOSE, start, ret == -1);
+    return ret;
+}
+
+static int ntfs_stats_statvfs_r (struct _reent *r, const char *path, struct statvfs *buf)
+{
+    ntfs_vd *vd = ntfsGetVolume(path, true);
+    u64 start = gettime();
+    int ret = ntfs_statvfs_r(r, path, buf);
+
+    ntfsRecordOp(vd, NTFS_OP_STATVFS, start, ret == -1);
+    return ret;
+}
+
+static int ntfs_stats_ftruncate_r (struct _reent *r, void *fd, off_t len)
+{
+    ntfs_vd *vd = ((ntfs_file_state *) fd)->vd;
+    u64 start = gettime();
+    int ret = ntfs_ftruncate_r(r, fd, len);
+
+    ntfsRecordOp(vd, NTFS_OP_FTRUNCATE, start, ret == -1);
+    return ret;
+}
+
+static int ntfs_stats_fsync_r (struct _reent *r, void *fd)
+{
+    ntfs_vd *vd = ((ntfs_file_state *) fd)->vd;
+    u64 start = gettime();
+    int ret = ntfs_fsync_r(r, fd);
+
+    ntfsRecordOp(vd, NTFS_OP_FSYNC, start, ret == -1);
+    return ret;
+}
+
+static int ntfs_stats_rmdir_r (struct _reent *r, const char *path)
+{
+    ntfs_vd *vd = ntfsGetVolume(path, true);
+    u64 start = gettime();
+    int ret = ntfs_rmdir_r(r, path);
+
+    ntfsRecordOp(vd, NTFS_OP_RMDIR, start, ret == -1);
+    return ret;
+}
+
+static int ntfs_stats_lstat_r (struct _reent *r, const char *path, struct stat *st)
+{
+    ntfs_vd *vd = ntfsGetVolume(path, true);
+    u64 start = gettime();
+    int ret = ntfs_lstat_r(r, path, st);
+
+    ntfsRecordOp(vd, NTFS_OP_LSTAT, start, ret == -1);
+    return ret;
+}
+
+static int ntfs_stats_symlink_r (struct _reent *r, const char *target, const char *linkpath)
+{
+    ntfs_vd *vd = ntfsGetVolume(linkpath, true);
+    u64 start = gettime();
+    int ret = ntfs_symlink_r(r, target, linkpath);
+
+    ntfsRecordOp(vd, NTFS_OP_SYMLINK, start, ret == -1);
+    return ret;
+}
+
+/**
+ * The devoptab of volumes mounted with NTFS_OP_STATS, the same as the usual one but timed
+ */
+static const devoptab_t devops_ntfs_stats = {
+    NULL, /* Device name */
+    sizeof (ntfs_file_state),
+    ntfs_stats_open_r,
+    ntfs_stats_close_r,
+    ntfs_stats_write_r,
+    ntfs_stats_read_r,
+    ntfs_stats_seek_r,
+    ntfs_stats_fstat_r,
+    ntfs_stats_stat_r,
+    NULL, // link_r
+    ntfs_stats_unlink_r,
+    ntfs_stats_chdir_r,
+    ntfs_stats_rename_r,
+    ntfs_stats_mkdir_r,
+    sizeof (ntfs_dir_state),
+    ntfs_stats_diropen_r,
+    ntfs_stats_dirreset_r,
+    ntfs_stats_dirnext_r,
+    ntfs_stats_dirclose_r,
+    ntfs_stats_statvfs_r,
+    ntfs_stats_ftruncate_r,
+    ntfs_stats_fsync_r,
+    NULL, /* Device data */
+    NULL, // chmod_r
+    NULL, // fchmod_r
+    ntfs_stats_rmdir_r,
+    ntfs_stats_lstat_r,
+    NULL, // utimes_r
+    NULL, // fpathconf_r
+    NULL, // pathconf_r
+    ntfs_stats_symlink_r,
+    NULL, // readlink_r
+};
+
+const devoptab_t *ntfsGetOpStatsDevOpTab (void)
+{
+    return &devops_ntfs_stats;
+}
@@ -0,0 +1,41 @@
+/**
+ * ntfsstats.h - Operation statistics for NTFS-based devices.
+ *
+ * This program/include file is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program/include file is distributed in the hope that it will be
+ * useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software Foundation,
+ * Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef _NTFSSTATS_H
+#define _NTFSSTATS_H
+
+#include "ntfs.h"
+#include "ntfsinternal.h"
+
+/**
+ * ntfs_op_recorder - Operation statistics of a volume, kept under NTFS_OP_STATS
+ */
+typedef struct _ntfs_op_recorder {
+    mutex_t lock;                           /* Guards the statistics, which are recorded outside of the volume lock */
+    ntfs_volume_op_stats stats;
+} ntfs_op_recorder;
+
+/* Operation statistics routines */
+ntfs_op_recorder *ntfsCreateOpRecorder (void);
+void ntfsDestroyOpRecorder (ntfs_op_recorder *recorder);
+void ntfsRecordLockWait (ntfs_vd *vd, u64 start);
+void ntfsGetOpRecorderStats (ntfs_op_recorder *recorder, ntfs_volume_op_stats *stats);
+void ntfsResetOpRecorder (ntfs_op_recorder *recorder);
+const devoptab_t *ntfsGetOpStatsDevOpTab (void);
+
+#endif /* _NTFSSTATS_H */
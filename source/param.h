@@ -27,6 +27,21 @@
 #define CACHE_LOOKUP_SIZE 64	/* lookup cache, zero or >= 3 and not too big */
 #define CACHE_SECURID_SIZE 16    /* securid cache, zero or >= 3 and not too big */
 #define CACHE_LEGACY_SIZE 8    /* legacy cache size, zero or >= 3 and not too big */
+#define CACHE_MFTREC_SIZE 64	/* mft record cache, zero or >= 3 and not too big */
+#define CACHE_SDH_SIZE 16	/* security ids found or allocated in $Secure,
+				   zero or >= 3 and not too big */
+#define CACHE_REPARSE_SIZE 16	/* targets of symbolic links and junctions,
+				   zero or >= 3 and not too big */
+#define CACHE_CBLOCK_SIZE 4	/* decompressed compression blocks, zero or
+				   >= 3 and not too big (64K each) */
+#define ATTR_INDEX_SIZE 4	/* attribute list lookups remembered per
+				   inode, zero to disable */
+#define POOL_DEPTH 16		/* freed inodes, attributes, contexts and mft
+				   records kept per volume, zero to disable */
+#define CACHE_CASE_INDEX_SIZE 262144 /* bytes of case-insensitive name
+				   indexes of directories, zero to disable */
+#define UPCASE_CHUNK_SIZE 16384 /* bytes of $UpCase compared to the
+				   default table at once */
 
 #define FORCE_FORMAT_v1x 0	/* Insert security data as in NTFS v1.x */
 #define OWNERFROMACL 1		/* Get the owner from ACL (not Windows owner) */
@@ -82,6 +97,9 @@ enum {
 
 	/* only update the final extent of a runlist when appending data */
 #define PARTIAL_RUNLIST_UPDATING 0
+	/* runs kept decoded when reading or overwriting a file, before older */
+	/* extents are forgotten, 2048 runs are 48K of memory */
+#define NTFS_RL_WINDOW_RUNS 2048
 
 /*
  *		Parameters for upper-case table
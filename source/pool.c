@@ -0,0 +1,140 @@
+/**
+ * pool.c : pools of freed objects kept for reuse
+ *
+ * This program/include file is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program/include file is distributed in the hope that it will be
+ * useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program (in the main directory of the NTFS-3G
+ * distribution in the file COPYING); if not, write to the Free Software
+ * Foundation,Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+
+#include "types.h"
+#include "pool.h"
+#include "misc.h"
+
+/*
+ *		Set up a pool of objects of a given size
+ */
+
+void ntfs_pool_init(struct NTFS_POOL *pool, size_t size, int depth)
+{
+	if (size < sizeof(void*))
+		size = sizeof(void*);
+	pool->free = (void*)NULL;
+	pool->size = size;
+	pool->count = 0;
+	pool->depth = depth;
+#ifdef GEKKO
+		/* readers sharing the volume lock allocate contexts */
+	if (depth && LWP_MutexInit(&pool->lock, false))
+		pool->depth = 0;
+#endif
+}
+
+/*
+ *		Get an object from a pool, or allocate a new one
+ */
+
+void *ntfs_pool_get(struct NTFS_POOL *pool)
+{
+	void *p;
+
+	p = (void*)NULL;
+	if (pool->depth) {
+#ifdef GEKKO
+		LWP_MutexLock(pool->lock);
+#endif
+		p = pool->free;
+		if (p) {
+			pool->free = *(void**)p;
+			pool->count--;
+		}
+#ifdef GEKKO
+		LWP_MutexUnlock(pool->lock);
+#endif
+	}
+	if (!p)
+		p = ntfs_malloc(pool->size);
+	return p;
+}
+
+/*
+ *		Get a zeroed object from a pool
+ */
+
+void *ntfs_pool_zget(struct NTFS_POOL *pool)
+{
+	void *p;
+
+	p = ntfs_pool_get(pool);
+	if (p)
+		memset(p, 0, pool->size);
+	return p;
+}
+
+/*
+ *		Give an object back to its pool, or free it when the
+ *	pool is full
+ */
+
+void ntfs_pool_put(struct NTFS_POOL *pool, void *p)
+{
+	if (!p)
+		return;
+	if (pool->depth) {
+#ifdef GEKKO
+		LWP_MutexLock(pool->lock);
+#endif
+		if (pool->count < pool->depth) {
+			*(void**)p = pool->free;
+			pool->free = p;
+			pool->count++;
+			p = (void*)NULL;
+		}
+#ifdef GEKKO
+		LWP_MutexUnlock(pool->lock);
+#endif
+	}
+	free(p);
+}
+
+/*
+ *		Free all the objects kept in a pool
+ */
+
+void ntfs_pool_release(struct NTFS_POOL *pool)
+{
+	void *p;
+
+	while (pool->free) {
+		p = pool->free;
+		pool->free = *(void**)p;
+		free(p);
+	}
+	pool->count = 0;
+#ifdef GEKKO
+	if (pool->depth)
+		LWP_MutexDestroy(pool->lock);
+#endif
+	pool->depth = 0;
+}
@@ -0,0 +1,52 @@
+/*
+ * pool.h : pools of freed objects kept for reuse
+ *
+ * This program/include file is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as published
+ * by the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program/include file is distributed in the hope that it will be
+ * useful, but WITHOUT ANY WARRANTY; without even the implied warranty
+ * of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program (in the main directory of the NTFS-3G
+ * distribution in the file COPYING); if not, write to the Free Software
+ * Foundation,Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+ */
+
+#ifndef _NTFS_POOL_H_
+#define _NTFS_POOL_H_
+
+#include <stddef.h>
+
+#ifdef GEKKO
+#include <ogc/mutex.h>
+#endif
+
+/*
+ *	A pool keeps up to "depth" freed objects of one size for reuse,
+ *	chained through their first word. A zero depth makes it a plain
+ *	allocator. Objects come from ntfs_malloc(), so anything of the
+ *	right size may be put back whichever way it was allocated.
+ */
+
+struct NTFS_POOL {
+	void *free;
+	size_t size;
+	int count;
+	int depth;
+#ifdef GEKKO
+	mutex_t lock;
+#endif
+} ;
+
+void ntfs_pool_init(struct NTFS_POOL *pool, size_t size, int depth);
+void *ntfs_pool_get(struct NTFS_POOL *pool);
+void *ntfs_pool_zget(struct NTFS_POOL *pool);
+void ntfs_pool_put(struct NTFS_POOL *pool, void *p);
+void ntfs_pool_release(struct NTFS_POOL *pool);
+
+#endif /* _NTFS_POOL_H_ */
@@ -57,6 +57,7 @@
 #include "lcnalloc.h"
 #include "logging.h"
 #include "misc.h"
+#include "cache.h"
 #include "reparse.h"
 #include "xattrs.h"
 #include "ea.h"
@@ -772,6 +773,186 @@ static char *ntfs_get_rellink(ntfs_inode *ni, ntfschar *junction, int count)
 	return (target);
 }
 
+#if CACHE_REPARSE_SIZE
+
+/*
+ *		Hash of a reparse point in the target cache
+ */
+
+int ntfs_reparse_target_hash(const struct CACHED_GENERIC *item)
+{
+	return ((int)(MREF(((const struct CACHED_REPARSE*)item)->mref)
+			& 0x7fffffff));
+}
+
+/*
+ *		Reparse point comparing for fetching from cache
+ *
+ *	The target depends on the mount point it was asked for, which
+ *	is kept at the start of the cached strings.
+ */
+
+static int reparse_cache_compare(const struct CACHED_GENERIC *cached,
+			const struct CACHED_GENERIC *item)
+{
+	return (!((const struct CACHED_REPARSE*)cached)->link
+		|| (((const struct CACHED_REPARSE*)cached)->mref
+			!= ((const struct CACHED_REPARSE*)item)->mref)
+		|| (cached->varsize <= item->varsize)
+		|| memcmp(((const struct CACHED_REPARSE*)cached)->link,
+			((const struct CACHED_REPARSE*)item)->link,
+			item->varsize));
+}
+
+/*
+ *		Reparse point comparing for dropping all its targets
+ */
+
+static int reparse_cache_inode_compare(const struct CACHED_GENERIC *cached,
+			const struct CACHED_GENERIC *item)
+{
+	return (MREF(((const struct CACHED_REPARSE*)cached)->mref)
+			!= MREF(((const struct CACHED_REPARSE*)item)->mref));
+}
+
+/*
+ *		Reparse point comparing for finding any of its targets
+ */
+
+static int reparse_cache_mref_compare(const struct CACHED_GENERIC *cached,
+			const struct CACHED_GENERIC *item)
+{
+	return (!((const struct CACHED_REPARSE*)cached)->link
+		|| (((const struct CACHED_REPARSE*)cached)->mref
+			!= ((const struct CACHED_REPARSE*)item)->mref));
+}
+
+/*
+ *		Check whether the target of a reparse point is cached,
+ *	for whatever mount point
+ */
+
+static BOOL reparse_cache_known(ntfs_inode *ni)
+{
+	struct CACHED_REPARSE item;
+
+	if (!ni->vol->reparse_cache)
+		return (FALSE);
+	item.mref = MK_MREF(ni->mft_no, le16_to_cpu(ni->mrec->sequence_number));
+	item.link = (char*)NULL;
+	item.varsize = 0;
+	return (ntfs_fetch_cache(ni->vol->reparse_cache,
+			GENERIC(&item), reparse_cache_mref_compare) != NULL);
+}
+
+/*
+ *		Get a copy of the cached target of a reparse point
+ *
+ *	The mft reference includes the sequence number, so that a record
+ *	reused for another reparse point does not find the old target.
+ *
+ *	Returns the target, to be freed by the caller, or NULL
+ */
+
+static char *reparse_cache_fetch(ntfs_inode *ni, const char *mnt_point)
+{
+	struct CACHED_REPARSE item;
+	const struct CACHED_REPARSE *cached;
+	char *target;
+
+	if (!ni->vol->reparse_cache)
+		return ((char*)NULL);
+	if (!mnt_point)
+		mnt_point = "";
+	item.mref = MK_MREF(ni->mft_no, le16_to_cpu(ni->mrec->sequence_number));
+	item.link = (char*)mnt_point;
+	item.varsize = strlen(mnt_point) + 1;
+	cached = (const struct CACHED_REPARSE*)ntfs_fetch_cache(
+				ni->vol->reparse_cache,
+				GENERIC(&item), reparse_cache_compare);
+	if (!cached)
+		return ((char*)NULL);
+	target = strdup(&cached->link[item.varsize]);
+	return (target);
+}
+
+/*
+ *		Keep the target of a reparse point for the mount point
+ *	it was asked for
+ */
+
+static void reparse_cache_enter(ntfs_inode *ni, const char *mnt_point,
+			const char *target)
+{
+	struct CACHED_REPARSE item;
+	size_t mlth;
+	size_t tlth;
+
+	if (!ni->vol->reparse_cache)
+		return;
+	if (!mnt_point)
+		mnt_point = "";
+	mlth = strlen(mnt_point) + 1;
+	tlth = strlen(target) + 1;
+	item.link = (char*)ntfs_malloc(mlth + tlth);
+	if (item.link) {
+		memcpy(item.link, mnt_point, mlth);
+		memcpy(&item.link[mlth], target, tlth);
+		item.mref = MK_MREF(ni->mft_no,
+				le16_to_cpu(ni->mrec->sequence_number));
+		item.varsize = mlth + tlth;
+		ntfs_enter_cache(ni->vol->reparse_cache,
+				GENERIC(&item), reparse_cache_compare);
+		free(item.link);
+	}
+}
+
+/*
+ *		Drop the cached targets of a reparse point being changed
+ *	or removed
+ */
+
+static void reparse_cache_invalidate(ntfs_inode *ni)
+{
+	struct CACHED_REPARSE item;
+
+	if (!ni->vol->reparse_cache)
+		return;
+	item.mref = MK_MREF(ni->mft_no, 0);
+	item.link = (char*)NULL;
+	item.varsize = 0;
+	ntfs_invalidate_cache(ni->vol->reparse_cache,
+			GENERIC(&item), reparse_cache_inode_compare, 0);
+}
+
+#else
+
+int ntfs_reparse_target_hash(const struct CACHED_GENERIC *item)
+{
+	return (0);
+}
+
+static BOOL reparse_cache_known(ntfs_inode *ni)
+{
+	return (FALSE);
+}
+
+static char *reparse_cache_fetch(ntfs_inode *ni, const char *mnt_point)
+{
+	return ((char*)NULL);
+}
+
+static void reparse_cache_enter(ntfs_inode *ni, const char *mnt_point,
+			const char *target)
+{
+}
+
+static void reparse_cache_invalidate(ntfs_inode *ni)
+{
+}
+
+#endif /* CACHE_REPARSE_SIZE */
+
 /*
  *		Get the target for a junction point or symbolic link
  *	Should only be called for files or directories with reparse data
@@ -798,7 +979,9 @@ char *ntfs_make_symlink(ntfs_inode *ni, const char *mnt_point)
 	BOOL bad;
 	BOOL isdir;
 
-	target = (char*)NULL;
+	target = reparse_cache_fetch(ni, mnt_point);
+	if (target)
+		return (target);
 	bad = TRUE;
 	isdir = (ni->mrec->flags & MFT_RECORD_IS_DIRECTORY)
 			 != const_cpu_to_le16(0);
@@ -896,6 +1079,8 @@ char *ntfs_make_symlink(ntfs_inode *ni, const char *mnt_point)
 	}
 	if (bad)
 		errno = EOPNOTSUPP;
+	else
+		reparse_cache_enter(ni, mnt_point, target);
 	return (target);
 }
 
@@ -913,6 +1098,9 @@ BOOL ntfs_possible_symlink(ntfs_inode *ni)
 	REPARSE_POINT *reparse_attr;
 	BOOL possible;
 
+		/* a target has already been made from its reparse data */
+	if (reparse_cache_known(ni))
+		return (TRUE);
 	possible = FALSE;
 	reparse_attr = (REPARSE_POINT*)ntfs_attr_readall(ni,
 			AT_REPARSE_POINT,(ntfschar*)NULL, 0, &attr_size);
@@ -1125,6 +1313,7 @@ int ntfs_delete_reparse_index(ntfs_inode *ni)
 	int res;
 
 	res = 0;
+	reparse_cache_invalidate(ni);
 	na = ntfs_attr_open(ni, AT_REPARSE_POINT, AT_UNNAMED, 0);
 	if (na) {
 			/*
@@ -1203,6 +1392,7 @@ int ntfs_set_ntfs_reparse_data(ntfs_inode *ni,
 			 * lead to problems with earlier versions.
 			 */
 	if (ni && valid_reparse_data(ni, (const REPARSE_POINT*)value, size)) {
+		reparse_cache_invalidate(ni);
 		xr = open_reparse_index(ni->vol);
 		if (xr) {
 			if (!ntfs_attr_exist(ni,AT_REPARSE_POINT,
@@ -1274,6 +1464,7 @@ int ntfs_remove_ntfs_reparse_data(ntfs_inode *ni)
 
 	res = 0;
 	if (ni) {
+		reparse_cache_invalidate(ni);
 		/*
 		 * open and delete the reparse data
 		 */
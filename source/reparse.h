@@ -26,6 +26,10 @@
 
 char *ntfs_make_symlink(ntfs_inode *ni, const char *mnt_point);
 
+struct CACHED_GENERIC;
+
+int ntfs_reparse_target_hash(const struct CACHED_GENERIC *item);
+
 BOOL ntfs_possible_symlink(ntfs_inode *ni);
 
 int ntfs_get_ntfs_reparse_data(ntfs_inode *ni, char *value, size_t size);
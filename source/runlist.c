@@ -49,6 +49,9 @@
 #include "logging.h"
 #include "misc.h"
 
+/* Number of runs ntfs_rl_pread() and ntfs_rl_pwrite() submit at once. */
+#define NTFS_RL_IO_BATCH 16
+
 /**
  * ntfs_rl_mm - runlist memmove
  * @base:
@@ -138,6 +141,7 @@ runlist_element *ntfs_rl_extend(ntfs_attr *na, runlist_element *rl,
 			rl = (runlist_element*)NULL;
 		} else {
 			na->rl = newrl;
+			na->rl_cursor = NULL;
 			rl = &newrl[irl];
 		}
 	} else {
@@ -1086,6 +1090,141 @@ LCN ntfs_rl_vcn_to_lcn(const runlist_element *rl, const VCN vcn)
 	return (LCN)LCN_ENOENT;
 }
 
+/**
+ * ntfs_rl_find_vcn - binary search a runlist for a vcn
+ * @rl:		runlist to search
+ * @count:	number of elements of @rl before its terminator
+ * @vcn:	vcn to find
+ *
+ * Return the element of @rl containing @vcn, which must be at least the vcn
+ * of the first element and below the vcn of the terminator, so a caller
+ * which does not know @count should use ntfs_rl_vcn_to_lcn() instead.
+ */
+runlist_element *ntfs_rl_find_vcn(const runlist_element *rl, int count,
+		const VCN vcn)
+{
+	int lo, hi, mid;
+
+	lo = 0;
+	hi = count - 1;
+	while (lo < hi) {
+		mid = (lo + hi + 1) >> 1;
+		if (rl[mid].vcn <= vcn)
+			lo = mid;
+		else
+			hi = mid - 1;
+	}
+	return ((runlist_element*)&rl[lo]);
+}
+
+/**
+ * ntfs_rl_queue_vec - queue a run for a vectored transfer
+ * @vec:	runs queued so far
+ * @nr_vec:	number of runs in @vec
+ * @buf:	data buffer for the run, following the one of the last run
+ * @count:	number of bytes in the run
+ * @pos:	device position of the run
+ *
+ * A run which is physically contiguous to the last queued one, as happens
+ * when a run was split or at the boundary of attribute extents, is merged
+ * into it so that it costs no extra device command.
+ *
+ * Return the new number of runs in @vec.
+ */
+static int ntfs_rl_queue_vec(struct ntfs_io_vec *vec, int nr_vec, void *buf,
+		s64 count, s64 pos)
+{
+	if (nr_vec && (vec[nr_vec - 1].pos + vec[nr_vec - 1].count == pos)) {
+		vec[nr_vec - 1].count += count;
+		return (nr_vec);
+	}
+	vec[nr_vec].buf = buf;
+	vec[nr_vec].count = count;
+	vec[nr_vec].pos = pos;
+	return (nr_vec + 1);
+}
+
+/**
+ * ntfs_rl_pread_vec - read a batch of runs queued by ntfs_rl_pread()
+ * @dev:	device to read from
+ * @vec:	runs to read, in runlist order
+ * @nr_vec:	number of runs in @vec
+ * @queued:	total number of bytes in @vec
+ * @err:	set to the error code if a run could not be read
+ *
+ * The runs are submitted as one vectored read. If that fails, they are read
+ * again one at a time to find out how far the read got.
+ *
+ * Return the number of bytes read from the start of the batch, which is lower
+ * than @queued if a run could not be read in full.
+ */
+static s64 ntfs_rl_pread_vec(struct ntfs_device *dev,
+		const struct ntfs_io_vec *vec, int nr_vec, s64 queued,
+		int *err)
+{
+	s64 bytes_read, total;
+	int i;
+
+	if (ntfs_preadv(dev, vec, nr_vec) == queued)
+		return queued;
+	for (total = 0, i = 0; i < nr_vec; i++) {
+retry:
+		bytes_read = ntfs_pread(dev, vec[i].pos, vec[i].count,
+				vec[i].buf);
+		/* If the syscall was interrupted, try again. */
+		if (bytes_read == (s64)-1 && errno == EINTR)
+			goto retry;
+		if (bytes_read > 0)
+			total += bytes_read;
+		if (bytes_read != vec[i].count) {
+			if (bytes_read == (s64)-1)
+				*err = errno;
+			break;
+		}
+	}
+	return total;
+}
+
+/**
+ * ntfs_rl_pwrite_vec - write a batch of runs queued by ntfs_rl_pwrite()
+ * @dev:	device to write to
+ * @vec:	runs to write, in runlist order
+ * @nr_vec:	number of runs in @vec
+ * @queued:	total number of bytes in @vec
+ * @err:	set to the error code if a run could not be written
+ *
+ * Same as ntfs_rl_pread_vec(), for writing.
+ *
+ * Return the number of bytes written from the start of the batch, which is
+ * lower than @queued if a run could not be written in full.
+ */
+static s64 ntfs_rl_pwrite_vec(struct ntfs_device *dev,
+		const struct ntfs_io_vec *vec, int nr_vec, s64 queued,
+		int *err)
+{
+	s64 written, total;
+	int i;
+
+	if (ntfs_pwritev(dev, vec, nr_vec) == queued)
+		return queued;
+	for (total = 0, i = 0; i < nr_vec; i++) {
+retry:
+		written = ntfs_pwrite(dev, vec[i].pos, vec[i].count,
+				vec[i].buf);
+		/* If the syscall was interrupted, try again. */
+		if (written == (s64)-1 && errno == EINTR)
+			goto retry;
+		if (written > 0)
+			total += written;
+		if (written != vec[i].count) {
+			if (written == (s64)-1)
+				*err = errno;
+			break;
+		}
+	}
+	return total;
+}
+
 /**
  * ntfs_rl_pread - gather read from disk
  * @vol:	ntfs volume to read from
@@ -1113,7 +1252,9 @@ LCN ntfs_rl_vcn_to_lcn(const runlist_element *rl, const VCN vcn)
 s64 ntfs_rl_pread(const ntfs_volume *vol, const runlist_element *rl,
 		const s64 pos, s64 count, void *b)
 {
-	s64 bytes_read, to_read, ofs, total;
+	struct ntfs_io_vec vec[NTFS_RL_IO_BATCH];
+	s64 bytes_read, to_read, ofs, total, queued;
+	int nr_vec;
 	int err = EIO;
 
 	if (!vol || !rl || pos < 0 || count < 0) {
@@ -1131,12 +1272,22 @@ s64 ntfs_rl_pread(const ntfs_volume *vol, const runlist_element *rl,
 		ofs += (rl->length << vol->cluster_size_bits);
 	/* Offset in the run at which to begin reading. */
 	ofs = pos - ofs;
-	for (total = 0LL; count; rl++, ofs = 0) {
+	for (total = 0LL, queued = 0LL, nr_vec = 0; count; rl++, ofs = 0) {
 		if (!rl->length)
 			goto rl_err_out;
 		if (rl->lcn < (LCN)0) {
 			if (rl->lcn != (LCN)LCN_HOLE)
 				goto rl_err_out;
+			/* Read the runs queued so far to keep @total in order. */
+			if (nr_vec) {
+				bytes_read = ntfs_rl_pread_vec(vol->dev, vec,
+						nr_vec, queued, &err);
+				total += bytes_read;
+				nr_vec = 0;
+				if (bytes_read != queued)
+					goto rl_err_out;
+				queued = 0;
+			}
 			/* It is a hole. Just fill buffer @b with zeroes. */
 			to_read = min(count, (rl->length <<
 					vol->cluster_size_bits) - ofs);
@@ -1147,29 +1298,42 @@ s64 ntfs_rl_pread(const ntfs_volume *vol, const runlist_element *rl,
 			b = (u8*)b + to_read;
 			continue;
 		}
-		/* It is a real lcn, read it from the volume. */
+		/*
+		 * It is a real lcn, queue it to be read from the volume
+		 * together with the runs that follow.
+		 */
 		to_read = min(count, (rl->length << vol->cluster_size_bits) -
 				ofs);
-retry:
-		bytes_read = ntfs_pread(vol->dev, (rl->lcn <<
-				vol->cluster_size_bits) + ofs, to_read, b);
-		/* If everything ok, update progress counters and continue. */
-		if (bytes_read > 0) {
+		nr_vec = ntfs_rl_queue_vec(vec, nr_vec, b, to_read,
+				(rl->lcn << vol->cluster_size_bits) + ofs);
+		queued += to_read;
+		count -= to_read;
+		b = (u8*)b + to_read;
+		if (nr_vec == NTFS_RL_IO_BATCH) {
+			bytes_read = ntfs_rl_pread_vec(vol->dev, vec, nr_vec,
+					queued, &err);
 			total += bytes_read;
-			count -= bytes_read;
-			b = (u8*)b + bytes_read;
-			continue;
+			nr_vec = 0;
+			if (bytes_read != queued)
+				goto rl_err_out;
+			queued = 0;
 		}
-		/* If the syscall was interrupted, try again. */
-		if (bytes_read == (s64)-1 && errno == EINTR)
-			goto retry;
-		if (bytes_read == (s64)-1)
-			err = errno;
-		goto rl_err_out;
+	}
+	if (nr_vec) {
+		bytes_read = ntfs_rl_pread_vec(vol->dev, vec, nr_vec, queued,
+				&err);
+		total += bytes_read;
+		nr_vec = 0;
+		if (bytes_read != queued)
+			goto rl_err_out;
 	}
 	/* Finally, return the number of bytes read. */
 	return total;
 rl_err_out:
+	/* Read whatever was queued before the bad run. */
+	if (nr_vec)
+		total += ntfs_rl_pread_vec(vol->dev, vec, nr_vec, queued,
+				&err);
 	if (total)
 		return total;
 	errno = err;
@@ -1202,7 +1366,9 @@ rl_err_out:
 s64 ntfs_rl_pwrite(const ntfs_volume *vol, const runlist_element *rl,
 		s64 ofs, const s64 pos, s64 count, void *b)
 {
-	s64 written, to_write, total = 0;
+	struct ntfs_io_vec vec[NTFS_RL_IO_BATCH];
+	s64 written, to_write, total = 0, queued = 0;
+	int nr_vec = 0;
 	int err = EIO;
 
 	if (!vol || !rl || pos < 0 || count < 0) {
@@ -1229,6 +1395,16 @@ s64 ntfs_rl_pwrite(const ntfs_volume *vol, const runlist_element *rl,
 
 			if (rl->lcn != (LCN)LCN_HOLE)
 				goto rl_err_out;
+			/* Write the runs queued so far to keep @total in order. */
+			if (nr_vec) {
+				written = ntfs_rl_pwrite_vec(vol->dev, vec,
+						nr_vec, queued, &err);
+				total += written;
+				nr_vec = 0;
+				if (written != queued)
+					goto rl_err_out;
+				queued = 0;
+			}
 			
 			to_write = min(count, (rl->length <<
 					       vol->cluster_size_bits) - ofs);
@@ -1238,33 +1414,45 @@ s64 ntfs_rl_pwrite(const ntfs_volume *vol, const runlist_element *rl,
 			b = (u8*)b + to_write;
 			continue;
 		}
-		/* It is a real lcn, write it to the volume. */
+		/* It is a real lcn, queue it to be written to the volume. */
 		to_write = min(count, (rl->length << vol->cluster_size_bits) -
 				ofs);
-retry:
-		if (!NVolReadOnly(vol))
-			written = ntfs_pwrite(vol->dev, (rl->lcn <<
-					vol->cluster_size_bits) + ofs,
-					to_write, b);
-		else
-			written = to_write;
-		/* If everything ok, update progress counters and continue. */
-		if (written > 0) {
-			total += written;
-			count -= written;
-			b = (u8*)b + written;
+		if (NVolReadOnly(vol)) {
+			total += to_write;
+			count -= to_write;
+			b = (u8*)b + to_write;
 			continue;
 		}
-		/* If the syscall was interrupted, try again. */
-		if (written == (s64)-1 && errno == EINTR)
-			goto retry;
-		if (written == (s64)-1)
-			err = errno;
-		goto rl_err_out;
+		nr_vec = ntfs_rl_queue_vec(vec, nr_vec, b, to_write,
+				(rl->lcn << vol->cluster_size_bits) + ofs);
+		queued += to_write;
+		count -= to_write;
+		b = (u8*)b + to_write;
+		if (nr_vec == NTFS_RL_IO_BATCH) {
+			written = ntfs_rl_pwrite_vec(vol->dev, vec, nr_vec,
+					queued, &err);
+			total += written;
+			nr_vec = 0;
+			if (written != queued)
+				goto rl_err_out;
+			queued = 0;
+		}
+	}
+	if (nr_vec) {
+		written = ntfs_rl_pwrite_vec(vol->dev, vec, nr_vec, queued,
+				&err);
+		total += written;
+		nr_vec = 0;
+		if (written != queued)
+			goto rl_err_out;
 	}
 out:
 	return total;
 rl_err_out:
+	/* Write whatever was queued before the bad run. */
+	if (nr_vec)
+		total += ntfs_rl_pwrite_vec(vol->dev, vec, nr_vec, queued,
+				&err);
 	if (total)
 		goto out;
 	errno = err;
@@ -1769,6 +1957,8 @@ s64 ntfs_rl_get_compressed_size(ntfs_volume *vol, runlist *rl)
 
 
 #ifdef NTFS_TEST
+#include <time.h>
+
 /**
  * test_rl_helper
  */
@@ -2167,6 +2357,59 @@ out:
 	free(attr3);
 }
 
+/**
+ * test_rl_bench - Runlist test: Time random lookups in a fragmented runlist
+ * @runs:
+ *
+ * Description...
+ *
+ * Returns:
+ */
+static void test_rl_bench(char *runs)
+{
+	runlist_element *rl;
+	clock_t start;
+	VCN vcn;
+	LCN sum1, sum2;
+	int count, lookups, i;
+
+	count = atoi(runs);
+	if (count <= 0)
+		return;
+	rl = ntfs_malloc((count + 1) * sizeof(runlist_element));
+	if (!rl)
+		return;
+	vcn = 0;
+	for (i = 0; i < count; i++) {
+		MKRL(rl+i, vcn, 2 * vcn + 100, 1 + (i % 7))
+		vcn += 1 + (i % 7);
+	}
+	MKRL(rl+count, vcn, LCN_ENOENT, 0)
+
+	lookups = 100000;
+	srand(1);
+	sum1 = 0;
+	start = clock();
+	for (i = 0; i < lookups; i++)
+		sum1 += ntfs_rl_vcn_to_lcn(rl, rand() % vcn);
+	printf("linear: %d lookups in %d runs, %ld ms\n", lookups, count,
+		(long)((clock() - start) * 1000 / CLOCKS_PER_SEC));
+
+	srand(1);
+	sum2 = 0;
+	start = clock();
+	for (i = 0; i < lookups; i++) {
+		VCN v = rand() % vcn;
+		runlist_element *r = ntfs_rl_find_vcn(rl, count, v);
+		sum2 += r->lcn + (v - r->vcn);
+	}
+	printf("binary: %d lookups in %d runs, %ld ms\n", lookups, count,
+		(long)((clock() - start) * 1000 / CLOCKS_PER_SEC));
+	if (sum1 != sum2)
+		printf("Bench: lookups do not agree\n");
+	free(rl);
+}
+
 /**
  * test_rl_main - Runlist test: Program start (main)
  * @argc:
@@ -2181,8 +2424,9 @@ int test_rl_main(int argc, char *argv[])
 	if      ((argc == 2) && (strcmp(argv[1], "zero") == 0)) test_rl_zero();
 	else if ((argc == 3) && (strcmp(argv[1], "frag") == 0)) test_rl_frag(argv[2]);
 	else if ((argc == 4) && (strcmp(argv[1], "pure") == 0)) test_rl_pure(argv[2], argv[3]);
+	else if ((argc == 3) && (strcmp(argv[1], "bench") == 0)) test_rl_bench(argv[2]);
 	else
-		printf("rl [zero|frag|pure] {args}\n");
+		printf("rl [zero|frag|pure|bench] {args}\n");
 
 	return 0;
 }
@@ -53,6 +53,8 @@ extern runlist_element *ntfs_rl_extend(ntfs_attr *na, runlist_element *rl,
 			int more_entries);
 
 extern LCN ntfs_rl_vcn_to_lcn(const runlist_element *rl, const VCN vcn);
+extern runlist_element *ntfs_rl_find_vcn(const runlist_element *rl, int count,
+		const VCN vcn);
 
 extern s64 ntfs_rl_pread(const ntfs_volume *vol, const runlist_element *rl,
 		const s64 pos, s64 count, void *b);
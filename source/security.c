@@ -807,6 +807,96 @@ static le32 entersecurityattr(ntfs_volume *vol,
 	return (securid);
 }
 
+#if CACHE_SDH_SIZE
+
+/*
+ *		Hash of a security descriptor in the security id cache
+ */
+
+int ntfs_security_sdh_hash(const struct CACHED_GENERIC *item)
+{
+	return ((int)(le32_to_cpu(((const struct CACHED_SDH*)item)->hash)
+			& 0x7fffffff));
+}
+
+/*
+ *		Security descriptor comparing for fetching from cache
+ */
+
+static int sdh_cache_compare(const struct CACHED_GENERIC *cached,
+			const struct CACHED_GENERIC *item)
+{
+	return (!((const struct CACHED_SDH*)cached)->descr
+		|| (((const struct CACHED_SDH*)cached)->hash
+			!= ((const struct CACHED_SDH*)item)->hash)
+		|| (cached->varsize != item->varsize)
+		|| memcmp(((const struct CACHED_SDH*)cached)->descr,
+			((const struct CACHED_SDH*)item)->descr,
+			item->varsize));
+}
+
+/*
+ *		Get the security id of a descriptor already met in $Secure
+ *
+ *	Descriptors are never removed from $Secure, so an id once found
+ *	stays valid while the volume is mounted.
+ *
+ *	Returns the id, or zero if the descriptor is not cached
+ */
+
+static le32 sdh_cache_fetch(ntfs_volume *vol,
+			const SECURITY_DESCRIPTOR_RELATIVE *attr, s64 attrsz,
+			le32 hash)
+{
+	struct CACHED_SDH item;
+	const struct CACHED_SDH *cached;
+
+	if (!vol->sdh_cache)
+		return (const_cpu_to_le32(0));
+	item.descr = (char*)attr;
+	item.varsize = attrsz;
+	item.hash = hash;
+	cached = (const struct CACHED_SDH*)ntfs_fetch_cache(vol->sdh_cache,
+				GENERIC(&item), sdh_cache_compare);
+	return (cached ? cached->securid : const_cpu_to_le32(0));
+}
+
+/*
+ *		Remember the security id found or allocated for a descriptor
+ */
+
+static void sdh_cache_enter(ntfs_volume *vol,
+			const SECURITY_DESCRIPTOR_RELATIVE *attr, s64 attrsz,
+			le32 hash, le32 securid)
+{
+	struct CACHED_SDH item;
+
+	if (!vol->sdh_cache)
+		return;
+	item.descr = (char*)attr;
+	item.varsize = attrsz;
+	item.hash = hash;
+	item.securid = securid;
+	ntfs_enter_cache(vol->sdh_cache, GENERIC(&item), sdh_cache_compare);
+}
+
+#else
+
+static le32 sdh_cache_fetch(ntfs_volume *vol,
+			const SECURITY_DESCRIPTOR_RELATIVE *attr, s64 attrsz,
+			le32 hash)
+{
+	return (const_cpu_to_le32(0));
+}
+
+static void sdh_cache_enter(ntfs_volume *vol,
+			const SECURITY_DESCRIPTOR_RELATIVE *attr, s64 attrsz,
+			le32 hash, le32 securid)
+{
+}
+
+#endif /* CACHE_SDH_SIZE */
+
 /*
  *		Find a matching security descriptor in $Secure,
  *	if none, allocate a new id and write the descriptor to storage
@@ -842,8 +932,11 @@ static le32 setsecurityattr(ntfs_volume *vol,
 	int olderrno;
 
 	hash = ntfs_security_hash(attr,attrsz);
+		/* descriptors already met need no search in $SDH */
+	securid = sdh_cache_fetch(vol, attr, attrsz, hash);
+	if (securid)
+		return (securid);
 	oldattr = (char*)NULL;
-	securid = const_cpu_to_le32(0);
 	res = 0;
 	xsdh = vol->secure_xsdh;
 	if (vol->secure_ni && xsdh && !vol->secure_reentry++) {
@@ -925,6 +1018,8 @@ static le32 setsecurityattr(ntfs_volume *vol,
 			}
 		}
 	}
+	if (securid)
+		sdh_cache_enter(vol, attr, attrsz, hash, securid);
 	if (--vol->secure_reentry)
 		ntfs_log_perror("Reentry error, check no multithreading\n");
 	return (securid);
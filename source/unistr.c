@@ -242,6 +242,65 @@ int ntfs_names_full_collate(const ntfschar *name1, const u32 name1_len,
 	return 0;
 }
 
+/**
+ * ntfs_names_full_collate_upcased - fully collate a name known upcased
+ *
+ * @name1:	first Unicode name to compare
+ * @upname1:	@name1 translated through @upcase
+ * @name1_len:	length of first Unicode name to compare
+ * @name2:	second Unicode name to compare
+ * @name2_len:	length of second Unicode name to compare
+ * @ic:		either CASE_SENSITIVE or IGNORE_CASE
+ * @upcase:	upcase table
+ * @upcase_len:	upcase table size
+ *
+ * Same as ntfs_names_full_collate(), for comparing a name to many others,
+ * as when searching an index: the first name is upcased once by the caller.
+ * The leading characters both names have in common are skipped two at
+ * a time without translation, as they cannot make a difference.
+ *
+ * Returns:
+ *  -1 if the first name collates before the second one,
+ *   0 if the names match, or
+ *   1 if the second name collates before the first one
+ */
+int ntfs_names_full_collate_upcased(const ntfschar *name1,
+		const ntfschar *upname1, const u32 name1_len,
+		const ntfschar *name2, const u32 name2_len,
+		const IGNORE_CASE_BOOL ic,
+		const ntfschar *upcase, const u32 upcase_len)
+{
+	u32 cnt, i, diff;
+	u32 w1, w2;
+	u16 u1, u2;
+
+	cnt = min(name1_len, name2_len);
+	for (i = 0; (i + 2) <= cnt; i += 2) {
+		memcpy(&w1, &name1[i], sizeof(w1));
+		memcpy(&w2, &name2[i], sizeof(w2));
+		if (w1 != w2)
+			break;
+	}
+	while ((i < cnt) && (name1[i] == name2[i]))
+		i++;
+		/* first character which differs, if any */
+	diff = i;
+	for ( ; i < cnt; i++) {
+		u1 = le16_to_cpu(upname1[i]);
+		u2 = le16_to_cpu(name2[i]);
+		if (u2 < upcase_len)
+			u2 = le16_to_cpu(upcase[u2]);
+		if (u1 != u2)
+			return (u1 < u2 ? -1 : 1);
+	}
+	if (name1_len != name2_len)
+		return (name1_len < name2_len ? -1 : 1);
+	if ((ic == CASE_SENSITIVE) && (diff < cnt))
+		return (le16_to_cpu(name1[diff]) < le16_to_cpu(name2[diff])
+				? -1 : 1);
+	return 0;
+}
+
 /**
  * ntfs_ucsncmp - compare two little endian Unicode strings
  * @s1:		first string
@@ -457,6 +516,65 @@ void ntfs_file_value_upcase(FILE_NAME_ATTR *file_name_attr,
    Jean-Pierre Andre made it compliant with RFC3629/RFC2781.
 */
  
+/*
+ *		Convert the leading ASCII part of a UTF-16LE string
+ *
+ *	Four characters are examined at a time, and copied to @t until
+ *	a non-ASCII or null character is met, or @ins_len characters
+ *	have been converted.
+ *
+ *	Returns the number of characters converted
+ */
+static int ascii_from_utf16(char *t, const ntfschar *ins, int ins_len)
+{
+	u64 w;
+	int i, k;
+
+	for (i = 0; (i + 4) <= ins_len; i += 4) {
+		memcpy(&w, &ins[i], sizeof(w));
+		w = le64_to_cpu(w);
+		if ((w & 0xff80ff80ff80ff80ULL)
+		    || ((w - 0x0001000100010001ULL) & ~w
+				& 0x8000800080008000ULL))
+			break;
+		for (k = 0; k < 4; k++)
+			t[i + k] = (char)(w >> (16 * k));
+	}
+	while ((i < ins_len)
+	    && ins[i] && (le16_to_cpu(ins[i]) < 0x80)) {
+		t[i] = (char)le16_to_cpu(ins[i]);
+		i++;
+	}
+	return (i);
+}
+
+/*
+ *		Convert the leading ASCII part of a multibyte string
+ *
+ *	The @len bytes of @s are expected to be non-null. They are examined
+ *	eight at a time, and copied to @t until a non-ASCII byte is met.
+ *
+ *	Returns the number of characters converted
+ */
+static int ascii_to_utf16(ntfschar *t, const char *s, int len)
+{
+	u64 w;
+	int i, k;
+
+	for (i = 0; (i + 8) <= len; i += 8) {
+		memcpy(&w, &s[i], sizeof(w));
+		if (w & 0x8080808080808080ULL)
+			break;
+		for (k = 0; k < 8; k++)
+			t[i + k] = cpu_to_le16((u8)s[i + k]);
+	}
+	while ((i < len) && !(s[i] & 0x80)) {
+		t[i] = cpu_to_le16((u8)s[i]);
+		i++;
+	}
+	return (i);
+}
+
 /* 
  * Return the number of bytes in UTF-8 needed (without the terminating null) to
  * store the given UTF-16LE string.
@@ -561,13 +679,35 @@ static int ntfs_utf16_to_utf8(const ntfschar *ins, const int ins_len,
 	char *t;
 	int i, size, ret = -1;
 	int halfpair;
+	BOOL allocated;
 
 	halfpair = 0;
+	allocated = FALSE;
 	if (!*outs) {
 		/* If no output buffer was provided, we will allocate one and
 		 * limit its length to PATH_MAX.  Note: we follow the standard
 		 * convention of PATH_MAX including the terminating null. */
 		outs_len = PATH_MAX;
+		*outs = ntfs_malloc(min(ins_len, outs_len - 1) + 1);
+		if (!*outs)
+			goto out;
+		allocated = TRUE;
+	}
+
+	/*
+	 * Plain ASCII, the usual case, is converted in a single pass.
+	 * Otherwise start again and size the string.
+	 */
+	size = min(ins_len, outs_len - 1);
+	i = ascii_from_utf16(*outs, ins, size);
+	if ((i == ins_len) || !ins[i]) {
+		(*outs)[i] = '\0';
+		ret = i;
+		goto out;
+	}
+	if (allocated) {
+		free(*outs);
+		*outs = (char*)NULL;
 	}
 
 	/* The size *with* the terminating null is limited to @outs_len,
@@ -827,13 +967,38 @@ static int ntfs_utf8_to_utf16(const char *ins, ntfschar **outs)
 	u32 wc;
 	BOOL allocated;
 	ntfschar *outpos;
-	int shorts, ret = -1;
+	int len, shorts, ret = -1;
+
+	/*
+	 * Plain ASCII, the usual case, is converted in a single pass.
+	 * A UTF-8 string never needs more UTF-16 units than it has bytes,
+	 * so the buffer is kept if other characters are met.
+	 */
+	len = strlen(ins);
+	allocated = FALSE;
+	if (len < PATH_MAX) {
+		if (!*outs) {
+			*outs = ntfs_malloc((len + 1) * sizeof(ntfschar));
+			if (!*outs)
+				goto fail;
+			allocated = TRUE;
+		}
+		if (ascii_to_utf16(*outs, ins, len) == len) {
+			(*outs)[len] = const_cpu_to_le16(0);
+			ret = len;
+			goto fail;
+		}
+	}
 
 	shorts = utf8_to_utf16_size(ins);
-	if (shorts < 0)
+	if (shorts < 0) {
+		if (allocated) {
+			free(*outs);
+			*outs = (ntfschar*)NULL;
+		}
 		goto fail;
+	}
 
-	allocated = FALSE;
 	if (!*outs) {
 		*outs = ntfs_malloc((shorts + 1) * sizeof(ntfschar));
 		if (!*outs)
@@ -1140,6 +1305,51 @@ err_out:
 	return -1;
 }
 
+/**
+ * ntfs_mbstoucs_buf - convert a multibyte string into a caller buffer
+ * @ins:	input multibyte string buffer
+ * @outs:	output Unicode string buffer
+ * @outs_len:	size of @outs in Unicode characters, terminating null included
+ *
+ * Same as ntfs_mbstoucs(), except that the Unicode string is stored into
+ * @outs, for callers converting names in a loop. No memory is allocated
+ * when the string is plain ASCII.
+ *
+ * On success the function returns the number of Unicode characters written
+ * to @outs (>= 0), not counting the terminating Unicode NULL character.
+ *
+ * On error, -1 is returned with errno set as by ntfs_mbstoucs(), or to
+ * ENAMETOOLONG if the string does not fit into @outs.
+ */
+int ntfs_mbstoucs_buf(const char *ins, ntfschar *outs, int outs_len)
+{
+	ntfschar *ucs;
+	int len;
+
+	if (!ins || !outs || (outs_len <= 0)) {
+		errno = EINVAL;
+		return -1;
+	}
+	len = strlen(ins);
+	if (use_utf8 && (len < outs_len)
+	    && (ascii_to_utf16(outs, ins, len) == len)) {
+		outs[len] = const_cpu_to_le16(0);
+		return len;
+	}
+	ucs = (ntfschar*)NULL;
+	len = ntfs_mbstoucs(ins, &ucs);
+	if (len < 0)
+		return -1;
+	if (len >= outs_len) {
+		free(ucs);
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	memcpy(outs, ucs, (len + 1) * sizeof(ntfschar));
+	free(ucs);
+	return len;
+}
+
 /*
  *		Turn a UTF8 name uppercase
  *
@@ -1391,6 +1601,83 @@ u32 ntfs_upcase_build_default(ntfschar **upcase)
 	return (upcase_len);
 }
 
+/*
+ *		Case tables shared by all volumes using the default upcase
+ *	table, built on first use and kept until the program exits.
+ *
+ *	Concurrent mounts may both build a table, only the first one
+ *	to be published is kept.
+ */
+
+static ntfschar *shared_upcase = (ntfschar*)NULL;
+static ntfschar *shared_locase = (ntfschar*)NULL;
+
+static ntfschar *publish_case_table(ntfschar **shared, ntfschar *table)
+{
+	ntfschar *old;
+
+	old = (ntfschar*)NULL;
+	if (!__atomic_compare_exchange_n(shared, &old, table, FALSE,
+			__ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+		free(table);
+		table = old;
+	}
+	return (table);
+}
+
+/*
+ *		Get the shared default upcase table
+ *
+ *	The table must neither be modified nor freed.
+ *	Returns NULL if it could not be built
+ */
+
+ntfschar *ntfs_upcase_shared(void)
+{
+	ntfschar *uc;
+
+	uc = __atomic_load_n(&shared_upcase, __ATOMIC_ACQUIRE);
+	if (!uc && ntfs_upcase_build_default(&uc))
+		uc = publish_case_table(&shared_upcase, uc);
+	return (uc);
+}
+
+/*
+ *		Get the locase table matching the shared upcase table
+ *
+ *	The table must neither be modified nor freed.
+ *	Returns NULL if it could not be built
+ */
+
+ntfschar *ntfs_locase_shared(void)
+{
+	ntfschar *uc;
+	ntfschar *lc;
+
+	lc = __atomic_load_n(&shared_locase, __ATOMIC_ACQUIRE);
+	if (!lc) {
+		uc = ntfs_upcase_shared();
+		if (uc) {
+			lc = ntfs_locase_table_build(uc, UPCASE_LEN);
+			if (lc)
+				lc = publish_case_table(&shared_locase, lc);
+		}
+	}
+	return (lc);
+}
+
+/*
+ *		Tell whether a case table is one of the shared ones
+ */
+
+BOOL ntfs_case_table_is_shared(const ntfschar *table)
+{
+	return (table
+		&& ((table == __atomic_load_n(&shared_upcase, __ATOMIC_ACQUIRE))
+		    || (table == __atomic_load_n(&shared_locase,
+					__ATOMIC_ACQUIRE))));
+}
+
 /*
  *		Build a table for converting to lower case
  *
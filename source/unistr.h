@@ -35,6 +35,12 @@ extern int ntfs_names_full_collate(const ntfschar *name1, const u32 name1_len,
 		const IGNORE_CASE_BOOL ic,
 		const ntfschar *upcase, const u32 upcase_len);
 
+extern int ntfs_names_full_collate_upcased(const ntfschar *name1,
+		const ntfschar *upname1, const u32 name1_len,
+		const ntfschar *name2, const u32 name2_len,
+		const IGNORE_CASE_BOOL ic,
+		const ntfschar *upcase, const u32 upcase_len);
+
 extern int ntfs_ucsncmp(const ntfschar *s1, const ntfschar *s2, size_t n);
 
 extern int ntfs_ucsncasecmp(const ntfschar *s1, const ntfschar *s2, size_t n,
@@ -56,6 +62,7 @@ extern void ntfs_file_value_upcase(FILE_NAME_ATTR *file_name_attr,
 extern int ntfs_ucstombs(const ntfschar *ins, const int ins_len, char **outs,
 		int outs_len);
 extern int ntfs_mbstoucs(const char *ins, ntfschar **outs);
+extern int ntfs_mbstoucs_buf(const char *ins, ntfschar *outs, int outs_len);
 
 extern char *ntfs_uppercase_mbs(const char *low,
 		const ntfschar *upcase, u32 upcase_len);
@@ -63,6 +70,9 @@ extern char *ntfs_uppercase_mbs(const char *low,
 extern void ntfs_upcase_table_build(ntfschar *uc, u32 uc_len);
 extern u32 ntfs_upcase_build_default(ntfschar **upcase);
 extern ntfschar *ntfs_locase_table_build(const ntfschar *uc, u32 uc_cnt);
+extern ntfschar *ntfs_upcase_shared(void);
+extern ntfschar *ntfs_locase_shared(void);
+extern BOOL ntfs_case_table_is_shared(const ntfschar *table);
 
 extern ntfschar *ntfs_str2ucs(const char *s, int *len);
 
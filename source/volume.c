@@ -68,6 +68,7 @@
 #include "debug.h"
 #include "inode.h"
 #include "runlist.h"
+#include "lcnalloc.h"
 #include "logfile.h"
 #include "dir.h"
 #include "logging.h"
@@ -132,7 +133,20 @@ static const char *access_denied_msg =
  */
 ntfs_volume *ntfs_volume_alloc(void)
 {
-	return ntfs_calloc(sizeof(ntfs_volume));
+	ntfs_volume *vol;
+
+	vol = ntfs_calloc(sizeof(ntfs_volume));
+	if (vol) {
+		ntfs_pool_init(&vol->inode_pool, sizeof(ntfs_inode),
+				POOL_DEPTH);
+		ntfs_pool_init(&vol->attr_pool, sizeof(ntfs_attr),
+				POOL_DEPTH);
+		ntfs_pool_init(&vol->ctx_pool, sizeof(ntfs_attr_search_ctx),
+				POOL_DEPTH);
+		ntfs_pool_init(&vol->icx_pool, sizeof(ntfs_index_context),
+				POOL_DEPTH);
+	}
+	return vol;
 }
 
 static void ntfs_attr_free(ntfs_attr **na)
@@ -173,6 +187,12 @@ static int __ntfs_volume_release(ntfs_volume *v)
 {
 	int err = 0;
 
+#if CACHE_NIDATA_SIZE
+	/* Write back what lazy sync left in the inode cache */
+	if (ntfs_inode_sync_cached(v))
+		ntfs_error_set(&err);
+	NVolClearLazySync(v);
+#endif
 	if (ntfs_close_secure(v))
 		ntfs_error_set(&err);
 
@@ -182,6 +202,9 @@ static int __ntfs_volume_release(ntfs_volume *v)
 	 * FIXME: Inodes must be synced before closing
 	 * attributes, otherwise unmount could fail.
 	 */
+	if (v->lcnbmp_na && (ntfs_cluster_free_flush(v, -1)
+			|| ntfs_cluster_bitmap_sync(v)))
+		ntfs_error_set(&err);
 	if (v->lcnbmp_ni && NInoDirty(v->lcnbmp_ni))
 		ntfs_inode_sync(v->lcnbmp_ni);
 	ntfs_attr_free(&v->lcnbmp_na);
@@ -211,9 +234,20 @@ static int __ntfs_volume_release(ntfs_volume *v)
 	}
 
 	ntfs_free_lru_caches(v);
+	ntfs_free_case_indexes(v);
+	ntfs_pool_release(&v->inode_pool);
+	ntfs_pool_release(&v->attr_pool);
+	ntfs_pool_release(&v->ctx_pool);
+	ntfs_pool_release(&v->icx_pool);
+	ntfs_pool_release(&v->mrec_pool);
 	free(v->vol_name);
-	free(v->upcase);
-	if (v->locase) free(v->locase);
+	free(v->lcn_free_map);
+	free(v->lcnbmp_cache);
+	free(v->free_queue);
+	if (!ntfs_case_table_is_shared(v->upcase))
+		free(v->upcase);
+	if (v->locase && !ntfs_case_table_is_shared(v->locase))
+		free(v->locase);
 	free(v->attrdef);
 	free(v);
 
@@ -262,7 +296,7 @@ static int ntfs_mft_load(ntfs_volume *vol)
 
 	/* Manually setup an ntfs_inode. */
 	vol->mft_ni = ntfs_inode_allocate(vol);
-	mb = ntfs_malloc(vol->mft_record_size);
+	mb = ntfs_pool_get(&vol->mrec_pool);
 	if (!vol->mft_ni || !mb) {
 		ntfs_log_perror("Error allocating memory for $MFT");
 		goto error_exit;
@@ -362,6 +396,7 @@ mft_has_no_attr_list:
 		 * as we have exclusive access to the inode at this time and we
 		 * are a mount in progress task, too.
 		 */
+		vol->mft_na->rl_cursor = NULL;
 		nrl = ntfs_mapping_pairs_decompress(vol, a, vol->mft_na->rl);
 		if (!nrl) {
 			ntfs_log_perror("ntfs_mapping_pairs_decompress() failed");
@@ -486,6 +521,23 @@ error_exit:
 	return -1;
 }
 
+/*
+ *		End a phase of mounting, charging it the time and i/o
+ *	since the previous one
+ *
+ *	Devices which do not time mounts just fail the request, which
+ *	is ignored.
+ */
+
+static void ntfs_mount_phase(struct ntfs_device *dev, int phase)
+{
+	int olderrno;
+
+	olderrno = errno;
+	dev->d_ops->ioctl(dev, NTFS_IOC_MOUNT_PHASE, &phase);
+	errno = olderrno;
+}
+
 /**
  * ntfs_volume_startup - allocate and setup an ntfs volume
  * @dev:	device to open
@@ -522,10 +574,11 @@ ntfs_volume *ntfs_volume_startup(struct ntfs_device *dev,
 	if (!vol)
 		goto error_exit;
 	
-	/* Create the default upcase table. */
-	vol->upcase_len = ntfs_upcase_build_default(&vol->upcase);
-	if (!vol->upcase_len || !vol->upcase)
+	/* Use the default upcase table until $UpCase is loaded. */
+	vol->upcase = ntfs_upcase_shared();
+	if (!vol->upcase)
 		goto error_exit;
+	vol->upcase_len = 65536;
 
 	/* Default with no locase table and case sensitive file names */
 	vol->locase = (ntfschar*)NULL;
@@ -563,6 +616,7 @@ ntfs_volume *ntfs_volume_startup(struct ntfs_device *dev,
 	}
 	/* Attach the device to the volume. */
 	vol->dev = dev;
+	ntfs_mount_phase(dev, NTFS_PHASE_OPEN);
 	
 	/* Now read the bootsector. */
 	br = ntfs_pread(dev, 0, sizeof(NTFS_BOOT_SECTOR), bs);
@@ -581,6 +635,7 @@ ntfs_volume *ntfs_volume_startup(struct ntfs_device *dev,
 	}
 	if (ntfs_boot_sector_parse(vol, bs) < 0)
 		goto error_exit;
+	ntfs_pool_init(&vol->mrec_pool, vol->mft_record_size, POOL_DEPTH);
 	
 	free(bs);
 	bs = NULL;
@@ -648,17 +703,21 @@ ntfs_volume *ntfs_volume_startup(struct ntfs_device *dev,
 	 * The cluster allocator is now fully operational.
 	 */
 
+	ntfs_mount_phase(dev, NTFS_PHASE_BOOT);
+
 	/* Need to setup $MFT so we can use the library read functions. */
 	if (ntfs_mft_load(vol) < 0) {
 		ntfs_log_perror("Failed to load $MFT");
 		goto error_exit;
 	}
+	ntfs_mount_phase(dev, NTFS_PHASE_MFT);
 
 	/* Need to setup $MFTMirr so we can use the write functions, too. */
 	if (ntfs_mftmirr_load(vol) < 0) {
 		ntfs_log_perror("Failed to load $MFTMirr");
 		goto error_exit;
 	}
+	ntfs_mount_phase(dev, NTFS_PHASE_MFTMIRR);
 	return vol;
 error_exit:
 	eo = errno;
@@ -913,51 +972,19 @@ static int fix_txf_data(ntfs_volume *vol)
 	return (res);
 }
 
-/**
- * ntfs_device_mount - open ntfs volume
- * @dev:	device to open
- * @flags:	optional mount flags
- *
- * This function mounts an ntfs volume. @dev should describe the device which
- * to mount as the ntfs volume.
- *
- * @flags is an optional second parameter. The same flags are used as for
- * the mount system call (man 2 mount). Currently only the following flag
- * is implemented:
- *	NTFS_MNT_RDONLY	- mount volume read-only
- *
- * The function opens the device @dev and verifies that it contains a valid
- * bootsector. Then, it allocates an ntfs_volume structure and initializes
- * some of the values inside the structure from the information stored in the
- * bootsector. It proceeds to load the necessary system files and completes
- * setting up the structure.
+/*
+ *		Load data from $MFT and $MFTMirr and compare the contents
  *
- * Return the allocated volume structure on success and NULL on error with
- * errno set to the error code.
+ *	Returns 0 if the mirror matches, -1 with errno set otherwise.
  */
-ntfs_volume *ntfs_device_mount(struct ntfs_device *dev, ntfs_mount_flags flags)
+
+static int ntfs_mftmirr_compare(ntfs_volume *vol)
 {
 	s64 l;
-	ntfs_volume *vol;
-	u8 *m = NULL, *m2 = NULL;
-	ntfs_attr_search_ctx *ctx = NULL;
-	ntfs_inode *ni;
-	ntfs_attr *na;
-	ATTR_RECORD *a;
-	VOLUME_INFORMATION *vinf;
-	ntfschar *vname;
+	u8 *m, *m2;
 	u32 record_size;
-	int i, j, eo;
-	unsigned int k;
-	u32 u;
-	BOOL need_fallback_ro;
-
-	need_fallback_ro = FALSE;
-	vol = ntfs_volume_startup(dev, flags);
-	if (!vol)
-		return NULL;
+	int i, eo;
 
-	/* Load data from $MFT and $MFTMirr and compare the contents. */
 	m  = ntfs_malloc(vol->mftmirr_size << vol->mft_record_size_bits);
 	m2 = ntfs_malloc(vol->mftmirr_size << vol->mft_record_size_bits);
 	if (!m || !m2)
@@ -1049,7 +1076,269 @@ ntfs_volume *ntfs_device_mount(struct ntfs_device *dev, ntfs_mount_flags flags)
 
 	free(m2);
 	free(m);
-	m = m2 = NULL;
+	return (0);
+io_error_exit:
+	errno = EIO;
+error_exit:
+	eo = errno;
+	free(m2);
+	free(m);
+	errno = eo;
+	return (-1);
+}
+
+/*
+ *		Read the upcase table from $UpCase/$DATA
+ *
+ *	The table is compared to the default one as it is read, and
+ *	only copied for this volume if it differs, otherwise the volume
+ *	keeps using the shared default table.
+ *
+ *	Returns 0 if successful, -1 with errno set otherwise.
+ */
+
+static int ntfs_upcase_load(ntfs_volume *vol, ntfs_attr *na)
+{
+	ntfschar *uc;
+	u8 *buf;
+	s64 pos;
+	s64 count;
+	s64 l;
+
+	pos = 0;
+	if (vol->upcase_len == na->data_size >> 1) {
+		buf = ntfs_malloc(UPCASE_CHUNK_SIZE);
+		if (!buf)
+			return (-1);
+		while (pos < na->data_size) {
+			count = na->data_size - pos;
+			if (count > UPCASE_CHUNK_SIZE)
+				count = UPCASE_CHUNK_SIZE;
+			l = ntfs_attr_pread(na, pos, count, buf);
+			if (l != count) {
+				ntfs_log_error("Failed to read $UpCase, "
+					"unexpected length (%lld != %lld).\n",
+					(long long)l, (long long)count);
+				free(buf);
+				errno = EIO;
+				return (-1);
+			}
+			if (memcmp(buf, (u8*)vol->upcase + pos, count))
+				break;
+			pos += count;
+		}
+		free(buf);
+		if (pos >= na->data_size)
+			return (0);
+	}
+		/* not the default table, keep a copy for the volume */
+	uc = ntfs_malloc(na->data_size);
+	if (!uc)
+		return (-1);
+	memcpy(uc, vol->upcase, pos);
+	l = ntfs_attr_pread(na, pos, na->data_size - pos, (u8*)uc + pos);
+	if (l != na->data_size - pos) {
+		ntfs_log_error("Failed to read $UpCase, unexpected length "
+			       "(%lld != %lld).\n", (long long)l,
+			       (long long)(na->data_size - pos));
+		free(uc);
+		errno = EIO;
+		return (-1);
+	}
+	vol->upcase = uc;
+	vol->upcase_len = na->data_size >> 1;
+	return (0);
+}
+
+/*
+ *		Load the attribute definitions from $AttrDef
+ *
+ *	Done at mount time, or on first use after a fast mount.
+ *	Returns 0 if successful, -1 with errno set otherwise.
+ */
+
+int ntfs_volume_load_attrdef(ntfs_volume *vol)
+{
+	ntfs_inode *ni;
+	ntfs_attr *na;
+	ATTR_DEF *attrdef;
+	s64 l;
+	int res;
+
+	ntfs_log_debug("Loading $AttrDef...\n");
+	res = -1;
+	ni = ntfs_inode_open(vol, FILE_AttrDef);
+	if (!ni) {
+		ntfs_log_perror("Failed to open $AttrDef");
+		return (-1);
+	}
+	/* Get an ntfs attribute for $AttrDef/$DATA. */
+	na = ntfs_attr_open(ni, AT_DATA, AT_UNNAMED, 0);
+	if (!na) {
+		ntfs_log_perror("Failed to open ntfs attribute");
+		ntfs_inode_close(ni);
+		return (-1);
+	}
+	/* Check we don't overflow 24-bits. */
+	if ((u64)na->data_size > 0xffffffLL) {
+		ntfs_log_error("Attribute definition table is too big (max "
+			       "24-bit allowed).\n");
+		errno = EINVAL;
+	} else {
+		attrdef = ntfs_malloc(na->data_size);
+		if (attrdef) {
+			/* Read in the $DATA attribute value into the buffer. */
+			l = ntfs_attr_pread(na, 0, na->data_size, attrdef);
+			if (l != na->data_size) {
+				ntfs_log_error("Failed to read $AttrDef, "
+					"unexpected length (%lld != %lld).\n",
+					(long long)l,
+					(long long)na->data_size);
+				free(attrdef);
+				errno = EIO;
+			} else {
+				vol->attrdef = attrdef;
+				vol->attrdef_len = na->data_size;
+				res = 0;
+			}
+		}
+	}
+	/* Done with the $AttrDef mft record. */
+	ntfs_attr_close(na);
+	if (ntfs_inode_close(ni)) {
+		ntfs_log_perror("Failed to close $AttrDef");
+		res = -1;
+	}
+	return (res);
+}
+
+/*
+ *		Check for a dirty logfile and hibernated Windows
+ *
+ *	Sets *need_fallback_ro when the volume may only be used read-only.
+ *	Returns -1 with errno set if it cannot be used at all.
+ */
+
+static int ntfs_volume_check_clean(ntfs_volume *vol, ntfs_mount_flags flags,
+			BOOL *need_fallback_ro)
+{
+	if (!(flags & NTFS_MNT_IGNORE_HIBERFILE) &&
+	    ntfs_volume_check_hiberfile(vol, 1) < 0) {
+		if (flags & NTFS_MNT_MAY_RDONLY)
+			*need_fallback_ro = TRUE;
+		else
+			return (-1);
+	}
+	if (ntfs_volume_check_logfile(vol) < 0) {
+		/* Always reject cached metadata for now */
+		if (!(flags & NTFS_MNT_RECOVER) || (errno == EPERM)) {
+			if (flags & NTFS_MNT_MAY_RDONLY)
+				*need_fallback_ro = TRUE;
+			else
+				return (-1);
+		} else {
+			ntfs_log_info("The file system wasn't safely "
+				      "closed on Windows. Fixing.\n");
+			if (ntfs_logfile_reset(vol))
+				return (-1);
+		}
+	}
+	/*
+	 * make $TXF_DATA resident if present on the root directory,
+	 * not when deferred, as the root may then be held open as
+	 * the current directory.
+	 */
+	if (!(flags & NTFS_MNT_FAST) && !*need_fallback_ro) {
+		if (fix_txf_data(vol))
+			return (-1);
+	}
+	return (0);
+}
+
+/*
+ *		Run the checks a fast mount left for the first write
+ *
+ *	If the volume turns out not to be safe to write to, it is
+ *	switched to read-only.
+ *
+ *	Returns 0 if writing may proceed, -1 with errno set otherwise.
+ */
+
+int ntfs_volume_check_deferred(ntfs_volume *vol)
+{
+	ntfs_mount_flags flags;
+	BOOL need_fallback_ro;
+
+	flags = vol->deferred_flags;
+	if (!flags)
+		return (0);
+		/* resetting the logfile writes, do not come back here */
+	vol->deferred_flags = 0;
+	need_fallback_ro = FALSE;
+	if (ntfs_mftmirr_compare(vol)
+	    || ntfs_volume_check_clean(vol, flags | NTFS_MNT_MAY_RDONLY,
+				&need_fallback_ro)
+	    || need_fallback_ro) {
+		ntfs_log_error("%s", fallback_readonly_msg);
+		NVolSetReadOnly(vol);
+		NDevSetReadOnly(vol->dev);
+		errno = EROFS;
+		return (-1);
+	}
+	return (0);
+}
+
+/**
+ * ntfs_device_mount - open ntfs volume
+ * @dev:	device to open
+ * @flags:	optional mount flags
+ *
+ * This function mounts an ntfs volume. @dev should describe the device which
+ * to mount as the ntfs volume.
+ *
+ * @flags is an optional second parameter. The same flags are used as for
+ * the mount system call (man 2 mount). Currently only the following flag
+ * is implemented:
+ *	NTFS_MNT_RDONLY	- mount volume read-only
+ *
+ * The function opens the device @dev and verifies that it contains a valid
+ * bootsector. Then, it allocates an ntfs_volume structure and initializes
+ * some of the values inside the structure from the information stored in the
+ * bootsector. It proceeds to load the necessary system files and completes
+ * setting up the structure.
+ *
+ * Return the allocated volume structure on success and NULL on error with
+ * errno set to the error code.
+ */
+ntfs_volume *ntfs_device_mount(struct ntfs_device *dev, ntfs_mount_flags flags)
+{
+	ntfs_volume *vol;
+	ntfs_attr_search_ctx *ctx = NULL;
+	ntfs_inode *ni;
+	ntfs_attr *na;
+	ATTR_RECORD *a;
+	VOLUME_INFORMATION *vinf;
+	ntfschar *vname;
+	int j, eo;
+	unsigned int k;
+	u32 u;
+	BOOL need_fallback_ro;
+
+	need_fallback_ro = FALSE;
+	vol = ntfs_volume_startup(dev, flags);
+	if (!vol)
+		return NULL;
+
+	/*
+	 * Compare $MFT to $MFTMirr, unless this is a fast mount, which leaves
+	 * it for the first write (and never does it when read-only).
+	 */
+	if (flags & NTFS_MNT_FAST) {
+		if (!(flags & (NTFS_MNT_RDONLY | NTFS_MNT_FORENSIC)))
+			vol->deferred_flags = flags;
+	} else if (ntfs_mftmirr_compare(vol))
+		goto error_exit;
+	ntfs_mount_phase(dev, NTFS_PHASE_MFTMIRR);
 
 	/* Now load the bitmap from $Bitmap. */
 	ntfs_log_debug("Loading $Bitmap...\n");
@@ -1071,6 +1360,7 @@ ntfs_volume *ntfs_device_mount(struct ntfs_device *dev, ntfs_mount_flags flags)
 				(long long)vol->lcnbmp_na->allocated_size);
 		goto io_error_exit;
 	}
+	ntfs_mount_phase(dev, NTFS_PHASE_BITMAP);
 
 	/* Now load the upcase table from $UpCase. */
 	ntfs_log_debug("Loading $UpCase...\n");
@@ -1097,23 +1387,8 @@ ntfs_volume *ntfs_device_mount(struct ntfs_device *dev, ntfs_mount_flags flags)
 		errno = EINVAL;
 		goto bad_upcase;
 	}
-	if (vol->upcase_len != na->data_size >> 1) {
-		vol->upcase_len = na->data_size >> 1;
-		/* Throw away default table. */
-		free(vol->upcase);
-		vol->upcase = ntfs_malloc(na->data_size);
-		if (!vol->upcase)
-			goto bad_upcase;
-	}
-	/* Read in the $DATA attribute value into the buffer. */
-	l = ntfs_attr_pread(na, 0, na->data_size, vol->upcase);
-	if (l != na->data_size) {
-		ntfs_log_error("Failed to read $UpCase, unexpected length "
-			       "(%lld != %lld).\n", (long long)l,
-			       (long long)na->data_size);
-		errno = EIO;
+	if (ntfs_upcase_load(vol, na))
 		goto bad_upcase;
-	}
 	/* Done with the $UpCase mft record. */
 	ntfs_attr_close(na);
 	if (ntfs_inode_close(ni)) {
@@ -1131,6 +1406,7 @@ ntfs_volume *ntfs_device_mount(struct ntfs_device *dev, ntfs_mount_flags flags)
 		ntfs_log_error("Corrupted file $UpCase\n");
 		goto io_error_exit;
 	}
+	ntfs_mount_phase(dev, NTFS_PHASE_UPCASE);
 
 	/*
 	 * Now load $Volume and set the version information and flags in the
@@ -1235,82 +1511,28 @@ ntfs_volume *ntfs_device_mount(struct ntfs_device *dev, ntfs_mount_flags flags)
 	}
 	ntfs_attr_put_search_ctx(ctx);
 	ctx = NULL;
-	/* Now load the attribute definitions from $AttrDef. */
-	ntfs_log_debug("Loading $AttrDef...\n");
-	ni = ntfs_inode_open(vol, FILE_AttrDef);
-	if (!ni) {
-		ntfs_log_perror("Failed to open $AttrDef");
-		goto error_exit;
-	}
-	/* Get an ntfs attribute for $AttrDef/$DATA. */
-	na = ntfs_attr_open(ni, AT_DATA, AT_UNNAMED, 0);
-	if (!na) {
-		ntfs_log_perror("Failed to open ntfs attribute");
-		goto error_exit;
-	}
-	/* Check we don't overflow 24-bits. */
-	if ((u64)na->data_size > 0xffffffLL) {
-		ntfs_log_error("Attribute definition table is too big (max "
-			       "24-bit allowed).\n");
-		errno = EINVAL;
-		goto error_exit;
-	}
-	vol->attrdef_len = na->data_size;
-	vol->attrdef = ntfs_malloc(na->data_size);
-	if (!vol->attrdef)
-		goto error_exit;
-	/* Read in the $DATA attribute value into the buffer. */
-	l = ntfs_attr_pread(na, 0, na->data_size, vol->attrdef);
-	if (l != na->data_size) {
-		ntfs_log_error("Failed to read $AttrDef, unexpected length "
-			       "(%lld != %lld).\n", (long long)l,
-			       (long long)na->data_size);
-		errno = EIO;
-		goto error_exit;
-	}
-	/* Done with the $AttrDef mft record. */
-	ntfs_attr_close(na);
-	if (ntfs_inode_close(ni)) {
-		ntfs_log_perror("Failed to close $AttrDef");
+	ntfs_mount_phase(dev, NTFS_PHASE_VOLUME);
+	/*
+	 * Now load the attribute definitions from $AttrDef, only needed
+	 * when attributes are created or resized.
+	 */
+	if (!(flags & NTFS_MNT_FAST) && ntfs_volume_load_attrdef(vol))
 		goto error_exit;
-	}
+	ntfs_mount_phase(dev, NTFS_PHASE_ATTRDEF);
 
 	/* Open $Secure. */
 	if (ntfs_open_secure(vol))
 		goto error_exit;
+	ntfs_mount_phase(dev, NTFS_PHASE_SECURE);
 
 	/*
 	 * Check for dirty logfile and hibernated Windows.
 	 * We care only about read-write mounts.
 	 */
-	if (!(flags & (NTFS_MNT_RDONLY | NTFS_MNT_FORENSIC))) {
-		if (!(flags & NTFS_MNT_IGNORE_HIBERFILE) &&
-		    ntfs_volume_check_hiberfile(vol, 1) < 0) {
-			if (flags & NTFS_MNT_MAY_RDONLY)
-				need_fallback_ro = TRUE;
-			else
-				goto error_exit;
-			}
-		if (ntfs_volume_check_logfile(vol) < 0) {
-			/* Always reject cached metadata for now */
-			if (!(flags & NTFS_MNT_RECOVER) || (errno == EPERM)) {
-				if (flags & NTFS_MNT_MAY_RDONLY)
-					need_fallback_ro = TRUE;
-				else
-					goto error_exit;
-			} else {
-				ntfs_log_info("The file system wasn't safely "
-					      "closed on Windows. Fixing.\n");
-				if (ntfs_logfile_reset(vol))
-					goto error_exit;
-			}
-		}
-		/* make $TXF_DATA resident if present on the root directory */
-		if (!(flags & NTFS_MNT_RDONLY) && !need_fallback_ro) {
-			if (fix_txf_data(vol))
-				goto error_exit;
-		}
-	}
+	if (!(flags & (NTFS_MNT_RDONLY | NTFS_MNT_FORENSIC | NTFS_MNT_FAST))
+	    && ntfs_volume_check_clean(vol, flags, &need_fallback_ro))
+		goto error_exit;
+	ntfs_mount_phase(dev, NTFS_PHASE_LOGFILE);
 	if (need_fallback_ro) {
 		NVolSetReadOnly(vol);
 		ntfs_log_error("%s", fallback_readonly_msg);
@@ -1327,8 +1549,6 @@ error_exit:
 	eo = errno;
 	if (ctx)
 		ntfs_attr_put_search_ctx(ctx);
-	free(m);
-	free(m2);
 	__ntfs_volume_release(vol);
 	errno = eo;
 	return NULL;
@@ -1374,7 +1594,10 @@ int ntfs_set_ignore_case(ntfs_volume *vol)
 
 	res = -1;
 	if (vol && vol->upcase) {
-		vol->locase = ntfs_locase_table_build(vol->upcase,
+		if (ntfs_case_table_is_shared(vol->upcase))
+			vol->locase = ntfs_locase_shared();
+		else
+			vol->locase = ntfs_locase_table_build(vol->upcase,
 					vol->upcase_len);
 		if (vol->locase) {
 			NVolClearCaseSensitive(vol);
@@ -1874,6 +2097,10 @@ int ntfs_set_locale(void)
 
 /*
  *		Feed the counts of free clusters and free mft records
+ *
+ *	Once known, the counts are kept up to date by the cluster and
+ *	mft record allocators, so this is only needed once per mount, or
+ *	to recount from the bitmaps.
  */
 
 int ntfs_volume_get_free_space(ntfs_volume *vol)
@@ -1882,7 +2109,7 @@ int ntfs_volume_get_free_space(ntfs_volume *vol)
 	int ret;
 
 	ret = -1; /* default return */
-	vol->free_clusters = ntfs_attr_get_free_bits(vol->lcnbmp_na);
+	vol->free_clusters = ntfs_cluster_count_free(vol);
 	if (vol->free_clusters < 0) {
 		ntfs_log_perror("Failed to read NTFS $Bitmap");
 	} else {
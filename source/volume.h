@@ -51,6 +51,8 @@ typedef struct _ntfs_volume ntfs_volume;
 #include "inode.h"
 #include "attrib.h"
 #include "index.h"
+#include "pool.h"
+#include "budget.h"
 
 /**
  * enum ntfs_mount_flags -
@@ -66,6 +68,9 @@ enum {
 	NTFS_MNT_EXCLUSIVE              = 0x08000000,
 	NTFS_MNT_RECOVER                = 0x10000000,
 	NTFS_MNT_IGNORE_HIBERFILE       = 0x20000000,
+	NTFS_MNT_FAST                   = 0x40000000, /* Leave the checks not
+						needed to read for the
+						first write */
 };
 typedef unsigned long ntfs_mount_flags;
 
@@ -118,6 +123,10 @@ typedef enum {
 	NV_Compression,		/* 1: allow compression */
 	NV_NoFixupWarn,		/* 1: Do not log fixup errors */
 	NV_FreeSpaceKnown,	/* 1: The free space is now known */
+	NV_Discard,		/* 1: Discard freed clusters on the device */
+	NV_LazySync,		/* 1: Keep closed inodes dirty in the cache */
+	NV_BestFit,		/* 1: Place large allocations in the smallest
+				      free extent holding them */
 } ntfs_volume_state_bits;
 
 #define  test_nvol_flag(nv, flag)	 test_bit(NV_##flag, (nv)->state)
@@ -160,6 +169,18 @@ typedef enum {
 #define NVolSetFreeSpaceKnown(nv)	  set_nvol_flag(nv, FreeSpaceKnown)
 #define NVolClearFreeSpaceKnown(nv)	clear_nvol_flag(nv, FreeSpaceKnown)
 
+#define NVolDiscard(nv)			 test_nvol_flag(nv, Discard)
+#define NVolSetDiscard(nv)		  set_nvol_flag(nv, Discard)
+#define NVolClearDiscard(nv)		clear_nvol_flag(nv, Discard)
+
+#define NVolLazySync(nv)		 test_nvol_flag(nv, LazySync)
+#define NVolSetLazySync(nv)		  set_nvol_flag(nv, LazySync)
+#define NVolClearLazySync(nv)		clear_nvol_flag(nv, LazySync)
+
+#define NVolBestFit(nv)			 test_nvol_flag(nv, BestFit)
+#define NVolSetBestFit(nv)		  set_nvol_flag(nv, BestFit)
+#define NVolClearBestFit(nv)		clear_nvol_flag(nv, BestFit)
+
 /*
  * NTFS version 1.1 and 1.2 are used by Windows NT4.
  * NTFS version 2.x is used by Windows 2000 Beta
@@ -207,6 +228,9 @@ struct _ntfs_volume {
 	u8 full_zones;		/* cluster zones which are full */
 	s64 mft_data_pos;	/* Mft record number at which to allocate the
 				   next mft record. */
+	s64 mft_grow_records;	/* Mft records $MFT/$DATA is next extended
+				   by when it fills up (0 until it first
+				   does). */
 	LCN mft_zone_start;	/* First cluster of the mft zone. */
 	LCN mft_zone_end;	/* First cluster beyond the mft zone. */
 	LCN mft_zone_pos;	/* Current position in the mft zone. */
@@ -260,10 +284,25 @@ struct _ntfs_volume {
 				   FILE_AttrDef. */
 	s32 attrdef_len;	/* Size of the attribute definition table in
 				   bytes. */
+	ntfs_mount_flags deferred_flags; /* Mount flags of the checks left
+				   for the first write, zero once done */
 
+	u8 compression_level;	/* How hard to compress data, copied into
+				   the attributes opened (see compress.h) */
 	s64 free_clusters; 	/* Track the number of free clusters which
 				   greatly improves statfs() performance */
 	s64 free_mft_records; 	/* Same for free mft records (see above) */
+	ntfs_attr *resv_list;	/* Open attributes with clusters reserved
+				   for them, see ntfs_cluster_reserve() */
+	u16 *lcn_free_map;	/* Free clusters in each group of
+				   NTFS_LCN_MAP_CLUSTERS clusters, built on the
+				   first allocation, NULL if not available */
+	s64 lcn_free_map_size;	/* Number of groups in lcn_free_map, -1 if it
+				   could not be built */
+	struct LCNBMP_CACHE *lcnbmp_cache; /* Blocks of $Bitmap updated in
+				   memory, see ntfs_cluster_bitmap_sync() */
+	struct FREE_QUEUE *free_queue; /* Freed runs not yet cleared in
+				   $Bitmap, see ntfs_cluster_free_flush() */
 	BOOL efs_raw;		/* volume is mounted for raw access to
 				   efs-encrypted files */
 	ntfs_volume_special_files special_files; /* Implementation of special files */
@@ -276,6 +315,8 @@ struct _ntfs_volume {
 #endif
 #if CACHE_NIDATA_SIZE
 	struct CACHE_HEADER *nidata_cache;
+	ntfs_inode *nidata_pending; /* Dirty inodes dropped from the cache,
+				   waiting to be written back and closed */
 #endif
 #if CACHE_LOOKUP_SIZE
 	struct CACHE_HEADER *lookup_cache;
@@ -286,6 +327,33 @@ struct _ntfs_volume {
 #if CACHE_LEGACY_SIZE
 	struct CACHE_HEADER *legacy_cache;
 #endif
+#if CACHE_MFTREC_SIZE
+	struct CACHE_HEADER *mftrec_cache;
+#endif
+#if CACHE_SDH_SIZE
+	struct CACHE_HEADER *sdh_cache;
+#endif
+#if CACHE_REPARSE_SIZE
+	struct CACHE_HEADER *reparse_cache;
+#endif
+#if CACHE_CBLOCK_SIZE
+	struct CACHE_HEADER *cblock_cache;
+#endif
+#if CACHE_CASE_INDEX_SIZE
+	struct CASE_INDEX *case_index; /* Upcased names of the directories
+				   searched while ignoring case, most
+				   recently used first */
+	size_t case_index_size; /* Bytes used by the above */
+	size_t case_index_budget; /* Bytes they may use, zero to disable */
+	struct NTFS_RECLAIMER case_index_reclaimer;
+#endif
+	struct NTFS_BUDGET *budget; /* Memory the caches draw from, NULL
+				   if not accounted for */
+	struct NTFS_POOL inode_pool; /* Freed objects kept for reuse */
+	struct NTFS_POOL attr_pool;
+	struct NTFS_POOL ctx_pool;
+	struct NTFS_POOL icx_pool;
+	struct NTFS_POOL mrec_pool; /* Set up once the record size is known */
 };
 
 extern const char *ntfs_home;
@@ -303,6 +371,8 @@ extern int ntfs_umount(ntfs_volume *vol, const BOOL force);
 
 extern int ntfs_version_is_supported(ntfs_volume *vol);
 extern int ntfs_volume_check_hiberfile(ntfs_volume *vol, int verbose);
+extern int ntfs_volume_load_attrdef(ntfs_volume *vol);
+extern int ntfs_volume_check_deferred(ntfs_volume *vol);
 extern int ntfs_logfile_reset(ntfs_volume *vol);
 
 extern int ntfs_volume_write_flags(ntfs_volume *vol, const le16 flags);